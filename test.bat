@@ -10,3 +10,5 @@
 
  out\ReleaseIA32\primordialsoup.exe out\snapshots\BenchmarkRunner.vfuel
  out\ReleaseX64\primordialsoup.exe out\snapshots\BenchmarkRunner.vfuel
+ out\ReleaseIA32\primordialsoup.exe out\snapshots\PingPongBenchmark.vfuel
+ out\ReleaseX64\primordialsoup.exe out\snapshots\PingPongBenchmark.vfuel
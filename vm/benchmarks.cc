@@ -0,0 +1,521 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+// Microbenchmarks of the VM's components, driven directly rather than through
+// Newspeak, so a change to one can be measured without the noise of the
+// interpreter around it:
+//
+//   primordialsoup_benchmarks <snapshot.vfuel> [name...]
+//
+// The components that need a heap share one deserialized from the snapshot,
+// which is also what the Deserialize benchmark reads, so compiler.vfuel is the
+// usual choice. Each benchmark is repeated until it has run for long enough
+// to time, and printed as a line of tab-separated fields:
+//
+//   name  nanoseconds per operation  operations
+
+#include "vm/globals.h"
+#if !defined(OS_EMSCRIPTEN)
+
+#include <atomic>
+#include <string.h>
+
+#include "vm/assert.h"
+#include "vm/heap.h"
+#include "vm/interpreter.h"
+#include "vm/isolate.h"
+#include "vm/lockers.h"
+#include "vm/lookup_cache.h"
+#include "vm/message_loop.h"
+#include "vm/object.h"
+#include "vm/os.h"
+#include "vm/port.h"
+#include "vm/primordial_soup.h"
+#include "vm/snapshot.h"
+#include "vm/thread.h"
+#include "vm/thread_pool.h"
+#include "vm/virtual_memory.h"
+
+namespace psoup {
+
+class Benchmarks {
+ public:
+  // The isolate is made current, as the write barrier needs, but never runs
+  // its loop.
+  Benchmarks(void* snapshot, size_t snapshot_length)
+      : snapshot_(snapshot), snapshot_length_(snapshot_length),
+        isolate_(NULL), heap_(NULL), interpreter_(NULL), sink_(0) {
+    PrimordialSoup_IsolateOptions options;
+    PrimordialSoup_DefaultIsolateOptions(&options);
+    isolate_ = new Isolate(snapshot, snapshot_length,
+                           OS::CurrentMonotonicNanos(), options);
+    heap_ = isolate_->heap();
+    interpreter_ = heap_->interpreter();
+  }
+
+  ~Benchmarks() {
+    delete isolate_;
+  }
+
+  // Answers false if no benchmark has the name.
+  bool Run(const char* name);
+  void RunAll();
+
+ private:
+  // Answers the nanoseconds n operations took.
+  typedef int64_t (Benchmarks::*Function)(intptr_t n);
+
+  struct Entry {
+    const char* name;
+    Function function;
+  };
+
+  static const Entry kEntries[];
+  static const int64_t kMinNanos = 100 * 1000 * 1000;
+  static const intptr_t kNumSelectors = 256;
+  static const intptr_t kNumClasses = 16;
+  static const intptr_t kObjectSlots = 6;
+
+  void Measure(const Entry& entry);
+
+  int64_t LookupOrdinaryHit(intptr_t n);
+  int64_t LookupOrdinaryMiss(intptr_t n);
+  int64_t LookupNSHit(intptr_t n);
+  int64_t AllocateRegularObject(intptr_t n);
+  int64_t PauseAt0(intptr_t n) { return Pauses(n, 0); }
+  int64_t PauseAt10(intptr_t n) { return Pauses(n, 10); }
+  int64_t PauseAt50(intptr_t n) { return Pauses(n, 50); }
+  int64_t PauseAt90(intptr_t n) { return Pauses(n, 90); }
+  int64_t Pauses(intptr_t n, intptr_t survival);
+  int64_t FreeListAllocate(intptr_t n);
+  int64_t Deserialize(intptr_t n);
+  int64_t PostMessage1(intptr_t n) { return PostMessages(n, 1); }
+  int64_t PostMessage4(intptr_t n) { return PostMessages(n, 4); }
+  int64_t PostMessage16(intptr_t n) { return PostMessages(n, 16); }
+  int64_t PostMessages(intptr_t n, intptr_t num_threads);
+  int64_t LargeIntegerAdd(intptr_t n) { return LargeIntegers(n, kAdd); }
+  int64_t LargeIntegerMultiply(intptr_t n) {
+    return LargeIntegers(n, kMultiply);
+  }
+  int64_t LargeIntegerDivide(intptr_t n) { return LargeIntegers(n, kDivide); }
+  int64_t LargeIntegerPrint(intptr_t n) { return LargeIntegers(n, kPrint); }
+
+  enum LargeIntegerOp { kAdd, kMultiply, kDivide, kPrint };
+  int64_t LargeIntegers(intptr_t n, LargeIntegerOp op);
+
+  Array TenuredSelectors();
+  RegularObject NewObject();
+
+  void* const snapshot_;
+  const size_t snapshot_length_;
+  Isolate* isolate_;
+  Heap* heap_;
+  Interpreter* interpreter_;
+
+  // Keeps the results from being optimized away.
+  uword sink_;
+
+  DISALLOW_COPY_AND_ASSIGN(Benchmarks);
+};
+
+
+const Benchmarks::Entry Benchmarks::kEntries[] = {
+  { "LookupCache.OrdinaryHit", &Benchmarks::LookupOrdinaryHit },
+  { "LookupCache.OrdinaryMiss", &Benchmarks::LookupOrdinaryMiss },
+  { "LookupCache.NSHit", &Benchmarks::LookupNSHit },
+  { "Heap.AllocateRegularObject", &Benchmarks::AllocateRegularObject },
+  { "Heap.PauseAt0%Survival", &Benchmarks::PauseAt0 },
+  { "Heap.PauseAt10%Survival", &Benchmarks::PauseAt10 },
+  { "Heap.PauseAt50%Survival", &Benchmarks::PauseAt50 },
+  { "Heap.PauseAt90%Survival", &Benchmarks::PauseAt90 },
+  { "FreeList.TryAllocate", &Benchmarks::FreeListAllocate },
+  { "Deserializer.Deserialize", &Benchmarks::Deserialize },
+  { "PortMap.PostMessage.1Thread", &Benchmarks::PostMessage1 },
+  { "PortMap.PostMessage.4Threads", &Benchmarks::PostMessage4 },
+  { "PortMap.PostMessage.16Threads", &Benchmarks::PostMessage16 },
+  { "LargeInteger.Add", &Benchmarks::LargeIntegerAdd },
+  { "LargeInteger.Multiply", &Benchmarks::LargeIntegerMultiply },
+  { "LargeInteger.Divide", &Benchmarks::LargeIntegerDivide },
+  { "LargeInteger.PrintString", &Benchmarks::LargeIntegerPrint },
+  { NULL, NULL },
+};
+
+
+bool Benchmarks::Run(const char* name) {
+  for (const Entry* entry = kEntries; entry->name != NULL; entry++) {
+    if (strcmp(entry->name, name) == 0) {
+      Measure(*entry);
+      return true;
+    }
+  }
+  return false;
+}
+
+
+void Benchmarks::RunAll() {
+  for (const Entry* entry = kEntries; entry->name != NULL; entry++) {
+    Measure(*entry);
+  }
+}
+
+
+void Benchmarks::Measure(const Entry& entry) {
+  (this->*entry.function)(1);  // Warm up.
+  intptr_t n = 1;
+  int64_t nanos;
+  for (;;) {
+    nanos = (this->*entry.function)(n);
+    if (nanos >= kMinNanos) {
+      break;
+    }
+    // Aim past the minimum, but grow at most a hundredfold at a time.
+    intptr_t next = (nanos <= 0) ? n * 100 : (n * kMinNanos * 2) / nanos;
+    n = (next > n * 100) ? n * 100 : (next > n ? next : n + 1);
+  }
+  OS::Print("%s\t%.1f\t%" Pd "\n", entry.name,
+            static_cast<double>(nanos) / n, n);
+}
+
+
+// Strings in old space, which stay put while nothing collects it, to stand
+// for selectors.
+Array Benchmarks::TenuredSelectors() {
+  Array selectors = heap_->AllocateArray(kNumSelectors, Heap::kTenured);
+  for (intptr_t i = 0; i < kNumSelectors; i++) {
+    selectors->set_element(i, SmallInteger::New(0), kNoBarrier);
+  }
+  HandleScope h1(heap_, reinterpret_cast<Object*>(&selectors));
+  for (intptr_t i = 0; i < kNumSelectors; i++) {
+    String selector = heap_->AllocateString(8, Heap::kTenured);
+    memset(selector->element_addr(0), 'a' + (i % 26), 8);
+    selectors->set_element(i, selector);
+  }
+  return selectors;
+}
+
+
+int64_t Benchmarks::LookupOrdinaryHit(intptr_t n) {
+  LookupCache cache;
+  Array selectors = TenuredSelectors();
+  for (intptr_t i = 0; i < kNumSelectors; i++) {
+    String selector = static_cast<String>(selectors->element(i));
+    cache.InsertOrdinary(kFirstRegularObjectCid + (i % kNumClasses),
+                         selector, static_cast<Method>(selector));
+  }
+  Method target;
+  uword sum = 0;
+  int64_t start = OS::CurrentMonotonicNanos();
+  for (intptr_t i = 0; i < n; i++) {
+    intptr_t j = i & (kNumSelectors - 1);
+    if (cache.LookupOrdinary(kFirstRegularObjectCid + (j % kNumClasses),
+                             static_cast<String>(selectors->element(j)),
+                             &target)) {
+      sum += static_cast<uword>(target);
+    }
+  }
+  int64_t nanos = OS::CurrentMonotonicNanos() - start;
+  sink_ += sum;
+  return nanos;
+}
+
+
+int64_t Benchmarks::LookupOrdinaryMiss(intptr_t n) {
+  LookupCache cache;
+  Array selectors = TenuredSelectors();
+  Method target;
+  uword sum = 0;
+  int64_t start = OS::CurrentMonotonicNanos();
+  for (intptr_t i = 0; i < n; i++) {
+    intptr_t j = i & (kNumSelectors - 1);
+    if (!cache.LookupOrdinary(kFirstRegularObjectCid + (j % kNumClasses),
+                              static_cast<String>(selectors->element(j)),
+                              &target)) {
+      sum++;
+    }
+  }
+  int64_t nanos = OS::CurrentMonotonicNanos() - start;
+  sink_ += sum;
+  return nanos;
+}
+
+
+int64_t Benchmarks::LookupNSHit(intptr_t n) {
+  LookupCache cache;
+  Array selectors = TenuredSelectors();
+  // The selectors also stand for the callers and the absent receivers.
+  for (intptr_t i = 0; i < kNumSelectors; i++) {
+    String selector = static_cast<String>(selectors->element(i));
+    Method caller = static_cast<Method>(
+        selectors->element((i + 1) & (kNumSelectors - 1)));
+    cache.InsertNS(kFirstRegularObjectCid + (i % kNumClasses), selector,
+                   caller, kImplicitReceiver, selector,
+                   static_cast<Method>(selector));
+  }
+  Object absent_receiver;
+  Method target;
+  uword sum = 0;
+  int64_t start = OS::CurrentMonotonicNanos();
+  for (intptr_t i = 0; i < n; i++) {
+    intptr_t j = i & (kNumSelectors - 1);
+    Method caller = static_cast<Method>(
+        selectors->element((j + 1) & (kNumSelectors - 1)));
+    if (cache.LookupNS(kFirstRegularObjectCid + (j % kNumClasses),
+                       static_cast<String>(selectors->element(j)),
+                       caller, kImplicitReceiver,
+                       &absent_receiver, &target)) {
+      sum += static_cast<uword>(target);
+    }
+  }
+  int64_t nanos = OS::CurrentMonotonicNanos() - start;
+  sink_ += sum;
+  return nanos;
+}
+
+
+// An instance of nil's class, which the snapshot registered, with more slots.
+RegularObject Benchmarks::NewObject() {
+  Object nil = interpreter_->nil_obj();
+  RegularObject object =
+      heap_->AllocateRegularObject(nil->ClassId(), kObjectSlots);
+  for (intptr_t i = 0; i < kObjectSlots; i++) {
+    object->set_slot(i, nil, kNoBarrier);
+  }
+  return object;
+}
+
+
+int64_t Benchmarks::AllocateRegularObject(intptr_t n) {
+  uword sum = 0;
+  int64_t start = OS::CurrentMonotonicNanos();
+  for (intptr_t i = 0; i < n; i++) {
+    sum += static_cast<uword>(NewObject());
+  }
+  int64_t nanos = OS::CurrentMonotonicNanos() - start;
+  sink_ += sum;
+  return nanos;
+}
+
+
+// The GC pauses while allocating with survival percent of what is allocated
+// between scavenges of the initial semispace still reachable at the next: a
+// ring of the objects kept, each slot overwritten once per semispace. What
+// survives two scavenges is tenured, and so mark-sweeps are among the pauses.
+// Answers their nanoseconds, not the allocation's.
+int64_t Benchmarks::Pauses(intptr_t n, intptr_t survival) {
+  const intptr_t object_size =
+      AllocationSize(kObjectSlots * sizeof(Object) + sizeof(HeapObject::Layout));
+  const intptr_t per_semispace = Heap::kInitialSemispaceCapacity / object_size;
+  intptr_t ring_size = per_semispace * survival / 100;
+  Array ring = heap_->AllocateArray(ring_size + 1, Heap::kTenured);
+  for (intptr_t i = 0; i <= ring_size; i++) {
+    ring->set_element(i, SmallInteger::New(0), kNoBarrier);
+  }
+  HandleScope h1(heap_, reinterpret_cast<Object*>(&ring));
+
+  GCTrace* trace = heap_->trace();
+  int64_t pauses = trace->pauses();
+  int64_t pause_nanos = trace->pause_nanos();
+  intptr_t kept = 0;
+  for (intptr_t i = 0; trace->pauses() - pauses < n; i++) {
+    RegularObject object = NewObject();
+    if ((ring_size > 0) && ((i % 100) < survival)) {
+      ring->set_element(kept, object);
+      kept = (kept + 1) % ring_size;
+    }
+  }
+  return trace->pause_nanos() - pause_nanos;
+}
+
+
+// Allocations in old space once a mark-sweep has left it a checkerboard of
+// free chunks, which the free list hands out as the sweep finds them.
+int64_t Benchmarks::FreeListAllocate(intptr_t n) {
+  Array kept = heap_->AllocateArray(n, Heap::kTenured);
+  for (intptr_t i = 0; i < n; i++) {
+    kept->set_element(i, SmallInteger::New(0), kNoBarrier);
+  }
+  HandleScope h1(heap_, reinterpret_cast<Object*>(&kept));
+  for (intptr_t i = 0; i < 2 * n; i++) {
+    Array object = heap_->AllocateArray(kObjectSlots, Heap::kTenured);
+    for (intptr_t j = 0; j < kObjectSlots; j++) {
+      object->set_element(j, SmallInteger::New(0), kNoBarrier);
+    }
+    if ((i & 1) == 0) {
+      kept->set_element(i / 2, object);
+    }
+  }
+  heap_->CollectAll(Heap::kPrimitive);
+
+  uword sum = 0;
+  int64_t start = OS::CurrentMonotonicNanos();
+  for (intptr_t i = 0; i < n; i++) {
+    Array object = heap_->AllocateArray(kObjectSlots, Heap::kTenured);
+    for (intptr_t j = 0; j < kObjectSlots; j++) {
+      object->set_element(j, SmallInteger::New(0), kNoBarrier);
+    }
+    sum += static_cast<uword>(object);
+  }
+  int64_t nanos = OS::CurrentMonotonicNanos() - start;
+  sink_ += sum;
+  return nanos;
+}
+
+
+int64_t Benchmarks::Deserialize(intptr_t n) {
+  int64_t nanos = 0;
+  for (intptr_t i = 0; i < n; i++) {
+    int64_t start = OS::CurrentMonotonicNanos();
+    // A heap of no isolate, since the isolates' constructor copies an image
+    // of a snapshot it has already read.
+    Heap* heap = new Heap();
+    Interpreter* interpreter = new Interpreter(
+        heap, NULL, Interpreter::kDefaultStackSize, 1);
+    {
+      Deserializer deserializer(heap, snapshot_, snapshot_length_);
+      deserializer.Deserialize();
+    }
+    nanos += OS::CurrentMonotonicNanos() - start;
+    delete heap;
+    delete interpreter;
+  }
+  return nanos;
+}
+
+
+class PostTask : public ThreadPool::Task {
+ public:
+  PostTask(Port port, intptr_t count, std::atomic<bool>* start,
+           Monitor* monitor, intptr_t* running)
+      : port_(port), count_(count), start_(start),
+        monitor_(monitor), running_(running) {}
+
+  void Run() {
+    while (!start_->load(std::memory_order_acquire)) {
+      Thread::YieldTimeslice();
+    }
+    for (intptr_t i = 0; i < count_; i++) {
+      PortMap::PostMessage(new IsolateMessage(port_, static_cast<uint8_t*>(NULL), 0));
+    }
+    MonitorLocker ml(monitor_);
+    if (--(*running_) == 0) {
+      ml.NotifyAll();
+    }
+  }
+
+ private:
+  Port port_;
+  intptr_t count_;
+  std::atomic<bool>* start_;
+  Monitor* monitor_;
+  intptr_t* running_;
+
+  DISALLOW_COPY_AND_ASSIGN(PostTask);
+};
+
+
+// Threads posting to one port together, contending for its shard's lock and
+// its loop's queue. The messages wait, unread, until the loop is deleted.
+int64_t Benchmarks::PostMessages(intptr_t n, intptr_t num_threads) {
+  MessageLoop* loop = MessageLoop::New(NULL, NULL);
+  Port port = PortMap::CreatePort(loop);
+  ThreadPool pool;
+  Monitor monitor;
+  std::atomic<bool> start(false);
+  intptr_t running = num_threads;
+  for (intptr_t i = 0; i < num_threads; i++) {
+    intptr_t count = n / num_threads + (i < n % num_threads ? 1 : 0);
+    pool.Run(new PostTask(port, count, &start, &monitor, &running));
+  }
+
+  int64_t begin = OS::CurrentMonotonicNanos();
+  start.store(true, std::memory_order_release);
+  {
+    MonitorLocker ml(&monitor);
+    while (running > 0) {
+      ml.Wait();
+    }
+  }
+  int64_t nanos = OS::CurrentMonotonicNanos() - begin;
+
+  PortMap::ClosePort(port);
+  delete loop;
+  return nanos;
+}
+
+
+// Operations on integers of about a thousand bits, where the digit loops
+// dominate.
+int64_t Benchmarks::LargeIntegers(intptr_t n, LargeIntegerOp op) {
+  LargeInteger left = LargeInteger::Expand(SmallInteger::New(123456789), heap_);
+  HandleScope h1(heap_, reinterpret_cast<Object*>(&left));
+  for (intptr_t i = 0; i < 5; i++) {
+    left = LargeInteger::Multiply(left, left, heap_);
+  }
+  LargeInteger right = LargeInteger::Expand(SmallInteger::New(987654321), heap_);
+  HandleScope h2(heap_, reinterpret_cast<Object*>(&right));
+  for (intptr_t i = 0; i < 4; i++) {
+    right = LargeInteger::Multiply(right, right, heap_);
+  }
+
+  uword sum = 0;
+  int64_t start = OS::CurrentMonotonicNanos();
+  for (intptr_t i = 0; i < n; i++) {
+    switch (op) {
+      case kAdd:
+        sum += LargeInteger::Add(left, right, heap_)->size();
+        break;
+      case kMultiply:
+        sum += LargeInteger::Multiply(left, right, heap_)->size();
+        break;
+      case kDivide:
+        sum += LargeInteger::Divide(LargeInteger::kTruncated,
+                                    LargeInteger::kQuoitent,
+                                    left, right, heap_)->size();
+        break;
+      case kPrint:
+        sum += LargeInteger::PrintString(left, heap_)->Size();
+        break;
+    }
+  }
+  int64_t nanos = OS::CurrentMonotonicNanos() - start;
+  sink_ += sum;
+  return nanos;
+}
+
+}  // namespace psoup
+
+
+int main(int argc, const char** argv) {
+  if (argc < 2) {
+    psoup::OS::PrintErr("Usage: %s <snapshot.vfuel> [benchmark...]\n",
+                        argv[0]);
+    return -1;
+  }
+
+  psoup::VirtualMemory snapshot = psoup::VirtualMemory::MapReadOnly(argv[1]);
+  PrimordialSoup_Startup();
+
+  int exit_code = 0;
+  {
+    psoup::Benchmarks benchmarks(reinterpret_cast<void*>(snapshot.base()),
+                                 snapshot.size());
+    if (argc == 2) {
+      benchmarks.RunAll();
+    }
+    for (int i = 2; i < argc; i++) {
+      if (!benchmarks.Run(argv[i])) {
+        psoup::OS::PrintErr("Unknown benchmark: %s\n", argv[i]);
+        exit_code = -1;
+      }
+    }
+  }
+
+  PrimordialSoup_Shutdown();
+#if !defined(OS_WINDOWS)
+  snapshot.Free();
+#endif
+  return exit_code;
+}
+
+#endif  // !defined(OS_EMSCRIPTEN)
@@ -0,0 +1,138 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/flags.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm/assert.h"
+#include "vm/globals.h"
+#include "vm/os.h"
+
+namespace psoup {
+
+#define DEFINE_FLAG(name, comment) bool FLAG_##name = false;
+FLAG_LIST(DEFINE_FLAG)
+#undef DEFINE_FLAG
+
+const char* Flags::log_file_ = NULL;
+bool Flags::output_thread_ = false;
+
+static bool ParseBool(const char* value, bool* result) {
+  if ((value == NULL) || (strcmp(value, "true") == 0)) {
+    *result = true;
+  } else if (strcmp(value, "false") == 0) {
+    *result = false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+
+struct FlagEntry {
+  const char* name;
+  bool* value;
+  const char* comment;
+};
+
+static const FlagEntry kFlags[] = {
+#define FLAG_ENTRY(name, comment) {#name, &FLAG_##name, comment},
+FLAG_LIST(FLAG_ENTRY)
+#undef FLAG_ENTRY
+};
+static const intptr_t kNumFlags = sizeof(kFlags) / sizeof(kFlags[0]);
+
+
+static bool NameEquals(const char* name, const char* argument,
+                       intptr_t length) {
+  for (intptr_t i = 0; i < length; i++) {
+    char c = (argument[i] == '-') ? '_' : argument[i];
+    if ((name[i] == 0) || (name[i] != c)) {
+      return false;
+    }
+  }
+  return name[length] == 0;
+}
+
+
+bool Flags::Parse(const char* argument) {
+  if ((argument[0] != '-') || (argument[1] != '-')) {
+    return false;
+  }
+  const char* name = argument + 2;
+  const char* equals = strchr(name, '=');
+  intptr_t length = (equals == NULL) ? strlen(name) : equals - name;
+  const char* value = (equals == NULL) ? NULL : equals + 1;
+
+  if (NameEquals("log_file", name, length)) {
+    if ((value == NULL) || (value[0] == 0)) {
+      return false;
+    }
+    log_file_ = value;
+    return true;
+  }
+  if (NameEquals("output_thread", name, length)) {
+    return ParseBool(value, &output_thread_);
+  }
+  for (intptr_t i = 0; i < kNumFlags; i++) {
+    if (NameEquals(kFlags[i].name, name, length)) {
+      return ParseBool(value, kFlags[i].value);
+    }
+  }
+  return false;
+}
+
+
+bool Flags::ParseEnvironment() {
+  const char* flags = getenv("PSOUP_FLAGS");
+  if (flags == NULL) {
+    return true;
+  }
+  // Never freed: log_file_ may point into it.
+  intptr_t length = strlen(flags);
+  char* copy = reinterpret_cast<char*>(malloc(length + 1));
+  if (copy == NULL) {
+    FATAL("Failed to copy PSOUP_FLAGS");
+  }
+  memcpy(copy, flags, length + 1);
+  char* argument = copy;
+  for (;;) {
+    while (*argument == ' ') {
+      argument++;
+    }
+    if (*argument == 0) {
+      return true;
+    }
+    char* end = strchr(argument, ' ');
+    if (end != NULL) {
+      *end = 0;
+    }
+    if (!Parse(argument)) {
+      OS::PrintErr("Unknown flag in PSOUP_FLAGS: %s\n", argument);
+      return false;
+    }
+    if (end == NULL) {
+      return true;
+    }
+    argument = end + 1;
+  }
+}
+
+
+void Flags::PrintUsage() {
+  OS::PrintErr("Flags, before the program or in PSOUP_FLAGS:\n");
+  for (intptr_t i = 0; i < kNumFlags; i++) {
+    OS::PrintErr("  --%s\n      Logs %s.\n", kFlags[i].name, kFlags[i].comment);
+  }
+  OS::PrintErr("  --log_file=<path>\n"
+               "      Logs to the file rather than to standard error.\n");
+  OS::PrintErr("  --output_thread\n"
+               "      Writes what isolates print from a thread of its own, so "
+               "that a slow\n      reader of standard output does not block "
+               "them.\n");
+}
+
+}  // namespace psoup
@@ -6,14 +6,75 @@
 #define VM_FLAGS_H_
 
 #define LOOKUP_CACHE true
+#define INLINE_CACHE true  // Requires LOOKUP_CACHE.
 #define STATIC_PREDICTION_BYTECODES true
+#define THREADED_DISPATCH true
+#if !defined(BASELINE_JIT)
+#define BASELINE_JIT false  // Set by `scons jit=true`. X64 and ARM64 only.
+#endif
+#if !defined(IO_URING)
+#define IO_URING false  // Set by `scons io_uring=true`. Linux only.
+#endif
+#if !defined(USDT_PROBES)
+#define USDT_PROBES false  // Set by `scons usdt=true`. Linux with sys/sdt.h.
+#endif
+#if !defined(EMSCRIPTEN_THREADS)
+// Spawned isolates run on Web Workers. Set by `scons os=emscripten threads=true`.
+#define EMSCRIPTEN_THREADS false
+#endif
+#if !defined(OUT_OF_LINE_HASH)
+// Keeps identity hashes in a table of the heap's instead of object headers.
+#define OUT_OF_LINE_HASH false  // Set by `scons out_of_line_hash=true`.
+#endif
 
-#define REPORT_GC false
+// These add counters to hot paths or change what they compute, so they are
+// still chosen when building.
+#define REPORT_ACTIVATIONS false
+#define REPORT_BYTECODES false
+#define REPORT_FREELIST false
 #define TEST_SLOW_PATH false
-#define TRACE_BECOME false
-#define TRACE_DNU false
-#define TRACE_GROWTH false
-#define TRACE_PRIMITIVES false
-#define TRACE_SPECIAL_CONTROL false
+
+// Diagnostics chosen when running, with --name on the command line or in the
+// PSOUP_FLAGS environment variable. Where one is tested it costs a load and a
+// well-predicted branch while off. What they report goes to the Log.
+#define FLAG_LIST(V)                                                           \
+  V(perf_map, "the native code of each method compiled to /tmp/perf-<pid>.map " \
+              "for perf")                                                      \
+  V(report_gc, "each garbage collection, with its sizes and time")             \
+  V(report_primitives, "the calls, failures and times of each primitive, as "  \
+                       "each interpreter exits")                               \
+  V(trace_become, "each become")                                               \
+  V(trace_dnu, "each message not understood")                                  \
+  V(trace_growth, "the heap's growth and shrinking, and snapshot sizes")       \
+  V(trace_primitives, "each primitive invoked")                                \
+  V(trace_special_control, "each #cannotReturn:, #aboutToReturn:through: "      \
+                           "and #nonBooleanReceiver:")                         \
+
+namespace psoup {
+
+#define DECLARE_FLAG(name, comment) extern bool FLAG_##name;
+FLAG_LIST(DECLARE_FLAG)
+#undef DECLARE_FLAG
+
+class Flags {
+ public:
+  // Sets the flag named by an argument --name, or --name=true or =false, or
+  // --log_file=path, or --output_thread. Dashes in a name may be underscores. Answers false for
+  // anything else.
+  static bool Parse(const char* argument);
+  // Parses each argument of PSOUP_FLAGS, separated by spaces, answering false
+  // at the first it does not take.
+  static bool ParseEnvironment();
+  static void PrintUsage();
+
+  static const char* log_file() { return log_file_; }
+  static bool output_thread() { return output_thread_; }
+
+ private:
+  static const char* log_file_;
+  static bool output_thread_;
+};
+
+}  // namespace psoup
 
 #endif  // VM_FLAGS_H_
@@ -0,0 +1,164 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/gc_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm/assert.h"
+
+namespace psoup {
+
+static const char* KindToCString(GCTrace::Kind kind) {
+  switch (kind) {
+    case GCTrace::kScavenge: return "scavenge";
+    case GCTrace::kMarkSweep: return "mark-sweep";
+    case GCTrace::kStartMarking: return "start-marking";
+    case GCTrace::kMarkingStep: return "marking-step";
+    case GCTrace::kSweepStep: return "sweep-step";
+  }
+  UNREACHABLE();
+  return nullptr;
+}
+
+static const char* PhaseToCString(GCTrace::Kind kind, GCTrace::Phase phase) {
+  switch (phase) {
+    case GCTrace::kRoots: return "roots";
+    case GCTrace::kCopy: return (kind == GCTrace::kScavenge) ? "copy" : "mark";
+    case GCTrace::kEphemerons: return "ephemerons";
+    case GCTrace::kWeakMourning: return "weak";
+    case GCTrace::kClassTableMourning: return "class-table";
+    case GCTrace::kSweep: return "sweep";
+    case GCTrace::kCompact: return "compact";
+    case GCTrace::kNumPhases: break;
+  }
+  UNREACHABLE();
+  return nullptr;
+}
+
+GCTrace::GCTrace()
+    : events_(nullptr),
+      capacity_(0),
+      count_(0),
+      next_(0),
+      depth_(0),
+      current_(),
+      last_(0),
+      kind_(kScavenge),
+      pause_start_(0),
+      pauses_(0),
+      pause_nanos_(0),
+      scavenges_(0),
+      scavenge_nanos_(0),
+      mark_sweeps_(0) {
+#if defined(USE_USDT_PROBES)
+  probe_kind_ = kScavenge;
+#endif
+}
+
+GCTrace::~GCTrace() {
+  delete[] events_;
+}
+
+void GCTrace::SetCapacity(intptr_t capacity) {
+  ASSERT(depth_ == 0);
+  delete[] events_;
+  events_ = (capacity > 0) ? new Event[capacity] : nullptr;
+  capacity_ = (capacity > 0) ? capacity : 0;
+  count_ = 0;
+  next_ = 0;
+}
+
+void GCTrace::StartEvent(Kind kind, const char* reason) {
+  current_.kind = kind;
+  current_.reason = reason;
+  current_.start = pause_start_;
+  for (intptr_t i = 0; i < kNumPhases; i++) {
+    current_.phases[i] = 0;
+  }
+  last_ = current_.start;
+}
+
+#if defined(USE_USDT_PROBES)
+void GCTrace::ProbeStart(Kind kind, const char* reason) {
+  probe_kind_ = kind;
+  Probes::GCBegin(KindToCString(kind), reason);
+}
+
+void GCTrace::ProbePhase(Phase phase) {
+  Probes::GCPhase(PhaseToCString(probe_kind_, phase));
+}
+#endif
+
+void GCTrace::AddPhase(Phase phase) {
+  int64_t now = OS::CurrentMonotonicNanos();
+  current_.phases[phase] += now - last_;
+  last_ = now;
+}
+
+void GCTrace::StopEvent(int64_t duration,
+                        size_t promoted, size_t new_size, size_t old_size) {
+  current_.duration = duration;
+  current_.promoted = promoted;
+  current_.new_size = new_size;
+  current_.old_size = old_size;
+  events_[next_] = current_;
+  next_ = (next_ + 1) % capacity_;
+  if (count_ < capacity_) {
+    count_++;
+  }
+}
+
+intptr_t GCTrace::PrintEvent(char* buffer, intptr_t size, const Event& event) {
+  // Chrome's trace viewer wants microseconds.
+  intptr_t length = snprintf(
+      buffer, size,
+      "{\"name\":\"%s\",\"cat\":\"gc\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+      "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"reason\":\"%s\","
+      "\"promoted\":%" Pd ",\"new\":%" Pd ",\"old\":%" Pd,
+      KindToCString(event.kind), event.start / 1000.0,
+      event.duration / 1000.0, event.reason, event.promoted, event.new_size,
+      event.old_size);
+  for (intptr_t i = 0; i < kNumPhases; i++) {
+    length += snprintf((buffer == nullptr) ? nullptr : buffer + length,
+                       (buffer == nullptr) ? 0 : size - length,
+                       ",\"%s\":%.3f",
+                       PhaseToCString(event.kind, static_cast<Phase>(i)),
+                       event.phases[i] / 1000.0);
+  }
+  length += snprintf((buffer == nullptr) ? nullptr : buffer + length,
+                     (buffer == nullptr) ? 0 : size - length, "}}");
+  return length;
+}
+
+char* GCTrace::TakeJSON(intptr_t* length) {
+  intptr_t first = (count_ < capacity_) ? 0 : next_;
+
+  intptr_t size = 2;  // Brackets.
+  for (intptr_t i = 0; i < count_; i++) {
+    if (i != 0) size++;  // Comma.
+    size += PrintEvent(nullptr, 0, events_[(first + i) % capacity_]);
+  }
+
+  char* buffer = reinterpret_cast<char*>(malloc(size + 1));  // And NUL.
+  intptr_t pos = 0;
+  buffer[pos++] = '[';
+  for (intptr_t i = 0; i < count_; i++) {
+    if (i != 0) buffer[pos++] = ',';
+    pos += PrintEvent(buffer + pos, size + 1 - pos,
+                      events_[(first + i) % capacity_]);
+  }
+  buffer[pos++] = ']';
+  buffer[pos] = 0;
+  ASSERT(pos == size);
+
+  count_ = 0;
+  next_ = 0;
+  *length = size;
+  return buffer;
+}
+
+}  // namespace psoup
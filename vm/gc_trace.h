@@ -0,0 +1,149 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_GC_TRACE_H_
+#define VM_GC_TRACE_H_
+
+#include "vm/globals.h"
+#include "vm/os.h"
+#include "vm/probes.h"
+
+namespace psoup {
+
+// A ring buffer of the heap's pauses, each with its reason and the time spent
+// in each phase, enabled at runtime and read as Chrome trace-event JSON. When
+// the buffer is full, the oldest pause is overwritten. Disabled, recording
+// costs a branch per phase, and the clock is read as each pause starts and
+// stops to keep the count and total time of all pauses.
+class GCTrace {
+ public:
+  enum Kind {
+    kScavenge,
+    kMarkSweep,
+    kStartMarking,
+    kMarkingStep,
+    kSweepStep,
+  };
+
+  enum Phase {
+    kRoots = 0,
+    kCopy,  // Or marking, outside scavenges.
+    kEphemerons,
+    kWeakMourning,
+    kClassTableMourning,
+    kSweep,
+    kCompact,
+    kNumPhases,
+  };
+
+  static const intptr_t kMaxCapacity = 64 * KB;
+
+  GCTrace();
+  ~GCTrace();
+
+  // Keeps up to capacity pauses, discarding those kept so far. Zero disables.
+  void SetCapacity(intptr_t capacity);
+
+  // A pause begins. One started during another is folded into the outer one.
+  void Start(Kind kind, const char* reason) {
+#if defined(USE_USDT_PROBES)
+    ProbeStart(kind, reason);
+#endif
+    if (depth_++ == 0) {
+      kind_ = kind;
+      pause_start_ = OS::CurrentMonotonicNanos();
+      if (events_ != nullptr) {
+        StartEvent(kind, reason);
+      }
+    }
+  }
+  // The time since the last Start or EndPhase was spent in phase.
+  void EndPhase(Phase phase) {
+#if defined(USE_USDT_PROBES)
+    ProbePhase(phase);
+#endif
+    if ((events_ != nullptr) && (depth_ == 1)) {
+      AddPhase(phase);
+    }
+  }
+  void Stop(size_t promoted, size_t new_size, size_t old_size) {
+#if defined(USE_USDT_PROBES)
+    Probes::GCEnd();
+#endif
+    if (--depth_ == 0) {
+      int64_t duration = OS::CurrentMonotonicNanos() - pause_start_;
+      pauses_++;
+      pause_nanos_ += duration;
+      if (kind_ == kScavenge) {
+        scavenges_++;
+        scavenge_nanos_ += duration;
+      } else if (kind_ == kMarkSweep) {
+        mark_sweeps_++;
+      }
+      if (events_ != nullptr) {
+        StopEvent(duration, promoted, new_size, old_size);
+      }
+    }
+  }
+
+  // Of all pauses so far, whether or not they were kept.
+  int64_t pauses() const { return pauses_; }
+  int64_t pause_nanos() const { return pause_nanos_; }
+  // Of them, the scavenges and their time, and the full mark-sweeps, which
+  // also finish any incremental marking. The rest of the time is spent in
+  // mark-sweeps and their incremental steps.
+  int64_t scavenges() const { return scavenges_; }
+  int64_t scavenge_nanos() const { return scavenge_nanos_; }
+  int64_t mark_sweeps() const { return mark_sweeps_; }
+
+  // The pauses as a JSON array of complete events, oldest first, in a buffer
+  // for the caller to free. The pauses are then forgotten.
+  char* TakeJSON(intptr_t* length);
+
+ private:
+  struct Event {
+    Kind kind;
+    const char* reason;
+    int64_t start;
+    int64_t duration;
+    int64_t phases[kNumPhases];
+    size_t promoted;
+    size_t new_size;
+    size_t old_size;
+  };
+
+  void StartEvent(Kind kind, const char* reason);
+  void AddPhase(Phase phase);
+  void StopEvent(int64_t duration,
+                 size_t promoted, size_t new_size, size_t old_size);
+  intptr_t PrintEvent(char* buffer, intptr_t size, const Event& event);
+#if defined(USE_USDT_PROBES)
+  void ProbeStart(Kind kind, const char* reason);
+  void ProbePhase(Phase phase);
+#endif
+
+  Event* events_;
+  intptr_t capacity_;
+  intptr_t count_;  // Completed events kept.
+  intptr_t next_;  // Where the next one goes.
+  intptr_t depth_;
+  Event current_;
+  int64_t last_;  // End of the last phase.
+  Kind kind_;  // Of the outermost pause.
+  int64_t pause_start_;
+  int64_t pauses_;
+  int64_t pause_nanos_;
+  int64_t scavenges_;
+  int64_t scavenge_nanos_;
+  int64_t mark_sweeps_;
+#if defined(USE_USDT_PROBES)
+  Kind probe_kind_;  // Of the innermost pause, even while disabled.
+#endif
+
+  DISALLOW_COPY_AND_ASSIGN(GCTrace);
+};
+
+}  // namespace psoup
+
+#endif  // VM_GC_TRACE_H_
@@ -6,6 +6,7 @@
 #define VM_GLOBALS_H_
 
 #if defined(_WIN32)
+#include <winsock2.h>  // Before windows.h, which would include winsock.h.
 #include <windows.h>
 #endif  // defined(_WIN32)
 
@@ -51,6 +52,12 @@
 #error Unknown architecture.
 #endif
 
+#if defined(_M_X64) || defined(__x86_64__)
+#define ARCH_X64 1
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define ARCH_ARM64 1
+#endif
+
 
 // ATTRIBUTE_UNUSED indicates to the compiler that a variable/typedef is
 // expected to be unused and disables the related warning.
@@ -96,6 +103,7 @@
 // Integer constants.
 const int32_t kMinInt32 = 0x80000000;
 const int32_t kMaxInt32 = 0x7FFFFFFF;
+const uint16_t kMaxUint16 = 0xFFFF;
 const uint32_t kMaxUint32 = 0xFFFFFFFF;
 const int64_t kMinInt64 = PSOUP_INT64_C(0x8000000000000000);
 const int64_t kMaxInt64 = PSOUP_INT64_C(0x7FFFFFFFFFFFFFFF);
@@ -266,6 +274,15 @@ inline D bit_cast(const S& source) {
 #endif
 #endif
 
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define USING_ADDRESS_SANITIZER
+#endif
+#endif
+#if defined(__SANITIZE_ADDRESS__)
+#define USING_ADDRESS_SANITIZER
+#endif
+
 #if defined(USING_UNDEFINED_BEHAVIOR_SANITIZER)
 #define NO_SANITIZE_UNDEFINED(check) __attribute__((no_sanitize(check)))
 #else
@@ -4,24 +4,77 @@
 
 #include "vm/heap.h"
 
+#include <atomic>
+
 #include "vm/interpreter.h"
+#include "vm/lockers.h"
+#include "vm/log.h"
 #include "vm/os.h"
+#include "vm/thread.h"
+#include "vm/thread_pool.h"
 
 namespace psoup {
 
 class Region {
  public:
-  static Region* Allocate(intptr_t size) {
+  static Region* Allocate(intptr_t size, intptr_t numa_node = -1) {
     VirtualMemory memory = VirtualMemory::Allocate(size,
                                                    VirtualMemory::kReadWrite,
                                                    "primordialsoup-heap");
+    if (numa_node >= 0) {
+      memory.PreferNumaNode(numa_node);
+    }
+    return Initialize(memory);
+  }
+
+  static Region* Initialize(VirtualMemory memory) {
     Region* region = reinterpret_cast<Region*>(memory.base());
     region->memory_ = memory;
     region->object_end_ = region->object_start();
+    region->cards_ = nullptr;
+    region->num_cards_ = 0;
+    region->mapped_ = false;
+    return region;
+  }
+
+#if defined(OS_FUCHSIA)
+  // For a ByteArray whose elements are the VMO's pages, which then start on
+  // the page after its header. The region's header precedes the ByteArray's.
+  static Region* MapVmo(zx_handle_t vmo, uint64_t offset, intptr_t size,
+                        bool shared, zx_status_t* status) {
+    const intptr_t headers =
+        AllocationSize(sizeof(Region)) + sizeof(ByteArray::Layout);
+    static_assert(sizeof(ByteArray::Layout) % kObjectAlignment == 0,
+                  "Mapped elements must follow an aligned header");
+    const size_t prefix = Utils::RoundUp(headers, VirtualMemory::PageSize());
+    VirtualMemory memory = VirtualMemory::MapVmo(vmo, offset, size, prefix,
+                                                 shared, "primordialsoup-heap",
+                                                 status);
+    if (memory.size() == 0) {
+      return nullptr;
+    }
+    Region* region =
+        reinterpret_cast<Region*>(memory.base() + prefix - headers);
+    region->memory_ = memory;
+    region->object_end_ = region->object_start();
+    region->cards_ = nullptr;
+    region->num_cards_ = 0;
+    region->mapped_ = true;
     return region;
   }
+#endif
+
+  // Only for objects of at least kLargeAllocation, which are each alone in a
+  // region.
+  static Region* Of(HeapObject large) {
+    return reinterpret_cast<Region*>(large->Addr() -
+                                     AllocationSize(sizeof(Region)));
+  }
 
-  void Free() { memory_.Free(); }
+  void Free() {
+    delete[] cards_;
+    memory_.Free();
+  }
 
   uword TryAllocate(intptr_t size) {
     ASSERT(Utils::IsAligned(size, kObjectAlignment));
@@ -43,39 +96,188 @@ class Region {
   uword object_end() const { return object_end_; }
   void set_object_end(uword value) { object_end_ = value; }
 
+  void Discard(uword addr, intptr_t size) { memory_.Discard(addr, size); }
+
   size_t Size() const { return object_end() - object_start(); }
 
   Region* next() const { return next_; }
   void set_next(Region* next) { next_ = next; }
 
+  // Holds a ByteArray over a VMO, never to be evacuated.
+  bool mapped() const { return mapped_; }
+
+  // A byte per card of the large object, nonzero if dirty.
+  uint8_t* cards() const { return cards_; }
+  intptr_t num_cards() const { return num_cards_; }
+  void set_cards(uint8_t* cards, intptr_t num_cards) {
+    cards_ = cards;
+    num_cards_ = num_cards;
+  }
+
  private:
   Region* next_;
   VirtualMemory memory_;
   uword object_end_;
+  uint8_t* cards_;
+  intptr_t num_cards_;
+  bool mapped_;
 };
 
-class MarkStack {
- public:
-  void Init(uword limit) {
-    top_ = &stack_[0];
-    end_ = reinterpret_cast<HeapObject*>(limit);
+void MarkStack::Grow() {
+  intptr_t capacity = (capacity_ == 0) ? 1024 : 2 * capacity_;
+  HeapObject* stack = new HeapObject[capacity];
+  for (intptr_t i = 0; i < size_; i++) {
+    stack[i] = stack_[i];
   }
+  delete[] stack_;
+  stack_ = stack;
+  capacity_ = capacity;
+}
 
-  bool IsEmpty() const { return top_ == &stack_[0]; }
-  void Push(HeapObject obj) {
-    if (top_ == end_) {
-      FATAL("Mark stack overflow");
-    } else {
-      *top_++ = obj;
+void EphemeronIndex::Add(HeapObject key, Ephemeron ephemeron) {
+  if (2 * (used_ + 1) > capacity_) {
+    Grow();
+  }
+  intptr_t i = IndexOf(key);
+  if (keys_[i] == nullptr) {
+    keys_[i] = key;
+    used_++;
+  }
+  if (heads_[i] == nullptr) {
+    size_++;
+  }
+  ephemeron->set_next(heads_[i]);
+  heads_[i] = ephemeron;
+}
+
+Ephemeron EphemeronIndex::Take(HeapObject key) {
+  intptr_t i = IndexOf(key);
+  Ephemeron list = heads_[i];
+  if (list != nullptr) {
+    heads_[i] = nullptr;
+    size_--;
+  }
+  return list;
+}
+
+Ephemeron EphemeronIndex::TakeAll() {
+  Ephemeron list = nullptr;
+  if (used_ == 0) {
+    return list;
+  }
+  for (intptr_t i = 0; i < capacity_; i++) {
+    Ephemeron ephemeron = heads_[i];
+    while (ephemeron != nullptr) {
+      Ephemeron next = ephemeron->next();
+      ephemeron->set_next(list);
+      list = ephemeron;
+      ephemeron = next;
     }
+    keys_[i] = nullptr;
+    heads_[i] = nullptr;
   }
-  HeapObject Pop() { return *--top_; }
+  size_ = used_ = 0;
+  return list;
+}
 
- private:
-  HeapObject* top_;
-  HeapObject* end_;
-  HeapObject stack_[];
-};
+void EphemeronIndex::Grow() {
+  // Emptied keys are dropped.
+  HeapObject* old_keys = keys_;
+  Ephemeron* old_heads = heads_;
+  intptr_t old_capacity = capacity_;
+  if (capacity_ == 0) {
+    capacity_ = 1024;
+  }
+  while (2 * (size_ + 1) > capacity_ / 2) {
+    capacity_ *= 2;
+  }
+  keys_ = new HeapObject[capacity_];
+  heads_ = new Ephemeron[capacity_];
+  for (intptr_t i = 0; i < capacity_; i++) {
+    keys_[i] = nullptr;
+    heads_[i] = nullptr;
+  }
+  used_ = size_;
+  for (intptr_t i = 0; i < old_capacity; i++) {
+    if (old_heads[i] != nullptr) {
+      intptr_t j = IndexOf(old_keys[i]);
+      keys_[j] = old_keys[i];
+      heads_[j] = old_heads[i];
+    }
+  }
+  delete[] old_keys;
+  delete[] old_heads;
+}
+
+#if OUT_OF_LINE_HASH
+static HeapObject SameKey(HeapObject key) {
+  return key;
+}
+
+void IdentityHashTable::Insert(HeapObject key, intptr_t hash) {
+  if (hash == 0) {
+    if (size_ != 0) {
+      intptr_t i = IndexOf(key);
+      if (hashes_[i] != 0) {
+        hashes_[i] = 0;  // The key stays until the table is rebuilt.
+        size_--;
+      }
+    }
+    return;
+  }
+  if (2 * (used_ + 1) > capacity_) {
+    Rebuild(SameKey);
+  }
+  intptr_t i = IndexOf(key);
+  if (keys_[i] == nullptr) {
+    keys_[i] = key;
+    used_++;
+  }
+  if (hashes_[i] == 0) {
+    size_++;
+  }
+  hashes_[i] = hash;
+}
+
+void IdentityHashTable::Rekey(HeapObject (*forward)(HeapObject key)) {
+  if (used_ != 0) {
+    Rebuild(forward);
+  }
+}
+
+void IdentityHashTable::Rebuild(HeapObject (*forward)(HeapObject key)) {
+  // Removed keys are dropped.
+  HeapObject* old_keys = keys_;
+  intptr_t* old_hashes = hashes_;
+  intptr_t old_capacity = capacity_;
+  capacity_ = 1024;
+  while (2 * (size_ + 1) > capacity_ / 2) {
+    capacity_ *= 2;
+  }
+  keys_ = new HeapObject[capacity_];
+  hashes_ = new intptr_t[capacity_];
+  for (intptr_t i = 0; i < capacity_; i++) {
+    keys_[i] = nullptr;
+    hashes_[i] = 0;
+  }
+  size_ = used_ = 0;
+  for (intptr_t i = 0; i < old_capacity; i++) {
+    if (old_hashes[i] != 0) {
+      HeapObject key = forward(old_keys[i]);
+      if (key != nullptr) {
+        intptr_t j = IndexOf(key);
+        ASSERT(keys_[j] == nullptr);
+        keys_[j] = key;
+        hashes_[j] = old_hashes[i];
+        size_++;
+        used_++;
+      }
+    }
+  }
+  delete[] old_keys;
+  delete[] old_hashes;
+}
+#endif  // OUT_OF_LINE_HASH
 
 Heap::Heap() :
     top_(0),
@@ -84,11 +286,24 @@ Heap::Heap() :
     to_(),
     from_(),
     next_semispace_capacity_(kInitialSemispaceCapacity),
+    initial_semispace_capacity_(kInitialSemispaceCapacity),
+    max_semispace_capacity_(kMaxSemispaceCapacity),
+    low_survivals_(0),
     regions_(nullptr),
+    unswept_(nullptr),
     freelist_(),
     old_size_(0),
     old_capacity_(0),
     old_limit_(0),
+    old_growth_(kOldSpaceGrowth),
+    heap_limit_(0),
+    out_of_memory_(false),
+    mark_stack_(),
+    deferred_(),
+    marking_(false),
+    marking_old_size_(0),
+    marking_limit_(0),
+    marked_size_(0),
     remembered_set_(nullptr),
     remembered_set_size_(0),
     remembered_set_capacity_(0),
@@ -96,13 +311,27 @@ Heap::Heap() :
     class_table_size_(0),
     class_table_capacity_(0),
     class_table_free_(0),
+    class_table_limit_(0),
+    feedback_(nullptr),
     interpreter_(nullptr),
     handles_(),
     handles_size_(0),
     ephemeron_list_(nullptr),
-    weak_list_(nullptr) {
-  to_.Allocate(kInitialSemispaceCapacity);
-  from_.Allocate(kInitialSemispaceCapacity);
+    ephemeron_index_(),
+    weak_list_(nullptr),
+    trace_(),
+    allocation_profiler_(),
+    allocation_period_(AllocationProfiler::kNever),
+    allocation_countdown_(AllocationProfiler::kNever),
+    allocated_(0),
+    peak_size_(0),
+    thread_pool_(nullptr),
+    scavenger_workers_(1),
+    numa_node_(-1),
+    huge_pages_(false),
+    huge_chunk_() {
+  to_.Allocate(kInitialSemispaceCapacity, numa_node_, huge_pages_);
+  from_.Allocate(kInitialSemispaceCapacity, numa_node_, huge_pages_);
   top_ = to_.object_start();
   end_ = to_.limit();
 
@@ -112,6 +341,7 @@ Heap::Heap() :
   // Class table.
   class_table_capacity_ = 1024;
   class_table_ = new Object[class_table_capacity_];
+  feedback_ = new SurvivalFeedback[class_table_capacity_]();
 #if defined(DEBUG)
   for (intptr_t i = 0; i < kFirstRegularObjectCid; i++) {
     class_table_[i] = static_cast<Object>(kUninitializedWord);
@@ -121,6 +351,7 @@ Heap::Heap() :
   }
 #endif
   class_table_size_ = kFirstRegularObjectCid;
+  class_table_limit_ = 4 * class_table_capacity_;
 }
 
 Heap::~Heap() {
@@ -132,8 +363,85 @@ Heap::~Heap() {
     region->Free();
     region = next;
   }
+  region = unswept_;
+  while (region != nullptr) {
+    Region* next = region->next();
+    region->Free();
+    region = next;
+  }
+  if (huge_chunk_.size() != 0) {
+    huge_chunk_.Free();
+  }
   delete[] remembered_set_;
   delete[] class_table_;
+  delete[] feedback_;
+}
+
+void Heap::InitializeScavengerWorkers(ThreadPool* thread_pool,
+                                      intptr_t num_workers) {
+#if defined(OS_EMSCRIPTEN)
+  num_workers = 1;  // No threads.
+#endif
+  if (num_workers < 1) {
+    num_workers = 1;
+  } else if (num_workers > kMaxScavengerWorkers) {
+    num_workers = kMaxScavengerWorkers;
+  }
+  thread_pool_ = thread_pool;
+  scavenger_workers_ = (thread_pool == nullptr) ? 1 : num_workers;
+}
+
+void Heap::set_numa_node(intptr_t node) {
+  numa_node_ = node;
+  to_.memory_.PreferNumaNode(node);
+  from_.memory_.PreferNumaNode(node);
+}
+
+void Heap::set_huge_pages(bool value) {
+  ASSERT(regions_ == nullptr);
+  ASSERT(top_ == to_.object_start());
+  huge_pages_ = value;
+  size_t size = to_.size();
+  to_.Free();
+  from_.Free();
+  to_.Allocate(size, numa_node_, huge_pages_);
+  from_.Allocate(size, numa_node_, huge_pages_);
+  top_ = to_.object_start();
+  end_ = to_.limit();
+}
+
+void Heap::ConfigureSizing(size_t initial_semispace,
+                           size_t max_semispace,
+                           intptr_t old_growth,
+                           size_t limit) {
+  ASSERT(regions_ == nullptr);
+  ASSERT(top_ == to_.object_start());
+  // Large enough for any object allocated in new space.
+  initial_semispace = Utils::RoundUp(initial_semispace, kRegionSize);
+  if (initial_semispace < kRegionSize) {
+    initial_semispace = kRegionSize;
+  }
+  max_semispace = Utils::RoundUp(max_semispace, kRegionSize);
+  if (max_semispace < initial_semispace) {
+    max_semispace = initial_semispace;
+  }
+  if (old_growth < 0) {
+    old_growth = 0;
+  }
+
+  if (to_.size() != initial_semispace) {
+    to_.Free();
+    from_.Free();
+    to_.Allocate(initial_semispace, numa_node_, huge_pages_);
+    from_.Allocate(initial_semispace, numa_node_, huge_pages_);
+    top_ = to_.object_start();
+    end_ = to_.limit();
+  }
+  next_semispace_capacity_ = initial_semispace;
+  initial_semispace_capacity_ = initial_semispace;
+  max_semispace_capacity_ = max_semispace;
+  old_growth_ = old_growth;
+  heap_limit_ = limit;
 }
 
 Message Heap::AllocateMessage() {
@@ -156,6 +464,21 @@ Message Heap::AllocateMessage() {
   return static_cast<Message>(new_instance);
 }
 
+void Heap::SampleAllocation(intptr_t size, intptr_t cid) {
+  intptr_t allocated = allocation_period_ - allocation_countdown_;
+  Behavior cls = static_cast<Behavior>(class_table_[cid]);
+  Method method = nullptr;
+  bool is_closure = false;
+  intptr_t bci = 0;
+  if (interpreter_ != nullptr) {
+    interpreter_->CurrentSite(&method, &is_closure, &bci);
+  }
+  allocated_ += allocated;
+  allocation_period_ = allocation_profiler_.Record(cls, size, allocated,
+                                                   method, is_closure, bci);
+  allocation_countdown_ = allocation_period_;
+}
+
 uword Heap::AllocateNew(intptr_t size) {
   ASSERT(size < kLargeAllocation);
   uword addr = TryAllocateNew(size);
@@ -173,6 +496,12 @@ uword Heap::AllocateNew(intptr_t size) {
 }
 
 uword Heap::AllocateTenure(intptr_t size) {
+  uword result = AllocatePromotion(size);
+  PushTenureStack(result);
+  return result;
+}
+
+uword Heap::AllocatePromotion(intptr_t size) {
   ASSERT(size < kLargeAllocation);
   uword result = freelist_.TryAllocate(size);
   if (result != 0) {
@@ -181,13 +510,20 @@ uword Heap::AllocateTenure(intptr_t size) {
     result = AllocateOldSmall(size, kForceGrowth);
     ASSERT(result != 0);
   }
-  PushTenureStack(result);
   return result;
 }
 
+void Heap::ReleasePromotion(uword addr, intptr_t size) {
+  freelist_.EnqueueRange(addr, size);
+  old_size_ -= size;
+}
+
 uword Heap::AllocateOldSmall(intptr_t size, GrowthPolicy growth) {
   ASSERT(size < kLargeAllocation);
   uword addr = freelist_.TryAllocate(size);
+  while ((addr == 0) && SweepNextRegion()) {
+    addr = freelist_.TryAllocate(size);
+  }
   if (addr == 0) {
     Region* region = AllocateRegion(kRegionSize, growth);
     addr = region->TryAllocate(size);
@@ -252,7 +588,7 @@ uword Heap::AllocateSnapshotSmall(intptr_t size) {
 uword Heap::AllocateSnapshotLarge(intptr_t size) {
   ASSERT(size >= kLargeAllocation);
   uword addr;
-  Region* region = Region::Allocate(size + AllocationSize(sizeof(Region)));
+  Region* region = NewRegion(size + AllocationSize(sizeof(Region)));
   old_capacity_ += region->size();
   // Keep the current region since it likely still has free space.
   if (regions_ == nullptr) {
@@ -273,23 +609,151 @@ uword Heap::AllocateSnapshotLarge(intptr_t size) {
 }
 
 Region* Heap::AllocateRegion(intptr_t region_size, GrowthPolicy growth) {
-  if ((growth == kControlGrowth) && ((old_size_ + region_size) > old_limit_)) {
-    MarkSweep(kOldSpace);
+  if (growth == kControlGrowth) {
+    ControlGrowth(region_size);
+  }
+  Region* region = NewRegion(region_size);
+  AddRegion(region);
+  return region;
+}
+
+Region* Heap::NewRegion(intptr_t region_size) {
+  if (huge_pages_) {
+    VirtualMemory memory;
+    if (region_size == static_cast<intptr_t>(kRegionSize)) {
+      if (huge_chunk_.size() == 0) {
+        huge_chunk_ = VirtualMemory::AllocateHuge(VirtualMemory::kHugePageSize,
+                                                  "primordialsoup-heap");
+        if ((huge_chunk_.size() != 0) && (numa_node_ >= 0)) {
+          huge_chunk_.PreferNumaNode(numa_node_);
+        }
+      }
+      if (huge_chunk_.size() != 0) {
+        memory = huge_chunk_.Split(kRegionSize);
+      }
+    } else if (region_size >=
+               static_cast<intptr_t>(VirtualMemory::kHugePageSize)) {
+      memory = VirtualMemory::AllocateHuge(region_size, "primordialsoup-heap");
+      if ((memory.size() != 0) && (numa_node_ >= 0)) {
+        memory.PreferNumaNode(numa_node_);
+      }
+    } else {
+      return Region::Allocate(region_size, numa_node_);
+    }
+    if (memory.size() != 0) {
+      return Region::Initialize(memory);
+    }
+    huge_pages_ = false;  // Unsupported, so not asked for again.
+  }
+  return Region::Allocate(region_size, numa_node_);
+}
+
+void Heap::ControlGrowth(intptr_t region_size) {
+  if (marking_) {
+    IncrementalMarkingStep(kOldSpace);
+  } else if ((old_size_ + region_size) > old_limit_) {
+    StartIncrementalMarking(kOldSpace);
   }
-  Region* region = Region::Allocate(region_size);
+}
+
+void Heap::AddRegion(Region* region) {
   old_capacity_ += region->size();
   region->set_next(regions_);
   regions_ = region;
-  return region;
 }
 
+static ByteArray TransferableOf(uint8_t* bytes) {
+  ByteArray result = static_cast<ByteArray>(HeapObject::FromAddr(
+      reinterpret_cast<uword>(bytes) - sizeof(ByteArray::Layout)));
+  ASSERT(result->element_addr(0) == bytes);
+  return result;
+}
+
+uint8_t* Heap::AllocateTransferable(intptr_t num_bytes) {
+  const intptr_t heap_size =
+      AllocationSize(num_bytes * sizeof(uint8_t) + sizeof(ByteArray::Layout));
+  if (heap_size < kLargeAllocation) {
+    return nullptr;
+  }
+  Region* region = Region::Allocate(heap_size + AllocationSize(sizeof(Region)));
+  region->set_next(nullptr);
+  uword addr = region->TryAllocate(heap_size);
+  if (addr == 0) {
+    FATAL1("Failed to allocate %" Pd " bytes\n", heap_size);
+  }
+  HeapObject obj = HeapObject::Initialize(addr, kByteArrayCid, heap_size);
+  ByteArray result = static_cast<ByteArray>(obj);
+  result->set_size(SmallInteger::New(num_bytes));
+  ASSERT(result->HeapSize() == heap_size);
+  return result->element_addr(0);
+}
+
+void Heap::ShrinkTransferable(uint8_t* bytes, intptr_t num_bytes) {
+  ByteArray array = TransferableOf(bytes);
+  const intptr_t heap_size =
+      AllocationSize(num_bytes * sizeof(uint8_t) + sizeof(ByteArray::Layout));
+  ASSERT(heap_size >= kLargeAllocation);
+  ASSERT(heap_size <= array->HeapSize());
+  HeapObject obj = HeapObject::Initialize(array->Addr(), kByteArrayCid,
+                                          heap_size);
+  array = static_cast<ByteArray>(obj);
+  array->set_size(SmallInteger::New(num_bytes));
+  ASSERT(array->HeapSize() == heap_size);
+  Region::Of(array)->set_object_end(array->Addr() + heap_size);
+}
+
+void Heap::FreeTransferable(uint8_t* bytes) {
+  Region::Of(TransferableOf(bytes))->Free();
+}
+
+ByteArray Heap::AdoptTransferable(uint8_t* bytes) {
+  ByteArray result = TransferableOf(bytes);
+  Region* region = Region::Of(result);
+  ControlGrowth(region->size());  // SAFEPOINT
+  AddRegion(region);
+  old_size_ += result->HeapSize();
+  return result;
+}
+
+#if defined(OS_FUCHSIA)
+zx_status_t Heap::AllocateMappedByteArray(zx_handle_t vmo,
+                                          uint64_t offset,
+                                          intptr_t num_bytes,
+                                          bool shared,
+                                          ByteArray* result) {
+  zx_status_t status;
+  Region* region = Region::MapVmo(vmo, offset, num_bytes, shared, &status);
+  if (region == nullptr) {
+    return status;
+  }
+  const intptr_t heap_size =
+      AllocationSize(num_bytes * sizeof(uint8_t) + sizeof(ByteArray::Layout));
+  uword addr = region->TryAllocate(heap_size);
+  ASSERT(addr != 0);
+  HeapObject obj = HeapObject::Initialize(addr, kByteArrayCid, heap_size);
+  ByteArray array = static_cast<ByteArray>(obj);
+  array->set_size(SmallInteger::New(num_bytes));
+  ASSERT(array->HeapSize() == heap_size);
+  ASSERT(Utils::IsAligned(reinterpret_cast<uword>(array->element_addr(0)),
+                          VirtualMemory::PageSize()));
+  // Counted like a transferable region, so dropped mappings are collected
+  // about as soon as dropped copies would be.
+  region->set_next(nullptr);
+  ControlGrowth(region->size());  // SAFEPOINT
+  AddRegion(region);
+  old_size_ += heap_size;
+  *result = array;
+  return ZX_OK;
+}
+#endif
+
 void Heap::GrowRememberedSet() {
   // TODO(rmacnak): Investigate a limit to trigger GC instead of letting this
   // grow in an unbounded way.
   remembered_set_capacity_ += (remembered_set_capacity_ >> 1);
-  if (TRACE_GROWTH) {
-    OS::PrintErr("Growing remembered set to %" Pd "\n",
-                 remembered_set_capacity_);
+  if (FLAG_trace_growth) {
+    Log::Print("trace_growth", "Growing remembered set to %" Pd,
+               remembered_set_capacity_);
   }
   HeapObject* old_remembered_set = remembered_set_;
   remembered_set_ = new HeapObject[remembered_set_capacity_];
@@ -308,9 +772,9 @@ void Heap::ShrinkRememberedSet() {
     return;
   }
   remembered_set_capacity_ = preferred_capacity;
-  if (TRACE_GROWTH) {
-    OS::PrintErr("Shrinking remembered set to %" Pd "\n",
-                 remembered_set_capacity_);
+  if (FLAG_trace_growth) {
+    Log::Print("trace_growth", "Shrinking remembered set to %" Pd,
+               remembered_set_capacity_);
   }
   HeapObject* old_remembered_set = remembered_set_;
   remembered_set_ = new HeapObject[remembered_set_capacity_];
@@ -320,12 +784,90 @@ void Heap::ShrinkRememberedSet() {
   delete[] old_remembered_set;
 }
 
+void Heap::RememberSlot(HeapObject object, Object* slot) {
+  ASSERT(object->IsOldObject());
+  if (object->HeapSize() < kLargeAllocation) {
+    if (!object->is_remembered()) {
+      PushRememberedSet(object);
+    }
+    return;
+  }
+  uint8_t* cards = CardsOf(object);
+  cards[(reinterpret_cast<uword>(slot) - object->Addr()) / kCardSize] = 1;
+  if (!object->is_remembered()) {
+    PushRememberedSet(object);
+  }
+}
+
+void Heap::RememberRange(HeapObject object, Object* slots, intptr_t count) {
+  ASSERT(object->IsOldObject());
+  bool marking = marking_ && object->is_marked();
+  if (object->HeapSize() < kLargeAllocation) {
+    for (intptr_t i = 0; i < count; i++) {
+      Object value = slots[i];
+      if (value->IsNewObject()) {
+        if (!object->is_remembered()) {
+          PushRememberedSet(object);
+        }
+        if (!marking) {
+          return;
+        }
+      } else if (marking && value->IsOldObject()) {
+        MarkingBarrier(static_cast<HeapObject>(value));
+      }
+    }
+    return;
+  }
+
+  // Each card is dirtied at most once, skipping the rest of its slots unless
+  // marking needs to see them.
+  uint8_t* cards = nullptr;
+  const intptr_t slots_per_card = kCardSize / sizeof(Object);
+  for (intptr_t i = 0; i < count; i++) {
+    Object value = slots[i];
+    if (value->IsNewObject()) {
+      if (cards == nullptr) {
+        cards = CardsOf(object);
+        if (!object->is_remembered()) {
+          PushRememberedSet(object);
+        }
+      }
+      uword offset = reinterpret_cast<uword>(&slots[i]) - object->Addr();
+      cards[offset / kCardSize] = 1;
+      if (!marking) {
+        intptr_t card_end = (offset / kCardSize + 1) * slots_per_card -
+            offset / sizeof(Object);
+        i += card_end - 1;
+      }
+    } else if (marking && value->IsOldObject()) {
+      MarkingBarrier(static_cast<HeapObject>(value));
+    }
+  }
+}
+
+uint8_t* Heap::CardsOf(HeapObject object) {
+  ASSERT(object->HeapSize() >= kLargeAllocation);
+  Region* region = Region::Of(object);
+  ASSERT(region->object_start() == object->Addr());
+  if (region->cards() == nullptr) {
+    intptr_t num_cards = (object->HeapSize() + kCardSize - 1) / kCardSize;
+    region->set_cards(new uint8_t[num_cards](), num_cards);
+    object->set_is_carded(true);
+  }
+  return region->cards();
+}
+
+void Heap::DirtyAllCards(HeapObject object) {
+  uint8_t* cards = CardsOf(object);
+  memset(cards, 1, Region::Of(object)->num_cards());
+}
+
 void Heap::Scavenge(Reason reason) {
-#if REPORT_GC
-  int64_t start = OS::CurrentMonotonicNanos();
+  int64_t start = FLAG_report_gc ? OS::CurrentMonotonicNanos() : 0;
+  NotePeakSize();
   size_t new_before = top_ - to_.object_start();
-#endif
   size_t old_before = old_size_;
+  trace_.Start(GCTrace::kScavenge, ReasonToCString(reason));
 
   FlipSpaces();
 
@@ -336,18 +878,33 @@ void Heap::Scavenge(Reason reason) {
   interpreter_->GCPrologue();
 
   // Strong references.
-  ScavengeRoots();
-  uword scan = to_.object_start();
-  while (scan < top_ || end_ < to_.limit()) {
-    scan = ScavengeToSpace(scan);
-    ProcessTenureStack();
-    ScavengeEphemeronList();
+  if (scavenger_workers_ > 1) {
+    ParallelScavenge();
+    trace_.EndPhase(GCTrace::kCopy);  // Includes roots and ephemerons.
+  } else {
+    ScavengeRoots();
+    trace_.EndPhase(GCTrace::kRoots);
+    uword scan = to_.object_start();
+    // At least once: the remembered set may list old ephemerons when the
+    // roots copied nothing.
+    do {
+      scan = ScavengeToSpace(scan);
+      ProcessTenureStack();
+      trace_.EndPhase(GCTrace::kCopy);
+      ScavengeEphemeronList();
+      trace_.EndPhase(GCTrace::kEphemerons);
+    } while (scan < top_ || end_ < to_.limit());
   }
 
   // Weak references.
   MournEphemeronList();
   MournWeakListScavenge();
+  trace_.EndPhase(GCTrace::kWeakMourning);
   MournClassTableScavenge();
+#if OUT_OF_LINE_HASH
+  MournIdentityHashesScavenge();
+#endif
+  trace_.EndPhase(GCTrace::kClassTableMourning);
 
 #if defined(DEBUG)
   from_.MarkUnallocated();
@@ -363,22 +920,39 @@ void Heap::Scavenge(Reason reason) {
   size_t tenured = old_after - old_before;
   size_t survived = new_after + tenured;
 
+  trace_.Stop(tenured, new_after, old_after);
+
+  UpdatePretenuring();
+
   if (survived > (to_.size() / 3)) {
     next_semispace_capacity_ = to_.size() * 2;
-    if (next_semispace_capacity_ > kMaxSemispaceCapacity) {
-      next_semispace_capacity_ = kMaxSemispaceCapacity;
+    if (next_semispace_capacity_ > max_semispace_capacity_) {
+      next_semispace_capacity_ = max_semispace_capacity_;
+    }
+    low_survivals_ = 0;
+  } else if ((survived < (to_.size() / kShrinkSurvival)) &&
+             (to_.size() > initial_semispace_capacity_)) {
+    if (++low_survivals_ == kShrinkScavenges) {
+      next_semispace_capacity_ = to_.size() / 2;
+      if (next_semispace_capacity_ < initial_semispace_capacity_) {
+        next_semispace_capacity_ = initial_semispace_capacity_;
+      }
+      low_survivals_ = 0;
     }
+  } else {
+    low_survivals_ = 0;
   }
+  ShrinkNewSpace();
 
-#if REPORT_GC
-  size_t freed = (new_before + old_before) - (new_after + old_after);
-  int64_t stop = OS::CurrentMonotonicNanos();
-  int64_t time = stop - start;
-  OS::PrintErr("Scavenge (%s, %" Pd "kB new, "
-               "%" Pd "kB tenured, %" Pd "kB freed, %" Pd64 " us)\n",
+  if (FLAG_report_gc) {
+    size_t freed = (new_before + old_before) - (new_after + old_after);
+    int64_t stop = OS::CurrentMonotonicNanos();
+    int64_t time = stop - start;
+    Log::Print("report_gc", "Scavenge (%s, %" Pd "kB new, "
+               "%" Pd "kB tenured, %" Pd "kB freed, %" Pd64 " us)",
                ReasonToCString(reason), new_after / KB, tenured / KB,
                freed / KB, time / kNanosecondsPerMicrosecond);
-#endif
+  }
 
   ASSERT(reason == kNewSpace ||
          reason == kClassTable ||
@@ -386,8 +960,14 @@ void Heap::Scavenge(Reason reason) {
          reason == kSnapshotTest);
   // kClassTable and kPrimitive will follow up with a MarkSweep anyway, so don't
   // perform an extra one for tenure.
-  if ((reason == kNewSpace) && (old_size_ > old_limit_)) {
-    MarkSweep(kTenure);
+  if (reason == kNewSpace) {
+    if (marking_) {
+      IncrementalMarkingStep(kTenure);
+    } else if (old_size_ > old_limit_) {
+      StartIncrementalMarking(kTenure);
+    } else {
+      SweepStep();
+    }
   }
 }
 
@@ -396,23 +976,54 @@ void Heap::FlipSpaces() {
   to_ = from_;
   from_ = temp;
 
-  ASSERT(next_semispace_capacity_ <= kMaxSemispaceCapacity);
+  ASSERT(next_semispace_capacity_ <= max_semispace_capacity_);
   if (to_.size() < next_semispace_capacity_) {
-    if (TRACE_GROWTH && (from_.size() < next_semispace_capacity_)) {
-      OS::PrintErr("Growing new space to %" Pd "MB\n",
-                   next_semispace_capacity_ / MB);
+    if (FLAG_trace_growth && (from_.size() < next_semispace_capacity_)) {
+      Log::Print("trace_growth", "Growing new space to %" Pd "MB",
+                 next_semispace_capacity_ / MB);
     }
     to_.Free();
-    to_.Allocate(next_semispace_capacity_);
+    to_.Allocate(next_semispace_capacity_, numa_node_, huge_pages_);
   }
 
-  ASSERT(to_.size() >= from_.size());
+  // Everything allocated may survive.
+  ASSERT(top_ - from_.object_start() <= to_.size());
 
   top_ = to_.object_start();
   end_ = to_.limit();
   ASSERT((top_ & kObjectAlignmentMask) == kNewObjectAlignmentOffset);
 }
 
+void Heap::ShrinkNewSpace() {
+  // After a scavenge, while from-space is empty and the tenure stack gone.
+  ASSERT(end_ == to_.limit());
+  size_t capacity = next_semispace_capacity_;
+  if ((from_.size() <= capacity) && (to_.size() <= capacity)) {
+    return;
+  }
+  // The next scavenge may copy all that to-space allocates into the smaller
+  // from-space, so it allocates only as much, and the system may reclaim the
+  // rest, once the survivors it holds fit.
+  if (top_ > to_.base() + capacity) {
+    return;
+  }
+  if (from_.size() > capacity) {
+    from_.Free();
+    from_.Allocate(capacity, numa_node_, huge_pages_);
+#if defined(DEBUG)
+    from_.NoAccess();
+#endif
+  }
+  if (to_.size() > capacity) {
+    if (FLAG_trace_growth) {
+      Log::Print("trace_growth", "Shrinking new space to %" Pd "kB",
+                 capacity / KB);
+    }
+    end_ = to_.base() + capacity;
+    to_.memory_.Discard(end_, to_.limit() - end_);
+  }
+}
+
 static void ForwardClass(Heap* heap, HeapObject object) {
   ASSERT(object->IsHeapObject());
   Behavior old_class = heap->ClassAt(object->cid());
@@ -458,9 +1069,10 @@ void Heap::ScavengeRoots() {
   for (Object* ptr = from; ptr <= to; ptr++) {
     ScavengePointer(ptr);
   }
-  interpreter_->StackPointers(&from, &to);
-  for (Object* ptr = from; ptr <= to; ptr++) {
-    ScavengePointer(ptr);
+  for (intptr_t i = 0; interpreter_->StackPointers(i, &from, &to); i++) {
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      ScavengePointer(ptr);
+    }
   }
 }
 
@@ -536,6 +1148,11 @@ static void SetForwarded(HeapObject old_obj, HeapObject new_obj) {
   *reinterpret_cast<uword*>(old_obj->Addr()) = header;
 }
 
+static bool IsScavengeSurvivor(Object obj) {
+  return obj->IsImmediateOrOldObject() ||
+      IsForwarded(static_cast<HeapObject>(obj));
+}
+
 void Heap::ScavengePointer(Object* ptr) {
   HeapObject old_target = static_cast<HeapObject>(*ptr);
   if (old_target->IsImmediateOrOldObject()) {
@@ -554,6 +1171,7 @@ void Heap::ScavengePointer(Object* ptr) {
     uword new_target_addr;
     if (old_target->Addr() < survivor_end_) {
       new_target_addr = AllocateTenure(size);
+      feedback_[old_target->cid()].tenured++;
     } else {
       new_target_addr = TryAllocateNew(size);
     }
@@ -564,6 +1182,12 @@ void Heap::ScavengePointer(Object* ptr) {
            size);
     new_target = HeapObject::FromAddr(new_target_addr);
     SetForwarded(old_target, new_target);
+    if (marking_ && new_target->IsOldObject()) {
+      MarkTenured(new_target);
+    }
+    if (!ephemeron_index_.IsEmpty()) {
+      RequeueEphemerons(old_target);
+    }
   }
 
   DEBUG_ASSERT(new_target->IsOldObject() || InToSpace(new_target));
@@ -578,6 +1202,8 @@ void Heap::ScavengeOldObject(HeapObject obj) {
     AddToWeakList(static_cast<WeakArray>(obj));
   } else if (cid == kEphemeronCid) {
     AddToEphemeronList(static_cast<Ephemeron>(obj));
+  } else if (obj->is_carded()) {
+    ScavengeCards(obj);
   } else {
     Object* from;
     Object* to;
@@ -591,6 +1217,37 @@ void Heap::ScavengeOldObject(HeapObject obj) {
   }
 }
 
+void Heap::ScavengeCards(HeapObject obj) {
+  // Only the slots in dirty cards can point to new objects. A card stays
+  // dirty if one of them still does.
+  Region* region = Region::Of(obj);
+  uint8_t* cards = region->cards();
+  Object* from;
+  Object* to;
+  obj->Pointers(&from, &to);
+  bool remembered = false;
+  for (intptr_t i = 0; i < region->num_cards(); i++) {
+    if (cards[i] == 0) {
+      continue;
+    }
+    cards[i] = 0;
+    Object* card_from = reinterpret_cast<Object*>(obj->Addr() + i * kCardSize);
+    Object* card_to = card_from + (kCardSize / sizeof(Object)) - 1;
+    if (card_from < from) card_from = from;
+    if (card_to > to) card_to = to;
+    for (Object* ptr = card_from; ptr <= card_to; ptr++) {
+      ScavengePointer(ptr);
+      if ((*ptr)->IsNewObject()) {
+        cards[i] = 1;
+      }
+    }
+    remembered |= cards[i] != 0;
+  }
+  if (remembered) {
+    PushRememberedSet(obj);
+  }
+}
+
 void Heap::ScavengeClass(intptr_t cid) {
   ASSERT(cid < class_table_size_);
   // This is very similar to ScavengePointer.
@@ -623,100 +1280,977 @@ void Heap::ScavengeClass(intptr_t cid) {
          size);
   HeapObject new_target = HeapObject::FromAddr(new_target_addr);
   SetForwarded(old_target, new_target);
+  if (marking_ && new_target->IsOldObject()) {
+    MarkTenured(new_target);
+  }
+  if (!ephemeron_index_.IsEmpty()) {
+    RequeueEphemerons(old_target);
+  }
 }
 
-void Heap::MarkSweep(Reason reason) {
-#if REPORT_GC
-  int64_t start = OS::CurrentMonotonicNanos();
-  size_t size_before = old_size_;
-#endif
+// A work-stealing deque of objects waiting to be scanned. The owning worker
+// pushes and pops at the bottom; other workers steal from the top.
+//
+// David Chase and Yossi Lev. "Dynamic Circular Work-Stealing Deque."
+// Symposium on Parallelism in Algorithms and Architectures. 2005.
+//
+// Nhat Minh Le, Antoniu Pop, Albert Cohen and Francesco Zappa Nardelli.
+// "Correct and Efficient Work-Stealing for Weak Memory Models." Principles and
+// Practice of Parallel Programming. 2013.
+class ScavengeQueue {
+ public:
+  ScavengeQueue()
+      : top_(0), bottom_(0), buffer_(new Buffer(kInitialCapacity)) {}
+
+  ~ScavengeQueue() {
+    Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+    while (buffer != nullptr) {
+      Buffer* previous = buffer->previous;
+      delete buffer;
+      buffer = previous;
+    }
+  }
 
-#if defined(DEBUG)
-  from_.ReadWrite();
-#endif
+  void Push(HeapObject obj) {
+    intptr_t bottom = bottom_.load(std::memory_order_relaxed);
+    intptr_t top = top_.load(std::memory_order_acquire);
+    Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+    if (bottom - top > buffer->mask) {
+      buffer = Grow(buffer, top, bottom);
+    }
+    buffer->Put(bottom, obj);
+    bottom_.store(bottom + 1, std::memory_order_release);
+  }
+
+  bool Pop(HeapObject* obj) {
+    intptr_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+    // Sequentially consistent, so a thief cannot also see the element.
+    bottom_.store(bottom, std::memory_order_seq_cst);
+    intptr_t top = top_.load(std::memory_order_seq_cst);
+    if (top > bottom) {
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+      return false;
+    }
+    *obj = buffer->Get(bottom);
+    if (top < bottom) {
+      return true;
+    }
+    // Last element: race the thieves for it.
+    bool won = top_.compare_exchange_strong(top, top + 1,
+                                            std::memory_order_seq_cst,
+                                            std::memory_order_relaxed);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+    return won;
+  }
+
+  bool Steal(HeapObject* obj) {
+    intptr_t top = top_.load(std::memory_order_seq_cst);
+    intptr_t bottom = bottom_.load(std::memory_order_seq_cst);
+    if (top >= bottom) {
+      return false;
+    }
+    Buffer* buffer = buffer_.load(std::memory_order_acquire);
+    *obj = buffer->Get(top);
+    return top_.compare_exchange_strong(top, top + 1,
+                                        std::memory_order_seq_cst,
+                                        std::memory_order_relaxed);
+  }
 
-  MarkStack* mark_stack = reinterpret_cast<MarkStack*>(from_.base());
-  mark_stack->Init(from_.limit());
+  bool IsEmpty() const {
+    return top_.load(std::memory_order_acquire) >=
+        bottom_.load(std::memory_order_acquire);
+  }
 
-  // Remembered set will be re-built during marking.
-  remembered_set_size_ = 0;
-  old_size_ = 0;
+ private:
+  static const intptr_t kInitialCapacity = 1024;
+
+  struct Buffer {
+    explicit Buffer(intptr_t capacity)
+        : mask(capacity - 1),
+          slots(new std::atomic<uword>[capacity]),
+          previous(nullptr) {
+      ASSERT(Utils::IsPowerOfTwo(capacity));
+    }
+    ~Buffer() { delete[] slots; }
 
-  interpreter_->GCPrologue();
+    HeapObject Get(intptr_t index) const {
+      return static_cast<HeapObject>(
+          slots[index & mask].load(std::memory_order_relaxed));
+    }
+    void Put(intptr_t index, HeapObject obj) {
+      slots[index & mask].store(static_cast<uword>(obj),
+                                std::memory_order_relaxed);
+    }
 
-  // Strong references.
-  MarkRoots();
-  while (!mark_stack->IsEmpty()) {
-    ProcessMarkStack();
-    MarkEphemeronList();
+    intptr_t mask;
+    std::atomic<uword>* slots;
+    Buffer* previous;  // Kept until the queue is deleted for late thieves.
+  };
+
+  Buffer* Grow(Buffer* buffer, intptr_t top, intptr_t bottom) {
+    Buffer* grown = new Buffer(2 * (buffer->mask + 1));
+    for (intptr_t i = top; i < bottom; i++) {
+      grown->Put(i, buffer->Get(i));
+    }
+    grown->previous = buffer;
+    buffer_.store(grown, std::memory_order_release);
+    return grown;
   }
 
-#if defined(DEBUG)
-  from_.NoAccess();
-#endif
+  std::atomic<intptr_t> top_;
+  std::atomic<intptr_t> bottom_;
+  std::atomic<Buffer*> buffer_;
 
-  ASSERT(old_size_ <= old_capacity_);
+  DISALLOW_COPY_AND_ASSIGN(ScavengeQueue);
+};
 
-  // Weak references.
-  MournEphemeronList();
-  MournWeakListMarkSweep();
-  MournClassTableMarkSweep();
+// One thread's share of a parallel scavenge. Copies go into the worker's own
+// block of to-space or, for tenured objects, its own promotion buffer in old
+// space, and are scanned from its own queue. Remembered objects, WeakArrays and
+// Ephemerons it finds are collected privately and handed to the heap after all
+// workers have finished.
+class ScavengerWorker {
+ public:
+  ScavengerWorker(Heap* heap, ParallelScavenger* scavenger, intptr_t id);
+  ~ScavengerWorker();
 
-  interpreter_->GCEpilogue();
+  intptr_t id() const { return id_; }
+  ScavengeQueue* queue() { return &queue_; }
 
-  Sweep();
+  // Scans until every worker is out of work.
+  void Run(bool scavenge_roots);
 
-  ShrinkRememberedSet();
+  void ScavengePointer(Object* ptr);
+  void ScavengeObject(HeapObject obj);
+  void Remember(HeapObject obj);
 
-  SetOldAllocationLimit();
+  // Only while no worker is running.
+  Ephemeron TakeEphemeronList();
+  void Finish();
 
-#if REPORT_GC
-  size_t size_after = old_size_;
-  int64_t stop = OS::CurrentMonotonicNanos();
-  int64_t time = stop - start;
-  OS::PrintErr("Mark-sweep "
-               "(%s, %" Pd "kB old, %" Pd "kB freed, %" Pd64 " us)\n",
-               ReasonToCString(reason), size_after / KB,
-               (size_before - size_after) / KB,
-               time / kNanosecondsPerMicrosecond);
-#endif
-}
+ private:
+  void ScavengeRoots();
+  void ScavengeRememberedSet();
+  void ScavengeClass(intptr_t cid);
+  void ScavengeNewObject(HeapObject obj);
+  void ScavengeOldObject(HeapObject obj);
+  void ScavengeCards(HeapObject obj);
+
+  HeapObject Forward(HeapObject old_target);
+  uword AllocateNew(intptr_t size);
+  uword AllocateTenure(intptr_t size);
+  void Retract(uword addr, intptr_t size);
+  void RetireBlock();
+  void RetirePromotionBuffer();
+
+  Heap* heap_;
+  ParallelScavenger* scavenger_;
+  intptr_t id_;
+  ScavengeQueue queue_;
+
+  uword block_top_;
+  uword block_end_;
+  uword promotion_top_;
+  uword promotion_end_;
+
+  HeapObject* remembered_;
+  intptr_t remembered_size_;
+  intptr_t remembered_capacity_;
+  WeakArray weak_list_;
+  Ephemeron ephemeron_list_;
+  MarkStack marked_;  // Objects tenured while marking.
+  MarkStack reached_;  // Keys of waiting Ephemerons, by their old addresses.
+
+  friend class ParallelScavenger;
+  DISALLOW_COPY_AND_ASSIGN(ScavengerWorker);
+};
 
-void Heap::MarkRoots() {
-  for (intptr_t i = 0; i < handles_size_; i++) {
-    MarkObject(*handles_[i]);
-  }
+// Strong references of a scavenge, traced by a team of ScavengerWorkers: this
+// thread and helpers from the thread pool. Forwarding installs the copy's
+// address in the original's header with a compare-and-swap, and a worker that
+// loses the race retracts its copy. A round ends once every worker is out of
+// work; Ephemerons whose keys survived are then scanned and, if that copied
+// anything, another round runs.
+class ParallelScavenger {
+ public:
+  // Blocks of to-space and promotion buffers handed out to workers.
+  static const intptr_t kBlockSize = 32 * KB;
+  static const intptr_t kPromotionBufferSize = 16 * KB;
+  // Entries of the remembered set claimed at a time.
+  static const intptr_t kRememberedChunk = 64;
+
+  explicit ParallelScavenger(Heap* heap);
+  ~ParallelScavenger();
+
+  void Scavenge();
+
+  // Called by workers.
+  uword ClaimToSpace(intptr_t size);
+  uword AllocateOld(intptr_t size);
+  void ReleaseOld(uword addr, intptr_t size);
+  bool Steal(ScavengerWorker* thief, HeapObject* obj);
+  bool Terminate();
+  void TaskDone();
+
+  intptr_t ClaimRemembered(intptr_t* end);
+
+ private:
+  void RunWorkers(bool scavenge_roots);
+  void ScavengeEphemeronList();
+
+  Heap* heap_;
+  intptr_t num_workers_;
+  ScavengerWorker* workers_[Heap::kMaxScavengerWorkers];
+
+  std::atomic<uword> to_space_top_;
+  uword to_space_limit_;
+  intptr_t remembered_size_;
+  std::atomic<intptr_t> remembered_cursor_;
+  std::atomic<intptr_t> num_idle_;
+
+  Mutex old_space_mutex_;
+  Monitor tasks_monitor_;
+  intptr_t num_tasks_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelScavenger);
+};
+
+class ScavengerTask : public ThreadPool::Task {
+ public:
+  ScavengerTask(ParallelScavenger* scavenger,
+                ScavengerWorker* worker,
+                bool scavenge_roots)
+      : scavenger_(scavenger), worker_(worker),
+        scavenge_roots_(scavenge_roots) {}
+
+  virtual void Run() {
+    worker_->Run(scavenge_roots_);
+    scavenger_->TaskDone();
+  }
+
+ private:
+  ParallelScavenger* scavenger_;
+  ScavengerWorker* worker_;
+  bool scavenge_roots_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScavengerTask);
+};
+
+ScavengerWorker::ScavengerWorker(Heap* heap,
+                                 ParallelScavenger* scavenger,
+                                 intptr_t id) :
+    heap_(heap),
+    scavenger_(scavenger),
+    id_(id),
+    queue_(),
+    block_top_(0),
+    block_end_(0),
+    promotion_top_(0),
+    promotion_end_(0),
+    remembered_(nullptr),
+    remembered_size_(0),
+    remembered_capacity_(0),
+    weak_list_(nullptr),
+    ephemeron_list_(nullptr),
+    marked_(),
+    reached_() {
+}
+
+ScavengerWorker::~ScavengerWorker() {
+  delete[] remembered_;
+}
+
+void ScavengerWorker::Run(bool scavenge_roots) {
+  if (scavenge_roots) {
+    ScavengeRememberedSet();
+    if (id_ == 0) {
+      ScavengeRoots();
+    }
+  }
+  for (;;) {
+    HeapObject obj;
+    while (queue_.Pop(&obj)) {
+      ScavengeObject(obj);
+    }
+    if (scavenger_->Steal(this, &obj)) {
+      ScavengeObject(obj);
+    } else if (scavenger_->Terminate()) {
+      return;
+    }
+  }
+}
+
+void ScavengerWorker::ScavengeRememberedSet() {
+  // Objects remembered again go into this worker's own list, so the heap's
+  // remembered set stays unchanged while it is shared.
+  intptr_t end;
+  for (intptr_t i = scavenger_->ClaimRemembered(&end);
+       i < end;
+       i = scavenger_->ClaimRemembered(&end)) {
+    for (; i < end; i++) {
+      HeapObject obj = heap_->remembered_set_[i];
+      ASSERT(obj->IsOldObject());
+      ASSERT(obj->is_remembered());
+      obj->set_is_remembered(false);
+      ScavengeOldObject(obj);
+    }
+  }
+}
+
+void ScavengerWorker::ScavengeRoots() {
+  for (intptr_t i = 0; i < heap_->handles_size_; i++) {
+    ScavengePointer(heap_->handles_[i]);
+  }
 
   Object* from;
   Object* to;
-  interpreter_->RootPointers(&from, &to);
+  Interpreter* interpreter = heap_->interpreter_;
+  interpreter->RootPointers(&from, &to);
   for (Object* ptr = from; ptr <= to; ptr++) {
-    MarkObject(*ptr);
+    ScavengePointer(ptr);
+  }
+  for (intptr_t i = 0; interpreter->StackPointers(i, &from, &to); i++) {
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      ScavengePointer(ptr);
+    }
+  }
+}
+
+void ScavengerWorker::ScavengePointer(Object* ptr) {
+  HeapObject old_target = static_cast<HeapObject>(*ptr);
+  if (old_target->IsImmediateOrOldObject()) {
+    return;
+  }
+  *ptr = Forward(old_target);
+}
+
+void ScavengerWorker::ScavengeClass(intptr_t cid) {
+  ASSERT(cid < heap_->class_table_size_);
+  HeapObject old_target = static_cast<HeapObject>(heap_->class_table_[cid]);
+  if (old_target->IsImmediateOrOldObject()) {
+    return;
+  }
+  // The class table is updated by MournClassTableScavenge.
+  Forward(old_target);
+}
+
+void ScavengerWorker::ScavengeObject(HeapObject obj) {
+  if (obj->IsNewObject()) {
+    ScavengeNewObject(obj);
+  } else {
+    ScavengeOldObject(obj);
+  }
+}
+
+void ScavengerWorker::ScavengeNewObject(HeapObject obj) {
+  intptr_t cid = obj->cid();
+  ScavengeClass(cid);
+  if (cid == kWeakArrayCid) {
+    WeakArray survivor = static_cast<WeakArray>(obj);
+    survivor->set_next(weak_list_);
+    weak_list_ = survivor;
+  } else if (cid == kEphemeronCid) {
+    Ephemeron survivor = static_cast<Ephemeron>(obj);
+    survivor->set_next(ephemeron_list_);
+    ephemeron_list_ = survivor;
+  } else {
+    Object* from;
+    Object* to;
+    obj->Pointers(&from, &to);
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      ScavengePointer(ptr);
+    }
+  }
+}
+
+void ScavengerWorker::ScavengeOldObject(HeapObject obj) {
+  intptr_t cid = obj->cid();
+  ScavengeClass(cid);
+  if (cid == kWeakArrayCid) {
+    WeakArray survivor = static_cast<WeakArray>(obj);
+    survivor->set_next(weak_list_);
+    weak_list_ = survivor;
+  } else if (cid == kEphemeronCid) {
+    Ephemeron survivor = static_cast<Ephemeron>(obj);
+    survivor->set_next(ephemeron_list_);
+    ephemeron_list_ = survivor;
+  } else if (obj->is_carded()) {
+    ScavengeCards(obj);
+  } else {
+    Object* from;
+    Object* to;
+    obj->Pointers(&from, &to);
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      ScavengePointer(ptr);
+      if ((*ptr)->IsNewObject() && !obj->is_remembered()) {
+        Remember(obj);
+      }
+    }
+  }
+}
+
+void ScavengerWorker::ScavengeCards(HeapObject obj) {
+  // As Heap::ScavengeCards. Only the worker that claimed the object touches
+  // its cards.
+  Region* region = Region::Of(obj);
+  uint8_t* cards = region->cards();
+  Object* from;
+  Object* to;
+  obj->Pointers(&from, &to);
+  bool remembered = false;
+  for (intptr_t i = 0; i < region->num_cards(); i++) {
+    if (cards[i] == 0) {
+      continue;
+    }
+    cards[i] = 0;
+    Object* card_from =
+        reinterpret_cast<Object*>(obj->Addr() + i * Heap::kCardSize);
+    Object* card_to = card_from + (Heap::kCardSize / sizeof(Object)) - 1;
+    if (card_from < from) card_from = from;
+    if (card_to > to) card_to = to;
+    for (Object* ptr = card_from; ptr <= card_to; ptr++) {
+      ScavengePointer(ptr);
+      if ((*ptr)->IsNewObject()) {
+        cards[i] = 1;
+      }
+    }
+    remembered |= cards[i] != 0;
+  }
+  if (remembered) {
+    Remember(obj);
+  }
+}
+
+void ScavengerWorker::Remember(HeapObject obj) {
+  ASSERT(obj->IsOldObject());
+  ASSERT(!obj->is_remembered());
+  if (remembered_size_ == remembered_capacity_) {
+    intptr_t capacity =
+        (remembered_capacity_ == 0) ? 256 : 2 * remembered_capacity_;
+    HeapObject* remembered = new HeapObject[capacity];
+    for (intptr_t i = 0; i < remembered_size_; i++) {
+      remembered[i] = remembered_[i];
+    }
+    delete[] remembered_;
+    remembered_ = remembered;
+    remembered_capacity_ = capacity;
+  }
+  remembered_[remembered_size_++] = obj;
+  // Only the worker that scans an old object sets its header bits.
+  obj->set_is_remembered(true);
+}
+
+HeapObject ScavengerWorker::Forward(HeapObject old_target) {
+  DEBUG_ASSERT(heap_->InFromSpace(old_target));
+
+  std::atomic<uword>* header_ptr =
+      reinterpret_cast<std::atomic<uword>*>(old_target->Addr());
+  uword header = header_ptr->load(std::memory_order_acquire);
+  if ((header & (1 << kMarkBit)) != 0) {
+    return static_cast<HeapObject>(header);  // Already forwarded.
+  }
+
+  // Target is now known to be reachable. Move it to to-space, or tenure it
+  // if it already survived a scavenge or to-space is exhausted.
+  intptr_t size = old_target->HeapSize(header);
+  uword new_target_addr = 0;
+  if (old_target->Addr() >= heap_->survivor_end_) {
+    new_target_addr = AllocateNew(size);
+  }
+  bool mark = false;
+  if (new_target_addr == 0) {
+    new_target_addr = AllocateTenure(size);
+    mark = heap_->marking_;
+    if (old_target->Addr() < heap_->survivor_end_) {
+      // The loser of a race to forward counts too, which feedback can afford.
+      uint32_t* tenured = &heap_->feedback_[
+          HeapObject::ClassIdFromHeader(header)].tenured;
+      reinterpret_cast<std::atomic<uint32_t>*>(tenured)->fetch_add(
+          1, std::memory_order_relaxed);
+    }
+  }
+
+  // Copy the header as it was when we decided to copy, since another worker
+  // may be forwarding the original concurrently. Objects tenured while
+  // marking are marked, as the serial scavenger does.
+  *reinterpret_cast<uword*>(new_target_addr) =
+      mark ? (header | (1 << kMarkBit)) : header;
+  memcpy(reinterpret_cast<void*>(new_target_addr + sizeof(uword)),
+         reinterpret_cast<void*>(old_target->Addr() + sizeof(uword)),
+         size - sizeof(uword));
+  HeapObject new_target = HeapObject::FromAddr(new_target_addr);
+
+  // Mark bit and tag bit are conveniently in the same place.
+  uword forwarded = static_cast<uword>(new_target);
+  ASSERT((forwarded & kSmiTagMask) == kHeapObjectTag);
+  if (!header_ptr->compare_exchange_strong(header, forwarded,
+                                           std::memory_order_acq_rel,
+                                           std::memory_order_acquire)) {
+    // Another worker copied it first.
+    Retract(new_target_addr, size);
+    ASSERT((header & (1 << kMarkBit)) != 0);
+    return static_cast<HeapObject>(header);
+  }
+
+  if (mark) {
+    marked_.Push(new_target);
+  }
+  if (heap_->ephemeron_index_.Contains(old_target)) {
+    reached_.Push(old_target);
+  }
+  queue_.Push(new_target);
+  return new_target;
+}
+
+uword ScavengerWorker::AllocateNew(intptr_t size) {
+  if (block_end_ - block_top_ >= static_cast<uword>(size)) {
+    uword result = block_top_;
+    block_top_ += size;
+    return result;
+  }
+  if (size > ParallelScavenger::kBlockSize / 8) {
+    return scavenger_->ClaimToSpace(size);
+  }
+  RetireBlock();
+  uword block = scavenger_->ClaimToSpace(ParallelScavenger::kBlockSize);
+  if (block == 0) {
+    return scavenger_->ClaimToSpace(size);
+  }
+  ASSERT((block & kObjectAlignmentMask) == kNewObjectAlignmentOffset);
+  block_top_ = block + size;
+  block_end_ = block + ParallelScavenger::kBlockSize;
+  return block;
+}
+
+uword ScavengerWorker::AllocateTenure(intptr_t size) {
+  if (promotion_end_ - promotion_top_ >= static_cast<uword>(size)) {
+    uword result = promotion_top_;
+    promotion_top_ += size;
+    return result;
+  }
+  if (size > ParallelScavenger::kPromotionBufferSize / 4) {
+    return scavenger_->AllocateOld(size);
+  }
+  RetirePromotionBuffer();
+  uword buffer =
+      scavenger_->AllocateOld(ParallelScavenger::kPromotionBufferSize);
+  promotion_top_ = buffer + size;
+  promotion_end_ = buffer + ParallelScavenger::kPromotionBufferSize;
+  return buffer;
+}
+
+static void FillNewSpace(uword addr, intptr_t size) {
+  // Keeps new-space walkable, as Sweep does.
+  HeapObject object = HeapObject::Initialize(addr, kFreeListElementCid, size);
+  FreeListElement element = static_cast<FreeListElement>(object);
+  if (element->heap_size() == 0) {
+    ASSERT(size > kObjectAlignment);
+    element->set_overflow_size(size);
+  }
+  ASSERT(element->HeapSize() == size);
+}
+
+void ScavengerWorker::Retract(uword addr, intptr_t size) {
+  if (addr + size == block_top_) {
+    block_top_ = addr;
+  } else if (addr + size == promotion_top_) {
+    promotion_top_ = addr;
+  } else if ((addr & kObjectAlignmentMask) == kNewObjectAlignmentOffset) {
+    FillNewSpace(addr, size);
+  } else {
+    scavenger_->ReleaseOld(addr, size);
+  }
+}
+
+void ScavengerWorker::RetireBlock() {
+  if (block_end_ > block_top_) {
+    FillNewSpace(block_top_, block_end_ - block_top_);
+  }
+  block_top_ = block_end_ = 0;
+}
+
+void ScavengerWorker::RetirePromotionBuffer() {
+  if (promotion_end_ > promotion_top_) {
+    scavenger_->ReleaseOld(promotion_top_, promotion_end_ - promotion_top_);
   }
-  interpreter_->StackPointers(&from, &to);
+  promotion_top_ = promotion_end_ = 0;
+}
+
+Ephemeron ScavengerWorker::TakeEphemeronList() {
+  Ephemeron list = ephemeron_list_;
+  ephemeron_list_ = nullptr;
+  return list;
+}
+
+void ScavengerWorker::Finish() {
+  RetireBlock();
+  RetirePromotionBuffer();
+
+  while (weak_list_ != nullptr) {
+    WeakArray next = weak_list_->next();
+    heap_->AddToWeakList(weak_list_);
+    weak_list_ = next;
+  }
+  ASSERT(ephemeron_list_ == nullptr);
+  ASSERT(reached_.IsEmpty());
+
+  for (intptr_t i = 0; i < remembered_size_; i++) {
+    HeapObject obj = remembered_[i];
+    ASSERT(obj->is_remembered());
+    if (heap_->remembered_set_size_ == heap_->remembered_set_capacity_) {
+      heap_->GrowRememberedSet();
+    }
+    heap_->remembered_set_[heap_->remembered_set_size_++] = obj;
+  }
+  remembered_size_ = 0;
+
+  while (!marked_.IsEmpty()) {
+    HeapObject obj = marked_.Pop();
+    heap_->marked_size_ += obj->HeapSize();
+    heap_->mark_stack_.Push(obj);
+  }
+}
+
+ParallelScavenger::ParallelScavenger(Heap* heap) :
+    heap_(heap),
+    num_workers_(heap->scavenger_workers_),
+    workers_(),
+    to_space_top_(heap->top_),
+    to_space_limit_(heap->end_),
+    remembered_size_(0),
+    remembered_cursor_(0),
+    num_idle_(0),
+    old_space_mutex_(),
+    tasks_monitor_(),
+    num_tasks_(0) {
+  ASSERT(num_workers_ > 1);
+  ASSERT(num_workers_ <= Heap::kMaxScavengerWorkers);
+  for (intptr_t i = 0; i < num_workers_; i++) {
+    workers_[i] = new ScavengerWorker(heap, this, i);
+  }
+}
+
+ParallelScavenger::~ParallelScavenger() {
+  for (intptr_t i = 0; i < num_workers_; i++) {
+    delete workers_[i];
+  }
+}
+
+void ParallelScavenger::Scavenge() {
+  // Workers share out the remembered set, and each starts a new one.
+  remembered_size_ = heap_->remembered_set_size_;
+  heap_->remembered_set_size_ = 0;
+
+  RunWorkers(true);
+  ScavengeEphemeronList();
+  while (!workers_[0]->queue()->IsEmpty()) {
+    RunWorkers(false);
+    ScavengeEphemeronList();
+  }
+
+  for (intptr_t i = 0; i < num_workers_; i++) {
+    workers_[i]->Finish();
+  }
+  heap_->top_ = to_space_top_.load(std::memory_order_relaxed);
+}
+
+void ParallelScavenger::RunWorkers(bool scavenge_roots) {
+  num_idle_.store(0, std::memory_order_relaxed);
+  num_tasks_ = num_workers_ - 1;
+  for (intptr_t i = 1; i < num_workers_; i++) {
+    ScavengerTask* task = new ScavengerTask(this, workers_[i], scavenge_roots);
+    if (!heap_->thread_pool_->Run(task)) {
+      // Shutting down: the others will do its share.
+      delete task;
+      num_idle_.fetch_add(1);
+      MonitorLocker ml(&tasks_monitor_);
+      num_tasks_--;
+    }
+  }
+
+  // This thread is worker 0.
+  workers_[0]->Run(scavenge_roots);
+
+  MonitorLocker ml(&tasks_monitor_);
+  while (num_tasks_ > 0) {
+    ml.Wait();
+  }
+}
+
+void ParallelScavenger::TaskDone() {
+  MonitorLocker ml(&tasks_monitor_);
+  num_tasks_--;
+  ml.NotifyAll();
+}
+
+intptr_t ParallelScavenger::ClaimRemembered(intptr_t* end) {
+  intptr_t start = remembered_cursor_.fetch_add(kRememberedChunk,
+                                                std::memory_order_relaxed);
+  if (start >= remembered_size_) {
+    *end = start;
+    return start;
+  }
+  *end = start + kRememberedChunk;
+  if (*end > remembered_size_) {
+    *end = remembered_size_;
+  }
+  return start;
+}
+
+uword ParallelScavenger::ClaimToSpace(intptr_t size) {
+  uword top = to_space_top_.load(std::memory_order_relaxed);
+  do {
+    if (to_space_limit_ - top < static_cast<uword>(size)) {
+      return 0;
+    }
+  } while (!to_space_top_.compare_exchange_weak(top, top + size,
+                                                 std::memory_order_relaxed));
+  return top;
+}
+
+uword ParallelScavenger::AllocateOld(intptr_t size) {
+  MutexLocker ml(&old_space_mutex_);
+  return heap_->AllocatePromotion(size);
+}
+
+void ParallelScavenger::ReleaseOld(uword addr, intptr_t size) {
+  MutexLocker ml(&old_space_mutex_);
+  heap_->ReleasePromotion(addr, size);
+}
+
+bool ParallelScavenger::Steal(ScavengerWorker* thief, HeapObject* obj) {
+  for (intptr_t i = 1; i < num_workers_; i++) {
+    ScavengerWorker* victim = workers_[(thief->id() + i) % num_workers_];
+    if (victim->queue()->Steal(obj)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ParallelScavenger::Terminate() {
+  // Idle workers have empty queues and only leave the idle count to steal, so
+  // once every worker is idle no work remains.
+  num_idle_.fetch_add(1);
+  for (;;) {
+    if (num_idle_.load() == num_workers_) {
+      return true;
+    }
+    for (intptr_t i = 0; i < num_workers_; i++) {
+      if (!workers_[i]->queue()->IsEmpty()) {
+        num_idle_.fetch_sub(1);
+        return false;
+      }
+    }
+    Thread::YieldTimeslice();
+  }
+}
+
+void ParallelScavenger::ScavengeEphemeronList() {
+  // As Heap::ScavengeEphemeronList, on this thread as worker 0. Anything it
+  // copies leaves work in worker 0's queue for another round.
+  for (intptr_t i = 0; i < num_workers_; i++) {
+    Ephemeron survivor = workers_[i]->TakeEphemeronList();
+    while (survivor != nullptr) {
+      Ephemeron next = survivor->next();
+      heap_->AddToEphemeronList(survivor);
+      survivor = next;
+    }
+    MarkStack* reached = &workers_[i]->reached_;
+    while (!reached->IsEmpty()) {
+      heap_->RequeueEphemerons(reached->Pop());
+    }
+  }
+
+  ScavengerWorker* worker = workers_[0];
+  Ephemeron survivor = heap_->ephemeron_list_;
+  heap_->ephemeron_list_ = nullptr;
+
+  while (survivor != nullptr) {
+    ASSERT(survivor->IsEphemeron());
+    Ephemeron next = survivor->next();
+    survivor->set_next(nullptr);
+
+    if (IsScavengeSurvivor(survivor->key())) {
+      worker->ScavengePointer(survivor->key_ptr());
+      worker->ScavengePointer(survivor->value_ptr());
+      worker->ScavengePointer(survivor->finalizer_ptr());
+
+      if (survivor->IsOldObject() &&
+          (survivor->key()->IsNewObject() ||
+           survivor->value()->IsNewObject() ||
+           survivor->finalizer()->IsNewObject()) &&
+          !survivor->is_remembered()) {
+        worker->Remember(survivor);
+      }
+    } else {
+      // Fate of key is not yet known, wait for it to be reached.
+      heap_->ephemeron_index_.Add(static_cast<HeapObject>(survivor->key()),
+                                  survivor);
+    }
+
+    survivor = next;
+  }
+}
+
+void Heap::ParallelScavenge() {
+  ASSERT(end_ == to_.limit());  // No tenure stack.
+  ParallelScavenger scavenger(this);
+  scavenger.Scavenge();
+}
+
+void Heap::MarkSweep(Reason reason) {
+  int64_t start = FLAG_report_gc ? OS::CurrentMonotonicNanos() : 0;
+  NotePeakSize();
+  size_t size_before = old_size_;
+
+  // Finishes incremental marking if it is in progress. Old objects it already
+  // marked stay marked, and the barrier kept everything they reach marked or
+  // on the mark stack, except new objects, which it does not mark. So roots
+  // are marked again, and the old objects pointing into new-space are
+  // scanned again.
+  trace_.Start(GCTrace::kMarkSweep, ReasonToCString(reason));
+  bool incremental = marking_;
+  marking_ = false;
+  if (!incremental) {
+    FinishSweep();
+    marked_size_ = 0;
+    trace_.EndPhase(GCTrace::kSweep);
+  }
+
+  interpreter_->GCPrologue();
+
+  // Strong references.
+  MarkRoots();
+  if (incremental) {
+    for (intptr_t i = 0; i < remembered_set_size_; i++) {
+      HeapObject obj = remembered_set_[i];
+      intptr_t cid = obj->cid();
+      if (obj->is_marked() &&
+          (cid != kWeakArrayCid) && (cid != kEphemeronCid)) {
+        mark_stack_.Push(obj);
+      }
+    }
+    while (!deferred_.IsEmpty()) {
+      HeapObject obj = deferred_.Pop();
+      if (obj->cid() == kWeakArrayCid) {
+        AddToWeakList(static_cast<WeakArray>(obj));
+      } else {
+        AddToEphemeronList(static_cast<Ephemeron>(obj));
+      }
+    }
+  }
+  trace_.EndPhase(GCTrace::kRoots);
+  do {
+    ProcessMarkStack(INTPTR_MAX);
+    trace_.EndPhase(GCTrace::kCopy);
+    MarkEphemeronList();
+    trace_.EndPhase(GCTrace::kEphemerons);
+  } while (!mark_stack_.IsEmpty());
+
+  old_size_ = marked_size_;
+
+  // Weak references.
+  MournEphemeronList();
+  MournWeakListMarkSweep();
+  trace_.EndPhase(GCTrace::kWeakMourning);
+  MournClassTableMarkSweep();
+#if OUT_OF_LINE_HASH
+  MournIdentityHashesMarkSweep();
+#endif
+  trace_.EndPhase(GCTrace::kClassTableMourning);
+
+  interpreter_->GCEpilogue();
+  // Native code is keyed by the addresses of old-space methods, which Sweep
+  // may free for reuse.
+  interpreter_->FlushNativeCode();
+
+  // Survivors keep their remembered bits; drop the dead.
+  FilterRememberedSet();
+
+  Sweep();
+  trace_.EndPhase(GCTrace::kSweep);
+
+  if (IsFragmented()) {
+    Compact();
+    trace_.EndPhase(GCTrace::kCompact);
+  }
+
+  ASSERT(old_size_ <= old_capacity_);
+
+  mark_stack_.Release();
+  deferred_.Release();
+  ShrinkRememberedSet();
+
+  SetOldAllocationLimit();
+  ResetPretenuring();
+
+  out_of_memory_ = (heap_limit_ != 0) &&
+      (old_size_ + to_.size() + from_.size() > heap_limit_);
+  trace_.Stop(0, top_ - to_.object_start(), old_size_);
+  if (FLAG_trace_growth && out_of_memory_) {
+    Log::Print("trace_growth", "Over the %" Pd "kB heap limit",
+               heap_limit_ / KB);
+  }
+
+  if (FLAG_report_gc) {
+    size_t size_after = old_size_;
+    int64_t stop = OS::CurrentMonotonicNanos();
+    int64_t time = stop - start;
+    Log::Print("report_gc", "Mark-sweep "
+               "(%s, %" Pd "kB old, %" Pd "kB freed, %" Pd64 " us)",
+               ReasonToCString(reason), size_after / KB,
+               (size_before - size_after) / KB,
+               time / kNanosecondsPerMicrosecond);
+  }
+}
+
+void Heap::MarkRoots() {
+  for (intptr_t i = 0; i < handles_size_; i++) {
+    MarkObject(*handles_[i]);
+  }
+
+  Object* from;
+  Object* to;
+  interpreter_->RootPointers(&from, &to);
   for (Object* ptr = from; ptr <= to; ptr++) {
     MarkObject(*ptr);
   }
+  for (intptr_t i = 0; interpreter_->StackPointers(i, &from, &to); i++) {
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      MarkObject(*ptr);
+    }
+  }
 }
 
 void Heap::MarkObject(Object obj) {
   if (obj->IsImmediateObject()) return;
 
   HeapObject heap_obj = static_cast<HeapObject>(obj);
+  // While marking incrementally, new-space belongs to the scavenger, which
+  // uses the mark bit for forwarding.
+  if (marking_ && heap_obj->IsNewObject()) return;
   if (heap_obj->is_marked()) return;
 
   heap_obj->set_is_marked(true);
-  heap_obj->set_is_remembered(false);
-  MarkStack* mark_stack = reinterpret_cast<MarkStack*>(from_.base());
-  mark_stack->Push(heap_obj);
+  if (heap_obj->IsOldObject()) {
+    marked_size_ += heap_obj->HeapSize();
+  }
+  mark_stack_.Push(heap_obj);
+  if (!ephemeron_index_.IsEmpty()) {
+    RequeueEphemerons(heap_obj);
+  }
 }
 
-void Heap::ProcessMarkStack() {
-  MarkStack* mark_stack = reinterpret_cast<MarkStack*>(from_.base());
-  while (!mark_stack->IsEmpty()) {
-    HeapObject obj = mark_stack->Pop();
+bool Heap::ProcessMarkStack(intptr_t budget) {
+  intptr_t scanned = 0;
+  while (!mark_stack_.IsEmpty()) {
+    if (scanned >= budget) {
+      return false;
+    }
+    HeapObject obj = mark_stack_.Pop();
     ASSERT(obj->is_marked());
-    ASSERT(!obj->is_remembered());
 
     intptr_t cid = obj->cid();
     ASSERT(cid != kIllegalCid);
@@ -725,10 +2259,15 @@ void Heap::ProcessMarkStack() {
 
     MarkObject(ClassAt(cid));
 
-    if (cid == kWeakArrayCid) {
-      AddToWeakList(static_cast<WeakArray>(obj));
-    } else if (cid == kEphemeronCid) {
-      AddToEphemeronList(static_cast<Ephemeron>(obj));
+    if ((cid == kWeakArrayCid) || (cid == kEphemeronCid)) {
+      if (marking_) {
+        // The lists are the scavenger's until the final pause.
+        deferred_.Push(obj);
+      } else if (cid == kWeakArrayCid) {
+        AddToWeakList(static_cast<WeakArray>(obj));
+      } else {
+        AddToEphemeronList(static_cast<Ephemeron>(obj));
+      }
     } else {
       Object* from;
       Object* to;
@@ -739,14 +2278,127 @@ void Heap::ProcessMarkStack() {
         has_new_target |= target->IsNewObject();
         MarkObject(target);
       }
-      if (has_new_target && obj->IsOldObject()) {
+      if (has_new_target && obj->IsOldObject() && !obj->is_remembered()) {
         AddToRememberedSet(obj);
       }
     }
+    scanned += obj->HeapSize();
   }
+  return true;
+}
+
+void Heap::StartIncrementalMarking(Reason reason) {
+  ASSERT(!marking_);
+  int64_t start = FLAG_report_gc ? OS::CurrentMonotonicNanos() : 0;
+  trace_.Start(GCTrace::kStartMarking, ReasonToCString(reason));
+
+  // Leftover marks would look live.
+  FinishSweep();
+  marked_size_ = 0;
+  trace_.EndPhase(GCTrace::kSweep);
+
+  interpreter_->GCPrologue();
+
+  marking_ = true;
+  MarkRoots();
+  trace_.EndPhase(GCTrace::kRoots);
+
+  // New objects are not marked until the final pause, so mark what they
+  // point to in old-space now. Later scavenges mark whatever they tenure.
+  uword scan = to_.object_start();
+  while (scan < top_) {
+    HeapObject obj = HeapObject::FromAddr(scan);
+    if (obj->cid() >= kFirstLegalCid) {
+      MarkObject(ClassAt(obj->cid()));
+      Object* from;
+      Object* to;
+      obj->Pointers(&from, &to);
+      for (Object* ptr = from; ptr <= to; ptr++) {
+        MarkObject(*ptr);
+      }
+    }
+    scan += obj->HeapSize();
+  }
+  trace_.EndPhase(GCTrace::kCopy);
+
+  interpreter_->GCEpilogue();
+
+  marking_old_size_ = old_size_;
+  marking_limit_ = old_limit_ + old_limit_ / 2;
+  if (heap_limit_ != 0) {
+    // Finish before old space alone passes the hard limit.
+    size_t new_space = to_.size() + from_.size();
+    size_t limit = (heap_limit_ > new_space) ? heap_limit_ - new_space : 0;
+    if (marking_limit_ > limit) {
+      marking_limit_ = (limit > old_limit_) ? limit : old_limit_;
+    }
+  }
+  trace_.Stop(0, top_ - to_.object_start(), old_size_);
+
+  if (FLAG_report_gc) {
+    int64_t stop = OS::CurrentMonotonicNanos();
+    int64_t time = stop - start;
+    Log::Print("report_gc", "Start marking (%" Pd "kB old, %" Pd64 " us)",
+               old_size_ / KB, time / kNanosecondsPerMicrosecond);
+  }
+}
+
+void Heap::IncrementalMarkingStep(Reason reason) {
+  ASSERT(marking_);
+  if (old_size_ > marking_limit_) {
+    // Allocation outpaced marking.
+    MarkSweep(reason);
+    return;
+  }
+
+  trace_.Start(GCTrace::kMarkingStep, ReasonToCString(reason));
+  intptr_t allocated = old_size_ - marking_old_size_;
+  marking_old_size_ = old_size_;
+  intptr_t budget = kMarkingRate * allocated;
+  if (budget < kMinMarkingStep) {
+    budget = kMinMarkingStep;
+  }
+  bool done = ProcessMarkStack(budget);
+  trace_.EndPhase(GCTrace::kCopy);
+  trace_.Stop(0, top_ - to_.object_start(), old_size_);
+  if (done) {
+    MarkSweep(reason);
+  }
+}
+
+void Heap::AbortIncrementalMarking() {
+  if (!marking_) {
+    return;
+  }
+  marking_ = false;
+  mark_stack_.Release();
+  deferred_.Release();
+  ASSERT(unswept_ == nullptr);
+  for (Region* region = regions_; region != nullptr; region = region->next()) {
+    uword scan = region->object_start();
+    while (scan < region->object_end()) {
+      HeapObject obj = HeapObject::FromAddr(scan);
+      obj->set_is_marked(false);
+      scan += obj->HeapSize();
+    }
+  }
+}
+
+void Heap::FilterRememberedSet() {
+  intptr_t size = 0;
+  for (intptr_t i = 0; i < remembered_set_size_; i++) {
+    HeapObject obj = remembered_set_[i];
+    if (obj->is_marked()) {
+      remembered_set_[size++] = obj;
+    }
+  }
+  remembered_set_size_ = size;
 }
 
 void Heap::Sweep() {
+#if REPORT_FREELIST
+  freelist_.PrintStatistics();
+#endif
   freelist_.Reset();
 
   uword scan = to_.object_start();
@@ -778,25 +2430,170 @@ void Heap::Sweep() {
     }
   }
 
+  // Old space is swept lazily.
+  ASSERT(unswept_ == nullptr);
+  unswept_ = regions_;
+  regions_ = nullptr;
+}
+
+bool Heap::SweepNextRegion() {
+  Region* region = unswept_;
+  if (region == nullptr) {
+    return false;
+  }
+  unswept_ = region->next();
+  if (SweepRegion(region)) {
+    region->set_next(regions_);
+    regions_ = region;
+  } else {
+    old_capacity_ -= region->size();
+    region->Free();
+  }
+  return true;
+}
+
+void Heap::SweepStep() {
+  if (unswept_ == nullptr) {
+    return;
+  }
+  trace_.Start(GCTrace::kSweepStep, ReasonToCString(kNewSpace));
+  intptr_t swept = 0;
+  while ((swept < kSweepStep) && (unswept_ != nullptr)) {
+    swept += unswept_->size();
+    SweepNextRegion();
+  }
+  trace_.EndPhase(GCTrace::kSweep);
+  trace_.Stop(0, top_ - to_.object_start(), old_size_);
+}
+
+void Heap::FinishSweep() {
+  while (SweepNextRegion()) {
+  }
+}
+
+bool Heap::ShouldEvacuate(Region* region) {
+  if ((region->size() != kRegionSize) || region->mapped()) {
+    return false;  // Holds a large object.
+  }
+  intptr_t live = 0;
+  uword scan = region->object_start();
+  while (scan < region->object_end()) {
+    HeapObject obj = HeapObject::FromAddr(scan);
+    intptr_t size = obj->HeapSize();
+    if (obj->cid() >= kFirstLegalCid) {
+      if (size >= kLargeAllocation) {
+        return false;
+      }
+      live += size;
+    }
+    scan += size;
+  }
+  return live * 100 < static_cast<intptr_t>(region->size()) *
+                          kEvacuationOccupancy;
+}
+
+void Heap::Compact() {
+  // Evacuates the sparse regions into the others and fresh ones, leaving
+  // ForwardingCorpses behind, and then forwards pointers as become: does.
+  int64_t start = FLAG_report_gc ? OS::CurrentMonotonicNanos() : 0;
+  size_t capacity_before = old_capacity_;
+
+  FinishSweep();
+  if (!IsFragmented()) {
+    return;  // Sweeping released whole regions.
+  }
+
+  Region* evacuated = nullptr;
   Region* prev = nullptr;
   Region* region = regions_;
   while (region != nullptr) {
-    bool in_use = SweepRegion(region);
-    if (in_use) {
-      prev = region;
-      region = region->next();
-    } else {
-      Region* next = region->next();
+    Region* next = region->next();
+    if (ShouldEvacuate(region)) {
       if (prev == nullptr) {
         regions_ = next;
       } else {
         prev->set_next(next);
       }
-      old_capacity_ -= region->size();
-      region->Free();
-      region = next;
+      region->set_next(evacuated);
+      evacuated = region;
+    } else {
+      prev = region;
+    }
+    region = next;
+  }
+  if (evacuated == nullptr) {
+    return;
+  }
+
+  // Don't allocate copies into the regions being evacuated.
+  freelist_.Reset();
+  for (region = regions_; region != nullptr; region = region->next()) {
+    uword scan = region->object_start();
+    while (scan < region->object_end()) {
+      HeapObject obj = HeapObject::FromAddr(scan);
+      intptr_t size = obj->HeapSize();
+      if (obj->IsFreeListElement()) {
+        freelist_.EnqueueRange(scan, size);
+      }
+      scan += size;
+    }
+  }
+
+  interpreter_->GCPrologue();  // Before creating forwarders!
+
+  for (region = evacuated; region != nullptr; region = region->next()) {
+    uword scan = region->object_start();
+    while (scan < region->object_end()) {
+      HeapObject obj = HeapObject::FromAddr(scan);
+      intptr_t heap_size = obj->HeapSize();
+      if (obj->cid() >= kFirstLegalCid) {
+        uword addr = AllocateOldSmall(heap_size, kForceGrowth);
+        memcpy(reinterpret_cast<void*>(addr),
+               reinterpret_cast<void*>(obj->Addr()),
+               heap_size);
+        old_size_ -= heap_size;
+
+        HeapObject::Initialize(obj->Addr(), kForwardingCorpseCid, heap_size);
+        ForwardingCorpse corpse = static_cast<ForwardingCorpse>(obj);
+        if (obj->heap_size() == 0) {
+          corpse->set_overflow_size(heap_size);
+        }
+        ASSERT(obj->HeapSize() == heap_size);
+        corpse->set_target(HeapObject::FromAddr(addr));
+      }
+      scan += heap_size;
     }
   }
+
+  // Unlike become:, moved classes keep their ids.
+  for (intptr_t cid = kFirstLegalCid; cid < class_table_size_; cid++) {
+    ForwardPointer(&class_table_[cid]);
+  }
+  ForwardRoots();
+  ForwardHeap();  // Rebuilds the remembered set.
+#if OUT_OF_LINE_HASH
+  MournIdentityHashesForwarded();
+#endif
+
+  interpreter_->GCEpilogue();
+  interpreter_->FlushNativeCode();  // Methods have moved.
+
+  while (evacuated != nullptr) {
+    Region* next = evacuated->next();
+    old_capacity_ -= evacuated->size();
+    evacuated->Free();
+    evacuated = next;
+  }
+
+  if (FLAG_report_gc) {
+    int64_t stop = OS::CurrentMonotonicNanos();
+    int64_t time = stop - start;
+    Log::Print("report_gc",
+               "Compact (%" Pd "kB old, %" Pd "kB released, %" Pd64 " us)",
+               old_size_ / KB,
+               static_cast<intptr_t>(capacity_before - old_capacity_) / KB,
+               time / kNanosecondsPerMicrosecond);
+  }
 }
 
 bool Heap::SweepRegion(Region* region) {
@@ -806,9 +2603,7 @@ bool Heap::SweepRegion(Region* region) {
     HeapObject obj = HeapObject::FromAddr(scan);
     if (obj->is_marked()) {
       obj->set_is_marked(false);
-      intptr_t size = obj->HeapSize();
-      old_size_ += size;
-      scan += size;
+      scan += obj->HeapSize();
     } else {
       uword free_scan = scan + obj->HeapSize();
       while (free_scan < end) {
@@ -824,6 +2619,13 @@ bool Heap::SweepRegion(Region* region) {
       }
 
       freelist_.EnqueueRange(scan, free_scan - scan);
+      // Past the free-list element's header. Discarding within a huge page
+      // would split it.
+      if ((free_scan - scan >= static_cast<uword>(kMinDiscard)) &&
+          !huge_pages_) {
+        uword discard = scan + sizeof(FreeListElement::Layout);
+        region->Discard(discard, free_scan - discard);
+      }
       scan = free_scan;
     }
   }
@@ -831,13 +2633,49 @@ bool Heap::SweepRegion(Region* region) {
 }
 
 void Heap::SetOldAllocationLimit() {
-  old_limit_ = old_size_ + old_size_ / 2;
+  old_limit_ = old_size_ + old_size_ / 100 * old_growth_;
+  if (heap_limit_ != 0) {
+    size_t new_space = to_.size() + from_.size();
+    if ((heap_limit_ > new_space) && (old_limit_ > heap_limit_ - new_space)) {
+      old_limit_ = heap_limit_ - new_space;
+    }
+  }
   if (old_limit_ < old_size_ + 2 * kRegionSize) {
     old_limit_ = old_size_ + 2 * kRegionSize;
   }
-  if (TRACE_GROWTH) {
-    OS::PrintErr("Old %" Pd "kB size, %" Pd "kB capacity, %" Pd "kB limit\n",
-                 old_size_ / KB, old_capacity_ / KB, old_limit_ / KB);
+  if (FLAG_trace_growth) {
+    Log::Print("trace_growth",
+               "Old %" Pd "kB size, %" Pd "kB capacity, %" Pd "kB limit",
+               old_size_ / KB, old_capacity_ / KB, old_limit_ / KB);
+  }
+}
+
+void Heap::UpdatePretenuring() {
+  // Objects are tenured a scavenge or two after they are allocated, so both
+  // counts span several scavenges.
+  for (intptr_t cid = kFirstLegalCid; cid < class_table_size_; cid++) {
+    SurvivalFeedback* feedback = &feedback_[cid];
+    if (feedback->allocated < kPretenureSamples) {
+      continue;
+    }
+    if ((cid != kEphemeronCid) &&
+        (static_cast<uint64_t>(feedback->tenured) * 100 >=
+         static_cast<uint64_t>(feedback->allocated) * kPretenureSurvival)) {
+      feedback->pretenure = true;
+      if (FLAG_trace_growth) {
+        Log::Print("trace_growth", "Pretenuring cid %" Pd, cid);
+      }
+    }
+    feedback->allocated = 0;
+    feedback->tenured = 0;
+  }
+}
+
+void Heap::ResetPretenuring() {
+  // Pretenured objects that die only show up as old-space garbage, so each
+  // mark-sweep makes the classes prove themselves again.
+  for (intptr_t cid = 0; cid < class_table_size_; cid++) {
+    feedback_[cid] = SurvivalFeedback();
   }
 }
 
@@ -847,9 +2685,14 @@ void Heap::AddToEphemeronList(Ephemeron survivor) {
   ephemeron_list_ = survivor;
 }
 
-static bool IsScavengeSurvivor(Object obj) {
-  return obj->IsImmediateOrOldObject() ||
-      IsForwarded(static_cast<HeapObject>(obj));
+void Heap::RequeueEphemerons(HeapObject key) {
+  // The key was just reached: what waited on it is scanned with the next list.
+  Ephemeron survivor = ephemeron_index_.Take(key);
+  while (survivor != nullptr) {
+    Ephemeron next = survivor->next();
+    AddToEphemeronList(survivor);
+    survivor = next;
+  }
 }
 
 void Heap::ScavengeEphemeronList() {
@@ -874,9 +2717,8 @@ void Heap::ScavengeEphemeronList() {
         AddToRememberedSet(survivor);
       }
     } else {
-      // Fate of key is not yet known, return the ephemeron to list.
-      survivor->set_next(ephemeron_list_);
-      ephemeron_list_ = survivor;
+      // Fate of key is not yet known, wait for it to be reached.
+      ephemeron_index_.Add(static_cast<HeapObject>(survivor->key()), survivor);
     }
 
     survivor = next;
@@ -912,9 +2754,8 @@ void Heap::MarkEphemeronList() {
         AddToRememberedSet(survivor);
       }
     } else {
-      // Fate of the key is not yet known; add the ephemeron back to the list.
-      survivor->set_next(ephemeron_list_);
-      ephemeron_list_ = survivor;
+      // Fate of the key is not yet known; wait for it to be marked.
+      ephemeron_index_.Add(static_cast<HeapObject>(survivor->key()), survivor);
     }
 
     survivor = next;
@@ -923,8 +2764,8 @@ void Heap::MarkEphemeronList() {
 
 void Heap::MournEphemeronList() {
   Object nil = interpreter_->nil_obj();
-  Ephemeron survivor = ephemeron_list_;
-  ephemeron_list_ = nullptr;
+  ASSERT(ephemeron_list_ == nullptr);
+  Ephemeron survivor = ephemeron_index_.TakeAll();
 
   while (survivor != nullptr) {
     ASSERT(survivor->IsEphemeron());
@@ -952,18 +2793,29 @@ void Heap::MournWeakListScavenge() {
   weak_list_ = nullptr;
   while (survivor != nullptr) {
     ASSERT(survivor->IsWeakArray());
+    if (survivor->is_carded()) {
+      MournCardsScavenge(survivor);
+      WeakArray next = survivor->next();
+      survivor->set_next(nullptr);
+      survivor = next;
+      continue;
+    }
 
     Object* from;
     Object* to;
     survivor->Pointers(&from, &to);
+    intptr_t cleared = 0;
     for (Object* ptr = from; ptr <= to; ptr++) {
-      MournWeakPointerScavenge(ptr);
+      if (MournWeakPointerScavenge(ptr)) {
+        cleared++;
+      }
       if (survivor->IsOldObject() &&
           (*ptr)->IsNewObject() &&
           !survivor->is_remembered()) {
         AddToRememberedSet(survivor);
       }
     }
+    CountCleared(survivor, cleared);
 
     WeakArray next = survivor->next();
     survivor->set_next(nullptr);
@@ -972,6 +2824,43 @@ void Heap::MournWeakListScavenge() {
   ASSERT(weak_list_ == nullptr);
 }
 
+void Heap::MournCardsScavenge(WeakArray survivor) {
+  // As ScavengeCards, but weak.
+  ASSERT(survivor->IsOldObject());
+  ASSERT(!survivor->is_remembered());
+  Region* region = Region::Of(survivor);
+  uint8_t* cards = region->cards();
+  Object* from;
+  Object* to;
+  survivor->Pointers(&from, &to);
+  bool remembered = false;
+  intptr_t cleared = 0;
+  for (intptr_t i = 0; i < region->num_cards(); i++) {
+    if (cards[i] == 0) {
+      continue;
+    }
+    cards[i] = 0;
+    Object* card_from =
+        reinterpret_cast<Object*>(survivor->Addr() + i * kCardSize);
+    Object* card_to = card_from + (kCardSize / sizeof(Object)) - 1;
+    if (card_from < from) card_from = from;
+    if (card_to > to) card_to = to;
+    for (Object* ptr = card_from; ptr <= card_to; ptr++) {
+      if (MournWeakPointerScavenge(ptr)) {
+        cleared++;
+      }
+      if ((*ptr)->IsNewObject()) {
+        cards[i] = 1;
+      }
+    }
+    remembered |= cards[i] != 0;
+  }
+  if (remembered) {
+    PushRememberedSet(survivor);
+  }
+  CountCleared(survivor, cleared);
+}
+
 void Heap::MournWeakListMarkSweep() {
   WeakArray survivor = weak_list_;
   weak_list_ = nullptr;
@@ -981,8 +2870,11 @@ void Heap::MournWeakListMarkSweep() {
     Object* from;
     Object* to;
     survivor->Pointers(&from, &to);
+    intptr_t cleared = 0;
     for (Object* ptr = from; ptr <= to; ptr++) {
-      MournWeakPointerMarkSweep(ptr);
+      if (MournWeakPointerMarkSweep(ptr)) {
+        cleared++;
+      }
       if (survivor->IsOldObject() &&
           (*ptr)->IsNewObject() &&
           !survivor->is_remembered()) {
@@ -990,6 +2882,8 @@ void Heap::MournWeakListMarkSweep() {
       }
     }
 
+    CountCleared(survivor, cleared);
+
     WeakArray next = survivor->next();
     survivor->set_next(nullptr);
     survivor = next;
@@ -998,37 +2892,51 @@ void Heap::MournWeakListMarkSweep() {
 }
 
 
-void Heap::MournWeakPointerScavenge(Object* ptr) {
+bool Heap::MournWeakPointerScavenge(Object* ptr) {
   HeapObject old_target = static_cast<HeapObject>(*ptr);
   if (old_target->IsImmediateOrOldObject()) {
-    return;
+    return false;
   }
 
   DEBUG_ASSERT(InFromSpace(old_target));
 
   HeapObject new_target;
-  if (IsForwarded(old_target)) {
-    new_target = ForwardingTarget(old_target);
-  } else {
+  bool died = !IsForwarded(old_target);
+  if (died) {
     // The object store and nil have already been scavenged.
     new_target = static_cast<HeapObject>(interpreter_->nil_obj());
+  } else {
+    new_target = ForwardingTarget(old_target);
   }
 
   DEBUG_ASSERT(new_target->IsOldObject() || InToSpace(new_target));
 
   *ptr = new_target;
+  return died;
 }
 
-void Heap::MournWeakPointerMarkSweep(Object* ptr) {
+bool Heap::MournWeakPointerMarkSweep(Object* ptr) {
   Object target = *ptr;
 
   if (IsMarkSweepSurvivor(target)) {
     // Target is still alive.
-    return;
+    return false;
   }
 
   ASSERT(IsMarkSweepSurvivor(interpreter_->nil_obj()));
   *ptr = interpreter_->nil_obj();
+  return true;
+}
+
+void Heap::CountCleared(WeakArray survivor, intptr_t cleared) {
+  if (cleared == 0) {
+    return;
+  }
+  intptr_t count = survivor->cleared()->value() + cleared;
+  if (count > SmallInteger::kMaxValue) {
+    count = SmallInteger::kMaxValue;
+  }
+  survivor->set_cleared(SmallInteger::New(count));
 }
 
 void Heap::MournClassTableScavenge() {
@@ -1054,20 +2962,67 @@ void Heap::MournClassTableScavenge() {
 }
 
 void Heap::MournClassTableMarkSweep() {
+  intptr_t live = 0;
   for (intptr_t i = kFirstLegalCid; i < class_table_size_; i++) {
     Object* ptr = &class_table_[i];
 
     Object target = *ptr;
 
     if (IsMarkSweepSurvivor(target)) {
+      live++;
       continue;
     }
 
     *ptr = SmallInteger::New(class_table_free_);
     class_table_free_ = i;
   }
+
+  // Like old space, let the table grow by old_growth_ percent of what
+  // survived before filling it up forces a collection.
+  // Never past the ids the header can hold, so that the table is not grown
+  // into ids it cannot use while a collection might yet free some.
+  class_table_limit_ = live + live / 100 * old_growth_;
+  if (class_table_limit_ > kMaxClassIds) {
+    class_table_limit_ = kMaxClassIds;
+  }
+  if (class_table_limit_ < class_table_capacity_) {
+    class_table_limit_ = class_table_capacity_;
+  }
+  ASSERT(class_table_limit_ <= kMaxClassIds);
+}
+
+#if OUT_OF_LINE_HASH
+static HeapObject ScavengedKey(HeapObject key) {
+  if (key->IsOldObject()) {
+    return key;
+  }
+  return IsForwarded(key) ? ForwardingTarget(key) : nullptr;
+}
+
+void Heap::MournIdentityHashesScavenge() {
+  identity_hashes_.Rekey(ScavengedKey);
+}
+
+static HeapObject MarkedKey(HeapObject key) {
+  return key->is_marked() ? key : nullptr;
+}
+
+void Heap::MournIdentityHashesMarkSweep() {
+  identity_hashes_.Rekey(MarkedKey);
+}
+
+static HeapObject ForwardedKey(HeapObject key) {
+  if (!key->IsForwardingCorpse()) {
+    return key;
+  }
+  return static_cast<HeapObject>(static_cast<ForwardingCorpse>(key)->target());
 }
 
+void Heap::MournIdentityHashesForwarded() {
+  identity_hashes_.Rekey(ForwardedKey);
+}
+#endif  // OUT_OF_LINE_HASH
+
 void Heap::MournClassTableForwarded() {
   for (intptr_t i = kFirstLegalCid; i < class_table_size_; i++) {
     Behavior old_class = static_cast<Behavior>(class_table_[i]);
@@ -1081,27 +3036,72 @@ void Heap::MournClassTableForwarded() {
   }
 }
 
-bool Heap::BecomeForward(Array old, Array neu) {
+bool Heap::CanBecomeForward(Array old, Array neu) {
   if (old->Size() != neu->Size()) {
     return false;
   }
-
-  intptr_t length = old->Size();
-  if (TRACE_BECOME) {
-    OS::PrintErr("become(%" Pd ")\n", length);
-  }
-
-  for (intptr_t i = 0; i < length; i++) {
+  for (intptr_t i = 0; i < old->Size(); i++) {
     Object forwarder = old->element(i);
     Object forwardee = neu->element(i);
     if (forwarder->IsImmediateObject() ||
         forwardee->IsImmediateObject()) {
       return false;
     }
+    if (static_cast<HeapObject>(forwarder)->is_shared() ||
+        static_cast<HeapObject>(forwardee)->is_shared()) {
+      return false;  // Other isolates see them too.
+    }
+  }
+  return true;
+}
+
+bool Heap::BecomeForward(Array old, Array neu) {
+  if (!CanBecomeForward(old, neu)) {
+    return false;
+  }
+  if (FLAG_trace_become) {
+    Log::Print("trace_become", "become(%" Pd ")", old->Size());
   }
 
+  AbortIncrementalMarking();  // Marks are used for forwarding class ids.
+  FinishSweep();  // Dead objects must not be forwarded.
   interpreter_->GCPrologue();  // Before creating forwarders!
 
+  CreateForwarders(old, neu);
+  ForwardAll();
+  return true;
+}
+
+bool Heap::BecomeForwardAll(Array olds, Array news) {
+  if (olds->Size() != news->Size()) {
+    return false;
+  }
+  for (intptr_t i = 0; i < olds->Size(); i++) {
+    Array old = static_cast<Array>(olds->element(i));
+    Array neu = static_cast<Array>(news->element(i));
+    if (!old->IsArray() || !neu->IsArray() || !CanBecomeForward(old, neu)) {
+      return false;
+    }
+  }
+  if (FLAG_trace_become) {
+    Log::Print("trace_become", "become(%" Pd " arrays)", olds->Size());
+  }
+
+  AbortIncrementalMarking();
+  FinishSweep();
+  interpreter_->GCPrologue();
+
+  for (intptr_t i = 0; i < olds->Size(); i++) {
+    CreateForwarders(static_cast<Array>(olds->element(i)),
+                     static_cast<Array>(news->element(i)));
+  }
+
+  ForwardAll();
+  return true;
+}
+
+void Heap::CreateForwarders(Array old, Array neu) {
+  intptr_t length = old->Size();
   for (intptr_t i = 0; i < length; i++) {
     HeapObject forwarder = static_cast<HeapObject>(old->element(i));
     HeapObject forwardee = static_cast<HeapObject>(neu->element(i));
@@ -1109,7 +3109,10 @@ bool Heap::BecomeForward(Array old, Array neu) {
     ASSERT(!forwarder->IsForwardingCorpse());
     ASSERT(!forwardee->IsForwardingCorpse());
 
-    forwardee->set_header_hash(forwarder->header_hash());
+    SetIdentityHash(forwardee, IdentityHash(forwarder));
+#if OUT_OF_LINE_HASH
+    identity_hashes_.Insert(forwarder, 0);
+#endif
 
     intptr_t heap_size = forwarder->HeapSize();
 
@@ -1123,15 +3126,16 @@ bool Heap::BecomeForward(Array old, Array neu) {
 
     corpse->set_target(forwardee);
   }
+}
 
+void Heap::ForwardAll() {
   ForwardClassIds();
   ForwardRoots();
   ForwardHeap();  // With forwarded class ids.
   MournClassTableForwarded();
 
   interpreter_->GCEpilogue();
-
-  return true;
+  interpreter_->FlushNativeCode();  // Methods may have been forwarded.
 }
 
 void Heap::ForwardRoots() {
@@ -1145,9 +3149,10 @@ void Heap::ForwardRoots() {
   for (Object* ptr = from; ptr <= to; ptr++) {
     ForwardPointer(ptr);
   }
-  interpreter_->StackPointers(&from, &to);
-  for (Object* ptr = from; ptr <= to; ptr++) {
-    ForwardPointer(ptr);
+  for (intptr_t i = 0; interpreter_->StackPointers(i, &from, &to); i++) {
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      ForwardPointer(ptr);
+    }
   }
 }
 
@@ -1239,31 +3244,28 @@ intptr_t Heap::AllocateClassId() {
     class_table_free_ =
         static_cast<SmallInteger>(class_table_[cid])->value();
   } else if (class_table_size_ == class_table_capacity_) {
-    if (TRACE_GROWTH) {
-      OS::PrintErr("Scavenging to free class table entries\n");
+    // Dead classes' ids come back with ordinary mark-sweeps, so only force
+    // one when growing would pass the limit set by the last.
+    if (class_table_capacity_ >= class_table_limit_) {
+      if (FLAG_trace_growth) {
+        Log::Print("trace_growth", "Collecting to free class table entries");
+      }
+      CollectAll(kClassTable);
     }
-    CollectAll(kClassTable);
     if (class_table_free_ != 0) {
       cid = class_table_free_;
       class_table_free_ =
           static_cast<SmallInteger>(class_table_[cid])->value();
     } else {
-      class_table_capacity_ += (class_table_capacity_ >> 1);
-      if (TRACE_GROWTH) {
-        OS::PrintErr("Growing class table to %" Pd "\n",
-                     class_table_capacity_);
-      }
-      Object* old_class_table = class_table_;
-      class_table_ = new Object[class_table_capacity_];
-      for (intptr_t i = 0; i < class_table_size_; i++) {
-        class_table_[i] = old_class_table[i];
+      intptr_t capacity = class_table_capacity_ * 2;
+      if (capacity > kMaxClassIds) {
+        capacity = kMaxClassIds;
       }
-#if defined(DEBUG)
-      for (intptr_t i = class_table_size_; i < class_table_capacity_; i++) {
-        class_table_[i] = static_cast<Object>(kUnallocatedWord);
+      if (capacity == class_table_capacity_) {
+        // Collected above, since the limit is never past the last id.
+        FATAL1("Out of class ids at %" Pd "\n", class_table_size_);
       }
-#endif
-      delete[] old_class_table;
+      GrowClassTable(capacity);
       cid = class_table_size_;
       class_table_size_++;
     }
@@ -1271,12 +3273,332 @@ intptr_t Heap::AllocateClassId() {
     cid = class_table_size_;
     class_table_size_++;
   }
+  ASSERT(cid < kMaxClassIds);
 #if defined(DEBUG)
   class_table_[cid] = static_cast<Object>(kUninitializedWord);
 #endif
+  feedback_[cid] = SurvivalFeedback();  // Perhaps a dead class's.
   return cid;
 }
 
+void Heap::ReserveClassIds(intptr_t count) {
+  if (class_table_size_ + count > kMaxClassIds) {
+    FATAL1("Out of class ids at %" Pd "\n", class_table_size_ + count);
+  }
+  if (class_table_capacity_ - class_table_size_ < count) {
+    intptr_t capacity =
+        class_table_size_ + count + (class_table_capacity_ >> 1);
+    if (capacity > kMaxClassIds) {
+      capacity = kMaxClassIds;
+    }
+    GrowClassTable(capacity);
+  }
+}
+
+void Heap::GrowClassTable(intptr_t capacity) {
+  ASSERT(capacity > class_table_capacity_);
+  ASSERT(capacity <= kMaxClassIds);
+  class_table_capacity_ = capacity;
+  if (FLAG_trace_growth) {
+    Log::Print("trace_growth", "Growing class table to %" Pd,
+               class_table_capacity_);
+  }
+  Object* old_class_table = class_table_;
+  class_table_ = new Object[class_table_capacity_];
+  for (intptr_t i = 0; i < class_table_size_; i++) {
+    class_table_[i] = old_class_table[i];
+  }
+#if defined(DEBUG)
+  for (intptr_t i = class_table_size_; i < class_table_capacity_; i++) {
+    class_table_[i] = static_cast<Object>(kUnallocatedWord);
+  }
+#endif
+  delete[] old_class_table;
+  SurvivalFeedback* old_feedback = feedback_;
+  feedback_ = new SurvivalFeedback[class_table_capacity_]();
+  for (intptr_t i = 0; i < class_table_size_; i++) {
+    feedback_[i] = old_feedback[i];
+  }
+  delete[] old_feedback;
+}
+
+HeapImage::~HeapImage() {
+  for (intptr_t i = 0; i < num_regions_; i++) {
+    delete[] regions_[i].objects;
+  }
+  delete[] regions_;
+  delete[] class_table_;
+  while (shared_ != nullptr) {
+    Region* next = shared_->next();
+    shared_->Free();
+    shared_ = next;
+  }
+}
+
+HeapImage* Heap::CaptureImage(Object root) {
+  ASSERT(!marking_);
+  ASSERT(top_ == to_.object_start());  // Snapshots are read into old space.
+  FinishSweep();
+
+  HeapImage* image = new HeapImage();
+  for (Region* region = regions_; region != nullptr; region = region->next()) {
+    image->num_regions_++;
+  }
+  image->regions_ = new HeapImage::RegionImage[image->num_regions_];
+  intptr_t i = 0;
+  for (Region* region = regions_; region != nullptr; region = region->next()) {
+    ASSERT(region->cards() == nullptr);
+    HeapImage::RegionImage* copy = &image->regions_[i++];
+    copy->object_start = region->object_start();
+    copy->size = region->size();
+    copy->used = region->Size();
+    copy->objects = new uint8_t[copy->used];
+    memcpy(copy->objects, reinterpret_cast<void*>(region->object_start()),
+           copy->used);
+  }
+
+  image->class_table_ = new Object[class_table_size_];
+  for (intptr_t cid = 0; cid < class_table_size_; cid++) {
+    image->class_table_[cid] = class_table_[cid];
+  }
+  image->class_table_size_ = class_table_size_;
+  image->class_table_free_ = class_table_free_;
+  image->old_size_ = old_size_;
+  image->root_ = root;
+  ShareCanonicalStrings(image);
+  return image;
+}
+
+// Where the regions of a HeapImage were and where their copies are, sorted by
+// the old addresses.
+class ImageRelocation {
+ public:
+  explicit ImageRelocation(intptr_t capacity)
+      : starts_(new uword[capacity]), ends_(new uword[capacity]),
+        deltas_(new uword[capacity]), size_(0), last_(0) {}
+  ~ImageRelocation() {
+    delete[] starts_;
+    delete[] ends_;
+    delete[] deltas_;
+  }
+
+  void Add(uword old_start, intptr_t size, uword new_start) {
+    intptr_t i = size_++;
+    while ((i > 0) && (starts_[i - 1] > old_start)) {
+      starts_[i] = starts_[i - 1];
+      ends_[i] = ends_[i - 1];
+      deltas_[i] = deltas_[i - 1];
+      i--;
+    }
+    starts_[i] = old_start;
+    ends_[i] = old_start + size;
+    deltas_[i] = new_start - old_start;
+  }
+
+  Object Relocate(Object obj) {
+    if (obj->IsImmediateObject()) {
+      return obj;
+    }
+    uword addr = static_cast<HeapObject>(obj)->Addr();
+    // Most pointers are to objects near the last one.
+    if ((addr >= starts_[last_]) && (addr < ends_[last_])) {
+      return static_cast<Object>(static_cast<uword>(obj) + deltas_[last_]);
+    }
+    intptr_t low = 0;
+    intptr_t high = size_ - 1;
+    while (low <= high) {
+      intptr_t mid = low + (high - low) / 2;
+      if (addr < starts_[mid]) {
+        high = mid - 1;
+      } else if (addr >= ends_[mid]) {
+        low = mid + 1;
+      } else {
+        last_ = mid;
+        return static_cast<Object>(static_cast<uword>(obj) + deltas_[mid]);
+      }
+    }
+    return obj;  // Not a pointer into the image, such as an unused cid.
+  }
+
+ private:
+  uword* starts_;
+  uword* ends_;
+  uword* deltas_;
+  intptr_t size_;
+  intptr_t last_;
+
+  DISALLOW_COPY_AND_ASSIGN(ImageRelocation);
+};
+
+// Canonical strings never change and hold no pointers, so the heaps loaded
+// from an image all refer to one copy of each kept with the image, and the
+// space they took in the copied regions is free. The copy is always marked, so
+// no heap's collector touches it.
+void Heap::ShareCanonicalStrings(HeapImage* image) {
+  // Move the strings out of the copied regions, leaving forwarders.
+  Region* shared = nullptr;
+  for (intptr_t i = 0; i < image->num_regions_; i++) {
+    const HeapImage::RegionImage* copy = &image->regions_[i];
+    uword scan = reinterpret_cast<uword>(copy->objects);
+    uword end = scan + copy->used;
+    while (scan < end) {
+      HeapObject obj = HeapObject::FromAddr(scan);
+      intptr_t size = obj->HeapSize();
+      if ((obj->cid() == kStringCid) && obj->is_canonical()) {
+        uword addr = (shared == nullptr) ? 0 : shared->TryAllocate(size);
+        if (addr == 0) {
+          intptr_t region_size = size + AllocationSize(sizeof(Region));
+          if (region_size < static_cast<intptr_t>(kRegionSize)) {
+            region_size = kRegionSize;
+          }
+          shared = Region::Allocate(region_size);
+          shared->set_next(image->shared_);
+          image->shared_ = shared;
+          addr = shared->TryAllocate(size);
+        }
+        memcpy(reinterpret_cast<void*>(addr), reinterpret_cast<void*>(scan),
+               size);
+        String string = static_cast<String>(HeapObject::FromAddr(addr));
+        string->EnsureHash(interpreter_->isolate());
+        string->set_is_marked(true);
+        string->set_is_shared(true);
+        image->shared_size_ += size;
+
+        HeapObject::Initialize(scan, kForwardingCorpseCid, size);
+        ForwardingCorpse corpse = static_cast<ForwardingCorpse>(obj);
+        if (corpse->heap_size() == 0) {
+          corpse->set_overflow_size(size);
+        }
+        corpse->set_target(string);
+      }
+      scan += size;
+    }
+  }
+  if (shared == nullptr) {
+    return;
+  }
+
+  // The copied objects still point where the originals were.
+  ImageRelocation copies(image->num_regions_);
+  for (intptr_t i = 0; i < image->num_regions_; i++) {
+    const HeapImage::RegionImage* copy = &image->regions_[i];
+    copies.Add(copy->object_start, copy->used,
+               reinterpret_cast<uword>(copy->objects));
+  }
+  for (intptr_t i = 0; i < image->num_regions_; i++) {
+    const HeapImage::RegionImage* copy = &image->regions_[i];
+    uword scan = reinterpret_cast<uword>(copy->objects);
+    uword end = scan + copy->used;
+    while (scan < end) {
+      HeapObject obj = HeapObject::FromAddr(scan);
+      if (obj->cid() >= kFirstLegalCid) {
+        Object* from;
+        Object* to;
+        obj->Pointers(&from, &to);
+        for (Object* ptr = from; ptr <= to; ptr++) {
+          Object target = copies.Relocate(*ptr);
+          if ((target != *ptr) &&
+              static_cast<HeapObject>(target)->IsForwardingCorpse()) {
+            *ptr = static_cast<ForwardingCorpse>(target)->target();
+          }
+        }
+      }
+      scan += obj->HeapSize();
+    }
+  }
+
+  // Free the forwarders.
+  for (intptr_t i = 0; i < image->num_regions_; i++) {
+    const HeapImage::RegionImage* copy = &image->regions_[i];
+    uword scan = reinterpret_cast<uword>(copy->objects);
+    uword end = scan + copy->used;
+    while (scan < end) {
+      HeapObject obj = HeapObject::FromAddr(scan);
+      intptr_t size = obj->HeapSize();
+      if (obj->cid() == kForwardingCorpseCid) {
+        HeapObject::Initialize(scan, kFreeListElementCid, size);
+        FreeListElement element = static_cast<FreeListElement>(obj);
+        if (element->heap_size() == 0) {
+          element->set_overflow_size(size);
+        }
+      }
+      scan += size;
+    }
+  }
+  image->old_size_ -= image->shared_size_;
+
+  if (FLAG_trace_growth) {
+    Log::Print("trace_growth", "Shared %" Pd "kB of canonical strings",
+               image->shared_size_ / KB);
+  }
+}
+
+Object Heap::LoadImage(const HeapImage* image) {
+  ASSERT(regions_ == nullptr);
+  ASSERT(class_table_size_ == kFirstRegularObjectCid);
+  int64_t start = OS::CurrentMonotonicNanos();
+
+  // Copy the regions, keeping their order in the list.
+  ImageRelocation relocation(image->num_regions_);
+  for (intptr_t i = image->num_regions_ - 1; i >= 0; i--) {
+    const HeapImage::RegionImage* copy = &image->regions_[i];
+    Region* region = NewRegion(copy->size);
+    memcpy(reinterpret_cast<void*>(region->object_start()), copy->objects,
+           copy->used);
+    region->set_object_end(region->object_start() + copy->used);
+    old_capacity_ += region->size();
+    region->set_next(regions_);
+    regions_ = region;
+    relocation.Add(copy->object_start, copy->used, region->object_start());
+  }
+
+  for (Region* region = regions_; region != nullptr; region = region->next()) {
+    uword scan = region->object_start();
+    while (scan < region->object_end()) {
+      HeapObject obj = HeapObject::FromAddr(scan);
+      intptr_t size = obj->HeapSize();
+      if (obj->cid() == kFreeListElementCid) {
+        freelist_.EnqueueRange(scan, size);
+      } else {
+        Object* from;
+        Object* to;
+        obj->Pointers(&from, &to);
+        for (Object* ptr = from; ptr <= to; ptr++) {
+          *ptr = relocation.Relocate(*ptr);
+        }
+      }
+      scan += size;
+    }
+  }
+
+  if (image->class_table_size_ > class_table_capacity_) {
+    delete[] class_table_;
+    delete[] feedback_;
+    class_table_capacity_ = image->class_table_size_;
+    class_table_ = new Object[class_table_capacity_];
+    feedback_ = new SurvivalFeedback[class_table_capacity_]();
+  }
+#if defined(DEBUG)
+  for (intptr_t i = image->class_table_size_; i < class_table_capacity_; i++) {
+    class_table_[i] = static_cast<Object>(kUnallocatedWord);
+  }
+#endif
+  for (intptr_t cid = 0; cid < image->class_table_size_; cid++) {
+    class_table_[cid] = relocation.Relocate(image->class_table_[cid]);
+  }
+  class_table_size_ = image->class_table_size_;
+  class_table_free_ = image->class_table_free_;
+  old_size_ = image->old_size_;
+
+  if (FLAG_trace_growth) {
+    Log::Print("trace_growth", "Loaded %" Pd "kB heap image in %" Pd " us",
+               old_size_ / KB,
+               (OS::CurrentMonotonicNanos() - start) /
+                   kNanosecondsPerMicrosecond);
+  }
+  return relocation.Relocate(image->root_);
+}
+
 void Heap::InitializeAfterSnapshot() {
   // Classes are registered before they are known to have been initialized, so
   // we have to delay setting the ids in the class objects or risk them being
@@ -1297,6 +3619,7 @@ void Heap::InitializeAfterSnapshot() {
 }
 
 intptr_t Heap::CountInstances(intptr_t cid) {
+  FinishSweep();  // Leave out the dead.
   intptr_t instances = 0;
   uword scan = to_.object_start();
   while (scan < top_) {
@@ -1320,6 +3643,7 @@ intptr_t Heap::CountInstances(intptr_t cid) {
 }
 
 intptr_t Heap::CollectInstances(intptr_t cid, Array array) {
+  FinishSweep();
   intptr_t instances = 0;
   uword scan = to_.object_start();
   while (scan < top_) {
@@ -1344,35 +3668,189 @@ intptr_t Heap::CollectInstances(intptr_t cid, Array array) {
   return instances;
 }
 
+intptr_t* Heap::InstanceSlots(Array classes) {
+  // Maps cids to indices of classes, so one walk of the heap serves them all.
+  intptr_t* slots = new intptr_t[class_table_size_];
+  for (intptr_t cid = 0; cid < class_table_size_; cid++) {
+    slots[cid] = -1;
+  }
+  Object nil = interpreter_->nil_obj();
+  for (intptr_t i = 0; i < classes->Size(); i++) {
+    Behavior cls = static_cast<Behavior>(classes->element(i));
+    if (cls->id() == nil) {
+      continue;  // Not yet registered: no instance has been allocated.
+    }
+    ASSERT(cls->id()->IsSmallInteger());
+    intptr_t cid = cls->id()->value();
+    ASSERT((cid > kIllegalCid) && (cid < class_table_size_));
+    if (slots[cid] != -1) {
+      delete[] slots;
+      return nullptr;
+    }
+    slots[cid] = i;
+  }
+  return slots;
+}
+
+bool Heap::CountInstances(Array classes, intptr_t* counts) {
+  intptr_t* slots = InstanceSlots(classes);
+  if (slots == nullptr) {
+    return false;
+  }
+  for (intptr_t i = 0; i < classes->Size(); i++) {
+    counts[i] = 0;
+  }
+
+  FinishSweep();  // Leave out the dead.
+  uword scan = to_.object_start();
+  while (scan < top_) {
+    HeapObject obj = HeapObject::FromAddr(scan);
+    intptr_t slot = slots[obj->cid()];
+    if (slot != -1) {
+      counts[slot]++;
+    }
+    scan += obj->HeapSize();
+  }
+  for (Region* region = regions_; region != nullptr; region = region->next()) {
+    uword scan = region->object_start();
+    while (scan < region->object_end()) {
+      HeapObject obj = HeapObject::FromAddr(scan);
+      intptr_t slot = slots[obj->cid()];
+      if (slot != -1) {
+        counts[slot]++;
+      }
+      scan += obj->HeapSize();
+    }
+  }
+  delete[] slots;
+  return true;
+}
+
+void Heap::CollectInstances(Array classes, Array results) {
+  intptr_t* slots = InstanceSlots(classes);
+  ASSERT(slots != nullptr);
+  intptr_t* counts = new intptr_t[classes->Size()];
+  for (intptr_t i = 0; i < classes->Size(); i++) {
+    counts[i] = 0;
+  }
+
+  FinishSweep();
+  uword scan = to_.object_start();
+  while (scan < top_) {
+    HeapObject obj = HeapObject::FromAddr(scan);
+    intptr_t slot = slots[obj->cid()];
+    if (slot != -1) {
+      Array result = static_cast<Array>(results->element(slot));
+      if (counts[slot] < result->Size()) {
+        result->set_element(counts[slot]++, obj);
+      }
+    }
+    scan += obj->HeapSize();
+  }
+  for (Region* region = regions_; region != nullptr; region = region->next()) {
+    uword scan = region->object_start();
+    while (scan < region->object_end()) {
+      HeapObject obj = HeapObject::FromAddr(scan);
+      intptr_t slot = slots[obj->cid()];
+      if (slot != -1) {
+        Array result = static_cast<Array>(results->element(slot));
+        if (counts[slot] < result->Size()) {
+          result->set_element(counts[slot]++, obj);
+        }
+      }
+      scan += obj->HeapSize();
+    }
+  }
+  delete[] counts;
+  delete[] slots;
+}
+
 uword FreeList::TryAllocate(intptr_t size) {
+  uword addr = TryAllocateFromSpan(size);
+  if (addr != 0) {
+#if REPORT_FREELIST
+    span_hits_++;
+#endif
+    return addr;
+  }
+
   intptr_t index = IndexForSize(size);
-  while (index < kSizeClasses) {
-    if (free_lists_[index] != nullptr) {
-      FreeListElement element = Dequeue(index);
-      SplitAndRequeue(element, size);
-      return element.Addr();
-    }
-    index++;
+  if ((index < kExactClasses) && (free_lists_[index] != nullptr)) {
+#if REPORT_FREELIST
+    exact_hits_++;
+#endif
+    return Dequeue(index)->Addr();
+  }
+
+  // Every element of a larger class fits.
+  intptr_t larger = NextNonEmpty(index + 1);
+  if (larger < kSizeClasses) {
+#if REPORT_FREELIST
+    class_hits_++;
+#endif
+    FreeListElement element = Dequeue(larger);
+    SplitAndRequeue(element, size);
+    return element->Addr();
+  }
+
+  addr = TryAllocateFirstFit(kSizeClasses, size);
+  if ((addr == 0) && (index >= kExactClasses) && (index < kSizeClasses)) {
+    addr = TryAllocateFirstFit(index, size);
+  }
+#if REPORT_FREELIST
+  if (addr != 0) {
+    first_fit_hits_++;
+  } else {
+    misses_++;
   }
+#endif
+  return addr;
+}
+
+uword FreeList::TryAllocateFromSpan(intptr_t size) {
+  if (span_end_ - span_top_ < static_cast<uword>(size)) {
+    return 0;
+  }
+  uword addr = span_top_;
+  SetSpan(addr + size, span_end_);
+  return addr;
+}
 
+uword FreeList::TryAllocateFirstFit(intptr_t index, intptr_t size) {
   FreeListElement prev = nullptr;
-  FreeListElement element = free_lists_[kSizeClasses];
+  FreeListElement element = free_lists_[index];
   while (element != nullptr) {
     if (element->HeapSize() >= size) {
       if (prev == nullptr) {
-        free_lists_[kSizeClasses] = element->next();
+        free_lists_[index] = element->next();
+        if ((element->next() == nullptr) && (index < kSizeClasses)) {
+          nonempty_[index >> 6] &= ~(static_cast<uint64_t>(1) << (index & 63));
+        }
       } else {
         prev->set_next(element->next());
       }
       SplitAndRequeue(element, size);
       return element->Addr();
     }
+    prev = element;
     element = element->next();
   }
-
   return 0;
 }
 
+intptr_t FreeList::NextNonEmpty(intptr_t index) const {
+  for (intptr_t word = index >> 6; word < kBitmapWords; word++) {
+    uint64_t bits = nonempty_[word];
+    if (word == (index >> 6)) {
+      bits &= ~static_cast<uint64_t>(0) << (index & 63);
+    }
+    if (bits != 0) {
+      return (word << 6) + Utils::LowestBit(bits);
+    }
+  }
+  return kSizeClasses;
+}
+
 void FreeList::SplitAndRequeue(FreeListElement element, intptr_t size) {
   ASSERT(size > 0);
   ASSERT((size & kObjectAlignmentMask) == 0);
@@ -1381,7 +3859,20 @@ void FreeList::SplitAndRequeue(FreeListElement element, intptr_t size) {
   ASSERT(remaining_size >= 0);
   if (remaining_size > 0) {
     uword remaining_addr = element->Addr() + size;
-    EnqueueRange(remaining_addr, remaining_size);
+    uword span_size = span_end_ - span_top_;
+    if (static_cast<uword>(remaining_size) > span_size) {
+      // Keep bumping into the larger of the two.
+      if (span_size > 0) {
+        EnqueueRange(span_top_, span_size);
+      }
+#if defined(DEBUG)
+      memset(reinterpret_cast<void*>(remaining_addr), kUnallocatedByte,
+             remaining_size);
+#endif
+      SetSpan(remaining_addr, remaining_addr + remaining_size);
+    } else {
+      EnqueueRange(remaining_addr, remaining_size);
+    }
   }
 }
 
@@ -1392,6 +3883,9 @@ FreeListElement FreeList::Dequeue(intptr_t index) {
   }
   ASSERT((element->next() == nullptr) || element->next()->IsFreeListElement());
   free_lists_[index] = element->next();
+  if ((element->next() == nullptr) && (index < kSizeClasses)) {
+    nonempty_[index >> 6] &= ~(static_cast<uint64_t>(1) << (index & 63));
+  }
   return element;
 }
 
@@ -1400,12 +3894,12 @@ void FreeList::Enqueue(FreeListElement element) {
   intptr_t index = IndexForSize(element->HeapSize());
   element->set_next(free_lists_[index]);
   free_lists_[index] = element;
+  if (index < kSizeClasses) {
+    nonempty_[index >> 6] |= static_cast<uint64_t>(1) << (index & 63);
+  }
 }
 
-void FreeList::EnqueueRange(uword addr, intptr_t size) {
-#if defined(DEBUG)
-  memset(reinterpret_cast<void*>(addr), kUnallocatedByte, size);
-#endif
+static FreeListElement InitializeFreeListElement(uword addr, intptr_t size) {
   ASSERT(size >= kObjectAlignment);
   ASSERT((addr & kObjectAlignmentMask) == 0);
   ASSERT((size & kObjectAlignmentMask) == 0);
@@ -1417,7 +3911,37 @@ void FreeList::EnqueueRange(uword addr, intptr_t size) {
   }
   ASSERT(object->HeapSize() == size);
   ASSERT(element->HeapSize() == size);
-  Enqueue(element);
+  return element;
+}
+
+void FreeList::EnqueueRange(uword addr, intptr_t size) {
+#if defined(DEBUG)
+  memset(reinterpret_cast<void*>(addr), kUnallocatedByte, size);
+#endif
+  Enqueue(InitializeFreeListElement(addr, size));
+}
+
+void FreeList::SetSpan(uword top, uword end) {
+  ASSERT(top <= end);
+  if (top == end) {
+    span_top_ = span_end_ = 0;
+    return;
+  }
+  span_top_ = top;
+  span_end_ = end;
+  InitializeFreeListElement(top, end - top)->set_next(nullptr);
+}
+
+#if REPORT_FREELIST
+void FreeList::PrintStatistics() {
+  intptr_t total = span_hits_ + exact_hits_ + class_hits_ + first_fit_hits_ +
+      misses_;
+  OS::PrintErr("Freelist (%" Pd " allocations: %" Pd " span, %" Pd " exact, %"
+               Pd " class, %" Pd " first-fit, %" Pd " miss)\n",
+               total, span_hits_, exact_hits_, class_hits_, first_fit_hits_,
+               misses_);
+  span_hits_ = exact_hits_ = class_hits_ = first_fit_hits_ = misses_ = 0;
 }
+#endif
 
 }  // namespace psoup
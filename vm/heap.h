@@ -7,15 +7,20 @@
 
 #include "vm/assert.h"
 #include "vm/flags.h"
+#include "vm/gc_trace.h"
 #include "vm/globals.h"
 #include "vm/object.h"
+#include "vm/profiler.h"
 #include "vm/utils.h"
 #include "vm/virtual_memory.h"
 
 namespace psoup {
 
 class Interpreter;
+class ParallelScavenger;
 class Region;
+class ScavengerWorker;
+class ThreadPool;
 
 // Note these values are never valid Object.
 #if defined(ARCH_IS_32_BIT)
@@ -36,12 +41,21 @@ class Semispace {
  private:
   friend class Heap;
 
-  void Allocate(size_t size) {
-    memory_ = VirtualMemory::Allocate(size,
-                                      VirtualMemory::kReadWrite,
-                                      "primordialsoup-heap");
+  void Allocate(size_t size, intptr_t numa_node, bool huge_pages) {
+    memory_ = VirtualMemory();
+    if (huge_pages) {
+      memory_ = VirtualMemory::AllocateHuge(size, "primordialsoup-heap");
+    }
+    if (memory_.size() == 0) {
+      memory_ = VirtualMemory::Allocate(size,
+                                        VirtualMemory::kReadWrite,
+                                        "primordialsoup-heap");
+    }
     ASSERT(Utils::IsAligned(memory_.base(), kObjectAlignment));
     ASSERT(memory_.size() == size);
+    if (numa_node >= 0) {
+      memory_.PreferNumaNode(numa_node);
+    }
 #if defined(DEBUG)
     MarkUnallocated();
 #endif
@@ -72,30 +86,230 @@ class FreeList {
  private:
   friend class Heap;
 
-  FreeList() { Reset(); }
+  FreeList() {
+    Reset();
+#if REPORT_FREELIST
+    span_hits_ = exact_hits_ = class_hits_ = first_fit_hits_ = misses_ = 0;
+#endif
+  }
 
   uword TryAllocate(intptr_t size);
 
-  intptr_t IndexForSize(intptr_t size) {
-    intptr_t index = size >> kObjectAlignmentLog2;
-    if (index > kSizeClasses) {
+  // Sizes below kExactClasses granules each have their own class. Larger
+  // sizes below Heap::kLargeAllocation share a class per quarter of a power of
+  // two, and anything bigger goes to the overflow list.
+  static intptr_t IndexForSize(intptr_t size) {
+    intptr_t granules = size >> kObjectAlignmentLog2;
+    if (granules < kExactClasses) {
+      return granules;
+    }
+    intptr_t log2 = Utils::HighestBit(granules);
+    if (log2 >= kSegregatedLog2) {
       return kSizeClasses;
     }
-    return index;
+    return kExactClasses + (log2 - kExactClassesLog2) * 4 +
+        ((granules >> (log2 - 2)) & 3);
   }
 
+  uword TryAllocateFromSpan(intptr_t size);
+  uword TryAllocateFirstFit(intptr_t index, intptr_t size);
+  intptr_t NextNonEmpty(intptr_t index) const;
   void SplitAndRequeue(FreeListElement element, intptr_t size);
   FreeListElement Dequeue(intptr_t index);
   void Enqueue(FreeListElement element);
   void EnqueueRange(uword address, intptr_t size);
+  void SetSpan(uword top, uword end);
   void Reset() {
     for (intptr_t i = 0; i <= kSizeClasses; i++) {
       free_lists_[i] = nullptr;
     }
+    for (intptr_t i = 0; i < kBitmapWords; i++) {
+      nonempty_[i] = 0;
+    }
+    span_top_ = span_end_ = 0;
   }
+#if REPORT_FREELIST
+  void PrintStatistics();
+#endif
 
-  static const intptr_t kSizeClasses = 7;
+  static const intptr_t kExactClassesLog2 = 6;
+  static const intptr_t kExactClasses = 1 << kExactClassesLog2;
+  static const intptr_t kSegregatedLog2 = 15 - kObjectAlignmentLog2;  // 32KB
+  static const intptr_t kSizeClasses =
+      kExactClasses + (kSegregatedLog2 - kExactClassesLog2) * 4;
+  static const intptr_t kBitmapWords = (kSizeClasses + 63) / 64;
   FreeListElement free_lists_[kSizeClasses + 1];
+  uint64_t nonempty_[kBitmapWords];  // Excludes the overflow list.
+
+  // The remainder of the last split, bump allocated. It stays formatted as a
+  // FreeListElement that is on no list so the heap remains walkable.
+  uword span_top_;
+  uword span_end_;
+
+#if REPORT_FREELIST
+  intptr_t span_hits_;
+  intptr_t exact_hits_;
+  intptr_t class_hits_;
+  intptr_t first_fit_hits_;
+  intptr_t misses_;
+#endif
+};
+
+// Objects marked but not yet scanned.
+class MarkStack {
+ private:
+  friend class Heap;
+  friend class ScavengerWorker;
+  friend class ParallelScavenger;
+
+  MarkStack() : stack_(nullptr), size_(0), capacity_(0) {}
+  ~MarkStack() { delete[] stack_; }
+
+  bool IsEmpty() const { return size_ == 0; }
+  void Push(HeapObject obj) {
+    if (size_ == capacity_) {
+      Grow();
+    }
+    stack_[size_++] = obj;
+  }
+  HeapObject Pop() {
+    ASSERT(size_ > 0);
+    return stack_[--size_];
+  }
+  void Release() {
+    delete[] stack_;
+    stack_ = nullptr;
+    size_ = capacity_ = 0;
+  }
+
+  void Grow();
+
+  HeapObject* stack_;
+  intptr_t size_;
+  intptr_t capacity_;
+};
+
+// Ephemerons whose keys are not yet known to survive, chained through their
+// next fields under their keys. A collection revisits an ephemeron only when
+// its key is reached, which keeps ephemeron processing linear. Keys are never
+// removed, only emptied, until the index is reset at the end of a collection.
+class EphemeronIndex {
+ private:
+  friend class Heap;
+  friend class ScavengerWorker;
+  friend class ParallelScavenger;
+
+  EphemeronIndex()
+      : keys_(nullptr), heads_(nullptr), size_(0), used_(0), capacity_(0) {}
+  ~EphemeronIndex() {
+    delete[] keys_;
+    delete[] heads_;
+  }
+
+  bool IsEmpty() const { return size_ == 0; }
+  void Add(HeapObject key, Ephemeron ephemeron);
+  // Safe to call from several threads while there are no other calls.
+  bool Contains(HeapObject key) const {
+    return (size_ != 0) && (heads_[IndexOf(key)] != nullptr);
+  }
+  // The ephemerons waiting on key, which stop waiting.
+  Ephemeron Take(HeapObject key);
+  // All of the ephemerons still waiting, after which the index is empty.
+  Ephemeron TakeAll();
+
+  intptr_t IndexOf(HeapObject key) const {
+    uword hash = static_cast<uword>(key) >> kObjectAlignmentLog2;
+    intptr_t mask = capacity_ - 1;
+    intptr_t i = (hash * 0x9E3779B9) & mask;
+    while ((keys_[i] != nullptr) && (keys_[i] != key)) {
+      i = (i + 1) & mask;
+    }
+    return i;
+  }
+  void Grow();
+
+  HeapObject* keys_;
+  Ephemeron* heads_;
+  intptr_t size_;  // Keys with waiting ephemerons.
+  intptr_t used_;  // Keys, including emptied ones.
+  intptr_t capacity_;
+};
+
+// With OUT_OF_LINE_HASH, the identity hashes of the objects other than
+// Strings that have been asked for one, keyed by address. Collections rekey it
+// as they move and free objects.
+class IdentityHashTable {
+ private:
+  friend class Heap;
+
+  IdentityHashTable()
+      : keys_(nullptr), hashes_(nullptr), size_(0), used_(0), capacity_(0) {}
+  ~IdentityHashTable() {
+    delete[] keys_;
+    delete[] hashes_;
+  }
+
+  // Or 0 if key has none.
+  intptr_t Lookup(HeapObject key) const {
+    return (size_ == 0) ? 0 : hashes_[IndexOf(key)];
+  }
+  // A hash of 0 removes key's.
+  void Insert(HeapObject key, intptr_t hash);
+  // Moves each key to where forward answers, or drops it if nullptr.
+  void Rekey(HeapObject (*forward)(HeapObject key));
+  void Rebuild(HeapObject (*forward)(HeapObject key));
+
+  intptr_t IndexOf(HeapObject key) const {
+    uword hash = static_cast<uword>(key) >> kObjectAlignmentLog2;
+    intptr_t mask = capacity_ - 1;
+    intptr_t i = (hash * 0x9E3779B9) & mask;
+    while ((keys_[i] != nullptr) && (keys_[i] != key)) {
+      i = (i + 1) & mask;
+    }
+    return i;
+  }
+
+  HeapObject* keys_;
+  intptr_t* hashes_;
+  intptr_t size_;  // Keys with hashes.
+  intptr_t used_;  // Keys, including removed ones.
+  intptr_t capacity_;
+};
+
+// The old space of a heap just made from a snapshot, with the addresses it
+// had. Further heaps for the same snapshot are made by copying the regions and
+// relocating their pointers, which is several times faster than deserializing.
+class HeapImage {
+ public:
+  ~HeapImage();
+
+ private:
+  friend class Heap;
+
+  HeapImage() : regions_(nullptr), num_regions_(0), class_table_(nullptr),
+      class_table_size_(0), class_table_free_(0), old_size_(0),
+      root_(nullptr), shared_(nullptr), shared_size_(0) {}
+
+  struct RegionImage {
+    uword object_start;  // The address it was copied from.
+    intptr_t size;  // Of the region.
+    intptr_t used;  // Bytes of objects.
+    uint8_t* objects;
+  };
+
+  RegionImage* regions_;  // In the order of the heap's list.
+  intptr_t num_regions_;
+  Object* class_table_;
+  intptr_t class_table_size_;
+  intptr_t class_table_free_;
+  size_t old_size_;
+  Object root_;
+  // The canonical strings, kept here once rather than in each heap loaded
+  // from the image. They are immutable and hold no pointers.
+  Region* shared_;
+  size_t shared_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(HeapImage);
 };
 
 // C. J. Cheney. "A nonrecursive list compacting algorithm." Communications of
@@ -103,15 +317,44 @@ class FreeList {
 //
 // Barry Hayes. "Ephemerons: a New Finalization Mechanism." Object-Oriented
 // Languages, Programming, Systems, and Applications. 1997.
+//
+// Edsger W. Dijkstra, Leslie Lamport, A. J. Martin, C. S. Scholten and
+// E. F. M. Steffens. "On-the-fly Garbage Collection: An Exercise in
+// Cooperation." Communications of the ACM. 1978.
 class Heap {
  private:
   static const intptr_t kLargeAllocation = 32 * KB;
-  static const size_t kInitialSemispaceCapacity = sizeof(uword) * MB / 8;
-  static const size_t kMaxSemispaceCapacity = 2 * sizeof(uword) * MB;
   static const size_t kRegionSize = 256 * KB;
+  // Incremental marking scans this many bytes of old space for each byte
+  // allocated in old space, and at least the minimum after each scavenge.
+  static const intptr_t kMarkingRate = 4;
+  static const intptr_t kMinMarkingStep = 256 * KB;
+  // Regions left unswept by a mark-sweep are swept when the free list runs
+  // dry, and at least this much after each scavenge.
+  static const intptr_t kSweepStep = 1 * MB;
+  // Old space is compacted when a mark-sweep leaves it less than half
+  // occupied with at least this much free, by evacuating the regions that
+  // are less than kEvacuationOccupancy percent occupied.
+  static const size_t kMinCompactionFree = 4 * kRegionSize;
+  static const intptr_t kEvacuationOccupancy = 50;
+  // Large objects are remembered in cards of this many bytes.
+  static const intptr_t kCardSize = 512;
+  // A class's instances are allocated in old space once this many have been
+  // instantiated in new space and at least kPretenureSurvival percent as
+  // many were tenured, until the next mark-sweep.
+  static const uint32_t kPretenureSamples = 1024;
+  static const uint32_t kPretenureSurvival = 90;
+  // New space halves, down to its initial size, after this many scavenges in
+  // a row in which under 1/kShrinkSurvival of a semispace survived.
+  static const intptr_t kShrinkScavenges = 4;
+  static const size_t kShrinkSurvival = 8;
+  // The sweeper lets the system reclaim the pages of free spans this large.
+  static const intptr_t kMinDiscard = 64 * KB;
 
  public:
-  enum Allocator { kNormal, kSnapshot };
+  // kMessage allocates in old space without collecting, so a message can be
+  // read into a running heap without its objects moving.
+  enum Allocator { kNormal, kSnapshot, kTenured, kMessage };
 
   enum GrowthPolicy { kControlGrowth, kForceGrowth };
 
@@ -137,34 +380,144 @@ class Heap {
     return nullptr;
   }
 
+  // The most threads one scavenge can use, including the isolate's own.
+  static const intptr_t kMaxScavengerWorkers = 16;
+
+  // Default sizing.
+  static const size_t kInitialSemispaceCapacity = sizeof(uword) * MB / 8;
+  static const size_t kMaxSemispaceCapacity = 2 * sizeof(uword) * MB;
+  static const intptr_t kOldSpaceGrowth = 50;  // Percent.
+
   Heap();
   ~Heap();
 
+  // With more than one worker, scavenges borrow helper threads from
+  // thread_pool to copy in parallel.
+  void InitializeScavengerWorkers(ThreadPool* thread_pool,
+                                  intptr_t num_workers);
+  // The deserializer reads edges with as many threads.
+  ThreadPool* thread_pool() const { return thread_pool_; }
+  intptr_t scavenger_workers() const { return scavenger_workers_; }
+
+  // Before anything is allocated. The heap's memory then comes from that NUMA
+  // node where it can, even when helper threads elsewhere first touch it.
+  void set_numa_node(intptr_t node);
+
+  // Before anything is allocated. The heap's memory then comes in chunks
+  // aligned to and backed by huge pages where the system has them, to spare
+  // the TLB during collections. Old-space regions are carved from chunks of
+  // one huge page, and semispaces and large objects take chunks of their own.
+  void set_huge_pages(bool value);
+
+  // Before anything is allocated. New space starts with semispaces of
+  // initial_semispace bytes and doubles them up to max_semispace. After a
+  // mark-sweep, old space may grow by old_growth percent of what survived
+  // before the next. With a nonzero limit, mark-sweeps also start early
+  // enough to keep old-space survivors and both semispaces within limit
+  // bytes.
+  void ConfigureSizing(size_t initial_semispace,
+                       size_t max_semispace,
+                       intptr_t old_growth,
+                       size_t limit);
+
+  GCTrace* trace() { return &trace_; }
+
+  // The bytes allocated so far, other than by reading a snapshot. Counted by
+  // the countdown to the next allocation sample, which every allocation
+  // already decrements.
+  int64_t allocated_bytes() const {
+    return allocated_ + (allocation_period_ - allocation_countdown_);
+  }
+  // The most bytes in use at once. Old space shrinks only in mark-sweeps and
+  // new space only in scavenges, so it is enough to look before each.
+  size_t peak_size() const {
+    size_t size = Size();
+    return size > peak_size_ ? size : peak_size_;
+  }
+
+  // Samples allocations about every interval bytes, or stops with zero. See
+  // AllocationProfiler.
+  void SetAllocationSampleInterval(intptr_t interval) {
+    allocated_ += allocation_period_ - allocation_countdown_;
+    allocation_period_ = allocation_profiler_.SetInterval(interval);
+    allocation_countdown_ = allocation_period_;
+  }
+  AllocationProfiler* allocation_profiler() { return &allocation_profiler_; }
+
+  // For instantiation primitives: where to allocate an instance of cid, by
+  // how its recent instances have survived.
+  Allocator InstanceAllocator(intptr_t cid) {
+    ASSERT(cid < class_table_size_);
+    SurvivalFeedback* feedback = &feedback_[cid];
+    if (feedback->pretenure) {
+      return kTenured;
+    }
+    feedback->allocated++;
+    return kNormal;
+  }
+
+  // Whether an instantiation primitive about to allocate num_elements of
+  // element_size bytes should fail, so Newspeak signals OutOfMemory: either
+  // the object alone would exceed the limit, or a mark-sweep has left the heap
+  // over the limit since the last such failure. Other allocations never fail.
+  bool TakeOutOfMemory(intptr_t num_elements, intptr_t element_size) {
+    if (heap_limit_ == 0) {
+      return false;
+    }
+    if (out_of_memory_) {
+      out_of_memory_ = false;
+      return true;
+    }
+    return static_cast<size_t>(num_elements) > heap_limit_ / element_size;
+  }
+
+  // The incremental marking barrier: a marked object is having an unmarked
+  // old object stored into it.
+  void MarkingBarrier(HeapObject value) {
+    ASSERT(value->IsOldObject());
+    if (marking_ && !value->is_marked()) {
+      value->set_is_marked(true);
+      marked_size_ += value->HeapSize();
+      mark_stack_.Push(value);
+    }
+  }
+
+  // Remembers all of object's slots.
   void AddToRememberedSet(HeapObject object) {
     ASSERT(object->IsOldObject());
     ASSERT(!object->is_remembered());
-    if (remembered_set_size_ == remembered_set_capacity_) {
-      GrowRememberedSet();
+    if (object->HeapSize() >= kLargeAllocation) {
+      DirtyAllCards(object);
     }
-    remembered_set_[remembered_set_size_++] = object;
-    object->set_is_remembered(true);
+    PushRememberedSet(object);
   }
+  // The generational barrier: slot of the old object now points to a new
+  // object.
+  void RememberSlot(HeapObject object, Object* slot);
+  // Both barriers for count slots of the old object written together.
+  void RememberRange(HeapObject object, Object* slots, intptr_t count);
 
   RegularObject AllocateRegularObject(intptr_t cid, intptr_t num_slots,
                                       Allocator allocator = kNormal) {
     ASSERT(cid == kEphemeronCid || cid >= kFirstRegularObjectCid);
-    const intptr_t heap_size =
+    intptr_t heap_size =
         AllocationSize(num_slots * sizeof(Object) + sizeof(HeapObject::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    if (cid == kEphemeronCid) {
+      // The GC's link follows the slots of the Ephemeron class.
+      ASSERT(heap_size <= AllocationSize(sizeof(Ephemeron::Layout)));
+      heap_size = AllocationSize(sizeof(Ephemeron::Layout));
+    }
+    uword addr = Allocate(heap_size, cid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, cid, heap_size);
     RegularObject result = static_cast<RegularObject>(obj);
     ASSERT(result->IsRegularObject() || result->IsEphemeron());
     ASSERT(result->HeapSize() == heap_size);
 
     const intptr_t header_slots = sizeof(HeapObject::Layout) / sizeof(uword);
-    if (((header_slots + num_slots) & 1) == 1) {
-      // The leftover slot will be visited by the GC. Make it a valid oop.
-      result->set_slot(num_slots, SmallInteger::New(0), kNoBarrier);
+    const intptr_t heap_slots = heap_size / sizeof(uword);
+    for (intptr_t i = num_slots; i < heap_slots - header_slots; i++) {
+      // Leftover slots will be visited by the GC. Make them valid oops.
+      result->set_slot(i, SmallInteger::New(0), kNoBarrier);
     }
 
     return result;
@@ -174,7 +527,7 @@ class Heap {
                               Allocator allocator = kNormal) {
     const intptr_t heap_size =
         AllocationSize(num_bytes * sizeof(uint8_t) + sizeof(ByteArray::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kByteArrayCid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kByteArrayCid, heap_size);
     ByteArray result = static_cast<ByteArray>(obj);
     result->set_size(SmallInteger::New(num_bytes));
@@ -186,10 +539,13 @@ class Heap {
   String AllocateString(intptr_t num_bytes, Allocator allocator = kNormal) {
     const intptr_t heap_size =
         AllocationSize(num_bytes * sizeof(uint8_t) + sizeof(String::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kStringCid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kStringCid, heap_size);
     String result = static_cast<String>(obj);
     result->set_size(SmallInteger::New(num_bytes));
+#if OUT_OF_LINE_HASH
+    result->set_hash(0);
+#endif
     ASSERT(result->IsString());
     ASSERT(result->HeapSize() == heap_size);
     return result;
@@ -198,7 +554,7 @@ class Heap {
   Array AllocateArray(intptr_t num_slots, Allocator allocator = kNormal) {
     const intptr_t heap_size =
         AllocationSize(num_slots * sizeof(Object) + sizeof(Array::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kArrayCid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kArrayCid, heap_size);
     Array result = static_cast<Array>(obj);
     result->set_size(SmallInteger::New(num_slots));
@@ -211,10 +567,11 @@ class Heap {
                               Allocator allocator = kNormal) {
     const intptr_t heap_size =
         AllocationSize(num_slots * sizeof(Object) + sizeof(WeakArray::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kWeakArrayCid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kWeakArrayCid, heap_size);
     WeakArray result = static_cast<WeakArray>(obj);
     result->set_size(SmallInteger::New(num_slots));
+    result->set_cleared(SmallInteger::New(0));
     ASSERT(result->IsWeakArray());
     ASSERT(result->HeapSize() == heap_size);
     return result;
@@ -223,7 +580,7 @@ class Heap {
   Closure AllocateClosure(intptr_t num_copied, Allocator allocator = kNormal) {
     const intptr_t heap_size =
         AllocationSize(num_copied * sizeof(Object) + sizeof(Closure::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kClosureCid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kClosureCid, heap_size);
     Closure result = static_cast<Closure>(obj);
     result->set_num_copied(SmallInteger::New(num_copied));
@@ -234,7 +591,7 @@ class Heap {
 
   Activation AllocateActivation(Allocator allocator = kNormal) {
     const intptr_t heap_size = AllocationSize(sizeof(Activation::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kActivationCid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kActivationCid, heap_size);
     Activation result = static_cast<Activation>(obj);
     ASSERT(result->IsActivation());
@@ -244,7 +601,7 @@ class Heap {
 
   MediumInteger AllocateMediumInteger(Allocator allocator = kNormal) {
     const intptr_t heap_size = AllocationSize(sizeof(MediumInteger::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kMintCid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kMintCid, heap_size);
     MediumInteger result = static_cast<MediumInteger>(obj);
     ASSERT(result->IsMediumInteger());
@@ -256,7 +613,7 @@ class Heap {
                                     Allocator allocator = kNormal) {
     const intptr_t heap_size = AllocationSize(capacity * sizeof(digit_t) +
                                               sizeof(LargeInteger::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kBigintCid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kBigintCid, heap_size);
     LargeInteger result = static_cast<LargeInteger>(obj);
     result->set_capacity(capacity);
@@ -267,7 +624,7 @@ class Heap {
 
   Float64 AllocateFloat64(Allocator allocator = kNormal) {
     const intptr_t heap_size = AllocationSize(sizeof(Float64::Layout));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr = Allocate(heap_size, kFloat64Cid, allocator);
     HeapObject obj = HeapObject::Initialize(addr, kFloat64Cid, heap_size);
     Float64 result = static_cast<Float64>(obj);
     ASSERT(result->IsFloat64());
@@ -277,19 +634,91 @@ class Heap {
 
   Message AllocateMessage();
 
+  // A ByteArray made outside any heap, alone in a region like other large
+  // objects, so a message can carry it to another isolate whose heap takes the
+  // region instead of copying the bytes. Answers its bytes, or nullptr if
+  // num_bytes is too few for this to beat copying.
+  static uint8_t* AllocateTransferable(intptr_t num_bytes);
+  // A buffer grown by doubling past this is more than half full, so still a
+  // large object once shrunk to fit.
+  static const intptr_t kMinGrownTransferable = 2 * kLargeAllocation;
+  // To its first num_bytes, which must still make a large object.
+  static void ShrinkTransferable(uint8_t* bytes, intptr_t num_bytes);
+  static void FreeTransferable(uint8_t* bytes);
+  ByteArray AdoptTransferable(uint8_t* bytes);
+#if defined(OS_FUCHSIA)
+  // A ByteArray over num_bytes of the VMO from offset, page aligned, alone in
+  // a region like a large object and unmapped when collected. Shared, its
+  // writes land in the VMO; otherwise the VMO's pages are shared until
+  // written. Answers why not if the VMO cannot be mapped so.
+  zx_status_t AllocateMappedByteArray(zx_handle_t vmo,
+                                      uint64_t offset,
+                                      intptr_t num_bytes,
+                                      bool shared,
+                                      ByteArray* result);
+#endif
+
   size_t Size() const {
     size_t new_size = top_ - to_.object_start();
     return new_size + old_size_;
   }
+  void NotePeakSize() {
+    size_t size = Size();
+    if (size > peak_size_) {
+      peak_size_ = size;
+    }
+  }
 
-  void CollectAll(Reason reason) { MarkSweep(reason); }
+  void CollectAll(Reason reason) {
+    // Marking already under way keeps what was reachable when it started.
+    if (marking_) {
+      MarkSweep(reason);
+    }
+    MarkSweep(reason);
+  }
 
   intptr_t CountInstances(intptr_t cid);
   intptr_t CollectInstances(intptr_t cid, Array array);
+  // The instances of several classes with one walk of the heap each, into the
+  // arrays of results, which are left with nils if instances died meanwhile.
+  // Fails if a class is repeated.
+  bool CountInstances(Array classes, intptr_t* counts);
+  void CollectInstances(Array classes, Array results);
 
   bool BecomeForward(Array old, Array neu);
+  // As BecomeForward for each pair of arrays, with one walk of the heap.
+  bool BecomeForwardAll(Array olds, Array news);
+
+  // Of obj, or 0 before it is given one. A String's is that of its contents.
+  intptr_t IdentityHash(HeapObject obj) const {
+    if (obj->IsString()) {
+      return static_cast<String>(obj)->hash();
+    }
+#if OUT_OF_LINE_HASH
+    return identity_hashes_.Lookup(obj);
+#else
+    return obj->header_hash();
+#endif
+  }
+  void SetIdentityHash(HeapObject obj, intptr_t hash) {
+    ASSERT((hash >= 0) && (hash <= HeapObject::kMaxHash));
+    if (obj->IsString()) {
+      static_cast<String>(obj)->set_hash(hash);
+      return;
+    }
+#if OUT_OF_LINE_HASH
+    identity_hashes_.Insert(obj, hash);
+#else
+    obj->set_header_hash(hash);
+#endif
+  }
 
+  // As many as the header's class id field holds.
+  static const intptr_t kMaxClassIds =
+      static_cast<intptr_t>(1) << kClassIdFieldSize;
   intptr_t AllocateClassId();
+  // So the next count AllocateClassIds collect nothing.
+  void ReserveClassIds(intptr_t count);
   void RegisterClass(intptr_t cid, Behavior cls) {
     ASSERT(class_table_[cid] == static_cast<Object>(kUninitializedWord));
     class_table_[cid] = cls;
@@ -297,6 +726,7 @@ class Heap {
     cls->AssertCouldBeBehavior();
     ASSERT(cls->cid() >= kFirstRegularObjectCid);
   }
+  intptr_t class_table_size() const { return class_table_size_; }
   Behavior ClassAt(intptr_t cid) const {
     ASSERT(cid > kIllegalCid);
     ASSERT(cid < class_table_size_);
@@ -309,18 +739,34 @@ class Heap {
   }
   void InitializeAfterSnapshot();
 
+  // Only right after deserializing, with the root of the snapshot.
+  HeapImage* CaptureImage(Object root);
+  // Only into an empty heap, answering the relocated root.
+  Object LoadImage(const HeapImage* image);
+
   Interpreter* interpreter() const { return interpreter_; }
 
   intptr_t handles() const { return handles_size_; }
   void set_handles(intptr_t value) { handles_size_ = value; }
 
  private:
+  void PushRememberedSet(HeapObject object) {
+    if (remembered_set_size_ == remembered_set_capacity_) {
+      GrowRememberedSet();
+    }
+    remembered_set_[remembered_set_size_++] = object;
+    object->set_is_remembered(true);
+  }
   void GrowRememberedSet();
+  void GrowClassTable(intptr_t capacity);
+  uint8_t* CardsOf(HeapObject object);
+  void DirtyAllCards(HeapObject object);
   void ShrinkRememberedSet();
 
   // Scavenging.
   void Scavenge(Reason reason);
   void FlipSpaces();
+  void ShrinkNewSpace();
   void ScavengeRoots();
   uword ScavengeToSpace(uword scan);
   void PushTenureStack(uword addr);
@@ -329,19 +775,45 @@ class Heap {
   void ProcessTenureStack();
   void ScavengePointer(Object* ptr);
   void ScavengeOldObject(HeapObject obj);
+  void ScavengeCards(HeapObject obj);
   void ScavengeClass(intptr_t cid);
+  void ParallelScavenge();
 
   // Mark-sweep.
   void MarkSweep(Reason reason);
   void MarkRoots();
   void MarkObject(Object obj);
-  void ProcessMarkStack();
+  bool ProcessMarkStack(intptr_t budget);
+  void MarkTenured(HeapObject obj) {
+    ASSERT(marking_);
+    ASSERT(obj->IsOldObject());
+    obj->set_is_marked(true);
+    marked_size_ += obj->HeapSize();
+    mark_stack_.Push(obj);
+  }
+  void StartIncrementalMarking(Reason reason);
+  void IncrementalMarkingStep(Reason reason);
+  void AbortIncrementalMarking();
+  void FilterRememberedSet();
   void Sweep();
+  bool SweepNextRegion();
+  void SweepStep();
+  void FinishSweep();
   bool SweepRegion(Region* region);
+  bool IsFragmented() const {
+    return (old_capacity_ > 2 * old_size_) &&
+           ((old_capacity_ - old_size_) > kMinCompactionFree);
+  }
+  bool ShouldEvacuate(Region* region);
+  void Compact();
   void SetOldAllocationLimit();
+  void UpdatePretenuring();
+  void ResetPretenuring();
+  intptr_t* InstanceSlots(Array classes);
 
   // Ephemerons.
   void AddToEphemeronList(Ephemeron ephemeron_corpse);
+  void RequeueEphemerons(HeapObject key);
   void ScavengeEphemeronList();
   void MarkEphemeronList();
   void MournEphemeronList();
@@ -349,20 +821,36 @@ class Heap {
   // WeakArrays.
   void AddToWeakList(WeakArray survivor);
   void MournWeakListScavenge();
+  void MournCardsScavenge(WeakArray survivor);
   void MournWeakListMarkSweep();
-  void MournWeakPointerScavenge(Object* ptr);
-  void MournWeakPointerMarkSweep(Object* ptr);
+  // Answer whether the target died, leaving nil.
+  bool MournWeakPointerScavenge(Object* ptr);
+  bool MournWeakPointerMarkSweep(Object* ptr);
+  void CountCleared(WeakArray survivor, intptr_t cleared);
 
   // Weak class table.
   void MournClassTableScavenge();
   void MournClassTableMarkSweep();
   void MournClassTableForwarded();
 
+#if OUT_OF_LINE_HASH
+  // Identity hashes.
+  void MournIdentityHashesScavenge();
+  void MournIdentityHashesMarkSweep();
+  void MournIdentityHashesForwarded();
+#endif
+
   // Become.
+  static bool CanBecomeForward(Array old, Array neu);
+  void CreateForwarders(Array old, Array neu);
+  void ForwardAll();
   void ForwardClassIds();
   void ForwardRoots();
   void ForwardHeap();
 
+  // Heap images.
+  void ShareCanonicalStrings(HeapImage* image);
+
   uword TryAllocateNew(intptr_t size) {
     uword result = top_;
     intptr_t remaining = end_ - top_;
@@ -374,7 +862,7 @@ class Heap {
     return result;
   }
 
-  uword Allocate(intptr_t size, Allocator allocator) {
+  uword Allocate(intptr_t size, intptr_t cid, Allocator allocator) {
     ASSERT(Utils::IsAligned(size, kObjectAlignment));
     if (allocator == kSnapshot) {
       if (size >= kLargeAllocation) {
@@ -382,20 +870,43 @@ class Heap {
       }
       return AllocateSnapshotSmall(size);
     }
+    allocation_countdown_ -= size;
+    if (allocation_countdown_ < 0) {
+      SampleAllocation(size, cid);
+    }
+    if (allocator == kTenured) {
+      if (size >= kLargeAllocation) {
+        return AllocateOldLarge(size, kControlGrowth);
+      }
+      return AllocateOldSmall(size, kControlGrowth);
+    }
+    if (allocator == kMessage) {
+      if (size >= kLargeAllocation) {
+        return AllocateOldLarge(size, kForceGrowth);
+      }
+      return AllocateOldSmall(size, kForceGrowth);
+    }
     if (size >= kLargeAllocation) {
       return AllocateOldLarge(size, kControlGrowth);
     }
     return AllocateNew(size);
   }
 
+  NOINLINE void SampleAllocation(intptr_t size, intptr_t cid);
+
   uword AllocateNew(intptr_t size);
   uword AllocateTenure(intptr_t size);
+  uword AllocatePromotion(intptr_t size);
+  void ReleasePromotion(uword addr, intptr_t size);
   uword AllocateOldSmall(intptr_t size, GrowthPolicy growth);
   uword AllocateOldLarge(intptr_t size, GrowthPolicy growth);
   uword AllocateSnapshotSmall(intptr_t size);
   uword AllocateSnapshotLarge(intptr_t size);
 
   Region* AllocateRegion(intptr_t region_size, GrowthPolicy growth);
+  Region* NewRegion(intptr_t region_size);
+  void ControlGrowth(intptr_t region_size);
+  void AddRegion(Region* region);
 
 #if defined(DEBUG)
   bool InFromSpace(HeapObject obj) {
@@ -413,13 +924,30 @@ class Heap {
   Semispace to_;
   Semispace from_;
   size_t next_semispace_capacity_;
+  size_t initial_semispace_capacity_;
+  size_t max_semispace_capacity_;
+  intptr_t low_survivals_;  // Scavenges in a row, toward shrinking.
 
-  // Old space.
+  // Old space. Regions not yet swept since the last mark-sweep are kept apart,
+  // and in them exactly the marked objects are live.
   Region* regions_;
+  Region* unswept_;
   FreeList freelist_;
   size_t old_size_;
   size_t old_capacity_;
   size_t old_limit_;
+  intptr_t old_growth_;
+  size_t heap_limit_;  // Zero for none.
+  bool out_of_memory_;
+
+  // Marking. While marking_, old space is being marked incrementally and new
+  // space is left to the final pause.
+  MarkStack mark_stack_;
+  MarkStack deferred_;  // WeakArrays and Ephemerons marked incrementally.
+  bool marking_;
+  size_t marking_old_size_;  // At the last step.
+  size_t marking_limit_;  // Beyond which marking finishes at once.
+  size_t marked_size_;  // Old-space bytes marked so far.
 
   // Remembered set.
   HeapObject* remembered_set_;
@@ -431,6 +959,15 @@ class Heap {
   intptr_t class_table_size_;
   intptr_t class_table_capacity_;
   intptr_t class_table_free_;
+  intptr_t class_table_limit_;  // Capacity past which filling up collects.
+
+  // Pretenuring, parallel to the class table.
+  struct SurvivalFeedback {
+    uint32_t allocated;  // In new space by instantiation primitives.
+    uint32_t tenured;  // By scavenges.
+    bool pretenure;
+  };
+  SurvivalFeedback* feedback_;
 
   // Roots.
   Interpreter* interpreter_;
@@ -440,7 +977,31 @@ class Heap {
   friend class HandleScope;
 
   Ephemeron ephemeron_list_;
+  EphemeronIndex ephemeron_index_;
   WeakArray weak_list_;
+#if OUT_OF_LINE_HASH
+  IdentityHashTable identity_hashes_;
+#endif
+
+  GCTrace trace_;
+
+  AllocationProfiler allocation_profiler_;
+  intptr_t allocation_period_;  // Bytes between the last sample and the next.
+  intptr_t allocation_countdown_;  // Of them, left to allocate.
+  int64_t allocated_;  // Before the last sample.
+  size_t peak_size_;  // As of the last GC.
+
+  // Parallel scavenging.
+  ThreadPool* thread_pool_;
+  intptr_t scavenger_workers_;
+  intptr_t numa_node_;  // Or -1.
+
+  bool huge_pages_;
+  VirtualMemory huge_chunk_;  // The part not yet carved into regions.
+  friend class ParallelScavenger;
+  friend class ScavengerWorker;
+
+  friend class HeapSnapshot;
 
   DISALLOW_COPY_AND_ASSIGN(Heap);
 };
@@ -0,0 +1,369 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/heap_snapshot.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm/assert.h"
+#include "vm/heap.h"
+#include "vm/interpreter.h"
+
+namespace psoup {
+
+// As the meta section lists them.
+enum NodeType {
+  kHiddenNode = 0,
+  kArrayNode = 1,
+  kStringNode = 2,
+  kObjectNode = 3,
+  kCodeNode = 4,
+  kClosureNode = 5,
+  kNumberNode = 7,
+  kSyntheticNode = 9,
+};
+
+enum EdgeType {
+  kElementEdge = 1,
+  kInternalEdge = 3,
+  kWeakEdge = 6,
+};
+
+static const intptr_t kNodeFields = 6;
+
+static const char kMeta[] =
+    "{\"snapshot\":{\"meta\":{"
+    "\"node_fields\":[\"type\",\"name\",\"id\",\"self_size\",\"edge_count\","
+    "\"trace_node_id\"],"
+    "\"node_types\":[[\"hidden\",\"array\",\"string\",\"object\",\"code\","
+    "\"closure\",\"regexp\",\"number\",\"native\",\"synthetic\","
+    "\"concatenated string\",\"sliced string\",\"symbol\",\"bigint\"],"
+    "\"string\",\"number\",\"number\",\"number\",\"number\"],"
+    "\"edge_fields\":[\"type\",\"name_or_index\",\"to_node\"],"
+    "\"edge_types\":[[\"context\",\"element\",\"property\",\"internal\","
+    "\"hidden\",\"shortcut\",\"weak\"],\"string_or_number\",\"node\"],"
+    "\"trace_function_info_fields\":[\"function_id\",\"name\",\"script_name\","
+    "\"script_id\",\"line\",\"column\"],"
+    "\"trace_node_fields\":[\"id\",\"function_info_index\",\"count\","
+    "\"size\",\"children\"],"
+    "\"sample_fields\":[\"timestamp_us\",\"last_assigned_id\"],"
+    "\"location_fields\":[\"object_index\",\"script_id\",\"line\","
+    "\"column\"]},";
+
+
+HeapSnapshot::HeapSnapshot(Heap* heap)
+    : heap_(heap),
+      nodes_(NULL),
+      edge_counts_(NULL),
+      nodes_size_(0),
+      nodes_capacity_(0),
+      edges_size_(0),
+      table_(NULL),
+      table_capacity_(0),
+      first_edge_(true) {}
+
+
+HeapSnapshot::~HeapSnapshot() {
+  free(nodes_);
+  free(edge_counts_);
+  free(table_);
+}
+
+
+bool HeapSnapshot::WriteTo(const char* path) {
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) {
+    return false;
+  }
+
+  // As for a GC, so every slot of the stacks is an object.
+  heap_->interpreter_->GCPrologue();
+  Discover();
+  fputs(kMeta, file);
+  fprintf(file, "\"node_count\":%" Pd ",\"edge_count\":%" Pd ","
+          "\"trace_function_count\":0},\n", nodes_size_, edges_size_);
+  WriteNodes(file);
+  WriteEdges(file);
+  fputs("\"trace_function_infos\":[],\"trace_tree\":[],\"samples\":[],"
+        "\"locations\":[],\n", file);
+  WriteStrings(file);
+  fputs("}\n", file);
+  heap_->interpreter_->GCEpilogue();
+
+  bool failed = ferror(file) != 0;
+  return (fclose(file) == 0) && !failed;
+}
+
+
+void HeapSnapshot::Discover() {
+  // Breadth first from the roots, the nodes found so far serving as the queue.
+  nodes_size_ = 0;
+  edges_size_ = 0;
+  AddNode(0);  // The roots.
+  AddNode(0);  // The stacks.
+
+  for (intptr_t i = 0; i < heap_->handles_size_; i++) {
+    Visit(kRootNode, *heap_->handles_[i]);
+  }
+  Object* from;
+  Object* to;
+  heap_->interpreter_->RootPointers(&from, &to);
+  for (Object* ptr = from; ptr <= to; ptr++) {
+    Visit(kRootNode, *ptr);
+  }
+  edge_counts_[kRootNode]++;  // To the stacks.
+  edges_size_++;
+  for (intptr_t i = 0; heap_->interpreter_->StackPointers(i, &from, &to); i++) {
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      Visit(kStackNode, *ptr);
+    }
+  }
+
+  for (intptr_t node = kFirstObjectNode; node < nodes_size_; node++) {
+    HeapObject obj = HeapObject::FromAddr(nodes_[node]);
+    Visit(node, heap_->ClassAt(obj->cid()));
+    obj->Pointers(&from, &to);
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      Visit(node, *ptr);
+    }
+  }
+}
+
+
+void HeapSnapshot::Visit(intptr_t node, Object target) {
+  if (target->IsImmediateObject()) {
+    return;
+  }
+  NodeOf(target);
+  edge_counts_[node]++;
+  edges_size_++;
+}
+
+
+intptr_t HeapSnapshot::NodeOf(Object target) {
+  if (2 * (nodes_size_ + 1) > table_capacity_) {
+    GrowTable();
+  }
+  uword address = static_cast<HeapObject>(target)->Addr();
+  intptr_t mask = table_capacity_ - 1;
+  intptr_t slot = (address >> kObjectAlignmentLog2) & mask;
+  while (table_[slot].address != 0) {
+    if (table_[slot].address == address) {
+      return table_[slot].node;
+    }
+    slot = (slot + 1) & mask;
+  }
+  table_[slot].address = address;
+  table_[slot].node = AddNode(address);
+  return table_[slot].node;
+}
+
+
+intptr_t HeapSnapshot::AddNode(uword address) {
+  if (nodes_size_ == nodes_capacity_) {
+    nodes_capacity_ = nodes_capacity_ == 0 ? 1024 : nodes_capacity_ * 2;
+    nodes_ = reinterpret_cast<uword*>(
+        realloc(nodes_, nodes_capacity_ * sizeof(nodes_[0])));
+    edge_counts_ = reinterpret_cast<intptr_t*>(
+        realloc(edge_counts_, nodes_capacity_ * sizeof(edge_counts_[0])));
+    if ((nodes_ == NULL) || (edge_counts_ == NULL)) {
+      FATAL("Failed to grow heap snapshot");
+    }
+  }
+  nodes_[nodes_size_] = address;
+  edge_counts_[nodes_size_] = 0;
+  return nodes_size_++;
+}
+
+
+void HeapSnapshot::GrowTable() {
+  Entry* old_table = table_;
+  intptr_t old_capacity = table_capacity_;
+  table_capacity_ = old_capacity == 0 ? 2048 : old_capacity * 2;
+  table_ = reinterpret_cast<Entry*>(
+      calloc(table_capacity_, sizeof(table_[0])));
+  if (table_ == NULL) {
+    FATAL("Failed to grow heap snapshot");
+  }
+  intptr_t mask = table_capacity_ - 1;
+  for (intptr_t i = 0; i < old_capacity; i++) {
+    uword address = old_table[i].address;
+    if (address != 0) {
+      intptr_t slot = (address >> kObjectAlignmentLog2) & mask;
+      while (table_[slot].address != 0) {
+        slot = (slot + 1) & mask;
+      }
+      table_[slot] = old_table[i];
+    }
+  }
+  free(old_table);
+}
+
+
+intptr_t HeapSnapshot::NameOf(HeapObject object) {
+  char buffer[NameTable::kMaxName];
+  intptr_t length;
+  if (object->IsString()) {
+    // Cut short, but not within a character.
+    String string = static_cast<String>(object);
+    length = string->Size();
+    if (length >= NameTable::kMaxName) {
+      length = NameTable::kMaxName - 1;
+      while ((length > 0) &&
+             ((*string->element_addr(length) & 0xC0) == 0x80)) {
+        length--;
+      }
+    }
+    return names_.Intern(
+        reinterpret_cast<const char*>(string->element_addr(0)), length);
+  }
+  Behavior cls = heap_->ClassAt(object->cid());
+  length = NameTable::PrintClass(buffer, sizeof(buffer), cls);
+  return names_.Intern(buffer, length);
+}
+
+
+intptr_t HeapSnapshot::IndexName(intptr_t index) {
+  char buffer[32];
+  intptr_t length = snprintf(buffer, sizeof(buffer), "%" Pd, index);
+  return names_.Intern(buffer, length);
+}
+
+
+void HeapSnapshot::WriteNodes(FILE* file) {
+  fputs("\"nodes\":[", file);
+  for (intptr_t node = 0; node < nodes_size_; node++) {
+    intptr_t type;
+    intptr_t name;
+    intptr_t size;
+    if (node == kRootNode) {
+      type = kSyntheticNode;
+      name = names_.Intern("(GC roots)", 10);
+      size = 0;
+    } else if (node == kStackNode) {
+      type = kSyntheticNode;
+      name = names_.Intern("(stacks)", 8);
+      size = 0;
+    } else {
+      HeapObject obj = HeapObject::FromAddr(nodes_[node]);
+      switch (obj->cid()) {
+        case kStringCid:
+          type = kStringNode;
+          break;
+        case kMintCid:
+        case kBigintCid:
+        case kFloat64Cid:
+          type = kNumberNode;
+          break;
+        case kArrayCid:
+        case kWeakArrayCid:
+          type = kArrayNode;
+          break;
+        case kClosureCid:
+          type = kClosureNode;
+          break;
+        case kActivationCid:
+          type = kCodeNode;
+          break;
+        default:
+          type = kObjectNode;
+          break;
+      }
+      name = NameOf(obj);
+      size = obj->HeapSize();
+    }
+    // Ids are odd, as V8 gives its objects.
+    fprintf(file, "%s%" Pd ",%" Pd ",%" Pd ",%" Pd ",%" Pd ",0",
+            (node == 0) ? "" : ",\n", type, name, 2 * node + 1, size,
+            edge_counts_[node]);
+  }
+  fputs("],\n", file);
+}
+
+
+void HeapSnapshot::WriteEdges(FILE* file) {
+  // In the order Discover counted them.
+  fputs("\"edges\":[", file);
+  first_edge_ = true;
+  intptr_t index = 1;
+  for (intptr_t i = 0; i < heap_->handles_size_; i++) {
+    WriteEdge(file, kElementEdge, index++, *heap_->handles_[i]);
+  }
+  Object* from;
+  Object* to;
+  heap_->interpreter_->RootPointers(&from, &to);
+  for (Object* ptr = from; ptr <= to; ptr++) {
+    WriteEdge(file, kElementEdge, index++, *ptr);
+  }
+  fprintf(file, "%s%d,%" Pd ",%" Pd, first_edge_ ? "" : ",\n",
+          kInternalEdge, names_.Intern("stacks", 6), kStackNode * kNodeFields);
+  first_edge_ = false;
+  index = 1;
+  for (intptr_t i = 0; heap_->interpreter_->StackPointers(i, &from, &to); i++) {
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      WriteEdge(file, kElementEdge, index++, *ptr);
+    }
+  }
+
+  intptr_t class_name = names_.Intern("class", 5);
+  for (intptr_t node = kFirstObjectNode; node < nodes_size_; node++) {
+    HeapObject obj = HeapObject::FromAddr(nodes_[node]);
+    intptr_t cid = obj->cid();
+    WriteEdge(file, kInternalEdge, class_name, heap_->ClassAt(cid));
+    obj->Pointers(&from, &to);
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      // Slots are numbered from 1, as Newspeak numbers elements. The weak
+      // edges name theirs, so strings name all edges of types but element.
+      intptr_t slot = ptr - from + 1;
+      if (cid == kWeakArrayCid) {
+        if (!(*ptr)->IsImmediateObject()) {
+          WriteEdge(file, kWeakEdge, IndexName(slot), *ptr);
+        }
+      } else if ((cid == kEphemeronCid) && (slot == 1)) {
+        if (!(*ptr)->IsImmediateObject()) {
+          WriteEdge(file, kWeakEdge, names_.Intern("key", 3), *ptr);
+        }
+      } else {
+        WriteEdge(file, kElementEdge, slot, *ptr);
+      }
+    }
+  }
+  fputs("],\n", file);
+}
+
+
+void HeapSnapshot::WriteEdge(FILE* file, intptr_t type, intptr_t name,
+                             Object target) {
+  if (target->IsImmediateObject()) {
+    return;
+  }
+  fprintf(file, "%s%" Pd ",%" Pd ",%" Pd, first_edge_ ? "" : ",\n", type,
+          name, NodeOf(target) * kNodeFields);
+  first_edge_ = false;
+}
+
+
+void HeapSnapshot::WriteStrings(FILE* file) {
+  fputs("\"strings\":[", file);
+  for (intptr_t i = 0; i < names_.size(); i++) {
+    fputs((i == 0) ? "\"" : ",\n\"", file);
+    for (const uint8_t* c = reinterpret_cast<const uint8_t*>(names_.At(i));
+         *c != 0;
+         c++) {
+      if ((*c == '"') || (*c == '\\')) {
+        fputc('\\', file);
+        fputc(*c, file);
+      } else if (*c < 0x20) {
+        fprintf(file, "\\u%04x", *c);
+      } else {
+        fputc(*c, file);
+      }
+    }
+    fputc('"', file);
+  }
+  fputs("]", file);
+}
+
+}  // namespace psoup
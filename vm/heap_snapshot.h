@@ -0,0 +1,76 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_HEAP_SNAPSHOT_H_
+#define VM_HEAP_SNAPSHOT_H_
+
+#include <stdio.h>
+
+#include "vm/globals.h"
+#include "vm/object.h"
+#include "vm/profiler.h"
+
+namespace psoup {
+
+class Heap;
+
+// Writes the objects reachable from a heap's roots, with their classes, sizes
+// and the pointers between them, as a V8 heap snapshot: the JSON that the
+// Memory panel of Chrome's developer tools loads to show what retains what.
+// Each object is a node named by its class, or by its contents for a String,
+// and each pointer an edge, with one more from each object to its class. The
+// roots are a synthetic node, with the interpreter's stacks below it as
+// another. The objects are found by a walk that neither allocates nor moves
+// them, so the snapshot is of the heap as it stands, without a GC first.
+class HeapSnapshot {
+ public:
+  explicit HeapSnapshot(Heap* heap);
+  ~HeapSnapshot();
+
+  // False if the file cannot be written.
+  bool WriteTo(const char* path);
+
+ private:
+  struct Entry {
+    uword address;  // Or 0 if free.
+    intptr_t node;
+  };
+
+  static const intptr_t kRootNode = 0;
+  static const intptr_t kStackNode = 1;
+  static const intptr_t kFirstObjectNode = 2;
+
+  void Discover();
+  void Visit(intptr_t node, Object target);
+  intptr_t NodeOf(Object target);
+  intptr_t AddNode(uword address);
+  void GrowTable();
+
+  void WriteNodes(FILE* file);
+  void WriteEdges(FILE* file);
+  void WriteEdge(FILE* file, intptr_t type, intptr_t name, Object target);
+  void WriteStrings(FILE* file);
+  intptr_t NameOf(HeapObject object);
+  intptr_t IndexName(intptr_t index);
+
+  Heap* const heap_;
+
+  uword* nodes_;  // Addresses of objects, from kFirstObjectNode.
+  intptr_t* edge_counts_;
+  intptr_t nodes_size_;
+  intptr_t nodes_capacity_;
+  intptr_t edges_size_;
+
+  Entry* table_;  // Nodes by address.
+  intptr_t table_capacity_;
+
+  NameTable names_;
+  bool first_edge_;
+
+  DISALLOW_COPY_AND_ASSIGN(HeapSnapshot);
+};
+
+}  // namespace psoup
+
+#endif  // VM_HEAP_SNAPSHOT_H_
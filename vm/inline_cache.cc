@@ -0,0 +1,88 @@
+// Copyright (c) 2016, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/inline_cache.h"
+
+namespace psoup {
+
+void InlineCache::Insert(const uint8_t* site,
+                         Method caller,
+                         intptr_t cid,
+                         Object absent_receiver,
+                         Method target) {
+  Entry* entry = &entries_[Hash(site)];
+  if (entry->site != site) {
+    // Evict whichever site was sharing this entry.
+    entry->site = site;
+    entry->count = 0;
+    entry->megamorphic = false;
+  } else if (entry->megamorphic) {
+    return;
+  } else if (entry->count == kPolymorphism) {
+    for (intptr_t i = 0; i < kPolymorphism; i++) {
+      if (entry->cids[i] == cid) {
+        // Another application of the same mixin.
+        entry->callers[i] = caller;
+        entry->absent_receivers[i] = absent_receiver;
+        entry->targets[i] = target;
+        return;
+      }
+    }
+    entry->count = 0;
+    entry->megamorphic = true;
+    return;
+  }
+
+  intptr_t i = entry->count++;
+  entry->cids[i] = cid;
+  entry->callers[i] = caller;
+  entry->absent_receivers[i] = absent_receiver;
+  entry->targets[i] = target;
+}
+
+
+void InlineCache::Clear() {
+  for (intptr_t i = 0; i < kSize; i++) {
+    entries_[i].site = nullptr;
+    entries_[i].count = 0;
+    entries_[i].megamorphic = false;
+  }
+}
+
+
+void InlineCache::ClearSelector(String selector) {
+  for (intptr_t i = 0; i < kSize; i++) {
+    Entry* entry = &entries_[i];
+    for (intptr_t j = 0; j < entry->count; j++) {
+      if (entry->targets[j]->selector() == selector) {
+        entry->site = nullptr;
+        entry->count = 0;
+        entry->megamorphic = false;
+        break;
+      }
+    }
+  }
+}
+
+
+void InlineCache::ClearClassIds(const bool* marked, intptr_t length) {
+  for (intptr_t i = 0; i < kSize; i++) {
+    Entry* entry = &entries_[i];
+    for (intptr_t j = 0; j < entry->count; j++) {
+      intptr_t cid = entry->cids[j];
+      Object absent_receiver = entry->absent_receivers[j];
+      if (((cid < length) && marked[cid]) ||
+          ((absent_receiver != nullptr) &&
+           (absent_receiver->ClassId() < length) &&
+           marked[absent_receiver->ClassId()])) {
+        entry->site = nullptr;
+        entry->count = 0;
+        entry->megamorphic = false;
+        break;
+      }
+    }
+  }
+}
+
+}  // namespace psoup
@@ -0,0 +1,94 @@
+// Copyright (c) 2016, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_INLINE_CACHE_H_
+#define VM_INLINE_CACHE_H_
+
+#include "vm/flags.h"
+#include "vm/globals.h"
+#include "vm/object.h"
+
+#if INLINE_CACHE && !LOOKUP_CACHE
+#error INLINE_CACHE is filled from the LookupCache.
+#endif
+
+namespace psoup {
+
+// Send-site caches, kept in a side table keyed by the address of the
+// instruction following the send. The address identifies the selector and the
+// lookup rule, leaving the receiver's class and the caller to be checked. The
+// caller matters because the methods of each application of a mixin share
+// their bytecode, but NS lookups depend on the mixin application. A site
+// remembers up to kPolymorphism (caller, class) pairs. When it is full, a new
+// caller replaces an old one for the same class, but a new class marks the
+// site megamorphic, after which sends from it go straight to the LookupCache.
+// Like the LookupCache, the entries are not visited by the GC and are cleared
+// after every GC, which also covers methods installed by become.
+class InlineCache {
+ public:
+  InlineCache() {
+    Clear();
+  }
+
+  INLINE
+  bool Lookup(const uint8_t* site,
+              Method caller,
+              intptr_t cid,
+              Object* absent_receiver,
+              Method* target) {
+    Entry* entry = &entries_[Hash(site)];
+    if (entry->site != site) {
+      return false;
+    }
+    // Megamorphic sites have a count of 0.
+    for (intptr_t i = 0; i < entry->count; i++) {
+      if (entry->cids[i] == cid && entry->callers[i] == caller) {
+        *absent_receiver = entry->absent_receivers[i];
+        *target = entry->targets[i];
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Insert(const uint8_t* site,
+              Method caller,
+              intptr_t cid,
+              Object absent_receiver,
+              Method target);
+
+  void Clear();
+  // A site's selector is not recorded, but it is the selector of each of its
+  // targets. Megamorphic sites have no targets and so are never stale.
+  void ClearSelector(String selector);
+  // As LookupCache::ClearClassIds.
+  void ClearClassIds(const bool* marked, intptr_t length);
+
+ private:
+  static const intptr_t kPolymorphism = 4;
+
+  struct Entry {
+    const uint8_t* site;
+    intptr_t count;
+    bool megamorphic;
+    intptr_t cids[kPolymorphism];
+    Method callers[kPolymorphism];
+    Object absent_receivers[kPolymorphism];
+    Method targets[kPolymorphism];
+  };
+
+  static const intptr_t kSize = 512;
+  static const intptr_t kMask = kSize - 1;
+
+  static intptr_t Hash(const uint8_t* site) {
+    uword addr = reinterpret_cast<uword>(site);
+    return (addr ^ (addr >> 9)) & kMask;
+  }
+
+  Entry entries_[kSize];
+};
+
+}  // namespace psoup
+
+#endif  // VM_INLINE_CACHE_H_
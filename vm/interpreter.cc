@@ -6,9 +6,11 @@
 
 #include "vm/heap.h"
 #include "vm/isolate.h"
+#include "vm/log.h"
 #include "vm/math.h"
 #include "vm/os.h"
 #include "vm/primitives.h"
+#include "vm/probes.h"
 
 #define H heap_
 #define nil nil_
@@ -111,37 +113,104 @@ static Activation FrameBaseSender(Object* fp) {
   return static_cast<Activation>(fp[1]);
 }
 
-Interpreter::Interpreter(Heap* heap, Isolate* isolate) :
+static intptr_t StackSlots(size_t stack_size) {
+  // Room for a few of the largest frames.
+  const intptr_t kMinimumSlots = 4 * sizeof(Activation::Layout) / sizeof(Object);
+  intptr_t slots = stack_size / sizeof(Object);
+  return slots < kMinimumSlots ? kMinimumSlots : slots;
+}
+
+Interpreter::Interpreter(Heap* heap,
+                         Isolate* isolate,
+                         size_t stack_size,
+                         intptr_t max_stack_segments) :
     ip_(nullptr),
     sp_(nullptr),
     fp_(nullptr),
     stack_base_(nullptr),
     stack_limit_(nullptr),
+    segment_(nullptr),
+    spare_segment_(nullptr),
+    num_segments_(1),
+    max_segments_(max_stack_segments < 1 ? 1 : max_stack_segments),
+    stack_slots_(StackSlots(stack_size)),
     nil_(nullptr),
     false_(nullptr),
     true_(nullptr),
     object_store_(nullptr),
     heap_(heap),
     isolate_(isolate),
-    environment_(nullptr) {
+    environment_(nullptr),
+    suspended_(false),
+    quota_exceeded_(false),
+    profiler_(this),
+    time_quota_(this) {
   heap->InitializeInterpreter(this);
+  if (FLAG_report_primitives) {
+    primitive_profiler_.SetEnabled(true);
+  }
+
+#if REPORT_ACTIVATIONS
+  for (intptr_t i = 0; i < kMaterializationSlots; i++) {
+    materializations_[i].method = nullptr;
+    materializations_[i].count = 0;
+  }
+  total_materializations_ = 0;
+#endif
+  num_free_activations_ = 0;
 
-  stack_limit_ = reinterpret_cast<Object*>(malloc(kStackSize));
-  stack_base_ = stack_limit_ + kStackSlots;
+  StackSegment* segment = NewStackSegment();
+  segment->previous = nullptr;
+  EnterStackSegment(segment);
   sp_ = stack_base_;
-  checked_stack_limit_ =
-      stack_limit_ + (sizeof(Activation::Layout) / sizeof(Object));
+  poll_word_ = 0;
+}
+
+
+Interpreter::~Interpreter() {
+  if (FLAG_report_primitives) {
+    primitive_profiler_.Report();
+  }
+#if REPORT_BYTECODES
+  execution_counter_.Report();
+#endif
+  while (segment_ != nullptr) {
+    StackSegment* previous = segment_->previous;
+    free(segment_);
+    segment_ = previous;
+  }
+  free(spare_segment_);
+}
 
+
+Interpreter::StackSegment* Interpreter::NewStackSegment() {
+  StackSegment* segment = spare_segment_;
+  if (segment != nullptr) {
+    spare_segment_ = nullptr;
+  } else {
+    segment = reinterpret_cast<StackSegment*>(
+        malloc(sizeof(StackSegment) + stack_slots_ * sizeof(Object)));
+    if (segment == nullptr) {
+      FATAL("Failed to allocate stack");
+    }
+    segment->limit = reinterpret_cast<Object*>(segment + 1);
+    segment->base = segment->limit + stack_slots_;
+  }
 #if defined(DEBUG)
-  for (intptr_t i = 0; i < kStackSlots; i++) {
-    stack_limit_[i] = static_cast<Object>(kUninitializedWord);
+  for (intptr_t i = 0; i < stack_slots_; i++) {
+    segment->limit[i] = static_cast<Object>(kUninitializedWord);
   }
 #endif
+  return segment;
 }
 
 
-Interpreter::~Interpreter() {
-  free(stack_limit_);
+void Interpreter::EnterStackSegment(StackSegment* segment) {
+  segment_ = segment;
+  stack_limit_ = segment->limit;
+  stack_base_ = segment->base;
+  checked_stack_limit_ =
+      stack_limit_ + (sizeof(Activation::Layout) / sizeof(Object));
 }
 
 
@@ -250,11 +319,19 @@ void Interpreter::PushNewArray(intptr_t size) {
 
 void Interpreter::PushClosure(intptr_t num_copied,
                               intptr_t num_args,
-                              intptr_t block_size) {
-  EnsureActivation(fp_);  // SAFEPOINT
-
-  Closure result = H->AllocateClosure(num_copied);  // SAFEPOINT
-  result->set_defining_activation(FrameActivation(fp_));
+                              intptr_t block_size,
+                              bool needs_activation) {
+  Closure result;
+  if (needs_activation) {
+    ExposeActivation(EnsureActivation(fp_));  // SAFEPOINT
+    result = H->AllocateClosure(num_copied);  // SAFEPOINT
+    result->set_defining_activation(FrameActivation(fp_));
+    result->set_receiver(nil, kNoBarrier);
+  } else {
+    result = H->AllocateClosure(num_copied);  // SAFEPOINT
+    result->set_home_method(FrameMethod(fp_));
+    result->set_receiver(FrameReceiver(fp_));
+  }
   result->set_initial_bci(FrameMethod(fp_)->BCI(ip_));
   result->set_num_args(SmallInteger::New(num_args));
   for (intptr_t i = 0; i < num_copied; i++) {
@@ -274,13 +351,32 @@ void Interpreter::Perform(String selector, intptr_t num_args) {
 
 void Interpreter::CommonSend(intptr_t offset) {
   Array common_selectors = object_store()->common_selectors();
-  String selector =
-      static_cast<String>(common_selectors->element(offset * 2));
-  ASSERT(selector->is_canonical());
   SmallInteger arity =
       static_cast<SmallInteger>(common_selectors->element(offset * 2 + 1));
   ASSERT(arity->IsSmallInteger());
-  OrdinarySend(selector, arity->value());  // SAFEPOINT
+  intptr_t num_args = arity->value();
+#if REPORT_BYTECODES
+  CountSend(Stack(num_args));
+#endif
+
+#if INLINE_CACHE
+  Object receiver = Stack(num_args);
+  Object absent_receiver;
+  Method target;
+  if (inline_cache_.Lookup(ip_,
+                           FrameMethod(fp_),
+                           receiver->ClassId(),
+                           &absent_receiver,
+                           &target)) {
+    Activate(target, num_args);  // SAFEPOINT
+    return;
+  }
+#endif
+
+  String selector =
+      static_cast<String>(common_selectors->element(offset * 2));
+  ASSERT(selector->is_canonical());
+  OrdinarySiteMiss(selector, num_args);  // SAFEPOINT
 }
 
 
@@ -309,8 +405,49 @@ bool Interpreter::HasMethod(Behavior cls, String selector) {
 
 void Interpreter::OrdinarySend(intptr_t selector_index,
                                intptr_t num_args) {
+#if REPORT_BYTECODES
+  CountSend(Stack(num_args));
+#endif
+#if INLINE_CACHE
+  Object receiver = Stack(num_args);
+  Object absent_receiver;
+  Method target;
+  if (inline_cache_.Lookup(ip_,
+                           FrameMethod(fp_),
+                           receiver->ClassId(),
+                           &absent_receiver,
+                           &target)) {
+    Activate(target, num_args);  // SAFEPOINT
+    return;
+  }
+#endif
+
   String selector = SelectorAt(selector_index);
-  OrdinarySend(selector, num_args);  // SAFEPOINT
+  OrdinarySiteMiss(selector, num_args);  // SAFEPOINT
+}
+
+
+// Not used by Perform, which has no send site of its own: ip_ there is the
+// site of the #perform: send.
+void Interpreter::OrdinarySiteMiss(String selector,
+                                   intptr_t num_args) {
+#if LOOKUP_CACHE
+  Object receiver = Stack(num_args);
+  Method target;
+  if (lookup_cache_.LookupOrdinary(receiver->ClassId(), selector, &target)) {
+#if INLINE_CACHE
+    inline_cache_.Insert(ip_,
+                         FrameMethod(fp_),
+                         receiver->ClassId(),
+                         Object(),
+                         target);
+#endif
+    Activate(target, num_args);  // SAFEPOINT
+    return;
+  }
+#endif
+
+  OrdinarySendMiss(selector, num_args);  // SAFEPOINT
 }
 
 
@@ -332,6 +469,25 @@ void Interpreter::OrdinarySend(String selector,
 void Interpreter::OrdinarySendMiss(String selector,
                                    intptr_t num_args) {
   Object receiver = Stack(num_args);
+  bool present_receiver = true;
+#if LOOKUP_CACHE
+  // A send that ended in #doesNotUnderstand: is kept under kMNU, with the
+  // #doesNotUnderstand: method it found, so that proxies do not repeat
+  // both lookups on every send.
+  Object absent_receiver;
+  Method dnu;
+  if (lookup_cache_.LookupNS(receiver->ClassId(),
+                             selector,
+                             static_cast<Method>(nil),
+                             kMNU,
+                             &absent_receiver,
+                             &dnu)) {
+    DNUSend(selector, num_args, receiver, dnu,
+            present_receiver);  // SAFEPOINT
+    return;
+  }
+#endif
+
   Behavior receiver_class = receiver->Klass(H);
   Behavior lookup_class = receiver_class;
   while (lookup_class != nil) {
@@ -344,17 +500,23 @@ void Interpreter::OrdinarySendMiss(String selector,
         Activate(method, num_args);  // SAFEPOINT
         return;
       } else if (method->IsProtected()) {
-        bool present_receiver = true;
-        DNUSend(selector, num_args, receiver,
-                receiver_class, present_receiver);  // SAFEPOINT
-        return;
+        break;
       }
     }
     lookup_class = lookup_class->superclass();
   }
-  bool present_receiver = true;
-  DNUSend(selector, num_args, receiver,
-          receiver_class, present_receiver);  // SAFEPOINT
+
+  Method method = LookupDNU(receiver_class);
+#if LOOKUP_CACHE
+  lookup_cache_.InsertNS(receiver->ClassId(),
+                         selector,
+                         static_cast<Method>(nil),
+                         kMNU,
+                         Object(),
+                         method);
+#endif
+  DNUSend(selector, num_args, receiver, method,
+          present_receiver);  // SAFEPOINT
 }
 
 
@@ -372,12 +534,29 @@ Behavior Interpreter::FindApplicationOf(AbstractMixin mixin,
 
 void Interpreter::SuperSend(intptr_t selector_index,
                             intptr_t num_args) {
-  String selector = SelectorAt(selector_index);
-
+#if REPORT_BYTECODES
+  CountSend(FrameReceiver(fp_));
+#endif
 #if LOOKUP_CACHE
   Object receiver = FrameReceiver(fp_);
   Object absent_receiver;
   Method target;
+#if INLINE_CACHE
+  if (inline_cache_.Lookup(ip_,
+                           FrameMethod(fp_),
+                           receiver->ClassId(),
+                           &absent_receiver,
+                           &target)) {
+    ASSERT(absent_receiver == nullptr);
+    ActivateAbsent(target, receiver, num_args);  // SAFEPOINT
+    return;
+  }
+#endif
+#endif
+
+  String selector = SelectorAt(selector_index);
+
+#if LOOKUP_CACHE
   if (lookup_cache_.LookupNS(receiver->ClassId(),
                              selector,
                              FrameMethod(fp_),
@@ -385,7 +564,13 @@ void Interpreter::SuperSend(intptr_t selector_index,
                              &absent_receiver,
                              &target)) {
     ASSERT(absent_receiver == nullptr);
-    absent_receiver = receiver;
+#if INLINE_CACHE
+    inline_cache_.Insert(ip_,
+                         FrameMethod(fp_),
+                         receiver->ClassId(),
+                         absent_receiver,
+                         target);
+#endif
     ActivateAbsent(target, receiver, num_args);  // SAFEPOINT
     return;
   }
@@ -412,18 +597,44 @@ void Interpreter::SuperSendMiss(String selector,
 
 void Interpreter::ImplicitReceiverSend(intptr_t selector_index,
                                        intptr_t num_args) {
-  String selector = SelectorAt(selector_index);
-
+#if REPORT_BYTECODES
+  CountSend(FrameReceiver(fp_));
+#endif
 #if LOOKUP_CACHE
   Object method_receiver = FrameReceiver(fp_);
   Object absent_receiver;
   Method target;
+#if INLINE_CACHE
+  if (inline_cache_.Lookup(ip_,
+                           FrameMethod(fp_),
+                           method_receiver->ClassId(),
+                           &absent_receiver,
+                           &target)) {
+    if (absent_receiver == nullptr) {
+      absent_receiver = method_receiver;
+    }
+    ActivateAbsent(target, absent_receiver, num_args);  // SAFEPOINT
+    return;
+  }
+#endif
+#endif
+
+  String selector = SelectorAt(selector_index);
+
+#if LOOKUP_CACHE
   if (lookup_cache_.LookupNS(method_receiver->ClassId(),
                              selector,
                              FrameMethod(fp_),
                              kImplicitReceiver,
                              &absent_receiver,
                              &target)) {
+#if INLINE_CACHE
+    inline_cache_.Insert(ip_,
+                         FrameMethod(fp_),
+                         method_receiver->ClassId(),
+                         absent_receiver,
+                         target);
+#endif
     if (absent_receiver == nullptr) {
       absent_receiver = method_receiver;
     }
@@ -470,12 +681,29 @@ void Interpreter::ImplicitReceiverSendMiss(String selector,
 void Interpreter::OuterSend(intptr_t selector_index,
                             intptr_t num_args,
                             intptr_t depth) {
-  String selector = SelectorAt(selector_index);
-
+#if REPORT_BYTECODES
+  CountSend(FrameReceiver(fp_));
+#endif
 #if LOOKUP_CACHE
   Object receiver = FrameReceiver(fp_);
   Object absent_receiver;
   Method target;
+#if INLINE_CACHE
+  if (inline_cache_.Lookup(ip_,
+                           FrameMethod(fp_),
+                           receiver->ClassId(),
+                           &absent_receiver,
+                           &target)) {
+    ASSERT(absent_receiver != nullptr);
+    ActivateAbsent(target, absent_receiver, num_args);  // SAFEPOINT
+    return;
+  }
+#endif
+#endif
+
+  String selector = SelectorAt(selector_index);
+
+#if LOOKUP_CACHE
   if (lookup_cache_.LookupNS(receiver->ClassId(),
                              selector,
                              FrameMethod(fp_),
@@ -483,6 +711,13 @@ void Interpreter::OuterSend(intptr_t selector_index,
                              &absent_receiver,
                              &target)) {
     ASSERT(absent_receiver != nullptr);
+#if INLINE_CACHE
+    inline_cache_.Insert(ip_,
+                         FrameMethod(fp_),
+                         receiver->ClassId(),
+                         absent_receiver,
+                         target);
+#endif
     ActivateAbsent(target, absent_receiver, num_args);  // SAFEPOINT
     return;
   }
@@ -511,12 +746,29 @@ void Interpreter::OuterSendMiss(String selector,
 
 void Interpreter::SelfSend(intptr_t selector_index,
                            intptr_t num_args) {
-  String selector = SelectorAt(selector_index);
-
+#if REPORT_BYTECODES
+  CountSend(FrameReceiver(fp_));
+#endif
 #if LOOKUP_CACHE
   Object receiver = FrameReceiver(fp_);
   Object absent_receiver;
   Method target;
+#if INLINE_CACHE
+  if (inline_cache_.Lookup(ip_,
+                           FrameMethod(fp_),
+                           receiver->ClassId(),
+                           &absent_receiver,
+                           &target)) {
+    ASSERT(absent_receiver == nullptr);
+    ActivateAbsent(target, receiver, num_args);  // SAFEPOINT
+    return;
+  }
+#endif
+#endif
+
+  String selector = SelectorAt(selector_index);
+
+#if LOOKUP_CACHE
   if (lookup_cache_.LookupNS(receiver->ClassId(),
                              selector,
                              FrameMethod(fp_),
@@ -524,6 +776,13 @@ void Interpreter::SelfSend(intptr_t selector_index,
                              &absent_receiver,
                              &target)) {
     ASSERT(absent_receiver == nullptr);
+#if INLINE_CACHE
+    inline_cache_.Insert(ip_,
+                         FrameMethod(fp_),
+                         receiver->ClassId(),
+                         absent_receiver,
+                         target);
+#endif
     ActivateAbsent(target, receiver, num_args);  // SAFEPOINT
     return;
   }
@@ -556,7 +815,7 @@ void Interpreter::LexicalSend(String selector,
                            selector,
                            FrameMethod(fp_),
                            rule,
-                           receiver == method_receiver ? Object() : receiver,
+                           AbsentReceiverEntry(receiver, method_receiver, rule),
                            method);
 #endif
     ActivateAbsent(method, receiver, num_args);  // SAFEPOINT
@@ -567,6 +826,22 @@ void Interpreter::LexicalSend(String selector,
 }
 
 
+// The receiver a lookup found, as the caches keep it: null when it is the
+// method's own receiver, which an implicit receiver send substitutes at each
+// hit. The enclosing object an outer send finds is the same for every instance
+// of the method receiver's class, so it is kept even when it happens to be
+// the receiver.
+Object Interpreter::AbsentReceiverEntry(Object receiver,
+                                        Object method_receiver,
+                                        intptr_t rule) {
+  bool is_outer = (rule != kSelf) && (rule < kSuper);
+  if ((receiver == method_receiver) && !is_outer) {
+    return Object();
+  }
+  return receiver;
+}
+
+
 void Interpreter::ProtectedSend(String selector,
                                 intptr_t num_args,
                                 Object receiver,
@@ -582,7 +857,8 @@ void Interpreter::ProtectedSend(String selector,
                              selector,
                              FrameMethod(fp_),
                              rule,
-                             receiver == method_receiver ? Object() : receiver,
+                             AbsentReceiverEntry(receiver, method_receiver,
+                                                 rule),
                              method);
 #endif
       ActivateAbsent(method, receiver, num_args);  // SAFEPOINT
@@ -591,26 +867,12 @@ void Interpreter::ProtectedSend(String selector,
     lookup_class = lookup_class->superclass();
   }
   bool present_receiver = false;
-  DNUSend(selector, num_args, receiver, mixin_application,
+  DNUSend(selector, num_args, receiver, LookupDNU(mixin_application),
           present_receiver);  // SAFEPOINT
 }
 
 
-void Interpreter::DNUSend(String selector,
-                          intptr_t num_args,
-                          Object receiver,
-                          Behavior lookup_class,
-                          bool present_receiver) {
-  if (TRACE_DNU) {
-    char* c1 = receiver->ToCString(H);
-    char* c2 = selector->ToCString(H);
-    char* c3 = FrameMethod(fp_)->selector()->ToCString(H);
-    OS::PrintErr("DNU %s %s from %s\n", c1, c2, c3);
-    free(c1);
-    free(c2);
-    free(c3);
-  }
-
+Method Interpreter::LookupDNU(Behavior lookup_class) {
   Behavior cls = lookup_class;
   Method method;
   do {
@@ -624,6 +886,24 @@ void Interpreter::DNUSend(String selector,
   if (method == nil) {
     FATAL("Recursive #doesNotUnderstand:");
   }
+  return method;
+}
+
+
+void Interpreter::DNUSend(String selector,
+                          intptr_t num_args,
+                          Object receiver,
+                          Method method,
+                          bool present_receiver) {
+  if (FLAG_trace_dnu) {
+    char* c1 = receiver->ToCString(H);
+    char* c2 = selector->ToCString(H);
+    char* c3 = FrameMethod(fp_)->selector()->ToCString(H);
+    Log::Print("trace_dnu", "DNU %s %s from %s", c1, c2, c3);
+    free(c1);
+    free(c2);
+    free(c3);
+  }
 
   Array arguments;
   {
@@ -658,8 +938,8 @@ void Interpreter::DNUSend(String selector,
 
 
 void Interpreter::SendCannotReturn(Object result) {
-  if (TRACE_SPECIAL_CONTROL) {
-    OS::PrintErr("#cannotReturn:\n");
+  if (FLAG_trace_special_control) {
+    Log::Print("trace_special_control", "#cannotReturn:");
   }
 
   Activation top;
@@ -683,7 +963,7 @@ void Interpreter::SendCannotReturn(Object result) {
     FATAL("Missing #cannotReturn:");
   }
 
-  Push(top);
+  Push(ExposeActivation(top));
   Push(result);
   Activate(method, 1);  // SAFEPOINT
 }
@@ -691,8 +971,8 @@ void Interpreter::SendCannotReturn(Object result) {
 
 void Interpreter::SendAboutToReturnThrough(Object result,
                                            Activation unwind) {
-  if (TRACE_SPECIAL_CONTROL) {
-    OS::PrintErr("#aboutToReturn:through:\n");
+  if (FLAG_trace_special_control) {
+    Log::Print("trace_special_control", "#aboutToReturn:through:");
   }
 
   Activation top;
@@ -717,17 +997,17 @@ void Interpreter::SendAboutToReturnThrough(Object result,
     FATAL("Missing #aboutToReturn:through:");
   }
 
-  Push(top);
+  Push(ExposeActivation(top));
   Push(result);
-  Push(unwind);
+  Push(ExposeActivation(unwind));
   Activate(method, 2);  // SAFEPOINT
 }
 
 
 void Interpreter::SendNonBooleanReceiver(Object non_boolean) {
   // Note that Squeak instead sends #mustBeBoolean to the non-boolean.
-  if (TRACE_SPECIAL_CONTROL) {
-    OS::PrintErr("#nonBooleanReceiver:\n");
+  if (FLAG_trace_special_control) {
+    Log::Print("trace_special_control", "#nonBooleanReceiver:");
   }
 
   Activation top;
@@ -751,7 +1031,7 @@ void Interpreter::SendNonBooleanReceiver(Object non_boolean) {
     FATAL("Missing #nonBooleanReceiver:");
   }
 
-  Push(top);
+  Push(ExposeActivation(top));
   Push(non_boolean);
   Activate(method, 1);  // SAFEPOINT
 }
@@ -783,10 +1063,10 @@ void Interpreter::Activate(Method method, intptr_t num_args) {
 
   intptr_t prim = method->Primitive();
   if (prim != 0) {
-    if (TRACE_PRIMITIVES) {
-      OS::PrintErr("Primitive %" Pd "\n", prim);
+    if (FLAG_trace_primitives) {
+      Log::Print("trace_primitives", "Primitive %" Pd, prim);
     }
-    if ((prim & 256) != 0) {
+    if (Primitives::IsGetter(prim)) {
       // Getter
       intptr_t offset = prim & 255;
       ASSERT(num_args == 0);
@@ -795,19 +1075,30 @@ void Interpreter::Activate(Method method, intptr_t num_args) {
       Object value = static_cast<RegularObject>(receiver)->slot(offset);
       PopNAndPush(1, value);
       return;
-    } else if ((prim & 512) != 0) {
+    } else if (Primitives::IsSetter(prim)) {
       // Setter
       intptr_t offset = prim & 255;
       ASSERT(num_args == 1);
       Object receiver = Stack(1);
       Object value = Stack(0);
       ASSERT(receiver->IsRegularObject() || receiver->IsEphemeron());
-      static_cast<RegularObject>(receiver)->set_slot(offset, value);
+      if (value->IsSmallInteger()) {
+        // Neither barrier applies, whatever space the receiver is in.
+        static_cast<RegularObject>(receiver)->set_slot(offset, value,
+                                                       kNoBarrier);
+      } else {
+        static_cast<RegularObject>(receiver)->set_slot(offset, value);
+      }
       PopNAndPush(2, receiver);
       return;
     } else {
       HandleScope h1(H, reinterpret_cast<Object*>(&method));
-      if (Primitives::Invoke(prim, num_args, H, this)) {  // SAFEPOINT
+      if (primitive_profiler_.enabled()) {
+        if (InvokeProfiled(prim, num_args)) {  // SAFEPOINT
+          ASSERT(StackDepth() >= 0);
+          return;
+        }
+      } else if (Primitives::Invoke(prim, num_args, H, this)) {  // SAFEPOINT
         ASSERT(StackDepth() >= 0);
         return;
       }
@@ -829,11 +1120,65 @@ void Interpreter::Activate(Method method, intptr_t num_args) {
   for (intptr_t i = num_args; i < num_temps; i++) {
     Push(nil);
   }
+  Probes::MethodEntry(method);
 
   if (sp_ < checked_stack_limit_) {
     StackOverflow();
+    return;
+  }
+  Poll();
+
+#if defined(USE_BASELINE_JIT)
+  const NativeCode* code = native_code_.Activated(method);
+  if (code != nullptr) {
+    RunNativeCode(code, method);
+  }
+#endif
+}
+
+
+bool Interpreter::InvokeProfiled(intptr_t prim, intptr_t num_args) {
+  int64_t start = OS::CurrentMonotonicNanos();
+  bool success = Primitives::Invoke(prim, num_args, H, this);  // SAFEPOINT
+  primitive_profiler_.Record(prim, success,
+                             OS::CurrentMonotonicNanos() - start);
+  return success;
+}
+
+
+#if defined(USE_BASELINE_JIT)
+void Interpreter::RunNativeCode(const NativeCode* code, Method method) {
+  intptr_t bci = method->BCI(ip_)->value();
+  if (!code->HasEntry(bci)) {
+    return;
+  }
+  NativeState state;
+  state.sp = sp_;
+  state.fp = fp_;
+  state.literals = method->literals()->from();
+  state.nil_obj = nil_;
+  state.false_obj = false_;
+  state.true_obj = true_;
+  static_assert(sizeof(poll_word_) == sizeof(uword), "poll word layout");
+  state.poll_word = reinterpret_cast<const volatile uword*>(&poll_word_);
+  intptr_t exit_bci = code->Run(&state, bci);
+  sp_ = state.sp;
+  ip_ = method->IP(SmallInteger::New(exit_bci));
+}
+
+
+void Interpreter::ResumeNativeCode() {
+  // Closure activations run their bodies, which are not compiled.
+  if (FlagsIsClosure(FrameFlags(fp_))) {
+    return;
+  }
+  Method method = FrameMethod(fp_);
+  const NativeCode* code = native_code_.Lookup(method);
+  if (code != nullptr) {
+    RunNativeCode(code, method);
   }
 }
+#endif  // defined(USE_BASELINE_JIT)
 
 
 void Interpreter::ActivateClosure(intptr_t num_args) {
@@ -841,18 +1186,27 @@ void Interpreter::ActivateClosure(intptr_t num_args) {
   ASSERT(closure->IsClosure());
   ASSERT(closure->num_args() == SmallInteger::New(num_args));
 
-  Activation home = closure->defining_activation();
+  Method method;
+  Object receiver;
+  if (closure->HasDefiningActivation()) {
+    Activation home = closure->defining_activation();
+    method = home->method();
+    receiver = home->receiver();
+  } else {
+    method = closure->home_method();
+    receiver = closure->receiver();
+  }
 
   // Create frame.
   Push(static_cast<SmallInteger>(reinterpret_cast<uword>(ip_)));
   Push(static_cast<SmallInteger>(reinterpret_cast<uword>(fp_)));
   fp_ = sp_;
   Push(MakeFlags(num_args, true));
-  Push(home->method());
+  Push(method);
   Push(Object(static_cast<uword>(0)));  // Activation.
-  Push(home->receiver());
+  Push(receiver);
 
-  ip_ = home->method()->IP(closure->initial_bci());
+  ip_ = method->IP(closure->initial_bci());
 
   intptr_t num_copied = closure->NumCopied();
   for (intptr_t i = 0; i < num_copied; i++) {
@@ -864,6 +1218,7 @@ void Interpreter::ActivateClosure(intptr_t num_args) {
   if (sp_ < checked_stack_limit_) {
     StackOverflow();
   }
+  Poll();
 }
 
 
@@ -923,63 +1278,228 @@ void Interpreter::CreateBaseFrame(Activation activation) {
 
 
 void Interpreter::StackOverflow() {
-  if (checked_stack_limit_ == reinterpret_cast<Object*>(-1)) {
-    // Interrupt.
-    isolate_->PrintStack();
-    Exit();
+  if ((num_segments_ < max_segments_) && (FrameSavedFP(fp_) != 0)) {
+    GrowStack();  // SAFEPOINT
+    return;
   }
 
-  // True overflow: reclaim stack space by moving all frames except the top
-  // frame to the heap.
+  // Reclaim stack space by moving all frames except the top frame to the
+  // heap.
   CreateBaseFrame(FlushAllFrames());  // SAFEPOINT
 }
 
 
-String Interpreter::SelectorAt(intptr_t index) {
-  Array literals = FrameMethod(fp_)->literals();
-  ASSERT((index >= 0) && (index < literals->Size()));
-  Object selector = literals->element(index);
-  ASSERT(selector->IsString());
-  ASSERT(static_cast<String>(selector)->is_canonical());
-  return static_cast<String>(selector);
-}
-
-
-void Interpreter::LocalReturn(Object result) {
-  Object* saved_fp = FrameSavedFP(fp_);
-  if (saved_fp == 0) {
-    LocalBaseReturn(result);  // SAFEPOINT
-    return;
+void Interpreter::GrowStack() {
+  // The top frame moves to a new segment as its base frame, with the
+  // activation of its caller, which stays in place, as its base sender.
+  Object* caller_fp = FrameSavedFP(fp_);
+  Activation sender = EnsureActivation(caller_fp);  // SAFEPOINT
+  ASSERT(FrameActivation(fp_) == nullptr);
+
+  Object* frame_top = FrameSavedSP(fp_);
+  StackSegment* segment = NewStackSegment();
+  segment->previous = segment_;
+  segment_->ip = FrameSavedIP(fp_);
+  segment_->sp = frame_top;
+  segment_->fp = caller_fp;
+
+  intptr_t frame_size = frame_top - sp_;
+  Object* new_sp = segment->base - frame_size;
+  memcpy(new_sp, sp_, frame_size * sizeof(Object));
+  fp_ = segment->base - (frame_top - fp_);
+  sp_ = new_sp;
+  fp_[1] = sender;                      // Base sender.
+  fp_[0] = Object(static_cast<uword>(0));  // Saved FP.
+  EnterStackSegment(segment);
+  num_segments_++;
+}
+
+
+void Interpreter::ShrinkStack() {
+  // Back to the top frame of the segment the stack grew from.
+  StackSegment* segment = segment_;
+  StackSegment* previous = segment->previous;
+  ASSERT(previous != nullptr);
+  ip_ = previous->ip;
+  sp_ = previous->sp;
+  fp_ = previous->fp;
+  EnterStackSegment(previous);
+  num_segments_--;
+  if (spare_segment_ == nullptr) {
+    spare_segment_ = segment;
+  } else {
+    free(segment);
   }
-
-  ip_ = FrameSavedIP(fp_);
-  sp_ = FrameSavedSP(fp_);
-  fp_ = saved_fp;
-  Push(result);
 }
 
 
-void Interpreter::LocalBaseReturn(Object result) {
-  // Returning from the base frame.
-  Activation top;
-  {
-    HandleScope h(H, reinterpret_cast<Object*>(&result));
-    top = FlushAllFrames();  // SAFEPOINT
+void Interpreter::HandlePollRequests() {
+  if ((poll_word_ & kProfileRequest) != 0) {
+    poll_word_.fetch_and(~kProfileRequest);
+    SampleStack();
   }
-
-  Activation sender = top->sender();
-  if (!sender->IsActivation() ||
-      !sender->bci()->IsSmallInteger()) {
-    CreateBaseFrame(top);
-    SendCannotReturn(result);  // SAFEPOINT
-    return;
+  if ((poll_word_ & kInterruptRequest) != 0) {
+    isolate_->PrintStack();
+    Exit();
+  }
+  if ((poll_word_ & (kYieldRequest | kQuotaRequest)) != 0) {
+    uword requests = poll_word_.fetch_and(~(kYieldRequest | kQuotaRequest));
+    // Outside a turn, as while a message is activated, they are for a slice
+    // already ended. Within one, the stack is left as the poll found it, for
+    // the turn to go on from.
+    if (environment_ == nullptr) {
+      return;
+    }
+    if (((requests & kQuotaRequest) != 0) && time_quota_.QuotaSpent()) {
+      quota_exceeded_ = true;
+      Exit();
+    }
+    if (((requests & kYieldRequest) != 0) && time_quota_.SliceSpent()) {
+      suspended_ = true;
+      Exit();
+    }
   }
-
-  top->set_sender(static_cast<Activation>(nil), kNoBarrier);
-  top->set_bci(static_cast<SmallInteger>(nil));
-
-  CreateBaseFrame(sender);
-  Push(result);
+}
+
+
+void Interpreter::SignalTimeQuotaExceeded() {
+  if (FLAG_trace_special_control) {
+    Log::Print("trace_special_control", "#timeQuotaExceeded");
+  }
+
+  Activation top = EnsureActivation(fp_);  // SAFEPOINT
+  Behavior cls = top->Klass(H);
+  Method method;
+  do {
+    method = MethodAt(cls, object_store()->time_quota_exceeded());
+    if (method != nil) {
+      break;
+    }
+    cls = cls->superclass();
+  } while (cls != nil);
+
+  if (method == nil) {
+    FATAL("Missing #timeQuotaExceeded");
+  }
+
+  Push(ExposeActivation(top));
+  Activate(method, 0);  // SAFEPOINT
+}
+
+
+void Interpreter::SampleStack() {
+  // Walks the frames as GCPrologue does, then the activations of those
+  // already moved to the heap, without allocating.
+  profiler_.BeginSample();
+  Object* fp = fp_;
+  Object* base_fp = nullptr;
+  StackSegment* segment = segment_;
+  while (fp != 0) {
+    if (!profiler_.AddFrame(FrameMethod(fp),
+                            FlagsIsClosure(FrameFlags(fp)))) {
+      break;
+    }
+    base_fp = fp;
+    fp = FrameSavedFP(fp);
+    if ((fp == 0) && (segment->previous != nullptr)) {
+      segment = segment->previous;
+      fp = segment->fp;
+    }
+  }
+  if ((fp == 0) && (base_fp != nullptr)) {
+    Object sender = FrameBaseSender(base_fp);
+    while (sender->IsActivation()) {
+      Activation activation = static_cast<Activation>(sender);
+      if (!profiler_.AddFrame(activation->method(),
+                              activation->closure() != nil)) {
+        break;
+      }
+      sender = activation->sender();
+    }
+  }
+  profiler_.EndSample();
+}
+
+
+void Interpreter::CurrentSite(Method* method, bool* is_closure,
+                              intptr_t* bci) {
+  if (fp_ == 0) {
+    return;
+  }
+  Method current = FrameMethod(fp_);
+  *method = current;
+  *is_closure = FlagsIsClosure(FrameFlags(fp_));
+  ByteArray bytecode = current->bytecode();
+  const uint8_t* start = bytecode->element_addr(0);
+  if ((ip_ >= start) && (ip_ <= start + bytecode->Size())) {
+    *bci = current->BCI(ip_)->value();
+  }
+}
+
+
+String Interpreter::SelectorAt(intptr_t index) {
+  Array literals = FrameMethod(fp_)->literals();
+  ASSERT((index >= 0) && (index < literals->Size()));
+  Object selector = literals->element(index);
+  ASSERT(selector->IsString());
+  ASSERT(static_cast<String>(selector)->is_canonical());
+  return static_cast<String>(selector);
+}
+
+
+void Interpreter::LocalReturn(Object result) {
+#if defined(USE_USDT_PROBES)
+  if (!FlagsIsClosure(FrameFlags(fp_))) {
+    Probes::MethodReturn(FrameMethod(fp_));
+  }
+#endif
+  Object* saved_fp = FrameSavedFP(fp_);
+  if (saved_fp == 0) {
+    LocalBaseReturn(result);  // SAFEPOINT
+    return;
+  }
+
+  ip_ = FrameSavedIP(fp_);
+  sp_ = FrameSavedSP(fp_);
+  fp_ = saved_fp;
+  Push(result);
+#if defined(USE_BASELINE_JIT)
+  ResumeNativeCode();
+#endif
+}
+
+
+void Interpreter::LocalBaseReturn(Object result) {
+  // Returning from the base frame.
+  if (segment_->previous != nullptr) {
+    // The sender is the top frame of the segment the stack grew from. A
+    // change of sender would have flushed the segments.
+    ASSERT(FrameBaseSender(fp_)->sender_fp() == segment_->previous->fp);
+    ShrinkStack();
+    Push(result);
+    return;
+  }
+
+  Activation top;
+  {
+    HandleScope h(H, reinterpret_cast<Object*>(&result));
+    top = FlushAllFrames();  // SAFEPOINT
+  }
+
+  Activation sender = top->sender();
+  if (!sender->IsActivation() ||
+      !sender->bci()->IsSmallInteger()) {
+    CreateBaseFrame(top);
+    SendCannotReturn(result);  // SAFEPOINT
+    return;
+  }
+
+  top->set_sender(static_cast<Activation>(nil), kNoBarrier);
+  top->set_bci(static_cast<SmallInteger>(nil));
+
+  CreateBaseFrame(sender);
+  Push(result);
+  RecycleActivation(top);
 }
 
 
@@ -996,9 +1516,16 @@ void Interpreter::NonLocalReturn(Object result) {
     ASSERT(home->IsActivation());
     c = home->closure();
   }
+  Probes::MethodReturn(home->method());
 
-  for (Object* fp = FrameSavedFP(fp_); fp != 0; fp = FrameSavedFP(fp)) {
-    if (FrameActivation(fp) == home) {
+  // A home with a frame records where the frame is, so a home without one
+  // cannot be on the stack and the search is skipped. Otherwise it only
+  // checks for unwind-protect and simulation root frames in the way.
+  Object* home_fp = home->sender()->IsSmallInteger() ? home->sender_fp() : 0;
+  for (Object* fp = FrameSavedFP(fp_);
+       (home_fp != 0) && (fp != 0);
+       fp = FrameSavedFP(fp)) {
+    if ((fp == home_fp) && (FrameActivation(fp) == home)) {
       if (FrameSavedFP(fp) == 0) {
         break;  // Return crosses base frame.
       }
@@ -1020,6 +1547,10 @@ void Interpreter::NonLocalReturn(Object result) {
     }
   }
 
+  if ((home_fp == 0) && ReturnPastFrames(home, result)) {
+    return;
+  }
+
   // A more complicated case: crossing the base frame, #cannotReturn:, or
   // #aboutToReturn:to:. These cares are very rare, so we simply flush to
   // activations instead of dealing with a mixture of frames and activations.
@@ -1072,11 +1603,80 @@ void Interpreter::NonLocalReturn(Object result) {
     Activation next = zap->sender();
     zap->set_sender(static_cast<Activation>(nil), kNoBarrier);
     zap->set_bci(static_cast<SmallInteger>(nil));
+    RecycleActivation(zap);
+    zap = next;
+  } while (zap != sender);
+
+  CreateBaseFrame(sender);
+  Push(result);
+}
+
+
+bool Interpreter::ReturnPastFrames(Activation home, Object result) {
+  // The home is already in the heap, below every frame, as after a stack
+  // overflow. Flushing the frames would make activations only to zap them, so
+  // if nothing in the way blocks the return, the frames are dropped instead.
+  // Those that had activations are found to be gone as any returned-from
+  // frame's are.
+  Object* base_fp = fp_;
+  StackSegment* segment = segment_;
+  Object* fp = FrameSavedFP(fp_);
+  for (;;) {
+    if ((fp == 0) && (segment->previous != nullptr)) {
+      segment = segment->previous;
+      fp = segment->fp;
+    }
+    if (fp == 0) {
+      break;
+    }
+    intptr_t prim = FrameMethod(fp)->Primitive();
+    if (Primitives::IsUnwindProtect(prim) ||
+        Primitives::IsSimulationRoot(prim)) {
+      return false;
+    }
+    base_fp = fp;
+    fp = FrameSavedFP(fp);
+  }
+
+  Activation base_sender = FrameBaseSender(base_fp);
+  for (Activation unwind = base_sender;
+       unwind != home;
+       unwind = unwind->sender()) {
+    if (!unwind->IsActivation()) {
+      return false;
+    }
+    intptr_t prim = unwind->method()->Primitive();
+    if (Primitives::IsUnwindProtect(prim) ||
+        Primitives::IsSimulationRoot(prim)) {
+      return false;
+    }
+  }
+
+  Activation sender = home->sender();
+  if (!sender->IsActivation() ||
+      !sender->bci()->IsSmallInteger()) {
+    return false;
+  }
+
+  Activation zap = base_sender;
+  do {
+    Activation next = zap->sender();
+    zap->set_sender(static_cast<Activation>(nil), kNoBarrier);
+    zap->set_bci(static_cast<SmallInteger>(nil));
+    RecycleActivation(zap);
     zap = next;
   } while (zap != sender);
 
+  while (segment_->previous != nullptr) {
+    ShrinkStack();
+  }
+  ip_ = 0;
+  sp_ = stack_base_;
+  fp_ = 0;
+
   CreateBaseFrame(sender);
   Push(result);
+  return true;
 }
 
 
@@ -1093,17 +1693,47 @@ void Interpreter::MethodReturn(Object result) {
 
 
 void Interpreter::Enter() {
+  time_quota_.BeginTurn();
+  Run();
+}
+
+
+void Interpreter::Resume() {
+  ASSERT(suspended_);
+  suspended_ = false;
+  Run();
+}
+
+
+void Interpreter::Run() {
   intptr_t saved_handles = H->handles();
   jmp_buf* saved_environment = environment_;
 
   jmp_buf environment;
   environment_ = &environment;
 
-  if (setjmp(environment) == 0) {
-    Interpret();
-    UNREACHABLE();
+  // A sample asked for while the isolate was waiting would be taken at the
+  // start of this slice instead, and a time quota's requests were for the
+  // last.
+  poll_word_.fetch_and(~(kProfileRequest | kYieldRequest | kQuotaRequest));
+  time_quota_.BeginSlice();
+
+  for (;;) {
+    if (setjmp(environment) == 0) {
+      if (quota_exceeded_) {
+        quota_exceeded_ = false;
+        SignalTimeQuotaExceeded();  // SAFEPOINT
+      }
+      Interpret();
+      UNREACHABLE();
+    }
+    if (!quota_exceeded_) {
+      break;
+    }
+    H->set_handles(saved_handles);
   }
 
+  time_quota_.EndSlice();
   environment_ = saved_environment;
   H->set_handles(saved_handles);
 }
@@ -1123,6 +1753,10 @@ void Interpreter::ReturnFromDispatch() {
   Object* saved_fp = FrameSavedFP(fp_);
   if (saved_fp == 0) {
     // Base frame.
+    if (segment_->previous != nullptr) {
+      ShrinkStack();
+      return;
+    }
     Activation sender = FrameBaseSender(fp_);
     if (sender != nil) {
       ip_ = 0;
@@ -1139,43 +1773,187 @@ void Interpreter::ReturnFromDispatch() {
 }
 
 void Interpreter::PrintStack() {
-  Activation top = FlushAllFrames();  // SAFEPOINT
-  top->PrintStack(H);
-  CreateBaseFrame(top);
-}
+  WalkStack([this](Method method, Object bci, Object receiver,
+                   Closure closure) {
+    Activation::PrintFrame(H, method, receiver, closure);
+    return true;
+  });
+}
+
+// Direct-threaded dispatch: each bytecode handler ends with its own indirect
+// jump through a table of label addresses instead of looping back to the
+// switch's single shared jump, so the branch predictor sees a separate history
+// for each handler. Labels as values are a GNU extension: MSVC does not have
+// them, and the wasm backend lowers them back into a switch anyway.
+#if THREADED_DISPATCH && (defined(__GNUC__) || defined(__clang__)) &&         \
+    !defined(OS_EMSCRIPTEN)
+#define USE_THREADED_DISPATCH 1
+#endif
+
+#if REPORT_BYTECODES
+#define COUNT_BYTECODE(bytecode) execution_counter_.CountBytecode(bytecode)
+#else
+#define COUNT_BYTECODE(bytecode)
+#endif
+
+#if defined(USE_THREADED_DISPATCH)
+#define BYTECODE(n) case n: bc##n
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    ASSERT(ip_ != 0);                                                          \
+    ASSERT(sp_ != 0);                                                          \
+    ASSERT(fp_ != 0);                                                          \
+    byte1 = *ip_++;                                                            \
+    COUNT_BYTECODE(byte1);                                                     \
+    goto *kDispatchTable[byte1];                                               \
+  } while (false)
+#else
+#define BYTECODE(n) case n
+#define DISPATCH() break
+#endif
 
 void Interpreter::Interpret() {
   uintptr_t extA = 0;
   uintptr_t extB = 0;
+  bool homeless = false;
+#if defined(USE_THREADED_DISPATCH)
+  static const void* const kDispatchTable[256] = {
+    &&bc0, &&bc1, &&bc2, &&bc3, &&bc4, &&bc5, &&bc6, &&bc7,
+    &&bc8, &&bc9, &&bc10, &&bc11, &&bc12, &&bc13, &&bc14, &&bc15,
+    &&bc16, &&bc17, &&bc18, &&bc19, &&bc20, &&bc21, &&bc22, &&bc23,
+    &&bc24, &&bc25, &&bc26, &&bc27, &&bc28, &&bc29, &&bc30, &&bc31,
+    &&bc32, &&bc33, &&bc34, &&bc35, &&bc36, &&bc37, &&bc38, &&bc39,
+    &&bc40, &&bc41, &&bc42, &&bc43, &&bc44, &&bc45, &&bc46, &&bc47,
+    &&bc48, &&bc49, &&bc50, &&bc51, &&bc52, &&bc53, &&bc54, &&bc55,
+    &&bc56, &&bc57, &&bc58, &&bc59, &&bc60, &&bc61, &&bc62, &&bc63,
+    &&bc64, &&bc65, &&bc66, &&bc67, &&bc68, &&bc69, &&bc70, &&bc71,
+    &&bc72, &&bc73, &&bc74, &&bc75, &&bc76, &&bc77, &&bc78, &&bc79,
+    &&bc80, &&bc81, &&bc82, &&bc83, &&bc84, &&bc85, &&bc86, &&bc87,
+    &&bc88, &&bc89, &&bc90, &&bc91, &&bc92, &&bc93, &&bc94, &&bc95,
+    &&bc96, &&bc97, &&bc98, &&bc99, &&bc100, &&bc101, &&bc102, &&bc103,
+    &&bc104, &&bc105, &&bc106, &&bc107, &&bc108, &&bc109, &&bc110, &&bc111,
+    &&bc112, &&bc113, &&bc114, &&bc115, &&bc116, &&bc117, &&bc118, &&bc119,
+    &&bc120, &&bc121, &&bc122, &&bc123, &&bc124, &&bc125, &&bc126, &&bc127,
+    &&bc128, &&bc129, &&bc130, &&bc131, &&bc132, &&bc133, &&bc134, &&bc135,
+    &&bc136, &&bc137, &&bc138, &&bc139, &&bc140, &&bc141, &&bc142, &&bc143,
+    &&bc144, &&bc145, &&bc146, &&bc147, &&bc148, &&bc149, &&bc150, &&bc151,
+    &&bc152, &&bc153, &&bc154, &&bc155, &&bc156, &&bc157, &&bc158, &&bc159,
+    &&bc160, &&bc161, &&bc162, &&bc163, &&bc164, &&bc165, &&bc166, &&bc167,
+    &&bc168, &&bc169, &&bc170, &&bc171, &&bc172, &&bc173, &&bc174, &&bc175,
+    &&bc176, &&bc177, &&bc178, &&bc179, &&bc180, &&bc181, &&bc182, &&bc183,
+    &&bc184, &&bc185, &&bc186, &&bc187, &&bc188, &&bc189, &&bc190, &&bc191,
+    &&bc192, &&bc193, &&bc194, &&bc195, &&bc196, &&bc197, &&bc198, &&bc199,
+    &&bc200, &&bc201, &&bc202, &&bc203, &&bc204, &&bc205, &&bc206, &&bc207,
+    &&bc208, &&bc209, &&bc210, &&bc211, &&bc212, &&bc213, &&bc214, &&bc215,
+    &&bc216, &&bc217, &&bc218, &&bc219, &&bc220, &&bc221, &&bc222, &&bc223,
+    &&bc224, &&bc225, &&bc226, &&bc227, &&bc228, &&bc229, &&bc230, &&bc231,
+    &&bc232, &&bc233, &&bc234, &&bc235, &&bc236, &&bc237, &&bc238, &&bc239,
+    &&bc240, &&bc241, &&bc242, &&bc243, &&bc244, &&bc245, &&bc246, &&bc247,
+    &&bc248, &&bc249, &&bc250, &&bc251, &&bc252, &&bc253, &&bc254, &&bc255,
+  };
+#endif
   for (;;) {
     ASSERT(ip_ != 0);
     ASSERT(sp_ != 0);
     ASSERT(fp_ != 0);
 
     uint8_t byte1 = *ip_++;
+    COUNT_BYTECODE(byte1);
     switch (byte1) {
-    case 0: case 1: case 2: case 3: case 4: case 5: case 6: case 7:
-    case 8: case 9: case 10: case 11: case 12: case 13: case 14: case 15:
-      FATAL("Unused bytecode");  // V4: push receiver variable
-      break;
-    case 16: case 17: case 18: case 19: case 20: case 21: case 22: case 23:
-    case 24: case 25: case 26: case 27: case 28: case 29: case 30: case 31:
+    // V4: push receiver variable. Reused for superinstructions, each of which
+    // takes the place of the first instruction of the sequence it executes, so
+    // the rest of the sequence remains to be stepped through by the debugger.
+    BYTECODE(0): BYTECODE(1): BYTECODE(2): BYTECODE(3):
+    BYTECODE(4): BYTECODE(5): BYTECODE(6): BYTECODE(7): {
+      // Push temporary, then the quick literal or integer that follows. The
+      // next instruction is usually the send that consumes both.
+      PushTemporary(byte1);
+      uint8_t byte2 = *ip_++;
+      if (byte2 < 64) {
+        PushLiteral(byte2 - 32);
+      } else if (byte2 < 229) {
+        Push(SmallInteger::New(byte2 - 78));
+      } else {
+        ASSERT(byte2 == 229);
+        uint8_t byte3 = *ip_++;
+        Push(SmallInteger::New(byte3));
+      }
+      DISPATCH();
+    }
+    BYTECODE(8): BYTECODE(9): BYTECODE(10): BYTECODE(11): {
+      // Pop into temporary, then the jump that follows: 8+i 225 hi 242 lo.
+      PopIntoTemporary(byte1 & 3);
+      intptr_t delta = static_cast<int8_t>(ip_[1]) * 256 + ip_[3];
+      ip_ += 4 + delta;
+      if (delta < 0) {
+        Poll();
+      }
+      DISPATCH();
+    }
+    BYTECODE(12): {
+      // Extend B and jump: 12 hi 242 lo.
+      intptr_t delta = static_cast<int8_t>(ip_[0]) * 256 + ip_[2];
+      ip_ += 3 + delta;
+      if (delta < 0) {
+        Poll();
+      }
+      DISPATCH();
+    }
+    BYTECODE(13): {
+      // Extend B and branch true: 13 hi 243 lo.
+      intptr_t delta = (ip_[0] << 8) + ip_[2];
+      ip_ += 3;
+      Object top = Pop();
+      if (top == false_) {
+      } else if (top == true_) {
+        ip_ += delta;
+      } else {
+        SendNonBooleanReceiver(top);
+      }
+      DISPATCH();
+    }
+    BYTECODE(14): {
+      // Extend B and branch false: 14 hi 244 lo.
+      intptr_t delta = (ip_[0] << 8) + ip_[2];
+      ip_ += 3;
+      Object top = Pop();
+      if (top == true_) {
+      } else if (top == false_) {
+        ip_ += delta;
+      } else {
+        SendNonBooleanReceiver(top);
+      }
+      DISPATCH();
+    }
+    BYTECODE(15):
+      // Prefixes a push closure that does not need its defining activation.
+      homeless = true;
+      DISPATCH();
+    BYTECODE(16): BYTECODE(17): BYTECODE(18): BYTECODE(19):
+    BYTECODE(20): BYTECODE(21): BYTECODE(22): BYTECODE(23):
+    BYTECODE(24): BYTECODE(25): BYTECODE(26): BYTECODE(27):
+    BYTECODE(28): BYTECODE(29): BYTECODE(30): BYTECODE(31):
       PushLiteralVariable(byte1 - 16);
-      break;
-    case 32: case 33: case 34: case 35: case 36: case 37: case 38: case 39:
-    case 40: case 41: case 42: case 43: case 44: case 45: case 46: case 47:
-    case 48: case 49: case 50: case 51: case 52: case 53: case 54: case 55:
-    case 56: case 57: case 58: case 59: case 60: case 61: case 62: case 63:
+      DISPATCH();
+    BYTECODE(32): BYTECODE(33): BYTECODE(34): BYTECODE(35):
+    BYTECODE(36): BYTECODE(37): BYTECODE(38): BYTECODE(39):
+    BYTECODE(40): BYTECODE(41): BYTECODE(42): BYTECODE(43):
+    BYTECODE(44): BYTECODE(45): BYTECODE(46): BYTECODE(47):
+    BYTECODE(48): BYTECODE(49): BYTECODE(50): BYTECODE(51):
+    BYTECODE(52): BYTECODE(53): BYTECODE(54): BYTECODE(55):
+    BYTECODE(56): BYTECODE(57): BYTECODE(58): BYTECODE(59):
+    BYTECODE(60): BYTECODE(61): BYTECODE(62): BYTECODE(63):
       PushLiteral(byte1 - 32);
-      break;
-    case 64: case 65: case 66: case 67: case 68: case 69: case 70: case 71:
-    case 72: case 73: case 74: case 75:
+      DISPATCH();
+    BYTECODE(64): BYTECODE(65): BYTECODE(66): BYTECODE(67):
+    BYTECODE(68): BYTECODE(69): BYTECODE(70): BYTECODE(71):
+    BYTECODE(72): BYTECODE(73): BYTECODE(74): BYTECODE(75):
       PushTemporary(byte1 - 64);
-      break;
-    case 76:
+      DISPATCH();
+    BYTECODE(76):
       Push(FrameReceiver(fp_));
-      break;
-    case 77:
+      DISPATCH();
+    BYTECODE(77):
       switch (extB) {
         case 0:
           Push(false_);
@@ -1194,47 +1972,48 @@ void Interpreter::Interpret() {
           break;
       }
       extB = 0;
-      break;
-    case 78:
+      DISPATCH();
+    BYTECODE(78):
       Push(SmallInteger::New(0));
-      break;
-    case 79:
+      DISPATCH();
+    BYTECODE(79):
       Push(SmallInteger::New(1));
-      break;
+      DISPATCH();
 #if STATIC_PREDICTION_BYTECODES
-    case 80: {
+    // The SmallInteger tag is 0, so arithmetic on tagged values gives the
+    // tagged result, and it overflows exactly when the result is not a
+    // SmallInteger.
+    BYTECODE(80): {
       // +
       Object left = Stack(1);
       Object right = Stack(0);
-      if (left->IsSmallInteger() && right->IsSmallInteger()) {
-        intptr_t raw_left = static_cast<SmallInteger>(left)->value();
-        intptr_t raw_right = static_cast<SmallInteger>(right)->value();
-        intptr_t raw_result = raw_left + raw_right;
-        if (SmallInteger::IsSmiValue(raw_result)) {
-          PopNAndPush(2, SmallInteger::New(raw_result));
-          break;
-        }
+      intptr_t tagged_result;
+      if (left->IsSmallInteger() && right->IsSmallInteger() &&
+          !Math::AddHasOverflow(static_cast<intptr_t>(left),
+                                static_cast<intptr_t>(right),
+                                &tagged_result)) {
+        PopNAndPush(2, static_cast<SmallInteger>(tagged_result));
+        DISPATCH();
       }
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 81: {
+    BYTECODE(81): {
       // -
       Object left = Stack(1);
       Object right = Stack(0);
-      if (left->IsSmallInteger() && right->IsSmallInteger()) {
-        intptr_t raw_left = static_cast<SmallInteger>(left)->value();
-        intptr_t raw_right = static_cast<SmallInteger>(right)->value();
-        intptr_t raw_result = raw_left - raw_right;
-        if (SmallInteger::IsSmiValue(raw_result)) {
-          PopNAndPush(2, SmallInteger::New(raw_result));
-          break;
-        }
+      intptr_t tagged_result;
+      if (left->IsSmallInteger() && right->IsSmallInteger() &&
+          !Math::SubtractHasOverflow(static_cast<intptr_t>(left),
+                                     static_cast<intptr_t>(right),
+                                     &tagged_result)) {
+        PopNAndPush(2, static_cast<SmallInteger>(tagged_result));
+        DISPATCH();
       }
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 82: {
+    BYTECODE(82): {
       // <
       Object left = Stack(1);
       Object right = Stack(0);
@@ -1245,12 +2024,12 @@ void Interpreter::Interpret() {
         } else {
           PopNAndPush(2, false_);
         }
-        break;
+        DISPATCH();
       }
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 83: {
+    BYTECODE(83): {
       // >
       Object left = Stack(1);
       Object right = Stack(0);
@@ -1261,12 +2040,12 @@ void Interpreter::Interpret() {
         } else {
           PopNAndPush(2, false_);
         }
-        break;
+        DISPATCH();
       }
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 84: {
+    BYTECODE(84): {
       // <=
       Object left = Stack(1);
       Object right = Stack(0);
@@ -1277,12 +2056,12 @@ void Interpreter::Interpret() {
         } else {
           PopNAndPush(2, false_);
         }
-        break;
+        DISPATCH();
       }
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 85: {
+    BYTECODE(85): {
       // >=
       Object left = Stack(1);
       Object right = Stack(0);
@@ -1293,12 +2072,12 @@ void Interpreter::Interpret() {
         } else {
           PopNAndPush(2, false_);
         }
-        break;
+        DISPATCH();
       }
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 86: {
+    BYTECODE(86): {
       // =
       Object left = Stack(1);
       Object right = Stack(0);
@@ -1309,27 +2088,48 @@ void Interpreter::Interpret() {
         } else {
           PopNAndPush(2, false_);
         }
-        break;
+        DISPATCH();
       }
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 87: {
+    BYTECODE(87): {
       // ~=
+      Object left = Stack(1);
+      Object right = Stack(0);
+      if (left->IsSmallInteger() && right->IsSmallInteger()) {
+        if (static_cast<intptr_t>(left) !=
+            static_cast<intptr_t>(right)) {
+          PopNAndPush(2, true_);
+        } else {
+          PopNAndPush(2, false_);
+        }
+        DISPATCH();
+      }
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 88: {
+    BYTECODE(88): {
       // *
+      Object left = Stack(1);
+      Object right = Stack(0);
+      intptr_t tagged_result;
+      if (left->IsSmallInteger() && right->IsSmallInteger() &&
+          !Math::MultiplyHasOverflow(static_cast<SmallInteger>(left)->value(),
+                                     static_cast<intptr_t>(right),
+                                     &tagged_result)) {
+        PopNAndPush(2, static_cast<SmallInteger>(tagged_result));
+        DISPATCH();
+      }
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 89: {
+    BYTECODE(89): {
       // /
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 90: {
+    BYTECODE(90): {
       /* \\ */
       Object left = Stack(1);
       Object right = Stack(0);
@@ -1340,28 +2140,41 @@ void Interpreter::Interpret() {
           intptr_t raw_result = Math::FloorMod(raw_left, raw_right);
           ASSERT(SmallInteger::IsSmiValue(raw_result));
           PopNAndPush(2, SmallInteger::New(raw_result));
-          break;
+          DISPATCH();
         }
       }
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 91: {
+    BYTECODE(91): {
       // @
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 92: {
+    BYTECODE(92): {
       // bitShift:
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 93: {
+    BYTECODE(93): {
       // //
+      Object left = Stack(1);
+      Object right = Stack(0);
+      if (left->IsSmallInteger() && right->IsSmallInteger()) {
+        intptr_t raw_left = static_cast<SmallInteger>(left)->value();
+        intptr_t raw_right = static_cast<SmallInteger>(right)->value();
+        if (raw_right != 0) {
+          intptr_t raw_result = Math::FloorDiv(raw_left, raw_right);
+          if (SmallInteger::IsSmiValue(raw_result)) {
+            PopNAndPush(2, SmallInteger::New(raw_result));
+            DISPATCH();
+          }
+        }
+      }
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 94: {
+    BYTECODE(94): {
       // bitAnd:
       Object left = Stack(1);
       Object right = Stack(0);
@@ -1370,12 +2183,12 @@ void Interpreter::Interpret() {
         intptr_t raw_right = static_cast<SmallInteger>(right)->value();
         intptr_t raw_result = raw_left & raw_right;
         PopNAndPush(2, SmallInteger::New(raw_result));
-        break;
+        DISPATCH();
       }
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 95: {
+    BYTECODE(95): {
       // bitOr:
       Object left = Stack(1);
       Object right = Stack(0);
@@ -1384,12 +2197,12 @@ void Interpreter::Interpret() {
         intptr_t raw_right = static_cast<SmallInteger>(right)->value();
         intptr_t raw_result = raw_left | raw_right;
         PopNAndPush(2, SmallInteger::New(raw_result));
-        break;
+        DISPATCH();
       }
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 96: {
+    BYTECODE(96): {
       // at:
       Object array = Stack(1);
       SmallInteger index = static_cast<SmallInteger>(Stack(0));
@@ -1400,21 +2213,21 @@ void Interpreter::Interpret() {
               (raw_index < static_cast<Array>(array)->Size())) {
             Object value = static_cast<Array>(array)->element(raw_index);
             PopNAndPush(2, value);
-            break;
+            DISPATCH();
           }
         } else if (array->IsBytes()) {
           if ((raw_index >= 0) &&
               (raw_index < static_cast<Bytes>(array)->Size())) {
             uint8_t raw_value = static_cast<Bytes>(array)->element(raw_index);
             PopNAndPush(2, SmallInteger::New(raw_value));
-            break;
+            DISPATCH();
           }
         }
       }
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 97: {
+    BYTECODE(97): {
       // at:put:
       Object array = Stack(2);
       SmallInteger index = static_cast<SmallInteger>(Stack(1));
@@ -1426,7 +2239,7 @@ void Interpreter::Interpret() {
             Object value = Stack(0);
             static_cast<Array>(array)->set_element(raw_index, value);
             PopNAndPush(3, value);
-            break;
+            DISPATCH();
           }
         } else if (array->IsByteArray()) {
           SmallInteger value = static_cast<SmallInteger>(Stack(0));
@@ -1436,208 +2249,215 @@ void Interpreter::Interpret() {
             static_cast<ByteArray>(array)->set_element(raw_index,
                                                         value->value());
             PopNAndPush(3, value);
-            break;
+            DISPATCH();
           }
         }
       }
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 98: {
+    BYTECODE(98): {
       // size
       Object array = Stack(0);
       if (array->IsArray()) {
         PopNAndPush(1, static_cast<Array>(array)->size());
-        break;
+        DISPATCH();
       } else if (array->IsBytes()) {
         PopNAndPush(1, static_cast<Bytes>(array)->size());
-        break;
+        DISPATCH();
       }
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
     }
-    case 99: case 100: case 101: case 102: case 103:
-    case 104: case 105: case 106: case 107:
-    case 108: case 109: case 110: case 111:
+    BYTECODE(99): BYTECODE(100): BYTECODE(101): BYTECODE(102):
+    BYTECODE(103): BYTECODE(104): BYTECODE(105): BYTECODE(106):
+    BYTECODE(107): BYTECODE(108): BYTECODE(109): BYTECODE(110):
+    BYTECODE(111):
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
 #else  // !STATIC_PREDICTION_BYTECODES
-    case 80: case 81: case 82: case 83:
-    case 84: case 85: case 86: case 87:
-    case 88: case 89: case 90: case 91:
-    case 92: case 93: case 94: case 95:
+    BYTECODE(80): BYTECODE(81): BYTECODE(82): BYTECODE(83):
+    BYTECODE(84): BYTECODE(85): BYTECODE(86): BYTECODE(87):
+    BYTECODE(88): BYTECODE(89): BYTECODE(90): BYTECODE(91):
+    BYTECODE(92): BYTECODE(93): BYTECODE(94): BYTECODE(95):
       CommonSend(byte1 - 80);
-      break;
-    case 96: case 97: case 98: case 99:
-    case 100: case 101: case 102: case 103:
-    case 104: case 105: case 106: case 107:
-    case 108: case 109: case 110: case 111:
+      DISPATCH();
+    BYTECODE(96): BYTECODE(97): BYTECODE(98): BYTECODE(99):
+    BYTECODE(100): BYTECODE(101): BYTECODE(102): BYTECODE(103):
+    BYTECODE(104): BYTECODE(105): BYTECODE(106): BYTECODE(107):
+    BYTECODE(108): BYTECODE(109): BYTECODE(110): BYTECODE(111):
       CommonSend(byte1 - 80);
-      break;
+      DISPATCH();
 #endif  // STATIC_PREDICTION_BYTECODES
-    case 112: case 113: case 114: case 115:
-    case 116: case 117: case 118: case 119:
-    case 120: case 121: case 122: case 123:
-    case 124: case 125: case 126: case 127:
+    BYTECODE(112): BYTECODE(113): BYTECODE(114): BYTECODE(115):
+    BYTECODE(116): BYTECODE(117): BYTECODE(118): BYTECODE(119):
+    BYTECODE(120): BYTECODE(121): BYTECODE(122): BYTECODE(123):
+    BYTECODE(124): BYTECODE(125): BYTECODE(126): BYTECODE(127):
       OrdinarySend(byte1 & 15, 0);
-      break;
-    case 128: case 129: case 130: case 131:
-    case 132: case 133: case 134: case 135:
-    case 136: case 137: case 138: case 139:
-    case 140: case 141: case 142: case 143:
+      DISPATCH();
+    BYTECODE(128): BYTECODE(129): BYTECODE(130): BYTECODE(131):
+    BYTECODE(132): BYTECODE(133): BYTECODE(134): BYTECODE(135):
+    BYTECODE(136): BYTECODE(137): BYTECODE(138): BYTECODE(139):
+    BYTECODE(140): BYTECODE(141): BYTECODE(142): BYTECODE(143):
       OrdinarySend(byte1 & 15, 1);
-      break;
-    case 144: case 145: case 146: case 147:
-    case 148: case 149: case 150: case 151:
-    case 152: case 153: case 154: case 155:
-    case 156: case 157: case 158: case 159:
+      DISPATCH();
+    BYTECODE(144): BYTECODE(145): BYTECODE(146): BYTECODE(147):
+    BYTECODE(148): BYTECODE(149): BYTECODE(150): BYTECODE(151):
+    BYTECODE(152): BYTECODE(153): BYTECODE(154): BYTECODE(155):
+    BYTECODE(156): BYTECODE(157): BYTECODE(158): BYTECODE(159):
       OrdinarySend(byte1 & 15, 2);
-      break;
-    case 160: case 161: case 162: case 163:
-    case 164: case 165: case 166: case 167:
-    case 168: case 169: case 170: case 171:
-    case 172: case 173: case 174: case 175:
+      DISPATCH();
+    BYTECODE(160): BYTECODE(161): BYTECODE(162): BYTECODE(163):
+    BYTECODE(164): BYTECODE(165): BYTECODE(166): BYTECODE(167):
+    BYTECODE(168): BYTECODE(169): BYTECODE(170): BYTECODE(171):
+    BYTECODE(172): BYTECODE(173): BYTECODE(174): BYTECODE(175):
       ImplicitReceiverSend(byte1 & 15, 0);
-      break;
-    case 176: case 177: case 178: case 179:
-    case 180: case 181: case 182: case 183:
+      DISPATCH();
+    BYTECODE(176): BYTECODE(177): BYTECODE(178): BYTECODE(179):
+    BYTECODE(180): BYTECODE(181): BYTECODE(182): BYTECODE(183):
       FATAL("Unused bytecode");  // V4: pop into receiver variable
-      break;
-    case 184: case 185: case 186: case 187:
-    case 188: case 189: case 190: case 191:
+      DISPATCH();
+    BYTECODE(184): BYTECODE(185): BYTECODE(186): BYTECODE(187):
+    BYTECODE(188): BYTECODE(189): BYTECODE(190): BYTECODE(191):
       PopIntoTemporary(byte1 & 7);
-      break;
-    case 192: case 193: case 194: case 195:  // V4: short jump
-    case 196: case 197: case 198: case 199:  // V4: short jump
-    case 200: case 201: case 202: case 203:  // V4: short branch true
-    case 204: case 205: case 206: case 207:  // V4: short branch true
-    case 208: case 209: case 210: case 211:  // V4: short branch false
-    case 212: case 213: case 214: case 215:  // V4: short branch false
+      DISPATCH();
+    // V4: short jump
+    BYTECODE(192): BYTECODE(193): BYTECODE(194): BYTECODE(195):
+    BYTECODE(196): BYTECODE(197): BYTECODE(198): BYTECODE(199):
+    // V4: short branch true
+    BYTECODE(200): BYTECODE(201): BYTECODE(202): BYTECODE(203):
+    BYTECODE(204): BYTECODE(205): BYTECODE(206): BYTECODE(207):
+    // V4: short branch false
+    BYTECODE(208): BYTECODE(209): BYTECODE(210): BYTECODE(211):
+    BYTECODE(212): BYTECODE(213): BYTECODE(214): BYTECODE(215):
       FATAL("Unused bytecode");
-      break;
-    case 216:
+      DISPATCH();
+    BYTECODE(216):
       MethodReturn(FrameReceiver(fp_));
-      break;
-    case 217:
+      DISPATCH();
+    BYTECODE(217):
       MethodReturn(Pop());
-      break;
-    case 218:
+      DISPATCH();
+    BYTECODE(218):
       ASSERT(FlagsIsClosure(FrameFlags(fp_)));
       LocalReturn(Pop());
-      break;
-    case 219:
+      DISPATCH();
+    BYTECODE(219):
       Push(Stack(0));
-      break;
-    case 220:
+      DISPATCH();
+    BYTECODE(220):
       Drop(1);
-      break;
-    case 221:  // V4: nop
-    case 222:  // V4: break
-    case 223:  // V4: not assigned
+      DISPATCH();
+    BYTECODE(221):  // V4: nop
+    BYTECODE(222):  // V4: break
+    BYTECODE(223):  // V4: not assigned
       FATAL("Unused bytecode");
-      break;
-    case 224: {
+      DISPATCH();
+    BYTECODE(224): {
       uint8_t byte2 = *ip_++;
       extA = (extA << 8) + byte2;
-      break;
+      DISPATCH();
     }
-    case 225: {
+    BYTECODE(225): {
       uint8_t byte2 = *ip_++;
       if (extB == 0 && byte2 > 127) {
         extB = byte2 - 256;
       } else {
         extB = (extB << 8) + byte2;
       }
-      break;
+      DISPATCH();
     }
-    case 226:
+    BYTECODE(226):
       FATAL("Unused bytecode");  // V4: push receiver variable
-      break;
-    case 227: {
+      DISPATCH();
+    BYTECODE(227): {
       uint8_t byte2 = *ip_++;
       PushLiteralVariable((extA << 8) + byte2);
       extA = 0;
-      break;
+      DISPATCH();
     }
-    case 228: {
+    BYTECODE(228): {
       uint8_t byte2 = *ip_++;
       PushLiteral(byte2 + extA * 256);
       extA = 0;
-      break;
+      DISPATCH();
     }
-    case 229: {
+    BYTECODE(229): {
       uint8_t byte2 = *ip_++;
       Push(SmallInteger::New((extB << 8) + byte2));
       extB = 0;
-      break;
+      DISPATCH();
     }
-    case 230: {
+    BYTECODE(230): {
       uint8_t byte2 = *ip_++;
       PushTemporary(byte2);
-      break;
+      DISPATCH();
     }
-    case 231: {
+    BYTECODE(231): {
       uint8_t byte2 = *ip_++;
       if (byte2 < 128) {
         PushNewArray(byte2);
       } else {
         PushNewArrayWithElements(byte2 - 128);
       }
-      break;
+      DISPATCH();
     }
-    case 232:  // V4: store into receiver variable
-    case 233:  // V4: store into literal variable
+    BYTECODE(232):  // V4: store into receiver variable
+    BYTECODE(233):  // V4: store into literal variable
       FATAL("Unused bytecode");
-      break;
-    case 234: {
+      DISPATCH();
+    BYTECODE(234): {
       uint8_t byte2 = *ip_++;
       StoreIntoTemporary(byte2);
-      break;
+      DISPATCH();
     }
-    case 235:  // V4: pop into receiver variable
-    case 236:  // V4: pop into literal variable
+    BYTECODE(235):  // V4: pop into receiver variable
+    BYTECODE(236):  // V4: pop into literal variable
       FATAL("Unused bytecode");
-      break;
-    case 237: {
+      DISPATCH();
+    BYTECODE(237): {
       uint8_t byte2 = *ip_++;
       PopIntoTemporary(byte2);
-      break;
+      DISPATCH();
     }
-    case 238: {
+    BYTECODE(238): {
       uint8_t byte2 = *ip_++;
       intptr_t selector_index = (extA << 5) + (byte2 >> 3);
       intptr_t num_args = (extB << 3) | (byte2 & 7);
       extA = extB = 0;
       OrdinarySend(selector_index, num_args);
-      break;
+      DISPATCH();
     }
-    case 239:
+    BYTECODE(239):
       FATAL("Unused bytecode");  // V4: static super send
-      break;
-    case 240: {
+      DISPATCH();
+    BYTECODE(240): {
       uint8_t byte2 = *ip_++;
       intptr_t selector_index = (extA << 5) + (byte2 >> 3);
       intptr_t num_args = (extB << 3) | (byte2 & 7);
       extA = extB = 0;
       ImplicitReceiverSend(selector_index, num_args);
-      break;
+      DISPATCH();
     }
-    case 241: {
+    BYTECODE(241): {
       uint8_t byte2 = *ip_++;
       intptr_t selector_index = (extA << 5) + (byte2 >> 3);
       intptr_t num_args = (extB << 3) | (byte2 & 7);
       extA = extB = 0;
       SuperSend(selector_index, num_args);
-      break;
+      DISPATCH();
     }
-    case 242: {
+    BYTECODE(242): {
       uint8_t byte2 = *ip_++;
       intptr_t delta = (extB << 8) + byte2;
       extB = 0;
       ip_ += delta;
-      break;
+      if (delta < 0) {
+        Poll();
+      }
+      DISPATCH();
     }
-    case 243: {
+    BYTECODE(243): {
       uint8_t byte2 = *ip_++;
       intptr_t delta = (extB << 8) + byte2;
       extB = 0;
@@ -1648,9 +2468,9 @@ void Interpreter::Interpret() {
       } else {
         SendNonBooleanReceiver(top);
       }
-      break;
+      DISPATCH();
     }
-    case 244: {
+    BYTECODE(244): {
       uint8_t byte2 = *ip_++;
       intptr_t delta = (extB << 8) + byte2;
       extB = 0;
@@ -1661,50 +2481,51 @@ void Interpreter::Interpret() {
       } else {
         SendNonBooleanReceiver(top);
       }
-      break;
+      DISPATCH();
     }
-    case 245: {
+    BYTECODE(245): {
       uint8_t byte2 = *ip_++;
       intptr_t selector_index = (extA << 5) + (byte2 >> 3);
       intptr_t num_args = (extB << 3) | (byte2 & 7);
       extA = extB = 0;
       SelfSend(selector_index, num_args);
-      break;
+      DISPATCH();
     }
-    case 246:  // V4: unassigned
-    case 247:  // V4: unassigned
-    case 248:  // V4: unassigned
-    case 249:  // V4: call primitive
+    BYTECODE(246):  // V4: unassigned
+    BYTECODE(247):  // V4: unassigned
+    BYTECODE(248):  // V4: unassigned
+    BYTECODE(249):  // V4: call primitive
       FATAL("Unused bytecode");
-    case 250: {
+    BYTECODE(250): {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       PushRemoteTemp(byte3, byte2);
-      break;
+      DISPATCH();
     }
-    case 251: {
+    BYTECODE(251): {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       StoreIntoRemoteTemp(byte3, byte2);
-      break;
+      DISPATCH();
     }
-    case 252: {
+    BYTECODE(252): {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       PopIntoRemoteTemp(byte3, byte2);
-      break;
+      DISPATCH();
     }
-    case 253: {
+    BYTECODE(253): {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       intptr_t num_copied = (byte2 >> 3 & 7) + ((extA / 16) << 3);
       intptr_t num_args = (byte2 & 7) + ((extA % 16) << 3);
       intptr_t block_size = byte3 + (extB << 8);
       extA = extB = 0;
-      PushClosure(num_copied, num_args, block_size);
-      break;
+      PushClosure(num_copied, num_args, block_size, !homeless);
+      homeless = false;
+      DISPATCH();
     }
-    case 254: {
+    BYTECODE(254): {
       uint8_t byte2 = *ip_++;
       uint8_t byte3 = *ip_++;
       intptr_t selector_index = (extA << 5) + (byte2 >> 3);
@@ -1712,11 +2533,11 @@ void Interpreter::Interpret() {
       intptr_t depth = byte3;
       extA = extB = 0;
       OuterSend(selector_index, num_args, depth);
-      break;
+      DISPATCH();
     }
-    case 255:
+    BYTECODE(255):
       FATAL("Unused bytecode");  // V4: unassigned
-      break;
+      DISPATCH();
     default:
       UNREACHABLE();
     }
@@ -1727,7 +2548,7 @@ void Interpreter::Interpret() {
 Activation Interpreter::EnsureActivation(Object* fp) {
   Activation activation = FrameActivation(fp);
   if (activation == nullptr) {
-    activation = H->AllocateActivation();  // SAFEPOINT
+    activation = NewActivation();  // SAFEPOINT
     activation->set_sender_fp(fp);
     activation->set_bci(static_cast<SmallInteger>(nil));
     activation->set_method(FrameMethod(fp));
@@ -1746,22 +2567,137 @@ Activation Interpreter::EnsureActivation(Object* fp) {
     activation->set_stack_depth(SmallInteger::New(0));
 
     FrameActivationPut(fp, activation);
+#if REPORT_ACTIVATIONS
+    RecordMaterialization(FrameMethod(fp));
+#endif
+  }
+  return activation;
+}
+
+
+Activation Interpreter::EnsurePrivateActivation(Object* fp) {
+  Activation activation = FrameActivation(fp);
+  if (activation == nullptr) {
+    activation = EnsureActivation(fp);  // SAFEPOINT
+    activation->set_is_private(true);
   }
   return activation;
 }
 
 
+Activation Interpreter::NewActivation() {
+  while (num_free_activations_ > 0) {
+    Activation activation = free_activations_[--num_free_activations_];
+    if (activation->is_private()) {  // Not found by allInstances since.
+      activation->set_is_private(false);
+      return activation;
+    }
+  }
+  return H->AllocateActivation();  // SAFEPOINT
+}
+
+
+void Interpreter::RecycleActivation(Activation activation) {
+  // Only a private activation is known to be unreferenced once its frame has
+  // returned: its callee was zapped or returned, and nothing else could have
+  // taken it.
+  if (activation->is_private() &&
+      activation->IsNewObject() &&
+      (num_free_activations_ < kMaxFreeActivations)) {
+    free_activations_[num_free_activations_++] = activation;
+  }
+}
+
+
+#if REPORT_BYTECODES
+void Interpreter::CountSend(Object receiver) {
+  Method method = FrameMethod(fp_);
+  intptr_t cid = receiver->ClassId();
+  execution_counter_.CountSend(method, method->BCI(ip_)->value(), cid,
+                               H->ClassAt(cid));
+}
+#endif  // REPORT_BYTECODES
+
+
+#if REPORT_ACTIVATIONS
+void Interpreter::RecordMaterialization(Method method) {
+  total_materializations_++;
+  intptr_t hash = static_cast<intptr_t>(method) >> kObjectAlignmentLog2;
+  for (intptr_t probe = 0; probe < kMaterializationSlots; probe++) {
+    MaterializationCount* entry =
+        &materializations_[(hash + probe) & (kMaterializationSlots - 1)];
+    if (entry->method == method) {
+      entry->count++;
+      return;
+    }
+    if (entry->method == nullptr) {
+      entry->method = method;
+      entry->count = 1;
+      return;
+    }
+  }
+  // Table full: only counted in the total.
+}
+
+
+void Interpreter::ReportMaterializations() {
+  if (total_materializations_ == 0) {
+    return;
+  }
+  OS::PrintErr("Materialized %" Pd " activations\n", total_materializations_);
+  const intptr_t kTop = 10;
+  for (intptr_t n = 0; n < kTop; n++) {
+    MaterializationCount* max = nullptr;
+    for (intptr_t i = 0; i < kMaterializationSlots; i++) {
+      MaterializationCount* entry = &materializations_[i];
+      if ((entry->count != 0) && ((max == nullptr) ||
+                                  (entry->count > max->count))) {
+        max = entry;
+      }
+    }
+    if (max == nullptr) {
+      break;
+    }
+    String mixin = max->method->mixin()->name();
+    const char* side = "";
+    if (!mixin->IsString()) {
+      mixin = static_cast<AbstractMixin>(mixin)->name();
+      side = " class";
+    }
+    String selector = max->method->selector();
+    OS::PrintErr("  %8" Pd " %.*s%s %.*s\n", max->count,
+                 static_cast<int>(mixin->Size()),
+                 reinterpret_cast<const char*>(mixin->element_addr(0)), side,
+                 static_cast<int>(selector->Size()),
+                 reinterpret_cast<const char*>(selector->element_addr(0)));
+    max->count = 0;
+  }
+  for (intptr_t i = 0; i < kMaterializationSlots; i++) {
+    materializations_[i].method = nullptr;
+    materializations_[i].count = 0;
+  }
+  total_materializations_ = 0;
+}
+#endif  // REPORT_ACTIVATIONS
+
+
 Activation Interpreter::FlushAllFrames() {
-  Activation top = EnsureActivation(fp_);  // SAFEPOINT
+  Activation top = EnsurePrivateActivation(fp_);  // SAFEPOINT
   HandleScope h1(H, reinterpret_cast<Object*>(&top));
 
-  while (fp_ != 0) {
-    EnsureActivation(fp_);  // SAFEPOINT
+  for (;;) {
+    if (fp_ == 0) {
+      if (segment_->previous == nullptr) {
+        break;
+      }
+      ShrinkStack();
+    }
+    EnsurePrivateActivation(fp_);  // SAFEPOINT
 
     Object* saved_fp = FrameSavedFP(fp_);
     Activation sender;
     if (saved_fp != 0) {
-      sender = EnsureActivation(saved_fp);  // SAFEPOINT
+      sender = EnsurePrivateActivation(saved_fp);  // SAFEPOINT
     } else {
       sender = FrameBaseSender(fp_);
       ASSERT((sender == nil) || sender->IsActivation());
@@ -1787,8 +2723,9 @@ Activation Interpreter::FlushAllFrames() {
   ip_ = 0;  // Was base sender.
   ASSERT(sp_ == stack_base_);
   ASSERT(fp_ == 0);
+  ASSERT(num_segments_ == 1);
 #if defined(DEBUG)
-  for (intptr_t i = 0; i < kStackSlots; i++) {
+  for (intptr_t i = 0; i < stack_slots_; i++) {
     stack_limit_[i] = static_cast<Object>(kUninitializedWord);
   }
 #endif
@@ -1804,6 +2741,7 @@ bool Interpreter::HasLivingFrame(Activation activation) {
 
   Object* activation_fp = activation->sender_fp();
   Object* fp = fp_;
+  StackSegment* segment = segment_;
   while (fp != 0) {
     if (fp == activation_fp) {
       if (FrameActivation(fp) == activation) {
@@ -1812,6 +2750,10 @@ bool Interpreter::HasLivingFrame(Activation activation) {
       break;
     }
     fp = FrameSavedFP(fp);
+    if ((fp == 0) && (segment->previous != nullptr)) {
+      segment = segment->previous;
+      fp = segment->fp;
+    }
   }
 
   // Frame is gone.
@@ -1822,7 +2764,73 @@ bool Interpreter::HasLivingFrame(Activation activation) {
 
 
 Activation Interpreter::CurrentActivation() {
-  return EnsureActivation(fp_);  // SAFEPOINT
+  Activation activation = EnsureActivation(fp_);  // SAFEPOINT
+  ExposeActivation(activation);
+  return activation;
+}
+
+
+template <typename Visitor>
+void Interpreter::WalkStack(Visitor visit) {
+  const uint8_t* ip = ip_;
+  Object* fp = fp_;
+  Object* base_fp = nullptr;
+  StackSegment* segment = segment_;
+  while (fp != 0) {
+    Method method = FrameMethod(fp);
+    Closure closure = static_cast<Closure>(nil);
+    if (FlagsIsClosure(FrameFlags(fp))) {
+      closure = static_cast<Closure>(FrameTemp(fp, -1));
+    }
+    if (!visit(method, method->BCI(ip), FrameReceiver(fp), closure)) {
+      return;
+    }
+    base_fp = fp;
+    ip = FrameSavedIP(fp);
+    fp = FrameSavedFP(fp);
+    if ((fp == 0) && (segment->previous != nullptr)) {
+      // The base sender is the activation of the frame the stack grew from.
+      segment = segment->previous;
+      ip = segment->ip;
+      fp = segment->fp;
+    }
+  }
+  if (base_fp == nullptr) {
+    return;
+  }
+  Object sender = FrameBaseSender(base_fp);
+  while (sender->IsActivation()) {
+    Activation activation = static_cast<Activation>(sender);
+    if (!visit(activation->method(), activation->bci(),
+               activation->receiver(), activation->closure())) {
+      return;
+    }
+    sender = activation->sender();
+  }
+}
+
+
+Array Interpreter::StackFrames(intptr_t depth) {
+  intptr_t count = 0;
+  if (depth > 0) {
+    WalkStack([&](Method method, Object bci, Object receiver,
+                  Closure closure) {
+      return ++count < depth;
+    });
+  }
+
+  Array frames = H->AllocateArray(3 * count);  // SAFEPOINT
+  intptr_t index = 0;
+  WalkStack([&](Method method, Object bci, Object receiver, Closure closure) {
+    if (index == 3 * count) {
+      return false;
+    }
+    frames->set_element(index++, method);
+    frames->set_element(index++, bci);
+    frames->set_element(index++, receiver);
+    return true;
+  });
+  return frames;
 }
 
 
@@ -1843,11 +2851,75 @@ Object Interpreter::ActivationSender(Activation activation) {
     Object* fp = activation->sender_fp();
     Object* sender_fp = FrameSavedFP(fp);
     if (sender_fp == 0) {
-      return FrameBaseSender(fp);
+      return ExposeActivation(FrameBaseSender(fp));
     }
-    return EnsureActivation(sender_fp);  // SAFEPOINT
+    return ExposeActivation(EnsureActivation(sender_fp));  // SAFEPOINT
   } else {
-    return activation->sender();
+    return ExposeActivation(activation->sender());
+  }
+}
+
+
+Object Interpreter::ActivationMarkedSender(Activation activation,
+                                           Activation limit,
+                                           bool (*is_marked)(intptr_t prim)) {
+  for (;;) {
+    Object sender;
+    if (activation->sender()->IsSmallInteger()) {
+      Object* activation_fp = activation->sender_fp();
+      Object* fp = fp_;
+      StackSegment* segment = segment_;
+      while ((fp != 0) && (fp != activation_fp)) {
+        fp = FrameSavedFP(fp);
+        if ((fp == 0) && (segment->previous != nullptr)) {
+          segment = segment->previous;
+          fp = segment->fp;
+        }
+      }
+      if ((fp == 0) || (FrameActivation(fp) != activation)) {
+        // Frame is gone.
+        activation->set_sender(static_cast<Activation>(nil), kNoBarrier);
+        activation->set_bci(static_cast<SmallInteger>(nil));
+        return nil;
+      }
+
+      for (;;) {
+        Object* sender_fp = FrameSavedFP(fp);
+        if ((sender_fp == 0) && (segment->previous != nullptr)) {
+          segment = segment->previous;
+          sender_fp = segment->fp;
+        }
+        if (sender_fp == 0) {
+          break;
+        }
+        fp = sender_fp;
+        if (FrameActivation(fp) == limit) {
+          return nil;
+        }
+        if (is_marked(FrameMethod(fp)->Primitive())) {
+          return ExposeActivation(EnsureActivation(fp));  // SAFEPOINT
+        }
+      }
+      sender = FrameBaseSender(fp);
+    } else {
+      sender = activation->sender();
+    }
+
+    // Below the frames, or on a chain built by the simulator, which may lead
+    // back to a frame.
+    for (;;) {
+      if (!sender->IsActivation() || (sender == limit)) {
+        return nil;
+      }
+      activation = static_cast<Activation>(sender);
+      if (is_marked(activation->method()->Primitive())) {
+        return ExposeActivation(activation);
+      }
+      if (activation->sender()->IsSmallInteger()) {
+        break;
+      }
+      sender = activation->sender();
+    }
   }
 }
 
@@ -1871,11 +2943,49 @@ void Interpreter::ActivationSenderPut(Activation activation,
 }
 
 
+void Interpreter::ActivationTerminateTo(Activation activation,
+                                        Activation previous) {
+  // Walking the senders of a frame finds it from the top of the stack each
+  // time, so flush once rather than on each step.
+  Activation top;
+  {
+    HandleScope h1(H, reinterpret_cast<Object*>(&activation));
+    HandleScope h2(H, reinterpret_cast<Object*>(&previous));
+    top = FlushAllFrames();  // SAFEPOINT
+  }
+
+  bool has_sender = false;
+  if (activation != previous) {
+    for (Activation sender = activation->sender();
+         sender->IsActivation();
+         sender = sender->sender()) {
+      if (sender == previous) {
+        has_sender = true;
+        break;
+      }
+    }
+  }
+  if (has_sender) {
+    Activation zap = activation->sender();
+    while (zap != previous) {
+      Activation next = zap->sender();
+      zap->set_sender(static_cast<Activation>(nil), kNoBarrier);
+      zap->set_bci(static_cast<SmallInteger>(nil));
+      zap->set_stack_depth(SmallInteger::New(0));
+      zap = next;
+    }
+  }
+  activation->set_sender(previous);
+  CreateBaseFrame(top);
+}
+
+
 Object Interpreter::ActivationBCI(Activation activation) {
   if (activation->sender()->IsSmallInteger()) {
     Object* activation_fp = activation->sender_fp();
     Object* fp = fp_;
     const uint8_t* ip = ip_;
+    StackSegment* segment = segment_;
     while (fp != 0) {
       if (fp == activation_fp) {
         if (FrameActivation(fp) == activation) {
@@ -1885,6 +2995,11 @@ Object Interpreter::ActivationBCI(Activation activation) {
       }
       ip = FrameSavedIP(fp);
       fp = FrameSavedFP(fp);
+      if ((fp == 0) && (segment->previous != nullptr)) {
+        segment = segment->previous;
+        ip = segment->ip;
+        fp = segment->fp;
+      }
     }
     // Frame is gone.
     activation->set_sender(static_cast<Activation>(nil), kNoBarrier);
@@ -1991,6 +3106,7 @@ intptr_t Interpreter::ActivationTempSize(Activation activation) {
     Object* activation_fp = activation->sender_fp();
     Object* sp = sp_;
     Object* fp = fp_;
+    StackSegment* segment = segment_;
     while (fp != 0) {
       if (fp == activation_fp) {
         if (FrameActivation(fp) == activation) {
@@ -2000,6 +3116,11 @@ intptr_t Interpreter::ActivationTempSize(Activation activation) {
       }
       sp = FrameSavedSP(fp);
       fp = FrameSavedFP(fp);
+      if ((fp == 0) && (segment->previous != nullptr)) {
+        segment = segment->previous;
+        sp = segment->sp;
+        fp = segment->fp;
+      }
     }
 
     // Frame is gone.
@@ -2040,8 +3161,14 @@ void Interpreter::GCPrologue() {
   // Convert IPs to BCIs. The makes every slot on the stack a valid object
   // pointer. Frame flags and saved FPs are valid as SmallIntegers.
 
+#if REPORT_ACTIVATIONS
+  ReportMaterializations();
+#endif
+  num_free_activations_ = 0;
+
   Object* fp = fp_;
   const uint8_t** ip_slot = &ip_;
+  StackSegment* segment = segment_;
 
   while (fp != 0) {
     SmallInteger bci = FrameMethod(fp)->BCI(*ip_slot);
@@ -2049,6 +3176,11 @@ void Interpreter::GCPrologue() {
 
     ip_slot = FrameSavedIPSlot(fp);
     fp = FrameSavedFP(fp);
+    if ((fp == 0) && (segment->previous != nullptr)) {
+      segment = segment->previous;
+      ip_slot = &segment->ip;
+      fp = segment->fp;
+    }
   }
 }
 
@@ -2058,6 +3190,7 @@ void Interpreter::GCEpilogue() {
 
   Object* fp = fp_;
   const uint8_t** ip_slot = &ip_;
+  StackSegment* segment = segment_;
 
   while (fp != 0) {
     const SmallInteger bci =
@@ -2066,11 +3199,83 @@ void Interpreter::GCEpilogue() {
 
     ip_slot = FrameSavedIPSlot(fp);
     fp = FrameSavedFP(fp);
+    if ((fp == 0) && (segment->previous != nullptr)) {
+      segment = segment->previous;
+      ip_slot = &segment->ip;
+      fp = segment->fp;
+    }
+  }
+  if ((fp_ == 0) && (ip_ != 0)) {
+    // Between dispatches, ip_ holds the base sender, nil, which may have been
+    // moved.
+    ip_ = reinterpret_cast<const uint8_t*>(static_cast<uword>(nil_));
   }
 
+  FlushCaches();
+  profiler_.FlushCache();
+#if REPORT_BYTECODES
+  execution_counter_.FlushCache();
+#endif
+}
+
+
+void Interpreter::FlushCaches() {
 #if LOOKUP_CACHE
   lookup_cache_.Clear();
 #endif
+#if INLINE_CACHE
+  inline_cache_.Clear();
+#endif
+}
+
+
+void Interpreter::FlushCachesForSelector(String selector) {
+  ASSERT(selector->IsString());
+  ASSERT(selector->is_canonical());
+#if LOOKUP_CACHE
+  lookup_cache_.ClearSelector(selector);
+  if (selector == object_store()->does_not_understand()) {
+    // kMNU entries are kept under the selector that was not understood.
+    lookup_cache_.ClearRule(kMNU);
+  }
+#endif
+#if INLINE_CACHE
+  inline_cache_.ClearSelector(selector);
+#endif
+}
+
+
+void Interpreter::FlushCachesForClass(Behavior cls) {
+  // Lookups are cached under the class id of the receiver, or for an outer or
+  // implicit receiver send, of the sender, with the receiver found kept
+  // beside. The classes that inherit from cls are known only by their
+  // superclass links.
+  intptr_t length = H->class_table_size();
+  bool* inherits = new bool[length];
+  for (intptr_t cid = 0; cid < length; cid++) {
+    inherits[cid] = false;
+    if (cid < kFirstLegalCid) {
+      continue;
+    }
+    Object entry = H->ClassAt(cid);
+    if (entry->IsSmallInteger()) {
+      continue;  // Free.
+    }
+    for (Behavior klass = static_cast<Behavior>(entry); klass != nil;
+         klass = klass->superclass()) {
+      if (klass == cls) {
+        inherits[cid] = true;
+        break;
+      }
+    }
+  }
+#if LOOKUP_CACHE
+  lookup_cache_.ClearClassIds(inherits, length);
+#endif
+#if INLINE_CACHE
+  inline_cache_.ClearClassIds(inherits, length);
+#endif
+  delete[] inherits;
 }
 
 }  // namespace psoup
@@ -7,11 +7,17 @@
 
 #include <setjmp.h>
 
+#include <atomic>
+
 #include "vm/globals.h"
 #include "vm/assert.h"
 #include "vm/flags.h"
+#include "vm/inline_cache.h"
+#include "vm/jit.h"
 #include "vm/lookup_cache.h"
 #include "vm/object.h"
+#include "vm/profiler.h"
+#include "vm/time_quota.h"
 
 namespace psoup {
 
@@ -21,13 +27,27 @@ class Object;
 
 class Interpreter {
  public:
-  Interpreter(Heap* heap, Isolate* isolate);
+  static constexpr size_t kDefaultStackSize = 1024 * sizeof(Object);
+
+  // The stack holds stack_size bytes of frames. When it is full, it grows by
+  // up to max_stack_segments - 1 more segments of the same size before frames
+  // are moved to the heap.
+  Interpreter(Heap* heap,
+              Isolate* isolate,
+              size_t stack_size,
+              intptr_t max_stack_segments);
   ~Interpreter();
 
   Isolate* isolate() const { return isolate_; }
+  LookupCache* lookup_cache() { return &lookup_cache_; }
 
+  // Runs a turn from its activation until the turn finishes or yields.
   void Enter();
   void Exit();
+  // Whether the last turn yielded its thread before it finished, to go on
+  // when resumed. Nothing else may be activated until then.
+  bool suspended() const { return suspended_; }
+  void Resume();
   void ActivateDispatch(Method method, intptr_t num_args);
   void ReturnFromDispatch();
 
@@ -35,15 +55,62 @@ class Interpreter {
   Method MethodAt(Behavior cls, String selector);
   void ActivateClosure(intptr_t num_args);
 
-  void Interrupt() { checked_stack_limit_ = reinterpret_cast<Object*>(-1); }
+  // Asks the interpreter to stop at its next poll, which happens on every
+  // activation and backward jump. May be called from any thread.
+  void Interrupt() { poll_word_.fetch_or(kInterruptRequest); }
   void PrintStack();
+  // Asks the interpreter to record its stack for the profiler at its next
+  // poll. May be called from any thread.
+  void RequestSample() { poll_word_.fetch_or(kProfileRequest); }
+  Profiler* profiler() { return &profiler_; }
+  // Asks the interpreter to yield, or to signal TimeQuotaExceeded, at its
+  // next poll, if its time quota finds the slice or the turn past its limit
+  // then. May be called from any thread.
+  void RequestYield() { poll_word_.fetch_or(kYieldRequest); }
+  void RequestQuotaCheck() { poll_word_.fetch_or(kQuotaRequest); }
+  TimeQuota* time_quota() { return &time_quota_; }
+  PrimitiveProfiler* primitive_profiler() { return &primitive_profiler_; }
+  // For the allocation profiler: the method running, whether in a block, and
+  // the BCI it has reached. Leaves them as they are between turns.
+  void CurrentSite(Method* method, bool* is_closure, intptr_t* bci);
+
+  void FlushCaches();
+  void FlushCachesForSelector(String selector);
+  // Also those of its subclasses and mixin applications over it, which
+  // inherit its methods.
+  void FlushCachesForClass(Behavior cls);
+  void FlushNativeCode() {
+#if defined(USE_BASELINE_JIT)
+    native_code_.Flush();
+#endif
+  }
 
   const uint8_t* IPForAssert() { return ip_; }
 
   Activation CurrentActivation();
+  // The method, BCI and receiver of each of the top depth activations, in
+  // threes, read from the frames without moving them to the heap.
+  Array StackFrames(intptr_t depth);  // SAFEPOINT
   void SetCurrentActivation(Activation new_activation);
+  // Clears the private bit of an activation about to be handed to the
+  // program, which may then hold it past the return of its frame.
+  static Object ExposeActivation(Object activation) {
+    if (activation->IsActivation()) {
+      static_cast<Activation>(activation)->set_is_private(false);
+    }
+    return activation;
+  }
   Object ActivationSender(Activation activation);
+  // The nearest sender of activation whose method's primitive is_marked,
+  // or nil if there is none before limit. Frames passed over are not
+  // materialized.
+  Object ActivationMarkedSender(Activation activation,
+                                Activation limit,
+                                bool (*is_marked)(intptr_t prim));
   void ActivationSenderPut(Activation activation, Activation new_sender);
+  // Marks the activations between activation and previous as returned, if
+  // previous is one of its senders, and makes previous its sender.
+  void ActivationTerminateTo(Activation activation, Activation previous);
   Object ActivationBCI(Activation activation);
   void ActivationBCIPut(Activation activation, SmallInteger new_bci);
   void ActivationMethodPut(Activation activation, Method new_method);
@@ -60,9 +127,24 @@ class Interpreter {
     *from = &nil_;
     *to = reinterpret_cast<Object*>(&object_store_);
   }
-  void StackPointers(Object** from, Object** to) {
-    *from = sp_;
-    *to = stack_base_ - 1;
+  // Answers the slots in use of the index-th segment of the stack, counting
+  // from the top, or false if there are not that many segments.
+  bool StackPointers(intptr_t index, Object** from, Object** to) {
+    if (index == 0) {
+      *from = sp_;
+      *to = stack_base_ - 1;
+      return true;
+    }
+    StackSegment* segment = segment_;
+    for (intptr_t i = 0; i < index; i++) {
+      segment = segment->previous;
+      if (segment == nullptr) {
+        return false;
+      }
+    }
+    *from = segment->sp;
+    *to = segment->base - 1;
+    return true;
   }
   void GCEpilogue();
 
@@ -127,11 +209,15 @@ class Interpreter {
   INLINE void PushEnclosingObject(intptr_t depth);
   INLINE void PushNewArrayWithElements(intptr_t size);
   INLINE void PushNewArray(intptr_t size);
-  void PushClosure(intptr_t num_copied, intptr_t num_args, intptr_t block_size);
+  void PushClosure(intptr_t num_copied,
+                   intptr_t num_args,
+                   intptr_t block_size,
+                   bool needs_activation);
 
   INLINE void CommonSend(intptr_t offset);
   INLINE void OrdinarySend(intptr_t selector_index, intptr_t num_args);
   INLINE void OrdinarySend(String selector, intptr_t num_args);
+  INLINE void OrdinarySiteMiss(String selector, intptr_t num_args);
   NOINLINE void OrdinarySendMiss(String selector, intptr_t num_args);
   INLINE void SuperSend(intptr_t selector_index, intptr_t num_args);
   NOINLINE void SuperSendMiss(String selector, intptr_t num_args);
@@ -148,6 +234,9 @@ class Interpreter {
   bool HasMethod(Behavior, String selector);
   INLINE String SelectorAt(intptr_t index);
 
+  static Object AbsentReceiverEntry(Object receiver,
+                                    Object method_receiver,
+                                    intptr_t rule);
   void LexicalSend(String selector,
                    intptr_t num_args,
                    Object receiver,
@@ -158,10 +247,11 @@ class Interpreter {
                      Object receiver,
                      Behavior starting_at,
                      intptr_t rule);
+  Method LookupDNU(Behavior lookup_class);
   void DNUSend(String selector,
                intptr_t num_args,
                Object receiver,
-               Behavior lookup_class,
+               Method method,
                bool present_receiver);
 
   NOINLINE void SendCannotReturn(Object result);
@@ -172,27 +262,88 @@ class Interpreter {
   INLINE void ActivateAbsent(Method method, Object receiver,
                              intptr_t num_args);
   NOINLINE void Activate(Method method, intptr_t num_args);
+  NOINLINE bool InvokeProfiled(intptr_t prim, intptr_t num_args);
   NOINLINE void StackOverflow();
+  void GrowStack();
+  void ShrinkStack();
+  INLINE void Poll() {
+    if (poll_word_.load(std::memory_order_relaxed) != 0) {
+      HandlePollRequests();
+    }
+  }
+  NOINLINE void HandlePollRequests();
+  void Run();
+  void SignalTimeQuotaExceeded();
+  void SampleStack();
+#if defined(USE_BASELINE_JIT)
+  NOINLINE void RunNativeCode(const NativeCode* code, Method method);
+  INLINE void ResumeNativeCode();
+#endif
 
   INLINE void MethodReturn(Object result);
   INLINE void LocalReturn(Object result);
   NOINLINE void LocalBaseReturn(Object result);
   NOINLINE void NonLocalReturn(Object result);
+  bool ReturnPastFrames(Activation home, Object result);
 
   NOINLINE void CreateBaseFrame(Activation activation);
   NOINLINE Activation EnsureActivation(Object* fp);
+  // Like EnsureActivation, but an activation made here is private until
+  // exposed: the program cannot refer to it, so once its frame returns it can
+  // be reused rather than left for the GC.
+  Activation EnsurePrivateActivation(Object* fp);
+  Activation NewActivation();  // SAFEPOINT
+  void RecycleActivation(Activation activation);
+#if REPORT_BYTECODES
+  void CountSend(Object receiver);
+#endif
+#if REPORT_ACTIVATIONS
+  void RecordMaterialization(Method method);
+  void ReportMaterializations();
+#endif
   NOINLINE Activation FlushAllFrames();
+  // Calls visit with the method, BCI, receiver and closure (or nil) of each
+  // activation from the top, those in frames and then those already moved to
+  // the heap, until it answers false. Allocates nothing.
+  template <typename Visitor>
+  void WalkStack(Visitor visit);
   bool HasLivingFrame(Activation activation);
 
-  static constexpr intptr_t kStackSlots = 1024;
-  static constexpr intptr_t kStackSize = kStackSlots * sizeof(Object);
+  // A part of the stack. When the stack grows, the frames of the segment it
+  // grew from stay in place, and that segment keeps the state of its top
+  // frame until the stack shrinks back to it.
+  struct StackSegment {
+    Object* limit;
+    Object* base;
+    StackSegment* previous;
+    const uint8_t* ip;
+    Object* sp;
+    Object* fp;
+  };
+
+  StackSegment* NewStackSegment();
+  void EnterStackSegment(StackSegment* segment);
 
   const uint8_t* ip_;
   Object* sp_;
   Object* fp_;
   Object* stack_base_;
   Object* stack_limit_;
-  Object* volatile checked_stack_limit_;
+  Object* checked_stack_limit_;
+
+  StackSegment* segment_;
+  StackSegment* spare_segment_;  // Kept to avoid churn at a segment boundary.
+  intptr_t num_segments_;
+  const intptr_t max_segments_;
+  const intptr_t stack_slots_;
+
+  // Requests for the interpreter to act on at its next poll. Nonzero only
+  // rarely, so polling costs a load and a branch.
+  static constexpr uword kInterruptRequest = 1 << 0;
+  static constexpr uword kProfileRequest = 1 << 1;
+  static constexpr uword kYieldRequest = 1 << 2;
+  static constexpr uword kQuotaRequest = 1 << 3;
+  std::atomic<uword> poll_word_;  // Also read by native code, as a uword.
 
   Object nil_;
   Object false_;
@@ -202,7 +353,36 @@ class Interpreter {
   Heap* const heap_;
   Isolate* const isolate_;
   jmp_buf* environment_;
+  bool suspended_;
+  bool quota_exceeded_;  // To be signalled once out of the poll.
   LookupCache lookup_cache_;
+  InlineCache inline_cache_;
+  Profiler profiler_;
+  PrimitiveProfiler primitive_profiler_;
+  TimeQuota time_quota_;
+#if defined(USE_BASELINE_JIT)
+  NativeCodeCache native_code_;
+#endif
+#if REPORT_BYTECODES
+  ExecutionCounter execution_counter_;
+#endif
+#if REPORT_ACTIVATIONS
+  // Activations created for frames since the last GC, by method. Keys are
+  // not visited by the GC, so the counts are reported and cleared by each GC.
+  struct MaterializationCount {
+    Method method;
+    intptr_t count;
+  };
+  static constexpr intptr_t kMaterializationSlots = 256;
+  MaterializationCount materializations_[kMaterializationSlots];
+  intptr_t total_materializations_;
+#endif
+  // Private activations whose frames have returned, for NewActivation. Not
+  // visited by the GC, so emptied by each GC. Only new ones are kept, so the
+  // marker never finds one revived after it decided it was dead.
+  static constexpr intptr_t kMaxFreeActivations = 128;
+  Activation free_activations_[kMaxFreeActivations];
+  intptr_t num_free_activations_;
 };
 
 }  // namespace psoup
@@ -9,13 +9,17 @@
 #include "vm/lockers.h"
 #include "vm/message_loop.h"
 #include "vm/os.h"
+#include "vm/output.h"
+#include "vm/profiler.h"
+#include "vm/scheduler.h"
 #include "vm/snapshot.h"
 #include "vm/thread.h"
 #include "vm/thread_pool.h"
+#include "vm/time_quota.h"
 
 namespace psoup {
 
-#if defined(OS_EMSCRIPTEN)
+#if defined(OS_EMSCRIPTEN) && !EMSCRIPTEN_THREADS
 Isolate* Isolate::current_ = NULL;
 #else
 thread_local Isolate* Isolate::current_ = NULL;
@@ -23,17 +27,35 @@ thread_local Isolate* Isolate::current_ = NULL;
 Monitor* Isolate::isolates_list_monitor_ = NULL;
 Isolate* Isolate::isolates_list_head_ = NULL;
 ThreadPool* Isolate::thread_pool_ = NULL;
+Scheduler* Isolate::scheduler_ = NULL;
+uintptr_t Isolate::salt_ = 0;
+Isolate::SnapshotImage* Isolate::images_ = NULL;
 
 
 void Isolate::Startup() {
   isolates_list_monitor_ = new Monitor();
   thread_pool_ = new ThreadPool();
+  Profiler::Startup(thread_pool_);
+  TimeQuota::Startup(thread_pool_);
+  salt_ = static_cast<uintptr_t>(OS::CurrentMonotonicNanos());
 }
 
 
 void Isolate::Shutdown() {
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+  delete scheduler_;  // Waits for all its isolates to exit.
+  scheduler_ = NULL;
+#endif
   delete thread_pool_;  // Waits for all tasks to complete.
   thread_pool_ = NULL;
+  Profiler::Shutdown();
+  TimeQuota::Shutdown();
+  while (images_ != NULL) {
+    SnapshotImage* next = images_->next;
+    delete images_->image;
+    delete images_;
+    images_ = next;
+  }
   ASSERT(isolates_list_head_ == NULL);
   delete isolates_list_monitor_;
   isolates_list_monitor_ = NULL;
@@ -96,22 +118,94 @@ void Isolate::PrintStack() {
 }
 
 
-Isolate::Isolate(void* snapshot, size_t snapshot_length, uint64_t seed) :
+Isolate::Isolate(void* snapshot,
+                 size_t snapshot_length,
+                 uint64_t seed,
+                 const PrimordialSoup_IsolateOptions& options,
+                 Scheduler* scheduler) :
     heap_(NULL),
     interpreter_(NULL),
     loop_(NULL),
     snapshot_(snapshot),
     snapshot_length_(snapshot_length),
-    salt_(static_cast<uintptr_t>(seed)),
+    options_(options),
     random_(seed),
-    next_(NULL) {
+    output_(new OutputBuffer()),
+    next_(NULL),
+    busy_nanos_(0),
+    messages_sent_(0) {
+  for (intptr_t i = 0; i < kNumUsageStatistics; i++) {
+    published_usage_[i].store(0, std::memory_order_relaxed);
+  }
   heap_ = new Heap();
-  interpreter_ = new Interpreter(heap_, this);
-  loop_ = new PlatformMessageLoop(this);
+  // Threads kept to one NUMA node keep the heap there too.
+  if (OS::NumberOfNumaNodes() > 1) {
+    intptr_t node = OS::ThreadNumaNode();
+    if (node >= 0) {
+      heap_->set_numa_node(node);
+    }
+  }
+  if (options.huge_pages != 0) {
+    heap_->set_huge_pages(true);
+  }
+  heap_->ConfigureSizing(options.initial_semispace_size,
+                         options.max_semispace_size,
+                         options.old_space_growth,
+                         options.heap_limit);
+  heap_->InitializeScavengerWorkers(thread_pool_, options.scavenger_workers);
+  interpreter_ = new Interpreter(heap_, this, options.stack_size,
+                                 options.max_stack_segments);
+  if (options.lookup_cache_size > 0) {
+    interpreter_->lookup_cache()->Resize(options.lookup_cache_size);
+  }
+  loop_ = MessageLoop::New(this, scheduler);
+  loop_->set_message_budget(options.message_budget);
+  loop_->set_mailbox_capacity(options.mailbox_capacity);
+
+  // Processes that spawn isolates typically spawn many from each snapshot, so
+  // the second to deserialize a snapshot leaves an image of its heap for the
+  // others to copy.
+  HeapImage* image = NULL;
+  bool capture = false;
+  SnapshotImage* entry;
   {
+    MonitorLocker ml(isolates_list_monitor_);
+    entry = images_;
+    while ((entry != NULL) &&
+           ((entry->snapshot != snapshot) ||
+            (entry->snapshot_length != snapshot_length))) {
+      entry = entry->next;
+    }
+    if (entry == NULL) {
+      entry = new SnapshotImage;
+      entry->snapshot = snapshot;
+      entry->snapshot_length = snapshot_length;
+      entry->image = NULL;
+      entry->next = images_;
+      images_ = entry;
+    } else {
+      image = entry->image;
+      capture = (image == NULL);
+    }
+  }
+  if (image != NULL) {
+    ObjectStore os = static_cast<ObjectStore>(heap_->LoadImage(image));
+    interpreter_->InitializeRoot(os);
+    heap_->InitializeAfterSnapshot();
+  } else {
     Deserializer deserializer(heap_, snapshot, snapshot_length);
     deserializer.Deserialize();
   }
+  if (capture) {
+    image = heap_->CaptureImage(interpreter_->object_store());
+    MonitorLocker ml(isolates_list_monitor_);
+    if (entry->image == NULL) {
+      entry->image = image;
+    } else {
+      delete image;  // Another isolate got there first.
+    }
+  }
+  SetTimeLimits(options.time_slice, options.turn_quota);
 
   AddIsolateToList(this);
 
@@ -128,16 +222,83 @@ Isolate::~Isolate() {
   delete heap_;
   delete interpreter_;
   delete loop_;
+  delete output_;
 }
 
 
 void Isolate::ActivateMessage(IsolateMessage* isolate_message) {
+  Object message = MessageObject(isolate_message);  // SAFEPOINT
+  HandleScope h1(heap_, &message);
+  Object port = PortObject(isolate_message->dest_port());  // SAFEPOINT
+  Activate(message, port);
+}
+
+
+bool Isolate::CanActivateMessages() const {
+  return interpreter_->object_store()->has_dispatch_messages();
+}
+
+
+void Isolate::ActivateMessages(IsolateMessage* first, intptr_t count) {
+  Array messages = heap_->AllocateArray(count);  // SAFEPOINT
+  for (intptr_t i = 0; i < count; i++) {
+    messages->set_element(i, SmallInteger::New(0));
+  }
+  HandleScope h1(heap_, reinterpret_cast<Object*>(&messages));
+  Array ports = heap_->AllocateArray(count);  // SAFEPOINT
+  for (intptr_t i = 0; i < count; i++) {
+    ports->set_element(i, SmallInteger::New(0));
+  }
+  HandleScope h2(heap_, reinterpret_cast<Object*>(&ports));
+
+  IsolateMessage* isolate_message = first;
+  for (intptr_t i = 0; i < count; i++) {
+    Object message = MessageObject(isolate_message);  // SAFEPOINT
+    messages->set_element(i, message);
+    Object port = PortObject(isolate_message->dest_port());  // SAFEPOINT
+    ports->set_element(i, port);
+    isolate_message = isolate_message->next_;
+  }
+
+  Object message_loop = interpreter_->object_store()->message_loop();
+
+  Behavior cls = message_loop->Klass(heap_);
+  String selector = interpreter_->object_store()->dispatch_messages();
+  Method method = interpreter_->MethodAt(cls, selector);
+
+  interpreter_->Push(message_loop);
+  interpreter_->Push(messages);
+  interpreter_->Push(ports);
+  interpreter_->ActivateDispatch(method, 2);  // SAFEPOINT
+}
+
+
+Object Isolate::MessageObject(IsolateMessage* isolate_message) {
   Object message;
-  if (isolate_message->data() != NULL) {
+#if defined(OS_FUCHSIA)
+  if (isolate_message->has_handle()) {
+    return SmallInteger::New(isolate_message->TakeHandle());
+  }
+#endif
+  if (isolate_message->transferable()) {
+    message = heap_->AdoptTransferable(isolate_message->TakeData());
+  } else if (isolate_message->text()) {
+    intptr_t length = isolate_message->length();
+    String string = heap_->AllocateString(length);  // SAFEPOINT
+    memcpy(string->element_addr(0), isolate_message->data(), length);
+    message = string;
+  } else if (isolate_message->data() != NULL) {
     intptr_t length = isolate_message->length();
     ByteArray bytes = heap_->AllocateByteArray(length);  // SAFEPOINT
     memcpy(bytes->element_addr(0), isolate_message->data(), length);
     message = bytes;
+  } else if (isolate_message->reply_port() != ILLEGAL_PORT) {
+    Array ports = heap_->AllocateArray(1);  // SAFEPOINT
+    ports->set_element(0, SmallInteger::New(0));
+    HandleScope h1(heap_, reinterpret_cast<Object*>(&ports));
+    Object reply = PortObject(isolate_message->reply_port());  // SAFEPOINT
+    ports->set_element(0, reply);
+    message = ports;
   } else {
     int argc = isolate_message->argc();
     Array strings = heap_->AllocateArray(argc);  // SAFEPOINT
@@ -155,21 +316,20 @@ void Isolate::ActivateMessage(IsolateMessage* isolate_message) {
     }
     message = strings;
   }
+  return message;
+}
 
-  Port port_id = isolate_message->dest_port();
-  Object port;
+
+Object Isolate::PortObject(Port port_id) {
   if (port_id == ILLEGAL_PORT) {
-    port = interpreter_->nil_obj();
-  } else if (SmallInteger::IsSmiValue(port_id)) {
-    port = SmallInteger::New(port_id);
-  } else {
-    HandleScope h1(heap_, reinterpret_cast<Object*>(&message));
-    MediumInteger mint = heap_->AllocateMediumInteger();  // SAFEPOINT
-    mint->set_value(port_id);
-    port = mint;
+    return interpreter_->nil_obj();
   }
-
-  Activate(message, port);
+  if (SmallInteger::IsSmiValue(port_id)) {
+    return SmallInteger::New(port_id);
+  }
+  MediumInteger mint = heap_->AllocateMediumInteger();  // SAFEPOINT
+  mint->set_value(port_id);
+  return mint;
 }
 
 
@@ -213,7 +373,104 @@ void Isolate::ActivateSignal(intptr_t handle,
 
 
 void Isolate::Interpret() {
+  int64_t start = OS::CurrentMonotonicNanos();
   interpreter_->Enter();
+  busy_nanos_ += OS::CurrentMonotonicNanos() - start;
+  output_->Flush();
+  PublishUsage();
+}
+
+
+bool Isolate::suspended() const {
+  return interpreter_->suspended();
+}
+
+
+void Isolate::Resume() {
+  int64_t start = OS::CurrentMonotonicNanos();
+  interpreter_->Resume();
+  busy_nanos_ += OS::CurrentMonotonicNanos() - start;
+  output_->Flush();
+  PublishUsage();
+}
+
+
+static bool IsTimeLimit(int64_t limit) {
+  return (limit == 0) || (limit >= TimeQuota::kMinLimit);
+}
+
+
+bool Isolate::SetTimeLimits(int64_t slice, int64_t quota) {
+  if (!IsTimeLimit(slice) || !IsTimeLimit(quota)) {
+    return false;
+  }
+  if (!loop_->CanYield()) {
+    slice = 0;
+  }
+  if (!interpreter_->object_store()->has_time_quota_exceeded()) {
+    quota = 0;
+  }
+  interpreter_->time_quota()->SetLimits(slice, quota);
+  return true;
+}
+
+
+int64_t Isolate::UsageStatisticAt(UsageStatistic statistic) const {
+  GCTrace* trace = heap_->trace();
+  switch (statistic) {
+    case kBusyNanos:
+      return busy_nanos_;
+    case kAllocatedBytes:
+      return heap_->allocated_bytes();
+    case kScavenges:
+      return trace->scavenges();
+    case kScavengeNanos:
+      return trace->scavenge_nanos();
+    case kMarkSweeps:
+      return trace->mark_sweeps();
+    case kMarkSweepNanos:
+      return trace->pause_nanos() - trace->scavenge_nanos();
+    case kMessagesSent:
+      return messages_sent_;
+    case kMessagesReceived:
+      return loop_->MailboxStatisticAt(MessageLoop::kMailboxDispatched);
+    case kPeakHeapSize:
+      return heap_->peak_size();
+    case kNumUsageStatistics:
+      break;
+  }
+  UNREACHABLE();
+  return 0;
+}
+
+
+void Isolate::PublishUsage() {
+  for (intptr_t i = 0; i < kNumUsageStatistics; i++) {
+    published_usage_[i].store(
+        UsageStatisticAt(static_cast<UsageStatistic>(i)),
+        std::memory_order_relaxed);
+  }
+}
+
+
+void Isolate::ReadUsage(int64_t* usage) const {
+  for (intptr_t i = 0; i < kNumUsageStatistics; i++) {
+    usage[i] = published_usage_[i].load(std::memory_order_relaxed);
+  }
+}
+
+
+void Isolate::UsageFrom(const int64_t* usage,
+                        PrimordialSoup_IsolateUsage* result) {
+  result->busy_nanos = usage[kBusyNanos];
+  result->allocated_bytes = usage[kAllocatedBytes];
+  result->scavenges = usage[kScavenges];
+  result->scavenge_nanos = usage[kScavengeNanos];
+  result->mark_sweeps = usage[kMarkSweeps];
+  result->mark_sweep_nanos = usage[kMarkSweepNanos];
+  result->messages_sent = usage[kMessagesSent];
+  result->messages_received = usage[kMessagesReceived];
+  result->peak_heap_size = usage[kPeakHeapSize];
 }
 
 
@@ -221,20 +478,45 @@ class SpawnIsolateTask : public ThreadPool::Task {
  public:
   SpawnIsolateTask(void* snapshot,
                    size_t snapshot_length,
-                   IsolateMessage* initial_message) :
+                   const PrimordialSoup_IsolateOptions& options,
+                   intptr_t numa_node,
+                   IsolateMessage* initial_message,
+                   PrimordialSoup_ExitHandler on_exit = NULL,
+                   void* context = NULL) :
     snapshot_(snapshot),
     snapshot_length_(snapshot_length),
-    initial_message_(initial_message) {
+    options_(options),
+    numa_node_(numa_node),
+    initial_message_(initial_message),
+    on_exit_(on_exit),
+    context_(context) {
   }
 
   virtual void Run() {
+    bool confined = false;
+    if ((options_.cpu_affinity != NULL) || (numa_node_ >= 0)) {
+      confined = OS::SetThreadAffinity(options_.cpu_affinity, numa_node_);
+    }
     uint64_t seed = OS::CurrentMonotonicNanos();
-    Isolate* child_isolate = new Isolate(snapshot_, snapshot_length_, seed);
+    Isolate* child_isolate = new Isolate(snapshot_, snapshot_length_, seed,
+                                         options_);
     child_isolate->loop()->PostMessage(initial_message_);
     initial_message_ = NULL;
     intptr_t exit_code = child_isolate->loop()->Run();
+    int64_t usage[Isolate::kNumUsageStatistics];
+    for (intptr_t i = 0; i < Isolate::kNumUsageStatistics; i++) {
+      usage[i] = child_isolate->UsageStatisticAt(
+          static_cast<Isolate::UsageStatistic>(i));
+    }
     delete child_isolate;
-    if (exit_code != 0) {
+    if (confined) {
+      OS::SetThreadAffinity(NULL, -1);  // The pool's thread may run others.
+    }
+    if (on_exit_ != NULL) {
+      PrimordialSoup_IsolateUsage final_usage;
+      Isolate::UsageFrom(usage, &final_usage);
+      on_exit_(exit_code, &final_usage, context_);
+    } else if (exit_code != 0) {
       OS::Exit(exit_code);
     }
   }
@@ -242,15 +524,136 @@ class SpawnIsolateTask : public ThreadPool::Task {
  private:
   void* snapshot_;
   size_t snapshot_length_;
+  PrimordialSoup_IsolateOptions options_;
+  intptr_t numa_node_;
   IsolateMessage* initial_message_;
+  // For the embedder's isolates, in place of ending the process on failure.
+  PrimordialSoup_ExitHandler on_exit_;
+  void* context_;
 
   DISALLOW_COPY_AND_ASSIGN(SpawnIsolateTask);
 };
 
 
-void Isolate::Spawn(IsolateMessage* initial_message) {
-  thread_pool_->Run(new SpawnIsolateTask(snapshot_, snapshot_length_,
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+class ScheduledSpawnTask : public Scheduler::Task {
+ public:
+  ScheduledSpawnTask(Scheduler* scheduler,
+                     void* snapshot,
+                     size_t snapshot_length,
+                     const PrimordialSoup_IsolateOptions& options,
+                     IsolateMessage* initial_message) :
+    scheduler_(scheduler),
+    snapshot_(snapshot),
+    snapshot_length_(snapshot_length),
+    options_(options),
+    initial_message_(initial_message) {
+  }
+
+  // The child's first turn then follows on the same worker.
+  virtual void RunTurn() {
+    uint64_t seed = OS::CurrentMonotonicNanos();
+    Isolate* child_isolate = new Isolate(snapshot_, snapshot_length_, seed,
+                                         options_, scheduler_);
+    ScheduledMessageLoop* loop =
+        static_cast<ScheduledMessageLoop*>(child_isolate->loop());
+    loop->PostMessage(initial_message_);
+    initial_message_ = NULL;
+    Isolate::ClearCurrent();
+    delete this;
+    loop->RunTurn();
+  }
+
+ private:
+  Scheduler* scheduler_;
+  void* snapshot_;
+  size_t snapshot_length_;
+  PrimordialSoup_IsolateOptions options_;
+  IsolateMessage* initial_message_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScheduledSpawnTask);
+};
+#endif
+
+
+void Isolate::Spawn(IsolateMessage* initial_message, bool near) {
+  intptr_t numa_node = near ? OS::CurrentNumaNode() : -1;
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+  if (options_.scheduler_workers > 0) {
+    Scheduler* scheduler;
+    {
+      MonitorLocker ml(isolates_list_monitor_);
+      if (scheduler_ == NULL) {
+        scheduler_ = new Scheduler(thread_pool_, options_.scheduler_workers,
+                                   options_.cpu_affinity);
+      }
+      scheduler = scheduler_;
+    }
+    scheduler->Start(new ScheduledSpawnTask(scheduler, snapshot_,
+                                            snapshot_length_, options_,
+                                            initial_message),
+                     numa_node);
+    return;
+  }
+#endif
+  thread_pool_->SetLimits(options_.max_isolate_threads, options_.warm_threads);
+  thread_pool_->Queue(new SpawnIsolateTask(snapshot_, snapshot_length_,
+                                         options_, numa_node,
                                          initial_message));
 }
 
+
+void Isolate::Start(void* snapshot,
+                    size_t snapshot_length,
+                    const PrimordialSoup_IsolateOptions& options,
+                    Port reply_port,
+                    PrimordialSoup_ExitHandler on_exit,
+                    void* context) {
+  IsolateMessage* initial_message = new IsolateMessage(ILLEGAL_PORT,
+                                                       reply_port);
+  thread_pool_->SetLimits(options.max_isolate_threads, options.warm_threads);
+  thread_pool_->Queue(new SpawnIsolateTask(snapshot, snapshot_length,
+                                         options, -1, initial_message,
+                                         on_exit, context));
+}
+
+
+void Isolate::PrepareSnapshot(void* snapshot, size_t snapshot_length) {
+  // A heap of no isolate, only to capture.
+  Heap* heap = new Heap();
+  Interpreter* interpreter = new Interpreter(
+      heap, NULL, Interpreter::kDefaultStackSize, 1);
+  {
+    Deserializer deserializer(heap, snapshot, snapshot_length);
+    deserializer.Deserialize();
+  }
+  HeapImage* image = heap->CaptureImage(interpreter->object_store());
+  delete heap;
+  delete interpreter;
+
+  MonitorLocker ml(isolates_list_monitor_);
+  SnapshotImage* entry = new SnapshotImage;
+  entry->snapshot = snapshot;
+  entry->snapshot_length = snapshot_length;
+  entry->image = image;
+  entry->next = images_;
+  images_ = entry;
+}
+
+
+void Isolate::ForgetSnapshot(const void* snapshot) {
+  MonitorLocker ml(isolates_list_monitor_);
+  SnapshotImage** link = &images_;
+  while (*link != NULL) {
+    SnapshotImage* entry = *link;
+    if (entry->snapshot == snapshot) {
+      *link = entry->next;
+      delete entry->image;
+      delete entry;
+    } else {
+      link = &entry->next;
+    }
+  }
+}
+
 }  // namespace psoup
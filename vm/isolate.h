@@ -5,42 +5,116 @@
 #ifndef VM_ISOLATE_H_
 #define VM_ISOLATE_H_
 
+#include <atomic>
+
 #include "vm/allocation.h"
+#include "vm/flags.h"
 #include "vm/globals.h"
 #include "vm/port.h"
+#include "vm/primordial_soup.h"
 #include "vm/random.h"
 
 namespace psoup {
 
 class Heap;
+class HeapImage;
 class Interpreter;
 class MessageLoop;
 class Monitor;
 class Object;
+class OutputBuffer;
+class Scheduler;
 class ThreadPool;
 
 class Isolate {
  public:
-  Isolate(void* snapshot, size_t snapshot_length, uint64_t seed);
+  // What the isolate has used, to account for it. In the order of
+  // PrimordialSoup_IsolateUsage.
+  enum UsageStatistic {
+    kBusyNanos = 0,  // Running Newspeak, including its GCs.
+    kAllocatedBytes,
+    kScavenges,
+    kScavengeNanos,
+    kMarkSweeps,
+    kMarkSweepNanos,  // Including incremental steps.
+    kMessagesSent,  // Posted to ports.
+    kMessagesReceived,  // Dispatched from its ports.
+    kPeakHeapSize,
+    kNumUsageStatistics,
+  };
+
+  Isolate(void* snapshot,
+          size_t snapshot_length,
+          uint64_t seed,
+          const PrimordialSoup_IsolateOptions& options,
+          Scheduler* scheduler = NULL);
   ~Isolate();
 
   Heap* heap() const { return heap_; }
   MessageLoop* loop() const { return loop_; }
-  uintptr_t salt() const { return salt_; }
+  static uintptr_t salt() { return salt_; }
+  const void* snapshot() const { return snapshot_; }
+  size_t snapshot_length() const { return snapshot_length_; }
   Random& random() { return random_; }
+  OutputBuffer* output() const { return output_; }
 
   void ActivateMessage(IsolateMessage* message);
+  // Whether the snapshot takes several messages in one activation.
+  bool CanActivateMessages() const;
+  // The count messages linked from first, in one activation.
+  void ActivateMessages(IsolateMessage* first, intptr_t count);
   void ActivateWakeup();
   void ActivateSignal(intptr_t handle,
                       intptr_t status,
                       intptr_t signals,
                       intptr_t count);
 
+  // Runs Newspeak until the turn ends, or yields, then publishes the usage.
   void Interpret();
-
-  void Spawn(IsolateMessage* initial_message);
+  // Whether the last turn yielded, and must be resumed before anything else
+  // is activated.
+  bool suspended() const;
+  void Resume();
+
+  // Limits each turn, in microseconds, as TimeQuota does. The slice is kept
+  // only by a loop whose turns can yield, and the quota only by a snapshot
+  // that handles it. Answers false for a limit that is negative or below
+  // TimeQuota::kMinLimit, but not 0 for none.
+  bool SetTimeLimits(int64_t slice, int64_t quota);
+
+  // On the isolate's thread, as it is now.
+  int64_t UsageStatisticAt(UsageStatistic statistic) const;
+  void CountMessageSent() { messages_sent_++; }
+  // From any thread, as of the end of the last turn, in usage's
+  // kNumUsageStatistics entries.
+  void ReadUsage(int64_t* usage) const;
+  static void UsageFrom(const int64_t* usage,
+                        PrimordialSoup_IsolateUsage* result);
+
+  // Near, the child runs on the NUMA node this isolate is running on.
+  void Spawn(IsolateMessage* initial_message, bool near);
+
+  // For the embedder: starts an isolate on a thread of the pool, whose
+  // main:args: gets an Array of reply_port.
+  static void Start(void* snapshot,
+                    size_t snapshot_length,
+                    const PrimordialSoup_IsolateOptions& options,
+                    Port reply_port,
+                    PrimordialSoup_ExitHandler on_exit,
+                    void* context);
+  // Reads a snapshot into an image of its heap, for every isolate then
+  // started from it to copy.
+  static void PrepareSnapshot(void* snapshot, size_t snapshot_length);
+  // Discards the image of a snapshot's heap, before the snapshot is freed.
+  static void ForgetSnapshot(const void* snapshot);
 
   static Isolate* Current() { return current_; }
+  // For the thread running a turn of a scheduled isolate.
+  void MakeCurrent() {
+    ASSERT(current_ == NULL);
+    current_ = this;
+  }
+  static void ClearCurrent() { current_ = NULL; }
   static void Startup();
   static void Shutdown();
 
@@ -49,21 +123,30 @@ class Isolate {
   void PrintStack();
 
  private:
+  Object MessageObject(IsolateMessage* message);
+  Object PortObject(Port port);
   void Activate(Object message, Object port);
+  void PublishUsage();
 
   Heap* heap_;
   Interpreter* interpreter_;
   MessageLoop* loop_;
   void* snapshot_;
   size_t snapshot_length_;
-  uintptr_t salt_;
+  // Inherited by spawned isolates, as is the snapshot.
+  PrimordialSoup_IsolateOptions options_;
   Random random_;
+  OutputBuffer* output_;
   Isolate* next_;
 
+  int64_t busy_nanos_;
+  int64_t messages_sent_;
+  std::atomic<int64_t> published_usage_[kNumUsageStatistics];
+
   void AddIsolateToList(Isolate* isolate);
   void RemoveIsolateFromList(Isolate* isolate);
 
-#if defined(OS_EMSCRIPTEN)
+#if defined(OS_EMSCRIPTEN) && !EMSCRIPTEN_THREADS
   static Isolate* current_;
 #else
   static thread_local Isolate* current_;
@@ -71,6 +154,22 @@ class Isolate {
   static Monitor* isolates_list_monitor_;
   static Isolate* isolates_list_head_;
   static ThreadPool* thread_pool_;
+  // Runs spawned isolates, unless they get a thread each. Created with the
+  // first.
+  static Scheduler* scheduler_;
+  // Shared by all isolates, so they agree on the hashes of the strings they
+  // share.
+  static uintptr_t salt_;
+
+  // Each snapshot loaded, and once a second isolate has loaded it too, an
+  // image of the heap it makes for the rest. Kept until shutdown.
+  struct SnapshotImage {
+    const void* snapshot;
+    size_t snapshot_length;
+    HeapImage* image;
+    SnapshotImage* next;
+  };
+  static SnapshotImage* images_;
 
   DISALLOW_COPY_AND_ASSIGN(Isolate);
 };
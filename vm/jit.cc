@@ -0,0 +1,507 @@
+// Copyright (c) 2016, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/jit.h"
+
+#if defined(USE_BASELINE_JIT)
+
+#include <string.h>
+
+#include "vm/probes.h"
+#include "vm/utils.h"
+
+namespace psoup {
+
+CodeGenerator::CodeGenerator(intptr_t num_bcis)
+    : buffer_(nullptr),
+      size_(0),
+      capacity_(0),
+      num_bcis_(num_bcis),
+      offsets_(new uint32_t[num_bcis + 2]),
+      exit_stubs_(new uint32_t[num_bcis + 2]),
+      fixups_(nullptr),
+      num_fixups_(0),
+      fixups_capacity_(0),
+      exit_(0) {
+  for (intptr_t i = 0; i < num_bcis + 2; i++) {
+    offsets_[i] = 0;
+    exit_stubs_[i] = 0;
+  }
+}
+
+
+CodeGenerator::~CodeGenerator() {
+  free(buffer_);
+  delete[] offsets_;
+  delete[] exit_stubs_;
+  free(fixups_);
+}
+
+
+void CodeGenerator::Emit8(uint8_t value) {
+  if (size_ == capacity_) {
+    capacity_ = capacity_ == 0 ? 1024 : capacity_ * 2;
+    buffer_ = reinterpret_cast<uint8_t*>(realloc(buffer_, capacity_));
+    if (buffer_ == nullptr) {
+      FATAL("Failed to grow code buffer");
+    }
+  }
+  buffer_[size_++] = value;
+}
+
+
+void CodeGenerator::Emit32(uint32_t value) {
+  Emit8(value);
+  Emit8(value >> 8);
+  Emit8(value >> 16);
+  Emit8(value >> 24);
+}
+
+
+void CodeGenerator::Patch32(intptr_t position, uint32_t value) {
+  ASSERT((position >= 0) && (position + 4 <= size_));
+  buffer_[position + 0] = value;
+  buffer_[position + 1] = value >> 8;
+  buffer_[position + 2] = value >> 16;
+  buffer_[position + 3] = value >> 24;
+}
+
+
+uint32_t CodeGenerator::Read32(intptr_t position) const {
+  ASSERT((position >= 0) && (position + 4 <= size_));
+  return static_cast<uint32_t>(buffer_[position + 0]) |
+      (static_cast<uint32_t>(buffer_[position + 1]) << 8) |
+      (static_cast<uint32_t>(buffer_[position + 2]) << 16) |
+      (static_cast<uint32_t>(buffer_[position + 3]) << 24);
+}
+
+
+void CodeGenerator::AddFixup(intptr_t position,
+                             intptr_t bci,
+                             FixupKind kind) {
+  if (num_fixups_ == fixups_capacity_) {
+    fixups_capacity_ = fixups_capacity_ == 0 ? 64 : fixups_capacity_ * 2;
+    fixups_ = reinterpret_cast<Fixup*>(
+        realloc(fixups_, fixups_capacity_ * sizeof(Fixup)));
+    if (fixups_ == nullptr) {
+      FATAL("Failed to grow fixups");
+    }
+  }
+  fixups_[num_fixups_].position = position;
+  fixups_[num_fixups_].bci = bci;
+  fixups_[num_fixups_].kind = kind;
+  num_fixups_++;
+}
+
+
+void CodeGenerator::Bind(intptr_t bci) {
+  ASSERT((bci >= 1) && (bci <= num_bcis_));
+  ASSERT(size_ > 0);  // After the entry stub.
+  offsets_[bci] = size_;
+}
+
+
+bool CodeGenerator::Finalize() {
+  for (intptr_t i = 0; i < num_fixups_; i++) {
+    const Fixup& fixup = fixups_[i];
+    intptr_t target;
+    if (fixup.kind == kJumpFixup) {
+      if ((fixup.bci < 1) || (fixup.bci > num_bcis_) ||
+          (offsets_[fixup.bci] == 0)) {
+        return false;
+      }
+      target = offsets_[fixup.bci];
+    } else {
+      if (exit_stubs_[fixup.bci] == 0) {
+        exit_stubs_[fixup.bci] = size_;
+        EmitExitStub(fixup.bci);
+      }
+      target = exit_stubs_[fixup.bci];
+    }
+    PatchBranch(fixup.position, target);
+  }
+  return true;
+}
+
+
+enum Bytecode {
+  kPushTemporaryAndQuick0 = 0,
+  kPushTemporaryAndQuick7 = 7,
+  kPopIntoTemporaryAndJump0 = 8,
+  kPopIntoTemporaryAndJump3 = 11,
+  kExtendedJump = 12,
+  kExtendedBranchTrue = 13,
+  kExtendedBranchFalse = 14,
+  kPushLiteral0 = 32,
+  kPushLiteral31 = 63,
+  kPushTemporary0 = 64,
+  kPushTemporary11 = 75,
+  kPushReceiver = 76,
+  kPushSpecial = 77,
+  kPushZero = 78,
+  kPushOne = 79,
+  kSendAdd = 80,
+  kSendSubtract = 81,
+  kSendLess = 82,
+  kSendGreater = 83,
+  kSendLessEqual = 84,
+  kSendGreaterEqual = 85,
+  kSendEqual = 86,
+  kSendNotEqual = 87,
+  kSendMultiply = 88,
+  kSendBitAnd = 94,
+  kSendBitOr = 95,
+  kPopIntoTemporary0 = 184,
+  kPopIntoTemporary7 = 191,
+  kDup = 219,
+  kPop = 220,
+  kExtendA = 224,
+  kExtendB = 225,
+  kPushLiteral = 228,
+  kPushInteger = 229,
+  kPushTemporary = 230,
+  kStoreIntoTemporary = 234,
+  kPopIntoTemporary = 237,
+  kJump = 242,
+  kBranchTrue = 243,
+  kBranchFalse = 244,
+  kPushClosure = 253,
+};
+
+
+static intptr_t InstructionLength(uint8_t byte) {
+  if (byte < 224) return 1;
+  if (byte < 249) return 2;
+  return 3;
+}
+
+
+// Mirrors FrameTemp for a method activation, where the number of arguments is
+// known.
+static intptr_t TempSlot(intptr_t index, intptr_t num_args) {
+  if (index < num_args) {
+    return 1 + num_args - index;
+  } else {
+    return -5 - (index - num_args);
+  }
+}
+
+
+// Compiles the instruction at bci, whose extensions have been decoded into
+// extA and extB and whose opcode is at opcode_bci. Answers false if it is left
+// to the interpreter.
+static bool Translate(CodeGenerator* cgen,
+                      const uint8_t* bytes,
+                      intptr_t bci,
+                      intptr_t opcode_bci,
+                      intptr_t next_bci,
+                      intptr_t extA,
+                      intptr_t extB,
+                      intptr_t num_args,
+                      intptr_t num_literals) {
+  uint8_t byte1 = bytes[opcode_bci - 1];
+  uint8_t byte2 = bytes[opcode_bci];
+
+  if (byte1 <= kPushTemporaryAndQuick7) {
+    // The quick push that follows is compiled as the next instruction.
+    cgen->PushSlot(TempSlot(byte1, num_args));
+    return true;
+  }
+  if (byte1 <= kPopIntoTemporaryAndJump3) {
+    // The jump that follows is compiled as the next instruction.
+    intptr_t index = byte1 & 3;
+    if (index < num_args) return false;
+    cgen->PopIntoSlot(TempSlot(index, num_args));
+    return true;
+  }
+  if (byte1 == kExtendedJump) {
+    intptr_t delta = static_cast<int8_t>(byte2) * 256 + bytes[opcode_bci + 2];
+    if (delta < 0) {
+      cgen->Poll(bci);
+    }
+    cgen->Jump(next_bci + delta);
+    return true;
+  }
+  if (byte1 == kExtendedBranchTrue || byte1 == kExtendedBranchFalse) {
+    intptr_t delta = (byte2 << 8) + bytes[opcode_bci + 2];
+    cgen->Branch(byte1 == kExtendedBranchTrue, next_bci + delta, bci);
+    return true;
+  }
+  if (byte1 >= kPushLiteral0 && byte1 <= kPushLiteral31) {
+    intptr_t index = byte1 - kPushLiteral0;
+    // Past the end is the mixin hack in Interpreter::PushLiteral.
+    if (index >= num_literals) return false;
+    cgen->PushLiteral(index);
+    return true;
+  }
+  if (byte1 >= kPushTemporary0 && byte1 <= kPushTemporary11) {
+    cgen->PushSlot(TempSlot(byte1 - kPushTemporary0, num_args));
+    return true;
+  }
+  switch (byte1) {
+    case kPushReceiver:
+      cgen->PushSlot(-4);
+      return true;
+    case kPushSpecial:
+      switch (extB) {
+        case 0: cgen->PushFalse(); return true;
+        case 1: cgen->PushTrue(); return true;
+        case 2: cgen->PushNil(); return true;
+        default: return false;
+      }
+    case kPushZero:
+      cgen->PushSmallInteger(0);
+      return true;
+    case kPushOne:
+      cgen->PushSmallInteger(1);
+      return true;
+#if STATIC_PREDICTION_BYTECODES
+    case kSendAdd:
+      cgen->SmallIntegerOperation(CodeGenerator::kAdd, bci);
+      return true;
+    case kSendSubtract:
+      cgen->SmallIntegerOperation(CodeGenerator::kSubtract, bci);
+      return true;
+    case kSendLess:
+      cgen->SmallIntegerOperation(CodeGenerator::kLess, bci);
+      return true;
+    case kSendGreater:
+      cgen->SmallIntegerOperation(CodeGenerator::kGreater, bci);
+      return true;
+    case kSendLessEqual:
+      cgen->SmallIntegerOperation(CodeGenerator::kLessEqual, bci);
+      return true;
+    case kSendGreaterEqual:
+      cgen->SmallIntegerOperation(CodeGenerator::kGreaterEqual, bci);
+      return true;
+    case kSendEqual:
+      cgen->SmallIntegerOperation(CodeGenerator::kEqual, bci);
+      return true;
+    case kSendNotEqual:
+      cgen->SmallIntegerOperation(CodeGenerator::kNotEqual, bci);
+      return true;
+    case kSendMultiply:
+      cgen->SmallIntegerOperation(CodeGenerator::kMultiply, bci);
+      return true;
+    case kSendBitAnd:
+      cgen->SmallIntegerOperation(CodeGenerator::kBitAnd, bci);
+      return true;
+    case kSendBitOr:
+      cgen->SmallIntegerOperation(CodeGenerator::kBitOr, bci);
+      return true;
+#endif  // STATIC_PREDICTION_BYTECODES
+    case kDup:
+      cgen->Dup();
+      return true;
+    case kPop:
+      cgen->Drop();
+      return true;
+    case kPushLiteral: {
+      intptr_t index = byte2 + extA * 256;
+      if (index >= num_literals) return false;
+      cgen->PushLiteral(index);
+      return true;
+    }
+    case kPushInteger:
+      cgen->PushSmallInteger((extB << 8) + byte2);
+      return true;
+    case kPushTemporary:
+      cgen->PushSlot(TempSlot(byte2, num_args));
+      return true;
+    case kStoreIntoTemporary:
+      if (byte2 < num_args) return false;
+      cgen->StoreIntoSlot(TempSlot(byte2, num_args));
+      return true;
+    case kPopIntoTemporary:
+      if (byte2 < num_args) return false;
+      cgen->PopIntoSlot(TempSlot(byte2, num_args));
+      return true;
+    case kJump: {
+      intptr_t delta = (extB << 8) + byte2;
+      if (delta < 0) {
+        cgen->Poll(bci);
+      }
+      cgen->Jump(next_bci + delta);
+      return true;
+    }
+    case kBranchTrue:
+    case kBranchFalse:
+      cgen->Branch(byte1 == kBranchTrue, next_bci + (extB << 8) + byte2, bci);
+      return true;
+    default:
+      if (byte1 >= kPopIntoTemporary0 && byte1 <= kPopIntoTemporary7) {
+        intptr_t index = byte1 & 7;
+        if (index < num_args) return false;
+        cgen->PopIntoSlot(TempSlot(index, num_args));
+        return true;
+      }
+      return false;
+  }
+}
+
+
+NativeCode* NativeCode::Compile(Method method) {
+  ASSERT(method->IsOldObject());
+  ByteArray bytecode = method->bytecode();
+  const uint8_t* bytes = bytecode->element_addr(0);
+  intptr_t num_bcis = bytecode->Size();
+  intptr_t num_args = method->NumArgs();
+  intptr_t num_literals = method->literals()->Size();
+
+  CodeGenerator cgen(num_bcis);
+  cgen.EmitEntryStub();
+
+  uint32_t* entries = new uint32_t[num_bcis + 2];
+  for (intptr_t i = 0; i < num_bcis + 2; i++) {
+    entries[i] = 0;
+  }
+
+  // The units in order, and whether each was translated.
+  intptr_t* units = new intptr_t[num_bcis + 1];
+  intptr_t num_units = 0;
+
+  intptr_t bci = 1;
+  while (bci <= num_bcis) {
+    // An instruction together with its extensions.
+    intptr_t extA = 0;
+    intptr_t extB = 0;
+    intptr_t next_bci = bci;
+    uint8_t byte1 = bytes[next_bci - 1];
+    while ((byte1 == kExtendA || byte1 == kExtendB) &&
+           (next_bci + 2 <= num_bcis)) {
+      uint8_t byte2 = bytes[next_bci];
+      if (byte1 == kExtendA) {
+        extA = (extA << 8) + byte2;
+      } else if (extB == 0 && byte2 > 127) {
+        extB = byte2 - 256;
+      } else {
+        extB = (extB << 8) + byte2;
+      }
+      next_bci += 2;
+      byte1 = bytes[next_bci - 1];
+    }
+    intptr_t length;
+    if (byte1 >= kExtendedJump && byte1 <= kExtendedBranchFalse) {
+      length = 4;  // Fused with the jump or branch that follows the extension.
+    } else {
+      length = InstructionLength(byte1);
+    }
+    intptr_t opcode_bci = next_bci;
+    next_bci += length;
+    if (next_bci > num_bcis + 1) {
+      break;  // Truncated.
+    }
+
+    cgen.Bind(bci);
+    if (Translate(&cgen, bytes, bci, opcode_bci, next_bci, extA, extB,
+                  num_args, num_literals)) {
+      entries[bci] = cgen.OffsetOf(bci);
+    } else {
+      cgen.Exit(bci);
+    }
+    units[num_units++] = bci;
+
+    if (byte1 == kPushClosure) {
+      // Skip the closure's body.
+      uint8_t byte3 = bytes[next_bci - 2];
+      next_bci += byte3 + (extB << 8);
+    }
+    bci = next_bci;
+  }
+
+  // Entering and exiting native code costs about as much as interpreting a
+  // few instructions, so only enter where a run of them is compiled.
+  intptr_t run = 0;
+  bool any_entry = false;
+  for (intptr_t i = num_units - 1; i >= 0; i--) {
+    intptr_t unit = units[i];
+    if (entries[unit] == 0) {
+      run = 0;
+      continue;
+    }
+    run++;
+    if (run < kMinimumRun) {
+      entries[unit] = 0;
+    } else {
+      any_entry = true;
+    }
+  }
+  delete[] units;
+
+  if (!any_entry || !cgen.Finalize()) {
+    delete[] entries;
+    return nullptr;
+  }
+
+  VirtualMemory memory =
+      VirtualMemory::Allocate(cgen.size(), VirtualMemory::kReadWrite,
+                              "primordialsoup-code");
+  memcpy(reinterpret_cast<void*>(memory.base()), cgen.buffer(), cgen.size());
+#if defined(ARCH_ARM64)
+  __builtin___clear_cache(reinterpret_cast<char*>(memory.base()),
+                          reinterpret_cast<char*>(memory.base() + cgen.size()));
+#endif
+  if (!memory.Protect(VirtualMemory::kReadExecute)) {
+    memory.Free();
+    delete[] entries;
+    return nullptr;
+  }
+  PerfMap::AddCode(memory.base(), cgen.size(), method);
+  return new NativeCode(memory, num_bcis, entries);
+}
+
+
+NativeCode::~NativeCode() {
+  memory_.Free();
+  delete[] entries_;
+}
+
+
+NativeCodeCache::NativeCodeCache() {
+  for (intptr_t i = 0; i < kSize; i++) {
+    entries_[i].method = nullptr;
+    entries_[i].count = 0;
+    entries_[i].code = nullptr;
+  }
+}
+
+
+NativeCodeCache::~NativeCodeCache() {
+  Flush();
+}
+
+
+void NativeCodeCache::Insert(Method method) {
+  if (!method->IsOldObject()) {
+    return;
+  }
+  intptr_t hash = Hash(method);
+  Entry* entry = &entries_[hash & kMask];
+  if (entry->code != nullptr) {
+    // Prefer evicting a method that is not compiled.
+    Entry* other = &entries_[(hash >> 3) & kMask];
+    if (other->code == nullptr) {
+      entry = other;
+    } else {
+      delete entry->code;
+    }
+  }
+  entry->method = method;
+  entry->count = 1;
+  entry->code = nullptr;
+}
+
+
+void NativeCodeCache::Flush() {
+  for (intptr_t i = 0; i < kSize; i++) {
+    delete entries_[i].code;
+    entries_[i].method = nullptr;
+    entries_[i].count = 0;
+    entries_[i].code = nullptr;
+  }
+}
+
+}  // namespace psoup
+
+#endif  // defined(USE_BASELINE_JIT)
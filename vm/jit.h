@@ -0,0 +1,257 @@
+// Copyright (c) 2016, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_JIT_H_
+#define VM_JIT_H_
+
+#include "vm/flags.h"
+#include "vm/globals.h"
+#include "vm/object.h"
+#include "vm/virtual_memory.h"
+
+#if BASELINE_JIT && (defined(ARCH_X64) || defined(ARCH_ARM64)) &&             \
+    !defined(OS_EMSCRIPTEN)
+#define USE_BASELINE_JIT 1
+#endif
+
+namespace psoup {
+
+// A baseline JIT for the straight-line parts of methods.
+//
+// Native code runs on the interpreter's stack and never builds frames of its
+// own: it covers pushes, pops, stores into temporaries, jumps, branches and
+// SmallInteger arithmetic, and exits back to the interpreter at the first
+// instruction it does not cover, such as a send, a return, or an arithmetic
+// send whose operands are not SmallIntegers. Exiting answers the BCI of that
+// instruction, and the interpreter carries on as if it had executed everything
+// before it. So the frame layout, EnsureActivation, the GC's StackPointers
+// and non-local return are unaffected, and native code needs no GC maps or
+// deoptimization. Backward jumps exit when the interpreter's poll word is set,
+// so the interpreter polls there as it would for its own jumps.
+//
+// The interpreter enters native code after activating a method and after
+// returning into one. Compiled instructions are only those of the method
+// itself: its closures' bodies keep running in the interpreter, because their
+// frames have a different number of arguments. Native code does not allocate,
+// so no GC happens while it runs, and it refers to heap objects only through
+// the NativeState, never as embedded constants.
+
+// Exchanged with native code, which keeps sp and fp in registers and writes sp
+// back when it exits.
+struct NativeState {
+  Object* sp;
+  Object* fp;
+  Object* literals;
+  Object nil_obj;
+  Object false_obj;
+  Object true_obj;
+  const volatile uword* poll_word;
+};
+
+class NativeCode {
+ public:
+  // The fewest instructions an entry must run in native code before its
+  // first exit.
+  static const intptr_t kMinimumRun = 4;
+
+  // Answers nullptr if no instruction of the method could be compiled, or if
+  // executable memory is not available.
+  static NativeCode* Compile(Method method);
+  ~NativeCode();
+
+  bool HasEntry(intptr_t bci) const {
+    ASSERT((bci >= 1) && (bci <= num_bcis_ + 1));
+    return entries_[bci] != 0;
+  }
+
+  // Runs from the instruction at bci until an instruction left to the
+  // interpreter, and answers that instruction's BCI.
+  intptr_t Run(NativeState* state, intptr_t bci) const {
+    ASSERT(HasEntry(bci));
+    typedef intptr_t (*Stub)(NativeState* state, uword entry);
+    Stub stub = reinterpret_cast<Stub>(memory_.base());
+    return stub(state, memory_.base() + entries_[bci]);
+  }
+
+ private:
+  NativeCode(VirtualMemory memory, intptr_t num_bcis, uint32_t* entries)
+      : memory_(memory), num_bcis_(num_bcis), entries_(entries) {}
+
+  VirtualMemory memory_;
+  intptr_t num_bcis_;
+  uint32_t* entries_;  // Code offsets, indexed by BCI. 0 marks no entry.
+
+  DISALLOW_COPY_AND_ASSIGN(NativeCode);
+};
+
+// Emits native code for one method. The instruction templates are in
+// jit_x64.cc and jit_arm64.cc, the rest in jit.cc.
+class CodeGenerator {
+ public:
+  enum Operation {
+    kAdd,
+    kSubtract,
+    kMultiply,
+    kBitAnd,
+    kBitOr,
+    kLess,
+    kGreater,
+    kLessEqual,
+    kGreaterEqual,
+    kEqual,
+    kNotEqual,
+  };
+
+  explicit CodeGenerator(intptr_t num_bcis);
+  ~CodeGenerator();
+
+  // The stub the NativeCode runs through, at offset 0.
+  void EmitEntryStub();
+
+  // Marks the code for the instruction at bci.
+  void Bind(intptr_t bci);
+
+  // Slots are word offsets from fp.
+  void PushSlot(intptr_t slot);
+  void StoreIntoSlot(intptr_t slot);
+  void PopIntoSlot(intptr_t slot);
+  void PushLiteral(intptr_t index);
+  void PushNil();
+  void PushFalse();
+  void PushTrue();
+  void PushSmallInteger(intptr_t value);
+  void Dup();
+  void Drop();
+
+  // Replaces the top two elements with the result, or exits at bci if they
+  // are not both SmallIntegers or the result overflows.
+  void SmallIntegerOperation(Operation op, intptr_t bci);
+
+  void Jump(intptr_t target_bci);
+  // Exits at bci if the interpreter has a poll request.
+  void Poll(intptr_t bci);
+  // Pops the top and branches if it is the given boolean. Exits at bci
+  // without popping if it is not a boolean.
+  void Branch(bool if_true, intptr_t target_bci, intptr_t bci);
+  void Exit(intptr_t bci);
+
+  // Resolves jumps and emits the exits of the slow paths. Answers false if a
+  // jump targets an instruction that was not bound.
+  bool Finalize();
+
+  intptr_t size() const { return size_; }
+  const uint8_t* buffer() const { return buffer_; }
+  // Answers the code offset of the instruction at bci, or 0.
+  uint32_t OffsetOf(intptr_t bci) const { return offsets_[bci]; }
+
+  void Emit8(uint8_t value);
+  void Emit32(uint32_t value);
+  void Patch32(intptr_t position, uint32_t value);
+  uint32_t Read32(intptr_t position) const;
+
+ private:
+  enum FixupKind {
+    kJumpFixup,
+    kExitFixup,
+  };
+
+  struct Fixup {
+    intptr_t position;
+    intptr_t bci;
+    FixupKind kind;
+  };
+
+  void AddFixup(intptr_t position, intptr_t bci, FixupKind kind);
+
+  // Emits the exit for a slow path, shared by every slow path exiting at the
+  // same BCI.
+  void EmitExitStub(intptr_t bci);
+  // Points the branch at position to the code at target.
+  void PatchBranch(intptr_t position, intptr_t target);
+
+  uint8_t* buffer_;
+  intptr_t size_;
+  intptr_t capacity_;
+  intptr_t num_bcis_;
+  uint32_t* offsets_;  // Indexed by BCI.
+  uint32_t* exit_stubs_;  // Indexed by BCI.
+  Fixup* fixups_;
+  intptr_t num_fixups_;
+  intptr_t fixups_capacity_;
+  intptr_t exit_;  // Offset of the shared exit sequence.
+
+  DISALLOW_COPY_AND_ASSIGN(CodeGenerator);
+};
+
+// Counts method activations and remembers their native code. Keyed by method
+// address, so it only admits old-space methods, and must be flushed whenever
+// an old-space object might be freed or forwarded.
+class NativeCodeCache {
+ public:
+  static const intptr_t kCompileThreshold = 512;
+
+  NativeCodeCache();
+  ~NativeCodeCache();
+
+  // Counts an activation, compiling the method when it becomes hot. Answers
+  // the method's native code or nullptr.
+  INLINE
+  const NativeCode* Activated(Method method) {
+    Entry* entry = Find(method);
+    if (entry == nullptr) {
+      Insert(method);
+      return nullptr;
+    }
+    if (entry->code == nullptr && ++entry->count == kCompileThreshold) {
+      entry->code = NativeCode::Compile(method);
+    }
+    return entry->code;
+  }
+
+  INLINE
+  const NativeCode* Lookup(Method method) {
+    Entry* entry = Find(method);
+    return entry == nullptr ? nullptr : entry->code;
+  }
+
+  void Flush();
+
+ private:
+  struct Entry {
+    Method method;
+    intptr_t count;
+    NativeCode* code;
+  };
+
+  static const intptr_t kSize = 1024;
+  static const intptr_t kMask = kSize - 1;
+
+  static intptr_t Hash(Method method) {
+    return static_cast<intptr_t>(method) >> kObjectAlignmentLog2;
+  }
+
+  INLINE
+  Entry* Find(Method method) {
+    intptr_t hash = Hash(method);
+    Entry* entry = &entries_[hash & kMask];
+    if (entry->method == method) {
+      return entry;
+    }
+    entry = &entries_[(hash >> 3) & kMask];
+    if (entry->method == method) {
+      return entry;
+    }
+    return nullptr;
+  }
+
+  NOINLINE void Insert(Method method);
+
+  Entry entries_[kSize];
+
+  DISALLOW_COPY_AND_ASSIGN(NativeCodeCache);
+};
+
+}  // namespace psoup
+
+#endif  // VM_JIT_H_
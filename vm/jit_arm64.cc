@@ -0,0 +1,326 @@
+// Copyright (c) 2016, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/jit.h"
+
+#if defined(USE_BASELINE_JIT) && defined(ARCH_ARM64)
+
+#include <stddef.h>
+
+namespace psoup {
+
+enum Register {
+  X0 = 0,
+  X1 = 1,
+  X9 = 9,
+  X10 = 10,
+  X11 = 11,
+  X12 = 12,
+  X13 = 13,
+  X16 = 16,
+  X19 = 19,
+  X20 = 20,
+  X21 = 21,
+  X22 = 22,
+  SP = 31,  // As the base of a load or store.
+  ZR = 31,  // Otherwise.
+};
+
+enum Condition {
+  EQ = 0x0,
+  NE = 0x1,
+  VS = 0x6,
+  GE = 0xA,
+  LT = 0xB,
+  GT = 0xC,
+  LE = 0xD,
+};
+
+// Callee-saved.
+static const Register kState = X19;
+static const Register kSP = X20;
+static const Register kFP = X21;
+static const Register kLiterals = X22;
+
+static void LoadImmediate(CodeGenerator* cgen, Register rd, int64_t value) {
+  if ((value >= 0) && (value < 65536)) {
+    cgen->Emit32(0xD2800000 | (value << 5) | rd);  // movz
+  } else if ((value < 0) && (~value < 65536)) {
+    cgen->Emit32(0x92800000 | (~value << 5) | rd);  // movn
+  } else {
+    uint64_t bits = static_cast<uint64_t>(value);
+    cgen->Emit32(0xD2800000 | ((bits & 0xFFFF) << 5) | rd);  // movz
+    for (intptr_t hw = 1; hw < 4; hw++) {
+      uint64_t part = (bits >> (16 * hw)) & 0xFFFF;
+      if (part != 0) {
+        cgen->Emit32(0xF2800000 | (hw << 21) | (part << 5) | rd);  // movk
+      }
+    }
+  }
+}
+
+
+// ldr rt, [rn, #offset]
+static void LoadWord(CodeGenerator* cgen,
+                     Register rt,
+                     Register rn,
+                     intptr_t offset) {
+  if ((offset >= 0) && (offset < 32768) && ((offset & 7) == 0)) {
+    cgen->Emit32(0xF9400000 | ((offset >> 3) << 10) | (rn << 5) | rt);
+  } else if ((offset >= -256) && (offset < 256)) {
+    cgen->Emit32(0xF8400000 | ((offset & 0x1FF) << 12) | (rn << 5) | rt);
+  } else {
+    LoadImmediate(cgen, X16, offset);
+    cgen->Emit32(0xF8606800 | (X16 << 16) | (rn << 5) | rt);
+  }
+}
+
+
+// str rt, [rn, #offset]
+static void StoreWord(CodeGenerator* cgen,
+                      Register rt,
+                      Register rn,
+                      intptr_t offset) {
+  if ((offset >= 0) && (offset < 32768) && ((offset & 7) == 0)) {
+    cgen->Emit32(0xF9000000 | ((offset >> 3) << 10) | (rn << 5) | rt);
+  } else if ((offset >= -256) && (offset < 256)) {
+    cgen->Emit32(0xF8000000 | ((offset & 0x1FF) << 12) | (rn << 5) | rt);
+  } else {
+    LoadImmediate(cgen, X16, offset);
+    cgen->Emit32(0xF8206800 | (X16 << 16) | (rn << 5) | rt);
+  }
+}
+
+
+// Pushes onto the interpreter's stack: str rt, [sp, #-8]!
+static void PushValue(CodeGenerator* cgen, Register rt) {
+  cgen->Emit32(0xF8000C00 | ((-kWordSize & 0x1FF) << 12) | (kSP << 5) | rt);
+}
+
+
+// str rt, [sp, #8]!
+static void ReplaceTopTwo(CodeGenerator* cgen, Register rt) {
+  cgen->Emit32(0xF8000C00 | ((kWordSize & 0x1FF) << 12) | (kSP << 5) | rt);
+}
+
+
+// add sp, sp, #8
+static void DropOne(CodeGenerator* cgen) {
+  cgen->Emit32(0x91000000 | (kWordSize << 10) | (kSP << 5) | kSP);
+}
+
+
+// cmp rn, rm
+static void Compare(CodeGenerator* cgen, Register rn, Register rm) {
+  cgen->Emit32(0xEB000000 | (rm << 16) | (rn << 5) | ZR);
+}
+
+
+void CodeGenerator::EmitEntryStub() {
+  ASSERT(size_ == 0);
+  // stp x19, x20, [csp, #-32]!
+  Emit32(0xA9800000 | ((-4 & 0x7F) << 15) | (X20 << 10) | (SP << 5) | X19);
+  // stp x21, x22, [csp, #16]
+  Emit32(0xA9000000 | (2 << 15) | (X22 << 10) | (SP << 5) | X21);
+  Emit32(0xAA0003E0 | (X0 << 16) | kState);  // mov x19, x0
+  LoadWord(this, kSP, kState, offsetof(NativeState, sp));
+  LoadWord(this, kFP, kState, offsetof(NativeState, fp));
+  LoadWord(this, kLiterals, kState, offsetof(NativeState, literals));
+  Emit32(0xD61F0000 | (X1 << 5));  // br x1
+
+  // The exit sequence. X0 holds the BCI to continue at.
+  exit_ = size_;
+  StoreWord(this, kSP, kState, offsetof(NativeState, sp));
+  // ldp x21, x22, [csp, #16]
+  Emit32(0xA9400000 | (2 << 15) | (X22 << 10) | (SP << 5) | X21);
+  // ldp x19, x20, [csp], #32
+  Emit32(0xA8C00000 | (4 << 15) | (X20 << 10) | (SP << 5) | X19);
+  Emit32(0xD65F03C0);  // ret
+}
+
+
+void CodeGenerator::PushSlot(intptr_t slot) {
+  LoadWord(this, X9, kFP, slot * kWordSize);
+  PushValue(this, X9);
+}
+
+
+void CodeGenerator::StoreIntoSlot(intptr_t slot) {
+  LoadWord(this, X9, kSP, 0);
+  StoreWord(this, X9, kFP, slot * kWordSize);
+}
+
+
+void CodeGenerator::PopIntoSlot(intptr_t slot) {
+  // ldr x9, [sp], #8
+  Emit32(0xF8400400 | ((kWordSize & 0x1FF) << 12) | (kSP << 5) | X9);
+  StoreWord(this, X9, kFP, slot * kWordSize);
+}
+
+
+void CodeGenerator::PushLiteral(intptr_t index) {
+  LoadWord(this, X9, kLiterals, index * kWordSize);
+  PushValue(this, X9);
+}
+
+
+void CodeGenerator::PushNil() {
+  LoadWord(this, X9, kState, offsetof(NativeState, nil_obj));
+  PushValue(this, X9);
+}
+
+
+void CodeGenerator::PushFalse() {
+  LoadWord(this, X9, kState, offsetof(NativeState, false_obj));
+  PushValue(this, X9);
+}
+
+
+void CodeGenerator::PushTrue() {
+  LoadWord(this, X9, kState, offsetof(NativeState, true_obj));
+  PushValue(this, X9);
+}
+
+
+void CodeGenerator::PushSmallInteger(intptr_t value) {
+  LoadImmediate(this, X9, static_cast<intptr_t>(SmallInteger::New(value)));
+  PushValue(this, X9);
+}
+
+
+void CodeGenerator::Dup() {
+  LoadWord(this, X9, kSP, 0);
+  PushValue(this, X9);
+}
+
+
+void CodeGenerator::Drop() {
+  DropOne(this);
+}
+
+
+void CodeGenerator::SmallIntegerOperation(Operation op, intptr_t bci) {
+  LoadWord(this, X9, kSP, kWordSize);  // Left.
+  LoadWord(this, X10, kSP, 0);  // Right.
+  Emit32(0xAA000000 | (X10 << 16) | (X9 << 5) | X11);  // orr x11, x9, x10
+  Emit32(0xF240001F | (X11 << 5));  // tst x11, #kSmiTagMask
+  AddFixup(size_, bci, kExitFixup);
+  Emit32(0x54000000 | NE);  // b.ne exit
+
+  Condition condition;
+  switch (op) {
+    case kAdd:
+      // Tagged arithmetic overflows exactly when the result is not a
+      // SmallInteger.
+      Emit32(0xAB000000 | (X10 << 16) | (X9 << 5) | X11);  // adds
+      AddFixup(size_, bci, kExitFixup);
+      Emit32(0x54000000 | VS);  // b.vs exit
+      ReplaceTopTwo(this, X11);
+      return;
+    case kSubtract:
+      Emit32(0xEB000000 | (X10 << 16) | (X9 << 5) | X11);  // subs
+      AddFixup(size_, bci, kExitFixup);
+      Emit32(0x54000000 | VS);  // b.vs exit
+      ReplaceTopTwo(this, X11);
+      return;
+    case kMultiply:
+      Emit32(0x9341FC00 | (X9 << 5) | X12);  // asr x12, x9, #1
+      Emit32(0x9B007C00 | (X10 << 16) | (X12 << 5) | X11);  // mul
+      Emit32(0x9B407C00 | (X10 << 16) | (X12 << 5) | X13);  // smulh
+      // The product fits in 64 bits iff the high half is the sign extension
+      // of the low half: cmp x13, x11, asr #63
+      Emit32(0xEB800000 | (X11 << 16) | (63 << 10) | (X13 << 5) | ZR);
+      AddFixup(size_, bci, kExitFixup);
+      Emit32(0x54000000 | NE);  // b.ne exit
+      ReplaceTopTwo(this, X11);
+      return;
+    case kBitAnd:
+      Emit32(0x8A000000 | (X10 << 16) | (X9 << 5) | X11);  // and
+      ReplaceTopTwo(this, X11);
+      return;
+    case kBitOr:
+      Emit32(0xAA000000 | (X10 << 16) | (X9 << 5) | X11);  // orr
+      ReplaceTopTwo(this, X11);
+      return;
+    case kLess: condition = LT; break;
+    case kGreater: condition = GT; break;
+    case kLessEqual: condition = LE; break;
+    case kGreaterEqual: condition = GE; break;
+    case kEqual: condition = EQ; break;
+    case kNotEqual: condition = NE; break;
+    default:
+      UNREACHABLE();
+      return;
+  }
+  Compare(this, X9, X10);
+  LoadWord(this, X11, kState, offsetof(NativeState, true_obj));
+  LoadWord(this, X12, kState, offsetof(NativeState, false_obj));
+  // csel x11, x11, x12, condition
+  Emit32(0x9A800000 | (X12 << 16) | (condition << 12) | (X11 << 5) | X11);
+  ReplaceTopTwo(this, X11);
+}
+
+
+void CodeGenerator::Jump(intptr_t target_bci) {
+  AddFixup(size_, target_bci, kJumpFixup);
+  Emit32(0x14000000);  // b
+}
+
+
+void CodeGenerator::Poll(intptr_t bci) {
+  LoadWord(this, X9, kState, offsetof(NativeState, poll_word));
+  LoadWord(this, X9, X9, 0);
+  Emit32(0xF100001F | (X9 << 5));  // cmp x9, #0
+  AddFixup(size_, bci, kExitFixup);
+  Emit32(0x54000000 | NE);  // b.ne exit
+}
+
+
+void CodeGenerator::Branch(bool if_true, intptr_t target_bci, intptr_t bci) {
+  intptr_t taken = if_true ? offsetof(NativeState, true_obj)
+                           : offsetof(NativeState, false_obj);
+  intptr_t not_taken = if_true ? offsetof(NativeState, false_obj)
+                               : offsetof(NativeState, true_obj);
+  LoadWord(this, X9, kSP, 0);
+  LoadWord(this, X10, kState, taken);
+  Compare(this, X9, X10);
+  Emit32(0x54000000 | (3 << 5) | NE);  // b.ne over the taken path
+  DropOne(this);
+  Jump(target_bci);
+
+  LoadWord(this, X10, kState, not_taken);
+  Compare(this, X9, X10);
+  AddFixup(size_, bci, kExitFixup);
+  Emit32(0x54000000 | NE);  // b.ne exit
+  DropOne(this);
+}
+
+
+void CodeGenerator::Exit(intptr_t bci) {
+  LoadImmediate(this, X0, bci);
+  intptr_t delta = (exit_ - size_) >> 2;
+  Emit32(0x14000000 | (delta & 0x3FFFFFF));  // b exit
+}
+
+
+void CodeGenerator::EmitExitStub(intptr_t bci) {
+  Exit(bci);
+}
+
+
+void CodeGenerator::PatchBranch(intptr_t position, intptr_t target) {
+  uint32_t instr = Read32(position);
+  intptr_t delta = (target - position) >> 2;
+  if ((instr & 0xFC000000) == 0x14000000) {
+    instr |= delta & 0x3FFFFFF;  // b
+  } else {
+    ASSERT((instr & 0xFF000010) == 0x54000000);
+    instr |= (delta & 0x7FFFF) << 5;  // b.cond
+  }
+  Patch32(position, instr);
+}
+
+}  // namespace psoup
+
+#endif  // defined(USE_BASELINE_JIT) && defined(ARCH_ARM64)
@@ -0,0 +1,384 @@
+// Copyright (c) 2016, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/jit.h"
+
+#if defined(USE_BASELINE_JIT) && defined(ARCH_X64)
+
+#include <stddef.h>
+
+namespace psoup {
+
+enum Register {
+  RAX = 0,
+  RCX = 1,
+  RDX = 2,
+  RBX = 3,
+  RSP = 4,
+  RBP = 5,
+  RSI = 6,
+  RDI = 7,
+  R8 = 8,
+  R9 = 9,
+  R10 = 10,
+  R11 = 11,
+  R12 = 12,
+  R13 = 13,
+  R14 = 14,
+  R15 = 15,
+};
+
+enum Condition {
+  OVERFLOW = 0x0,
+  EQUAL = 0x4,
+  NOT_EQUAL = 0x5,
+  LESS = 0xC,
+  GREATER_EQUAL = 0xD,
+  LESS_EQUAL = 0xE,
+  GREATER = 0xF,
+};
+
+// Callee-saved in both the System V and Windows ABIs.
+static const Register kState = RBX;
+static const Register kSP = R12;
+static const Register kFP = R13;
+static const Register kLiterals = R14;
+
+#if defined(OS_WINDOWS)
+static const Register kArg0 = RCX;
+static const Register kArg1 = RDX;
+#else
+static const Register kArg0 = RDI;
+static const Register kArg1 = RSI;
+#endif
+
+static void EmitRex(CodeGenerator* cgen, Register reg, Register rm) {
+  cgen->Emit8(0x48 | ((reg >> 3) << 2) | (rm >> 3));
+}
+
+
+// ModRM (and SIB) for [base + disp].
+static void EmitOperand(CodeGenerator* cgen,
+                        Register reg,
+                        Register base,
+                        intptr_t disp) {
+  uint8_t mod;
+  if ((disp == 0) && ((base & 7) != RBP)) {
+    mod = 0;
+  } else if ((disp >= -128) && (disp <= 127)) {
+    mod = 1;
+  } else {
+    mod = 2;
+  }
+  cgen->Emit8((mod << 6) | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP) {
+    cgen->Emit8(0x24);
+  }
+  if (mod == 1) {
+    cgen->Emit8(disp);
+  } else if (mod == 2) {
+    cgen->Emit32(disp);
+  }
+}
+
+
+// mov dst, [base + disp]
+static void Load(CodeGenerator* cgen,
+                 Register dst,
+                 Register base,
+                 intptr_t disp) {
+  EmitRex(cgen, dst, base);
+  cgen->Emit8(0x8B);
+  EmitOperand(cgen, dst, base, disp);
+}
+
+
+// mov [base + disp], src
+static void Store(CodeGenerator* cgen,
+                  Register base,
+                  intptr_t disp,
+                  Register src) {
+  EmitRex(cgen, src, base);
+  cgen->Emit8(0x89);
+  EmitOperand(cgen, src, base, disp);
+}
+
+
+// op dst, src, for the "op r/m64, r64" forms.
+static void EmitRegReg(CodeGenerator* cgen,
+                       uint8_t opcode,
+                       Register dst,
+                       Register src) {
+  EmitRex(cgen, src, dst);
+  cgen->Emit8(opcode);
+  cgen->Emit8(0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+
+static void AddImmediate(CodeGenerator* cgen, Register reg, int8_t imm) {
+  EmitRex(cgen, RAX, reg);
+  cgen->Emit8(0x83);
+  if (imm >= 0) {
+    cgen->Emit8(0xC0 | (reg & 7));  // /0: add
+    cgen->Emit8(imm);
+  } else {
+    cgen->Emit8(0xE8 | (reg & 7));  // /5: sub
+    cgen->Emit8(-imm);
+  }
+}
+
+
+static void PushRegister(CodeGenerator* cgen, Register reg) {
+  if (reg >= R8) cgen->Emit8(0x41);
+  cgen->Emit8(0x50 | (reg & 7));
+}
+
+
+static void PopRegister(CodeGenerator* cgen, Register reg) {
+  if (reg >= R8) cgen->Emit8(0x41);
+  cgen->Emit8(0x58 | (reg & 7));
+}
+
+
+// Pushes onto the interpreter's stack.
+static void PushValue(CodeGenerator* cgen, Register reg) {
+  AddImmediate(cgen, kSP, -kWordSize);
+  Store(cgen, kSP, 0, reg);
+}
+
+
+static void ReplaceTopTwo(CodeGenerator* cgen, Register reg) {
+  AddImmediate(cgen, kSP, kWordSize);
+  Store(cgen, kSP, 0, reg);
+}
+
+
+void CodeGenerator::EmitEntryStub() {
+  ASSERT(size_ == 0);
+  PushRegister(this, RBX);
+  PushRegister(this, R12);
+  PushRegister(this, R13);
+  PushRegister(this, R14);
+  EmitRegReg(this, 0x89, kState, kArg0);
+  Load(this, kSP, kState, offsetof(NativeState, sp));
+  Load(this, kFP, kState, offsetof(NativeState, fp));
+  Load(this, kLiterals, kState, offsetof(NativeState, literals));
+  Emit8(0xFF);  // jmp arg1
+  Emit8(0xE0 | (kArg1 & 7));
+
+  // The exit sequence. RAX holds the BCI to continue at.
+  exit_ = size_;
+  Store(this, kState, offsetof(NativeState, sp), kSP);
+  PopRegister(this, R14);
+  PopRegister(this, R13);
+  PopRegister(this, R12);
+  PopRegister(this, RBX);
+  Emit8(0xC3);  // ret
+}
+
+
+void CodeGenerator::PushSlot(intptr_t slot) {
+  Load(this, RAX, kFP, slot * kWordSize);
+  PushValue(this, RAX);
+}
+
+
+void CodeGenerator::StoreIntoSlot(intptr_t slot) {
+  Load(this, RAX, kSP, 0);
+  Store(this, kFP, slot * kWordSize, RAX);
+}
+
+
+void CodeGenerator::PopIntoSlot(intptr_t slot) {
+  Load(this, RAX, kSP, 0);
+  AddImmediate(this, kSP, kWordSize);
+  Store(this, kFP, slot * kWordSize, RAX);
+}
+
+
+void CodeGenerator::PushLiteral(intptr_t index) {
+  Load(this, RAX, kLiterals, index * kWordSize);
+  PushValue(this, RAX);
+}
+
+
+void CodeGenerator::PushNil() {
+  Load(this, RAX, kState, offsetof(NativeState, nil_obj));
+  PushValue(this, RAX);
+}
+
+
+void CodeGenerator::PushFalse() {
+  Load(this, RAX, kState, offsetof(NativeState, false_obj));
+  PushValue(this, RAX);
+}
+
+
+void CodeGenerator::PushTrue() {
+  Load(this, RAX, kState, offsetof(NativeState, true_obj));
+  PushValue(this, RAX);
+}
+
+
+void CodeGenerator::PushSmallInteger(intptr_t value) {
+  intptr_t tagged = static_cast<intptr_t>(SmallInteger::New(value));
+  if (static_cast<int32_t>(tagged) == tagged) {
+    EmitRex(this, RAX, RAX);
+    Emit8(0xC7);  // mov rax, simm32
+    Emit8(0xC0);
+    Emit32(tagged);
+  } else {
+    EmitRex(this, RAX, RAX);
+    Emit8(0xB8);  // mov rax, imm64
+    Emit32(tagged);
+    Emit32(static_cast<uint64_t>(tagged) >> 32);
+  }
+  PushValue(this, RAX);
+}
+
+
+void CodeGenerator::Dup() {
+  Load(this, RAX, kSP, 0);
+  PushValue(this, RAX);
+}
+
+
+void CodeGenerator::Drop() {
+  AddImmediate(this, kSP, kWordSize);
+}
+
+
+void CodeGenerator::SmallIntegerOperation(Operation op, intptr_t bci) {
+  Load(this, RAX, kSP, kWordSize);  // Left.
+  Load(this, RCX, kSP, 0);  // Right.
+  EmitRegReg(this, 0x89, RDX, RAX);  // mov rdx, rax
+  EmitRegReg(this, 0x09, RDX, RCX);  // or rdx, rcx
+  Emit8(0xF6);  // test dl, kSmiTagMask
+  Emit8(0xC2);
+  Emit8(kSmiTagMask);
+  Emit8(0x0F);  // jnz exit
+  Emit8(0x80 | NOT_EQUAL);
+  AddFixup(size_, bci, kExitFixup);
+  Emit32(0);
+
+  Condition condition;
+  switch (op) {
+    case kAdd:
+    case kSubtract:
+    case kMultiply:
+      // Tagged arithmetic overflows exactly when the result is not a
+      // SmallInteger.
+      if (op == kAdd) {
+        EmitRegReg(this, 0x01, RAX, RCX);
+      } else if (op == kSubtract) {
+        EmitRegReg(this, 0x29, RAX, RCX);
+      } else {
+        EmitRex(this, RAX, RAX);
+        Emit8(0xD1);  // sar rax, 1
+        Emit8(0xF8);
+        EmitRex(this, RAX, RCX);
+        Emit8(0x0F);  // imul rax, rcx
+        Emit8(0xAF);
+        Emit8(0xC1);
+      }
+      Emit8(0x0F);  // jo exit
+      Emit8(0x80 | OVERFLOW);
+      AddFixup(size_, bci, kExitFixup);
+      Emit32(0);
+      ReplaceTopTwo(this, RAX);
+      return;
+    case kBitAnd:
+      EmitRegReg(this, 0x21, RAX, RCX);
+      ReplaceTopTwo(this, RAX);
+      return;
+    case kBitOr:
+      EmitRegReg(this, 0x09, RAX, RCX);
+      ReplaceTopTwo(this, RAX);
+      return;
+    case kLess: condition = LESS; break;
+    case kGreater: condition = GREATER; break;
+    case kLessEqual: condition = LESS_EQUAL; break;
+    case kGreaterEqual: condition = GREATER_EQUAL; break;
+    case kEqual: condition = EQUAL; break;
+    case kNotEqual: condition = NOT_EQUAL; break;
+    default:
+      UNREACHABLE();
+      return;
+  }
+  EmitRegReg(this, 0x39, RAX, RCX);  // cmp rax, rcx
+  Load(this, RAX, kState, offsetof(NativeState, false_obj));
+  EmitRex(this, RAX, kState);
+  Emit8(0x0F);  // cmovcc rax, [state + true]
+  Emit8(0x40 | condition);
+  EmitOperand(this, RAX, kState, offsetof(NativeState, true_obj));
+  ReplaceTopTwo(this, RAX);
+}
+
+
+void CodeGenerator::Jump(intptr_t target_bci) {
+  Emit8(0xE9);
+  AddFixup(size_, target_bci, kJumpFixup);
+  Emit32(0);
+}
+
+
+void CodeGenerator::Poll(intptr_t bci) {
+  Load(this, RAX, kState, offsetof(NativeState, poll_word));
+  Load(this, RAX, RAX, 0);
+  EmitRegReg(this, 0x85, RAX, RAX);  // test rax, rax
+  Emit8(0x0F);  // jnz exit
+  Emit8(0x80 | NOT_EQUAL);
+  AddFixup(size_, bci, kExitFixup);
+  Emit32(0);
+}
+
+
+void CodeGenerator::Branch(bool if_true, intptr_t target_bci, intptr_t bci) {
+  intptr_t taken = if_true ? offsetof(NativeState, true_obj)
+                           : offsetof(NativeState, false_obj);
+  intptr_t not_taken = if_true ? offsetof(NativeState, false_obj)
+                               : offsetof(NativeState, true_obj);
+  Load(this, RAX, kSP, 0);
+  EmitRex(this, RAX, kState);
+  Emit8(0x3B);  // cmp rax, [state + taken]
+  EmitOperand(this, RAX, kState, taken);
+  Emit8(0x70 | NOT_EQUAL);  // jne over the taken path
+  intptr_t over = size_;
+  Emit8(0);
+  AddImmediate(this, kSP, kWordSize);
+  Jump(target_bci);
+  buffer_[over] = size_ - (over + 1);
+
+  EmitRex(this, RAX, kState);
+  Emit8(0x3B);  // cmp rax, [state + not_taken]
+  EmitOperand(this, RAX, kState, not_taken);
+  Emit8(0x0F);  // jne exit
+  Emit8(0x80 | NOT_EQUAL);
+  AddFixup(size_, bci, kExitFixup);
+  Emit32(0);
+  AddImmediate(this, kSP, kWordSize);
+}
+
+
+void CodeGenerator::Exit(intptr_t bci) {
+  Emit8(0xB8);  // mov eax, imm32
+  Emit32(bci);
+  Emit8(0xE9);  // jmp exit
+  Emit32(exit_ - (size_ + 4));
+}
+
+
+void CodeGenerator::EmitExitStub(intptr_t bci) {
+  Exit(bci);
+}
+
+
+void CodeGenerator::PatchBranch(intptr_t position, intptr_t target) {
+  // The rel32 of a jmp or jcc, relative to the end of the instruction.
+  Patch32(position, target - (position + 4));
+}
+
+}  // namespace psoup
+
+#endif  // defined(USE_BASELINE_JIT) && defined(ARCH_X64)
@@ -0,0 +1,266 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/json_scanner.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm/assert.h"
+
+namespace psoup {
+
+JSONScanner::JSONScanner(const uint8_t* bytes, intptr_t size)
+    : bytes_(bytes), size_(size), position_(0),
+      bounds_(NULL), length_(0), capacity_(0) {}
+
+
+JSONScanner::~JSONScanner() {
+  free(bounds_);
+}
+
+
+bool JSONScanner::Scan() {
+  position_ = 0;
+  length_ = 0;
+  return ScanValue(0);
+}
+
+
+intptr_t JSONScanner::Add(intptr_t first, intptr_t second) {
+  if (length_ + 2 > capacity_) {
+    capacity_ = capacity_ == 0 ? 64 : capacity_ * 2;
+    bounds_ = reinterpret_cast<intptr_t*>(
+        realloc(bounds_, capacity_ * sizeof(bounds_[0])));
+    if (bounds_ == NULL) {
+      FATAL("Failed to grow JSON bounds");
+    }
+  }
+  intptr_t index = length_;
+  bounds_[length_++] = first;
+  bounds_[length_++] = second;
+  return index;
+}
+
+
+void JSONScanner::SkipWhitespace() {
+  while (position_ < size_) {
+    uint8_t byte = bytes_[position_];
+    if ((byte != ' ') && (byte != '\n') && (byte != '\r') && (byte != '\t')) {
+      return;
+    }
+    position_++;
+  }
+}
+
+
+bool JSONScanner::ScanValue(intptr_t depth) {
+  SkipWhitespace();
+  if (position_ >= size_) {
+    return false;
+  }
+  switch (bytes_[position_]) {
+    case '[':
+      return ScanList(depth);
+    case '{':
+      return ScanMap(depth);
+    case '"':
+      return ScanString();
+    case 't':
+      return ScanLiteral("true", 4);
+    case 'f':
+      return ScanLiteral("false", 5);
+    case 'n':
+      return ScanLiteral("null", 4);
+    case '-':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+      return ScanNumber();
+    default:
+      return false;
+  }
+}
+
+
+bool JSONScanner::ScanList(intptr_t depth) {
+  if (depth >= kMaxDepth) {
+    return false;  // The decoder recurses without this limit.
+  }
+  intptr_t index = Add(position_ + 1, 0);
+  position_++;
+  SkipWhitespace();
+  if (position_ >= size_) {
+    return false;
+  }
+  if (bytes_[position_] == ']') {
+    position_++;
+    return true;
+  }
+  intptr_t count = 0;
+  for (;;) {
+    if (!ScanValue(depth + 1)) {
+      return false;
+    }
+    count++;
+    SkipWhitespace();
+    if (position_ >= size_) {
+      return false;
+    }
+    uint8_t byte = bytes_[position_++];
+    if (byte == ']') {
+      break;
+    }
+    if (byte != ',') {
+      return false;
+    }
+  }
+  bounds_[index + 1] = count;
+  return true;
+}
+
+
+bool JSONScanner::ScanMap(intptr_t depth) {
+  if (depth >= kMaxDepth) {
+    return false;
+  }
+  intptr_t index = Add(position_ + 1, 0);
+  position_++;
+  SkipWhitespace();
+  if (position_ >= size_) {
+    return false;
+  }
+  if (bytes_[position_] == '}') {
+    position_++;
+    return true;
+  }
+  intptr_t count = 0;
+  for (;;) {
+    SkipWhitespace();
+    if ((position_ >= size_) || (bytes_[position_] != '"') || !ScanString()) {
+      return false;
+    }
+    SkipWhitespace();
+    if ((position_ >= size_) || (bytes_[position_] != ':')) {
+      return false;
+    }
+    position_++;
+    if (!ScanValue(depth + 1)) {
+      return false;
+    }
+    count++;
+    SkipWhitespace();
+    if (position_ >= size_) {
+      return false;
+    }
+    uint8_t byte = bytes_[position_++];
+    if (byte == '}') {
+      break;
+    }
+    if (byte != ',') {
+      return false;
+    }
+  }
+  bounds_[index + 1] = count;
+  return true;
+}
+
+
+bool JSONScanner::ScanString() {
+  ASSERT(bytes_[position_] == '"');
+  intptr_t start = position_;
+  intptr_t quote = -1;
+  bool escaped = false;
+  position_++;
+  for (;;) {
+    // Both searches are memchr's, which looks at many bytes at a time. The
+    // quote found is kept until an escape is found to have consumed it, so
+    // strings with many escapes are still scanned in linear time.
+    if (quote < position_) {
+      const void* found = memchr(bytes_ + position_, '"', size_ - position_);
+      if (found == NULL) {
+        return false;
+      }
+      quote = static_cast<const uint8_t*>(found) - bytes_;
+    }
+    const void* backslash =
+        memchr(bytes_ + position_, '\\', quote - position_);
+    if (backslash == NULL) {
+      position_ = quote + 1;
+      Add(start + 1, escaped ? -position_ : position_);
+      return true;
+    }
+    escaped = true;
+    position_ = static_cast<const uint8_t*>(backslash) - bytes_ + 1;
+    if (position_ >= size_) {
+      return false;
+    }
+    switch (bytes_[position_]) {
+      case '"': case '\\': case '/':
+      case 'b': case 'f': case 'n': case 'r': case 't':
+        position_++;
+        break;
+      default:
+        return false;
+    }
+  }
+}
+
+
+bool JSONScanner::ScanDigits() {
+  intptr_t start = position_;
+  while ((position_ < size_) &&
+         (bytes_[position_] >= '0') &&
+         (bytes_[position_] <= '9')) {
+    position_++;
+  }
+  return position_ > start;
+}
+
+
+bool JSONScanner::ScanNumber() {
+  intptr_t start = position_;
+  bool exact_integer = true;
+  if (bytes_[position_] == '-') {
+    position_++;
+  }
+  if (!ScanDigits()) {
+    return false;
+  }
+  if ((position_ < size_) && (bytes_[position_] == '.')) {
+    position_++;
+    if (!ScanDigits()) {
+      return false;
+    }
+    exact_integer = false;
+  }
+  if ((position_ < size_) &&
+      ((bytes_[position_] == 'e') || (bytes_[position_] == 'E'))) {
+    position_++;
+    if (position_ >= size_) {
+      return false;
+    }
+    if ((bytes_[position_] == '+') || (bytes_[position_] == '-')) {
+      position_++;
+    }
+    if (!ScanDigits()) {
+      return false;
+    }
+    exact_integer = false;
+  }
+  Add(start + 1, exact_integer ? position_ : -position_);
+  return true;
+}
+
+
+bool JSONScanner::ScanLiteral(const char* literal, intptr_t length) {
+  if ((size_ - position_ < length) ||
+      (memcmp(bytes_ + position_, literal, length) != 0)) {
+    return false;
+  }
+  Add(position_ + 1, position_ + length);
+  position_ += length;
+  return true;
+}
+
+}  // namespace psoup
@@ -0,0 +1,62 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_JSON_SCANNER_H_
+#define VM_JSON_SCANNER_H_
+
+#include "vm/globals.h"
+
+namespace psoup {
+
+// Finds the extent of the first JSON value in some bytes and of each value
+// inside it, for the JSON decoder, which then builds the value without
+// looking at most of the bytes again. Each value is recorded as a pair, in the
+// order the values begin, with each key of a map before its value:
+//
+//   list or map        index of [ or {, number of elements or members
+//   string             indices of its quotes, the second negated if the string
+//                      has escapes
+//   number             indices of its first and last bytes, the last negated
+//                      if it has a fraction or exponent
+//   true, false, null  indices of its first and last bytes
+//
+// Indices start at 1. What follows the value is ignored, as the decoder does.
+class JSONScanner {
+ public:
+  JSONScanner(const uint8_t* bytes, intptr_t size);
+  ~JSONScanner();
+
+  // False if the bytes do not start with a value the decoder accepts, or if
+  // it nests more deeply than kMaxDepth.
+  bool Scan();
+
+  intptr_t length() const { return length_; }
+  const intptr_t* bounds() const { return bounds_; }
+
+  static const intptr_t kMaxDepth = 1024;
+
+ private:
+  bool ScanValue(intptr_t depth);
+  bool ScanList(intptr_t depth);
+  bool ScanMap(intptr_t depth);
+  bool ScanString();
+  bool ScanNumber();
+  bool ScanLiteral(const char* literal, intptr_t length);
+  bool ScanDigits();
+  void SkipWhitespace();
+  intptr_t Add(intptr_t first, intptr_t second);
+
+  const uint8_t* bytes_;
+  intptr_t size_;
+  intptr_t position_;  // 0-based.
+  intptr_t* bounds_;
+  intptr_t length_;
+  intptr_t capacity_;
+
+  DISALLOW_COPY_AND_ASSIGN(JSONScanner);
+};
+
+}  // namespace psoup
+
+#endif  // VM_JSON_SCANNER_H_
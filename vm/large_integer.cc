@@ -262,11 +262,142 @@ static void AbsAddOneInPlace(LargeInteger result) {
     carry >>= kDigitShift;
     ASSERT(carry == 0 || carry == 1);
   }
-  ASSERT(carry == 0);
+  if (carry != 0) {
+    // All digits were at their maximum, as for a floored quotient of -B^k.
+    ASSERT(result->size() < result->capacity());
+    result->set_digit(result->size(), carry);
+    result->set_size(result->size() + 1);
+  }
   Verify(result);
 }
 
 
+// Below this many digits in the shorter operand, Karatsuba's extra additions
+// cost more than the digit products they save.
+static const intptr_t kKaratsubaThreshold = 32;
+
+
+// r[0, n) += a[0, m), for m <= n and a sum that fits.
+static void AddDigits(digit_t* r, intptr_t n, const digit_t* a, intptr_t m) {
+  ddigit_t carry = 0;
+  intptr_t i = 0;
+  for (; i < m; i++) {
+    carry += static_cast<ddigit_t>(r[i]) + static_cast<ddigit_t>(a[i]);
+    r[i] = carry & kDigitMask;
+    carry >>= kDigitShift;
+  }
+  for (; carry != 0 && i < n; i++) {
+    carry += static_cast<ddigit_t>(r[i]);
+    r[i] = carry & kDigitMask;
+    carry >>= kDigitShift;
+  }
+  ASSERT(carry == 0);
+}
+
+
+// r[0, n) -= a[0, m), for m <= n and a difference of at least 0.
+static void SubtractDigits(digit_t* r, intptr_t n,
+                           const digit_t* a, intptr_t m) {
+  sddigit_t borrow = 0;
+  intptr_t i = 0;
+  for (; i < m; i++) {
+    borrow += static_cast<ddigit_t>(r[i]) - static_cast<ddigit_t>(a[i]);
+    r[i] = borrow & kDigitMask;
+    borrow >>= kDigitShift;
+  }
+  for (; borrow != 0 && i < n; i++) {
+    borrow += static_cast<ddigit_t>(r[i]);
+    r[i] = borrow & kDigitMask;
+    borrow >>= kDigitShift;
+  }
+  ASSERT(borrow == 0);
+}
+
+
+// r[0, n + m) = a[0, n) * b[0, m).
+static void MultiplyDigits(const digit_t* a, intptr_t n,
+                           const digit_t* b, intptr_t m,
+                           digit_t* r) {
+  if (n < m) {
+    MultiplyDigits(b, m, a, n, r);
+    return;
+  }
+
+  if (m < kKaratsubaThreshold) {
+    for (intptr_t i = 0; i < n; i++) {
+      r[i] = 0;
+    }
+    for (intptr_t i = 0; i < m; i++) {
+      ddigit_t carry = 0;
+      ddigit_t b_digit = b[i];
+      for (intptr_t j = 0; j < n; j++) {
+        carry += static_cast<ddigit_t>(a[j]) * b_digit +
+            static_cast<ddigit_t>(r[i + j]);
+        r[i + j] = carry & kDigitMask;
+        carry >>= kDigitShift;
+      }
+      ASSERT((carry >> kDigitShift) == 0);
+      r[i + n] = carry;
+    }
+    return;
+  }
+
+  intptr_t h = (n + 1) >> 1;
+  if (m <= h) {
+    // Too unbalanced to split both: multiply b by each m-digit piece of a.
+    digit_t* product =
+        reinterpret_cast<digit_t*>(malloc(2 * m * sizeof(digit_t)));
+    for (intptr_t i = 0; i < n + m; i++) {
+      r[i] = 0;
+    }
+    for (intptr_t offset = 0; offset < n; offset += m) {
+      intptr_t length = n - offset < m ? n - offset : m;
+      MultiplyDigits(a + offset, length, b, m, product);
+      AddDigits(r + offset, n + m - offset, product, length + m);
+    }
+    free(product);
+    return;
+  }
+
+  // a = a1 B^h + a0 and b = b1 B^h + b0, so with z0 = a0 b0, z2 = a1 b1 and
+  // z1 = (a0 + a1)(b0 + b1) - z0 - z2, a b = z2 B^2h + z1 B^h + z0.
+  const digit_t* a0 = a;
+  const digit_t* a1 = a + h;
+  const digit_t* b0 = b;
+  const digit_t* b1 = b + h;
+  intptr_t a1_length = n - h;
+  intptr_t b1_length = m - h;
+
+  MultiplyDigits(a0, h, b0, h, r);
+  MultiplyDigits(a1, a1_length, b1, b1_length, r + 2 * h);
+
+  digit_t* sums =
+      reinterpret_cast<digit_t*>(malloc((4 * h + 4) * sizeof(digit_t)));
+  digit_t* a_sum = sums;
+  digit_t* b_sum = sums + h + 1;
+  digit_t* z1 = sums + 2 * h + 2;
+  for (intptr_t i = 0; i < h; i++) {
+    a_sum[i] = a0[i];
+    b_sum[i] = b0[i];
+  }
+  a_sum[h] = 0;
+  b_sum[h] = 0;
+  AddDigits(a_sum, h + 1, a1, a1_length);
+  AddDigits(b_sum, h + 1, b1, b1_length);
+  MultiplyDigits(a_sum, h + 1, b_sum, h + 1, z1);
+  SubtractDigits(z1, 2 * h + 2, r, 2 * h);
+  SubtractDigits(z1, 2 * h + 2, r + 2 * h, a1_length + b1_length);
+
+  // z1 < B^(n + m - h), so its digits above that are 0.
+  intptr_t z1_length = 2 * h + 2;
+  if (z1_length > n + m - h) {
+    z1_length = n + m - h;
+  }
+  AddDigits(r + h, n + m - h, z1, z1_length);
+  free(sums);
+}
+
+
 LargeInteger MultiplyAbsolutesWithSign(LargeInteger left,
                                         LargeInteger right,
                                         bool negative,
@@ -278,22 +409,14 @@ LargeInteger MultiplyAbsolutesWithSign(LargeInteger left,
   HandleScope h2(H, reinterpret_cast<Object*>(&right));
   LargeInteger result = H->AllocateLargeInteger(left->size() + right->size());
 
-  for (intptr_t i = 0; i < left->size(); i++) {
-    result->set_digit(i, 0);
-  }
-
-  for (intptr_t i = 0; i < right->size(); i++) {
-    ddigit_t carry = 0;
-    ddigit_t right_digit = right->digit(i);
-    for (intptr_t j = 0; j < left->size(); j++) {
-      ddigit_t left_digit = left->digit(j);
-      carry += left_digit * right_digit +
-          static_cast<ddigit_t>(result->digit(i + j));
-      result->set_digit(i + j, carry & kDigitMask);
-      carry >>= kDigitShift;
+  if (left->size() == 0 || right->size() == 0) {
+    for (intptr_t i = 0; i < result->capacity(); i++) {
+      result->set_digit(i, 0);
     }
-    ASSERT((carry >> kDigitShift) == 0);
-    result->set_digit(i + left->size(), carry);
+  } else {
+    MultiplyDigits(left->digit_addr(0), left->size(),
+                   right->digit_addr(0), right->size(),
+                   result->digit_addr(0));
   }
 
   result->set_negative(negative);
@@ -904,6 +1027,262 @@ ATTRIBUTE_UNUSED static intptr_t CountLeadingZeros(uint32_t x) {
 }
 
 
+// Below this many digits in the divisor or the quotient, long division beats
+// Burnikel-Ziegler's recursion.
+static const intptr_t kBurnikelZieglerThreshold = 64;
+static const digit_t kOne = 1;
+
+
+static intptr_t CompareDigits(const digit_t* a, const digit_t* b,
+                              intptr_t n) {
+  for (intptr_t i = n - 1; i >= 0; i--) {
+    if (a[i] != b[i]) {
+      return a[i] < b[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+
+static intptr_t TrimDigits(const digit_t* a, intptr_t n) {
+  while (n > 0 && a[n - 1] == 0) {
+    n--;
+  }
+  return n;
+}
+
+
+static void CopyDigits(digit_t* to, const digit_t* from, intptr_t n) {
+  memcpy(to, from, n * sizeof(digit_t));
+}
+
+
+static digit_t* NewDigits(intptr_t n) {
+  return reinterpret_cast<digit_t*>(malloc(n * sizeof(digit_t)));
+}
+
+
+// Knuth's algorithm D: q[0, m - n + 1) = u[0, m) / v[0, n) and
+// r[0, n) = u[0, m) % v[0, n), for m >= n and v[n - 1] != 0.
+static void LongDivideDigits(const digit_t* u, intptr_t m,
+                             const digit_t* v, intptr_t n,
+                             digit_t* q, digit_t* r) {
+  if (n == 1) {
+    digit_t divisor_d = v[0];
+    ddigit_t remainder_d = 0;
+    for (intptr_t j = m - 1; j >= 0; j--) {
+      ddigit_t dividend_d = remainder_d * kDigitBase + u[j];
+      q[j] = dividend_d / divisor_d;
+      remainder_d = dividend_d - static_cast<ddigit_t>(q[j]) * divisor_d;
+    }
+    r[0] = remainder_d;
+    return;
+  }
+
+  intptr_t normalize_shift = CountLeadingZeros(v[n - 1]);
+  intptr_t inv_normalize_shift = kDigitBits - normalize_shift;
+  digit_t* norm_div = new digit_t[n];
+  for (intptr_t i = n - 1; i > 0; i--) {
+    norm_div[i] = (v[i] << normalize_shift) |
+        (static_cast<ddigit_t>(v[i - 1]) >> inv_normalize_shift);
+  }
+  norm_div[0] = v[0] << normalize_shift;
+
+  digit_t* norm_rem = new digit_t[m + 1];
+  norm_rem[m] = static_cast<ddigit_t>(u[m - 1]) >> inv_normalize_shift;
+  for (intptr_t i = m - 1; i > 0; i--) {
+    norm_rem[i] = (u[i] << normalize_shift) |
+        (static_cast<ddigit_t>(u[i - 1]) >> inv_normalize_shift);
+  }
+  norm_rem[0] = u[0] << normalize_shift;
+
+  for (intptr_t j = m - n; j >= 0; j--) {
+    ddigit_t p = norm_rem[j+n] * kDigitBase + norm_rem[j+n-1];
+    ddigit_t q_est = p / norm_div[n-1];
+    ddigit_t r_est = p - (q_est * norm_div[n-1]);
+  again:
+    if ((q_est >= kDigitBase) ||
+        (q_est * norm_div[n-2]) > (kDigitBase * r_est + norm_rem[j+n-2])) {
+      q_est = q_est - 1;
+      r_est = r_est + norm_div[n-1];
+      if (r_est < kDigitBase) goto again;
+    }
+
+    sddigit_t k = 0;
+    sddigit_t t;
+    for (intptr_t i = 0; i < n; i++) {
+      ddigit_t p = q_est * norm_div[i];
+      t = norm_rem[i+j] - k - (p & kDigitMask);
+      norm_rem[i+j] = t;
+      k = (p >> kDigitBits) - (t >> kDigitBits);
+    }
+    t = norm_rem[j+n] - k;
+    norm_rem[j+n] = t;
+
+    q[j] = q_est;
+    if (t < 0) {
+      q[j] = q[j] - 1;
+      k = 0;
+      for (intptr_t i = 0; i < n; i++) {
+        t = static_cast<ddigit_t>(norm_rem[i+j]) + norm_div[i] + k;
+        norm_rem[i + j] = t;
+        k = t >> kDigitBits;
+      }
+      norm_rem[j+n] = norm_rem[j+n] + k;
+    }
+  }
+
+  for (intptr_t i = 0; i < n - 1; i++) {
+    r[i] = (norm_rem[i] >> normalize_shift) |
+        (static_cast<ddigit_t>(norm_rem[i + 1]) << inv_normalize_shift);
+  }
+  r[n - 1] = norm_rem[n - 1] >> normalize_shift;
+
+  delete[] norm_div;
+  delete[] norm_rem;
+}
+
+
+static void DivideTwoByOne(const digit_t* a, const digit_t* b, intptr_t n,
+                           digit_t* q, digit_t* r);
+
+
+// Burnikel and Ziegler's "Fast Recursive Division", 1998. For a[0, 3h) <
+// b[0, 2h) B^h with b normalized, q[0, h) = a / b and r[0, 2h) = a % b.
+static void DivideThreeByTwo(const digit_t* a, const digit_t* b, intptr_t h,
+                             digit_t* q, digit_t* r) {
+  const digit_t* b1 = b + h;
+  const digit_t* b2 = b;
+  // t = (a1 a2 % b1) B^h + a3, and d = q b2, to be brought to t - d >= 0.
+  digit_t* t = NewDigits(4 * h + 2);
+  digit_t* d = t + 2 * h + 1;
+  if (CompareDigits(a + 2 * h, b1, h) == 0) {
+    // a1 = b1, so q is B^h - 1, and a1 a2 - q b1 = a2 + b1.
+    for (intptr_t i = 0; i < h; i++) {
+      q[i] = kDigitMask;
+    }
+    CopyDigits(t + h, a + h, h);
+    t[2 * h] = 0;
+    AddDigits(t + h, h + 1, b1, h);
+  } else {
+    DivideTwoByOne(a + h, b1, h, q, t + h);
+    t[2 * h] = 0;
+  }
+  CopyDigits(t, a, h);
+  MultiplyDigits(q, h, b2, h, d);
+  d[2 * h] = 0;
+  // At most twice, for b is normalized.
+  while (CompareDigits(t, d, 2 * h + 1) < 0) {
+    SubtractDigits(q, h, &kOne, 1);
+    AddDigits(t, 2 * h + 1, b, 2 * h);
+  }
+  SubtractDigits(t, 2 * h + 1, d, 2 * h);
+  ASSERT(t[2 * h] == 0);
+  CopyDigits(r, t, 2 * h);
+  free(t);
+}
+
+
+// For a[0, 2n) < b[0, n) B^n with b normalized, q[0, n) = a / b and
+// r[0, n) = a % b.
+static void DivideTwoByOne(const digit_t* a, const digit_t* b, intptr_t n,
+                           digit_t* q, digit_t* r) {
+  if ((n & 1) != 0 || n < kBurnikelZieglerThreshold) {
+    digit_t* long_q = NewDigits(n + 1);
+    LongDivideDigits(a, 2 * n, b, n, long_q, r);
+    ASSERT(long_q[n] == 0);
+    CopyDigits(q, long_q, n);
+    free(long_q);
+    return;
+  }
+
+  intptr_t h = n >> 1;
+  digit_t* rest = NewDigits(3 * h);
+  DivideThreeByTwo(a + h, b, h, q + h, rest + h);
+  CopyDigits(rest, a, h);
+  DivideThreeByTwo(rest, b, h, q, r);
+  free(rest);
+}
+
+
+// q[0, m - n + 1) = u[0, m) / v[0, n) and r[0, n) = u[0, m) % v[0, n), for
+// m >= n and v[n - 1] != 0.
+static void DivideDigits(const digit_t* u, intptr_t m,
+                         const digit_t* v, intptr_t n,
+                         digit_t* q, digit_t* r) {
+  if (n < kBurnikelZieglerThreshold ||
+      m - n < kBurnikelZieglerThreshold) {
+    LongDivideDigits(u, m, v, n, q, r);
+    return;
+  }
+
+  // Widen v to a block of j 2^k digits, for j below the threshold, so the
+  // recursion halves it evenly down to long division, and normalize it.
+  intptr_t halvings = 1;
+  while (halvings * kBurnikelZieglerThreshold < n) {
+    halvings <<= 1;
+  }
+  intptr_t block = ((n + halvings - 1) / halvings) * halvings;
+  intptr_t digit_shift = block - n;
+  intptr_t bit_shift = CountLeadingZeros(v[n - 1]);
+  intptr_t inv_bit_shift = kDigitBits - bit_shift;
+
+  digit_t* b = NewDigits(block);
+  for (intptr_t i = 0; i < digit_shift; i++) {
+    b[i] = 0;
+  }
+  for (intptr_t i = n - 1; i > 0; i--) {
+    b[digit_shift + i] = (v[i] << bit_shift) |
+        (static_cast<ddigit_t>(v[i - 1]) >> inv_bit_shift);
+  }
+  b[digit_shift] = v[0] << bit_shift;
+
+  // u shifted the same, in blocks, the top of which is below b.
+  intptr_t a_length = m + digit_shift + 1;
+  intptr_t blocks = a_length / block + 1;
+  if (blocks < 2) {
+    blocks = 2;
+  }
+  digit_t* a = NewDigits(blocks * block);
+  for (intptr_t i = 0; i < blocks * block; i++) {
+    a[i] = 0;
+  }
+  a[digit_shift + m] = static_cast<ddigit_t>(u[m - 1]) >> inv_bit_shift;
+  for (intptr_t i = m - 1; i > 0; i--) {
+    a[digit_shift + i] = (u[i] << bit_shift) |
+        (static_cast<ddigit_t>(u[i - 1]) >> inv_bit_shift);
+  }
+  a[digit_shift] = u[0] << bit_shift;
+
+  digit_t* quotient = NewDigits((blocks - 1) * block);
+  digit_t* z = NewDigits(2 * block);
+  digit_t* remainder = NewDigits(block);
+  CopyDigits(z, a + (blocks - 2) * block, 2 * block);
+  for (intptr_t i = blocks - 2; i >= 0; i--) {
+    DivideTwoByOne(z, b, block, quotient + i * block, remainder);
+    if (i > 0) {
+      CopyDigits(z + block, remainder, block);
+      CopyDigits(z, a + (i - 1) * block, block);
+    }
+  }
+
+  ASSERT(TrimDigits(quotient, (blocks - 1) * block) <= m - n + 1);
+  CopyDigits(q, quotient, m - n + 1);
+  for (intptr_t i = 0; i < n - 1; i++) {
+    r[i] = (remainder[digit_shift + i] >> bit_shift) |
+        (static_cast<ddigit_t>(remainder[digit_shift + i + 1]) <<
+            inv_bit_shift);
+  }
+  r[n - 1] = remainder[digit_shift + n - 1] >> bit_shift;
+
+  free(b);
+  free(a);
+  free(quotient);
+  free(z);
+  free(remainder);
+}
+
+
 LargeInteger LargeInteger::Divide(DivOperationType op_type,
                                    DivResultType result_type,
                                    LargeInteger dividend,
@@ -1069,76 +1448,16 @@ LargeInteger LargeInteger::Divide(DivOperationType op_type,
 
   // Multi-digit divisor.
 
-  intptr_t normalize_shift = CountLeadingZeros(divisor->digit(n - 1));
-  intptr_t inv_normalize_shift = kDigitBits - normalize_shift;
-  digit_t* norm_div = new digit_t[n];
-  for (intptr_t i = n - 1; i > 0; i--) {
-    norm_div[i] = (divisor->digit(i) << normalize_shift) |
-        (static_cast<ddigit_t>(divisor->digit(i - 1)) >>
-            inv_normalize_shift);
-  }
-  norm_div[0] = divisor->digit(0) << normalize_shift;
-
-  digit_t* norm_rem = new digit_t[m + 1];
-  norm_rem[m] = static_cast<ddigit_t>(dividend->digit(m-1)) >>
-      inv_normalize_shift;
-  for (intptr_t i = m - 1; i > 0; i--) {
-    norm_rem[i] = (dividend->digit(i) << normalize_shift) |
-        (static_cast<ddigit_t>(dividend->digit(i - 1)) >>
-            inv_normalize_shift);
-  }
-  norm_rem[0] = dividend->digit(0) << normalize_shift;
-
-  for (intptr_t j = m - n; j >= 0; j--) {
-    ddigit_t p = norm_rem[j+n] * kDigitBase + norm_rem[j+n-1];
-    ddigit_t q_est = p / norm_div[n-1];
-    ddigit_t r_est = p - (q_est * norm_div[n-1]);
-  again:
-    if ((q_est >= kDigitBase) ||
-        (q_est * norm_div[n-2]) > (kDigitBase * r_est + norm_rem[j+n-2])) {
-      q_est = q_est - 1;
-      r_est = r_est + norm_div[n-1];
-      if (r_est < kDigitBase) goto again;
-    }
-
-    sddigit_t k = 0;
-    sddigit_t t;
-    for (intptr_t i = 0; i < n; i++) {
-      ddigit_t p = q_est * norm_div[i];
-      t = norm_rem[i+j] - k - (p & kDigitMask);
-      norm_rem[i+j] = t;
-      k = (p >> kDigitBits) - (t >> kDigitBits);
-    }
-    t = norm_rem[j+n] - k;
-    norm_rem[j+n] = t;
-
-    quoitent->set_digit(j, q_est);
-    if (t < 0) {
-      quoitent->set_digit(j, quoitent->digit(j) - 1);
-      k = 0;
-      for (intptr_t i = 0; i < n; i++) {
-        t = static_cast<ddigit_t>(norm_rem[i+j]) + norm_div[i] + k;
-        norm_rem[i + j] = t;
-        k = t >> kDigitBits;
-      }
-      norm_rem[j+n] = norm_rem[j+n] + k;
-    }
-  }
+  digit_t* rem = NewDigits(n);
+  DivideDigits(dividend->digit_addr(0), m, divisor->digit_addr(0), n,
+               quoitent->digit_addr(0), rem);
 
   if (result_type == kQuoitent) {
     Clamp(quoitent);
     Verify(quoitent);
 
-    bool remainder_is_zero = true;
-    for (intptr_t i = 0; i <= n; i++) {
-      if (norm_rem[i] != 0) {
-        remainder_is_zero = false;
-        break;
-      }
-    }
-
-    delete[] norm_div;
-    delete[] norm_rem;
+    bool remainder_is_zero = TrimDigits(rem, n) == 0;
+    free(rem);
 
     if (op_type == kTruncated) {
       return quoitent;
@@ -1167,18 +1486,11 @@ LargeInteger LargeInteger::Divide(DivOperationType op_type,
   if (result_type == kRemainder) {
     LargeInteger remainder = H->AllocateLargeInteger(n);
     remainder->set_negative(dividend->negative());
-    for (intptr_t i = 0; i < n - 1; i++) {
-      digit_t d = (norm_rem[i] >> normalize_shift) |
-          (static_cast<ddigit_t>(norm_rem[i + 1]) <<
-              inv_normalize_shift);
-      remainder->set_digit(i, d);
-    }
-    remainder->set_digit(n - 1, norm_rem[n - 1] >> normalize_shift);
+    CopyDigits(remainder->digit_addr(0), rem, n);
+    free(rem);
 
     Clamp(remainder);
     Verify(remainder);
-    delete[] norm_div;
-    delete[] norm_rem;
 
     if (op_type == kTruncated) {
       return remainder;
@@ -1198,52 +1510,132 @@ LargeInteger LargeInteger::Divide(DivOperationType op_type,
 }
 
 
-String LargeInteger::PrintString(LargeInteger large, Heap* H) {
 #if defined(ARCH_IS_32_BIT)
-  const ddigit_t kDivisor = 10000;
-  const intptr_t kDivisorLog10 = 4;
+static const ddigit_t kPrintDivisor = 10000;
+static const intptr_t kPrintDivisorLog10 = 4;
 #elif defined(ARCH_IS_64_BIT)
-  const ddigit_t kDivisor = 1000000000;
-  const intptr_t kDivisorLog10 = 9;
+static const ddigit_t kPrintDivisor = 1000000000;
+static const intptr_t kPrintDivisorLog10 = 9;
 #endif
-  ASSERT(kDivisor < kDigitBase);
-  // log10(2) = 0.30102999566398114
-  const intptr_t kLog2Dividend = 30103;
-  const intptr_t kLog2Divisor = 100000;
-  intptr_t binary_digits = large->size() * sizeof(digit_t) * kBitsPerByte;
-  intptr_t est_decimal_digits =
-      (binary_digits * kLog2Dividend / kLog2Divisor) + 1 + kDivisorLog10;
-  if (large->negative()) {
-    est_decimal_digits++;
-  }
 
-  char* chars = new char[est_decimal_digits];
-  intptr_t pos = est_decimal_digits;
+// Below this many digits, printing by repeated division by kPrintDivisor
+// beats splitting by powers of it.
+static const intptr_t kPrintThreshold = 128;
 
-  digit_t* scratch = new digit_t[large->size()];
-  for (intptr_t i = 0; i < large->size(); i++) {
-    scratch[i] = large->digit(i);
-  }
 
-  intptr_t used = large->size();
+// Writes the decimal digits of x[0, n), which it consumes, to end before
+// end, kPrintDivisorLog10 at a time. Answers where they start.
+static char* PrintDigitsByChunks(digit_t* x, intptr_t n, char* end) {
+  char* pos = end;
+  intptr_t used = TrimDigits(x, n);
   while (used > 0) {
     digit_t remainder = 0;
     for (intptr_t i = used - 1; i >= 0; i--) {
       ddigit_t dividend =
-          (static_cast<ddigit_t>(remainder) << kDigitShift) + scratch[i];
-      digit_t quotient = dividend / kDivisor;
-      remainder = dividend - (static_cast<ddigit_t>(quotient) * kDivisor);
-      scratch[i] = quotient;
+          (static_cast<ddigit_t>(remainder) << kDigitShift) + x[i];
+      digit_t quotient = dividend / kPrintDivisor;
+      remainder = dividend - (static_cast<ddigit_t>(quotient) * kPrintDivisor);
+      x[i] = quotient;
     }
-    while ((used > 0) && (scratch[used - 1] == 0)) {
+    while ((used > 0) && (x[used - 1] == 0)) {
       used--;
     }
-    for (intptr_t i = 0; i < kDivisorLog10; i++) {
-      chars[--pos] = '0' + (remainder % 10);
+    for (intptr_t i = 0; i < kPrintDivisorLog10; i++) {
+      *--pos = '0' + (remainder % 10);
       remainder /= 10;
     }
     ASSERT(remainder == 0);
   }
+  return pos;
+}
+
+
+// Writes the decimal digits of x[0, n) to end before end, padded with zeros
+// to width if that is not 0, by dividing it by powers[k], which is
+// kPrintDivisor ^ 2^k, and printing the quotient and remainder the same way.
+// Answers where they start.
+static char* PrintDigits(const digit_t* x, intptr_t n,
+                         digit_t** powers, intptr_t* power_lengths,
+                         intptr_t k, char* end, intptr_t width) {
+  n = TrimDigits(x, n);
+  while (k >= 0 &&
+         (n < power_lengths[k] ||
+          (n == power_lengths[k] && CompareDigits(x, powers[k], n) < 0))) {
+    k--;
+  }
+
+  char* pos;
+  if (k < 0 || n < kPrintThreshold) {
+    digit_t* scratch = NewDigits(n);
+    CopyDigits(scratch, x, n);
+    pos = PrintDigitsByChunks(scratch, n, end);
+    free(scratch);
+  } else {
+    intptr_t power_length = power_lengths[k];
+    digit_t* quotient = NewDigits(n - power_length + 1);
+    digit_t* remainder = NewDigits(power_length);
+    DivideDigits(x, n, powers[k], power_length, quotient, remainder);
+    intptr_t low_width = kPrintDivisorLog10 << k;
+    pos = PrintDigits(remainder, power_length, powers, power_lengths, k - 1,
+                      end, low_width);
+    pos = PrintDigits(quotient, n - power_length + 1, powers, power_lengths,
+                      k - 1, pos, width == 0 ? 0 : width - low_width);
+    free(quotient);
+    free(remainder);
+  }
+
+  if (width != 0) {
+    while (pos > end - width) {
+      *--pos = '0';
+    }
+  }
+  return pos;
+}
+
+
+String LargeInteger::PrintString(LargeInteger large, Heap* H) {
+  ASSERT(kPrintDivisor < kDigitBase);
+  // log10(2) = 0.30102999566398114
+  const intptr_t kLog2Dividend = 30103;
+  const intptr_t kLog2Divisor = 100000;
+  intptr_t binary_digits = large->size() * sizeof(digit_t) * kBitsPerByte;
+  intptr_t est_decimal_digits =
+      (binary_digits * kLog2Dividend / kLog2Divisor) + 1 + kPrintDivisorLog10;
+  if (large->negative()) {
+    est_decimal_digits++;
+  }
+
+  char* chars = new char[est_decimal_digits];
+  char* end = chars + est_decimal_digits;
+
+  // kPrintDivisor ^ 2^k, up to about the square root of large.
+  const intptr_t kMaxPowers = 64;
+  digit_t* powers[kMaxPowers];
+  intptr_t power_lengths[kMaxPowers];
+  intptr_t num_powers = 0;
+  if (large->size() >= kPrintThreshold) {
+    powers[0] = NewDigits(1);
+    powers[0][0] = kPrintDivisor;
+    power_lengths[0] = 1;
+    num_powers = 1;
+    while (2 * power_lengths[num_powers - 1] <= large->size() &&
+           num_powers < kMaxPowers) {
+      digit_t* last = powers[num_powers - 1];
+      intptr_t last_length = power_lengths[num_powers - 1];
+      digit_t* square = NewDigits(2 * last_length);
+      MultiplyDigits(last, last_length, last, last_length, square);
+      powers[num_powers] = square;
+      power_lengths[num_powers] = TrimDigits(square, 2 * last_length);
+      num_powers++;
+    }
+  }
+
+  intptr_t pos = PrintDigits(large->digit_addr(0), large->size(),
+                             powers, power_lengths, num_powers - 1,
+                             end, 0) - chars;
+  for (intptr_t i = 0; i < num_powers; i++) {
+    free(powers[i]);
+  }
 
   ASSERT((0 <= pos) && (pos < est_decimal_digits));
   // Remove leading zeros.
@@ -1256,8 +1648,6 @@ String LargeInteger::PrintString(LargeInteger large, Heap* H) {
   }
   ASSERT((0 <= pos) && (pos < est_decimal_digits));
 
-  delete[] scratch;
-
   intptr_t nchars = est_decimal_digits - pos;
   String result = H->AllocateString(nchars);
   memcpy(result->element_addr(0), &chars[pos], nchars);
@@ -0,0 +1,76 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/log.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "vm/flags.h"
+#include "vm/os.h"
+
+namespace psoup {
+
+static FILE* log_stream = NULL;
+static int64_t log_start = 0;
+
+
+void Log::Startup() {
+  log_start = OS::CurrentMonotonicNanos();
+  log_stream = stderr;
+  if (Flags::log_file() != NULL) {
+    FILE* file = fopen(Flags::log_file(), "a");
+    if (file == NULL) {
+      OS::PrintErr("Failed to open %s, logging to standard error\n",
+                   Flags::log_file());
+    } else {
+      log_stream = file;
+    }
+  }
+}
+
+
+void Log::Shutdown() {
+  if ((log_stream != NULL) && (log_stream != stderr)) {
+    fclose(log_stream);
+  }
+  log_stream = NULL;
+}
+
+
+void Log::Print(const char* flag, const char* format, ...) {
+  char message[1024];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+
+  // Messages are ASCII, but may quote a selector or a path.
+  char line[2 * sizeof(message) + 128];
+  intptr_t length = snprintf(
+      line, sizeof(line), "{\"us\":%" Pd64 ",\"flag\":\"%s\",\"message\":\"",
+      (OS::CurrentMonotonicNanos() - log_start) / kNanosecondsPerMicrosecond,
+      flag);
+  for (const char* c = message; *c != 0; c++) {
+    if ((*c == '"') || (*c == '\\')) {
+      line[length++] = '\\';
+      line[length++] = *c;
+    } else if (static_cast<unsigned char>(*c) < 0x20) {
+      line[length++] = ' ';
+    } else {
+      line[length++] = *c;
+    }
+  }
+  line[length++] = '"';
+  line[length++] = '}';
+  line[length++] = '\n';
+  line[length] = 0;
+
+  // A line at a time, so the lines of isolates on other threads do not mix.
+  FILE* stream = (log_stream == NULL) ? stderr : log_stream;
+  fputs(line, stream);
+  fflush(stream);
+}
+
+}  // namespace psoup
@@ -0,0 +1,29 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_LOG_H_
+#define VM_LOG_H_
+
+#include "vm/globals.h"
+
+namespace psoup {
+
+// Where the diagnostic flags report: a line of JSON per event, with the
+// microseconds since startup, the flag that enabled it and the message, so
+// that tools can filter and order the lines of many isolates. To standard
+// error, or to the file named by --log_file.
+//
+//   {"us":1234,"flag":"report_gc","message":"Scavenge (new-space, ...)"}
+class Log {
+ public:
+  static void Startup();
+  static void Shutdown();
+
+  static void Print(const char* flag, const char* format, ...)
+      PRINTF_ATTRIBUTE(2, 3);
+};
+
+}  // namespace psoup
+
+#endif  // VM_LOG_H_
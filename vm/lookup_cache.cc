@@ -4,23 +4,56 @@
 
 #include "vm/lookup_cache.h"
 
+#include "vm/utils.h"
+
 namespace psoup {
 
+LookupCache::LookupCache()
+    : ordinary_entries_(nullptr),
+      ordinary_mask_(0),
+      ns_entries_(nullptr),
+      ns_mask_(0),
+      ordinary_hits_(0),
+      ordinary_misses_(0),
+      ordinary_evictions_(0),
+      ns_hits_(0),
+      ns_misses_(0),
+      ns_evictions_(0),
+      ordinary_lookups_at_clear_(0),
+      ordinary_evictions_at_clear_(0),
+      ns_lookups_at_clear_(0),
+      ns_evictions_at_clear_(0) {
+  Resize(kInitialSize);
+}
+
+
+LookupCache::~LookupCache() {
+  delete[] ordinary_entries_;
+  delete[] ns_entries_;
+}
+
+
 void LookupCache::InsertOrdinary(intptr_t cid,
                                  String selector,
                                  Method target) {
   intptr_t hash = cid
       ^ (static_cast<intptr_t>(selector) >> kObjectAlignmentLog2);
 
-  intptr_t probe1 = hash & kMask;
-  entries_[probe1].ordinary_cid = cid;
-  entries_[probe1].ordinary_selector = selector;
-  entries_[probe1].ordinary_target = target;
+  intptr_t probe1 = hash & ordinary_mask_;
+  if (ordinary_entries_[probe1].cid != kIllegalCid) {
+    ordinary_evictions_++;
+  }
+  ordinary_entries_[probe1].cid = cid;
+  ordinary_entries_[probe1].selector = selector;
+  ordinary_entries_[probe1].target = target;
 
-  intptr_t probe2 = (hash >> 3) & kMask;
-  entries_[probe2].ordinary_cid = cid;
-  entries_[probe2].ordinary_selector = selector;
-  entries_[probe2].ordinary_target = target;
+  intptr_t probe2 = (hash >> 3) & ordinary_mask_;
+  if ((probe2 != probe1) && (ordinary_entries_[probe2].cid != kIllegalCid)) {
+    ordinary_evictions_++;
+  }
+  ordinary_entries_[probe2].cid = cid;
+  ordinary_entries_[probe2].selector = selector;
+  ordinary_entries_[probe2].target = target;
 }
 
 
@@ -35,26 +68,155 @@ void LookupCache::InsertNS(intptr_t cid,
       ^ (static_cast<intptr_t>(caller) >> kObjectAlignmentLog2);
   intptr_t cid_and_rule = (cid << 16) | rule;
 
-  intptr_t probe1 = hash & kMask;
-  entries_[probe1].ns_cid_and_rule = cid_and_rule;
-  entries_[probe1].ns_selector = selector;
-  entries_[probe1].ns_caller = caller;
-  entries_[probe1].ns_target = target;
-  entries_[probe1].ns_absent_receiver = absent_receiver;
+  intptr_t probe1 = hash & ns_mask_;
+  if (ns_entries_[probe1].cid_and_rule != (kIllegalCid << 16)) {
+    ns_evictions_++;
+  }
+  ns_entries_[probe1].cid_and_rule = cid_and_rule;
+  ns_entries_[probe1].selector = selector;
+  ns_entries_[probe1].caller = caller;
+  ns_entries_[probe1].target = target;
+  ns_entries_[probe1].absent_receiver = absent_receiver;
 
-  intptr_t probe2 = (hash >> 3) & kMask;
-  entries_[probe2].ns_cid_and_rule = cid_and_rule;
-  entries_[probe2].ns_selector = selector;
-  entries_[probe2].ns_caller = caller;
-  entries_[probe2].ns_target = target;
-  entries_[probe2].ns_absent_receiver = absent_receiver;
+  intptr_t probe2 = (hash >> 3) & ns_mask_;
+  if ((probe2 != probe1) &&
+      (ns_entries_[probe2].cid_and_rule != (kIllegalCid << 16))) {
+    ns_evictions_++;
+  }
+  ns_entries_[probe2].cid_and_rule = cid_and_rule;
+  ns_entries_[probe2].selector = selector;
+  ns_entries_[probe2].caller = caller;
+  ns_entries_[probe2].target = target;
+  ns_entries_[probe2].absent_receiver = absent_receiver;
 }
 
 
 void LookupCache::Clear() {
-  for (intptr_t i = 0; i < kSize; i++) {
-    entries_[i].ordinary_cid = kIllegalCid;
-    entries_[i].ns_cid_and_rule = kIllegalCid << 16;
+  int64_t ordinary_lookups = ordinary_hits_ + ordinary_misses_;
+  int64_t evictions = ordinary_evictions_ - ordinary_evictions_at_clear_;
+  int64_t lookups = ordinary_lookups - ordinary_lookups_at_clear_;
+  ordinary_lookups_at_clear_ = ordinary_lookups;
+  ordinary_evictions_at_clear_ = ordinary_evictions_;
+  intptr_t ordinary_size = ordinary_mask_ + 1;
+  if ((evictions * kGrowthRatio > lookups) && (ordinary_size < kMaxSize)) {
+    ResizeOrdinary(ordinary_size * 2);
+  } else {
+    ClearOrdinary();
+  }
+
+  int64_t ns_lookups = ns_hits_ + ns_misses_;
+  evictions = ns_evictions_ - ns_evictions_at_clear_;
+  lookups = ns_lookups - ns_lookups_at_clear_;
+  ns_lookups_at_clear_ = ns_lookups;
+  ns_evictions_at_clear_ = ns_evictions_;
+  intptr_t ns_size = ns_mask_ + 1;
+  if ((evictions * kGrowthRatio > lookups) && (ns_size < kMaxSize)) {
+    ResizeNS(ns_size * 2);
+  } else {
+    ClearNS();
+  }
+}
+
+
+void LookupCache::ClearOrdinary() {
+  for (intptr_t i = 0; i <= ordinary_mask_; i++) {
+    ordinary_entries_[i].cid = kIllegalCid;
+  }
+}
+
+
+void LookupCache::ClearNS() {
+  for (intptr_t i = 0; i <= ns_mask_; i++) {
+    ns_entries_[i].cid_and_rule = kIllegalCid << 16;
+  }
+}
+
+
+void LookupCache::ClearSelector(String selector) {
+  for (intptr_t i = 0; i <= ordinary_mask_; i++) {
+    if (ordinary_entries_[i].selector == selector) {
+      ordinary_entries_[i].cid = kIllegalCid;
+    }
+  }
+  for (intptr_t i = 0; i <= ns_mask_; i++) {
+    if (ns_entries_[i].selector == selector) {
+      ns_entries_[i].cid_and_rule = kIllegalCid << 16;
+    }
+  }
+}
+
+
+void LookupCache::ClearClassIds(const bool* marked, intptr_t length) {
+  for (intptr_t i = 0; i <= ordinary_mask_; i++) {
+    intptr_t cid = ordinary_entries_[i].cid;
+    if ((cid < length) && marked[cid]) {
+      ordinary_entries_[i].cid = kIllegalCid;
+    }
+  }
+  for (intptr_t i = 0; i <= ns_mask_; i++) {
+    intptr_t cid = ns_entries_[i].cid_and_rule >> 16;
+    if (cid == kIllegalCid) {
+      continue;  // Its absent receiver may since have been moved or freed.
+    }
+    Object absent_receiver = ns_entries_[i].absent_receiver;
+    if (((cid < length) && marked[cid]) ||
+        ((absent_receiver != nullptr) &&
+         (absent_receiver->ClassId() < length) &&
+         marked[absent_receiver->ClassId()])) {
+      ns_entries_[i].cid_and_rule = kIllegalCid << 16;
+    }
+  }
+}
+
+
+void LookupCache::ClearRule(intptr_t rule) {
+  for (intptr_t i = 0; i <= ns_mask_; i++) {
+    if ((ns_entries_[i].cid_and_rule & 0xFFFF) == rule) {
+      ns_entries_[i].cid_and_rule = kIllegalCid << 16;
+    }
+  }
+}
+
+
+void LookupCache::Resize(intptr_t size) {
+  intptr_t capacity = kMinSize;
+  while ((capacity < size) && (capacity < kMaxSize)) {
+    capacity *= 2;
+  }
+  ResizeOrdinary(capacity);
+  ResizeNS(capacity);
+}
+
+
+void LookupCache::ResizeOrdinary(intptr_t size) {
+  ASSERT(Utils::IsPowerOfTwo(size));
+  delete[] ordinary_entries_;
+  ordinary_entries_ = new OrdinaryEntry[size];
+  ordinary_mask_ = size - 1;
+  ClearOrdinary();
+}
+
+
+void LookupCache::ResizeNS(intptr_t size) {
+  ASSERT(Utils::IsPowerOfTwo(size));
+  delete[] ns_entries_;
+  ns_entries_ = new NSEntry[size];
+  ns_mask_ = size - 1;
+  ClearNS();
+}
+
+
+int64_t LookupCache::StatisticAt(Statistic statistic) const {
+  switch (statistic) {
+    case kOrdinarySize: return ordinary_mask_ + 1;
+    case kOrdinaryHits: return ordinary_hits_;
+    case kOrdinaryMisses: return ordinary_misses_;
+    case kOrdinaryEvictions: return ordinary_evictions_;
+    case kNSSize: return ns_mask_ + 1;
+    case kNSHits: return ns_hits_;
+    case kNSMisses: return ns_misses_;
+    case kNSEvictions: return ns_evictions_;
+    default: UNREACHABLE(); return 0;
   }
 }
 
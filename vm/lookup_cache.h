@@ -17,11 +17,31 @@ enum LookupRule {
   kMNU = 258,
 };
 
+// Ordinary and NS lookups are kept in separate tables so a workload dominated
+// by one kind does not drag the other's entries through the data cache. Each
+// table starts at kInitialSize entries. When a table has been evicting more
+// than one entry per kGrowthRatio lookups since the last Clear, the next Clear
+// doubles it, up to kMaxSize.
 class LookupCache {
  public:
-  LookupCache() {
-    Clear();
-  }
+  enum Statistic {
+    kOrdinarySize = 0,
+    kOrdinaryHits,
+    kOrdinaryMisses,
+    kOrdinaryEvictions,
+    kNSSize,
+    kNSHits,
+    kNSMisses,
+    kNSEvictions,
+    kNumStatistics,
+  };
+
+  static const intptr_t kMinSize = 64;
+  static const intptr_t kInitialSize = 512;
+  static const intptr_t kMaxSize = 8192;
+
+  LookupCache();
+  ~LookupCache();
 
   INLINE
   bool LookupOrdinary(intptr_t cid,
@@ -30,20 +50,23 @@ class LookupCache {
     intptr_t hash = cid
         ^ (static_cast<intptr_t>(selector) >> kObjectAlignmentLog2);
 
-    intptr_t probe1 = hash & kMask;
-    if (entries_[probe1].ordinary_cid == cid &&
-        entries_[probe1].ordinary_selector == selector) {
-      *target = entries_[probe1].ordinary_target;
+    intptr_t probe1 = hash & ordinary_mask_;
+    if (ordinary_entries_[probe1].cid == cid &&
+        ordinary_entries_[probe1].selector == selector) {
+      *target = ordinary_entries_[probe1].target;
+      ordinary_hits_++;
       return true;
     }
 
-    intptr_t probe2 = (hash >> 3) & kMask;
-    if (entries_[probe2].ordinary_cid == cid &&
-        entries_[probe2].ordinary_selector == selector) {
-      *target = entries_[probe2].ordinary_target;
+    intptr_t probe2 = (hash >> 3) & ordinary_mask_;
+    if (ordinary_entries_[probe2].cid == cid &&
+        ordinary_entries_[probe2].selector == selector) {
+      *target = ordinary_entries_[probe2].target;
+      ordinary_hits_++;
       return true;
     }
 
+    ordinary_misses_++;
     return false;
   }
 
@@ -63,24 +86,27 @@ class LookupCache {
         ^ (static_cast<intptr_t>(caller) >> kObjectAlignmentLog2);
     intptr_t cid_and_rule = (cid << 16) | rule;
 
-    intptr_t probe1 = hash & kMask;
-    if (entries_[probe1].ns_cid_and_rule == cid_and_rule &&
-        entries_[probe1].ns_selector == selector &&
-        entries_[probe1].ns_caller == caller) {
-      *absent_receiver = entries_[probe1].ns_absent_receiver;
-      *target = entries_[probe1].ns_target;
+    intptr_t probe1 = hash & ns_mask_;
+    if (ns_entries_[probe1].cid_and_rule == cid_and_rule &&
+        ns_entries_[probe1].selector == selector &&
+        ns_entries_[probe1].caller == caller) {
+      *absent_receiver = ns_entries_[probe1].absent_receiver;
+      *target = ns_entries_[probe1].target;
+      ns_hits_++;
       return true;
     }
 
-    intptr_t probe2 = (hash >> 3) & kMask;
-    if (entries_[probe2].ns_cid_and_rule == cid_and_rule &&
-        entries_[probe2].ns_selector == selector &&
-        entries_[probe2].ns_caller == caller) {
-      *absent_receiver = entries_[probe2].ns_absent_receiver;
-      *target = entries_[probe2].ns_target;
+    intptr_t probe2 = (hash >> 3) & ns_mask_;
+    if (ns_entries_[probe2].cid_and_rule == cid_and_rule &&
+        ns_entries_[probe2].selector == selector &&
+        ns_entries_[probe2].caller == caller) {
+      *absent_receiver = ns_entries_[probe2].absent_receiver;
+      *target = ns_entries_[probe2].target;
+      ns_hits_++;
       return true;
     }
 
+    ns_misses_++;
     return false;
   }
 
@@ -92,24 +118,59 @@ class LookupCache {
                 Method target);
 
   void Clear();
+  void ClearSelector(String selector);
+  // Clears the lookups on receivers whose class id is marked: those cached
+  // under it, and the outer and implicit receiver sends that found one.
+  void ClearClassIds(const bool* marked, intptr_t length);
+  void ClearRule(intptr_t rule);
+
+  // Sets both tables to the given size, rounded up to a power of two within
+  // [kMinSize, kMaxSize]. Discards all entries.
+  void Resize(intptr_t size);
+
+  int64_t StatisticAt(Statistic statistic) const;
 
  private:
-  struct Entry {
-    intptr_t ordinary_cid;
-    String ordinary_selector;
-    Method ordinary_target;
-
-    intptr_t ns_cid_and_rule;
-    String ns_selector;
-    Method ns_caller;
-    Object ns_absent_receiver;
-    Method ns_target;
+  struct OrdinaryEntry {
+    intptr_t cid;
+    String selector;
+    Method target;
   };
 
-  static const intptr_t kSize = 512;
-  static const intptr_t kMask = kSize - 1;
+  struct NSEntry {
+    intptr_t cid_and_rule;
+    String selector;
+    Method caller;
+    Object absent_receiver;
+    Method target;
+  };
+
+  static const intptr_t kGrowthRatio = 64;
+
+  void ResizeOrdinary(intptr_t size);
+  void ResizeNS(intptr_t size);
+  void ClearOrdinary();
+  void ClearNS();
+
+  OrdinaryEntry* ordinary_entries_;
+  intptr_t ordinary_mask_;
+  NSEntry* ns_entries_;
+  intptr_t ns_mask_;
+
+  int64_t ordinary_hits_;
+  int64_t ordinary_misses_;
+  int64_t ordinary_evictions_;
+  int64_t ns_hits_;
+  int64_t ns_misses_;
+  int64_t ns_evictions_;
+
+  // Counts at the last Clear, for the growth policy.
+  int64_t ordinary_lookups_at_clear_;
+  int64_t ordinary_evictions_at_clear_;
+  int64_t ns_lookups_at_clear_;
+  int64_t ns_evictions_at_clear_;
 
-  Entry entries_[kSize];
+  DISALLOW_COPY_AND_ASSIGN(LookupCache);
 };
 
 }  // namespace psoup
@@ -6,7 +6,9 @@
 #if !defined(OS_EMSCRIPTEN)
 
 #include <signal.h>
+#include <string.h>
 
+#include "vm/flags.h"
 #include "vm/os.h"
 #include "vm/primordial_soup.h"
 #include "vm/virtual_memory.h"
@@ -16,18 +18,35 @@ static void SIGINT_handler(int sig) {
 }
 
 int main(int argc, const char** argv) {
-  if (argc < 2) {
-    psoup::OS::PrintErr("Usage: %s <program.vfuel>\n", argv[0]);
+  if (!psoup::Flags::ParseEnvironment()) {
+    psoup::Flags::PrintUsage();
+    return -1;
+  }
+  int program = 1;
+  while ((program < argc) && (strncmp(argv[program], "--", 2) == 0)) {
+    if (!psoup::Flags::Parse(argv[program])) {
+      psoup::OS::PrintErr("Unknown flag: %s\n", argv[program]);
+      psoup::Flags::PrintUsage();
+      return -1;
+    }
+    program++;
+  }
+  if (program >= argc) {
+    psoup::OS::PrintErr("Usage: %s [flags] <program.vfuel> [arguments]\n",
+                        argv[0]);
+    psoup::Flags::PrintUsage();
     return -1;
   }
 
-  psoup::VirtualMemory snapshot = psoup::VirtualMemory::MapReadOnly(argv[1]);
+  psoup::VirtualMemory snapshot =
+      psoup::VirtualMemory::MapReadOnly(argv[program]);
   PrimordialSoup_Startup();
   void (*defaultSIGINT)(int) = signal(SIGINT, SIGINT_handler);
 
   intptr_t exit_code =
       PrimordialSoup_RunIsolate(reinterpret_cast<void*>(snapshot.base()),
-                                snapshot.size(), argc - 2, &argv[2]);
+                                snapshot.size(), argc - program - 1,
+                                &argv[program + 1]);
 
   signal(SIGINT, defaultSIGINT);
   PrimordialSoup_Shutdown();
@@ -7,29 +7,21 @@
 
 #include <emscripten.h>
 
+#include "vm/interpreter.h"
 #include "vm/isolate.h"
 #include "vm/message_loop.h"
 #include "vm/os.h"
 #include "vm/port.h"
 #include "vm/primordial_soup.h"
 
-EM_JS(void, _JS_initializeAliens, (), {
-  var aliens = new Array();
-  aliens.push(undefined);  // 0
-  aliens.push(null);       // 1
-  aliens.push(false);      // 2
-  aliens.push(true);       // 3
-  aliens.push(window);     // 4
-  Module.aliens = aliens;
-});
-
 static psoup::Isolate* isolate;
 extern "C" void load_snapshot(void* snapshot, size_t snapshot_length) {
   PrimordialSoup_Startup();
-  _JS_initializeAliens();
 
   uint64_t seed = psoup::OS::CurrentMonotonicNanos();
-  isolate = new psoup::Isolate(snapshot, snapshot_length, seed);
+  PrimordialSoup_IsolateOptions options;
+  PrimordialSoup_DefaultIsolateOptions(&options);
+  isolate = new psoup::Isolate(snapshot, snapshot_length, seed, options);
   int argc = 0;
   const char** argv = NULL;
   isolate->loop()->PostMessage(new psoup::IsolateMessage(ILLEGAL_PORT,
@@ -41,8 +33,11 @@ extern "C" int handle_message() {
       ->HandleMessage();
 }
 
+// Called back by the JavaScript objects of the isolate on this thread, which
+// with threads may be a worker's.
 extern "C" int handle_signal(int handle, int status, int signals, int count) {
-  return static_cast<psoup::EmscriptenMessageLoop*>(isolate->loop())
+  return static_cast<psoup::EmscriptenMessageLoop*>(
+      psoup::Isolate::Current()->loop())
       ->HandleSignal(handle, status, signals, count);
 }
 
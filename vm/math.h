@@ -12,6 +12,35 @@ namespace psoup {
 
 class Math {
  public:
+  static inline bool AddHasOverflow(intptr_t left,
+                                    intptr_t right,
+                                    intptr_t* result) {
+    if (TEST_SLOW_PATH) return true;
+
+#if defined(__GNUC__)
+#if __GNUC__ >= 5
+#define HAS_BUILTIN_ADD_OVERFLOW
+#endif
+#endif
+
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_add_overflow)
+#define HAS_BUILTIN_ADD_OVERFLOW
+#endif
+#endif
+
+#if defined(HAS_BUILTIN_ADD_OVERFLOW)
+    return __builtin_add_overflow(left, right, result);
+#else
+    if (((right > 0) && (left > (INTPTR_MAX - right))) ||
+        ((right < 0) && (left < (INTPTR_MIN - right)))) {
+      return true;
+    }
+    *result = left + right;
+    return false;
+#endif
+  }
+
   static inline bool AddHasOverflow64(int64_t left,
                                       int64_t right,
                                       int64_t* result) {
@@ -41,6 +70,35 @@ class Math {
 #endif
   }
 
+  static inline bool SubtractHasOverflow(intptr_t left,
+                                         intptr_t right,
+                                         intptr_t* result) {
+    if (TEST_SLOW_PATH) return true;
+
+#if defined(__GNUC__)
+#if __GNUC__ >= 5
+#define HAS_BUILTIN_SUB_OVERFLOW
+#endif
+#endif
+
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_sub_overflow)
+#define HAS_BUILTIN_SUB_OVERFLOW
+#endif
+#endif
+
+#if defined(HAS_BUILTIN_SUB_OVERFLOW)
+    return __builtin_sub_overflow(left, right, result);
+#else
+    if (((right > 0) && (left < (INTPTR_MIN + right))) ||
+        ((right < 0) && (left > (INTPTR_MAX + right)))) {
+      return true;
+    }
+    *result = left - right;
+    return false;
+#endif
+  }
+
   static inline bool SubtractHasOverflow64(int64_t left,
                                            int64_t right,
                                            int64_t* result) {
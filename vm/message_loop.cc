@@ -4,25 +4,464 @@
 
 #include "vm/message_loop.h"
 
+#if defined(OS_FUCHSIA)
+#include <zircon/syscalls.h>
+#endif
+
+#include "vm/flags.h"
+#include "vm/heap.h"
 #include "vm/isolate.h"
+#include "vm/lockers.h"
 #include "vm/os.h"
+#include "vm/scheduler.h"
+#include "vm/thread.h"
 
 namespace psoup {
 
+Mutex* MessagePool::mutex_ = NULL;
+MessagePool::FreeMessage* MessagePool::batches_ = NULL;
+thread_local MessagePool::Cache MessagePool::cache_;
+
+void MessagePool::Startup() {
+  if (mutex_ == NULL) {  // Kept from an earlier Startup.
+    mutex_ = new Mutex();
+  }
+}
+
+void* MessagePool::Allocate(size_t size) {
+  ASSERT(size == sizeof(IsolateMessage));
+#if defined(USING_ADDRESS_SANITIZER)
+  void* pointer = malloc(size);
+  if (pointer == NULL) {
+    FATAL("Failed to allocate message");
+  }
+  return pointer;
+#else
+  Cache* cache = &cache_;
+  if (cache->head == NULL) {
+    if (cache->spare != NULL) {
+      cache->head = cache->spare;
+      cache->spare = NULL;
+    } else {
+      cache->head = TakeBatch();
+    }
+    cache->size = cache->head->batch_size;
+  }
+  FreeMessage* message = cache->head;
+  cache->head = message->next;
+  cache->size--;
+  return message;
+#endif
+}
+
+void MessagePool::Free(void* pointer) {
+  if (pointer == NULL) {
+    return;
+  }
+#if defined(USING_ADDRESS_SANITIZER)
+  free(pointer);
+#else
+  Cache* cache = &cache_;
+  if (cache->size == kBatchSize) {
+    if (cache->spare != NULL) {
+      GiveBatch(cache->spare, kBatchSize);
+    }
+    cache->head->batch_size = kBatchSize;
+    cache->spare = cache->head;
+    cache->head = NULL;
+    cache->size = 0;
+  }
+  FreeMessage* message = reinterpret_cast<FreeMessage*>(pointer);
+  message->next = cache->head;
+  cache->head = message;
+  cache->size++;
+#endif
+}
+
+MessagePool::Cache::~Cache() {
+  if (head != NULL) {
+    GiveBatch(head, size);
+  }
+  if (spare != NULL) {
+    GiveBatch(spare, kBatchSize);
+  }
+}
+
+MessagePool::FreeMessage* MessagePool::TakeBatch() {
+  {
+    MutexLocker ml(mutex_);
+    FreeMessage* batch = batches_;
+    if (batch != NULL) {
+      batches_ = batch->next_batch;
+      return batch;
+    }
+  }
+
+  static_assert(sizeof(FreeMessage) <= sizeof(IsolateMessage),
+                "A free message must fit in a message");
+  uint8_t* slab =
+      reinterpret_cast<uint8_t*>(malloc(kBatchSize * sizeof(IsolateMessage)));
+  if (slab == NULL) {
+    FATAL("Failed to allocate messages");
+  }
+  FreeMessage* batch = NULL;
+  for (intptr_t i = kBatchSize - 1; i >= 0; i--) {
+    FreeMessage* message =
+        reinterpret_cast<FreeMessage*>(slab + i * sizeof(IsolateMessage));
+    message->next = batch;
+    batch = message;
+  }
+  batch->batch_size = kBatchSize;
+  return batch;
+}
+
+void MessagePool::GiveBatch(FreeMessage* batch, intptr_t size) {
+  batch->batch_size = size;
+  MutexLocker ml(mutex_);
+  batch->next_batch = batches_;
+  batches_ = batch;
+}
+
+IsolateMessage::~IsolateMessage() {
+#if defined(OS_FUCHSIA)
+  if (handle_ != ZX_HANDLE_INVALID) {
+    zx_handle_close(handle_);
+  }
+#endif
+  if (release_ != NULL) {
+    release_(data_, length_, release_context_);
+    return;
+  }
+  if (data_ == NULL) {
+    return;
+  }
+  if (transferable_) {
+    Heap::FreeTransferable(data_);
+  } else {
+    free(data_);
+  }
+}
+
+IsolateMessage* IsolateMessage::NewText(Port dest,
+                                        const void* data,
+                                        intptr_t length) {
+  uint8_t* copy = reinterpret_cast<uint8_t*>(malloc(length > 0 ? length : 1));
+  if (copy == NULL) {
+    FATAL("Failed to allocate message");
+  }
+  if (length > 0) {
+    memcpy(copy, data, length);
+  }
+  IsolateMessage* message = new IsolateMessage(dest, copy, length);
+  message->text_ = true;
+  return message;
+}
+
+IsolateMessage* IsolateMessage::NewBorrowedText(Port dest,
+                                                const void* data,
+                                                intptr_t length,
+                                                Release release,
+                                                void* context) {
+  ASSERT(release != NULL);
+  IsolateMessage* message = new IsolateMessage(
+      dest, reinterpret_cast<uint8_t*>(const_cast<void*>(data)), length);
+  message->text_ = true;
+  message->release_ = release;
+  message->release_context_ = context;
+  return message;
+}
+
+IsolateMessage* IsolateMessage::NewBorrowed(Port dest,
+                                            const void* data,
+                                            intptr_t length,
+                                            Release release,
+                                            void* context) {
+  ASSERT(release != NULL);
+  IsolateMessage* message = new IsolateMessage(
+      dest, reinterpret_cast<uint8_t*>(const_cast<void*>(data)), length);
+  message->release_ = release;
+  message->release_context_ = context;
+  return message;
+}
+
+#if defined(OS_FUCHSIA)
+IsolateMessage* IsolateMessage::NewHandle(Port dest, zx_handle_t handle) {
+  ASSERT(handle != ZX_HANDLE_INVALID);
+  IsolateMessage* message = new IsolateMessage(dest, NULL, 0);
+  message->handle_ = handle;
+  return message;
+}
+#endif
+
+MessageQueue::~MessageQueue() {
+  IsolateMessage* message = TakeAll();
+  while (message != NULL) {
+    IsolateMessage* next = message->next_;
+    delete message;
+    message = next;
+  }
+}
+
+bool MessageQueue::Post(IsolateMessage* message) {
+  IsolateMessage* head = head_.load(std::memory_order_relaxed);
+  do {
+    message->next_ = (head == Waiting()) ? NULL : head;
+  } while (!head_.compare_exchange_weak(head, message,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed));
+  return head == Waiting();
+}
+
+bool MessageQueue::PrepareToWait() {
+  IsolateMessage* head = NULL;
+  return head_.compare_exchange_strong(head, Waiting(),
+                                       std::memory_order_relaxed) ||
+         (head == Waiting());
+}
+
+IsolateMessage* MessageQueue::TakeAll() {
+  IsolateMessage* message = head_.exchange(NULL, std::memory_order_acquire);
+  if (message == Waiting()) {
+    return NULL;
+  }
+  // Reverse into the order posted.
+  IsolateMessage* result = NULL;
+  while (message != NULL) {
+    IsolateMessage* next = message->next_;
+    message->next_ = result;
+    result = message;
+    message = next;
+  }
+  return result;
+}
+
+MessageLoop* MessageLoop::New(Isolate* isolate, Scheduler* scheduler) {
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+  if (scheduler != NULL) {
+    return new ScheduledMessageLoop(isolate, scheduler);
+  }
+#else
+  ASSERT(scheduler == NULL);
+#endif
+#if defined(OS_LINUX) && IO_URING
+  if (IOUringMessageLoop::IsSupported()) {
+    return new IOUringMessageLoop(isolate);
+  }
+#endif
+  return new PlatformMessageLoop(isolate);
+}
+
 MessageLoop::MessageLoop(Isolate* isolate)
-    : isolate_(isolate), open_ports_(0), open_waits_(0), exit_code_(0) {}
+    : isolate_(isolate),
+      open_ports_(0),
+      open_waits_(0),
+      exit_code_(0),
+      pending_head_(NULL),
+      pending_tail_(NULL),
+      message_budget_(kDefaultMessageBudget),
+      mailbox_capacity_(0),
+      mailbox_depth_(0),
+      mailbox_max_depth_(0),
+      mailbox_admitted_(0),
+      mailbox_rejected_(0),
+      mailbox_dispatched_(0),
+      mailbox_latency_(0),
+      message_trace_(),
+      trace_id_(0),
+      timers_() {}
+
+MessageLoop::~MessageLoop() {
+  DiscardMessages(NULL);
+}
 
-MessageLoop::~MessageLoop() {}
+bool MessageLoop::AdmitMessage(IsolateMessage* message) {
+  intptr_t capacity = mailbox_capacity_.load(std::memory_order_relaxed);
+  intptr_t depth;
+  if (capacity <= 0) {
+    depth = mailbox_depth_.fetch_add(1, std::memory_order_relaxed) + 1;
+  } else {
+    depth = mailbox_depth_.load(std::memory_order_relaxed);
+    do {
+      if (depth >= capacity) {
+        mailbox_rejected_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+    } while (!mailbox_depth_.compare_exchange_weak(depth, depth + 1,
+                                                   std::memory_order_relaxed));
+    depth++;
+  }
+  intptr_t max_depth = mailbox_max_depth_.load(std::memory_order_relaxed);
+  while ((depth > max_depth) &&
+         !mailbox_max_depth_.compare_exchange_weak(max_depth, depth,
+                                                   std::memory_order_relaxed)) {
+  }
+  mailbox_admitted_.fetch_add(1, std::memory_order_relaxed);
+  message->admitted_ = OS::CurrentMonotonicNanos();
+  Isolate* sender = Isolate::Current();
+  if (sender != NULL) {
+    message->trace_id_ = sender->loop()->trace_id();
+  }
+  return true;
+}
+
+void MessageLoop::CountDispatched(IsolateMessage* message, int64_t now) {
+  if (message->admitted_ == 0) {
+    return;  // Not sent to a port.
+  }
+  mailbox_depth_.fetch_sub(1, std::memory_order_relaxed);
+  mailbox_dispatched_++;
+  mailbox_latency_ += now - message->admitted_;
+}
+
+int64_t MessageLoop::MailboxStatisticAt(MailboxStatistic statistic) const {
+  switch (statistic) {
+    case kMailboxDepth:
+      return mailbox_depth_.load(std::memory_order_relaxed);
+    case kMailboxMaxDepth:
+      return mailbox_max_depth_.load(std::memory_order_relaxed);
+    case kMailboxAdmitted:
+      return mailbox_admitted_.load(std::memory_order_relaxed);
+    case kMailboxRejected:
+      return mailbox_rejected_.load(std::memory_order_relaxed);
+    case kMailboxDispatched:
+      return mailbox_dispatched_;
+    case kMailboxLatency:
+      return mailbox_latency_;
+    case kNumMailboxStatistics:
+      break;
+  }
+  UNREACHABLE();
+  return 0;
+}
 
 void MessageLoop::DispatchMessage(IsolateMessage* message) {
+  int64_t start = OS::CurrentMonotonicNanos();
+  CountDispatched(message, start);
   if (isolate_ == NULL) {
     delete message;
     return;
   }
 
+  // Left set after the turn, so that one that yields keeps its trace when
+  // resumed.
+  trace_id_ = message->trace_id_;
+  if ((trace_id_ == 0) && message_trace_.enabled()) {
+    trace_id_ = MessageTrace::NewTraceId();
+  }
+  Port port = message->dest_;
+  int64_t posted = message->admitted_;
+  int64_t dequeued = message->dequeued_;
+
   isolate_->ActivateMessage(message);
   delete message;
   isolate_->Interpret();
+
+  // The trace may have been enabled or disabled during the turn.
+  if (message_trace_.enabled()) {
+    if (trace_id_ == 0) {
+      trace_id_ = MessageTrace::NewTraceId();
+    }
+    message_trace_.Record(trace_id_, port, posted, dequeued, start,
+                          OS::CurrentMonotonicNanos());
+  }
+}
+
+bool MessageLoop::DispatchMessages(IsolateMessage* messages) {
+  if (messages != NULL) {
+    if (pending_head_ == NULL) {
+      pending_head_ = messages;
+    } else {
+      pending_tail_->next_ = messages;
+    }
+    if (message_trace_.enabled()) {
+      int64_t now = OS::CurrentMonotonicNanos();
+      messages->dequeued_ = now;
+      while (messages->next_ != NULL) {
+        messages = messages->next_;
+        messages->dequeued_ = now;
+      }
+    } else {
+      while (messages->next_ != NULL) {
+        messages = messages->next_;
+      }
+    }
+    pending_tail_ = messages;
+  }
+  if (pending_head_ == NULL) {
+    return false;
+  }
+
+  // Split off this turn's batch.
+  IsolateMessage* first = pending_head_;
+  IsolateMessage* last = first;
+  intptr_t count = 1;
+  while ((last->next_ != NULL) &&
+         ((message_budget_ <= 0) || (count < message_budget_))) {
+    last = last->next_;
+    count++;
+  }
+  pending_head_ = last->next_;
+  if (pending_head_ == NULL) {
+    pending_tail_ = NULL;
+  }
+  last->next_ = NULL;
+
+  // A batch is one turn, with no one message to record, so a loop that
+  // records dispatches singly.
+  if ((count == 1) || (isolate_ == NULL) || message_trace_.enabled() ||
+      !isolate_->CanActivateMessages()) {
+    while (first != NULL) {
+      IsolateMessage* next = first->next_;
+      DispatchMessage(first);
+      first = next;
+      if ((first != NULL) && Yielded()) {
+        last->next_ = pending_head_;
+        pending_head_ = first;
+        if (pending_tail_ == NULL) {
+          pending_tail_ = last;
+        }
+        break;
+      }
+    }
+  } else {
+    // The batch's sends cannot be told apart, so they join the first trace
+    // among its messages.
+    trace_id_ = 0;
+    int64_t now = OS::CurrentMonotonicNanos();
+    for (IsolateMessage* message = first; message != NULL;
+         message = message->next_) {
+      CountDispatched(message, now);
+      if (trace_id_ == 0) {
+        trace_id_ = message->trace_id_;
+      }
+    }
+    isolate_->ActivateMessages(first, count);
+    while (first != NULL) {
+      IsolateMessage* next = first->next_;
+      delete first;
+      first = next;
+    }
+    isolate_->Interpret();
+  }
+  return pending_head_ != NULL;
+}
+
+bool MessageLoop::Yielded() const {
+  return (isolate_ != NULL) && isolate_->suspended();
+}
+
+void MessageLoop::DiscardMessages(IsolateMessage* messages) {
+  while (pending_head_ != NULL) {
+    IsolateMessage* next = pending_head_->next_;
+    delete pending_head_;
+    pending_head_ = next;
+  }
+  pending_tail_ = NULL;
+  while (messages != NULL) {
+    IsolateMessage* next = messages->next_;
+    delete messages;
+    messages = next;
+  }
 }
 
 void MessageLoop::DispatchWakeup() {
@@ -30,6 +469,7 @@ void MessageLoop::DispatchWakeup() {
     return;
   }
 
+  trace_id_ = 0;
   isolate_->ActivateWakeup();
   isolate_->Interpret();
 }
@@ -42,6 +482,7 @@ void MessageLoop::DispatchSignal(intptr_t handle,
     return;
   }
 
+  trace_id_ = 0;
   isolate_->ActivateSignal(handle, status, signals, count);
   isolate_->Interpret();
 }
@@ -5,49 +5,204 @@
 #ifndef VM_MESSAGE_LOOP_H_
 #define VM_MESSAGE_LOOP_H_
 
+#include <atomic>
+
+#include "vm/message_trace.h"
 #include "vm/port.h"
+#include "vm/timer_wheel.h"
+
+#if defined(OS_FUCHSIA)
+#include <zircon/types.h>
+#endif
 
 namespace psoup {
 
 class Isolate;
+class Mutex;
+class Scheduler;
+
+// Keeps the memory of deleted IsolateMessages for new ones, instead of a
+// malloc and free for each. Each thread keeps up to two batches of free
+// messages and trades whole batches with a shared list, so a thread that
+// allocates the messages another frees takes the lock once a batch. The
+// messages are allocated a batch at a time and never returned to the system,
+// since threads may hold them past Shutdown. With AddressSanitizer each is
+// malloced instead, so that it still sees their uses after delete.
+class MessagePool {
+ public:
+  static const intptr_t kBatchSize = 64;
+
+  static void Startup();
+
+  static void* Allocate(size_t size);
+  static void Free(void* pointer);
+
+ private:
+  struct FreeMessage {
+    FreeMessage* next;
+    FreeMessage* next_batch;  // In batches_.
+    intptr_t batch_size;
+  };
+
+  struct Cache {
+    ~Cache();  // Gives back the thread's messages as it exits.
+
+    FreeMessage* head;
+    intptr_t size;
+    FreeMessage* spare;  // A full batch, or NULL.
+  };
+
+  static FreeMessage* TakeBatch();
+  static void GiveBatch(FreeMessage* batch, intptr_t size);
+
+  static Mutex* mutex_;
+  static FreeMessage* batches_;  // With mutex_ held.
+  static thread_local Cache cache_;
+};
 
 class IsolateMessage {
  public:
-  IsolateMessage(Port dest, uint8_t* data, intptr_t length)
+  // Called with data the message borrowed, instead of free.
+  typedef void (*Release)(const void* data, size_t length, void* context);
+
+  IsolateMessage(Port dest, uint8_t* data, intptr_t length,
+                 bool transferable = false)
       : next_(NULL), dest_(dest),
-        data_(data), length_(length),
-        argv_(NULL), argc_(0) {}
+        data_(data), length_(length), transferable_(transferable),
+        text_(false), release_(NULL), release_context_(NULL),
+        argv_(NULL), argc_(0), reply_(ILLEGAL_PORT), admitted_(0),
+        dequeued_(0), trace_id_(0) {}
   IsolateMessage(Port dest, int argc, const char** argv)
       : next_(NULL), dest_(dest),
-        data_(NULL), length_(0),
-        argv_(argv), argc_(argc) {}
+        data_(NULL), length_(0), transferable_(false), text_(false),
+        release_(NULL), release_context_(NULL),
+        argv_(argv), argc_(argc), reply_(ILLEGAL_PORT), admitted_(0),
+        dequeued_(0), trace_id_(0) {}
+  // An Array of the reply port, as an embedder starts an isolate.
+  IsolateMessage(Port dest, Port reply)
+      : next_(NULL), dest_(dest),
+        data_(NULL), length_(0), transferable_(false), text_(false),
+        release_(NULL), release_context_(NULL),
+        argv_(NULL), argc_(0), reply_(reply), admitted_(0),
+        dequeued_(0), trace_id_(0) {}
+  // A copy of the embedder's bytes, received as a String.
+  static IsolateMessage* NewText(Port dest, const void* data, intptr_t length);
+  // The embedder's bytes themselves, received as a String. They are given
+  // back to release when the message is deleted.
+  static IsolateMessage* NewBorrowedText(Port dest,
+                                         const void* data,
+                                         intptr_t length,
+                                         Release release,
+                                         void* context);
+  // The same, received as a ByteArray to decode, so that many messages may
+  // share one copy of the bytes.
+  static IsolateMessage* NewBorrowed(Port dest,
+                                     const void* data,
+                                     intptr_t length,
+                                     Release release,
+                                     void* context);
+#if defined(OS_FUCHSIA)
+  // A handle, such as a VMO's, that the message owns until it is received as
+  // a SmallInteger, so the receiver may map the VMO instead of copying it.
+  // Closed with the message if it is never received.
+  static IsolateMessage* NewHandle(Port dest, zx_handle_t handle);
+#endif
 
-  ~IsolateMessage() { free(data_); }
+  ~IsolateMessage();
+
+  static void* operator new(size_t size) {
+    return MessagePool::Allocate(size);
+  }
+  static void operator delete(void* pointer) { MessagePool::Free(pointer); }
+
+  // Links messages for PortMap::PostMessages.
+  void set_next(IsolateMessage* next) { next_ = next; }
 
   Port dest_port() const { return dest_; }
   uint8_t* data() const { return data_; }
   intptr_t length() const { return length_; }
+  // The data is from Heap::AllocateTransferable rather than malloc.
+  bool transferable() const { return transferable_; }
+  // The receiving heap takes the data, which the message then no longer owns.
+  uint8_t* TakeData() {
+    uint8_t* data = data_;
+    data_ = NULL;
+    return data;
+  }
+  // The data is received as a String rather than a message to decode.
+  bool text() const { return text_; }
   int argc() const { return argc_; }
   const char** argv() const { return argv_; }
+  Port reply_port() const { return reply_; }
+#if defined(OS_FUCHSIA)
+  bool has_handle() const { return handle_ != ZX_HANDLE_INVALID; }
+  // The receiving isolate takes the handle, which the message then no longer
+  // owns.
+  zx_handle_t TakeHandle() {
+    zx_handle_t handle = handle_;
+    handle_ = ZX_HANDLE_INVALID;
+    return handle;
+  }
+#endif
 
  private:
+  friend class Isolate;
   friend class MessageLoop;
+  friend class MessageQueue;
+  friend class PortMap;
   friend class EPollMessageLoop;
   friend class EmscriptenMessageLoop;
   friend class FuchsiaMessageLoop;
   friend class IOCPMessageLoop;
   friend class KQueueMessageLoop;
+  friend class ScheduledMessageLoop;
 
   IsolateMessage* next_;
   Port dest_;
-  uint8_t* data_;  // Owned by message.
+  uint8_t* data_;  // Owned by message, unless it has release_.
   intptr_t length_;
+  bool transferable_;
+  bool text_;
+  Release release_;
+  void* release_context_;
   const char** argv_;  // Not owned by message.
   int argc_;
+  Port reply_;
+  int64_t admitted_;  // When counted into a mailbox, or 0.
+  int64_t dequeued_;  // When the loop took it, if it records messages, or 0.
+  int64_t trace_id_;  // That of the turn that sent it, or 0.
+#if defined(OS_FUCHSIA)
+  zx_handle_t handle_ = ZX_HANDLE_INVALID;  // Owned by message.
+#endif
 
   DISALLOW_COPY_AND_ASSIGN(IsolateMessage);
 };
 
+// The messages posted to a loop. Any thread may post, without blocking, but
+// only the loop's thread takes them. The loop marks the queue before it waits,
+// so only a post that finds it waiting has to wake it.
+class MessageQueue {
+ public:
+  MessageQueue() : head_(NULL) {}
+  ~MessageQueue();
+
+  // Answers whether the loop is waiting and must be woken.
+  bool Post(IsolateMessage* message);
+  // Marks the loop as about to wait, unless messages have already arrived.
+  bool PrepareToWait();
+  // In the order posted, linked through next_. Also ends a wait.
+  IsolateMessage* TakeAll();
+
+ private:
+  static IsolateMessage* Waiting() {
+    return reinterpret_cast<IsolateMessage*>(1);
+  }
+
+  std::atomic<IsolateMessage*> head_;  // Newest first, or Waiting().
+
+  DISALLOW_COPY_AND_ASSIGN(MessageQueue);
+};
+
 enum {
   kReadEvent = 0,
   kWriteEvent,
@@ -55,11 +210,64 @@ enum {
   kErrorEvent,
 };
 
+// Beside the events, bits of AwaitSignal's signals that choose how readiness
+// is reported, except on Fuchsia. Without them each loop keeps its default:
+// epoll and io_uring report changes in readiness, kqueue readiness at every
+// turn while it lasts.
+enum {
+  kEdgeTriggered = 8,  // Once per change in readiness.
+  kLevelTriggered,  // At every turn while ready.
+  kOneShot,  // Once, after which the fd must be awaited again.
+};
+
 class MessageLoop {
  public:
+  static const intptr_t kDefaultMessageBudget = 64;
+
+  enum MailboxStatistic {
+    kMailboxDepth = 0,  // Admitted and not yet dispatched.
+    kMailboxMaxDepth,
+    kMailboxAdmitted,
+    kMailboxRejected,  // Sent while the mailbox was full.
+    kMailboxDispatched,
+    kMailboxLatency,  // Total nanoseconds from admission to dispatch.
+    kNumMailboxStatistics,
+  };
+
+  // The best loop this platform offers, or with a scheduler, one whose turns
+  // it runs.
+  static MessageLoop* New(Isolate* isolate, Scheduler* scheduler);
+
   explicit MessageLoop(Isolate* isolate);
   virtual ~MessageLoop();
 
+  // Messages dispatched per turn of the loop, before it again checks for
+  // signals and timers. Zero is unlimited.
+  intptr_t message_budget() const { return message_budget_; }
+  void set_message_budget(intptr_t budget) { message_budget_ = budget; }
+
+  // The most messages for this loop's ports that may wait to be dispatched.
+  // Zero is unlimited.
+  void set_mailbox_capacity(intptr_t capacity) {
+    mailbox_capacity_.store(capacity, std::memory_order_relaxed);
+  }
+  // Called by senders before posting to one of this loop's ports. Answers
+  // false, and the message should be dropped, if the mailbox is full.
+  bool AdmitMessage(IsolateMessage* message);
+  int64_t MailboxStatisticAt(MailboxStatistic statistic) const;
+
+  // The messages this loop has dispatched, when given a capacity.
+  MessageTrace* message_trace() { return &message_trace_; }
+  // The trace of the message being handled, which the messages it sends
+  // join, or 0.
+  int64_t trace_id() const { return trace_id_; }
+
+  // Or NULL, for a loop that runs no isolate.
+  Isolate* isolate() const { return isolate_; }
+
+  // The isolate's timers, whose next wakeup it passes to MessageEpilogue.
+  TimerWheel* timers() { return &timers_; }
+
   virtual void PostMessage(IsolateMessage* message) = 0;
   virtual intptr_t AwaitSignal(intptr_t handle, intptr_t signals) = 0;
   virtual void CancelSignalWait(intptr_t wait_id) = 0;
@@ -68,12 +276,27 @@ class MessageLoop {
 
   virtual intptr_t Run() = 0;
   virtual void Interrupt() = 0;
+  // Whether a turn may yield the loop's thread partway, to be resumed by a
+  // later one.
+  virtual bool CanYield() const { return false; }
 
   Port OpenPort();
   void ClosePort(Port p);
 
  protected:
   void DispatchMessage(IsolateMessage* message);
+  // The message leaves the mailbox.
+  void CountDispatched(IsolateMessage* message, int64_t now);
+  // Dispatches the messages left from the last turn and then these, in the
+  // order posted and up to the budget, in one activation where the snapshot
+  // allows. Answers whether some are left for the next turn.
+  bool DispatchMessages(IsolateMessage* messages);
+  // Whether the isolate's turn yielded, to be resumed before anything more
+  // is dispatched. The messages of a batch after the one it yielded in are
+  // left for the next turns.
+  bool Yielded() const;
+  // Drops these and any left from the last turn, once the loop has exited.
+  void DiscardMessages(IsolateMessage* messages);
   void DispatchWakeup();
   void DispatchSignal(intptr_t handle,
                       intptr_t status,
@@ -86,6 +309,23 @@ class MessageLoop {
   intptr_t exit_code_;
 
  private:
+  IsolateMessage* pending_head_;
+  IsolateMessage* pending_tail_;
+  intptr_t message_budget_;
+
+  std::atomic<intptr_t> mailbox_capacity_;
+  std::atomic<intptr_t> mailbox_depth_;
+  std::atomic<intptr_t> mailbox_max_depth_;
+  std::atomic<int64_t> mailbox_admitted_;
+  std::atomic<int64_t> mailbox_rejected_;
+  int64_t mailbox_dispatched_;  // This and the latency by the loop only.
+  int64_t mailbox_latency_;
+
+  MessageTrace message_trace_;
+  int64_t trace_id_;
+
+  TimerWheel timers_;
+
   DISALLOW_COPY_AND_ASSIGN(MessageLoop);
 };
 
@@ -99,6 +339,7 @@ class MessageLoop {
 #include "vm/message_loop_fuchsia.h"
 #elif defined(OS_LINUX)
 #include "vm/message_loop_epoll.h"
+#include "vm/message_loop_io_uring.h"
 #elif defined(OS_MACOS)
 #include "vm/message_loop_kqueue.h"
 #elif defined(OS_WINDOWS)
@@ -8,16 +8,38 @@
 #include "vm/message_loop.h"
 
 #include <emscripten.h>
+#include <emscripten/threading.h>
 
+#include "vm/lockers.h"
 #include "vm/os.h"
 
 namespace psoup {
 
+// Each isolate's JavaScript objects, in the realm of its thread: the page's,
+// or a worker's, whose global scope stands in for the window.
+EM_JS(void, _JS_initializeAliens, (), {
+  var aliens = new Array();
+  aliens.push(undefined);   // 0
+  aliens.push(null);        // 1
+  aliens.push(false);       // 2
+  aliens.push(true);        // 3
+  aliens.push(globalThis);  // 4
+  Module.aliens = aliens;
+});
+
 EmscriptenMessageLoop::EmscriptenMessageLoop(Isolate* isolate)
     : MessageLoop(isolate),
-      head_(NULL),
-      tail_(NULL),
-      wakeup_(0) {}
+      queue_(),
+      pending_(false),
+      wakeup_(0)
+#if EMSCRIPTEN_THREADS
+      , on_worker_(!emscripten_is_main_browser_thread()),
+      monitor_(),
+      notified_(false)
+#endif
+{
+  _JS_initializeAliens();
+}
 
 EmscriptenMessageLoop::~EmscriptenMessageLoop() {}
 
@@ -33,52 +55,89 @@ void EmscriptenMessageLoop::CancelSignalWait(intptr_t wait_id) {
 
 void EmscriptenMessageLoop::MessageEpilogue(int64_t new_wakeup) {
   wakeup_ = new_wakeup;
+
+#if EMSCRIPTEN_THREADS
+  // The page's isolate may still be called back by its JavaScript objects.
+  if (on_worker_ && (open_ports_ == 0) && (wakeup_ == 0)) {
+    Exit(0);
+  }
+#endif
 }
 
 void EmscriptenMessageLoop::Exit(intptr_t exit_code) {
   exit_code_ = exit_code;
   isolate_ = NULL;
+}
 
+void EmscriptenMessageLoop::Finish() {
   if (open_ports_ > 0) {
     PortMap::CloseAllPorts(this);
   }
 
-  while (head_ != NULL) {
-    IsolateMessage* message = head_;
-    head_ = message->next_;
-    delete message;
-  }
+  DiscardMessages(queue_.TakeAll());
+  pending_ = false;
 }
 
 void EmscriptenMessageLoop::PostMessage(IsolateMessage* message) {
-  if (head_ == NULL) {
-    head_ = tail_ = message;
-  } else {
-    tail_->next_ = message;
-    tail_ = message;
+  if (queue_.Post(message)) {
+    Notify();
   }
 }
 
+void EmscriptenMessageLoop::Notify() {
+#if EMSCRIPTEN_THREADS
+  if (on_worker_) {
+    MonitorLocker ml(&monitor_);
+    notified_ = true;
+    ml.Notify();
+    return;
+  }
+#endif
+  // From a worker, queued for the page's thread; from that thread, at once.
+  MAIN_THREAD_ASYNC_EM_ASM({
+    if (Module.wake) Module.wake();
+  });
+}
+
 intptr_t EmscriptenMessageLoop::Run() {
+#if EMSCRIPTEN_THREADS
+  ASSERT(on_worker_);
+  while (isolate_ != NULL) {
+    if (!pending_ && queue_.PrepareToWait()) {
+      MonitorLocker ml(&monitor_);
+      while (!notified_) {
+        if (wakeup_ == 0) {
+          ml.Wait();
+        } else if (ml.WaitUntilNanos(wakeup_) == Monitor::kTimedOut) {
+          break;
+        }
+      }
+      notified_ = false;
+    }
+
+    if ((wakeup_ != 0) && (OS::CurrentMonotonicNanos() >= wakeup_)) {
+      DispatchWakeup();
+    }
+
+    pending_ = DispatchMessages(queue_.TakeAll());
+  }
+
+  Finish();
+
+  return exit_code_;
+#else
   UNREACHABLE();
   return -1;
+#endif
 }
 
 int EmscriptenMessageLoop::HandleMessage() {
-  IsolateMessage* message = head_;
-  if (head_ != NULL) {
-    head_ = message->next_;
-    if (head_ == NULL) {
-      tail_ = NULL;
-    }
-  }
-
-  if (message == NULL) {
+  if ((wakeup_ != 0) && (OS::CurrentMonotonicNanos() >= wakeup_)) {
     DispatchWakeup();
-  } else {
-    DispatchMessage(message);
   }
 
+  pending_ = DispatchMessages(queue_.TakeAll());
+
   return ComputeTimeout();
 }
 
@@ -91,7 +150,12 @@ int EmscriptenMessageLoop::HandleSignal(int handle,
 }
 
 int EmscriptenMessageLoop::ComputeTimeout() {
-  if (head_ != NULL) return 0;
+  if (isolate_ == NULL) {
+    Finish();
+    return -1;
+  }
+
+  if (pending_ || !queue_.PrepareToWait()) return 0;
 
   if (wakeup_ == 0) return -1;
 
@@ -10,12 +10,18 @@
   instead.
 #endif
 
+#include "vm/flags.h"
 #include "vm/message_loop.h"
+#include "vm/thread.h"
 
 namespace psoup {
 
 #define PlatformMessageLoop EmscriptenMessageLoop
 
+// The first isolate's loop is run by the page, which calls HandleMessage
+// whenever the timeout it last answered passes or Module.wake() is called. With
+// threads, a spawned isolate's loop is run by Run on its Web Worker, which
+// waits for messages in Atomics.wait.
 class EmscriptenMessageLoop : public MessageLoop {
  public:
   explicit EmscriptenMessageLoop(Isolate* isolate);
@@ -30,17 +36,25 @@ class EmscriptenMessageLoop : public MessageLoop {
   intptr_t Run();
   void Interrupt();
 
+  // Milliseconds until the page should call HandleMessage again, or -1 to
+  // wait for Module.wake().
   int HandleMessage();
   int HandleSignal(int handle, int status, int signals, int count);
 
  private:
   int ComputeTimeout();
+  void Notify();
+  // Once the isolate has exited.
+  void Finish();
 
-  IsolateMessage* WaitMessage();
-
-  IsolateMessage* head_;
-  IsolateMessage* tail_;
+  MessageQueue queue_;
+  bool pending_;  // Messages were left for the next turn.
   int64_t wakeup_;
+#if EMSCRIPTEN_THREADS
+  const bool on_worker_;  // Run rather than the page's.
+  Monitor monitor_;
+  bool notified_;  // With monitor_ held.
+#endif
 
   DISALLOW_COPY_AND_ASSIGN(EmscriptenMessageLoop);
 };
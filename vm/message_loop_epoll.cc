@@ -10,11 +10,11 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <stdlib.h>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
 #include <unistd.h>
 
-#include "vm/lockers.h"
 #include "vm/os.h"
 
 namespace psoup {
@@ -36,10 +36,11 @@ static bool SetBlockingHelper(intptr_t fd, bool blocking) {
 
 EPollMessageLoop::EPollMessageLoop(Isolate* isolate)
     : MessageLoop(isolate),
-      mutex_(),
-      head_(NULL),
-      tail_(NULL),
-      wakeup_(0) {
+      queue_(),
+      wakeup_(0),
+      events_(reinterpret_cast<struct epoll_event*>(
+          malloc(kInitialEvents * sizeof(struct epoll_event)))),
+      events_capacity_(kInitialEvents) {
   int result = pipe(interrupt_fds_);
   if (result != 0) {
     FATAL("Failed to create pipe");
@@ -48,7 +49,8 @@ EPollMessageLoop::EPollMessageLoop(Isolate* isolate)
     FATAL("Failed to set pipe fd non-blocking\n");
   }
 
-  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  // Non-blocking: a dispatch earlier in the same batch may have re-armed it.
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
   if (timer_fd_ == -1) {
     FATAL("Failed to creater timer_fd");
   }
@@ -75,6 +77,7 @@ EPollMessageLoop::EPollMessageLoop(Isolate* isolate)
 }
 
 EPollMessageLoop::~EPollMessageLoop() {
+  free(events_);
   close(epoll_fd_);
   close(timer_fd_);
   close(interrupt_fds_[0]);
@@ -83,7 +86,13 @@ EPollMessageLoop::~EPollMessageLoop() {
 
 intptr_t EPollMessageLoop::AwaitSignal(intptr_t fd, intptr_t signals) {
   struct epoll_event event;
-  event.events = EPOLLRDHUP | EPOLLET;
+  event.events = EPOLLRDHUP;
+  if ((signals & (1 << kLevelTriggered)) == 0) {
+    event.events |= EPOLLET;
+  }
+  if (signals & (1 << kOneShot)) {
+    event.events |= EPOLLONESHOT;
+  }
   if (signals & (1 << kReadEvent)) {
     event.events |= EPOLLIN;
   }
@@ -93,6 +102,12 @@ intptr_t EPollMessageLoop::AwaitSignal(intptr_t fd, intptr_t signals) {
   event.data.fd = fd;
 
   int status = epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+  if (status == 0) {
+    open_waits_++;
+  } else if (errno == EEXIST) {
+    // Awaited again, as after a one-shot wait.
+    status = epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event);
+  }
   if (status == -1) {
     FATAL("Failed to add to epoll");
   }
@@ -100,21 +115,28 @@ intptr_t EPollMessageLoop::AwaitSignal(intptr_t fd, intptr_t signals) {
 }
 
 void EPollMessageLoop::CancelSignalWait(intptr_t wait_id) {
-  UNIMPLEMENTED();
+  // The fd may already be closed, which also removes it.
+  if ((epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, wait_id, NULL) == 0) ||
+      (errno == EBADF)) {
+    open_waits_--;
+  }
 }
 
 void EPollMessageLoop::MessageEpilogue(int64_t new_wakeup) {
-  wakeup_ = new_wakeup;
-
-  struct itimerspec it;
-  memset(&it, 0, sizeof(it));
-  if (new_wakeup != 0) {
-    it.it_value.tv_sec = new_wakeup / kNanosecondsPerSecond;
-    it.it_value.tv_nsec = new_wakeup % kNanosecondsPerSecond;
+  // Most turns leave the next timer where it was, and need no system call.
+  if (new_wakeup != wakeup_) {
+    wakeup_ = new_wakeup;
+
+    struct itimerspec it;
+    memset(&it, 0, sizeof(it));
+    if (new_wakeup != 0) {
+      it.it_value.tv_sec = new_wakeup / kNanosecondsPerSecond;
+      it.it_value.tv_nsec = new_wakeup % kNanosecondsPerSecond;
+    }
+    timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &it, NULL);
   }
-  timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &it, NULL);
 
-  if ((open_ports_ == 0) && (wakeup_ == 0)) {
+  if ((open_ports_ == 0) && (open_waits_ == 0) && (wakeup_ == 0)) {
     Exit(0);
   }
 }
@@ -125,13 +147,8 @@ void EPollMessageLoop::Exit(intptr_t exit_code) {
 }
 
 void EPollMessageLoop::PostMessage(IsolateMessage* message) {
-  MutexLocker locker(&mutex_);
-  if (head_ == NULL) {
-    head_ = tail_ = message;
+  if (queue_.Post(message)) {
     Notify();
-  } else {
-    tail_->next_ = message;
-    tail_ = message;
   }
 }
 
@@ -144,19 +161,18 @@ void EPollMessageLoop::Notify() {
 }
 
 IsolateMessage* EPollMessageLoop::TakeMessages() {
-  MutexLocker locker(&mutex_);
-  IsolateMessage* message = head_;
-  head_ = tail_ = NULL;
-  return message;
+  return queue_.TakeAll();
 }
 
 intptr_t EPollMessageLoop::Run() {
+  bool pending = false;
   while (isolate_ != NULL) {
-    static const intptr_t kMaxEvents = 16;
-    struct epoll_event events[kMaxEvents];
-
-    int result = epoll_wait(epoll_fd_, events, kMaxEvents, -1);
-    if (result <= 0) {
+    // Block only if no message is left over or arrived since the last were
+    // taken.
+    int timeout = (!pending && queue_.PrepareToWait()) ? -1 : 0;
+    struct epoll_event* events = events_;
+    int result = epoll_wait(epoll_fd_, events, events_capacity_, timeout);
+    if (result < 0) {
       if ((errno != EWOULDBLOCK) && (errno != EINTR)) {
         FATAL("epoll_wait failed");
       }
@@ -171,9 +187,10 @@ intptr_t EPollMessageLoop::Run() {
           }
         } else if (events[i].data.fd == timer_fd_) {
           int64_t value;
-          ssize_t ignore = read(timer_fd_, &value, sizeof(value));
-          (void)ignore;
-          DispatchWakeup();
+          if (read(timer_fd_, &value, sizeof(value)) == sizeof(value)) {
+            wakeup_ = 0;  // Disarmed by expiring.
+            DispatchWakeup();
+          }
         } else {
           intptr_t fd = events[i].data.fd;
           intptr_t pending = 0;
@@ -195,25 +212,22 @@ intptr_t EPollMessageLoop::Run() {
           DispatchSignal(fd, 0, pending, 0);
         }
       }
+      if ((result == events_capacity_) && (events_capacity_ < kMaxEvents)) {
+        // More may be ready: take more in one wait next time.
+        events_capacity_ *= 2;
+        events_ = reinterpret_cast<struct epoll_event*>(
+            realloc(events_, events_capacity_ * sizeof(struct epoll_event)));
+      }
     }
 
-    IsolateMessage* message = TakeMessages();
-    while (message != NULL) {
-      IsolateMessage* next = message->next_;
-      DispatchMessage(message);
-      message = next;
-    }
+    pending = DispatchMessages(TakeMessages());
   }
 
   if (open_ports_ > 0) {
     PortMap::CloseAllPorts(this);
   }
 
-  while (head_ != NULL) {
-    IsolateMessage* message = head_;
-    head_ = message->next_;
-    delete message;
-  }
+  DiscardMessages(TakeMessages());
 
   return exit_code_;
 }
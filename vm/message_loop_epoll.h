@@ -13,6 +13,8 @@
 #include "vm/message_loop.h"
 #include "vm/thread.h"
 
+struct epoll_event;
+
 namespace psoup {
 
 #define PlatformMessageLoop EPollMessageLoop
@@ -35,10 +37,14 @@ class EPollMessageLoop : public MessageLoop {
   IsolateMessage* TakeMessages();
   void Notify();
 
-  Mutex mutex_;
-  IsolateMessage* head_;
-  IsolateMessage* tail_;
+  // The events taken by one wait grow while waits fill them.
+  static const intptr_t kInitialEvents = 16;
+  static const intptr_t kMaxEvents = 1024;
+
+  MessageQueue queue_;
   int64_t wakeup_;
+  struct epoll_event* events_;
+  intptr_t events_capacity_;
   int interrupt_fds_[2];
   int timer_fd_;
   int epoll_fd_;
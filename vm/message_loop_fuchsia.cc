@@ -8,6 +8,7 @@
 #include "vm/message_loop.h"
 
 #include <lib/async/cpp/task.h>
+#include <poll.h>
 #include <zircon/status.h>
 #include <zircon/syscalls.h>
 
@@ -45,7 +46,7 @@ intptr_t FuchsiaMessageLoop::AwaitSignal(intptr_t handle, intptr_t signals) {
   Wait* wait = new Wait(this, handle, signals);
   zx_status_t status = wait->Begin(async_loop_get_dispatcher(loop_));
   ASSERT(status == ZX_OK);
-  ASSERT((reinterpret_cast<intptr_t>(wait) & 1) == 0);
+  ASSERT((reinterpret_cast<intptr_t>(wait) & 3) == 0);
   return reinterpret_cast<intptr_t>(wait) >> 1;
 }
 
@@ -65,10 +66,71 @@ void FuchsiaMessageLoop::OnHandleReady(async_dispatcher_t* async,
   }
 }
 
+intptr_t FuchsiaMessageLoop::AwaitDescriptor(intptr_t fd, intptr_t signals) {
+  fdio_t* io = fdio_unsafe_fd_to_io(fd);
+  if (io == NULL) {
+    FATAL("Failed to await fd");
+  }
+  uint32_t events = POLLRDHUP;
+  if (signals & (1 << kReadEvent)) {
+    events |= POLLIN;
+  }
+  if (signals & (1 << kWriteEvent)) {
+    events |= POLLOUT;
+  }
+  zx_handle_t handle = ZX_HANDLE_INVALID;
+  zx_signals_t trigger = ZX_SIGNAL_NONE;
+  fdio_unsafe_wait_begin(io, events, &handle, &trigger);
+
+  open_waits_++;
+
+  DescriptorWait* wait = new DescriptorWait(this, fd, io);
+  wait->set_object(handle);
+  wait->set_trigger(trigger);
+  zx_status_t status = wait->Begin(async_loop_get_dispatcher(loop_));
+  ASSERT(status == ZX_OK);
+  // Told apart from AwaitSignal's ids by the low bit.
+  ASSERT((reinterpret_cast<intptr_t>(wait) & 3) == 0);
+  return (reinterpret_cast<intptr_t>(wait) >> 1) | 1;
+}
+
+void FuchsiaMessageLoop::OnDescriptorReady(async_dispatcher_t* async,
+                                           async::WaitBase* base,
+                                           zx_status_t status,
+                                           const zx_packet_signal_t* packet) {
+  DescriptorWait* wait = static_cast<DescriptorWait*>(base);
+  // Level-triggered: awaited again while the fd stays ready.
+  wait->Begin(async_loop_get_dispatcher(loop_));
+
+  uint32_t events = 0;
+  fdio_unsafe_wait_end(wait->io(), packet->observed, &events);
+  intptr_t pending = 0;
+  if (events & POLLERR) {
+    pending |= 1 << kErrorEvent;
+  }
+  if (events & POLLIN) {
+    pending |= 1 << kReadEvent;
+  }
+  if (events & POLLOUT) {
+    pending |= 1 << kWriteEvent;
+  }
+  if (events & (POLLHUP | POLLRDHUP)) {
+    pending |= 1 << kCloseEvent;
+  }
+  DispatchSignal(wait->fd(), status, pending, 0);
+}
+
 void FuchsiaMessageLoop::CancelSignalWait(intptr_t wait_id) {
-  Wait* wait = reinterpret_cast<Wait*>(wait_id << 1);
-  wait->Cancel();
-  delete wait;
+  if ((wait_id & 1) != 0) {
+    DescriptorWait* wait =
+        reinterpret_cast<DescriptorWait*>((wait_id & ~1) << 1);
+    wait->Cancel();
+    delete wait;
+  } else {
+    Wait* wait = reinterpret_cast<Wait*>(wait_id << 1);
+    wait->Cancel();
+    delete wait;
+  }
 
   open_waits_--;
 }
@@ -12,6 +12,7 @@
 
 #include <lib/async-loop/cpp/loop.h>
 #include <lib/async/cpp/wait.h>
+#include <lib/fdio/unsafe.h>
 #include <lib/zx/timer.h>
 
 #include "vm/port.h"
@@ -27,6 +28,10 @@ class FuchsiaMessageLoop : public MessageLoop {
 
   void PostMessage(IsolateMessage* message);
   intptr_t AwaitSignal(intptr_t handle, intptr_t signals);
+  // Awaits a file descriptor, such as a socket's, with the read, write and
+  // edge or level signals the other platforms' loops take, which are
+  // dispatched for the fd. Its wait is cancelled as AwaitSignal's are.
+  intptr_t AwaitDescriptor(intptr_t fd, intptr_t signals);
   void CancelSignalWait(intptr_t wait_id);
   void MessageEpilogue(int64_t new_wakeup);
   void Exit(intptr_t exit_code);
@@ -40,9 +45,32 @@ class FuchsiaMessageLoop : public MessageLoop {
                      zx_status_t status,
                      const zx_packet_signal_t* packet);
 
+  void OnDescriptorReady(async_dispatcher_t* async,
+                         async::WaitBase* wait,
+                         zx_status_t status,
+                         const zx_packet_signal_t* packet);
+
   using Wait =
       async::WaitMethod<FuchsiaMessageLoop, &FuchsiaMessageLoop::OnHandleReady>;
 
+  // Waits on the handle fdio answers for the fd, whose signals fdio maps back
+  // to poll events.
+  class DescriptorWait
+      : public async::WaitMethod<FuchsiaMessageLoop,
+                                 &FuchsiaMessageLoop::OnDescriptorReady> {
+   public:
+    DescriptorWait(FuchsiaMessageLoop* loop, intptr_t fd, fdio_t* io)
+        : WaitMethod(loop), fd_(fd), io_(io) {}
+    ~DescriptorWait() { fdio_unsafe_release(io_); }
+
+    intptr_t fd() const { return fd_; }
+    fdio_t* io() const { return io_; }
+
+   private:
+    intptr_t fd_;
+    fdio_t* io_;
+  };
+
   async_loop_t* loop_;
   zx::timer timer_;
   Wait timer_wait_;
@@ -0,0 +1,434 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/globals.h"  // NOLINT
+#include "vm/flags.h"
+#if defined(OS_LINUX) && IO_URING
+
+#include "vm/message_loop.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "vm/os.h"
+
+namespace psoup {
+
+// The low bits of a submission's user data say what it was for.
+enum {
+  kPollTag = 0,  // The rest is the wait.
+  kWakeTag = 1,
+  kTimerTag = 2,  // The rest is the timer's generation.
+  kIgnoredTag = 3,  // The timer's removals.
+  kRemoveTag = 4,  // The rest is the wait whose poll it removes.
+  kTagBits = 3,
+  kTagMask = (1 << kTagBits) - 1,
+};
+
+static const unsigned kRingEntries = 64;
+
+// What a wait's poll is armed with.
+enum {
+  kWaitRead = 1 << 0,
+  kWaitWrite = 1 << 1,
+  kWaitLevel = 1 << 2,
+  kWaitOnce = 1 << 3,
+};
+
+static int SetupRing(unsigned entries, struct io_uring_params* params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+bool IOUringMessageLoop::IsSupported() {
+  // Multishot polls came with resource tags, in 5.13.
+  static const unsigned kRequired =
+      IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_RSRC_TAGS;
+  static int supported = -1;  // Unknown. Racing probes agree.
+  if (supported == -1) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = SetupRing(1, &params);
+    if (fd >= 0) {
+      close(fd);
+    }
+    supported = ((fd >= 0) && ((params.features & kRequired) == kRequired))
+                    ? 1 : 0;
+  }
+  return supported == 1;
+}
+
+IOUringMessageLoop::IOUringMessageLoop(Isolate* isolate)
+    : MessageLoop(isolate),
+      queue_(),
+      wakeup_(0),
+      timer_armed_(false),
+      timer_generation_(0),
+      wake_value_(0),
+      waits_(NULL),
+      to_submit_(0) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_fd_ = SetupRing(kRingEntries, &params);
+  if (ring_fd_ < 0) {
+    FATAL("Failed to create io_uring");
+  }
+
+  ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (cq_size > ring_size_) {
+    ring_size_ = cq_size;
+  }
+  ring_ = mmap(NULL, ring_size_, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (ring_ == MAP_FAILED) {
+    FATAL("Failed to map io_uring");
+  }
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    FATAL("Failed to map io_uring submissions");
+  }
+  sqes_ = reinterpret_cast<struct io_uring_sqe*>(sqes);
+
+  uint8_t* ring = reinterpret_cast<uint8_t*>(ring_);
+  sq_head_ = reinterpret_cast<unsigned*>(ring + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(ring + params.sq_off.tail);
+  sq_array_ = reinterpret_cast<unsigned*>(ring + params.sq_off.array);
+  sq_mask_ = *reinterpret_cast<unsigned*>(ring + params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  cq_head_ = reinterpret_cast<unsigned*>(ring + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(ring + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned*>(ring + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe*>(ring + params.cq_off.cqes);
+
+  wake_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (wake_fd_ == -1) {
+    FATAL("Failed to create eventfd");
+  }
+  ArmWake();
+}
+
+IOUringMessageLoop::~IOUringMessageLoop() {
+  while (waits_ != NULL) {
+    PollWait* next = waits_->next;
+    delete waits_;
+    waits_ = next;
+  }
+  munmap(sqes_, sqes_size_);
+  munmap(ring_, ring_size_);
+  close(ring_fd_);
+  close(wake_fd_);
+}
+
+struct io_uring_sqe* IOUringMessageLoop::NextSubmission() {
+  unsigned tail = *sq_tail_;
+  if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) {
+    Enter(false);
+    tail = *sq_tail_;
+  }
+  unsigned index = tail & sq_mask_;
+  struct io_uring_sqe* sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  to_submit_++;
+  return sqe;
+}
+
+void IOUringMessageLoop::Enter(bool wait) {
+  unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+  for (;;) {
+    int result = syscall(__NR_io_uring_enter, ring_fd_, to_submit_,
+                         wait ? 1 : 0, flags, NULL, 0);
+    if (result >= 0) {
+      to_submit_ -= result;
+      return;
+    }
+    if (errno == EINTR) {
+      if (wait) {
+        return;
+      }
+    } else if ((errno == EBUSY) || (errno == EAGAIN)) {
+      // Completions must be reaped before more can be submitted.
+      HandleCompletions();
+    } else {
+      FATAL("io_uring_enter failed");
+    }
+  }
+}
+
+void IOUringMessageLoop::HandleCompletions() {
+  unsigned head = *cq_head_;
+  while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+    struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+    uint64_t tag = cqe->user_data;
+    int32_t result = cqe->res;
+    uint32_t flags = cqe->flags;
+    // Release the entry first: handling may dispatch, and so submit more.
+    head++;
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    HandleCompletion(tag, result, flags);
+  }
+}
+
+void IOUringMessageLoop::HandleCompletion(uint64_t tag,
+                                          int32_t result,
+                                          uint32_t flags) {
+  switch (tag & kTagMask) {
+    case kWakeTag:
+      // The message queue is checked after every wait.
+      ArmWake();
+      break;
+    case kTimerTag:
+      if ((tag >> kTagBits) != timer_generation_) {
+        break;  // Removed, or replaced before it could be.
+      }
+      timer_armed_ = false;
+      if ((wakeup_ != 0) && (OS::CurrentMonotonicNanos() >= wakeup_)) {
+        DispatchWakeup();
+      }
+      break;
+    case kPollTag: {
+      PollWait* wait = reinterpret_cast<PollWait*>(tag);
+      if ((flags & IORING_CQE_F_MORE) == 0) {
+        wait->armed = false;
+      }
+      if (wait->cancelled) {
+        // Queued before the removal, or the -ECANCELED it ends the poll with.
+        ReleaseIfDone(wait);
+        break;
+      }
+      intptr_t pending = 0;
+      if (result < 0) {
+        pending |= 1 << kErrorEvent;
+      } else {
+        if (result & POLLERR) {
+          pending |= 1 << kErrorEvent;
+        }
+        if (result & POLLIN) {
+          pending |= 1 << kReadEvent;
+        }
+        if (result & POLLOUT) {
+          pending |= 1 << kWriteEvent;
+        }
+        if (result & (POLLHUP | POLLRDHUP)) {
+          pending |= 1 << kCloseEvent;
+        }
+        if (!wait->armed && ((wait->flags & kWaitOnce) == 0)) {
+          // A level-triggered poll, or the kernel ended a multishot one.
+          ArmPoll(wait);
+        }
+      }
+      // May cancel the wait, and so free it.
+      DispatchSignal(wait->fd, 0, pending, 0);
+      break;
+    }
+    case kRemoveTag: {
+      PollWait* wait = reinterpret_cast<PollWait*>(tag & ~kTagMask);
+      wait->removing = false;
+      ReleaseIfDone(wait);
+      break;
+    }
+    case kIgnoredTag:
+      break;
+  }
+}
+
+void IOUringMessageLoop::ArmWake() {
+  struct io_uring_sqe* sqe = NextSubmission();
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = wake_fd_;
+  sqe->addr = reinterpret_cast<uword>(&wake_value_);
+  sqe->len = sizeof(wake_value_);
+  sqe->user_data = kWakeTag;
+}
+
+void IOUringMessageLoop::ArmTimer() {
+  timer_generation_++;
+  // Copied by the kernel when submitted.
+  timer_spec_.tv_sec = wakeup_ / kNanosecondsPerSecond;
+  timer_spec_.tv_nsec = wakeup_ % kNanosecondsPerSecond;
+  struct io_uring_sqe* sqe = NextSubmission();
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->fd = -1;
+  sqe->addr = reinterpret_cast<uword>(&timer_spec_);
+  sqe->len = 1;
+  sqe->timeout_flags = IORING_TIMEOUT_ABS;
+  sqe->user_data = (timer_generation_ << kTagBits) | kTimerTag;
+  timer_armed_ = true;
+}
+
+void IOUringMessageLoop::ArmPoll(PollWait* wait) {
+  unsigned events = POLLRDHUP;
+  if (wait->flags & kWaitRead) {
+    events |= POLLIN;
+  }
+  if (wait->flags & kWaitWrite) {
+    events |= POLLOUT;
+  }
+  // Before submitting, which may handle completions.
+  wait->armed = true;
+  struct io_uring_sqe* sqe = NextSubmission();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = wait->fd;
+  sqe->poll32_events = events;  // Little-endian only.
+  // A single poll, re-armed once it completes, reports readiness at every
+  // turn while it lasts.
+  if ((wait->flags & (kWaitLevel | kWaitOnce)) == 0) {
+    sqe->len = IORING_POLL_ADD_MULTI;
+  }
+  sqe->user_data = reinterpret_cast<uword>(wait) | kPollTag;
+}
+
+void IOUringMessageLoop::ReleaseIfDone(PollWait* wait) {
+  if (!wait->cancelled || wait->armed || wait->removing) {
+    return;
+  }
+  if (wait->previous == NULL) {
+    waits_ = wait->next;
+  } else {
+    wait->previous->next = wait->next;
+  }
+  if (wait->next != NULL) {
+    wait->next->previous = wait->previous;
+  }
+  delete wait;
+}
+
+intptr_t IOUringMessageLoop::AwaitSignal(intptr_t fd, intptr_t signals) {
+  PollWait* wait = new PollWait();
+  wait->fd = fd;
+  // What to re-arm the poll with.
+  wait->flags = 0;
+  if (signals & (1 << kReadEvent)) {
+    wait->flags |= kWaitRead;
+  }
+  if (signals & (1 << kWriteEvent)) {
+    wait->flags |= kWaitWrite;
+  }
+  if (signals & (1 << kLevelTriggered)) {
+    wait->flags |= kWaitLevel;
+  }
+  if (signals & (1 << kOneShot)) {
+    wait->flags |= kWaitOnce;
+  }
+  wait->armed = false;
+  wait->removing = false;
+  wait->cancelled = false;
+  wait->previous = NULL;
+  wait->next = waits_;
+  if (waits_ != NULL) {
+    waits_->previous = wait;
+  }
+  waits_ = wait;
+  ASSERT((reinterpret_cast<uword>(wait) & kTagMask) == 0);
+
+  ArmPoll(wait);
+  open_waits_++;
+  return reinterpret_cast<intptr_t>(wait) >> 1;
+}
+
+void IOUringMessageLoop::CancelSignalWait(intptr_t wait_id) {
+  PollWait* wait = reinterpret_cast<PollWait*>(wait_id << 1);
+  ASSERT(!wait->cancelled);
+  // Completions already queued for the poll are dropped from here on, and
+  // the wait freed once the poll and its removal have both ended.
+  wait->cancelled = true;
+  if (wait->armed) {
+    // Before submitting, which may handle completions.
+    wait->removing = true;
+    struct io_uring_sqe* sqe = NextSubmission();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<uword>(wait) | kPollTag;
+    sqe->user_data = reinterpret_cast<uword>(wait) | kRemoveTag;
+  }
+  ReleaseIfDone(wait);
+  open_waits_--;
+}
+
+void IOUringMessageLoop::MessageEpilogue(int64_t new_wakeup) {
+  if (new_wakeup != wakeup_) {
+    if (timer_armed_) {
+      struct io_uring_sqe* sqe = NextSubmission();
+      sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+      sqe->fd = -1;
+      sqe->addr = (timer_generation_ << kTagBits) | kTimerTag;
+      sqe->user_data = kIgnoredTag;
+      timer_generation_++;  // Orphans the old timer's completion.
+      timer_armed_ = false;
+    }
+    wakeup_ = new_wakeup;
+    if (new_wakeup != 0) {
+      ArmTimer();
+    }
+  }
+
+  if ((open_ports_ == 0) && (open_waits_ == 0) && (wakeup_ == 0)) {
+    Exit(0);
+  }
+}
+
+void IOUringMessageLoop::Exit(intptr_t exit_code) {
+  exit_code_ = exit_code;
+  isolate_ = NULL;
+}
+
+void IOUringMessageLoop::PostMessage(IsolateMessage* message) {
+  if (queue_.Post(message)) {
+    Notify();
+  }
+}
+
+void IOUringMessageLoop::Notify() {
+  uint64_t value = 1;
+  ssize_t written = write(wake_fd_, &value, sizeof(value));
+  if (written != sizeof(value)) {
+    FATAL("Failed to write to eventfd");
+  }
+}
+
+IsolateMessage* IOUringMessageLoop::TakeMessages() {
+  return queue_.TakeAll();
+}
+
+intptr_t IOUringMessageLoop::Run() {
+  bool pending = false;
+  while (isolate_ != NULL) {
+    // Block only if no message is left over or arrived since the last were
+    // taken. Otherwise completions are read straight from the ring.
+    bool wait = !pending && queue_.PrepareToWait();
+    if (wait || (to_submit_ != 0)) {
+      Enter(wait);
+    }
+    HandleCompletions();
+
+    pending = DispatchMessages(TakeMessages());
+  }
+
+  if (open_ports_ > 0) {
+    PortMap::CloseAllPorts(this);
+  }
+
+  DiscardMessages(TakeMessages());
+
+  return exit_code_;
+}
+
+void IOUringMessageLoop::Interrupt() {
+  Exit(SIGINT);
+  Notify();
+}
+
+}  // namespace psoup
+
+#endif  // defined(OS_LINUX) && IO_URING
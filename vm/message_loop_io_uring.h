@@ -0,0 +1,104 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_MESSAGE_LOOP_IO_URING_H_
+#define VM_MESSAGE_LOOP_IO_URING_H_
+
+#if !defined(VM_MESSAGE_LOOP_H_)
+#error Do not include message_loop_io_uring.h directly; use message_loop.h \
+  instead.
+#endif
+
+#include "vm/flags.h"
+
+#if IO_URING
+
+#include <linux/io_uring.h>
+
+#include "vm/message_loop.h"
+
+namespace psoup {
+
+// A loop whose waits, timer and signal polls all go through one io_uring, so
+// a turn that only re-arms them needs no system call, and one that blocks
+// needs one. Chosen over EPollMessageLoop when the kernel supports it.
+class IOUringMessageLoop : public MessageLoop {
+ public:
+  // Whether this kernel has the io_uring features the loop uses.
+  static bool IsSupported();
+
+  explicit IOUringMessageLoop(Isolate* isolate);
+  ~IOUringMessageLoop();
+
+  void PostMessage(IsolateMessage* message);
+  intptr_t AwaitSignal(intptr_t handle, intptr_t signals);
+  void CancelSignalWait(intptr_t wait_id);
+  void MessageEpilogue(int64_t new_wakeup);
+  void Exit(intptr_t exit_code);
+
+  intptr_t Run();
+  void Interrupt();
+
+ private:
+  IsolateMessage* TakeMessages();
+  void Notify();
+
+  struct io_uring_sqe* NextSubmission();
+  // Submits what is queued, and with wait, blocks until something completes.
+  void Enter(bool wait);
+  void HandleCompletions();
+  void HandleCompletion(uint64_t tag, int32_t result, uint32_t flags);
+
+  // A wait's poll, whose address is its id and the poll's user data. Kept
+  // after the wait is cancelled until the kernel is done with the poll and
+  // its removal, whose completions may still be queued.
+  struct PollWait {
+    intptr_t fd;
+    intptr_t flags;
+    bool armed;  // A poll is submitted and has not yet ended.
+    bool removing;  // Its removal is submitted and has not yet completed.
+    bool cancelled;
+    PollWait* previous;
+    PollWait* next;
+  };
+
+  void ArmWake();
+  void ArmTimer();
+  void ArmPoll(PollWait* wait);
+  // Frees a cancelled wait once nothing more will complete for it.
+  void ReleaseIfDone(PollWait* wait);
+
+  MessageQueue queue_;
+  int64_t wakeup_;
+  bool timer_armed_;
+  uint64_t timer_generation_;  // Tells a stale timer's completion apart.
+  struct __kernel_timespec timer_spec_;
+  int wake_fd_;  // An eventfd, always being read.
+  uint64_t wake_value_;
+  PollWait* waits_;  // Those not yet freed, live or cancelled.
+
+  int ring_fd_;
+  void* ring_;
+  size_t ring_size_;
+  struct io_uring_sqe* sqes_;
+  size_t sqes_size_;
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_array_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned to_submit_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  struct io_uring_cqe* cqes_;
+
+  DISALLOW_COPY_AND_ASSIGN(IOUringMessageLoop);
+};
+
+}  // namespace psoup
+
+#endif  // IO_URING
+
+#endif  // VM_MESSAGE_LOOP_IO_URING_H_
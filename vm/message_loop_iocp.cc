@@ -9,17 +9,53 @@
 
 #include <signal.h>
 
-#include "vm/lockers.h"
 #include "vm/os.h"
 
 namespace psoup {
 
+// Room for AcceptEx's local and remote addresses.
+static const DWORD kAcceptAddressSize = sizeof(SOCKADDR_STORAGE) + 16;
+
+OverlappedOperation::OverlappedOperation(Kind kind,
+                                         intptr_t id,
+                                         HANDLE handle,
+                                         intptr_t size)
+    : kind_(kind),
+      id_(id),
+      handle_(handle),
+      buffer_(NULL),
+      error_(0),
+      transferred_(0),
+      accepted_(INVALID_SOCKET),
+      completed_(false),
+      cancelled_(false) {
+  memset(&overlapped_, 0, sizeof(overlapped_));
+  if (size > 0) {
+    buffer_ = reinterpret_cast<uint8_t*>(malloc(size));
+    if (buffer_ == NULL) {
+      FATAL("Failed to allocate I/O buffer");
+    }
+  }
+}
+
+OverlappedOperation::~OverlappedOperation() {
+  free(buffer_);
+  if (accepted_ != INVALID_SOCKET) {
+    closesocket(accepted_);
+  }
+}
+
 IOCPMessageLoop::IOCPMessageLoop(Isolate* isolate)
     : MessageLoop(isolate),
-      mutex_(),
-      head_(NULL),
-      tail_(NULL),
-      wakeup_(0) {
+      queue_(),
+      wakeup_(0),
+      operations_(NULL),
+      free_ids_(NULL),
+      num_free_ids_(0),
+      operations_capacity_(0),
+      num_pending_(0),
+      accept_ex_(NULL),
+      connect_ex_(NULL) {
   completion_port_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, NULL,
                                             1);
   if (completion_port_ == NULL) {
@@ -28,6 +64,33 @@ IOCPMessageLoop::IOCPMessageLoop(Isolate* isolate)
 }
 
 IOCPMessageLoop::~IOCPMessageLoop() {
+  // The kernel may still write the buffers of pending operations, so they are
+  // cancelled and awaited before they are freed.
+  for (intptr_t id = 1; id < operations_capacity_; id++) {
+    OverlappedOperation* operation = operations_[id];
+    if ((operation != NULL) && !operation->completed_) {
+      CancelIoEx(operation->handle_, &operation->overlapped_);
+    }
+  }
+  while (num_pending_ > 0) {
+    DWORD bytes;
+    ULONG_PTR key;
+    OVERLAPPED* overlapped;
+    BOOL ok = GetQueuedCompletionStatus(completion_port_, &bytes, &key,
+                                        &overlapped, INFINITE);
+    if ((overlapped != NULL) && (key == kOverlappedKey)) {
+      OverlappedOperation* operation = OverlappedOperation::From(overlapped);
+      operation->completed_ = true;
+      num_pending_--;
+    } else if (!ok && (overlapped == NULL)) {
+      FATAL("GetQueuedCompletionStatus failed");
+    }
+  }
+  for (intptr_t id = 1; id < operations_capacity_; id++) {
+    delete operations_[id];
+  }
+  delete[] operations_;
+  delete[] free_ids_;
   CloseHandle(completion_port_);
 }
 
@@ -37,13 +100,269 @@ intptr_t IOCPMessageLoop::AwaitSignal(intptr_t fd, intptr_t signals) {
 }
 
 void IOCPMessageLoop::CancelSignalWait(intptr_t wait_id) {
-  UNIMPLEMENTED();
+  // Only the overlapped operations are waits here.
+  if ((wait_id <= 0) || (wait_id >= operations_capacity_)) {
+    return;
+  }
+  OverlappedOperation* operation = operations_[wait_id];
+  if (operation == NULL) {
+    return;
+  }
+  if (operation->completed_) {
+    FreeOperation(operation);
+  } else if (!operation->cancelled_) {
+    operation->cancelled_ = true;
+    CancelIoEx(operation->handle_, &operation->overlapped_);
+  }
+}
+
+bool IOCPMessageLoop::Associate(HANDLE handle, DWORD* error) {
+  if (CreateIoCompletionPort(handle, completion_port_, kOverlappedKey, 0) !=
+      NULL) {
+    return true;
+  }
+  // Associated by an earlier operation.
+  *error = GetLastError();
+  return *error == ERROR_INVALID_PARAMETER;
+}
+
+OverlappedOperation* IOCPMessageLoop::NewOperation(
+    OverlappedOperation::Kind kind, HANDLE handle, intptr_t size) {
+  if (num_free_ids_ == 0) {
+    intptr_t capacity =
+        (operations_capacity_ == 0) ? 64 : 2 * operations_capacity_;
+    OverlappedOperation** operations = new OverlappedOperation*[capacity];
+    intptr_t* free_ids = new intptr_t[capacity];
+    for (intptr_t id = 0; id < operations_capacity_; id++) {
+      operations[id] = operations_[id];
+    }
+    // Id 0 is never used.
+    intptr_t first = (operations_capacity_ == 0) ? 1 : operations_capacity_;
+    for (intptr_t id = capacity - 1; id >= first; id--) {
+      operations[id] = NULL;
+      free_ids[num_free_ids_++] = id;
+    }
+    operations[0] = NULL;
+    delete[] operations_;
+    delete[] free_ids_;
+    operations_ = operations;
+    free_ids_ = free_ids;
+    operations_capacity_ = capacity;
+  }
+  intptr_t id = free_ids_[--num_free_ids_];
+  OverlappedOperation* operation =
+      new OverlappedOperation(kind, id, handle, size);
+  operations_[id] = operation;
+  return operation;
+}
+
+void IOCPMessageLoop::FreeOperation(OverlappedOperation* operation) {
+  ASSERT(operation->completed_);
+  ASSERT(operations_[operation->id_] == operation);
+  operations_[operation->id_] = NULL;
+  free_ids_[num_free_ids_++] = operation->id_;
+  delete operation;
+}
+
+intptr_t IOCPMessageLoop::Started(OverlappedOperation* operation,
+                                  BOOL ok,
+                                  DWORD* error) {
+  if (!ok) {
+    *error = GetLastError();
+    if ((*error != ERROR_IO_PENDING) && (*error != WSA_IO_PENDING)) {
+      operation->completed_ = true;  // No completion will come.
+      FreeOperation(operation);
+      return -1;
+    }
+  }
+  // Even one done at once is dispatched through the port.
+  num_pending_++;
+  open_waits_++;
+  return operation->id_;
+}
+
+intptr_t IOCPMessageLoop::StartRead(HANDLE handle,
+                                    intptr_t size,
+                                    int64_t position,
+                                    DWORD* error) {
+  if (!Associate(handle, error)) {
+    return -1;
+  }
+  OverlappedOperation* operation =
+      NewOperation(OverlappedOperation::kRead, handle, size);
+  operation->overlapped_.Offset = static_cast<DWORD>(position);
+  operation->overlapped_.OffsetHigh = static_cast<DWORD>(position >> 32);
+  BOOL ok = ReadFile(handle, operation->buffer_, static_cast<DWORD>(size),
+                     NULL, &operation->overlapped_);
+  return Started(operation, ok, error);
+}
+
+intptr_t IOCPMessageLoop::StartWrite(HANDLE handle,
+                                     const uint8_t* bytes,
+                                     intptr_t size,
+                                     int64_t position,
+                                     DWORD* error) {
+  if (!Associate(handle, error)) {
+    return -1;
+  }
+  OverlappedOperation* operation =
+      NewOperation(OverlappedOperation::kWrite, handle, size);
+  if (size > 0) {
+    memcpy(operation->buffer_, bytes, size);
+  }
+  operation->overlapped_.Offset = static_cast<DWORD>(position);
+  operation->overlapped_.OffsetHigh = static_cast<DWORD>(position >> 32);
+  BOOL ok = WriteFile(handle, operation->buffer_, static_cast<DWORD>(size),
+                      NULL, &operation->overlapped_);
+  return Started(operation, ok, error);
+}
+
+intptr_t IOCPMessageLoop::StartAccept(SOCKET listener, DWORD* error) {
+  HANDLE handle = reinterpret_cast<HANDLE>(listener);
+  if (!Associate(handle, error)) {
+    return -1;
+  }
+  if (accept_ex_ == NULL) {
+    GUID guid = WSAID_ACCEPTEX;
+    DWORD size;
+    if (WSAIoctl(listener, SIO_GET_EXTENSION_FUNCTION_POINTER,
+                 &guid, sizeof(guid), &accept_ex_, sizeof(accept_ex_),
+                 &size, NULL, NULL) != 0) {
+      *error = WSAGetLastError();
+      accept_ex_ = NULL;
+      return -1;
+    }
+  }
+  // The accepted socket must be of the listener's kind.
+  WSAPROTOCOL_INFOW info;
+  int info_size = sizeof(info);
+  if (getsockopt(listener, SOL_SOCKET, SO_PROTOCOL_INFOW,
+                 reinterpret_cast<char*>(&info), &info_size) != 0) {
+    *error = WSAGetLastError();
+    return -1;
+  }
+  SOCKET accepted = WSASocketW(info.iAddressFamily, info.iSocketType,
+                               info.iProtocol, NULL, 0, WSA_FLAG_OVERLAPPED);
+  if (accepted == INVALID_SOCKET) {
+    *error = WSAGetLastError();
+    return -1;
+  }
+  OverlappedOperation* operation =
+      NewOperation(OverlappedOperation::kAccept, handle,
+                   2 * kAcceptAddressSize);
+  operation->accepted_ = accepted;
+  DWORD received;
+  BOOL ok = accept_ex_(listener, accepted, operation->buffer_, 0,
+                       kAcceptAddressSize, kAcceptAddressSize, &received,
+                       &operation->overlapped_);
+  if (!ok) {
+    // AcceptEx reports through WSAGetLastError, which Started reads as
+    // GetLastError.
+    SetLastError(WSAGetLastError());
+  }
+  return Started(operation, ok, error);
+}
+
+intptr_t IOCPMessageLoop::StartConnect(SOCKET socket,
+                                       const struct sockaddr* address,
+                                       int address_size,
+                                       DWORD* error) {
+  HANDLE handle = reinterpret_cast<HANDLE>(socket);
+  if (!Associate(handle, error)) {
+    return -1;
+  }
+  if (connect_ex_ == NULL) {
+    GUID guid = WSAID_CONNECTEX;
+    DWORD size;
+    if (WSAIoctl(socket, SIO_GET_EXTENSION_FUNCTION_POINTER,
+                 &guid, sizeof(guid), &connect_ex_, sizeof(connect_ex_),
+                 &size, NULL, NULL) != 0) {
+      *error = WSAGetLastError();
+      connect_ex_ = NULL;
+      return -1;
+    }
+  }
+  // ConnectEx takes only a bound socket.
+  SOCKADDR_STORAGE any;
+  memset(&any, 0, sizeof(any));
+  any.ss_family = address->sa_family;
+  if ((bind(socket, reinterpret_cast<struct sockaddr*>(&any),
+            address_size) != 0) &&
+      (WSAGetLastError() != WSAEINVAL)) {
+    *error = WSAGetLastError();
+    return -1;
+  }
+  OverlappedOperation* operation =
+      NewOperation(OverlappedOperation::kConnect, handle, 0);
+  BOOL ok = connect_ex_(socket, address, address_size, NULL, 0, NULL,
+                        &operation->overlapped_);
+  if (!ok) {
+    SetLastError(WSAGetLastError());
+  }
+  return Started(operation, ok, error);
+}
+
+OverlappedOperation* IOCPMessageLoop::CompletedOperation(intptr_t id) {
+  if ((id <= 0) || (id >= operations_capacity_)) {
+    return NULL;
+  }
+  OverlappedOperation* operation = operations_[id];
+  if ((operation == NULL) || !operation->completed_) {
+    return NULL;
+  }
+  return operation;
+}
+
+void IOCPMessageLoop::HandleCompletion(OVERLAPPED* overlapped,
+                                       DWORD error,
+                                       DWORD bytes) {
+  OverlappedOperation* operation = OverlappedOperation::From(overlapped);
+  ASSERT(!operation->completed_);
+  operation->completed_ = true;
+  operation->error_ = error;
+  operation->transferred_ = bytes;
+  num_pending_--;
+  open_waits_--;
+  if (operation->cancelled_) {
+    FreeOperation(operation);
+    return;
+  }
+
+  intptr_t signals;
+  if ((operation->kind_ == OverlappedOperation::kWrite) ||
+      (operation->kind_ == OverlappedOperation::kConnect)) {
+    signals = 1 << kWriteEvent;
+  } else {
+    signals = 1 << kReadEvent;
+  }
+  if (error != 0) {
+    signals |= 1 << kErrorEvent;
+  } else if (operation->kind_ == OverlappedOperation::kAccept) {
+    SOCKET listener = reinterpret_cast<SOCKET>(operation->handle_);
+    if (setsockopt(operation->accepted_, SOL_SOCKET,
+                   SO_UPDATE_ACCEPT_CONTEXT,
+                   reinterpret_cast<char*>(&listener),
+                   sizeof(listener)) != 0) {
+      operation->error_ = WSAGetLastError();
+      signals |= 1 << kErrorEvent;
+    }
+  } else if (operation->kind_ == OverlappedOperation::kConnect) {
+    SOCKET socket = reinterpret_cast<SOCKET>(operation->handle_);
+    if (setsockopt(socket, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, NULL,
+                   0) != 0) {
+      operation->error_ = WSAGetLastError();
+      signals |= 1 << kErrorEvent;
+    }
+  } else if ((bytes == 0) && (operation->kind_ == OverlappedOperation::kRead)) {
+    signals |= 1 << kCloseEvent;  // At the end.
+  }
+  DispatchSignal(operation->id_, operation->error_, signals, bytes);
 }
 
 void IOCPMessageLoop::MessageEpilogue(int64_t new_wakeup) {
   wakeup_ = new_wakeup;
 
-  if ((open_ports_ == 0) && (wakeup_ == 0)) {
+  if ((open_ports_ == 0) && (open_waits_ == 0) && (wakeup_ == 0)) {
     Exit(0);
   }
 }
@@ -54,13 +373,8 @@ void IOCPMessageLoop::Exit(intptr_t exit_code) {
 }
 
 void IOCPMessageLoop::PostMessage(IsolateMessage* message) {
-  MutexLocker locker(&mutex_);
-  if (head_ == NULL) {
-    head_ = tail_ = message;
+  if (queue_.Post(message)) {
     Notify();
-  } else {
-    tail_->next_ = message;
-    tail_ = message;
   }
 }
 
@@ -73,16 +387,17 @@ void IOCPMessageLoop::Notify() {
 }
 
 IsolateMessage* IOCPMessageLoop::TakeMessages() {
-  MutexLocker locker(&mutex_);
-  IsolateMessage* message = head_;
-  head_ = tail_ = NULL;
-  return message;
+  return queue_.TakeAll();
 }
 
 intptr_t IOCPMessageLoop::Run() {
+  bool pending = false;
   while (isolate_ != NULL) {
     DWORD timeout;
-    if (wakeup_ == 0) {
+    if (pending || !queue_.PrepareToWait()) {
+      // Messages are waiting: only poll.
+      timeout = 0;
+    } else if (wakeup_ == 0) {
       timeout = INFINITE;
     } else {
       int64_t timeout64 = (wakeup_ - OS::CurrentMonotonicNanos()) /
@@ -110,26 +425,18 @@ intptr_t IOCPMessageLoop::Run() {
     } else if (key == NULL) {
       // Interrupt: will check messages below.
     } else {
-      UNIMPLEMENTED();
+      ASSERT(key == kOverlappedKey);
+      HandleCompletion(overlapped, ok ? 0 : GetLastError(), bytes);
     }
 
-    IsolateMessage* message = TakeMessages();
-    while (message != NULL) {
-      IsolateMessage* next = message->next_;
-      DispatchMessage(message);
-      message = next;
-    }
+    pending = DispatchMessages(TakeMessages());
   }
 
   if (open_ports_ > 0) {
     PortMap::CloseAllPorts(this);
   }
 
-  while (head_ != NULL) {
-    IsolateMessage* message = head_;
-    head_ = message->next_;
-    delete message;
-  }
+  DiscardMessages(TakeMessages());
 
   return exit_code_;
 }
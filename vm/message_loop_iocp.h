@@ -9,6 +9,8 @@
 #error Do not include message_loop_iocp.h directly; use message_loop.h instead.
 #endif
 
+#include <mswsock.h>
+
 #include "vm/message_loop.h"
 #include "vm/thread.h"
 
@@ -16,11 +18,79 @@ namespace psoup {
 
 #define PlatformMessageLoop IOCPMessageLoop
 
+// A read, write, accept or connect started on a handle or socket opened for
+// overlapped I/O. Its buffer is the loop's, since the heap may move a
+// ByteArray while the operation is pending.
+class OverlappedOperation {
+ public:
+  enum Kind {
+    kRead,
+    kWrite,
+    kAccept,
+    kConnect,
+  };
+
+  static OverlappedOperation* From(OVERLAPPED* overlapped) {
+    return reinterpret_cast<OverlappedOperation*>(overlapped);
+  }
+
+  Kind kind() const { return kind_; }
+  intptr_t id() const { return id_; }
+  // The Windows error it completed with, or 0.
+  DWORD error() const { return error_; }
+  // Bytes read or written.
+  DWORD transferred() const { return transferred_; }
+  const uint8_t* buffer() const { return buffer_; }
+  // The socket it accepted, which the isolate then owns.
+  SOCKET TakeAccepted() {
+    SOCKET accepted = accepted_;
+    accepted_ = INVALID_SOCKET;
+    return accepted;
+  }
+
+ private:
+  friend class IOCPMessageLoop;
+
+  OverlappedOperation(Kind kind, intptr_t id, HANDLE handle, intptr_t size);
+  ~OverlappedOperation();
+
+  OVERLAPPED overlapped_;  // First, so a completion's OVERLAPPED* is this.
+  Kind kind_;
+  intptr_t id_;
+  HANDLE handle_;
+  uint8_t* buffer_;
+  DWORD error_;
+  DWORD transferred_;
+  SOCKET accepted_;
+  bool completed_;
+  bool cancelled_;  // Freed on completion instead of dispatched.
+
+  DISALLOW_COPY_AND_ASSIGN(OverlappedOperation);
+};
+
 class IOCPMessageLoop : public MessageLoop {
  public:
   explicit IOCPMessageLoop(Isolate* isolate);
   ~IOCPMessageLoop();
 
+  // Each starts an operation on a handle or socket opened for overlapped I/O,
+  // whose completion is dispatched as a signal for the operation's id, with
+  // the Windows error or 0 as its status and the bytes transferred as its
+  // count. Each answers the id, or -1 with the error in *error if the
+  // operation could not start. The position is ignored for sockets and pipes.
+  intptr_t StartRead(HANDLE handle, intptr_t size, int64_t position,
+                     DWORD* error);
+  intptr_t StartWrite(HANDLE handle, const uint8_t* bytes, intptr_t size,
+                      int64_t position, DWORD* error);
+  intptr_t StartAccept(SOCKET listener, DWORD* error);
+  // Binds the socket to any address first, if it is not yet bound.
+  intptr_t StartConnect(SOCKET socket, const struct sockaddr* address,
+                        int address_size, DWORD* error);
+  // The completed operation of this id, or NULL. FreeOperation releases its
+  // id for another.
+  OverlappedOperation* CompletedOperation(intptr_t id);
+  void FreeOperation(OverlappedOperation* operation);
+
   void PostMessage(IsolateMessage* message);
   intptr_t AwaitSignal(intptr_t handle, intptr_t signals);
   void CancelSignalWait(intptr_t wait_id);
@@ -34,12 +104,29 @@ class IOCPMessageLoop : public MessageLoop {
   IsolateMessage* TakeMessages();
   void Notify();
 
-  Mutex mutex_;
-  IsolateMessage* head_;
-  IsolateMessage* tail_;
+  // A completion key apart from Notify's NULL.
+  static const ULONG_PTR kOverlappedKey = 1;
+
+  bool Associate(HANDLE handle, DWORD* error);
+  OverlappedOperation* NewOperation(OverlappedOperation::Kind kind,
+                                    HANDLE handle,
+                                    intptr_t size);
+  intptr_t Started(OverlappedOperation* operation, BOOL ok, DWORD* error);
+  void HandleCompletion(OVERLAPPED* overlapped, DWORD error, DWORD bytes);
+
+  MessageQueue queue_;
   int64_t wakeup_;
   HANDLE completion_port_;
 
+  // Indexed by id, with the free ids kept as a stack.
+  OverlappedOperation** operations_;
+  intptr_t* free_ids_;
+  intptr_t num_free_ids_;
+  intptr_t operations_capacity_;
+  intptr_t num_pending_;
+  LPFN_ACCEPTEX accept_ex_;
+  LPFN_CONNECTEX connect_ex_;
+
   DISALLOW_COPY_AND_ASSIGN(IOCPMessageLoop);
 };
 
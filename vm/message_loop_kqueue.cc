@@ -15,11 +15,17 @@
 #include <sys/time.h>
 #include <unistd.h>
 
-#include "vm/lockers.h"
 #include "vm/os.h"
 
 namespace psoup {
 
+// A wait id is its fd and these flags.
+enum {
+  kWaitRead = 1 << 0,
+  kWaitWrite = 1 << 1,
+  kWaitBits = 2,
+};
+
 static bool SetBlockingHelper(intptr_t fd, bool blocking) {
   intptr_t status;
   status = fcntl(fd, F_GETFL);
@@ -37,9 +43,7 @@ static bool SetBlockingHelper(intptr_t fd, bool blocking) {
 
 KQueueMessageLoop::KQueueMessageLoop(Isolate* isolate)
     : MessageLoop(isolate),
-      mutex_(),
-      head_(NULL),
-      tail_(NULL),
+      queue_(),
       wakeup_(0) {
   int result = pipe(interrupt_fds_);
   if (result != 0) {
@@ -73,12 +77,19 @@ intptr_t KQueueMessageLoop::AwaitSignal(intptr_t fd, intptr_t signals) {
   struct kevent changes[kMaxChanges];
   intptr_t nchanges = 0;
   void* udata = reinterpret_cast<void*>(fd);
+  uint16_t flags = EV_ADD;
+  if (signals & (1 << kEdgeTriggered)) {
+    flags |= EV_CLEAR;
+  }
+  if (signals & (1 << kOneShot)) {
+    flags |= EV_ONESHOT;
+  }
   if (signals & (1 << kReadEvent)) {
-    EV_SET(changes + nchanges, fd, EVFILT_READ, EV_ADD, 0, 0, udata);
+    EV_SET(changes + nchanges, fd, EVFILT_READ, flags, 0, 0, udata);
     nchanges++;
   }
   if (signals & (1 << kWriteEvent)) {
-    EV_SET(changes + nchanges, fd, EVFILT_WRITE, EV_ADD, 0, 0, udata);
+    EV_SET(changes + nchanges, fd, EVFILT_WRITE, flags, 0, 0, udata);
     nchanges++;
   }
   ASSERT(nchanges > 0);
@@ -87,18 +98,39 @@ intptr_t KQueueMessageLoop::AwaitSignal(intptr_t fd, intptr_t signals) {
   if (status == -1) {
     FATAL("Failed to add to kqueue");
   }
+  open_waits_++;
 
-  return fd;
+  // The wait id keeps which filters to delete.
+  intptr_t wait_id = fd << kWaitBits;
+  if (signals & (1 << kReadEvent)) {
+    wait_id |= kWaitRead;
+  }
+  if (signals & (1 << kWriteEvent)) {
+    wait_id |= kWaitWrite;
+  }
+  return wait_id;
 }
 
 void KQueueMessageLoop::CancelSignalWait(intptr_t wait_id) {
-  UNIMPLEMENTED();
+  // Deleted one at a time: a one-shot filter that fired, or a closed fd's,
+  // is already gone.
+  intptr_t fd = wait_id >> kWaitBits;
+  struct kevent change;
+  if (wait_id & kWaitRead) {
+    EV_SET(&change, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    kevent(kqueue_fd_, &change, 1, NULL, 0, NULL);
+  }
+  if (wait_id & kWaitWrite) {
+    EV_SET(&change, fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    kevent(kqueue_fd_, &change, 1, NULL, 0, NULL);
+  }
+  open_waits_--;
 }
 
 void KQueueMessageLoop::MessageEpilogue(int64_t new_wakeup) {
   wakeup_ = new_wakeup;
 
-  if ((open_ports_ == 0) && (wakeup_ == 0)) {
+  if ((open_ports_ == 0) && (open_waits_ == 0) && (wakeup_ == 0)) {
     Exit(0);
   }
 }
@@ -109,13 +141,8 @@ void KQueueMessageLoop::Exit(intptr_t exit_code) {
 }
 
 void KQueueMessageLoop::PostMessage(IsolateMessage* message) {
-  MutexLocker locker(&mutex_);
-  if (head_ == NULL) {
-    head_ = tail_ = message;
+  if (queue_.Post(message)) {
     Notify();
-  } else {
-    tail_->next_ = message;
-    tail_ = message;
   }
 }
 
@@ -128,17 +155,20 @@ void KQueueMessageLoop::Notify() {
 }
 
 IsolateMessage* KQueueMessageLoop::TakeMessages() {
-  MutexLocker locker(&mutex_);
-  IsolateMessage* message = head_;
-  head_ = tail_ = NULL;
-  return message;
+  return queue_.TakeAll();
 }
 
 intptr_t KQueueMessageLoop::Run() {
+  bool pending = false;
   while (isolate_ != NULL) {
     struct timespec* timeout = NULL;
     struct timespec ts;
-    if (wakeup_ == 0) {
+    if (pending || !queue_.PrepareToWait()) {
+      // Messages are waiting: only poll.
+      ts.tv_sec = 0;
+      ts.tv_nsec = 0;
+      timeout = &ts;
+    } else if (wakeup_ == 0) {
       // NULL pointer timespec for infinite timeout.
     } else {
       int64_t nanos = wakeup_ - OS::CurrentMonotonicNanos();
@@ -198,23 +228,14 @@ intptr_t KQueueMessageLoop::Run() {
       }
     }
 
-    IsolateMessage* message = TakeMessages();
-    while (message != NULL) {
-      IsolateMessage* next = message->next_;
-      DispatchMessage(message);
-      message = next;
-    }
+    pending = DispatchMessages(TakeMessages());
   }
 
   if (open_ports_ > 0) {
     PortMap::CloseAllPorts(this);
   }
 
-  while (head_ != NULL) {
-    IsolateMessage* message = head_;
-    head_ = message->next_;
-    delete message;
-  }
+  DiscardMessages(TakeMessages());
 
   return exit_code_;
 }
@@ -35,9 +35,7 @@ class KQueueMessageLoop : public MessageLoop {
   IsolateMessage* TakeMessages();
   void Notify();
 
-  Mutex mutex_;
-  IsolateMessage* head_;
-  IsolateMessage* tail_;
+  MessageQueue queue_;
   int64_t wakeup_;
   int interrupt_fds_[2];
   int kqueue_fd_;
@@ -0,0 +1,140 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/message_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "vm/assert.h"
+
+namespace psoup {
+
+static std::atomic<int64_t> next_trace_id(1);
+static std::atomic<intptr_t> next_tid(1);
+
+MessageTrace::MessageTrace()
+    : events_(nullptr),
+      capacity_(0),
+      count_(0),
+      next_(0),
+      recorded_(0),
+      tid_(next_tid.fetch_add(1, std::memory_order_relaxed)) {}
+
+MessageTrace::~MessageTrace() {
+  delete[] events_;
+}
+
+void MessageTrace::SetCapacity(intptr_t capacity) {
+  delete[] events_;
+  events_ = (capacity > 0) ? new Event[capacity] : nullptr;
+  capacity_ = (capacity > 0) ? capacity : 0;
+  count_ = 0;
+  next_ = 0;
+}
+
+void MessageTrace::Record(int64_t trace_id,
+                          Port port,
+                          int64_t posted,
+                          int64_t dequeued,
+                          int64_t start,
+                          int64_t end) {
+  ASSERT(enabled());
+  // Not stamped before tracing began, or not posted to a port.
+  if (dequeued == 0) {
+    dequeued = start;
+  }
+  if (posted == 0) {
+    posted = dequeued;
+  }
+  Event* event = &events_[next_];
+  event->trace_id = trace_id;
+  event->port = port;
+  event->posted = posted;
+  event->dequeued = dequeued;
+  event->start = start;
+  event->end = end;
+  next_ = (next_ + 1) % capacity_;
+  if (count_ < capacity_) {
+    count_++;
+  }
+  recorded_++;
+}
+
+intptr_t MessageTrace::PrintEvent(char* buffer, intptr_t size,
+                                  const Event& event, int64_t serial) {
+  // Chrome's trace viewer wants microseconds. The waits overlap those of
+  // other messages, so they are async events, paired by id; the dispatch is
+  // a complete event on the isolate's track.
+  struct Span {
+    const char* name;
+    int64_t begin;
+    int64_t end;
+  };
+  const Span waits[] = {
+    {"queued", event.posted, event.dequeued},
+    {"ready", event.dequeued, event.start},
+  };
+  intptr_t length = 0;
+  for (const Span& wait : waits) {
+    for (intptr_t edge = 0; edge < 2; edge++) {
+      length += snprintf(
+          (buffer == nullptr) ? nullptr : buffer + length,
+          (buffer == nullptr) ? 0 : size - length,
+          "{\"name\":\"%s\",\"cat\":\"message\",\"ph\":\"%s\","
+          "\"id\":\"%" Pd ".%" Pd64 "\",\"pid\":1,\"tid\":%" Pd ","
+          "\"ts\":%.3f,\"args\":{\"trace\":%" Pd64 "}},",
+          wait.name, (edge == 0) ? "b" : "e", tid_, serial, tid_,
+          ((edge == 0) ? wait.begin : wait.end) / 1000.0, event.trace_id);
+    }
+  }
+  length += snprintf(
+      (buffer == nullptr) ? nullptr : buffer + length,
+      (buffer == nullptr) ? 0 : size - length,
+      "{\"name\":\"dispatch\",\"cat\":\"message\",\"ph\":\"X\",\"pid\":1,"
+      "\"tid\":%" Pd ",\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"trace\":%" Pd64 ","
+      "\"port\":%" Pd64 ",\"queued\":%.3f,\"ready\":%.3f}}",
+      tid_, event.start / 1000.0, (event.end - event.start) / 1000.0,
+      event.trace_id, event.port, (event.dequeued - event.posted) / 1000.0,
+      (event.start - event.dequeued) / 1000.0);
+  return length;
+}
+
+char* MessageTrace::TakeJSON(intptr_t* length) {
+  intptr_t first = (count_ < capacity_) ? 0 : next_;
+  int64_t first_serial = recorded_ - count_;
+
+  intptr_t size = 2;  // Brackets.
+  for (intptr_t i = 0; i < count_; i++) {
+    if (i != 0) size++;  // Comma.
+    size += PrintEvent(nullptr, 0, events_[(first + i) % capacity_],
+                       first_serial + i);
+  }
+
+  char* buffer = reinterpret_cast<char*>(malloc(size + 1));  // And NUL.
+  intptr_t pos = 0;
+  buffer[pos++] = '[';
+  for (intptr_t i = 0; i < count_; i++) {
+    if (i != 0) buffer[pos++] = ',';
+    pos += PrintEvent(buffer + pos, size + 1 - pos,
+                      events_[(first + i) % capacity_], first_serial + i);
+  }
+  buffer[pos++] = ']';
+  buffer[pos] = 0;
+  ASSERT(pos == size);
+
+  count_ = 0;
+  next_ = 0;
+  *length = size;
+  return buffer;
+}
+
+int64_t MessageTrace::NewTraceId() {
+  return next_trace_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace psoup
@@ -0,0 +1,76 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_MESSAGE_TRACE_H_
+#define VM_MESSAGE_TRACE_H_
+
+#include "vm/globals.h"
+#include "vm/port.h"
+
+namespace psoup {
+
+// A ring buffer of the messages an isolate has dispatched, enabled at runtime
+// and read as Chrome trace-event JSON. Each has the times it was posted, taken
+// from the loop's queue, dispatched and finished, so that its latency splits
+// into waiting for the loop's thread, waiting behind earlier messages, and
+// running; and the trace it belongs to. The clock is the monotonic one every
+// isolate shares, so the events of several isolates can be merged. When the
+// buffer is full, the oldest message is overwritten.
+//
+// A trace follows a request across isolates: the messages an isolate posts
+// while it handles one belong to that one's trace, and a message that belongs
+// to none starts a new trace when dispatched by an isolate that records them.
+class MessageTrace {
+ public:
+  static const intptr_t kMaxCapacity = 64 * KB;
+
+  MessageTrace();
+  ~MessageTrace();
+
+  // Keeps up to capacity messages, discarding those kept so far. Zero
+  // disables.
+  void SetCapacity(intptr_t capacity);
+  bool enabled() const { return events_ != nullptr; }
+
+  // A message's times are 0 where not known.
+  void Record(int64_t trace_id,
+              Port port,
+              int64_t posted,
+              int64_t dequeued,
+              int64_t start,
+              int64_t end);
+
+  // The messages as a JSON array of events, oldest first, in a buffer for the
+  // caller to free. The messages are then forgotten.
+  char* TakeJSON(intptr_t* length);
+
+  // Unique among all isolates, and never 0.
+  static int64_t NewTraceId();
+
+ private:
+  struct Event {
+    int64_t trace_id;
+    Port port;
+    int64_t posted;
+    int64_t dequeued;
+    int64_t start;
+    int64_t end;
+  };
+
+  intptr_t PrintEvent(char* buffer, intptr_t size, const Event& event,
+                      int64_t serial);
+
+  Event* events_;
+  intptr_t capacity_;
+  intptr_t count_;  // Events kept.
+  intptr_t next_;  // Where the next one goes.
+  int64_t recorded_;  // Ever, numbering the events to pair their async parts.
+  const intptr_t tid_;  // Tells the isolates apart in the viewer.
+
+  DISALLOW_COPY_AND_ASSIGN(MessageTrace);
+};
+
+}  // namespace psoup
+
+#endif  // VM_MESSAGE_TRACE_H_
@@ -16,10 +16,10 @@ Behavior Object::Klass(Heap* heap) const {
 }
 
 
-intptr_t HeapObject::HeapSizeFromClass() const {
+intptr_t HeapObject::HeapSizeFromClass(intptr_t cid) const {
   ASSERT(IsHeapObject());
 
-  switch (cid()) {
+  switch (cid) {
   case kIllegalCid:
     UNREACHABLE();
   case kForwardingCorpseCid:
@@ -108,10 +108,24 @@ void HeapObject::Pointers(Object** from, Object** to) {
 }
 
 
-void HeapObject::AddToRememberedSet() const {
+void HeapObject::RememberSlot(Object* slot) const {
+  Isolate* isolate = Isolate::Current();
+  ASSERT(isolate != NULL);
+  isolate->heap()->RememberSlot(*this, slot);
+}
+
+
+void HeapObject::RememberRange(Object* slots, intptr_t count) const {
+  Isolate* isolate = Isolate::Current();
+  ASSERT(isolate != NULL);
+  isolate->heap()->RememberRange(*this, slots, count);
+}
+
+
+void HeapObject::MarkingBarrier(Object value) const {
   Isolate* isolate = Isolate::Current();
   ASSERT(isolate != NULL);
-  isolate->heap()->AddToRememberedSet(*this);
+  isolate->heap()->MarkingBarrier(static_cast<HeapObject>(value));
 }
 
 
@@ -194,77 +208,168 @@ static void PrintStringError(String string) {
 void Activation::PrintStack(Heap* heap) {
   Activation act = *this;
   while (act != heap->interpreter()->nil_obj()) {
-    OS::PrintErr("  ");
+    PrintFrame(heap, act->method(), act->receiver(), act->closure());
+    act = act->sender();
+  }
+}
 
-    Activation home = act;
-    while (home->closure() != heap->interpreter()->nil_obj()) {
-      ASSERT(home->closure()->IsClosure());
-      OS::PrintErr("[] in ");
-      home = home->closure()->defining_activation();
+
+void Activation::PrintFrame(Heap* heap, Method method, Object receiver,
+                            Closure closure) {
+  OS::PrintErr("  ");
+  while (closure != heap->interpreter()->nil_obj()) {
+    ASSERT(closure->IsClosure());
+    OS::PrintErr("[] in ");
+    if (!closure->HasDefiningActivation()) {
+      method = closure->home_method();
+      receiver = closure->receiver();
+      break;
     }
+    Activation home = closure->defining_activation();
+    method = home->method();
+    receiver = home->receiver();
+    closure = home->closure();
+  }
 
-    AbstractMixin receiver_mixin = home->receiver()->Klass(heap)->mixin();
-    String receiver_mixin_name = receiver_mixin->name();
-    if (receiver_mixin_name->IsString()) {
-      PrintStringError(receiver_mixin_name);
+  AbstractMixin receiver_mixin = receiver->Klass(heap)->mixin();
+  String receiver_mixin_name = receiver_mixin->name();
+  if (receiver_mixin_name->IsString()) {
+    PrintStringError(receiver_mixin_name);
+  } else {
+    receiver_mixin_name =
+        static_cast<AbstractMixin>(receiver_mixin_name)->name();
+    ASSERT(receiver_mixin_name->IsString());
+    PrintStringError(receiver_mixin_name);
+    OS::PrintErr(" class");
+  }
+
+  AbstractMixin method_mixin = method->mixin();
+  if (receiver_mixin != method_mixin) {
+    String method_mixin_name = method_mixin->name();
+    OS::PrintErr("(");
+    if (method_mixin_name->IsString()) {
+      PrintStringError(method_mixin_name);
     } else {
-      receiver_mixin_name =
-          static_cast<AbstractMixin>(receiver_mixin_name)->name();
-      ASSERT(receiver_mixin_name->IsString());
-      PrintStringError(receiver_mixin_name);
+      method_mixin_name =
+          static_cast<AbstractMixin>(method_mixin_name)->name();
+      ASSERT(method_mixin_name->IsString());
+      PrintStringError(method_mixin_name);
       OS::PrintErr(" class");
     }
+    OS::PrintErr(")");
+  }
 
-    AbstractMixin method_mixin = home->method()->mixin();
-    if (receiver_mixin != method_mixin) {
-      String method_mixin_name = method_mixin->name();
-      OS::PrintErr("(");
-      if (method_mixin_name->IsString()) {
-        PrintStringError(method_mixin_name);
-      } else {
-        method_mixin_name =
-            static_cast<AbstractMixin>(method_mixin_name)->name();
-        ASSERT(method_mixin_name->IsString());
-        PrintStringError(method_mixin_name);
-        OS::PrintErr(" class");
-      }
-      OS::PrintErr(")");
-    }
+  String method_name = method->selector();
+  OS::PrintErr(" ");
+  PrintStringError(method_name);
+  OS::PrintErr("\n");
+}
 
-    String method_name = home->method()->selector();
-    OS::PrintErr(" ");
-    PrintStringError(method_name);
-    OS::PrintErr("\n");
 
-    act = act->sender();
-  }
-}
+// The multipliers of wyhash, whose mixing this follows.
+static const uint64_t kHashP0 = 0xa0761d6478bd642fULL;
+static const uint64_t kHashP1 = 0xe7037ed1a0b428dbULL;
+static const uint64_t kHashP2 = 0x8ebc6af09c88c6e3ULL;
+static const uint64_t kHashP3 = 0x589965cc75374cc3ULL;
 
 
-#if defined(ARCH_IS_32_BIT)
-static uintptr_t kFNVPrime = 16777619;
-#elif defined(ARCH_IS_64_BIT)
-static uintptr_t kFNVPrime = 1099511628211;
+// The 128-bit product of a and b, low word in a and high word in b.
+static inline void Multiply128(uint64_t* a, uint64_t* b) {
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = static_cast<__uint128_t>(*a) * *b;
+  *a = static_cast<uint64_t>(r);
+  *b = static_cast<uint64_t>(r >> 64);
+#else
+  uint64_t ha = *a >> 32, hb = *b >> 32;
+  uint64_t la = static_cast<uint32_t>(*a), lb = static_cast<uint32_t>(*b);
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32);
+  uint64_t c = t < rl;
+  uint64_t lo = t + (rm1 << 32);
+  c += lo < t;
+  *a = lo;
+  *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
 #endif
+}
 
 
-SmallInteger String::EnsureHash(Isolate* isolate) {
-  if (header_hash() == 0) {
-    // FNV-1a hash
-    intptr_t length = Size();
-    uintptr_t h = length + 1;
-    for (intptr_t i = 0; i < length; i++) {
-      h = h ^ element(i);
-      h = h * kFNVPrime;
+static inline uint64_t Mix(uint64_t a, uint64_t b) {
+  Multiply128(&a, &b);
+  return a ^ b;
+}
+
+
+static inline uint64_t Read64(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+
+static inline uint64_t Read32(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+
+// Eight or sixteen bytes at once, with a multiply for each sixteen, instead
+// of FNV-1a's multiply for each byte.
+static uint64_t HashBytes(const uint8_t* p, intptr_t length, uint64_t seed) {
+  seed ^= Mix(seed ^ kHashP0, kHashP1);
+  uint64_t a, b;
+  if (length <= 16) {
+    if (length >= 4) {
+      intptr_t step = (length >> 3) << 2;
+      a = (Read32(p) << 32) | Read32(p + step);
+      b = (Read32(p + length - 4) << 32) | Read32(p + length - 4 - step);
+    } else if (length > 0) {
+      a = (static_cast<uint64_t>(p[0]) << 16) |
+          (static_cast<uint64_t>(p[length >> 1]) << 8) | p[length - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    intptr_t i = length;
+    if (i > 48) {
+      uint64_t seed1 = seed, seed2 = seed;
+      do {
+        seed = Mix(Read64(p) ^ kHashP1, Read64(p + 8) ^ seed);
+        seed1 = Mix(Read64(p + 16) ^ kHashP2, Read64(p + 24) ^ seed1);
+        seed2 = Mix(Read64(p + 32) ^ kHashP3, Read64(p + 40) ^ seed2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= seed1 ^ seed2;
+    }
+    while (i > 16) {
+      seed = Mix(Read64(p) ^ kHashP1, Read64(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
     }
-    h = h ^ isolate->salt();
-    h = h & SmallInteger::kMaxValue;
+    // The last sixteen bytes, some perhaps already mixed.
+    a = Read64(p + i - 16);
+    b = Read64(p + i - 8);
+  }
+  a ^= kHashP1;
+  b ^= seed;
+  Multiply128(&a, &b);
+  return Mix(a ^ kHashP0 ^ static_cast<uint64_t>(length), b ^ kHashP1);
+}
+
+
+SmallInteger String::EnsureHash(Isolate* isolate) {
+  if (hash() == 0) {
+    uintptr_t h = static_cast<uintptr_t>(
+        HashBytes(element_addr(0), Size(), isolate->salt()));
+    h = h & HeapObject::kMaxHash;
     if (h == 0) {
       h = 1;
     }
-    set_header_hash(h);
+    set_hash(h);
   }
-  return SmallInteger::New(header_hash());
+  return SmallInteger::New(hash());
 }
 
 }  // namespace psoup
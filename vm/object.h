@@ -8,6 +8,7 @@
 #include "vm/assert.h"
 #include "vm/globals.h"
 #include "vm/bitfield.h"
+#include "vm/flags.h"
 #include "vm/utils.h"
 
 namespace psoup {
@@ -44,19 +45,49 @@ enum HeaderBits {
   // For symbols.
   kCanonicalBit = 2,
 
+  // Large old object: remembered by the cards of its region holding new
+  // pointers, rather than as a whole.
+  kCardedBit = 3,
+
+  // Old object: in the space shared by the isolates loaded from a heap image,
+  // which is never collected, moved or changed. Always marked.
+  kSharedBit = 4,
+
+  // Activation: made by the interpreter to move a frame to the heap, and not
+  // yet handed to the program, so it may be reused once its frame returns.
+  kPrivateBit = 5,
+
 #if defined(ARCH_IS_32_BIT)
   kSizeFieldOffset = 8,
   kSizeFieldSize = 8,
   kClassIdFieldOffset = 16,
   kClassIdFieldSize = 16,
 #elif defined(ARCH_IS_64_BIT)
-  kSizeFieldOffset = 16,
-  kSizeFieldSize = 16,
-  kClassIdFieldOffset = 32,
-  kClassIdFieldSize = 32,
+  // The hash shares the header word, rather than taking a word of its own.
+  kSizeFieldOffset = 8,
+  kSizeFieldSize = 8,
+  kClassIdFieldOffset = 16,
+  kClassIdFieldSize = 16,
+  kHashFieldOffset = 32,
+  kHashFieldSize = 32,
 #endif
 };
 
+// Where identity hashes are kept: in a header word of their own on 32-bit,
+// in the upper half of the header word on 64-bit, or with OUT_OF_LINE_HASH in
+// a table of the heap's that only the objects hashed take room in. Strings
+// then keep theirs in a word after the size.
+#if OUT_OF_LINE_HASH
+#define HEADER_HASH_WORD false
+#define HEADER_HASH_BITS false
+#elif defined(ARCH_IS_32_BIT)
+#define HEADER_HASH_WORD true
+#define HEADER_HASH_BITS false
+#elif defined(ARCH_IS_64_BIT)
+#define HEADER_HASH_WORD false
+#define HEADER_HASH_BITS true
+#endif
+
 enum ClassIds {
   kIllegalCid = 0,
   kForwardingCorpseCid = 1,
@@ -204,6 +235,15 @@ class HeapObject : public Object {
   HEAP_OBJECT_IMPLEMENTATION(HeapObject, Object);
 
  public:
+  // The largest identity or String hash the header holds, a SmallInteger.
+#if defined(ARCH_IS_32_BIT)
+  static const intptr_t kMaxHash =
+      (static_cast<intptr_t>(1) << (kBitsPerWord - 2)) - 1;
+#elif defined(ARCH_IS_64_BIT)
+  static const intptr_t kMaxHash =
+      (static_cast<intptr_t>(1) << kHashFieldSize) - 1;
+#endif
+
   void AssertCouldBeBehavior() const {
     ASSERT(IsHeapObject());
     ASSERT(IsRegularObject());
@@ -218,11 +258,19 @@ class HeapObject : public Object {
   inline void set_is_remembered(bool value);
   inline bool is_canonical() const;
   inline void set_is_canonical(bool value);
+  inline bool is_carded() const;
+  inline void set_is_carded(bool value);
+  inline bool is_shared() const;
+  inline void set_is_shared(bool value);
+  inline bool is_private() const;
+  inline void set_is_private(bool value);
   inline intptr_t heap_size() const;
   inline intptr_t cid() const;
   inline void set_cid(intptr_t value);
+#if !OUT_OF_LINE_HASH
   inline intptr_t header_hash() const;
   inline void set_header_hash(intptr_t value);
+#endif
 
   uword Addr() const {
     return tagged_pointer_ - kHeapObjectTag;
@@ -243,7 +291,22 @@ class HeapObject : public Object {
     }
     return HeapSizeFromClass();
   }
-  intptr_t HeapSizeFromClass() const;
+  // Like HeapSize, but decoding the given header instead of the object's own,
+  // which another scavenger worker may be replacing with a forwarding pointer.
+  intptr_t HeapSize(uword header) const {
+    ASSERT(IsHeapObject());
+    intptr_t heap_size_from_tag =
+        SizeField::decode(header) << kObjectAlignmentLog2;
+    if (heap_size_from_tag != 0) {
+      return heap_size_from_tag;
+    }
+    return HeapSizeFromClass(ClassIdField::decode(header));
+  }
+  static intptr_t ClassIdFromHeader(uword header) {
+    return ClassIdField::decode(header);
+  }
+  intptr_t HeapSizeFromClass() const { return HeapSizeFromClass(cid()); }
+  intptr_t HeapSizeFromClass(intptr_t cid) const;
   void Pointers(Object** from, Object** to);
 
  protected:
@@ -258,23 +321,50 @@ class HeapObject : public Object {
     if (barrier == kNoBarrier) {
       ASSERT(value->IsImmediateOrOldObject());
     } else {
-      // Generational write barrier:
-      if (IsOldObject() && value->IsNewObject() && !is_remembered()) {
-        AddToRememberedSet();
+      if (IsOldObject()) {
+        if (value->IsNewObject()) {
+          // Generational write barrier.
+          if (!is_remembered() || is_carded()) {
+            RememberSlot(reinterpret_cast<Object*>(addr));
+          }
+        } else if (value->IsOldObject() && is_marked() &&
+                   !static_cast<HeapObject>(value)->is_marked()) {
+          // Incremental marking write barrier. Outside of marking, old
+          // objects are only marked until their region is swept, and the
+          // heap ignores this.
+          MarkingBarrier(value);
+        }
       }
     }
   }
 
+  // The barriers of Store for count slots already written together, such as
+  // by memmove.
+  void StoreRangeBarrier(Object* slots, intptr_t count) {
+    if (IsOldObject()) {
+      RememberRange(slots, count);
+    }
+  }
+
  private:
-  void AddToRememberedSet() const;
+  void RememberSlot(Object* slot) const;
+  void RememberRange(Object* slots, intptr_t count) const;
+  void MarkingBarrier(Object value) const;
 
   class MarkBit : public BitField<bool, kMarkBit, 1> {};
   class RememberedBit : public BitField<bool, kRememberedBit, 1> {};
   class CanonicalBit : public BitField<bool, kCanonicalBit, 1> {};
+  class CardedBit : public BitField<bool, kCardedBit, 1> {};
+  class SharedBit : public BitField<bool, kSharedBit, 1> {};
+  class PrivateBit : public BitField<bool, kPrivateBit, 1> {};
   class SizeField :
       public BitField<intptr_t, kSizeFieldOffset, kSizeFieldSize> {};
   class ClassIdField :
       public BitField<intptr_t, kClassIdFieldOffset, kClassIdFieldSize> {};
+#if HEADER_HASH_BITS
+  class HashField :
+      public BitField<intptr_t, kHashFieldOffset, kHashFieldSize> {};
+#endif
 };
 
 intptr_t Object::ClassId() const {
@@ -420,6 +510,7 @@ class LargeInteger : public HeapObject {
   inline void set_capacity(intptr_t value);
   inline digit_t digit(intptr_t index) const;
   inline void set_digit(intptr_t index, digit_t value);
+  inline digit_t* digit_addr(intptr_t index);
 };
 
 class RegularObject : public HeapObject {
@@ -445,6 +536,11 @@ class Array : public HeapObject {
   inline Object element(intptr_t index) const;
   inline void set_element(intptr_t index, Object value,
                           Barrier barrier = kBarrier);
+  // Bulk stores, with the barrier applied once for all of them. Source may
+  // be this array.
+  inline void CopyElements(intptr_t index, Array source,
+                           intptr_t source_index, intptr_t count);
+  inline void FillElements(intptr_t index, Object value, intptr_t count);
 
   inline Object* from();
   inline Object* to();
@@ -462,6 +558,11 @@ class WeakArray : public HeapObject {
   inline WeakArray next() const;
   inline void set_next(WeakArray value);
 
+  // How many elements the GC has nilled because their targets died, since
+  // the array was allocated.
+  inline SmallInteger cleared() const;
+  inline void set_cleared(SmallInteger count);
+
   inline Object element(intptr_t index) const;
   inline void set_element(intptr_t index, Object value,
                           Barrier barrier = kBarrier);
@@ -512,6 +613,9 @@ class String : public Bytes {
   HEAP_OBJECT_IMPLEMENTATION(String, Bytes);
 
  public:
+  // Of the contents, or 0 before EnsureHash.
+  inline intptr_t hash() const;
+  inline void set_hash(intptr_t value);
   SmallInteger EnsureHash(Isolate* isolate);
 };
 
@@ -566,6 +670,9 @@ class Activation : public HeapObject {
   }
 
   void PrintStack(Heap* heap);
+  // One line of PrintStack, for an activation still in a frame.
+  static void PrintFrame(Heap* heap, Method method, Object receiver,
+                         Closure closure);
 
   inline Object* from();
   inline Object* to();
@@ -634,6 +741,17 @@ class Closure : public HeapObject {
   inline Activation defining_activation() const;
   inline void set_defining_activation(Activation a, Barrier barrier = kBarrier);
 
+  // A closure that cannot return non-locally is created without its defining
+  // activation. Until the activation is asked for, the defining activation
+  // slot holds the home method and receiver holds the home receiver.
+  bool HasDefiningActivation() const {
+    return defining_activation()->IsActivation();
+  }
+  inline Method home_method() const;
+  inline void set_home_method(Method m);
+  inline Object receiver() const;
+  inline void set_receiver(Object r, Barrier barrier = kBarrier);
+
   inline SmallInteger initial_bci() const;
   inline void set_initial_bci(SmallInteger bci);
 
@@ -722,21 +840,35 @@ class ObjectStore : public HeapObject {
   inline Behavior WeakArray() const;
   inline Behavior Activation() const;
   inline Behavior Method() const;
+  // Absent from snapshots from before batched dispatch.
+  inline bool has_dispatch_messages() const;
+  inline class String dispatch_messages() const;
+  // Absent from snapshots from before time quotas.
+  inline bool has_time_quota_exceeded() const;
+  inline class String time_quota_exceeded() const;
 };
 
 class HeapObject::Layout {
  public:
   uword header_;
+#if HEADER_HASH_WORD
   uword header_hash_;
+#endif
 };
 
 class ForwardingCorpse::Layout : public HeapObject::Layout {
  public:
+#if !HEADER_HASH_WORD
+  uword target_;
+#endif
   intptr_t overflow_size_;
 };
 
 class FreeListElement::Layout : public HeapObject::Layout {
  public:
+#if !HEADER_HASH_WORD
+  uword next_;
+#endif
   intptr_t overflow_size_;
 };
 
@@ -768,6 +900,7 @@ class WeakArray::Layout : public HeapObject::Layout {
  public:
   SmallInteger size_;  // Not visited.
   WeakArray next_;  // Not visited.
+  SmallInteger cleared_;  // Not visited.
   Object elements_[];
 };
 
@@ -782,6 +915,9 @@ class Ephemeron::Layout : public HeapObject::Layout {
 class Bytes::Layout : public HeapObject::Layout {
  public:
   SmallInteger size_;
+#if OUT_OF_LINE_HASH
+  uword hash_;  // Of a String.
+#endif
 };
 
 class String::Layout : public Bytes::Layout {};
@@ -820,6 +956,7 @@ class Closure::Layout : public HeapObject::Layout {
   Activation defining_activation_;
   SmallInteger initial_bci_;
   SmallInteger num_args_;
+  Object receiver_;
   Object copied_[];
 };
 
@@ -885,6 +1022,8 @@ class ObjectStore::Layout : public HeapObject::Layout {
   Behavior WeakArray_;
   Behavior Activation_;
   Behavior Method_;
+  class String dispatch_messages_;
+  class String time_quota_exceeded_;
 };
 
 bool HeapObject::is_marked() const {
@@ -905,6 +1044,24 @@ bool HeapObject::is_canonical() const {
 void HeapObject::set_is_canonical(bool value) {
   ptr()->header_ = CanonicalBit::update(value, ptr()->header_);
 }
+bool HeapObject::is_carded() const {
+  return CardedBit::decode(ptr()->header_);
+}
+void HeapObject::set_is_carded(bool value) {
+  ptr()->header_ = CardedBit::update(value, ptr()->header_);
+}
+bool HeapObject::is_shared() const {
+  return SharedBit::decode(ptr()->header_);
+}
+void HeapObject::set_is_shared(bool value) {
+  ptr()->header_ = SharedBit::update(value, ptr()->header_);
+}
+bool HeapObject::is_private() const {
+  return PrivateBit::decode(ptr()->header_);
+}
+void HeapObject::set_is_private(bool value) {
+  ptr()->header_ = PrivateBit::update(value, ptr()->header_);
+}
 intptr_t HeapObject::heap_size() const {
   return SizeField::decode(ptr()->header_) << kObjectAlignmentLog2;
 }
@@ -914,12 +1071,21 @@ intptr_t HeapObject::cid() const {
 void HeapObject::set_cid(intptr_t value) {
   ptr()->header_ = ClassIdField::update(value, ptr()->header_);
 }
+#if HEADER_HASH_WORD
 intptr_t HeapObject::header_hash() const {
   return ptr()->header_hash_;
 }
 void HeapObject::set_header_hash(intptr_t value) {
   ptr()->header_hash_ = value;
 }
+#elif HEADER_HASH_BITS
+intptr_t HeapObject::header_hash() const {
+  return HashField::decode(ptr()->header_);
+}
+void HeapObject::set_header_hash(intptr_t value) {
+  ptr()->header_ = HashField::update(value, ptr()->header_);
+}
+#endif
 
 HeapObject HeapObject::Initialize(uword addr,
                                 intptr_t cid,
@@ -937,18 +1103,29 @@ HeapObject HeapObject::Initialize(uword addr,
   header = ClassIdField::update(cid, header);
   HeapObject obj = FromAddr(addr);
   obj.ptr()->header_ = header;
+#if HEADER_HASH_WORD
   obj.ptr()->header_hash_ = 0;
+#endif
   ASSERT(obj.cid() == cid);
   ASSERT(!obj.is_marked());
   return obj;
 }
 
+#if HEADER_HASH_WORD
 Object ForwardingCorpse::target() const {
   return static_cast<Object>(ptr()->header_hash_);
 }
 void ForwardingCorpse::set_target(Object value) {
   ptr()->header_hash_ = static_cast<uword>(value);
 }
+#else
+Object ForwardingCorpse::target() const {
+  return static_cast<Object>(ptr()->target_);
+}
+void ForwardingCorpse::set_target(Object value) {
+  ptr()->target_ = static_cast<uword>(value);
+}
+#endif
 intptr_t ForwardingCorpse::overflow_size() const {
   return ptr()->overflow_size_;
 }
@@ -956,6 +1133,7 @@ void ForwardingCorpse::set_overflow_size(intptr_t value) {
   ptr()->overflow_size_ = value;
 }
 
+#if HEADER_HASH_WORD
 FreeListElement FreeListElement::next() const {
   return static_cast<FreeListElement>(ptr()->header_hash_);
 }
@@ -963,6 +1141,15 @@ void FreeListElement::set_next(FreeListElement value) {
   ASSERT((value == nullptr) || value->IsHeapObject());  // Tagged.
   ptr()->header_hash_ = static_cast<uword>(value);
 }
+#else
+FreeListElement FreeListElement::next() const {
+  return static_cast<FreeListElement>(ptr()->next_);
+}
+void FreeListElement::set_next(FreeListElement value) {
+  ASSERT((value == nullptr) || value->IsHeapObject());  // Tagged.
+  ptr()->next_ = static_cast<uword>(value);
+}
+#endif
 intptr_t FreeListElement::overflow_size() const {
   return ptr()->overflow_size_;
 }
@@ -997,6 +1184,9 @@ digit_t LargeInteger::digit(intptr_t index) const {
 void LargeInteger::set_digit(intptr_t index, digit_t value) {
   ptr()->digits_[index] = value;
 }
+digit_t* LargeInteger::digit_addr(intptr_t index) {
+  return &ptr()->digits_[index];
+}
 
 Object RegularObject::slot(intptr_t index) const {
   return Load(&ptr()->slots_[index]);
@@ -1022,6 +1212,21 @@ Object Array::element(intptr_t index) const {
 void Array::set_element(intptr_t index, Object value, Barrier barrier) {
   Store(&ptr()->elements_[index], value, barrier);
 }
+void Array::CopyElements(intptr_t index, Array source,
+                         intptr_t source_index, intptr_t count) {
+  memmove(&ptr()->elements_[index], &source->ptr()->elements_[source_index],
+          count * sizeof(Object));
+  StoreRangeBarrier(&ptr()->elements_[index], count);
+}
+void Array::FillElements(intptr_t index, Object value, intptr_t count) {
+  Object* elements = &ptr()->elements_[index];
+  for (intptr_t i = 0; i < count; i++) {
+    elements[i] = value;
+  }
+  if (value->IsHeapObject()) {
+    StoreRangeBarrier(elements, count);
+  }
+}
 Object* Array::from() {
   return &ptr()->elements_[0];
 }
@@ -1035,6 +1240,12 @@ void WeakArray::set_size(SmallInteger s) {
 }
 WeakArray WeakArray::next() const { return ptr()->next_; }
 void WeakArray::set_next(WeakArray value) { ptr()->next_ = value; }
+SmallInteger WeakArray::cleared() const {
+  return Load(&ptr()->cleared_, kNoBarrier);
+}
+void WeakArray::set_cleared(SmallInteger count) {
+  Store(&ptr()->cleared_, count, kNoBarrier);
+}
 Object WeakArray::element(intptr_t index) const {
   return Load(&ptr()->elements_[index]);
 }
@@ -1087,6 +1298,14 @@ const uint8_t* Bytes::element_addr(intptr_t index) const {
   return &elements[index];
 }
 
+#if OUT_OF_LINE_HASH
+intptr_t String::hash() const { return ptr()->hash_; }
+void String::set_hash(intptr_t value) { ptr()->hash_ = value; }
+#else
+intptr_t String::hash() const { return header_hash(); }
+void String::set_hash(intptr_t value) { set_header_hash(value); }
+#endif
+
 SmallInteger Method::header() const { return Load(&ptr()->header_); }
 Array Method::literals() const { return Load(&ptr()->literals_); }
 ByteArray Method::bytecode() const { return Load(&ptr()->bytecode_); }
@@ -1146,6 +1365,16 @@ Activation Closure::defining_activation() const {
 void Closure::set_defining_activation(Activation a, Barrier barrier) {
   Store(&ptr()->defining_activation_, a, barrier);
 }
+Method Closure::home_method() const {
+  return static_cast<Method>(Load(&ptr()->defining_activation_));
+}
+void Closure::set_home_method(Method m) {
+  Store(&ptr()->defining_activation_, static_cast<Activation>(m), kBarrier);
+}
+Object Closure::receiver() const { return Load(&ptr()->receiver_); }
+void Closure::set_receiver(Object r, Barrier barrier) {
+  Store(&ptr()->receiver_, r, barrier);
+}
 SmallInteger Closure::initial_bci() const {
   return Load(&ptr()->initial_bci_, kNoBarrier);
 }
@@ -1245,6 +1474,22 @@ Behavior ObjectStore::SmallInteger() const { return ptr()->SmallInteger_; }
 Behavior ObjectStore::WeakArray() const { return ptr()->WeakArray_; }
 Behavior ObjectStore::Activation() const { return ptr()->Activation_; }
 Behavior ObjectStore::Method() const { return ptr()->Method_; }
+bool ObjectStore::has_dispatch_messages() const {
+  return reinterpret_cast<const Object*>(&ptr()->dispatch_messages_) <
+         &ptr()->nil_ + size()->value();
+}
+class String ObjectStore::dispatch_messages() const {
+  ASSERT(has_dispatch_messages());
+  return ptr()->dispatch_messages_;
+}
+bool ObjectStore::has_time_quota_exceeded() const {
+  return reinterpret_cast<const Object*>(&ptr()->time_quota_exceeded_) <
+         &ptr()->nil_ + size()->value();
+}
+class String ObjectStore::time_quota_exceeded() const {
+  ASSERT(has_time_quota_exceeded());
+  return ptr()->time_quota_exceeded_;
+}
 
 }  // namespace psoup
 
@@ -15,10 +15,26 @@ class OS {
   static void Shutdown();
 
   static int64_t CurrentMonotonicNanos();
+  // The same clock, cheaper to read but only to about a millisecond, and may
+  // lag it by as much. Where there is no such clock, CurrentMonotonicNanos.
+  static int64_t CurrentCoarseMonotonicNanos();
 
   static const char* Name();
   static int NumberOfAvailableProcessors();
 
+  // Confines the calling thread to cpus, a list of CPUs and ranges such as
+  // "0-3,8", or with NULL to those the process started with. With a node of 0
+  // or more, only those of them on that NUMA node, if any are. Answers false,
+  // leaving the thread as it was, where unsupported or if cpus is malformed.
+  static bool SetThreadAffinity(const char* cpus, intptr_t node);
+  // 1 where unknown, and the nodes -1.
+  static intptr_t NumberOfNumaNodes();
+  // That of the CPU the calling thread is running on.
+  static intptr_t CurrentNumaNode();
+  // That of all the CPUs the calling thread may run on, or -1 if they are on
+  // several.
+  static intptr_t ThreadNumaNode();
+
   static void DebugBreak();
 
   static void Print(const char* format, ...) PRINTF_ATTRIBUTE(1, 2);
@@ -37,6 +37,18 @@ int64_t OS::CurrentMonotonicNanos() {
 }
 
 
+int64_t OS::CurrentCoarseMonotonicNanos() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) != 0) {
+    return CurrentMonotonicNanos();
+  }
+  int64_t result = ts.tv_sec;
+  result *= kNanosecondsPerSecond;
+  result += ts.tv_nsec;
+  return result;
+}
+
+
 const char* OS::Name() { return "android"; }
 
 
@@ -45,6 +57,26 @@ int OS::NumberOfAvailableProcessors() {
 }
 
 
+bool OS::SetThreadAffinity(const char* cpus, intptr_t node) {
+  return false;
+}
+
+
+intptr_t OS::NumberOfNumaNodes() {
+  return 1;
+}
+
+
+intptr_t OS::CurrentNumaNode() {
+  return -1;
+}
+
+
+intptr_t OS::ThreadNumaNode() {
+  return -1;
+}
+
+
 void OS::DebugBreak() {
   __builtin_trap();
 }
@@ -8,6 +8,7 @@
 #include "vm/os.h"
 
 #include <emscripten.h>
+#include <emscripten/threading.h>
 #include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -16,6 +17,7 @@
 #include <unistd.h>
 
 #include "vm/assert.h"
+#include "vm/flags.h"
 
 namespace psoup {
 
@@ -38,14 +40,43 @@ int64_t OS::CurrentMonotonicNanos() {
 }
 
 
+int64_t OS::CurrentCoarseMonotonicNanos() {
+  return CurrentMonotonicNanos();
+}
+
+
 const char* OS::Name() { return "emscripten"; }
 
 
 int OS::NumberOfAvailableProcessors() {
+#if EMSCRIPTEN_THREADS
+  return emscripten_num_logical_cores();
+#else
+  return 1;
+#endif
+}
+
+
+bool OS::SetThreadAffinity(const char* cpus, intptr_t node) {
+  return false;
+}
+
+
+intptr_t OS::NumberOfNumaNodes() {
   return 1;
 }
 
 
+intptr_t OS::CurrentNumaNode() {
+  return -1;
+}
+
+
+intptr_t OS::ThreadNumaNode() {
+  return -1;
+}
+
+
 void OS::DebugBreak() {
   emscripten_debugger();
 }
@@ -25,6 +25,11 @@ int64_t OS::CurrentMonotonicNanos() {
 }
 
 
+int64_t OS::CurrentCoarseMonotonicNanos() {
+  return zx_clock_get_monotonic();
+}
+
+
 const char* OS::Name() { return "fuchsia"; }
 
 
@@ -33,6 +38,26 @@ int OS::NumberOfAvailableProcessors() {
 }
 
 
+bool OS::SetThreadAffinity(const char* cpus, intptr_t node) {
+  return false;
+}
+
+
+intptr_t OS::NumberOfNumaNodes() {
+  return 1;
+}
+
+
+intptr_t OS::CurrentNumaNode() {
+  return -1;
+}
+
+
+intptr_t OS::ThreadNumaNode() {
+  return -1;
+}
+
+
 void OS::DebugBreak() {
   __builtin_trap();
 }
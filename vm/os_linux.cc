@@ -8,6 +8,7 @@
 #include "vm/os.h"
 
 #include <errno.h>
+#include <sched.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,7 +19,100 @@
 
 namespace psoup {
 
-void OS::Startup() {}
+static cpu_set_t process_cpus_;
+static int16_t cpu_nodes_[CPU_SETSIZE];
+static intptr_t num_numa_nodes_ = 1;
+
+
+// Parses a list such as "0-3,8", as the kernel writes and taskset reads.
+static bool ParseCpuList(const char* list, cpu_set_t* set) {
+  CPU_ZERO(set);
+  const char* p = list;
+  for (;;) {
+    char* end;
+    errno = 0;
+    long first = strtol(p, &end, 10);  // NOLINT
+    if ((end == p) || (errno != 0)) {
+      return false;
+    }
+    long last = first;  // NOLINT
+    p = end;
+    if (*p == '-') {
+      p++;
+      last = strtol(p, &end, 10);
+      if ((end == p) || (errno != 0)) {
+        return false;
+      }
+      p = end;
+    }
+    if ((first < 0) || (last < first) || (last >= CPU_SETSIZE)) {
+      return false;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {  // NOLINT
+      CPU_SET(cpu, set);
+    }
+    if (*p != ',') {
+      break;
+    }
+    p++;
+  }
+  while ((*p == '\n') || (*p == ' ')) {
+    p++;
+  }
+  return (*p == '\0') && (CPU_COUNT(set) > 0);
+}
+
+
+static bool ReadCpuList(const char* path, cpu_set_t* set) {
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    return false;
+  }
+  char buffer[4096];
+  bool result = (fgets(buffer, sizeof(buffer), file) != NULL) &&
+                ParseCpuList(buffer, set);
+  fclose(file);
+  return result;
+}
+
+
+void OS::Startup() {
+  CPU_ZERO(&process_cpus_);
+  if (sched_getaffinity(0, sizeof(process_cpus_), &process_cpus_) != 0) {
+    for (intptr_t cpu = 0; cpu < NumberOfAvailableProcessors(); cpu++) {
+      CPU_SET(cpu, &process_cpus_);
+    }
+  }
+
+  // Without sysfs, everything is on node 0. Nodes are numbered as CPUs are.
+  for (intptr_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    cpu_nodes_[cpu] = 0;
+  }
+  cpu_set_t nodes;
+  if (!ReadCpuList("/sys/devices/system/node/online", &nodes)) {
+    return;
+  }
+  for (intptr_t node = 0; node < CPU_SETSIZE; node++) {
+    if (!CPU_ISSET(node, &nodes)) {
+      continue;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%" Pd
+             "/cpulist", node);
+    cpu_set_t cpus;
+    if (!ReadCpuList(path, &cpus)) {
+      continue;  // A node with memory but no CPUs.
+    }
+    for (intptr_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &cpus)) {
+        cpu_nodes_[cpu] = node;
+      }
+    }
+    num_numa_nodes_ = node + 1;
+  }
+}
+
+
 void OS::Shutdown() {}
 
 
@@ -37,6 +131,18 @@ int64_t OS::CurrentMonotonicNanos() {
 }
 
 
+int64_t OS::CurrentCoarseMonotonicNanos() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) != 0) {
+    return CurrentMonotonicNanos();
+  }
+  int64_t result = ts.tv_sec;
+  result *= kNanosecondsPerSecond;
+  result += ts.tv_nsec;
+  return result;
+}
+
+
 const char* OS::Name() { return "linux"; }
 
 
@@ -45,6 +151,60 @@ int OS::NumberOfAvailableProcessors() {
 }
 
 
+bool OS::SetThreadAffinity(const char* cpus, intptr_t node) {
+  cpu_set_t set;
+  if (cpus == NULL) {
+    set = process_cpus_;
+  } else if (!ParseCpuList(cpus, &set)) {
+    return false;
+  }
+  if (node >= 0) {
+    cpu_set_t local = set;
+    for (intptr_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (cpu_nodes_[cpu] != node) {
+        CPU_CLR(cpu, &local);
+      }
+    }
+    if (CPU_COUNT(&local) > 0) {
+      set = local;
+    }
+  }
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+
+intptr_t OS::NumberOfNumaNodes() {
+  return num_numa_nodes_;
+}
+
+
+intptr_t OS::CurrentNumaNode() {
+  int cpu = sched_getcpu();
+  if ((cpu < 0) || (cpu >= CPU_SETSIZE)) {
+    return -1;
+  }
+  return cpu_nodes_[cpu];
+}
+
+
+intptr_t OS::ThreadNumaNode() {
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    return -1;
+  }
+  intptr_t node = -1;
+  for (intptr_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &set)) {
+      if ((node >= 0) && (cpu_nodes_[cpu] != node)) {
+        return -1;
+      }
+      node = cpu_nodes_[cpu];
+    }
+  }
+  return node;
+}
+
+
 void OS::DebugBreak() {
   __builtin_trap();
 }
@@ -41,6 +41,16 @@ int64_t OS::CurrentMonotonicNanos() {
 }
 
 
+int64_t OS::CurrentCoarseMonotonicNanos() {
+  ASSERT(timebase_info.denom != 0);
+  // Kept by the kernel at its ticks, in the same units.
+  int64_t result = mach_approximate_time();
+  result *= timebase_info.numer;
+  result /= timebase_info.denom;
+  return result;
+}
+
+
 const char* OS::Name() { return "macos"; }
 
 
@@ -49,6 +59,26 @@ int OS::NumberOfAvailableProcessors() {
 }
 
 
+bool OS::SetThreadAffinity(const char* cpus, intptr_t node) {
+  return false;
+}
+
+
+intptr_t OS::NumberOfNumaNodes() {
+  return 1;
+}
+
+
+intptr_t OS::CurrentNumaNode() {
+  return -1;
+}
+
+
+intptr_t OS::ThreadNumaNode() {
+  return -1;
+}
+
+
 void OS::DebugBreak() {
   __builtin_trap();
 }
@@ -52,6 +52,11 @@ int64_t OS::CurrentMonotonicNanos() {
 }
 
 
+int64_t OS::CurrentCoarseMonotonicNanos() {
+  return CurrentMonotonicNanos();
+}
+
+
 const char* OS::Name() { return "windows"; }
 
 
@@ -62,6 +67,26 @@ int OS::NumberOfAvailableProcessors() {
 }
 
 
+bool OS::SetThreadAffinity(const char* cpus, intptr_t node) {
+  return false;
+}
+
+
+intptr_t OS::NumberOfNumaNodes() {
+  return 1;
+}
+
+
+intptr_t OS::CurrentNumaNode() {
+  return -1;
+}
+
+
+intptr_t OS::ThreadNumaNode() {
+  return -1;
+}
+
+
 void OS::DebugBreak() {
 #if defined(_MSC_VER)
   // Microsoft Visual C/C++ or drop-in replacement.
@@ -169,10 +194,17 @@ void OS::Startup() {
   } else {
     qpc_ticks_per_second = static_cast<int64_t>(ticks_per_sec.QuadPart);
   }
+  // For the sockets of overlapped I/O.
+  WSADATA wsa_data;
+  if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+    FATAL("WSAStartup failed");
+  }
 }
 
 
-void OS::Shutdown() {}
+void OS::Shutdown() {
+  WSACleanup();
+}
 
 
 void OS::Abort() {
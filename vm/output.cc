@@ -0,0 +1,229 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/output.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm/assert.h"
+#include "vm/flags.h"
+#include "vm/lockers.h"
+#include "vm/os.h"
+
+namespace psoup {
+
+// A buffer handed to the writer thread.
+struct OutputChunk {
+  char* bytes;
+  intptr_t length;
+  OutputChunk* next;
+};
+
+static Mutex* buffers_mutex = NULL;
+static OutputBuffer* buffers = NULL;
+
+static Monitor* writer_monitor = NULL;
+// Held while writing chunks, so those taken later are written after them.
+static Mutex* writer_mutex = NULL;
+static OutputChunk* writer_head = NULL;
+static OutputChunk* writer_tail = NULL;
+static bool writer_running = false;
+static bool writer_done = false;
+
+
+static void Write(const char* bytes, intptr_t length) {
+  OS::Print("%.*s", static_cast<int>(length), bytes);
+}
+
+
+static void WriteChunks(OutputChunk* chunk) {
+  while (chunk != NULL) {
+    OutputChunk* next = chunk->next;
+    Write(chunk->bytes, chunk->length);
+    free(chunk->bytes);
+    free(chunk);
+    chunk = next;
+  }
+}
+
+
+static void DrainWriter() {
+  if (writer_monitor == NULL) {
+    return;
+  }
+  MutexLocker wl(writer_mutex);
+  OutputChunk* chunks;
+  {
+    MonitorLocker ml(writer_monitor);
+    chunks = writer_head;
+    writer_head = writer_tail = NULL;
+  }
+  WriteChunks(chunks);
+}
+
+
+static void WriterMain(uword parameter) {
+  for (;;) {
+    {
+      MonitorLocker ml(writer_monitor);
+      while ((writer_head == NULL) && writer_running) {
+        ml.Wait();
+      }
+      if (writer_head == NULL) {
+        writer_done = true;
+        ml.NotifyAll();
+        return;
+      }
+    }
+    DrainWriter();
+  }
+}
+
+
+OutputBuffer::OutputBuffer() :
+    buffer_(NULL), size_(0), capacity_(0), oldest_nanos_(0), next_(NULL) {
+  MutexLocker ml(buffers_mutex);
+  next_ = buffers;
+  buffers = this;
+}
+
+
+OutputBuffer::~OutputBuffer() {
+  {
+    MutexLocker ml(buffers_mutex);
+    OutputBuffer** link = &buffers;
+    while (*link != this) {
+      link = &(*link)->next_;
+    }
+    *link = next_;
+  }
+  Flush();
+  free(buffer_);
+}
+
+
+void OutputBuffer::PrintLine(const char* line, intptr_t length) {
+  MutexLocker ml(&mutex_);
+  if (size_ + length + 1 > capacity_) {
+    intptr_t capacity = capacity_ == 0 ? kFlushBytes : capacity_;
+    while (size_ + length + 1 > capacity) {
+      capacity *= 2;
+    }
+    buffer_ = reinterpret_cast<char*>(realloc(buffer_, capacity));
+    if (buffer_ == NULL) {
+      FATAL("Failed to grow output buffer");
+    }
+    capacity_ = capacity;
+  }
+  memcpy(buffer_ + size_, line, length);
+  buffer_[size_ + length] = '\n';
+  int64_t now = OS::CurrentMonotonicNanos();
+  if (size_ == 0) {
+    oldest_nanos_ = now;
+  }
+  size_ += length + 1;
+
+  if ((size_ >= kFlushBytes) || (now - oldest_nanos_ >= kFlushNanos)) {
+    FlushLocked();
+  }
+}
+
+
+void OutputBuffer::Flush() {
+  MutexLocker ml(&mutex_);
+  FlushLocked();
+}
+
+
+void OutputBuffer::FlushLocked() {
+  if (size_ == 0) {
+    return;
+  }
+  if (writer_monitor != NULL) {
+    MonitorLocker ml(writer_monitor);
+    if (writer_running) {
+      OutputChunk* chunk =
+          reinterpret_cast<OutputChunk*>(malloc(sizeof(OutputChunk)));
+      if (chunk == NULL) {
+        FATAL("Failed to allocate output chunk");
+      }
+      chunk->bytes = buffer_;
+      chunk->length = size_;
+      chunk->next = NULL;
+      if (writer_tail == NULL) {
+        writer_head = chunk;
+      } else {
+        writer_tail->next = chunk;
+      }
+      writer_tail = chunk;
+      ml.Notify();
+      buffer_ = NULL;
+      size_ = 0;
+      capacity_ = 0;
+      return;
+    }
+  }
+  Write(buffer_, size_);
+  size_ = 0;
+}
+
+
+static void FlushAtExit() {
+  OutputBuffer::FlushAll();
+}
+
+
+void OutputBuffer::Startup() {
+  buffers_mutex = new Mutex();
+  atexit(FlushAtExit);
+  if (!Flags::output_thread()) {
+    return;
+  }
+  writer_mutex = new Mutex();
+  writer_monitor = new Monitor();
+  writer_running = true;
+  int result = Thread::Start("output", WriterMain, 0);
+  if (result != 0) {
+    OS::PrintErr("Failed to start the output thread (%d), writing from "
+                 "each isolate\n", result);
+    writer_running = false;
+  }
+}
+
+
+void OutputBuffer::Shutdown() {
+  FlushAll();
+  if (writer_monitor != NULL) {
+    MonitorLocker ml(writer_monitor);
+    if (!writer_running) {
+      return;
+    }
+    writer_running = false;
+    ml.NotifyAll();
+    while (!writer_done) {
+      ml.Wait();
+    }
+  }
+  // Not freed: FlushAtExit may yet run, and an isolate thread may yet be
+  // finishing a flush.
+}
+
+
+void OutputBuffer::FlushAll() {
+  if (buffers_mutex == NULL) {
+    return;
+  }
+  {
+    MutexLocker ml(buffers_mutex);
+    for (OutputBuffer* buffer = buffers;
+         buffer != NULL;
+         buffer = buffer->next_) {
+      buffer->Flush();
+    }
+  }
+  DrainWriter();
+}
+
+}  // namespace psoup
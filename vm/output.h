@@ -0,0 +1,57 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_OUTPUT_H_
+#define VM_OUTPUT_H_
+
+#include "vm/allocation.h"
+#include "vm/globals.h"
+#include "vm/thread.h"
+
+namespace psoup {
+
+// What an isolate prints to standard output. Lines gather in the isolate's
+// buffer and are written together: once kFlushBytes have gathered or the
+// oldest has waited kFlushNanos, at the end of each of the isolate's turns,
+// and when it or the process exits. A buffer is written whole, so the lines
+// of isolates on other threads do not mix.
+//
+// With --output_thread, full buffers are handed to a writer thread in place
+// of being written, so that a slow reader of standard output never blocks an
+// isolate.
+class OutputBuffer {
+ public:
+  static const intptr_t kFlushBytes = 4 * KB;
+  static const int64_t kFlushNanos = 100 * kNanosecondsPerMillisecond;
+
+  OutputBuffer();
+  ~OutputBuffer();  // Flushes.
+
+  // Adds the line, appending a newline.
+  void PrintLine(const char* line, intptr_t length);
+  void Flush();
+
+  static void Startup();
+  static void Shutdown();
+  // Writes every isolate's buffer and whatever the writer thread holds, as
+  // the process exits.
+  static void FlushAll();
+
+ private:
+  void FlushLocked();
+
+  Mutex mutex_;
+  char* buffer_;
+  intptr_t size_;
+  intptr_t capacity_;
+  int64_t oldest_nanos_;  // When the first line of the buffer was added.
+
+  OutputBuffer* next_;  // All buffers, for FlushAll.
+
+  DISALLOW_COPY_AND_ASSIGN(OutputBuffer);
+};
+
+}  // namespace psoup
+
+#endif  // VM_OUTPUT_H_
@@ -5,6 +5,7 @@
 #include "vm/port.h"
 
 #include "vm/flags.h"
+#include "vm/isolate.h"
 #include "vm/lockers.h"
 #include "vm/message_loop.h"
 #include "vm/os.h"
@@ -14,16 +15,14 @@
 
 namespace psoup {
 
-Mutex* PortMap::mutex_ = NULL;
-PortMap::Entry* PortMap::map_ = NULL;
+PortMap::Shard PortMap::shards_[kNumShards];
 MessageLoop* PortMap::deleted_entry_ = reinterpret_cast<MessageLoop*>(1);
-intptr_t PortMap::capacity_ = 0;
-intptr_t PortMap::used_ = 0;
-intptr_t PortMap::deleted_ = 0;
+MessageLoop* PortMap::host_entry_ = reinterpret_cast<MessageLoop*>(2);
+Mutex* PortMap::prng_mutex_ = NULL;
 Random* PortMap::prng_ = NULL;
 
 
-intptr_t PortMap::FindPort(Port port) {
+intptr_t PortMap::FindPort(Shard* shard, Port port) {
   // ILLEGAL_PORT (0) is used as a sentinel value in Entry.port. The loop below
   // could return the index to a deleted port when we are searching for
   // port id ILLEGAL_PORT. Return -1 immediately to indicate the port
@@ -32,190 +31,364 @@ intptr_t PortMap::FindPort(Port port) {
     return -1;
   }
   ASSERT(port != ILLEGAL_PORT);
-  intptr_t index = port % capacity_;
+  // The low bits chose the shard.
+  intptr_t index = (port / kNumShards) % shard->capacity;
   intptr_t start_index = index;
-  Entry entry = map_[index];
+  Entry entry = shard->map[index];
   while (entry.loop != NULL) {
     if (entry.port == port) {
       return index;
     }
-    index = (index + 1) % capacity_;
+    index = (index + 1) % shard->capacity;
     // Prevent endless loops.
     ASSERT(index != start_index);
-    entry = map_[index];
+    entry = shard->map[index];
   }
   return -1;
 }
 
 
-void PortMap::Rehash(intptr_t new_capacity) {
+void PortMap::Rehash(Shard* shard, intptr_t new_capacity) {
   Entry* new_ports = new Entry[new_capacity];
   memset(new_ports, 0, new_capacity * sizeof(Entry));
 
-  for (intptr_t i = 0; i < capacity_; i++) {
-    Entry entry = map_[i];
+  for (intptr_t i = 0; i < shard->capacity; i++) {
+    Entry entry = shard->map[i];
     // Skip free and deleted entries.
     if (entry.port != 0) {
-      intptr_t new_index = entry.port % new_capacity;
+      intptr_t new_index = (entry.port / kNumShards) % new_capacity;
       while (new_ports[new_index].port != 0) {
         new_index = (new_index + 1) % new_capacity;
       }
       new_ports[new_index] = entry;
     }
   }
-  delete[] map_;
-  map_ = new_ports;
-  capacity_ = new_capacity;
-  deleted_ = 0;
+  delete[] shard->map;
+  shard->map = new_ports;
+  shard->capacity = new_capacity;
+  shard->deleted = 0;
 }
 
 
 Port PortMap::AllocatePort() {
+  MutexLocker ml(prng_mutex_);
   Port result = prng_->NextUInt64() & kMaxInt64;
 
-  // Keep getting new values while we have an illegal port number or the port
-  // number is already in use.
-  while ((result == ILLEGAL_PORT) || (FindPort(result) >= 0)) {
+  // Keep getting new values while we have an illegal port number. Whether the
+  // number is already in use is checked under the lock of its shard.
+  while (result == ILLEGAL_PORT) {
     result = prng_->NextUInt64() & kMaxInt64;
   }
 
   ASSERT(result != 0);
-  ASSERT(FindPort(result) < 0);
   return result;
 }
 
 
-void PortMap::MaintainInvariants() {
-  intptr_t empty = capacity_ - used_ - deleted_;
-  if (used_ > ((capacity_ / 4) * 3)) {
+void PortMap::MaintainInvariants(Shard* shard) {
+  intptr_t empty = shard->capacity - shard->used - shard->deleted;
+  if (shard->used > ((shard->capacity / 4) * 3)) {
     // Grow the port map.
-    Rehash(capacity_ * 2);
-  } else if (empty < deleted_) {
+    Rehash(shard, shard->capacity * 2);
+  } else if (empty < shard->deleted) {
     // Rehash without growing the table to flush the deleted slots out of the
     // map.
-    Rehash(capacity_);
+    Rehash(shard, shard->capacity);
   }
 }
 
 
 Port PortMap::CreatePort(MessageLoop* loop) {
   ASSERT(loop != NULL);
-  MutexLocker ml(mutex_);
-#if defined(DEBUG)
-  /// queue->CheckAccess();
-#endif
-
-  Entry entry;
-  entry.port = AllocatePort();
-  entry.loop = loop;
-  /// entry.state = kNewPort;
-
-  // Search for the first unused slot. Make use of the knowledge that here is
-  // currently no port with this id in the port map.
-  ASSERT(FindPort(entry.port) < 0);
-  intptr_t index = entry.port % capacity_;
-  Entry cur = map_[index];
-  // Stop the search at the first found unused (free or deleted) slot.
-  while (cur.port != 0) {
-    index = (index + 1) % capacity_;
-    cur = map_[index];
-  }
-
-  // Insert the newly created port at the index.
+  return AddPort(loop, NULL, NULL);
+}
+
+
+Port PortMap::CreateHostPort(HostHandler handler, void* context) {
+  ASSERT(handler != NULL);
+  return AddPort(host_entry_, handler, context);
+}
+
+
+Port PortMap::AddPort(MessageLoop* loop, HostHandler handler, void* context) {
+  for (;;) {
+    Entry entry;
+    entry.port = AllocatePort();
+    entry.loop = loop;
+    entry.handler = handler;
+    entry.context = context;
+    Shard* shard = ShardOf(entry.port);
+    MutexLocker ml(shard->mutex);
+    if (FindPort(shard, entry.port) >= 0) {
+      continue;  // Already in use.
+    }
+
+    // Search for the first unused slot. Make use of the knowledge that here is
+    // currently no port with this id in the port map.
+    intptr_t index = (entry.port / kNumShards) % shard->capacity;
+    Entry cur = shard->map[index];
+    // Stop the search at the first found unused (free or deleted) slot.
+    while (cur.port != 0) {
+      index = (index + 1) % shard->capacity;
+      cur = shard->map[index];
+    }
+
+    // Insert the newly created port at the index.
+    ASSERT(index >= 0);
+    ASSERT(index < shard->capacity);
+    ASSERT(shard->map[index].port == 0);
+    ASSERT((shard->map[index].loop == NULL) ||
+           (shard->map[index].loop == deleted_entry_));
+    if (shard->map[index].loop == deleted_entry_) {
+      // Consuming a deleted entry.
+      shard->deleted--;
+    }
+    shard->map[index] = entry;
+
+    // Increment number of used slots and grow if necessary.
+    shard->used++;
+    MaintainInvariants(shard);
+
+    return entry.port;
+  }
+}
+
+
+PortMap::PostResult PortMap::PostMessage(IsolateMessage* message) {
+  message->next_ = NULL;
+  intptr_t posted = 0;
+  PostResult result = Post(&message, &posted);
+  DeleteMessages(message);
+  return result;
+}
+
+
+intptr_t PortMap::PostMessages(IsolateMessage* messages) {
+  intptr_t posted = 0;
+  if (messages != NULL) {
+    Post(&messages, &posted);
+    DeleteMessages(messages);
+  }
+  return posted;
+}
+
+
+void PortMap::PostEach(IsolateMessage** messages,
+                       intptr_t count,
+                       PostResult* results) {
+  uint32_t shards = 0;
+  for (intptr_t i = 0; i < count; i++) {
+    shards |= 1 << (messages[i]->dest_port() & (kNumShards - 1));
+  }
+  bool any_host = false;
+  for (intptr_t s = 0; s < kNumShards; s++) {
+    if ((shards & (1 << s)) == 0) {
+      continue;
+    }
+    Shard* shard = &shards_[s];
+    MutexLocker ml(shard->mutex);
+    for (intptr_t i = 0; i < count; i++) {
+      IsolateMessage* message = messages[i];
+      if (message == NULL) {
+        continue;  // Posted from an earlier shard.
+      }
+      Port port = message->dest_port();
+      if (ShardOf(port) != shard) {
+        continue;
+      }
+      intptr_t index = FindPort(shard, port);
+      if (index < 0) {
+        results[i] = kNoSuchPort;
+        continue;
+      }
+      MessageLoop* loop = shard->map[index].loop;
+      ASSERT((loop != NULL) && (loop != deleted_entry_));
+      if (loop == host_entry_) {
+        // Posted below, outside the lock, as Post does.
+        results[i] = kPosted;
+        any_host = true;
+        continue;
+      }
+      if (!loop->AdmitMessage(message)) {
+        results[i] = kMailboxFull;
+        continue;
+      }
+      message->next_ = NULL;
+      // Under the lock, so the loop cannot close the port and go away meanwhile.
+      loop->PostMessage(message);
+      messages[i] = NULL;
+      results[i] = kPosted;
+    }
+  }
+  if (any_host) {
+    for (intptr_t i = 0; i < count; i++) {
+      if ((messages[i] != NULL) && (results[i] == kPosted)) {
+        results[i] = PostMessage(messages[i]);
+        messages[i] = NULL;
+      }
+    }
+  }
+}
+
+
+PortMap::PostResult PortMap::Post(IsolateMessage** messages,
+                                  intptr_t* posted) {
+  IsolateMessage* message = *messages;
+  Port port = message->dest_port();
+  Shard* shard = ShardOf(port);
+  MutexLocker ml(shard->mutex);
+  intptr_t index = FindPort(shard, port);
+  if (index < 0) {
+    return kNoSuchPort;
+  }
   ASSERT(index >= 0);
-  ASSERT(index < capacity_);
-  ASSERT(map_[index].port == 0);
-  ASSERT((map_[index].loop == NULL) ||
-         (map_[index].loop == deleted_entry_));
-  if (map_[index].loop == deleted_entry_) {
-    // Consuming a deleted entry.
-    deleted_--;
+  ASSERT(index < shard->capacity);
+  MessageLoop* loop = shard->map[index].loop;
+  ASSERT(shard->map[index].port != 0);
+  ASSERT((loop != NULL) && (loop != deleted_entry_));
+  if (loop == host_entry_) {
+    HostHandler handler = shard->map[index].handler;
+    void* context = shard->map[index].context;
+    ml.Unlock();  // The handler may send to the shard's ports.
+    while (message != NULL) {
+      IsolateMessage* next = message->next_;
+      handler(port, message->data(), message->length(), context);
+      delete message;
+      message = next;
+      (*posted)++;
+    }
+    *messages = NULL;
+    ml.Lock();
+    return kPosted;
+  }
+  while (message != NULL) {
+    ASSERT(message->dest_port() == port);
+    if (!loop->AdmitMessage(message)) {
+      *messages = message;
+      return kMailboxFull;
+    }
+    IsolateMessage* next = message->next_;
+    // Under the lock, so the loop cannot close the port and go away meanwhile.
+    loop->PostMessage(message);
+    message = next;
+    (*posted)++;
   }
-  map_[index] = entry;
+  *messages = NULL;
+  return kPosted;
+}
 
-  // Increment number of used slots and grow if necessary.
-  used_++;
-  MaintainInvariants();
 
-  return entry.port;
+void PortMap::DeleteMessages(IsolateMessage* messages) {
+  while (messages != NULL) {
+    IsolateMessage* next = messages->next_;
+    delete messages;
+    messages = next;
+  }
 }
 
 
-bool PortMap::PostMessage(IsolateMessage* message) {
-  MutexLocker ml(mutex_);
-  intptr_t index = FindPort(message->dest_port());
+bool PortMap::ReadUsage(Port port, int64_t* usage) {
+  Shard* shard = ShardOf(port);
+  MutexLocker ml(shard->mutex);
+  intptr_t index = FindPort(shard, port);
   if (index < 0) {
-    delete message;
     return false;
   }
-  ASSERT(index >= 0);
-  ASSERT(index < capacity_);
-  MessageLoop* loop = map_[index].loop;
-  ASSERT(map_[index].port != 0);
+  MessageLoop* loop = shard->map[index].loop;
   ASSERT((loop != NULL) && (loop != deleted_entry_));
-  loop->PostMessage(message);
+  if ((loop == host_entry_) || (loop->isolate() == NULL)) {
+    return false;
+  }
+  // Under the lock, so the loop and its isolate cannot go away meanwhile.
+  loop->isolate()->ReadUsage(usage);
   return true;
 }
 
 
 bool PortMap::ClosePort(Port port) {
-  MutexLocker ml(mutex_);
-  intptr_t index = FindPort(port);
+  return RemovePort(port, false);
+}
+
+
+bool PortMap::CloseHostPort(Port port) {
+  return RemovePort(port, true);
+}
+
+
+bool PortMap::RemovePort(Port port, bool host) {
+  Shard* shard = ShardOf(port);
+  MutexLocker ml(shard->mutex);
+  intptr_t index = FindPort(shard, port);
   if (index < 0) {
     return false;
   }
-  ASSERT(index < capacity_);
-  ASSERT(map_[index].port != 0);
-  ASSERT(map_[index].loop != deleted_entry_);
-  ASSERT(map_[index].loop != NULL);
+  ASSERT(index < shard->capacity);
+  ASSERT(shard->map[index].port != 0);
+  ASSERT(shard->map[index].loop != deleted_entry_);
+  ASSERT(shard->map[index].loop != NULL);
+  if ((shard->map[index].loop == host_entry_) != host) {
+    return false;
+  }
 
-  map_[index].port = 0;
-  map_[index].loop = deleted_entry_;
+  shard->map[index].port = 0;
+  shard->map[index].loop = deleted_entry_;
 
-  used_--;
-  deleted_++;
-  MaintainInvariants();
+  shard->used--;
+  shard->deleted++;
+  MaintainInvariants(shard);
   return true;
 }
 
 
 void PortMap::CloseAllPorts(MessageLoop* loop) {
-  MutexLocker ml(mutex_);
-  for (intptr_t index = 0; index < capacity_; index++) {
-    if (map_[index].loop == loop) {
-      ASSERT(map_[index].port != 0);
-      map_[index].port = 0;
-      map_[index].loop = deleted_entry_;
-      used_--;
-      deleted_++;
+  for (intptr_t i = 0; i < kNumShards; i++) {
+    Shard* shard = &shards_[i];
+    MutexLocker ml(shard->mutex);
+    for (intptr_t index = 0; index < shard->capacity; index++) {
+      if (shard->map[index].loop == loop) {
+        ASSERT(shard->map[index].port != 0);
+        shard->map[index].port = 0;
+        shard->map[index].loop = deleted_entry_;
+        shard->used--;
+        shard->deleted++;
+      }
     }
+    MaintainInvariants(shard);
   }
-  MaintainInvariants();
 }
 
 
 void PortMap::Startup() {
-  mutex_ = new Mutex();
+  prng_mutex_ = new Mutex();
   prng_ = new Random(OS::CurrentMonotonicNanos());
 
   static const intptr_t kInitialCapacity = 8;
   // TODO(iposva): Verify whether we want to keep exponentially growing.
   ASSERT(Utils::IsPowerOfTwo(kInitialCapacity));
-  map_ = new Entry[kInitialCapacity];
-  memset(map_, 0, kInitialCapacity * sizeof(Entry));
-  capacity_ = kInitialCapacity;
-  used_ = 0;
-  deleted_ = 0;
+  for (intptr_t i = 0; i < kNumShards; i++) {
+    Shard* shard = &shards_[i];
+    shard->mutex = new Mutex();
+    shard->map = new Entry[kInitialCapacity];
+    memset(shard->map, 0, kInitialCapacity * sizeof(Entry));
+    shard->capacity = kInitialCapacity;
+    shard->used = 0;
+    shard->deleted = 0;
+  }
 }
 
 
 void PortMap::Shutdown() {
-  delete mutex_;
-  mutex_ = NULL;
+  for (intptr_t i = 0; i < kNumShards; i++) {
+    Shard* shard = &shards_[i];
+    delete shard->mutex;
+    shard->mutex = NULL;
+    delete[] shard->map;
+    shard->map = NULL;
+  }
+  delete prng_mutex_;
+  prng_mutex_ = NULL;
   delete prng_;
   prng_ = NULL;
-  delete[] map_;
-  map_ = NULL;
 }
 
 }  // namespace psoup
@@ -20,36 +20,86 @@ class Random;
 
 class PortMap : public AllStatic {
  public:
+  enum PostResult {
+    kPosted,
+    kNoSuchPort,
+    kMailboxFull,  // The receiving loop has its capacity of messages waiting.
+  };
+
+  // Receives the messages posted to a host port, on the poster's thread.
+  typedef void (*HostHandler)(Port port, const uint8_t* data, size_t length,
+                              void* context);
+
   static Port CreatePort(MessageLoop* loop);
-  static bool PostMessage(IsolateMessage* message);
+  // A port of the embedder rather than of an isolate.
+  static Port CreateHostPort(HostHandler handler, void* context);
+  // Takes the message, which is dropped unless posted.
+  static PostResult PostMessage(IsolateMessage* message);
+  // Takes messages for one port, linked through next_, and posts them in
+  // order under one lock until one finds the mailbox full. Answers how many
+  // were posted. The rest are dropped.
+  static intptr_t PostMessages(IsolateMessage* messages);
+  // Posts count messages, each to its own port, into results. The ports are
+  // taken a shard at a time, so each shard's lock is taken once however many
+  // of the ports it holds. The messages posted are taken and set to NULL; the
+  // rest are left to the caller.
+  static void PostEach(IsolateMessage** messages,
+                       intptr_t count,
+                       PostResult* results);
   static bool ClosePort(Port port);
+  static bool CloseHostPort(Port port);
+  // As Isolate::ReadUsage, of the isolate the port belongs to. False if there
+  // is none.
+  static bool ReadUsage(Port port, int64_t* usage);
   static void CloseAllPorts(MessageLoop* loop);
 
   static void Startup();
   static void Shutdown();
 
  private:
-  // Allocate a new unique port.
-  static Port AllocatePort();
-
-  static intptr_t FindPort(Port port);
-  static void Rehash(intptr_t new_capacity);
-
-  static void MaintainInvariants();
+  // Ports are spread over shards by their low bits, each with its own lock,
+  // so isolates sending to different ports rarely contend.
+  static const intptr_t kNumShards = 16;
 
   typedef struct {
     Port port;
-    MessageLoop* loop;
+    MessageLoop* loop;  // Or host_entry_, for a host port.
+    HostHandler handler;
+    void* context;
   } Entry;
 
-  static Mutex* mutex_;
+  typedef struct {
+    Mutex* mutex;
+    Entry* map;
+    intptr_t capacity;
+    intptr_t used;
+    intptr_t deleted;
+  } Shard;
+
+  static Shard* ShardOf(Port port) {
+    return &shards_[port & (kNumShards - 1)];
+  }
+
+  // Allocate a new unique port.
+  static Port AllocatePort();
+  static Port AddPort(MessageLoop* loop, HostHandler handler, void* context);
+  static bool RemovePort(Port port, bool host);
+  // Posts messages until one is not, leaving it and those after it. They
+  // are deleted by the caller, outside the lock, since deleting a message
+  // may call back into the embedder.
+  static PostResult Post(IsolateMessage** messages, intptr_t* posted);
+  static void DeleteMessages(IsolateMessage* messages);
+
+  static intptr_t FindPort(Shard* shard, Port port);
+  static void Rehash(Shard* shard, intptr_t new_capacity);
+
+  static void MaintainInvariants(Shard* shard);
 
-  static Entry* map_;
+  static Shard shards_[kNumShards];
   static MessageLoop* deleted_entry_;
-  static intptr_t capacity_;
-  static intptr_t used_;
-  static intptr_t deleted_;
+  static MessageLoop* host_entry_;
 
+  static Mutex* prng_mutex_;
   static Random* prng_;
 };
 
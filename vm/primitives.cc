@@ -4,25 +4,49 @@
 
 #include "vm/primitives.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <sys/stat.h>
+#if defined(OS_WINDOWS)
+#include <ws2tcpip.h>
+#else
+#include <unistd.h>
+#if !defined(OS_EMSCRIPTEN)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+#endif
 
 #if defined(OS_FUCHSIA)
 #include <zircon/status.h>
 #include <zircon/syscalls.h>
 #elif defined(OS_EMSCRIPTEN)
 #include <emscripten.h>
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
 #endif
+#endif
+
+#include <atomic>
+#include <new>
 
 #include "vm/assert.h"
 #include "vm/double_conversion.h"
 #include "vm/heap.h"
+#include "vm/heap_snapshot.h"
 #include "vm/interpreter.h"
 #include "vm/isolate.h"
+#include "vm/json_scanner.h"
 #include "vm/math.h"
 #include "vm/message_loop.h"
 #include "vm/object.h"
 #include "vm/os.h"
+#include "vm/output.h"
+#include "vm/snapshot.h"
+#include "vm/thread_pool.h"
 
 #define nil I->nil_obj()
 
@@ -86,6 +110,7 @@ const bool kFailure = false;
   V(49, ByteArray_size)                                                        \
   V(50, Bytes_copyByteArrayFromTo)                                             \
   V(51, String_at)                                                             \
+  V(52, WeakArray_cleared)                                                     \
   V(53, String_size)                                                           \
   V(54, String_hash)                                                           \
   V(55, Activation_sender)                                                     \
@@ -115,9 +140,13 @@ const bool kFailure = false;
   V(79, ByteArray_replaceFromToWithStartingAt)                                 \
   V(80, Array_replaceFromToWithStartingAt)                                     \
   V(81, Array_copyFromTo)                                                      \
+  V(82, Activation_unwindSender)                                               \
+  V(83, Activation_terminateTo)                                                \
+  V(84, Activation_handlerSender)                                              \
   V(85, Object_class)                                                          \
   V(86, Object_identical)                                                      \
   V(87, Object_identityHash)                                                   \
+  V(88, Time_coarseMonotonicNanos)                                             \
   V(89, Object_performWithAll)                                                 \
   V(90, Closure_value0)                                                        \
   V(91, Closure_value1)                                                        \
@@ -126,6 +155,7 @@ const bool kFailure = false;
   V(94, Closure_valueArray)                                                    \
   V(95, Activation_jump)                                                       \
   V(96, Behavior_allInstances)                                                 \
+  V(97, Platform_numberOfProcessors)                                           \
   V(98, Array_elementsForwardIdentity)                                         \
   V(99, Platform_operatingSystem)                                              \
   V(100, Time_monotonicNanos)                                                  \
@@ -134,6 +164,7 @@ const bool kFailure = false;
   V(103, halt)                                                                 \
   V(104, flushCache)                                                           \
   V(105, collectGarbage)                                                       \
+  V(106, sendToAll)                                                            \
   V(107, MessageLoop_exit)                                                     \
   V(108, Double_asStringFixed)                                                 \
   V(109, Double_asStringExponential)                                           \
@@ -155,6 +186,7 @@ const bool kFailure = false;
   V(126, Object_isCanonical)                                                   \
   V(127, Object_markCanonical)                                                 \
   V(128, writeBytesToFile)                                                     \
+  V(129, lookupSymbol)                                                         \
   V(130, readFileAsBytes)                                                      \
   V(131, Double_pow)                                                           \
   V(132, Double_class_parse)                                                   \
@@ -193,7 +225,101 @@ const bool kFailure = false;
   V(165, ZXStatus_getString)                                                   \
   V(166, JS_performInstanceOf)                                                 \
   V(167, JS_performHas)                                                        \
+  V(168, lookupCacheStatistic)                                                 \
+  V(169, lookupCacheResize)                                                    \
+  V(170, gcTraceCapacity)                                                      \
+  V(171, gcTraceEvents)                                                        \
+  V(172, Behavior_allInstancesAll)                                             \
+  V(173, Array_elementsForwardIdentityAll)                                     \
+  V(174, Method_deferredSourceAt)                                              \
+  V(175, snapshotHeap)                                                         \
+  V(176, sendObject)                                                           \
+  V(177, spawnObject)                                                          \
+  V(178, messageSymbols)                                                       \
+  V(179, decodeMessage)                                                        \
+  V(180, mailboxCapacity)                                                      \
+  V(181, mailboxStatistic)                                                     \
+  V(182, timerSchedule)                                                        \
+  V(183, timerCancel)                                                          \
+  V(184, timerExpire)                                                          \
+  V(185, timerNextWakeup)                                                      \
+  V(186, spawnNear)                                                            \
+  V(187, spawnObjectNear)                                                      \
+  V(188, threadPoolStatistic)                                                  \
+  V(189, HashTable_slotFor)                                                    \
+  V(190, HashTable_emptySlot)                                                  \
+  V(191, Array_sortFromTo)                                                     \
+  V(192, StringBuilder_add)                                                    \
+  V(193, StringBuilder_addByte)                                                \
+  V(194, File_open)                                                            \
+  V(195, File_read)                                                            \
+  V(196, File_write)                                                           \
+  V(197, File_close)                                                           \
+  V(198, File_size)                                                            \
+  V(199, File_delete)                                                          \
   V(200, quickReturnSelf)                                                      \
+  V(201, ByteArray_float64At)                                                  \
+  V(202, ByteArray_float64AtPut)                                               \
+  V(203, ByteArray_int32At)                                                    \
+  V(204, ByteArray_int32AtPut)                                                 \
+  V(205, ByteArray_int64At)                                                    \
+  V(206, ByteArray_int64AtPut)                                                 \
+  V(207, ByteArray_addFloat64s)                                                \
+  V(208, ByteArray_scaleFloat64s)                                              \
+  V(209, ByteArray_dotFloat64s)                                                \
+  V(210, ByteArray_sumFloat64s)                                                \
+  V(211, ByteArray_minFloat64s)                                                \
+  V(212, ByteArray_maxFloat64s)                                                \
+  V(213, Array_fill)                                                           \
+  V(214, Array_indexOfIdentical)                                               \
+  V(215, Bytes_fill)                                                           \
+  V(216, Bytes_compare)                                                        \
+  V(217, Bytes_indexAfterDigits)                                               \
+  V(218, Bytes_decimalValue)                                                   \
+  V(219, Double_class_parseFromTo)                                             \
+  V(220, ByteArray_printNumberAt)                                              \
+  V(221, JSON_scan)                                                            \
+  V(222, profileInterval)                                                      \
+  V(223, profileSamples)                                                       \
+  V(224, allocationSampleInterval)                                             \
+  V(225, allocationSummary)                                                    \
+  V(226, allocationSites)                                                      \
+  V(227, writeHeapSnapshot)                                                    \
+  V(228, primitiveProfileEnabled)                                              \
+  V(229, primitiveProfile)                                                     \
+  V(230, gcPauseStatistic)                                                     \
+  V(231, usageStatistic)                                                       \
+  V(232, timeLimits)                                                           \
+  V(233, JS_performBatch)                                                      \
+  V(234, ZXVmo_map)                                                            \
+  V(235, sendHandle)                                                           \
+  V(236, Overlapped_read)                                                      \
+  V(237, Overlapped_write)                                                     \
+  V(238, Overlapped_accept)                                                    \
+  V(239, Overlapped_result)                                                    \
+  V(240, Socket_open)                                                          \
+  V(241, Socket_bind)                                                          \
+  V(242, Socket_listen)                                                        \
+  V(243, Socket_accept)                                                        \
+  V(244, Socket_connect)                                                       \
+  V(245, Socket_error)                                                         \
+  V(246, Socket_read)                                                          \
+  V(247, Socket_write)                                                         \
+  V(248, Socket_writev)                                                        \
+  V(249, Socket_sendTo)                                                        \
+  V(250, Socket_receiveFrom)                                                   \
+  V(251, Socket_localPort)                                                     \
+  V(252, Socket_close)                                                         \
+  V(253, Socket_await)                                                         \
+  V(254, Overlapped_connect)                                                   \
+  V(255, encodeMessage)                                                        \
+  V(768, stackFrames)                                                          \
+  V(769, ByteArray_fillRandom)                                                 \
+  V(770, ByteArray_fillRandomFloat64s)                                         \
+  V(771, ByteArray_fillRandomInt64s)                                           \
+  V(772, messageTraceCapacity)                                                 \
+  V(773, messageTraceEvents)                                                   \
+  V(774, messageBudget)                                                        \
 
 
 #define DEFINE_PRIMITIVE(name)                                                 \
@@ -320,6 +446,83 @@ const bool kFailure = false;
   RETURN((raw_bool) ? I->true_obj() : I->false_obj());                         \
 
 
+#if defined(__SIZEOF_INT128__)
+// Large integers of a few digits are common as the intermediates of 64-bit
+// hashing and the like. With both operands below 2^127 in magnitude, the
+// operation is done in 128 bits and only its result is allocated. Neither
+// operand can then be -2^127, so quotients cannot overflow.
+static const intptr_t kInt128Digits = 128 / kDigitBits;
+
+static bool Int128Value(Object integer, __int128* value) {
+  if (integer->IsSmallInteger()) {
+    *value = static_cast<SmallInteger>(integer)->value();
+    return true;
+  }
+  if (integer->IsMediumInteger()) {
+    *value = static_cast<MediumInteger>(integer)->value();
+    return true;
+  }
+  LargeInteger large = static_cast<LargeInteger>(integer);
+  if (large->size() > kInt128Digits) {
+    return false;
+  }
+  unsigned __int128 absolute_value = 0;
+  for (intptr_t i = large->size() - 1; i >= 0; i--) {
+    absolute_value <<= kDigitShift;
+    absolute_value |= large->digit(i);
+  }
+  if ((absolute_value >> 127) != 0) {
+    return false;
+  }
+  __int128 signed_value = static_cast<__int128>(absolute_value);
+  *value = large->negative() ? -signed_value : signed_value;
+  return true;
+}
+
+static Object NewInteger128(__int128 value, Heap* H) {
+  if ((value >= kMinInt64) && (value <= kMaxInt64)) {
+    int64_t raw_value = static_cast<int64_t>(value);
+    if (SmallInteger::IsSmiValue(raw_value)) {
+      return SmallInteger::New(raw_value);
+    }
+    MediumInteger result = H->AllocateMediumInteger();
+    result->set_value(raw_value);
+    return result;
+  }
+
+  LargeInteger result = H->AllocateLargeInteger(kInt128Digits);
+  result->set_negative(value < 0);
+  unsigned __int128 absolute_value;
+  if (value < 0) {
+    absolute_value = -static_cast<unsigned __int128>(value);
+  } else {
+    absolute_value = static_cast<unsigned __int128>(value);
+  }
+  intptr_t i = 0;
+  while (absolute_value != 0) {
+    result->set_digit(i, absolute_value & kDigitMask);
+    absolute_value >>= kDigitShift;
+    i++;
+  }
+  result->set_size(i);
+  while (i < kInt128Digits) {
+    result->set_digit(i, 0);
+    i++;
+  }
+  return result;
+}
+
+#define INT128_VALUES                                                          \
+  __int128 raw_left, raw_right;                                                \
+  bool is_int128_op = Int128Value(left, &raw_left) &&                          \
+                      Int128Value(right, &raw_right);                          \
+
+#define RETURN_INT128(raw_integer)                                             \
+  RETURN(NewInteger128(raw_integer, H));                                       \
+
+#endif  // defined(__SIZEOF_INT128__)
+
+
 DEFINE_PRIMITIVE(Unimplemented) {
   UNIMPLEMENTED();
   return kFailure;
@@ -348,6 +551,14 @@ DEFINE_PRIMITIVE(Number_add) {
   }
 
   if (IS_LINT_OP(left, right)) {
+#if defined(__SIZEOF_INT128__)
+    INT128_VALUES;
+    __int128 raw_result;
+    if (is_int128_op &&
+        !__builtin_add_overflow(raw_left, raw_right, &raw_result)) {
+      RETURN_INT128(raw_result);
+    }
+#endif
     LINT_VALUES;
     LargeInteger large_result = LargeInteger::Add(large_left, large_right, H);
     RETURN_LINT(large_result);
@@ -387,6 +598,14 @@ DEFINE_PRIMITIVE(Number_subtract) {
   }
 
   if (IS_LINT_OP(left, right)) {
+#if defined(__SIZEOF_INT128__)
+    INT128_VALUES;
+    __int128 raw_result;
+    if (is_int128_op &&
+        !__builtin_sub_overflow(raw_left, raw_right, &raw_result)) {
+      RETURN_INT128(raw_result);
+    }
+#endif
     LINT_VALUES;
     LargeInteger large_result =
         LargeInteger::Subtract(large_left, large_right, H);
@@ -440,6 +659,14 @@ DEFINE_PRIMITIVE(Number_multiply) {
   }
 
   if (IS_LINT_OP(left, right)) {
+#if defined(__SIZEOF_INT128__)
+    INT128_VALUES;
+    __int128 raw_result;
+    if (is_int128_op &&
+        !__builtin_mul_overflow(raw_left, raw_right, &raw_result)) {
+      RETURN_INT128(raw_result);
+    }
+#endif
     LINT_VALUES;
     LargeInteger large_result =
         LargeInteger::Multiply(large_left, large_right, H);
@@ -492,6 +719,15 @@ DEFINE_PRIMITIVE(Number_divide) {
   }
 
   if (IS_LINT_OP(left, right)) {
+#if defined(__SIZEOF_INT128__)
+    INT128_VALUES;
+    if (is_int128_op && (raw_right != 0)) {
+      if ((raw_left % raw_right) != 0) {
+        return kFailure;  // Inexact division.
+      }
+      RETURN_INT128(raw_left / raw_right);
+    }
+#endif
     LINT_VALUES;
     if (large_right->size() == 0) {
       return kFailure;  // Division by zero.
@@ -546,6 +782,17 @@ DEFINE_PRIMITIVE(Number_div) {
   }
 
   if (IS_LINT_OP(left, right)) {
+#if defined(__SIZEOF_INT128__)
+    INT128_VALUES;
+    if (is_int128_op && (raw_right != 0)) {
+      __int128 raw_result = raw_left / raw_right;
+      if (((raw_left % raw_right) != 0) &&
+          ((raw_left < 0) != (raw_right < 0))) {
+        raw_result--;
+      }
+      RETURN_INT128(raw_result);
+    }
+#endif
     LINT_VALUES;
     if (large_right->size() == 0) {
       return kFailure;  // Division by zero.
@@ -601,6 +848,16 @@ DEFINE_PRIMITIVE(Number_mod) {
   }
 
   if (IS_LINT_OP(left, right)) {
+#if defined(__SIZEOF_INT128__)
+    INT128_VALUES;
+    if (is_int128_op && (raw_right != 0)) {
+      __int128 raw_result = raw_left % raw_right;
+      if ((raw_result != 0) && ((raw_result < 0) != (raw_right < 0))) {
+        raw_result += raw_right;
+      }
+      RETURN_INT128(raw_result);
+    }
+#endif
     LINT_VALUES;
     if (large_right->size() == 0) {
       return kFailure;  // Division by zero.
@@ -644,6 +901,12 @@ DEFINE_PRIMITIVE(Number_quo) {
   }
 
   if (IS_LINT_OP(left, right)) {
+#if defined(__SIZEOF_INT128__)
+    INT128_VALUES;
+    if (is_int128_op && (raw_right != 0)) {
+      RETURN_INT128(raw_left / raw_right);
+    }
+#endif
     LINT_VALUES;
     if (large_right->size() == 0) {
       return kFailure;  // Division by zero.
@@ -687,6 +950,12 @@ DEFINE_PRIMITIVE(Number_rem) {
   }
 
   if (IS_LINT_OP(left, right)) {
+#if defined(__SIZEOF_INT128__)
+    INT128_VALUES;
+    if (is_int128_op && (raw_right != 0)) {
+      RETURN_INT128(raw_left % raw_right);
+    }
+#endif
     LINT_VALUES;
     if (large_right->size() == 0) {
       return kFailure;  // Division by zero.
@@ -718,6 +987,12 @@ DEFINE_PRIMITIVE(Number_equal) {
   }
 
   if (IS_LINT_OP(left, right)) {
+#if defined(__SIZEOF_INT128__)
+    INT128_VALUES;
+    if (is_int128_op) {
+      RETURN_BOOL(raw_left == raw_right);
+    }
+#endif
     LINT_VALUES;
     RETURN_BOOL(LargeInteger::Compare(large_left, large_right) == 0);
   }
@@ -749,6 +1024,12 @@ DEFINE_PRIMITIVE(Number_less) {
   }
 
   if (IS_LINT_OP(left, right)) {
+#if defined(__SIZEOF_INT128__)
+    INT128_VALUES;
+    if (is_int128_op) {
+      RETURN_BOOL(raw_left < raw_right);
+    }
+#endif
     LINT_VALUES;
     RETURN_BOOL(LargeInteger::Compare(large_left, large_right) > 0);
   }
@@ -780,6 +1061,12 @@ DEFINE_PRIMITIVE(Number_greater) {
   }
 
   if (IS_LINT_OP(left, right)) {
+#if defined(__SIZEOF_INT128__)
+    INT128_VALUES;
+    if (is_int128_op) {
+      RETURN_BOOL(raw_left > raw_right);
+    }
+#endif
     LINT_VALUES;
     RETURN_BOOL(LargeInteger::Compare(large_left, large_right) < 0);
   }
@@ -811,6 +1098,12 @@ DEFINE_PRIMITIVE(Number_lessOrEqual) {
   }
 
   if (IS_LINT_OP(left, right)) {
+#if defined(__SIZEOF_INT128__)
+    INT128_VALUES;
+    if (is_int128_op) {
+      RETURN_BOOL(raw_left <= raw_right);
+    }
+#endif
     LINT_VALUES;
     RETURN_BOOL(LargeInteger::Compare(large_left, large_right) >= 0);
   }
@@ -842,6 +1135,12 @@ DEFINE_PRIMITIVE(Number_greaterOrEqual) {
   }
 
   if (IS_LINT_OP(left, right)) {
+#if defined(__SIZEOF_INT128__)
+    INT128_VALUES;
+    if (is_int128_op) {
+      RETURN_BOOL(raw_left >= raw_right);
+    }
+#endif
     LINT_VALUES;
     RETURN_BOOL(LargeInteger::Compare(large_left, large_right) <= 0);
   }
@@ -911,6 +1210,12 @@ DEFINE_PRIMITIVE(Integer_bitAnd) {
   }
 
   if (IS_LINT_OP(left, right)) {
+#if defined(__SIZEOF_INT128__)
+    INT128_VALUES;
+    if (is_int128_op) {
+      RETURN_INT128(raw_left & raw_right);
+    }
+#endif
     LINT_VALUES;
     LargeInteger large_result = LargeInteger::And(large_left, large_right, H);
     RETURN_LINT(large_result);
@@ -938,6 +1243,12 @@ DEFINE_PRIMITIVE(Integer_bitOr) {
   }
 
   if (IS_LINT_OP(left, right)) {
+#if defined(__SIZEOF_INT128__)
+    INT128_VALUES;
+    if (is_int128_op) {
+      RETURN_INT128(raw_left | raw_right);
+    }
+#endif
     LINT_VALUES;
     LargeInteger large_result = LargeInteger::Or(large_left, large_right, H);
     RETURN_LINT(large_result);
@@ -965,6 +1276,12 @@ DEFINE_PRIMITIVE(Integer_bitXor) {
   }
 
   if (IS_LINT_OP(left, right)) {
+#if defined(__SIZEOF_INT128__)
+    INT128_VALUES;
+    if (is_int128_op) {
+      RETURN_INT128(raw_left ^ raw_right);
+    }
+#endif
     LINT_VALUES;
     LargeInteger large_result = LargeInteger::Xor(large_left, large_right, H);
     RETURN_LINT(large_result);
@@ -1160,9 +1477,13 @@ DEFINE_PRIMITIVE(Behavior_basicNew) {
   intptr_t num_slots = format->value();
   ASSERT(num_slots >= 0);
   ASSERT(num_slots < 255);
+  if (H->TakeOutOfMemory(num_slots, sizeof(Object))) {
+    return kFailure;
+  }
 
-  RegularObject new_instance = H->AllocateRegularObject(id->value(),
-                                                         num_slots);
+  RegularObject new_instance =
+      H->AllocateRegularObject(id->value(), num_slots,
+                               H->InstanceAllocator(id->value()));
   for (intptr_t i = 0; i < num_slots; i++) {
     new_instance->set_slot(i, nil, kNoBarrier);
   }
@@ -1209,7 +1530,11 @@ DEFINE_PRIMITIVE(Array_class_new) {
   if (length < 0) {
     return kFailure;
   }
-  Array result = H->AllocateArray(length);  // SAFEPOINT
+  if (H->TakeOutOfMemory(length, sizeof(Object))) {
+    return kFailure;
+  }
+  Array result =
+      H->AllocateArray(length, H->InstanceAllocator(kArrayCid));  // SAFEPOINT
   for (intptr_t i = 0; i < length; i++) {
     result->set_element(i, nil, kNoBarrier);
   }
@@ -1259,6 +1584,9 @@ DEFINE_PRIMITIVE(WeakArray_class_new) {
   if (length < 0) {
     return kFailure;
   }
+  if (H->TakeOutOfMemory(length, sizeof(Object))) {
+    return kFailure;
+  }
   WeakArray result = H->AllocateWeakArray(length);  // SAFEPOINT
   for (intptr_t i = 0; i < length; i++) {
     result->set_element(i, nil, kNoBarrier);
@@ -1303,13 +1631,26 @@ DEFINE_PRIMITIVE(WeakArray_size) {
 }
 
 
+DEFINE_PRIMITIVE(WeakArray_cleared) {
+  ASSERT(num_args == 0);
+  WeakArray array = static_cast<WeakArray>(I->Stack(0));
+  ASSERT(array->IsWeakArray());
+  RETURN(array->cleared());
+}
+
+
 DEFINE_PRIMITIVE(ByteArray_class_new) {
   ASSERT(num_args == 1);
   SMI_ARGUMENT(length, 0);
   if (length < 0) {
     return kFailure;
   }
-  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
+  if (H->TakeOutOfMemory(length, sizeof(uint8_t))) {
+    return kFailure;
+  }
+  ByteArray result =
+      H->AllocateByteArray(length,
+                           H->InstanceAllocator(kByteArrayCid));  // SAFEPOINT
   memset(result->element_addr(0), 0, length);
   RETURN(result);
 }
@@ -1425,1298 +1766,2986 @@ DEFINE_PRIMITIVE(ByteArray_replaceFromToWithStartingAt) {
 }
 
 
-DEFINE_PRIMITIVE(Array_replaceFromToWithStartingAt) {
-  ASSERT(num_args == 4);
-  Array receiver = static_cast<Array>(I->Stack(4));
-  if (!receiver->IsArray()) {
+DEFINE_PRIMITIVE(Bytes_fill) {
+  ASSERT(num_args == 3);
+  ByteArray receiver = static_cast<ByteArray>(I->Stack(3));
+  if (!receiver->IsByteArray()) {
     UNREACHABLE();
   }
-  SMI_ARGUMENT(start, 3);
-  SMI_ARGUMENT(stop, 2);
-  Array replacement = static_cast<Array>(I->Stack(1));
-  if (!replacement->IsArray()) {
+  SMI_ARGUMENT(start, 2);
+  SMI_ARGUMENT(stop, 1);
+  SMI_ARGUMENT(value, 0);
+  if ((value < 0) || (value > 255)) {
     return kFailure;
   }
-  SMI_ARGUMENT(replacementStart, 0);
-
   if (start <= 0) {
     return kFailure;
   }
   if (stop < start) {
-    // Empty copy.
     RETURN_SELF();
   }
   if (stop > receiver->Size()) {
     return kFailure;
   }
+  memset(receiver->element_addr(start - 1), value, stop - start + 1);
+  RETURN_SELF();
+}
 
-  intptr_t count = stop - start + 1;
 
-  if (replacementStart <= 0) {
-    return kFailure;
+// Fills every byte from the isolate's generator.
+DEFINE_PRIMITIVE(ByteArray_fillRandom) {
+  ASSERT(num_args == 0);
+  ByteArray receiver = static_cast<ByteArray>(I->Stack(0));
+  if (!receiver->IsByteArray()) {
+    UNREACHABLE();
   }
-  if (replacementStart + count - 1 > replacement->Size()) {
+  I->isolate()->random().Fill(receiver->element_addr(0), receiver->Size());
+  RETURN_SELF();
+}
+
+
+// Fills every float64 element with a double in [0, limit).
+DEFINE_PRIMITIVE(ByteArray_fillRandomFloat64s) {
+  ASSERT(num_args == 1);
+  ByteArray receiver = static_cast<ByteArray>(I->Stack(1));
+  if (!receiver->IsByteArray()) {
+    UNREACHABLE();
+  }
+  FLOAT_ARGUMENT(limit, 0);
+  if (!(limit > 0.0) || isinf(limit)) {
     return kFailure;
   }
-
-  // Note replacement may be receiver.
-  if (replacementStart < start) {
-    for (intptr_t i = count - 1; i >= 0; i--) {
-      receiver->set_element(start - 1 + i,
-                            replacement->element(replacementStart - 1 + i));
-    }
-  } else {
-    for (intptr_t i = 0; i < count; i++) {
-      receiver->set_element(start - 1 + i,
-                            replacement->element(replacementStart - 1 + i));
+  Random& random = I->isolate()->random();
+  intptr_t length = receiver->Size() / 8;
+  for (intptr_t i = 0; i < length; i++) {
+    double value = random.NextDouble() * limit;
+    if (value >= limit) {
+      value = nextafter(limit, 0.0);  // Rounded up.
     }
+    memcpy(receiver->element_addr(i * 8), &value, 8);
   }
-
   RETURN_SELF();
 }
 
-DEFINE_PRIMITIVE(Array_copyFromTo) {
-  ASSERT(num_args == 2);
-
-  if (!I->Stack(1)->IsSmallInteger()) return kFailure;
-  intptr_t start = static_cast<SmallInteger>(I->Stack(1))->value();
-
-  if (!I->Stack(0)->IsSmallInteger()) return kFailure;
-  intptr_t stop = static_cast<SmallInteger>(I->Stack(0))->value();
 
-  if (!I->Stack(2)->IsArray()) return kFailure;
+// Fills every int64 element with an integer in [low, high].
+DEFINE_PRIMITIVE(ByteArray_fillRandomInt64s) {
+  ASSERT(num_args == 2);
+  ByteArray receiver = static_cast<ByteArray>(I->Stack(2));
+  if (!receiver->IsByteArray()) {
+    UNREACHABLE();
+  }
+  MINT_ARGUMENT(low, 1);
+  MINT_ARGUMENT(high, 0);
+  if (low > high) {
+    return kFailure;
+  }
+  // Wraps to 0, standing for 2^64, when the range is every int64.
+  uint64_t span = static_cast<uint64_t>(high) - static_cast<uint64_t>(low) + 1;
+  Random& random = I->isolate()->random();
+  intptr_t length = receiver->Size() / 8;
+  for (intptr_t i = 0; i < length; i++) {
+    int64_t value = static_cast<int64_t>(static_cast<uint64_t>(low) +
+                                         random.NextBelow(span));
+    memcpy(receiver->element_addr(i * 8), &value, 8);
+  }
+  RETURN_SELF();
+}
 
-  Array array = static_cast<Array>(I->Stack(2));
-  if ((start <= 0) || (stop > array->Size())) return kFailure;
 
-  intptr_t subsize = stop - (start - 1);
-  if (subsize < 0) {
+// Answers -1, 0 or 1 as the receiver's bytes sort before, with or after the
+// argument's, the shorter first when one is a prefix of the other.
+DEFINE_PRIMITIVE(Bytes_compare) {
+  ASSERT(num_args == 1);
+  Bytes receiver = static_cast<Bytes>(I->Stack(1));
+  Bytes other = static_cast<Bytes>(I->Stack(0));
+  if (!receiver->IsBytes() || !other->IsBytes()) {
     return kFailure;
   }
+  intptr_t receiver_size = receiver->Size();
+  intptr_t other_size = other->Size();
+  intptr_t length = receiver_size < other_size ? receiver_size : other_size;
+  int result = memcmp(receiver->element_addr(0), other->element_addr(0),
+                      length);
+  if (result == 0) {
+    result = receiver_size < other_size ? -1 :
+             receiver_size > other_size ? 1 : 0;
+  }
+  RETURN_SMI(result < 0 ? -1 : result > 0 ? 1 : 0);
+}
 
-  Array result = H->AllocateArray(subsize);  // SAFEPOINT
-  array = static_cast<Array>(I->Stack(2));
-  for (intptr_t i = 0; i < subsize; i++) {
-    result->set_element(i, array->element(i + start - 1));
+
+// The first argument is the buffer of a StringBuilder holding count bytes.
+// Answers it with the bytes, or the byte, stored after them, or a copy grown by
+// half when they do not fit, so a run of appends copies each byte about once.
+static ByteArray BuilderBufferFor(Heap* H, Interpreter* I,
+                                  intptr_t count, intptr_t extra) {
+  ByteArray buffer = static_cast<ByteArray>(I->Stack(2));
+  intptr_t capacity = buffer->Size();
+  if (count + extra <= capacity) {
+    return buffer;
   }
-  RETURN(result);
+  intptr_t new_capacity = (capacity >> 1) + capacity;
+  if (new_capacity < count + extra) {
+    new_capacity = count + extra;
+  }
+  new_capacity |= 7;
+  if (H->TakeOutOfMemory(new_capacity, sizeof(uint8_t))) {
+    return static_cast<ByteArray>(I->nil_obj());
+  }
+  ByteArray result = H->AllocateByteArray(new_capacity);  // SAFEPOINT
+  buffer = static_cast<ByteArray>(I->Stack(2));
+  memcpy(result->element_addr(0), buffer->element_addr(0), count);
+  memset(result->element_addr(count), 0, new_capacity - count);
+  return result;
 }
 
-DEFINE_PRIMITIVE(String_at) {
-  ASSERT(num_args == 1);
-  String string = static_cast<String>(I->Stack(1));
-  ASSERT(string->IsString());
-  SMI_ARGUMENT(index, 0);
-  index--;
-  if ((index < 0) || (index >= string->Size())) {
+
+DEFINE_PRIMITIVE(StringBuilder_add) {
+  ASSERT(num_args == 3);
+  ByteArray buffer = static_cast<ByteArray>(I->Stack(2));
+  if (!buffer->IsByteArray()) {
     return kFailure;
   }
-  uint8_t value = string->element(index);
-  RETURN(SmallInteger::New(value));
+  Bytes bytes = static_cast<Bytes>(I->Stack(1));
+  if (!bytes->IsBytes()) {
+    return kFailure;
+  }
+  SMI_ARGUMENT(count, 0);
+  if (count < 0 || count > buffer->Size()) {
+    return kFailure;
+  }
+  intptr_t length = bytes->Size();
+  ByteArray result = BuilderBufferFor(H, I, count, length);  // SAFEPOINT
+  if (result == I->nil_obj()) {
+    return kFailure;
+  }
+  bytes = static_cast<Bytes>(I->Stack(1));
+  memmove(result->element_addr(count), bytes->element_addr(0), length);
+  RETURN(result);
 }
 
 
-DEFINE_PRIMITIVE(String_size) {
-  ASSERT(num_args == 0);
-  String string = static_cast<String>(I->Stack(0));
-  ASSERT(string->IsString());
-  RETURN(string->size());
+DEFINE_PRIMITIVE(StringBuilder_addByte) {
+  ASSERT(num_args == 3);
+  ByteArray buffer = static_cast<ByteArray>(I->Stack(2));
+  if (!buffer->IsByteArray()) {
+    return kFailure;
+  }
+  SMI_ARGUMENT(byte, 1);
+  if (byte < 0 || byte > 255) {
+    return kFailure;
+  }
+  SMI_ARGUMENT(count, 0);
+  if (count < 0 || count > buffer->Size()) {
+    return kFailure;
+  }
+  ByteArray result = BuilderBufferFor(H, I, count, 1);  // SAFEPOINT
+  if (result == I->nil_obj()) {
+    return kFailure;
+  }
+  *result->element_addr(count) = byte;
+  RETURN(result);
 }
 
 
-DEFINE_PRIMITIVE(String_hash) {
-  ASSERT(num_args == 0);
-  String string = static_cast<String>(I->Stack(0));
-  ASSERT(string->IsString());
-  SmallInteger hash = string->EnsureHash(I->isolate());
-  RETURN(hash);
+// The elements of Float64Array, Int32Array and Int64Array, which keep them
+// unboxed in a ByteArray in host byte order. Indices count elements, not
+// bytes. The bulk operations work on every element without allocating, in
+// loops the compiler can vectorize.
+template <typename T>
+static inline T TypedElement(ByteArray array, intptr_t index) {
+  T value;
+  memcpy(&value, array->element_addr(index * sizeof(T)), sizeof(T));
+  return value;
 }
 
 
-DEFINE_PRIMITIVE(Activation_sender) {
-  ASSERT(num_args == 0);
-  Activation activation = static_cast<Activation>(I->Stack(0));
-  ASSERT(activation->IsActivation());
-  RETURN(I->ActivationSender(activation));  // SAFEPOINT
+template <typename T>
+static inline void SetTypedElement(ByteArray array, intptr_t index, T value) {
+  memcpy(array->element_addr(index * sizeof(T)), &value, sizeof(T));
 }
 
 
-DEFINE_PRIMITIVE(Activation_senderPut) {
+DEFINE_PRIMITIVE(ByteArray_float64At) {
   ASSERT(num_args == 1);
-  Activation activation = static_cast<Activation>(I->Stack(1));
-  ASSERT(activation->IsActivation());
-  Activation new_sender = static_cast<Activation>(I->Stack(0));
-  if (!new_sender->IsActivation() && (new_sender != nil)) {
+  ByteArray array = static_cast<ByteArray>(I->Stack(1));
+  ASSERT(array->IsByteArray());
+  SMI_ARGUMENT(index, 0);
+  index--;
+  if ((index < 0) || (index >= array->Size() / 8)) {
     return kFailure;
   }
-  I->ActivationSenderPut(activation, new_sender);  // SAFEPOINT
-  RETURN_SELF();
+  double raw_result = TypedElement<double>(array, index);
+  RETURN_FLOAT(raw_result);
 }
 
 
-DEFINE_PRIMITIVE(Activation_bci) {
-  ASSERT(num_args == 0);
-  Activation activation = static_cast<Activation>(I->Stack(0));
-  ASSERT(activation->IsActivation());
-  RETURN(I->ActivationBCI(activation));
+DEFINE_PRIMITIVE(ByteArray_float64AtPut) {
+  ASSERT(num_args == 2);
+  ByteArray array = static_cast<ByteArray>(I->Stack(2));
+  ASSERT(array->IsByteArray());
+  SMI_ARGUMENT(index, 1);
+  index--;
+  if ((index < 0) || (index >= array->Size() / 8)) {
+    return kFailure;
+  }
+  Object value = I->Stack(0);
+  double raw_value;
+  FLOAT_VALUE(raw_value, value);
+  SetTypedElement<double>(array, index, raw_value);
+  RETURN(value);
 }
 
 
-DEFINE_PRIMITIVE(Activation_bciPut) {
+DEFINE_PRIMITIVE(ByteArray_int32At) {
   ASSERT(num_args == 1);
-  Activation activation = static_cast<Activation>(I->Stack(1));
-  ASSERT(activation->IsActivation());
-  SmallInteger new_bci = static_cast<SmallInteger>(I->Stack(0));
-  if (!new_bci->IsSmallInteger() && (new_bci != nil)) {
+  ByteArray array = static_cast<ByteArray>(I->Stack(1));
+  ASSERT(array->IsByteArray());
+  SMI_ARGUMENT(index, 0);
+  index--;
+  if ((index < 0) || (index >= array->Size() / 4)) {
     return kFailure;
   }
-  I->ActivationBCIPut(activation, new_bci);  // SAFEPOINT
-  RETURN_SELF();
+  int64_t raw_result = TypedElement<int32_t>(array, index);
+  RETURN_MINT(raw_result);
 }
 
 
-DEFINE_PRIMITIVE(Activation_method) {
-  ASSERT(num_args == 0);
-  Activation activation = static_cast<Activation>(I->Stack(0));
-  ASSERT(activation->IsActivation());
-  // No frame state to sync.
-  RETURN(activation->method());
+DEFINE_PRIMITIVE(ByteArray_int32AtPut) {
+  ASSERT(num_args == 2);
+  ByteArray array = static_cast<ByteArray>(I->Stack(2));
+  ASSERT(array->IsByteArray());
+  SMI_ARGUMENT(index, 1);
+  index--;
+  if ((index < 0) || (index >= array->Size() / 4)) {
+    return kFailure;
+  }
+  MINT_ARGUMENT(value, 0);
+  if ((value < kMinInt32) || (value > kMaxInt32)) {
+    return kFailure;
+  }
+  SetTypedElement<int32_t>(array, index, static_cast<int32_t>(value));
+  RETURN(I->Stack(0));
 }
 
 
-DEFINE_PRIMITIVE(Activation_methodPut) {
+DEFINE_PRIMITIVE(ByteArray_int64At) {
   ASSERT(num_args == 1);
-  Activation activation = static_cast<Activation>(I->Stack(1));
-  ASSERT(activation->IsActivation());
-  Method new_method = static_cast<Method>(I->Stack(0));
-  I->ActivationMethodPut(activation, new_method);  // SAFEPOINT
-  RETURN_SELF();
+  ByteArray array = static_cast<ByteArray>(I->Stack(1));
+  ASSERT(array->IsByteArray());
+  SMI_ARGUMENT(index, 0);
+  index--;
+  if ((index < 0) || (index >= array->Size() / 8)) {
+    return kFailure;
+  }
+  int64_t raw_result = TypedElement<int64_t>(array, index);
+  RETURN_MINT(raw_result);
 }
 
 
-DEFINE_PRIMITIVE(Activation_closure) {
-  ASSERT(num_args == 0);
-  Activation activation = static_cast<Activation>(I->Stack(0));
-  ASSERT(activation->IsActivation());
-  // No frame state to sync.
-  RETURN(activation->closure());
+DEFINE_PRIMITIVE(ByteArray_int64AtPut) {
+  ASSERT(num_args == 2);
+  ByteArray array = static_cast<ByteArray>(I->Stack(2));
+  ASSERT(array->IsByteArray());
+  SMI_ARGUMENT(index, 1);
+  index--;
+  if ((index < 0) || (index >= array->Size() / 8)) {
+    return kFailure;
+  }
+  MINT_ARGUMENT(value, 0);
+  SetTypedElement<int64_t>(array, index, value);
+  RETURN(I->Stack(0));
 }
 
 
-DEFINE_PRIMITIVE(Activation_closurePut) {
+DEFINE_PRIMITIVE(ByteArray_addFloat64s) {
   ASSERT(num_args == 1);
-  Activation activation = static_cast<Activation>(I->Stack(1));
-  ASSERT(activation->IsActivation());
-  Closure new_closure = static_cast<Closure>(I->Stack(0));
-  if (!new_closure->IsClosure() && (new_closure != nil)) {
+  ByteArray array = static_cast<ByteArray>(I->Stack(1));
+  ASSERT(array->IsByteArray());
+  ByteArray other = static_cast<ByteArray>(I->Stack(0));
+  if (!other->IsByteArray() || (other->Size() != array->Size())) {
     return kFailure;
   }
-  I->ActivationClosurePut(activation, new_closure);  // SAFEPOINT
+  intptr_t length = array->Size() / 8;
+  for (intptr_t i = 0; i < length; i++) {
+    SetTypedElement<double>(array, i, TypedElement<double>(array, i) +
+                                      TypedElement<double>(other, i));
+  }
   RETURN_SELF();
 }
 
 
-DEFINE_PRIMITIVE(Activation_receiver) {
-  ASSERT(num_args == 0);
-  Activation activation = static_cast<Activation>(I->Stack(0));
-  ASSERT(activation->IsActivation());
-  // No frame state to sync.
-  RETURN(activation->receiver());
-}
-
-
-DEFINE_PRIMITIVE(Activation_receiverPut) {
+DEFINE_PRIMITIVE(ByteArray_scaleFloat64s) {
   ASSERT(num_args == 1);
-  Activation activation = static_cast<Activation>(I->Stack(1));
-  ASSERT(activation->IsActivation());
-  Object new_receiver = I->Stack(0);
-  I->ActivationReceiverPut(activation, new_receiver);  // SAFEPOINT
+  ByteArray array = static_cast<ByteArray>(I->Stack(1));
+  ASSERT(array->IsByteArray());
+  Object factor = I->Stack(0);
+  double raw_factor;
+  FLOAT_VALUE(raw_factor, factor);
+  intptr_t length = array->Size() / 8;
+  for (intptr_t i = 0; i < length; i++) {
+    SetTypedElement<double>(array, i,
+                            TypedElement<double>(array, i) * raw_factor);
+  }
   RETURN_SELF();
 }
 
 
-DEFINE_PRIMITIVE(Activation_tempAt) {
+DEFINE_PRIMITIVE(ByteArray_dotFloat64s) {
   ASSERT(num_args == 1);
-  Activation activation = static_cast<Activation>(I->Stack(1));
-  ASSERT(activation->IsActivation());
-  SMI_ARGUMENT(index, 0);
-  index--;
-  if ((index < 0) || (index >= I->ActivationTempSize(activation))) {
+  ByteArray array = static_cast<ByteArray>(I->Stack(1));
+  ASSERT(array->IsByteArray());
+  ByteArray other = static_cast<ByteArray>(I->Stack(0));
+  if (!other->IsByteArray() || (other->Size() != array->Size())) {
     return kFailure;
   }
-  RETURN(I->ActivationTempAt(activation, index));
-}
-
-
-DEFINE_PRIMITIVE(Activation_tempAtPut) {
-  ASSERT(num_args == 2);
-  Activation activation = static_cast<Activation>(I->Stack(2));
-  ASSERT(activation->IsActivation());
-  SMI_ARGUMENT(index, 1);
-  Object value = I->Stack(0);
-  index--;
-  if ((index < 0) || (index >= I->ActivationTempSize(activation))) {
-    return kFailure;
+  // Four partial sums, so the additions need not wait on each other.
+  intptr_t length = array->Size() / 8;
+  double sums[4] = {0.0, 0.0, 0.0, 0.0};
+  intptr_t i = 0;
+  for (; i + 4 <= length; i += 4) {
+    for (intptr_t j = 0; j < 4; j++) {
+      sums[j] += TypedElement<double>(array, i + j) *
+                 TypedElement<double>(other, i + j);
+    }
   }
-  I->ActivationTempAtPut(activation, index, value);  // SAFEPOINT
-  value = I->Stack(0);
-  RETURN(value);
+  for (; i < length; i++) {
+    sums[0] += TypedElement<double>(array, i) * TypedElement<double>(other, i);
+  }
+  double raw_result = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+  RETURN_FLOAT(raw_result);
 }
 
 
-DEFINE_PRIMITIVE(Activation_tempSize) {
+DEFINE_PRIMITIVE(ByteArray_sumFloat64s) {
   ASSERT(num_args == 0);
-  Activation activation = static_cast<Activation>(I->Stack(0));
-  ASSERT(activation->IsActivation());
-  RETURN_SMI(I->ActivationTempSize(activation));
+  ByteArray array = static_cast<ByteArray>(I->Stack(0));
+  ASSERT(array->IsByteArray());
+  intptr_t length = array->Size() / 8;
+  double sums[4] = {0.0, 0.0, 0.0, 0.0};
+  intptr_t i = 0;
+  for (; i + 4 <= length; i += 4) {
+    for (intptr_t j = 0; j < 4; j++) {
+      sums[j] += TypedElement<double>(array, i + j);
+    }
+  }
+  for (; i < length; i++) {
+    sums[0] += TypedElement<double>(array, i);
+  }
+  double raw_result = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+  RETURN_FLOAT(raw_result);
 }
 
 
-DEFINE_PRIMITIVE(Activation_tempSizePut) {
-  ASSERT(num_args == 1);
-  Activation activation = static_cast<Activation>(I->Stack(1));
-  ASSERT(activation->IsActivation());
-  SMI_ARGUMENT(new_size, 0);
-  if ((new_size < 0) || (new_size > kMaxTemps)) {
+DEFINE_PRIMITIVE(ByteArray_minFloat64s) {
+  ASSERT(num_args == 0);
+  ByteArray array = static_cast<ByteArray>(I->Stack(0));
+  ASSERT(array->IsByteArray());
+  intptr_t length = array->Size() / 8;
+  if (length == 0) {
     return kFailure;
   }
-  I->ActivationTempSizePut(activation, new_size);  // SAFEPOINT
-  RETURN_SMI(new_size);
+  double raw_result = TypedElement<double>(array, 0);
+  for (intptr_t i = 1; i < length; i++) {
+    double element = TypedElement<double>(array, i);
+    raw_result = element < raw_result ? element : raw_result;
+  }
+  RETURN_FLOAT(raw_result);
 }
 
 
-DEFINE_PRIMITIVE(Activation_class_new) {
+DEFINE_PRIMITIVE(ByteArray_maxFloat64s) {
   ASSERT(num_args == 0);
-  Activation result = H->AllocateActivation();  // SAFEPOINT
-  result->set_sender(static_cast<Activation>(nil), kNoBarrier);
-  result->set_bci(static_cast<SmallInteger>(nil));
-  result->set_method(static_cast<Method>(nil), kNoBarrier);
-  result->set_closure(static_cast<Closure>(nil), kNoBarrier);
-  result->set_receiver(nil, kNoBarrier);
-  result->set_stack_depth(SmallInteger::New(0));
-  RETURN(result);
+  ByteArray array = static_cast<ByteArray>(I->Stack(0));
+  ASSERT(array->IsByteArray());
+  intptr_t length = array->Size() / 8;
+  if (length == 0) {
+    return kFailure;
+  }
+  double raw_result = TypedElement<double>(array, 0);
+  for (intptr_t i = 1; i < length; i++) {
+    double element = TypedElement<double>(array, i);
+    raw_result = element > raw_result ? element : raw_result;
+  }
+  RETURN_FLOAT(raw_result);
 }
 
 
-DEFINE_PRIMITIVE(Closure_class_new) {
+DEFINE_PRIMITIVE(Array_replaceFromToWithStartingAt) {
   ASSERT(num_args == 4);
-  Activation defining_activation = static_cast<Activation>(I->Stack(3));
-  SmallInteger initial_bci = static_cast<SmallInteger>(I->Stack(2));
-  SmallInteger closure_num_args = static_cast<SmallInteger>(I->Stack(1));
-  SmallInteger num_copied = static_cast<SmallInteger>(I->Stack(0));
-  if (!defining_activation->IsActivation()) {
-    return kFailure;
+  Array receiver = static_cast<Array>(I->Stack(4));
+  if (!receiver->IsArray()) {
+    UNREACHABLE();
   }
-  if (!initial_bci->IsSmallInteger()) {
+  SMI_ARGUMENT(start, 3);
+  SMI_ARGUMENT(stop, 2);
+  Array replacement = static_cast<Array>(I->Stack(1));
+  if (!replacement->IsArray()) {
     return kFailure;
   }
-  if (!closure_num_args->IsSmallInteger()) {
+  SMI_ARGUMENT(replacementStart, 0);
+
+  if (start <= 0) {
     return kFailure;
   }
-  if (!num_copied->IsSmallInteger()) {
-    return kFailure;
+  if (stop < start) {
+    // Empty copy.
+    RETURN_SELF();
   }
-  if (num_copied->value() < 0) {
+  if (stop > receiver->Size()) {
     return kFailure;
   }
 
-  Closure result = H->AllocateClosure(num_copied->value());  // SAFEPOINT
-  defining_activation = static_cast<Activation>(I->Stack(3));
-  initial_bci = static_cast<SmallInteger>(I->Stack(2));
-  closure_num_args = static_cast<SmallInteger>(I->Stack(1));
-  num_copied = static_cast<SmallInteger>(I->Stack(0));
-
-  result->set_defining_activation(defining_activation);
-  result->set_initial_bci(initial_bci);
-  result->set_num_args(closure_num_args);
-  for (intptr_t i = 0; i < num_copied->value(); i++) {
-    result->set_copied(i, nil, kNoBarrier);
-  }
-
-  RETURN(result);
-}
-
+  intptr_t count = stop - start + 1;
 
-DEFINE_PRIMITIVE(Closure_numCopied) {
-  ASSERT(num_args == 1);
-  Closure subject = static_cast<Closure>(I->Stack(0));
-  if (!subject->IsClosure()) {
-    UNIMPLEMENTED();
+  if (replacementStart <= 0) {
+    return kFailure;
   }
-  RETURN_SMI(subject->NumCopied());
-}
-
-
-DEFINE_PRIMITIVE(Closure_definingActivation) {
-  ASSERT(num_args == 0 || num_args == 1);
-  Closure subject = static_cast<Closure>(I->Stack(0));
-  if (!subject->IsClosure()) {
-    UNIMPLEMENTED();
+  if (replacementStart + count - 1 > replacement->Size()) {
+    return kFailure;
   }
-  RETURN(subject->defining_activation());
-}
 
+  // Note replacement may be receiver.
+  receiver->CopyElements(start - 1, replacement, replacementStart - 1, count);
 
-DEFINE_PRIMITIVE(Closure_definingActivationPut) {
-  UNIMPLEMENTED();
-  return kSuccess;
+  RETURN_SELF();
 }
 
-
-DEFINE_PRIMITIVE(Closure_initialBci) {
-  ASSERT(num_args == 1);
-  Closure subject = static_cast<Closure>(I->Stack(0));
-  if (!subject->IsClosure()) {
-    UNIMPLEMENTED();
+// Orders for Array_sortFromTo, each as sortFrom:to: orders its elements:
+// numbers by <=, and Strings by compare:.
+struct SmallIntegerLessOrEqual {
+  bool operator()(Object a, Object b) const {
+    return static_cast<SmallInteger>(a)->value() <=
+           static_cast<SmallInteger>(b)->value();
+  }
+};
+
+struct Float64LessOrEqual {
+  bool operator()(Object a, Object b) const {
+    return static_cast<Float64>(a)->value() <= static_cast<Float64>(b)->value();
+  }
+};
+
+struct StringLessOrEqual {
+  bool operator()(Object a, Object b) const {
+    String left = static_cast<String>(a);
+    String right = static_cast<String>(b);
+    intptr_t left_size = left->Size();
+    intptr_t right_size = right->Size();
+    intptr_t common = left_size < right_size ? left_size : right_size;
+    int order = memcmp(left->element_addr(0), right->element_addr(0), common);
+    return (order < 0) || ((order == 0) && (left_size <= right_size));
+  }
+};
+
+
+// A stable merge sort, so the result is the one the Newspeak merge sort
+// gives for the same order: runs sorted by insertion, then merged back and
+// forth between elements and scratch. Answers where the sorted elements are.
+template <typename LessOrEqual>
+static Object* MergeSort(Object* elements, Object* scratch, intptr_t length,
+                         LessOrEqual less_or_equal) {
+  const intptr_t kRun = 16;
+  for (intptr_t run = 0; run < length; run += kRun) {
+    intptr_t end = run + kRun < length ? run + kRun : length;
+    for (intptr_t i = run + 1; i < end; i++) {
+      Object element = elements[i];
+      intptr_t j = i;
+      while ((j > run) && !less_or_equal(elements[j - 1], element)) {
+        elements[j] = elements[j - 1];
+        j--;
+      }
+      elements[j] = element;
+    }
   }
-  RETURN(subject->initial_bci());
+  Object* from = elements;
+  Object* to = scratch;
+  for (intptr_t width = kRun; width < length; width *= 2) {
+    for (intptr_t left = 0; left < length; left += 2 * width) {
+      intptr_t mid = left + width < length ? left + width : length;
+      intptr_t right = mid + width < length ? mid + width : length;
+      intptr_t i = left, j = mid, k = left;
+      while ((i < mid) && (j < right)) {
+        if (less_or_equal(from[i], from[j])) {
+          to[k++] = from[i++];
+        } else {
+          to[k++] = from[j++];
+        }
+      }
+      while (i < mid) to[k++] = from[i++];
+      while (j < right) to[k++] = from[j++];
+    }
+    Object* sorted = to;
+    to = from;
+    from = sorted;
+  }
+  return from;
 }
 
 
-DEFINE_PRIMITIVE(Closure_initialBciPut) { UNIMPLEMENTED(); return kSuccess; }
-
-
-DEFINE_PRIMITIVE(Closure_numArgs) {
-  ASSERT(num_args == 0);
-  Closure rcvr = static_cast<Closure>(I->Stack(0));
-  if (!rcvr->IsClosure()) {
+// Sorts a range ascending when all of it is SmallIntegers, Float64s other
+// than NaN, or Strings (by their bytes, as compare:). Otherwise fails, and
+// sortFrom:to: sorts the range in Newspeak in the same order.
+DEFINE_PRIMITIVE(Array_sortFromTo) {
+  ASSERT(num_args == 2);
+  Array array = static_cast<Array>(I->Stack(2));
+  if (!array->IsArray()) {
     UNREACHABLE();
+  }
+  SMI_ARGUMENT(start, 1);
+  SMI_ARGUMENT(stop, 0);
+  if ((start <= 0) || (stop > array->Size())) {
     return kFailure;
   }
-  RETURN(rcvr->num_args());
-}
-
-
-DEFINE_PRIMITIVE(Closure_numArgsPut) { UNIMPLEMENTED(); return kSuccess; }
-
+  intptr_t length = stop - start + 1;
+  if (length <= 1) {
+    RETURN_SELF();
+  }
 
-DEFINE_PRIMITIVE(Closure_copiedAt) {
-  ASSERT(num_args == 2);
-  Closure receiver = static_cast<Closure>(I->Stack(1));
-  SmallInteger index = static_cast<SmallInteger>(I->Stack(0));
-  if (!receiver->IsClosure()) {
+  intptr_t cid = array->element(start - 1)->ClassId();
+  if ((cid != kSmiCid) && (cid != kFloat64Cid) && (cid != kStringCid)) {
     return kFailure;
   }
-  if (!index->IsSmallInteger()) {
-    return kFailure;
+  for (intptr_t i = 0; i < length; i++) {
+    Object element = array->element(start - 1 + i);
+    if (element->ClassId() != cid) {
+      return kFailure;
+    }
+    if ((cid == kFloat64Cid) &&
+        isnan(static_cast<Float64>(element)->value())) {
+      return kFailure;
+    }
   }
-  if (index->value() <= 0) {
-    return kFailure;
+
+  Object* elements = new Object[2 * length];
+  for (intptr_t i = 0; i < length; i++) {
+    elements[i] = array->element(start - 1 + i);
+  }
+  Object* sorted;
+  if (cid == kSmiCid) {
+    sorted = MergeSort(elements, elements + length, length,
+                       SmallIntegerLessOrEqual());
+  } else if (cid == kFloat64Cid) {
+    sorted = MergeSort(elements, elements + length, length,
+                       Float64LessOrEqual());
+  } else {
+    sorted = MergeSort(elements, elements + length, length,
+                       StringLessOrEqual());
   }
-  if (index->value() > receiver->NumCopied()) {
-    return kFailure;
+  // With the barrier, as the array may be old and carded, or being marked.
+  for (intptr_t i = 0; i < length; i++) {
+    array->set_element(start - 1 + i, sorted[i]);
   }
-  Object value = receiver->copied(index->value() - 1);
-  RETURN(value);
+  delete[] elements;
+  RETURN_SELF();
 }
 
 
-DEFINE_PRIMITIVE(Closure_copiedAtPut) {
+DEFINE_PRIMITIVE(Array_fill) {
   ASSERT(num_args == 3);
-  Closure receiver = static_cast<Closure>(I->Stack(2));
-  SmallInteger index = static_cast<SmallInteger>(I->Stack(1));
-  Object value = I->Stack(0);
-  if (!receiver->IsClosure()) {
-    return kFailure;
+  Array receiver = static_cast<Array>(I->Stack(3));
+  if (!receiver->IsArray()) {
+    UNREACHABLE();
   }
-  if (!index->IsSmallInteger()) {
+  SMI_ARGUMENT(start, 2);
+  SMI_ARGUMENT(stop, 1);
+  Object value = I->Stack(0);
+  if (start <= 0) {
     return kFailure;
   }
-  if (index->value() <= 0) {
-    return kFailure;
+  if (stop < start) {
+    RETURN_SELF();
   }
-  if (index->value() > receiver->NumCopied()) {
+  if (stop > receiver->Size()) {
     return kFailure;
   }
-  receiver->set_copied(index->value() - 1, value);
-  RETURN(value);
+  receiver->FillElements(start - 1, value, stop - start + 1);
+  RETURN_SELF();
 }
 
 
-DEFINE_PRIMITIVE(Object_class) {
-  ASSERT((num_args == 0) || (num_args == 1));
-  Object subject = I->Stack(0);
-  RETURN(subject->Klass(H));
-}
-
-
-DEFINE_PRIMITIVE(Object_identical) {
-  ASSERT(num_args == 1 || num_args == 2);
-  Object left = I->Stack(1);
-  Object right = I->Stack(0);
-  RETURN_BOOL(left == right);
-}
-
-
-DEFINE_PRIMITIVE(Object_identityHash) {
-  ASSERT(num_args == 0 || num_args == 1);
-  Object receiver = I->Stack(0);
-  intptr_t hash;
-  if (receiver->IsSmallInteger()) {
-    hash = static_cast<SmallInteger>(receiver)->value();
-    if (hash == 0) {
-      hash = 1;
-    }
-  } else if (receiver->IsMediumInteger()) {
-    hash = static_cast<MediumInteger>(receiver)->value();
-    hash &= SmallInteger::kMaxValue;
-    if (hash == 0) {
-      hash = 1;
-    }
-  } else if (receiver->IsString()) {
-    static_cast<String>(receiver)->EnsureHash(I->isolate());
-    hash = static_cast<String>(receiver)->header_hash();
-  } else {
-    hash = static_cast<HeapObject>(receiver)->header_hash();
-    if (hash == 0) {
-      hash = I->isolate()->random().NextUInt64() & SmallInteger::kMaxValue;
-      if (hash == 0) {
-        hash = 1;
-      }
-      static_cast<HeapObject>(receiver)->set_header_hash(hash);
+DEFINE_PRIMITIVE(Array_indexOfIdentical) {
+  ASSERT(num_args == 2);
+  Array receiver = static_cast<Array>(I->Stack(2));
+  if (!receiver->IsArray()) {
+    UNREACHABLE();
+  }
+  Object element = I->Stack(1);
+  SMI_ARGUMENT(start, 0);
+  if (start <= 0) {
+    return kFailure;
+  }
+  intptr_t size = receiver->Size();
+  for (intptr_t i = start - 1; i < size; i++) {
+    if (receiver->element(i) == element) {
+      RETURN_SMI(i + 1);
     }
   }
-  RETURN_SMI(hash);
+  RETURN_SMI(0);
 }
 
 
-DEFINE_PRIMITIVE(Object_performWithAll) {
-  ASSERT(num_args == 3);
-
-  Object receiver = I->Stack(2);
-  String selector = static_cast<String>(I->Stack(1));
-  Array arguments = static_cast<Array>(I->Stack(0));
-
-  if (!selector->IsString() ||
-      !selector->is_canonical() ||
-      !arguments->IsArray()) {
-    UNIMPLEMENTED();
-    return kFailure;
-  }
+DEFINE_PRIMITIVE(Array_copyFromTo) {
+  ASSERT(num_args == 2);
 
-  I->Drop(num_args + 1);
+  if (!I->Stack(1)->IsSmallInteger()) return kFailure;
+  intptr_t start = static_cast<SmallInteger>(I->Stack(1))->value();
 
-  intptr_t perform_args = arguments->Size();
-  I->Push(receiver);
-  for (intptr_t i = 0; i < perform_args; i++) {
-    I->Push(arguments->element(i));
-  }
+  if (!I->Stack(0)->IsSmallInteger()) return kFailure;
+  intptr_t stop = static_cast<SmallInteger>(I->Stack(0))->value();
 
-  I->Perform(selector, perform_args);
-  return kSuccess;
-}
+  if (!I->Stack(2)->IsArray()) return kFailure;
 
+  Array array = static_cast<Array>(I->Stack(2));
+  if ((start <= 0) || (stop > array->Size())) return kFailure;
 
-DEFINE_PRIMITIVE(Closure_value0) {
-  ASSERT(num_args == 0);
-  Closure closure = static_cast<Closure>(I->Stack(num_args));
-  ASSERT(closure->IsClosure());
-  if (closure->num_args() != SmallInteger::New(0)) {
+  intptr_t subsize = stop - (start - 1);
+  if (subsize < 0) {
     return kFailure;
   }
 
-  I->ActivateClosure(0);
-  return kSuccess;
+  Array result = H->AllocateArray(subsize);  // SAFEPOINT
+  array = static_cast<Array>(I->Stack(2));
+  result->CopyElements(0, array, start - 1, subsize);
+  RETURN(result);
 }
 
-
-DEFINE_PRIMITIVE(Closure_value1) {
+DEFINE_PRIMITIVE(String_at) {
   ASSERT(num_args == 1);
-  Closure closure = static_cast<Closure>(I->Stack(num_args));
-  ASSERT(closure->IsClosure());
-  if (closure->num_args() != SmallInteger::New(1)) {
+  String string = static_cast<String>(I->Stack(1));
+  ASSERT(string->IsString());
+  SMI_ARGUMENT(index, 0);
+  index--;
+  if ((index < 0) || (index >= string->Size())) {
     return kFailure;
   }
+  uint8_t value = string->element(index);
+  RETURN(SmallInteger::New(value));
+}
 
-  I->ActivateClosure(1);
-  return kSuccess;
+
+DEFINE_PRIMITIVE(String_size) {
+  ASSERT(num_args == 0);
+  String string = static_cast<String>(I->Stack(0));
+  ASSERT(string->IsString());
+  RETURN(string->size());
 }
 
 
-DEFINE_PRIMITIVE(Closure_value2) {
-  ASSERT(num_args == 2);
-  Closure closure = static_cast<Closure>(I->Stack(num_args));
-  ASSERT(closure->IsClosure());
-  if (closure->num_args() != SmallInteger::New(2)) {
-    return kFailure;
-  }
+DEFINE_PRIMITIVE(String_hash) {
+  ASSERT(num_args == 0);
+  String string = static_cast<String>(I->Stack(0));
+  ASSERT(string->IsString());
+  SmallInteger hash = string->EnsureHash(I->isolate());
+  RETURN(hash);
+}
 
-  I->ActivateClosure(2);
-  return kSuccess;
+
+DEFINE_PRIMITIVE(Activation_sender) {
+  ASSERT(num_args == 0);
+  Activation activation = static_cast<Activation>(I->Stack(0));
+  ASSERT(activation->IsActivation());
+  RETURN(I->ActivationSender(activation));  // SAFEPOINT
 }
 
 
-DEFINE_PRIMITIVE(Closure_value3) {
-  ASSERT(num_args == 3);
-  Closure closure = static_cast<Closure>(I->Stack(num_args));
-  ASSERT(closure->IsClosure());
-  if (closure->num_args() != SmallInteger::New(3)) {
+DEFINE_PRIMITIVE(Activation_senderPut) {
+  ASSERT(num_args == 1);
+  Activation activation = static_cast<Activation>(I->Stack(1));
+  ASSERT(activation->IsActivation());
+  Activation new_sender = static_cast<Activation>(I->Stack(0));
+  if (!new_sender->IsActivation() && (new_sender != nil)) {
     return kFailure;
   }
+  I->ActivationSenderPut(activation, new_sender);  // SAFEPOINT
+  RETURN_SELF();
+}
 
-  I->ActivateClosure(3);
-  return kSuccess;
+
+DEFINE_PRIMITIVE(Activation_unwindSender) {
+  ASSERT(num_args == 1);
+  Activation activation = static_cast<Activation>(I->Stack(1));
+  ASSERT(activation->IsActivation());
+  Activation limit = static_cast<Activation>(I->Stack(0));
+  RETURN(I->ActivationMarkedSender(activation, limit,
+                                   Primitives::IsUnwindProtect));  // SAFEPOINT
 }
 
 
-DEFINE_PRIMITIVE(Closure_valueArray) {
+DEFINE_PRIMITIVE(Activation_terminateTo) {
   ASSERT(num_args == 1);
-  Closure closure = static_cast<Closure>(I->Stack(1));
-  ASSERT(closure->IsClosure());
-  Array args = static_cast<Array>(I->Stack(0));
-  if (!args->IsArray() || args->size() != closure->num_args()) {
+  Activation activation = static_cast<Activation>(I->Stack(1));
+  ASSERT(activation->IsActivation());
+  Activation previous = static_cast<Activation>(I->Stack(0));
+  if (!previous->IsActivation() && (previous != nil)) {
     return kFailure;
   }
+  I->ActivationTerminateTo(activation, previous);  // SAFEPOINT
+  RETURN_SELF();
+}
 
-  I->Pop();
-  intptr_t closure_args = args->Size();
-  for (intptr_t i = 0; i < closure_args; i++) {
-    I->Push(args->element(i));
-  }
 
-  I->ActivateClosure(closure_args);
-  return kSuccess;
+static bool IsHandlerOrSimulationRoot(intptr_t prim) {
+  return Primitives::IsExceptionHandler(prim) ||
+         Primitives::IsSimulationRoot(prim);
 }
 
 
-DEFINE_PRIMITIVE(Activation_jump) {
+DEFINE_PRIMITIVE(Activation_handlerSender) {
   ASSERT(num_args == 1);
-  Activation target = static_cast<Activation>(I->Stack(0));
-  if (!target->IsActivation() ||
-      !target->bci()->IsSmallInteger()) {
+  Activation activation = static_cast<Activation>(I->Stack(0));
+  if (!activation->IsActivation()) {
     return kFailure;
   }
+  RETURN(I->ActivationMarkedSender(activation,
+                                   static_cast<Activation>(nil),
+                                   IsHandlerOrSimulationRoot));  // SAFEPOINT
+}
 
-  I->Drop(num_args + 1);
-  I->SetCurrentActivation(target);  // SAFEPOINT
-  return kSuccess;
+
+DEFINE_PRIMITIVE(Activation_bci) {
+  ASSERT(num_args == 0);
+  Activation activation = static_cast<Activation>(I->Stack(0));
+  ASSERT(activation->IsActivation());
+  RETURN(I->ActivationBCI(activation));
 }
 
 
-DEFINE_PRIMITIVE(Behavior_allInstances) {
+DEFINE_PRIMITIVE(Activation_bciPut) {
   ASSERT(num_args == 1);
-  Behavior cls = static_cast<Behavior>(I->Stack(0));
-  if (!cls->IsRegularObject()) {
-    UNREACHABLE();
-  }
-  if (cls->id() == nil) {
-    // Class not yet registered: no instance has been allocated.
-    Array result = H->AllocateArray(0);  // SAFEPOINT
-    RETURN(result);
-  }
-
-  ASSERT(cls->id()->IsSmallInteger());
-  intptr_t cid = cls->id()->value();
-  if (cid == kIllegalCid) {
-    UNREACHABLE();
-  }
-  intptr_t num_instances = H->CountInstances(cid);
-  if (cid == kArrayCid) {
-    num_instances++;
+  Activation activation = static_cast<Activation>(I->Stack(1));
+  ASSERT(activation->IsActivation());
+  SmallInteger new_bci = static_cast<SmallInteger>(I->Stack(0));
+  if (!new_bci->IsSmallInteger() && (new_bci != nil)) {
+    return kFailure;
   }
-  Array result = H->AllocateArray(num_instances);  // SAFEPOINT
-  result->set_size(SmallInteger::New(num_instances));
-  intptr_t num_instances2 = H->CollectInstances(cid, result);
-
-  ASSERT(num_instances == num_instances2);
-  // Note that if a GC happens there may be fewer instances than
-  // we initially counted. TODO(rmacnak): truncate result.
-  // OS::PrintErr("Found %" Pd " instances of %" Pd "\n", num_instances, cid);
-
-  RETURN(result);
+  I->ActivationBCIPut(activation, new_bci);  // SAFEPOINT
+  RETURN_SELF();
 }
 
 
-DEFINE_PRIMITIVE(Array_elementsForwardIdentity) {
-  ASSERT(num_args == 2);
-  Array left = static_cast<Array>(I->Stack(1));
-  Array right = static_cast<Array>(I->Stack(0));
-  if (left->IsArray() && right->IsArray()) {
-    if (H->BecomeForward(left, right)) {
-      RETURN_SELF();
-    }
-  }
-  return kFailure;
+DEFINE_PRIMITIVE(Activation_method) {
+  ASSERT(num_args == 0);
+  Activation activation = static_cast<Activation>(I->Stack(0));
+  ASSERT(activation->IsActivation());
+  // No frame state to sync.
+  RETURN(activation->method());
 }
 
 
-DEFINE_PRIMITIVE(Platform_operatingSystem) {
-  const char* name = OS::Name();
-  intptr_t length = strlen(name);
-  String result = H->AllocateString(length);  // SAFEPOINT
-  memcpy(result->element_addr(0), name, length);
-  RETURN(result);
+DEFINE_PRIMITIVE(Activation_methodPut) {
+  ASSERT(num_args == 1);
+  Activation activation = static_cast<Activation>(I->Stack(1));
+  ASSERT(activation->IsActivation());
+  Method new_method = static_cast<Method>(I->Stack(0));
+  I->ActivationMethodPut(activation, new_method);  // SAFEPOINT
+  RETURN_SELF();
 }
 
 
-DEFINE_PRIMITIVE(Time_monotonicNanos) {
+DEFINE_PRIMITIVE(Activation_closure) {
   ASSERT(num_args == 0);
-  int64_t now = OS::CurrentMonotonicNanos();
-  RETURN_MINT(now);
+  Activation activation = static_cast<Activation>(I->Stack(0));
+  ASSERT(activation->IsActivation());
+  // No frame state to sync.
+  RETURN(activation->closure());
 }
 
 
-DEFINE_PRIMITIVE(Time_utcEpochNanos) { UNIMPLEMENTED(); return kSuccess; }
-
-
-DEFINE_PRIMITIVE(print) {
+DEFINE_PRIMITIVE(Activation_closurePut) {
   ASSERT(num_args == 1);
-  ASSERT(I->StackDepth() >= 2);
-
-  Object message = I->Stack(0);
-  if (message->IsString()) {
-    String string = static_cast<String>(message);
-    const char* cstr =
-        reinterpret_cast<const char*>(string->element_addr(0));
-    OS::Print("%.*s\n", static_cast<int>(string->Size()), cstr);
-  } else {
-    char* cstr = message->ToCString(H);
-    OS::Print("[print] %s\n", cstr);
-    free(cstr);
+  Activation activation = static_cast<Activation>(I->Stack(1));
+  ASSERT(activation->IsActivation());
+  Closure new_closure = static_cast<Closure>(I->Stack(0));
+  if (!new_closure->IsClosure() && (new_closure != nil)) {
+    return kFailure;
   }
+  I->ActivationClosurePut(activation, new_closure);  // SAFEPOINT
   RETURN_SELF();
 }
 
 
-DEFINE_PRIMITIVE(halt) {
-  OS::PrintErr("Halt:\n");
-  I->PrintStack();
-  OS::Exit(-1);
-  UNREACHABLE();
-  return kFailure;
-}
-
-
-DEFINE_PRIMITIVE(flushCache) {
-  // Atomicity may require this to be part of an atomic install's become. If so,
-  // remove this separate primitive.
-  UNREACHABLE();
-  return kFailure;
+DEFINE_PRIMITIVE(Activation_receiver) {
+  ASSERT(num_args == 0);
+  Activation activation = static_cast<Activation>(I->Stack(0));
+  ASSERT(activation->IsActivation());
+  // No frame state to sync.
+  RETURN(activation->receiver());
 }
 
 
-DEFINE_PRIMITIVE(collectGarbage) {
-  H->CollectAll(Heap::kPrimitive);  // SAFEPOINT
+DEFINE_PRIMITIVE(Activation_receiverPut) {
+  ASSERT(num_args == 1);
+  Activation activation = static_cast<Activation>(I->Stack(1));
+  ASSERT(activation->IsActivation());
+  Object new_receiver = I->Stack(0);
+  I->ActivationReceiverPut(activation, new_receiver);  // SAFEPOINT
   RETURN_SELF();
 }
 
 
-DEFINE_PRIMITIVE(MessageLoop_exit) {
+DEFINE_PRIMITIVE(Activation_tempAt) {
   ASSERT(num_args == 1);
-  SmallInteger exit_code = static_cast<SmallInteger>(I->Stack(0));
-  if (!exit_code->IsSmallInteger()) {
+  Activation activation = static_cast<Activation>(I->Stack(1));
+  ASSERT(activation->IsActivation());
+  SMI_ARGUMENT(index, 0);
+  index--;
+  if ((index < 0) || (index >= I->ActivationTempSize(activation))) {
     return kFailure;
   }
-  I->isolate()->loop()->Exit(exit_code->value());
-  I->Exit();
-  UNREACHABLE();
-  return kFailure;
+  RETURN(I->ActivationTempAt(activation, index));
 }
 
-DEFINE_PRIMITIVE(Double_asStringFixed) {
-  ASSERT(num_args == 1);
-  FLOAT_ARGUMENT(value, 1);
-  SMI_ARGUMENT(fraction_digits, 0);
-  if (fraction_digits < 0 || fraction_digits > 20) {
+
+DEFINE_PRIMITIVE(Activation_tempAtPut) {
+  ASSERT(num_args == 2);
+  Activation activation = static_cast<Activation>(I->Stack(2));
+  ASSERT(activation->IsActivation());
+  SMI_ARGUMENT(index, 1);
+  Object value = I->Stack(0);
+  index--;
+  if ((index < 0) || (index >= I->ActivationTempSize(activation))) {
     return kFailure;
   }
+  I->ActivationTempAtPut(activation, index, value);  // SAFEPOINT
+  value = I->Stack(0);
+  RETURN(value);
+}
 
-  char buffer[64];
-  intptr_t length;
-  if (value < 1e21 && value > -1e21) {
-    length = DoubleToCStringAsFixed(value, fraction_digits,
-                                    buffer, sizeof(buffer));
-  } else {
-    length = DoubleToCStringAsShortest(value, buffer, sizeof(buffer));
-  }
-  ASSERT(length < 64);
 
-  String result = H->AllocateString(length);  // SAFEPOINT
-  memcpy(result->element_addr(0), buffer, length);
-  RETURN(result);
+DEFINE_PRIMITIVE(Activation_tempSize) {
+  ASSERT(num_args == 0);
+  Activation activation = static_cast<Activation>(I->Stack(0));
+  ASSERT(activation->IsActivation());
+  RETURN_SMI(I->ActivationTempSize(activation));
 }
 
-DEFINE_PRIMITIVE(Double_asStringExponential) {
+
+DEFINE_PRIMITIVE(Activation_tempSizePut) {
   ASSERT(num_args == 1);
-  FLOAT_ARGUMENT(value, 1);
-  SMI_ARGUMENT(fraction_digits, 0);
-  if (fraction_digits < 0 || fraction_digits > 20) {
+  Activation activation = static_cast<Activation>(I->Stack(1));
+  ASSERT(activation->IsActivation());
+  SMI_ARGUMENT(new_size, 0);
+  if ((new_size < 0) || (new_size > kMaxTemps)) {
     return kFailure;
   }
+  I->ActivationTempSizePut(activation, new_size);  // SAFEPOINT
+  RETURN_SMI(new_size);
+}
 
-  char buffer[64];
-  intptr_t length = DoubleToCStringAsExponential(value, fraction_digits,
-                                                 buffer, sizeof(buffer));
-  ASSERT(length < 64);
 
-  String result = H->AllocateString(length);  // SAFEPOINT
-  memcpy(result->element_addr(0), buffer, length);
+DEFINE_PRIMITIVE(Activation_class_new) {
+  ASSERT(num_args == 0);
+  Activation result = H->AllocateActivation();  // SAFEPOINT
+  result->set_sender(static_cast<Activation>(nil), kNoBarrier);
+  result->set_bci(static_cast<SmallInteger>(nil));
+  result->set_method(static_cast<Method>(nil), kNoBarrier);
+  result->set_closure(static_cast<Closure>(nil), kNoBarrier);
+  result->set_receiver(nil, kNoBarrier);
+  result->set_stack_depth(SmallInteger::New(0));
   RETURN(result);
 }
 
-DEFINE_PRIMITIVE(Double_asStringPrecision) {
-  ASSERT(num_args == 1);
-  FLOAT_ARGUMENT(value, 1);
-  SMI_ARGUMENT(precision, 0);
-  if (precision < 1 || precision > 21) {
+
+DEFINE_PRIMITIVE(Closure_class_new) {
+  ASSERT(num_args == 4);
+  Activation defining_activation = static_cast<Activation>(I->Stack(3));
+  SmallInteger initial_bci = static_cast<SmallInteger>(I->Stack(2));
+  SmallInteger closure_num_args = static_cast<SmallInteger>(I->Stack(1));
+  SmallInteger num_copied = static_cast<SmallInteger>(I->Stack(0));
+  if (!defining_activation->IsActivation()) {
+    return kFailure;
+  }
+  if (!initial_bci->IsSmallInteger()) {
+    return kFailure;
+  }
+  if (!closure_num_args->IsSmallInteger()) {
+    return kFailure;
+  }
+  if (!num_copied->IsSmallInteger()) {
+    return kFailure;
+  }
+  if (num_copied->value() < 0) {
     return kFailure;
   }
 
-  char buffer[64];
-  intptr_t length = DoubleToCStringAsPrecision(value, precision,
-                                               buffer, sizeof(buffer));
-  ASSERT(length < 64);
+  Closure result = H->AllocateClosure(num_copied->value());  // SAFEPOINT
+  defining_activation = static_cast<Activation>(I->Stack(3));
+  initial_bci = static_cast<SmallInteger>(I->Stack(2));
+  closure_num_args = static_cast<SmallInteger>(I->Stack(1));
+  num_copied = static_cast<SmallInteger>(I->Stack(0));
+
+  result->set_defining_activation(defining_activation);
+  result->set_receiver(nil, kNoBarrier);
+  result->set_initial_bci(initial_bci);
+  result->set_num_args(closure_num_args);
+  for (intptr_t i = 0; i < num_copied->value(); i++) {
+    result->set_copied(i, nil, kNoBarrier);
+  }
 
-  String result = H->AllocateString(length);  // SAFEPOINT
-  memcpy(result->element_addr(0), buffer, length);
   RETURN(result);
 }
 
-DEFINE_PRIMITIVE(Number_asString) {
-  ASSERT(num_args == 0);
-  Object receiver = I->Stack(0);
 
-  char buffer[64];
-  intptr_t length = -1;
-  if (receiver->IsSmallInteger()) {
-    intptr_t value = static_cast<SmallInteger>(receiver)->value();
-    length = snprintf(buffer, sizeof(buffer), "%" Pd "", value);
-  } else if (receiver->IsMediumInteger()) {
-    int64_t value = static_cast<MediumInteger>(receiver)->value();
-    length = snprintf(buffer, sizeof(buffer), "%" Pd64 "", value);
-  } else if (receiver->IsFloat64()) {
-    double value = static_cast<Float64>(receiver)->value();
-    length = DoubleToCStringAsShortest(value, buffer, sizeof(buffer));
-  } else if (receiver->IsLargeInteger()) {
-    LargeInteger large = static_cast<LargeInteger>(receiver);
-    String result = LargeInteger::PrintString(large, H);  // SAFEPOINT
-    RETURN(result);
-  } else {
+DEFINE_PRIMITIVE(Closure_numCopied) {
+  ASSERT(num_args == 1);
+  Closure subject = static_cast<Closure>(I->Stack(0));
+  if (!subject->IsClosure()) {
     UNIMPLEMENTED();
   }
-  ASSERT(length < 64);
+  RETURN_SMI(subject->NumCopied());
+}
 
-  String result = H->AllocateString(length);  // SAFEPOINT
-  memcpy(result->element_addr(0), buffer, length);
 
-  RETURN(result);
+DEFINE_PRIMITIVE(Closure_definingActivation) {
+  ASSERT(num_args == 0 || num_args == 1);
+  Closure subject = static_cast<Closure>(I->Stack(0));
+  if (!subject->IsClosure()) {
+    UNIMPLEMENTED();
+  }
+  if (!subject->HasDefiningActivation()) {
+    // Materialize the home as a dead activation and keep it, so the closure
+    // answers the same activation from now on.
+    Activation home = H->AllocateActivation();  // SAFEPOINT
+    subject = static_cast<Closure>(I->Stack(0));
+    home->set_sender(static_cast<Activation>(nil), kNoBarrier);
+    home->set_bci(static_cast<SmallInteger>(nil));
+    home->set_method(subject->home_method());
+    home->set_closure(static_cast<Closure>(nil), kNoBarrier);
+    home->set_receiver(subject->receiver());
+    home->set_stack_depth(SmallInteger::New(0));
+    subject->set_defining_activation(home);
+    subject->set_receiver(nil);
+  }
+  RETURN(subject->defining_activation());
 }
 
 
-DEFINE_PRIMITIVE(Closure_ensure) {
-  // This is a marker primitive checked on non-local return.
-  return kFailure;
+DEFINE_PRIMITIVE(Closure_definingActivationPut) {
+  UNIMPLEMENTED();
+  return kSuccess;
 }
 
 
-DEFINE_PRIMITIVE(String_equals) {
+DEFINE_PRIMITIVE(Closure_initialBci) {
   ASSERT(num_args == 1);
-
-  String left = static_cast<String>(I->Stack(1));
-  String right = static_cast<String>(I->Stack(0));
-  if (left == right) {
-    RETURN_BOOL(true);
-    return kSuccess;
-  }
-  if (!left->IsString() || !right->IsString()) {
-    RETURN_BOOL(false);
-  }
-  if (left->size() != right->size()) {
-    RETURN_BOOL(false);
-  }
-  if (left->EnsureHash(I->isolate()) != right->EnsureHash(I->isolate())) {
-    RETURN_BOOL(false);
-  }
-  intptr_t length = left->Size();
-  for (intptr_t i = 0; i < length; i++) {
-    if (left->element(i) != right->element(i)) {
-      RETURN_BOOL(false);
-    }
+  Closure subject = static_cast<Closure>(I->Stack(0));
+  if (!subject->IsClosure()) {
+    UNIMPLEMENTED();
   }
-  RETURN_BOOL(true);
+  RETURN(subject->initial_bci());
 }
 
 
-DEFINE_PRIMITIVE(String_concat) {
-  ASSERT(num_args == 1);
-  String a = static_cast<String>(I->Stack(1));
-  String b = static_cast<String>(I->Stack(0));
-  if (!a->IsString() || !b->IsString()) {
+DEFINE_PRIMITIVE(Closure_initialBciPut) { UNIMPLEMENTED(); return kSuccess; }
+
+
+DEFINE_PRIMITIVE(Closure_numArgs) {
+  ASSERT(num_args == 0);
+  Closure rcvr = static_cast<Closure>(I->Stack(0));
+  if (!rcvr->IsClosure()) {
+    UNREACHABLE();
     return kFailure;
   }
-  intptr_t a_length = a->Size();
-  intptr_t b_length = b->Size();
-  String result =
-      H->AllocateString(a_length + b_length);  // SAFEPOINT
-  a = static_cast<String>(I->Stack(1));
-  b = static_cast<String>(I->Stack(0));
-  memcpy(result->element_addr(0), a->element_addr(0), a_length);
-  memcpy(result->element_addr(a_length), b->element_addr(0), b_length);
-  RETURN(result);
+  RETURN(rcvr->num_args());
+}
+
+
+DEFINE_PRIMITIVE(Closure_numArgsPut) { UNIMPLEMENTED(); return kSuccess; }
+
+
+DEFINE_PRIMITIVE(Closure_copiedAt) {
+  ASSERT(num_args == 2);
+  Closure receiver = static_cast<Closure>(I->Stack(1));
+  SmallInteger index = static_cast<SmallInteger>(I->Stack(0));
+  if (!receiver->IsClosure()) {
+    return kFailure;
+  }
+  if (!index->IsSmallInteger()) {
+    return kFailure;
+  }
+  if (index->value() <= 0) {
+    return kFailure;
+  }
+  if (index->value() > receiver->NumCopied()) {
+    return kFailure;
+  }
+  Object value = receiver->copied(index->value() - 1);
+  RETURN(value);
+}
+
+
+DEFINE_PRIMITIVE(Closure_copiedAtPut) {
+  ASSERT(num_args == 3);
+  Closure receiver = static_cast<Closure>(I->Stack(2));
+  SmallInteger index = static_cast<SmallInteger>(I->Stack(1));
+  Object value = I->Stack(0);
+  if (!receiver->IsClosure()) {
+    return kFailure;
+  }
+  if (!index->IsSmallInteger()) {
+    return kFailure;
+  }
+  if (index->value() <= 0) {
+    return kFailure;
+  }
+  if (index->value() > receiver->NumCopied()) {
+    return kFailure;
+  }
+  receiver->set_copied(index->value() - 1, value);
+  RETURN(value);
+}
+
+
+DEFINE_PRIMITIVE(Object_class) {
+  ASSERT((num_args == 0) || (num_args == 1));
+  Object subject = I->Stack(0);
+  RETURN(subject->Klass(H));
+}
+
+
+DEFINE_PRIMITIVE(Object_identical) {
+  ASSERT(num_args == 1 || num_args == 2);
+  Object left = I->Stack(1);
+  Object right = I->Stack(0);
+  RETURN_BOOL(left == right);
+}
+
+
+DEFINE_PRIMITIVE(Object_identityHash) {
+  ASSERT(num_args == 0 || num_args == 1);
+  Object receiver = I->Stack(0);
+  intptr_t hash;
+  if (receiver->IsSmallInteger()) {
+    hash = static_cast<SmallInteger>(receiver)->value();
+    if (hash == 0) {
+      hash = 1;
+    }
+  } else if (receiver->IsMediumInteger()) {
+    hash = static_cast<MediumInteger>(receiver)->value();
+    hash &= SmallInteger::kMaxValue;
+    if (hash == 0) {
+      hash = 1;
+    }
+  } else if (receiver->IsString()) {
+    hash = static_cast<String>(receiver)->EnsureHash(I->isolate())->value();
+  } else {
+    hash = H->IdentityHash(static_cast<HeapObject>(receiver));
+    if (hash == 0) {
+      hash = I->isolate()->random().NextUInt64() & HeapObject::kMaxHash;
+      if (hash == 0) {
+        hash = 1;
+      }
+      H->SetIdentityHash(static_cast<HeapObject>(receiver), hash);
+    }
+  }
+  RETURN_SMI(hash);
+}
+
+
+DEFINE_PRIMITIVE(Object_performWithAll) {
+  ASSERT(num_args == 3);
+
+  Object receiver = I->Stack(2);
+  String selector = static_cast<String>(I->Stack(1));
+  Array arguments = static_cast<Array>(I->Stack(0));
+
+  if (!selector->IsString() ||
+      !selector->is_canonical() ||
+      !arguments->IsArray()) {
+    UNIMPLEMENTED();
+    return kFailure;
+  }
+
+  I->Drop(num_args + 1);
+
+  intptr_t perform_args = arguments->Size();
+  I->Push(receiver);
+  for (intptr_t i = 0; i < perform_args; i++) {
+    I->Push(arguments->element(i));
+  }
+
+  I->Perform(selector, perform_args);
+  return kSuccess;
+}
+
+
+DEFINE_PRIMITIVE(Closure_value0) {
+  ASSERT(num_args == 0);
+  Closure closure = static_cast<Closure>(I->Stack(num_args));
+  ASSERT(closure->IsClosure());
+  if (closure->num_args() != SmallInteger::New(0)) {
+    return kFailure;
+  }
+
+  I->ActivateClosure(0);
+  return kSuccess;
+}
+
+
+DEFINE_PRIMITIVE(Closure_value1) {
+  ASSERT(num_args == 1);
+  Closure closure = static_cast<Closure>(I->Stack(num_args));
+  ASSERT(closure->IsClosure());
+  if (closure->num_args() != SmallInteger::New(1)) {
+    return kFailure;
+  }
+
+  I->ActivateClosure(1);
+  return kSuccess;
+}
+
+
+DEFINE_PRIMITIVE(Closure_value2) {
+  ASSERT(num_args == 2);
+  Closure closure = static_cast<Closure>(I->Stack(num_args));
+  ASSERT(closure->IsClosure());
+  if (closure->num_args() != SmallInteger::New(2)) {
+    return kFailure;
+  }
+
+  I->ActivateClosure(2);
+  return kSuccess;
+}
+
+
+DEFINE_PRIMITIVE(Closure_value3) {
+  ASSERT(num_args == 3);
+  Closure closure = static_cast<Closure>(I->Stack(num_args));
+  ASSERT(closure->IsClosure());
+  if (closure->num_args() != SmallInteger::New(3)) {
+    return kFailure;
+  }
+
+  I->ActivateClosure(3);
+  return kSuccess;
+}
+
+
+DEFINE_PRIMITIVE(Closure_valueArray) {
+  ASSERT(num_args == 1);
+  Closure closure = static_cast<Closure>(I->Stack(1));
+  ASSERT(closure->IsClosure());
+  Array args = static_cast<Array>(I->Stack(0));
+  if (!args->IsArray() || args->size() != closure->num_args()) {
+    return kFailure;
+  }
+
+  I->Pop();
+  intptr_t closure_args = args->Size();
+  for (intptr_t i = 0; i < closure_args; i++) {
+    I->Push(args->element(i));
+  }
+
+  I->ActivateClosure(closure_args);
+  return kSuccess;
+}
+
+
+DEFINE_PRIMITIVE(Activation_jump) {
+  ASSERT(num_args == 1);
+  Activation target = static_cast<Activation>(I->Stack(0));
+  if (!target->IsActivation() ||
+      !target->bci()->IsSmallInteger()) {
+    return kFailure;
+  }
+
+  I->Drop(num_args + 1);
+  I->SetCurrentActivation(target);  // SAFEPOINT
+  return kSuccess;
+}
+
+
+// Activations found in the heap are handed to the program, so the interpreter
+// may no longer reuse them.
+static void ExposeActivations(Array instances) {
+  for (intptr_t i = 0; i < instances->Size(); i++) {
+    Interpreter::ExposeActivation(instances->element(i));
+  }
+}
+
+
+DEFINE_PRIMITIVE(Behavior_allInstances) {
+  ASSERT(num_args == 1);
+  Behavior cls = static_cast<Behavior>(I->Stack(0));
+  if (!cls->IsRegularObject()) {
+    UNREACHABLE();
+  }
+  if (cls->id() == nil) {
+    // Class not yet registered: no instance has been allocated.
+    Array result = H->AllocateArray(0);  // SAFEPOINT
+    RETURN(result);
+  }
+
+  ASSERT(cls->id()->IsSmallInteger());
+  intptr_t cid = cls->id()->value();
+  if (cid == kIllegalCid) {
+    UNREACHABLE();
+  }
+  intptr_t num_instances = H->CountInstances(cid);
+  if (cid == kArrayCid) {
+    num_instances++;
+  }
+  Array result = H->AllocateArray(num_instances);  // SAFEPOINT
+  result->set_size(SmallInteger::New(num_instances));
+  intptr_t num_instances2 = H->CollectInstances(cid, result);
+
+  ASSERT(num_instances == num_instances2);
+  // Note that if a GC happens there may be fewer instances than
+  // we initially counted. TODO(rmacnak): truncate result.
+  // OS::PrintErr("Found %" Pd " instances of %" Pd "\n", num_instances, cid);
+
+  if (cid == kActivationCid) {
+    ExposeActivations(result);
+  }
+  RETURN(result);
+}
+
+
+DEFINE_PRIMITIVE(Behavior_allInstancesAll) {
+  ASSERT(num_args == 1);
+  Array classes = static_cast<Array>(I->Stack(0));
+  if (!classes->IsArray()) {
+    return kFailure;
+  }
+  intptr_t length = classes->Size();
+  for (intptr_t i = 0; i < length; i++) {
+    Object cls = classes->element(i);
+    if (!cls->IsRegularObject()) {
+      return kFailure;
+    }
+  }
+
+  intptr_t* counts = new intptr_t[length];
+  if (!H->CountInstances(classes, counts)) {
+    delete[] counts;
+    return kFailure;
+  }
+  HandleScope h1(H, reinterpret_cast<Object*>(&classes));
+  Array results = H->AllocateArray(length);  // SAFEPOINT
+  for (intptr_t i = 0; i < length; i++) {
+    results->set_element(i, nil, kNoBarrier);
+  }
+  HandleScope h2(H, reinterpret_cast<Object*>(&results));
+  for (intptr_t i = 0; i < length; i++) {
+    intptr_t num_instances = counts[i];
+    if (static_cast<Behavior>(classes->element(i))->id() ==
+        SmallInteger::New(kArrayCid)) {
+      num_instances += length + 1;  // The results.
+    }
+    Array result = H->AllocateArray(num_instances);  // SAFEPOINT
+    for (intptr_t j = 0; j < num_instances; j++) {
+      result->set_element(j, nil, kNoBarrier);
+    }
+    results->set_element(i, result);
+  }
+  delete[] counts;
+
+  // If a GC happened meanwhile, instances that died leave nils at the ends.
+  H->CollectInstances(classes, results);
+  for (intptr_t i = 0; i < length; i++) {
+    ExposeActivations(static_cast<Array>(results->element(i)));
+  }
+  RETURN(results);
+}
+
+
+DEFINE_PRIMITIVE(Array_elementsForwardIdentity) {
+  ASSERT(num_args == 2);
+  Array left = static_cast<Array>(I->Stack(1));
+  Array right = static_cast<Array>(I->Stack(0));
+  if (left->IsArray() && right->IsArray()) {
+    if (H->BecomeForward(left, right)) {
+      RETURN_SELF();
+    }
+  }
+  return kFailure;
+}
+
+
+DEFINE_PRIMITIVE(Array_elementsForwardIdentityAll) {
+  ASSERT(num_args == 2);
+  Array left = static_cast<Array>(I->Stack(1));
+  Array right = static_cast<Array>(I->Stack(0));
+  if (left->IsArray() && right->IsArray()) {
+    if (H->BecomeForwardAll(left, right)) {
+      RETURN_SELF();
+    }
+  }
+  return kFailure;
+}
+
+
+DEFINE_PRIMITIVE(Method_deferredSourceAt) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(offset, 0);
+  Isolate* isolate = I->isolate();
+  String result = Deserializer::DeferredString(H, isolate->snapshot(),
+                                               isolate->snapshot_length(),
+                                               offset);  // SAFEPOINT
+  if (result == nullptr) {
+    return kFailure;
+  }
+  RETURN(result);
+}
+
+
+// A snapshot of everything reachable from the object store, which starts
+// again from the state reached when it is run.
+DEFINE_PRIMITIVE(snapshotHeap) {
+  ASSERT(num_args == 0);
+  Isolate* isolate = I->isolate();
+  intptr_t length;
+  uint8_t* bytes;
+  {
+    Serializer serializer(H, isolate->snapshot(), isolate->snapshot_length());
+    bytes = serializer.Serialize(I->object_store(), &length);
+  }
+  if (bytes == nullptr) {
+    return kFailure;
+  }
+  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), bytes, length);
+  free(bytes);
+  RETURN(result);
+}
+
+
+DEFINE_PRIMITIVE(Platform_operatingSystem) {
+  const char* name = OS::Name();
+  intptr_t length = strlen(name);
+  String result = H->AllocateString(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), name, length);
+  RETURN(result);
+}
+
+
+DEFINE_PRIMITIVE(Platform_numberOfProcessors) {
+  ASSERT(num_args == 0);
+  RETURN_SMI(OS::NumberOfAvailableProcessors());
+}
+
+
+DEFINE_PRIMITIVE(Time_monotonicNanos) {
+  ASSERT(num_args == 0);
+  int64_t now = OS::CurrentMonotonicNanos();
+  RETURN_MINT(now);
+}
+
+
+DEFINE_PRIMITIVE(Time_coarseMonotonicNanos) {
+  ASSERT(num_args == 0);
+  int64_t now = OS::CurrentCoarseMonotonicNanos();
+  RETURN_MINT(now);
+}
+
+
+DEFINE_PRIMITIVE(Time_utcEpochNanos) { UNIMPLEMENTED(); return kSuccess; }
+
+
+DEFINE_PRIMITIVE(print) {
+  ASSERT(num_args == 1);
+  ASSERT(I->StackDepth() >= 2);
+
+  Object message = I->Stack(0);
+  if (message->IsString()) {
+    String string = static_cast<String>(message);
+    const char* cstr =
+        reinterpret_cast<const char*>(string->element_addr(0));
+    I->isolate()->output()->PrintLine(cstr, string->Size());
+  } else {
+    char* cstr = message->ToCString(H);
+    char* line = OS::PrintStr("[print] %s", cstr);
+    I->isolate()->output()->PrintLine(line, strlen(line));
+    free(line);
+    free(cstr);
+  }
+  RETURN_SELF();
+}
+
+
+DEFINE_PRIMITIVE(halt) {
+  I->isolate()->output()->Flush();
+  OS::PrintErr("Halt:\n");
+  I->PrintStack();
+  OS::Exit(-1);
+  UNREACHABLE();
+  return kFailure;
+}
+
+
+// With no argument, flushes every cached lookup. With a selector, flushes
+// lookups of that selector. With a class, flushes lookups whose receiver,
+// including one found by an outer or implicit receiver send, is an instance of
+// that class or of one that inherits from it, as after its methods are changed
+// in place. Lookups are also flushed after every GC,
+// which covers installation by become.
+DEFINE_PRIMITIVE(flushCache) {
+  ASSERT(num_args == 0 || num_args == 1);
+  if (num_args == 0) {
+    I->FlushCaches();
+    RETURN_SELF();
+  }
+
+  Object argument = I->Stack(0);
+  if (argument->IsString()) {
+    if (!static_cast<String>(argument)->is_canonical()) {
+      return kFailure;
+    }
+    I->FlushCachesForSelector(static_cast<String>(argument));
+    RETURN_SELF();
+  }
+  if (argument->IsRegularObject()) {
+    Behavior cls = static_cast<Behavior>(argument);
+    // Even one never instantiated may have subclasses that were.
+    if ((cls->id() == nil) || cls->id()->IsSmallInteger()) {
+      I->FlushCachesForClass(cls);
+      RETURN_SELF();
+    }
+  }
+  return kFailure;
+}
+
+
+DEFINE_PRIMITIVE(collectGarbage) {
+  H->CollectAll(Heap::kPrimitive);  // SAFEPOINT
+  RETURN_SELF();
+}
+
+
+DEFINE_PRIMITIVE(MessageLoop_exit) {
+  ASSERT(num_args == 1);
+  SmallInteger exit_code = static_cast<SmallInteger>(I->Stack(0));
+  if (!exit_code->IsSmallInteger()) {
+    return kFailure;
+  }
+  I->isolate()->loop()->Exit(exit_code->value());
+  I->Exit();
+  UNREACHABLE();
+  return kFailure;
+}
+
+DEFINE_PRIMITIVE(Double_asStringFixed) {
+  ASSERT(num_args == 1);
+  FLOAT_ARGUMENT(value, 1);
+  SMI_ARGUMENT(fraction_digits, 0);
+  if (fraction_digits < 0 || fraction_digits > 20) {
+    return kFailure;
+  }
+
+  char buffer[64];
+  intptr_t length;
+  if (value < 1e21 && value > -1e21) {
+    length = DoubleToCStringAsFixed(value, fraction_digits,
+                                    buffer, sizeof(buffer));
+  } else {
+    length = DoubleToCStringAsShortest(value, buffer, sizeof(buffer));
+  }
+  ASSERT(length < 64);
+
+  String result = H->AllocateString(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), buffer, length);
+  RETURN(result);
+}
+
+DEFINE_PRIMITIVE(Double_asStringExponential) {
+  ASSERT(num_args == 1);
+  FLOAT_ARGUMENT(value, 1);
+  SMI_ARGUMENT(fraction_digits, 0);
+  if (fraction_digits < 0 || fraction_digits > 20) {
+    return kFailure;
+  }
+
+  char buffer[64];
+  intptr_t length = DoubleToCStringAsExponential(value, fraction_digits,
+                                                 buffer, sizeof(buffer));
+  ASSERT(length < 64);
+
+  String result = H->AllocateString(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), buffer, length);
+  RETURN(result);
+}
+
+DEFINE_PRIMITIVE(Double_asStringPrecision) {
+  ASSERT(num_args == 1);
+  FLOAT_ARGUMENT(value, 1);
+  SMI_ARGUMENT(precision, 0);
+  if (precision < 1 || precision > 21) {
+    return kFailure;
+  }
+
+  char buffer[64];
+  intptr_t length = DoubleToCStringAsPrecision(value, precision,
+                                               buffer, sizeof(buffer));
+  ASSERT(length < 64);
+
+  String result = H->AllocateString(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), buffer, length);
+  RETURN(result);
+}
+
+DEFINE_PRIMITIVE(Number_asString) {
+  ASSERT(num_args == 0);
+  Object receiver = I->Stack(0);
+
+  char buffer[64];
+  intptr_t length = -1;
+  if (receiver->IsSmallInteger()) {
+    intptr_t value = static_cast<SmallInteger>(receiver)->value();
+    length = snprintf(buffer, sizeof(buffer), "%" Pd "", value);
+  } else if (receiver->IsMediumInteger()) {
+    int64_t value = static_cast<MediumInteger>(receiver)->value();
+    length = snprintf(buffer, sizeof(buffer), "%" Pd64 "", value);
+  } else if (receiver->IsFloat64()) {
+    double value = static_cast<Float64>(receiver)->value();
+    length = DoubleToCStringAsShortest(value, buffer, sizeof(buffer));
+  } else if (receiver->IsLargeInteger()) {
+    LargeInteger large = static_cast<LargeInteger>(receiver);
+    String result = LargeInteger::PrintString(large, H);  // SAFEPOINT
+    RETURN(result);
+  } else {
+    UNIMPLEMENTED();
+  }
+  ASSERT(length < 64);
+
+  String result = H->AllocateString(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), buffer, length);
+
+  RETURN(result);
+}
+
+
+DEFINE_PRIMITIVE(Closure_ensure) {
+  // This is a marker primitive checked on non-local return.
+  return kFailure;
+}
+
+
+#if defined(__wasm_simd128__)
+// The memchr and memcmp Emscripten links look at a word at a time at best.
+// With wasm SIMD, the bulk string primitives look at 16 bytes at a time.
+static const uint8_t* FindByte(const uint8_t* bytes, uint8_t value,
+                               intptr_t length) {
+  v128_t pattern = wasm_i8x16_splat(value);
+  intptr_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    v128_t chunk = wasm_v128_load(bytes + i);
+    uint32_t matches = wasm_i8x16_bitmask(wasm_i8x16_eq(chunk, pattern));
+    if (matches != 0) {
+      return bytes + i + __builtin_ctz(matches);
+    }
+  }
+  for (; i < length; i++) {
+    if (bytes[i] == value) {
+      return bytes + i;
+    }
+  }
+  return NULL;
+}
+
+
+static bool BytesEqual(const uint8_t* left, const uint8_t* right,
+                       intptr_t length) {
+  intptr_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    v128_t difference = wasm_v128_xor(wasm_v128_load(left + i),
+                                      wasm_v128_load(right + i));
+    if (wasm_v128_any_true(difference)) {
+      return false;
+    }
+  }
+  for (; i < length; i++) {
+    if (left[i] != right[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+#else
+static inline const uint8_t* FindByte(const uint8_t* bytes, uint8_t value,
+                                      intptr_t length) {
+  return reinterpret_cast<const uint8_t*>(memchr(bytes, value, length));
+}
+
+
+static inline bool BytesEqual(const uint8_t* left, const uint8_t* right,
+                              intptr_t length) {
+  return memcmp(left, right, length) == 0;
+}
+#endif
+
+
+DEFINE_PRIMITIVE(String_equals) {
+  ASSERT(num_args == 1);
+
+  String left = static_cast<String>(I->Stack(1));
+  String right = static_cast<String>(I->Stack(0));
+  if (left == right) {
+    RETURN_BOOL(true);
+    return kSuccess;
+  }
+  if (!left->IsString() || !right->IsString()) {
+    RETURN_BOOL(false);
+  }
+  if (left->size() != right->size()) {
+    RETURN_BOOL(false);
+  }
+  if (left->EnsureHash(I->isolate()) != right->EnsureHash(I->isolate())) {
+    RETURN_BOOL(false);
+  }
+  intptr_t length = left->Size();
+  RETURN_BOOL(BytesEqual(left->element_addr(0), right->element_addr(0),
+                         length));
+}
+
+
+// The kernel's symbol table: open addressing from the string's hash, with
+// the table itself marking empty slots and nil those the GC cleared. Answers
+// the symbol equal to the string, or nil for the kernel to add it.
+DEFINE_PRIMITIVE(lookupSymbol) {
+  ASSERT(num_args == 2);
+  String string = static_cast<String>(I->Stack(1));
+  WeakArray table = static_cast<WeakArray>(I->Stack(0));
+  if (!string->IsString() || !table->IsWeakArray() || (table->Size() == 0)) {
+    return kFailure;
+  }
+  intptr_t capacity = table->Size();
+  SmallInteger hash = string->EnsureHash(I->isolate());
+  intptr_t length = string->Size();
+  intptr_t index = hash->value() % capacity;
+  for (intptr_t probes = 0; probes < capacity; probes++) {
+    Object entry = table->element(index);
+    if (entry == table) {
+      break;
+    }
+    if (entry->IsString()) {
+      String symbol = static_cast<String>(entry);
+      if ((symbol->Size() == length) &&
+          (symbol->EnsureHash(I->isolate()) == hash) &&
+          BytesEqual(symbol->element_addr(0), string->element_addr(0),
+                     length)) {
+        RETURN(symbol);
+      }
+    }
+    index++;
+    if (index == capacity) {
+      index = 0;
+    }
+  }
+  RETURN(nil);
+}
+
+
+DEFINE_PRIMITIVE(String_concat) {
+  ASSERT(num_args == 1);
+  String a = static_cast<String>(I->Stack(1));
+  String b = static_cast<String>(I->Stack(0));
+  if (!a->IsString() || !b->IsString()) {
+    return kFailure;
+  }
+  intptr_t a_length = a->Size();
+  intptr_t b_length = b->Size();
+  String result =
+      H->AllocateString(a_length + b_length);  // SAFEPOINT
+  a = static_cast<String>(I->Stack(1));
+  b = static_cast<String>(I->Stack(0));
+  memcpy(result->element_addr(0), a->element_addr(0), a_length);
+  memcpy(result->element_addr(a_length), b->element_addr(0), b_length);
+  RETURN(result);
+}
+
+
+DEFINE_PRIMITIVE(Closure_onDo) {
+  // This is a marker primitive for the in-image exception handling machinary.
+  return kFailure;
+}
+
+
+DEFINE_PRIMITIVE(Bytes_startsWith) {
+  ASSERT(num_args == 1);
+  Bytes string = static_cast<Bytes>(I->Stack(1));
+  Bytes prefix = static_cast<Bytes>(I->Stack(0));
+  if (!string->IsBytes() || !prefix->IsBytes()) {
+    return kFailure;
+  }
+
+  intptr_t string_length = string->Size();
+  intptr_t prefix_length = prefix->Size();
+  if (prefix_length > string_length) {
+    RETURN_BOOL(false);
+  }
+  RETURN_BOOL(BytesEqual(string->element_addr(0), prefix->element_addr(0),
+                         prefix_length));
+}
+
+
+DEFINE_PRIMITIVE(Bytes_endsWith) {
+  ASSERT(num_args == 1);
+  Bytes string = static_cast<Bytes>(I->Stack(1));
+  Bytes suffix = static_cast<Bytes>(I->Stack(0));
+  if (!string->IsBytes() || !suffix->IsBytes()) {
+    return kFailure;
+  }
+
+  intptr_t string_length = string->Size();
+  intptr_t suffix_length = suffix->Size();
+  if (suffix_length > string_length) {
+    RETURN_BOOL(false);
+  }
+  intptr_t offset = string_length - suffix_length;
+  RETURN_BOOL(BytesEqual(string->element_addr(offset),
+                         suffix->element_addr(0), suffix_length));
+}
+
+
+DEFINE_PRIMITIVE(Bytes_indexOf) {
+  ASSERT(num_args == 2);
+
+  Bytes string = static_cast<Bytes>(I->Stack(2));
+  Bytes substring = static_cast<Bytes>(I->Stack(1));
+  SmallInteger start = static_cast<SmallInteger>(I->Stack(0));
+  if (!(string->IsBytes())) {
+    UNREACHABLE();
+    return kFailure;
+  }
+  if (!(substring->IsBytes())) {
+    return kFailure;
+  }
+  if (!start->IsSmallInteger()) {
+    return kFailure;
+  }
+  intptr_t string_length = string->Size();
+  intptr_t substring_length = substring->Size();
+  intptr_t start_index = start->value() - 1;
+  if (start_index < 0) {
+    return kFailure;
+  }
+  if (start_index > string_length) {
+    return kFailure;
+  }
+
+  if (substring_length > string_length) {
+    RETURN_SMI(static_cast<intptr_t>(0));
+  }
+
+  intptr_t limit = string_length - substring_length;
+  if (start_index > limit) {
+    RETURN_SMI(static_cast<intptr_t>(0));
+  }
+  if (substring_length == 0) {
+    RETURN_SMI(start_index + 1);
+  }
+  // Candidates are found with FindByte and checked with BytesEqual, which
+  // look at many bytes at a time. Between them few bytes are looked at twice.
+  const uint8_t* bytes = string->element_addr(0);
+  const uint8_t* target = substring->element_addr(0);
+  uint8_t first = target[0];
+  intptr_t index = start_index;
+  while (index <= limit) {
+    const uint8_t* candidate =
+        FindByte(bytes + index, first, limit - index + 1);
+    if (candidate == NULL) {
+      break;
+    }
+    index = candidate - bytes;
+    if (BytesEqual(candidate + 1, target + 1, substring_length - 1)) {
+      RETURN_SMI(index + 1);
+    }
+    index++;
+  }
+  RETURN_SMI(static_cast<intptr_t>(0));
+}
+
+
+DEFINE_PRIMITIVE(Bytes_lastIndexOf) {
+  ASSERT(num_args == 2);
+
+  Bytes string = static_cast<Bytes>(I->Stack(2));
+  Bytes substring = static_cast<Bytes>(I->Stack(1));
+  SmallInteger start = static_cast<SmallInteger>(I->Stack(0));
+  if (!(string->IsBytes())) {
+    UNREACHABLE();
+    return kFailure;
+  }
+  if (!(substring->IsBytes())) {
+    return kFailure;
+  }
+  if (!start->IsSmallInteger()) {
+    return kFailure;
+  }
+
+  intptr_t string_length = string->Size();
+  intptr_t substring_length = substring->Size();
+  intptr_t start_index = start->value() - 1;
+  if (start_index < 0) {
+    return kFailure;
+  }
+  if (start_index > string_length) {
+    return kFailure;
+  }
+  if (substring_length > string_length) {
+    RETURN_SMI(static_cast<intptr_t>(0));
+  }
+
+  intptr_t limit = string_length - substring_length;
+  if (limit > start_index) {
+    limit = start_index;
+  }
+  if (substring_length == 0) {
+    RETURN_SMI(limit + 1);
+  }
+  // There is no portable memrchr, so candidates are found a byte at a time,
+  // but checked with BytesEqual.
+  const uint8_t* bytes = string->element_addr(0);
+  const uint8_t* target = substring->element_addr(0);
+  uint8_t first = target[0];
+  for (intptr_t start = limit; start >= 0; start--) {
+    if ((bytes[start] == first) &&
+        BytesEqual(bytes + start + 1, target + 1, substring_length - 1)) {
+      RETURN_SMI(start + 1);
+    }
+  }
+  RETURN_SMI(static_cast<intptr_t>(0));
+}
+
+
+DEFINE_PRIMITIVE(Bytes_copyStringFromTo) {
+  ASSERT(num_args == 2);
+
+  if (!I->Stack(1)->IsSmallInteger()) return kFailure;
+  intptr_t start = static_cast<SmallInteger>(I->Stack(1))->value();
+
+  if (!I->Stack(0)->IsSmallInteger()) return kFailure;
+  intptr_t stop = static_cast<SmallInteger>(I->Stack(0))->value();
+
+  if (!I->Stack(2)->IsBytes()) return kFailure;
+
+  Bytes bytes = static_cast<Bytes>(I->Stack(2));
+  if ((start <= 0) || (stop > bytes->Size())) return kFailure;
+
+  intptr_t subsize = stop - (start - 1);
+  if (subsize < 0) {
+    return kFailure;
+  }
+
+  String result = H->AllocateString(subsize);  // SAFEPOINT
+  bytes = static_cast<Bytes>(I->Stack(2));
+  memcpy(result->element_addr(0),
+         bytes->element_addr(start - 1),
+         subsize);
+  RETURN(result);
+}
+
+
+DEFINE_PRIMITIVE(String_class_with) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(byte, 0);
+  if ((byte < 0) || (byte > 255)) {
+    return kFailure;
+  }
+  String result = H->AllocateString(1);  // SAFEPOINT
+  result->set_element(0, byte);
+  RETURN(result);
+}
+
+
+DEFINE_PRIMITIVE(String_class_withAll) {
+  ASSERT(num_args == 1);
+
+  if (I->Stack(0)->IsBytes()) {
+    intptr_t length = static_cast<Bytes>(I->Stack(0))->Size();
+    String result = H->AllocateString(length);  // SAFEPOINT
+    Bytes bytes = static_cast<Bytes>(I->Stack(0));
+    memcpy(result->element_addr(0), bytes->element_addr(0), length);
+    RETURN(result);
+  } else if (I->Stack(0)->IsArray()) {
+    Array bytes = static_cast<Array>(I->Stack(0));
+    if (!bytes->IsArray()) {
+      return kFailure;
+    }
+
+    intptr_t length = bytes->Size();
+    for (intptr_t i = 0; i < length; i++) {
+      SmallInteger byte = static_cast<SmallInteger>(bytes->element(i));
+      if (!byte->IsSmallInteger()) {
+        return kFailure;
+      }
+      intptr_t raw_byte = byte->value();
+      if ((raw_byte < 0) || (raw_byte > 255)) {
+        return kFailure;
+      }
+    }
+
+    String result = H->AllocateString(length);  // SAFEPOINT
+    bytes = static_cast<Array>(I->Stack(0));
+
+    for (intptr_t i = 0; i < length; i++) {
+      SmallInteger byte = static_cast<SmallInteger>(bytes->element(i));
+      intptr_t raw_byte = byte->value();
+      result->set_element(i, raw_byte);
+    }
+
+    RETURN(result);
+  }
+  return kFailure;
+}
+
+
+DEFINE_PRIMITIVE(ByteArray_class_withAll) {
+  ASSERT(num_args == 1);
+
+  if (I->Stack(0)->IsBytes()) {
+    intptr_t length = static_cast<Bytes>(I->Stack(0))->Size();
+    String result = H->AllocateString(length);  // SAFEPOINT
+    Bytes bytes = static_cast<Bytes>(I->Stack(0));
+    memcpy(result->element_addr(0), bytes->element_addr(0), length);
+    RETURN(result);
+  } else if (I->Stack(0)->IsArray()) {
+    Array bytes = static_cast<Array>(I->Stack(0));
+    if (!bytes->IsArray()) {
+      return kFailure;
+    }
+
+    intptr_t length = bytes->Size();
+    for (intptr_t i = 0; i < length; i++) {
+      SmallInteger byte = static_cast<SmallInteger>(bytes->element(i));
+      if (!byte->IsSmallInteger()) {
+        return kFailure;
+      }
+      intptr_t raw_byte = byte->value();
+      if ((raw_byte < 0) || (raw_byte > 255)) {
+        return kFailure;
+      }
+    }
+
+    String result = H->AllocateString(length);  // SAFEPOINT
+    bytes = static_cast<Array>(I->Stack(0));
+
+    for (intptr_t i = 0; i < length; i++) {
+      SmallInteger byte = static_cast<SmallInteger>(bytes->element(i));
+      intptr_t raw_byte = byte->value();
+      result->set_element(i, raw_byte);
+    }
+
+    RETURN(result);
+  }
+  return kFailure;
+}
+
+
+DEFINE_PRIMITIVE(Object_isCanonical) {
+  ASSERT(num_args == 1);
+  Object object = I->Stack(0);
+  if (object->IsHeapObject()) {
+    RETURN_BOOL(static_cast<HeapObject>(object)->is_canonical());
+  } else {
+    RETURN_BOOL(true);
+  }
+}
+
+
+DEFINE_PRIMITIVE(Object_markCanonical) {
+  ASSERT(num_args == 1);
+  Object object = I->Stack(0);
+  if (object->IsHeapObject()) {
+    if (!static_cast<HeapObject>(object)->is_canonical()) {
+      // Not written when already set, as in the shared space.
+      static_cast<HeapObject>(object)->set_is_canonical(true);
+    }
+  } else {
+    // Nop.
+  }
+  RETURN(object);
+}
+
+
+DEFINE_PRIMITIVE(writeBytesToFile) {
+  ASSERT(num_args == 2);
+  ByteArray content = static_cast<ByteArray>(I->Stack(1));
+  String filename = static_cast<String>(I->Stack(0));
+  if (!content->IsByteArray() || !filename->IsString()) {
+    return kFailure;
+  }
+
+  char* raw_filename = reinterpret_cast<char*>(malloc(filename->Size() + 1));
+  memcpy(raw_filename, filename->element_addr(0), filename->Size());
+  raw_filename[filename->Size()] = 0;
+  FILE* f = fopen(raw_filename, "wb");
+  if (f == NULL) {
+    FATAL1("Cannot open %s\n", raw_filename);
+  }
+
+  size_t length = content->Size();
+  size_t start = 0;
+  while (start != length) {
+    size_t written = fwrite(content->element_addr(start), 1, length - start, f);
+    if (written == 0) {
+      FATAL1("Failed to write '%s'\n", raw_filename);
+    }
+    start += written;
+  }
+  fflush(f);
+  fclose(f);
+
+  free(raw_filename);
+
+  RETURN_SELF();
+}
+
+
+DEFINE_PRIMITIVE(readFileAsBytes) {
+  ASSERT(num_args == 1);
+  String filename = static_cast<String>(I->Stack(0));
+  if (!filename->IsString()) {
+    return kFailure;
+  }
+
+  char* raw_filename = reinterpret_cast<char*>(malloc(filename->Size() + 1));
+  memcpy(raw_filename, filename->element_addr(0), filename->Size());
+  raw_filename[filename->Size()] = 0;
+  FILE* f = fopen(raw_filename, "rb");
+  if (f == NULL) {
+    free(raw_filename);
+    return kFailure;  // Some callers expect the file may be absent.
+  }
+  struct stat st;
+  if (fstat(fileno(f), &st) != 0) {
+    FATAL1("Failed to stat '%s'\n", raw_filename);
+  }
+  size_t length = st.st_size;
+
+  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
+  size_t start = 0;
+  size_t remaining = length;
+  while (remaining > 0) {
+    size_t bytes_read = fread(result->element_addr(start), 1, remaining, f);
+    if (bytes_read == 0) {
+      FATAL1("Failed to read '%s'\n", raw_filename);
+    }
+    start += bytes_read;
+    remaining -= bytes_read;
+  }
+
+  fclose(f);
+  free(raw_filename);
+
+  RETURN(result);
+}
+
+
+// The File primitives answer a negative errno on failure, so the image can
+// say why. Reads and writes go at the descriptor's own offset, a chunk at a
+// time. Regular files cannot be awaited with the loops, which report them
+// always ready, so the image reads the next chunk in a later turn instead.
+#if !defined(OS_WINDOWS)
+static char* NewPath(String path) {
+  char* raw_path = reinterpret_cast<char*>(malloc(path->Size() + 1));
+  memcpy(raw_path, path->element_addr(0), path->Size());
+  raw_path[path->Size()] = 0;
+  return raw_path;
+}
+#endif
+
+
+DEFINE_PRIMITIVE(File_open) {
+#if defined(OS_WINDOWS)
+  return kFailure;
+#else
+  ASSERT(num_args == 2);
+  String path = static_cast<String>(I->Stack(1));
+  if (!path->IsString()) {
+    return kFailure;
+  }
+  SMI_ARGUMENT(mode, 0);
+  int flags;
+  switch (mode) {
+    case 0: flags = O_RDONLY; break;
+    case 1: flags = O_WRONLY | O_CREAT | O_TRUNC; break;
+    case 2: flags = O_WRONLY | O_CREAT | O_APPEND; break;
+    default: return kFailure;
+  }
+  char* raw_path = NewPath(path);
+  int fd;
+  do {
+    fd = open(raw_path, flags | O_CLOEXEC, 0666);
+  } while (fd == -1 && errno == EINTR);
+  intptr_t result = fd == -1 ? -errno : fd;
+  free(raw_path);
+  RETURN_SMI(result);
+#endif
+}
+
+
+DEFINE_PRIMITIVE(File_read) {
+#if defined(OS_WINDOWS)
+  return kFailure;
+#else
+  ASSERT(num_args == 4);
+  SMI_ARGUMENT(fd, 3);
+  ByteArray buffer = static_cast<ByteArray>(I->Stack(2));
+  if (!buffer->IsByteArray()) {
+    return kFailure;
+  }
+  SMI_ARGUMENT(start, 1);
+  SMI_ARGUMENT(count, 0);
+  if (start <= 0 || count < 0 || start - 1 + count > buffer->Size()) {
+    return kFailure;
+  }
+  ssize_t result;
+  do {
+    result = read(fd, buffer->element_addr(start - 1), count);
+  } while (result == -1 && errno == EINTR);
+  RETURN_SMI(result == -1 ? -errno : result);
+#endif
+}
+
+
+DEFINE_PRIMITIVE(File_write) {
+#if defined(OS_WINDOWS)
+  return kFailure;
+#else
+  ASSERT(num_args == 4);
+  SMI_ARGUMENT(fd, 3);
+  Bytes bytes = static_cast<Bytes>(I->Stack(2));
+  if (!bytes->IsBytes()) {
+    return kFailure;
+  }
+  SMI_ARGUMENT(start, 1);
+  SMI_ARGUMENT(count, 0);
+  if (start <= 0 || count < 0 || start - 1 + count > bytes->Size()) {
+    return kFailure;
+  }
+  ssize_t result;
+  do {
+    result = write(fd, bytes->element_addr(start - 1), count);
+  } while (result == -1 && errno == EINTR);
+  RETURN_SMI(result == -1 ? -errno : result);
+#endif
+}
+
+
+DEFINE_PRIMITIVE(File_close) {
+#if defined(OS_WINDOWS)
+  return kFailure;
+#else
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(fd, 0);
+  // Not retried on EINTR: the descriptor is released either way.
+  intptr_t result = close(fd) == -1 ? -errno : 0;
+  RETURN_SMI(result);
+#endif
+}
+
+
+DEFINE_PRIMITIVE(File_size) {
+#if defined(OS_WINDOWS)
+  return kFailure;
+#else
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(fd, 0);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    RETURN_SMI(-errno);
+  }
+  RETURN_MINT(st.st_size);
+#endif
 }
 
 
-DEFINE_PRIMITIVE(Closure_onDo) {
-  // This is a marker primitive for the in-image exception handling machinary.
+DEFINE_PRIMITIVE(File_delete) {
+#if defined(OS_WINDOWS)
   return kFailure;
+#else
+  ASSERT(num_args == 1);
+  String path = static_cast<String>(I->Stack(0));
+  if (!path->IsString()) {
+    return kFailure;
+  }
+  char* raw_path = NewPath(path);
+  intptr_t result = unlink(raw_path) == -1 ? -errno : 0;
+  free(raw_path);
+  RETURN_SMI(result);
+#endif
 }
 
 
-DEFINE_PRIMITIVE(Bytes_startsWith) {
+DEFINE_PRIMITIVE(Double_class_parse) {
   ASSERT(num_args == 1);
-  Bytes string = static_cast<Bytes>(I->Stack(1));
-  Bytes prefix = static_cast<Bytes>(I->Stack(0));
-  if (!string->IsBytes() || !prefix->IsBytes()) {
+  String string = static_cast<String>(I->Stack(0));
+  if (!string->IsString()) {
     return kFailure;
   }
-
-  intptr_t string_length = string->Size();
-  intptr_t prefix_length = prefix->Size();
-  if (prefix_length > string_length) {
-    RETURN_BOOL(false);
-  }
-  for (intptr_t i = 0; i < prefix_length; i++) {
-    if (string->element(i) != prefix->element(i)) {
-      RETURN_BOOL(false);
-    }
+  double raw_result;
+  const char* cstr = reinterpret_cast<const char*>(string->element_addr(0));
+  intptr_t length = string->Size();
+  if (CStringToDouble(cstr, length, &raw_result)) {
+    RETURN_FLOAT(raw_result);
   }
-  RETURN_BOOL(true);
+  return kFailure;
 }
 
 
-DEFINE_PRIMITIVE(Bytes_endsWith) {
+// For scanners such as JSON's, which find the extent of a number and then
+// take its value from the same bytes, without copying them out.
+DEFINE_PRIMITIVE(Bytes_indexAfterDigits) {
   ASSERT(num_args == 1);
-  Bytes string = static_cast<Bytes>(I->Stack(1));
-  Bytes suffix = static_cast<Bytes>(I->Stack(0));
-  if (!string->IsBytes() || !suffix->IsBytes()) {
+  Bytes receiver = static_cast<Bytes>(I->Stack(1));
+  ASSERT(receiver->IsBytes());
+  SMI_ARGUMENT(start, 0);
+  intptr_t size = receiver->Size();
+  if ((start <= 0) || (start > size + 1)) {
     return kFailure;
   }
-
-  intptr_t string_length = string->Size();
-  intptr_t suffix_length = suffix->Size();
-  if (suffix_length > string_length) {
-    RETURN_BOOL(false);
-  }
-  intptr_t offset = string_length - suffix_length;
-  for (intptr_t i = 0; i < suffix_length; i++) {
-    if (string->element(offset + i) != suffix->element(i)) {
-      RETURN_BOOL(false);
-    }
+  intptr_t index = start - 1;
+  while ((index < size) &&
+         (receiver->element(index) >= '0') &&
+         (receiver->element(index) <= '9')) {
+    index++;
   }
-
-  RETURN_BOOL(true);
+  RETURN_SMI(index + 1);
 }
 
 
-DEFINE_PRIMITIVE(Bytes_indexOf) {
+DEFINE_PRIMITIVE(Bytes_decimalValue) {
   ASSERT(num_args == 2);
-
-  Bytes string = static_cast<Bytes>(I->Stack(2));
-  Bytes substring = static_cast<Bytes>(I->Stack(1));
-  SmallInteger start = static_cast<SmallInteger>(I->Stack(0));
-  if (!(string->IsBytes())) {
-    UNREACHABLE();
+  Bytes receiver = static_cast<Bytes>(I->Stack(2));
+  ASSERT(receiver->IsBytes());
+  SMI_ARGUMENT(start, 1);
+  SMI_ARGUMENT(stop, 0);
+  if ((start <= 0) || (stop < start) || (stop > receiver->Size())) {
     return kFailure;
   }
-  if (!(substring->IsBytes())) {
-    return kFailure;
+  if (stop - start >= 18) {
+    return kFailure;  // May not fit in a Mint.
   }
-  if (!start->IsSmallInteger()) {
-    return kFailure;
+  int64_t value = 0;
+  for (intptr_t index = start - 1; index < stop; index++) {
+    uint8_t digit = receiver->element(index);
+    if ((digit < '0') || (digit > '9')) {
+      return kFailure;
+    }
+    value = value * 10 + (digit - '0');
   }
-  intptr_t string_length = string->Size();
-  intptr_t substring_length = substring->Size();
-  intptr_t start_index = start->value() - 1;
-  if (start_index < 0) {
+  RETURN_MINT(value);
+}
+
+
+DEFINE_PRIMITIVE(Double_class_parseFromTo) {
+  ASSERT(num_args == 3);
+  Bytes string = static_cast<Bytes>(I->Stack(2));
+  if (!string->IsBytes()) {
     return kFailure;
   }
-  if (start_index > string_length) {
+  SMI_ARGUMENT(start, 1);
+  SMI_ARGUMENT(stop, 0);
+  if ((start <= 0) || (stop < start) || (stop > string->Size())) {
     return kFailure;
   }
-
-  if (substring_length > string_length) {
-    RETURN_SMI(static_cast<intptr_t>(0));
-  }
-
-  intptr_t limit = string_length - substring_length;
-  for (intptr_t start = start_index; start <= limit; start++) {
-    bool found = true;
-    for (intptr_t i = 0; i < substring_length; i++) {
-      if (string->element(start + i) != substring->element(i)) {
-        found = false;
-        break;
-      }
-    }
-    if (found) {
-      RETURN_SMI(start + 1);
-    }
+  double raw_result;
+  const char* cstr =
+      reinterpret_cast<const char*>(string->element_addr(start - 1));
+  if (CStringToDouble(cstr, stop - start + 1, &raw_result)) {
+    RETURN_FLOAT(raw_result);
   }
-  RETURN_SMI(static_cast<intptr_t>(0));
+  return kFailure;
 }
 
 
-DEFINE_PRIMITIVE(Bytes_lastIndexOf) {
+// Prints a Smi, Mint or Float as asString does, straight into a
+// StringBuilder's buffer, answering the number of bytes written.
+DEFINE_PRIMITIVE(ByteArray_printNumberAt) {
   ASSERT(num_args == 2);
-
-  Bytes string = static_cast<Bytes>(I->Stack(2));
-  Bytes substring = static_cast<Bytes>(I->Stack(1));
-  SmallInteger start = static_cast<SmallInteger>(I->Stack(0));
-  if (!(string->IsBytes())) {
-    UNREACHABLE();
-    return kFailure;
-  }
-  if (!(substring->IsBytes())) {
+  ByteArray buffer = static_cast<ByteArray>(I->Stack(2));
+  ASSERT(buffer->IsByteArray());
+  Object number = I->Stack(1);
+  SMI_ARGUMENT(index, 0);
+  const intptr_t kMaxLength = 32;  // Including the terminating NUL.
+  if ((index <= 0) || (buffer->Size() - (index - 1) < kMaxLength)) {
     return kFailure;
   }
-  if (!start->IsSmallInteger()) {
+  char* cstr = reinterpret_cast<char*>(buffer->element_addr(index - 1));
+  intptr_t length;
+  if (number->IsSmallInteger()) {
+    intptr_t value = static_cast<SmallInteger>(number)->value();
+    length = snprintf(cstr, kMaxLength, "%" Pd "", value);
+  } else if (number->IsMediumInteger()) {
+    int64_t value = static_cast<MediumInteger>(number)->value();
+    length = snprintf(cstr, kMaxLength, "%" Pd64 "", value);
+  } else if (number->IsFloat64()) {
+    double value = static_cast<Float64>(number)->value();
+    length = DoubleToCStringAsShortest(value, cstr, kMaxLength);
+  } else {
     return kFailure;
   }
+  ASSERT(length < kMaxLength);
+  RETURN_SMI(length);
+}
 
-  intptr_t string_length = string->Size();
-  intptr_t substring_length = substring->Size();
-  intptr_t start_index = start->value() - 1;
-  if (start_index < 0) {
+
+// Answers the bounds of the values in a String or ByteArray holding JSON, as
+// described for JSONScanner, or fails for the decoder to report the error.
+DEFINE_PRIMITIVE(JSON_scan) {
+  ASSERT(num_args == 1);
+  Bytes bytes = static_cast<Bytes>(I->Stack(0));
+  if (!bytes->IsBytes()) {
     return kFailure;
   }
-  if (start_index > string_length) {
+  JSONScanner scanner(bytes->element_addr(0), bytes->Size());
+  if (!scanner.Scan()) {
     return kFailure;
   }
-  if (substring_length > string_length) {
-    RETURN_SMI(static_cast<intptr_t>(0));
+  intptr_t length = scanner.length();
+  const intptr_t* bounds = scanner.bounds();
+  Array result = H->AllocateArray(length);  // SAFEPOINT
+  for (intptr_t i = 0; i < length; i++) {
+    result->set_element(i, SmallInteger::New(bounds[i]), kNoBarrier);
   }
+  RETURN(result);
+}
 
-  intptr_t limit = string_length - substring_length;
-  if (limit > start_index) {
-    limit = start_index;
-  }
-  for (intptr_t start = limit; start >= 0; start--) {
-    bool found = true;
-    for (intptr_t i = 0; i < substring_length; i++) {
-      if (string->element(start + i) != substring->element(i)) {
-        found = false;
-      }
-    }
-    if (found) {
-      RETURN_SMI(start + 1);
-    }
+
+DEFINE_PRIMITIVE(currentActivation) {
+  ASSERT(num_args == 0);
+  RETURN(I->CurrentActivation());  // SAFEPOINT
+}
+
+
+// Answers the method, BCI and receiver of each of the top depth activations,
+// in threes, without moving their frames to the heap as following senders
+// from the current activation would.
+DEFINE_PRIMITIVE(stackFrames) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(depth, 0);
+  if (depth < 0) {
+    return kFailure;
   }
-  RETURN_SMI(static_cast<intptr_t>(0));
+  RETURN(I->StackFrames(depth));  // SAFEPOINT
 }
 
 
-DEFINE_PRIMITIVE(Bytes_copyStringFromTo) {
+DEFINE_PRIMITIVE(Behavior_adoptInstance) {
   ASSERT(num_args == 2);
+  Behavior new_cls = static_cast<Behavior>(I->Stack(1));
+  HeapObject instance = static_cast<HeapObject>(I->Stack(0));
+  Behavior old_cls = instance->Klass(H);
 
-  if (!I->Stack(1)->IsSmallInteger()) return kFailure;
-  intptr_t start = static_cast<SmallInteger>(I->Stack(1))->value();
+  ASSERT(old_cls->cid() >= kFirstRegularObjectCid);
+  ASSERT(old_cls->format() == new_cls->format());
 
-  if (!I->Stack(0)->IsSmallInteger()) return kFailure;
-  intptr_t stop = static_cast<SmallInteger>(I->Stack(0))->value();
+  SmallInteger id = new_cls->id();
+  if (id == nil) {
+    id = SmallInteger::New(H->AllocateClassId());  // SAFEPOINT
+    new_cls = static_cast<Behavior>(I->Stack(1));
+    instance = static_cast<HeapObject>(I->Stack(0));
+    new_cls->set_id(id);
+    H->RegisterClass(id->value(), new_cls);
+  }
+  ASSERT(id->IsSmallInteger());
+  instance->set_cid(id->value());
+  if (instance->IsOldObject() && instance->is_marked() &&
+      new_cls->IsOldObject() && !new_cls->is_marked()) {
+    // The class is referenced by its id, which the store barrier cannot see.
+    H->MarkingBarrier(new_cls);
+  }
 
-  if (!I->Stack(2)->IsBytes()) return kFailure;
+  RETURN_SELF();
+}
 
-  Bytes bytes = static_cast<Bytes>(I->Stack(2));
-  if ((start <= 0) || (stop > bytes->Size())) return kFailure;
 
-  intptr_t subsize = stop - (start - 1);
-  if (subsize < 0) {
-    return kFailure;
-  }
+DEFINE_PRIMITIVE(openPort) {
+  ASSERT(num_args == 0);
+  Port new_port = I->isolate()->loop()->OpenPort();
+  RETURN_MINT(new_port);
+}
 
-  String result = H->AllocateString(subsize);  // SAFEPOINT
-  bytes = static_cast<Bytes>(I->Stack(2));
-  memcpy(result->element_addr(0),
-         bytes->element_addr(start - 1),
-         subsize);
-  RETURN(result);
+
+DEFINE_PRIMITIVE(closePort) {
+  ASSERT(num_args == 1);
+  MINT_ARGUMENT(port, 0);
+  I->isolate()->loop()->ClosePort(port);
+  RETURN_SELF();
 }
 
 
-DEFINE_PRIMITIVE(String_class_with) {
+// A copy of bytes for another isolate. A large one is made outside the heap,
+// so the receiver takes it without copying it again.
+static IsolateMessage* NewBytesMessage(Port port, ByteArray bytes) {
+  intptr_t length = bytes->Size();
+  uint8_t* data = Heap::AllocateTransferable(length);
+  bool transferable = data != nullptr;
+  if (!transferable) {
+    data = reinterpret_cast<uint8_t*>(malloc(length));
+  }
+  memcpy(data, bytes->element_addr(0), length);
+  return new IsolateMessage(port, data, length, transferable);
+}
+
+
+DEFINE_PRIMITIVE(spawn) {
   ASSERT(num_args == 1);
-  SMI_ARGUMENT(byte, 0);
-  if ((byte < 0) || (byte > 255)) {
-    return kFailure;
+  ByteArray message = static_cast<ByteArray>(I->Stack(0));
+  if (message->IsByteArray()) {
+    I->isolate()->Spawn(NewBytesMessage(ILLEGAL_PORT, message), false);
+
+    RETURN_SELF();
   }
-  String result = H->AllocateString(1);  // SAFEPOINT
-  result->set_element(0, byte);
-  RETURN(result);
+
+  return kFailure;
 }
 
 
-DEFINE_PRIMITIVE(String_class_withAll) {
+DEFINE_PRIMITIVE(spawnNear) {
   ASSERT(num_args == 1);
+  ByteArray message = static_cast<ByteArray>(I->Stack(0));
+  if (message->IsByteArray()) {
+    I->isolate()->Spawn(NewBytesMessage(ILLEGAL_PORT, message), true);
 
-  if (I->Stack(0)->IsBytes()) {
-    intptr_t length = static_cast<Bytes>(I->Stack(0))->Size();
-    String result = H->AllocateString(length);  // SAFEPOINT
-    Bytes bytes = static_cast<Bytes>(I->Stack(0));
-    memcpy(result->element_addr(0), bytes->element_addr(0), length);
-    RETURN(result);
-  } else if (I->Stack(0)->IsArray()) {
-    Array bytes = static_cast<Array>(I->Stack(0));
-    if (!bytes->IsArray()) {
-      return kFailure;
-    }
+    RETURN_SELF();
+  }
 
-    intptr_t length = bytes->Size();
-    for (intptr_t i = 0; i < length; i++) {
-      SmallInteger byte = static_cast<SmallInteger>(bytes->element(i));
-      if (!byte->IsSmallInteger()) {
-        return kFailure;
-      }
-      intptr_t raw_byte = byte->value();
-      if ((raw_byte < 0) || (raw_byte > 255)) {
-        return kFailure;
-      }
-    }
+  return kFailure;
+}
 
-    String result = H->AllocateString(length);  // SAFEPOINT
-    bytes = static_cast<Array>(I->Stack(0));
 
-    for (intptr_t i = 0; i < length; i++) {
-      SmallInteger byte = static_cast<SmallInteger>(bytes->element(i));
-      intptr_t raw_byte = byte->value();
-      result->set_element(i, raw_byte);
-    }
+// True once posted, false if the port is closed, or nil if the receiver's
+// mailbox is full and the message was dropped.
+static Object PostResultObject(Interpreter* I, PortMap::PostResult result) {
+  switch (result) {
+    case PortMap::kPosted: return I->true_obj();
+    case PortMap::kNoSuchPort: return I->false_obj();
+    case PortMap::kMailboxFull: return I->nil_obj();
+  }
+  UNREACHABLE();
+  return I->nil_obj();
+}
 
-    RETURN(result);
+
+static PortMap::PostResult PostCounted(Interpreter* I,
+                                       IsolateMessage* message) {
+  PortMap::PostResult result = PortMap::PostMessage(message);
+  if (result == PortMap::kPosted) {
+    I->isolate()->CountMessageSent();
+  }
+  return result;
+}
+
+
+DEFINE_PRIMITIVE(send) {
+  ASSERT(num_args == 2);
+  MINT_ARGUMENT(port, 1);
+  ByteArray data = static_cast<ByteArray>(I->Stack(0));
+  if (!data->IsByteArray()) {
+    return kFailure;
+  }
+
+  IsolateMessage* message = NewBytesMessage(port, data);
+  RETURN(PostResultObject(I, PostCounted(I, message)));
+}
+
+
+// One copy of the bytes sent to many ports, freed with the last of the
+// messages that borrow it.
+struct SharedBytes {
+  explicit SharedBytes(intptr_t count) : references(count) {}
+
+  uint8_t* data() { return reinterpret_cast<uint8_t*>(this + 1); }
+
+  std::atomic<intptr_t> references;
+};
+
+
+static void ReleaseSharedBytes(const void* data, size_t length,
+                               void* context) {
+  SharedBytes* shared = reinterpret_cast<SharedBytes*>(context);
+  if (shared->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    shared->~SharedBytes();
+    free(shared);
   }
-  return kFailure;
 }
 
 
-DEFINE_PRIMITIVE(ByteArray_class_withAll) {
-  ASSERT(num_args == 1);
-
-  if (I->Stack(0)->IsBytes()) {
-    intptr_t length = static_cast<Bytes>(I->Stack(0))->Size();
-    String result = H->AllocateString(length);  // SAFEPOINT
-    Bytes bytes = static_cast<Bytes>(I->Stack(0));
-    memcpy(result->element_addr(0), bytes->element_addr(0), length);
-    RETURN(result);
-  } else if (I->Stack(0)->IsArray()) {
-    Array bytes = static_cast<Array>(I->Stack(0));
-    if (!bytes->IsArray()) {
+// Sends data to each of an Array of ports, answering an Array of what send
+// would answer for each. The bytes are copied once rather than once a port,
+// and each lock of the PortMap is taken once.
+DEFINE_PRIMITIVE(sendToAll) {
+  ASSERT(num_args == 2);
+  Array ports = static_cast<Array>(I->Stack(1));
+  ByteArray data = static_cast<ByteArray>(I->Stack(0));
+  if (!ports->IsArray() || !data->IsByteArray()) {
+    return kFailure;
+  }
+  intptr_t count = ports->Size();
+  for (intptr_t i = 0; i < count; i++) {
+    Object port = ports->element(i);
+    if (!port->IsSmallInteger() && !port->IsMediumInteger()) {
       return kFailure;
     }
+  }
 
-    intptr_t length = bytes->Size();
-    for (intptr_t i = 0; i < length; i++) {
-      SmallInteger byte = static_cast<SmallInteger>(bytes->element(i));
-      if (!byte->IsSmallInteger()) {
-        return kFailure;
-      }
-      intptr_t raw_byte = byte->value();
-      if ((raw_byte < 0) || (raw_byte > 255)) {
-        return kFailure;
-      }
+  Array results = H->AllocateArray(count);  // SAFEPOINT
+  ports = static_cast<Array>(I->Stack(1));
+  data = static_cast<ByteArray>(I->Stack(0));
+  if (count == 0) {
+    RETURN(results);
+  }
+
+  intptr_t length = data->Size();
+  void* memory = malloc(sizeof(SharedBytes) + length);
+  IsolateMessage** messages = reinterpret_cast<IsolateMessage**>(
+      malloc(count * sizeof(IsolateMessage*)));
+  PortMap::PostResult* posts = reinterpret_cast<PortMap::PostResult*>(
+      malloc(count * sizeof(PortMap::PostResult)));
+  if ((memory == NULL) || (messages == NULL) || (posts == NULL)) {
+    FATAL("Failed to allocate messages");
+  }
+  SharedBytes* shared = new (memory) SharedBytes(count);
+  memcpy(shared->data(), data->element_addr(0), length);
+  for (intptr_t i = 0; i < count; i++) {
+    Object port = ports->element(i);
+    int64_t id = port->IsSmallInteger()
+        ? static_cast<SmallInteger>(port)->value()
+        : static_cast<MediumInteger>(port)->value();
+    messages[i] = IsolateMessage::NewBorrowed(id, shared->data(), length,
+                                              ReleaseSharedBytes, shared);
+  }
+
+  PortMap::PostEach(messages, count, posts);
+
+  for (intptr_t i = 0; i < count; i++) {
+    if (messages[i] != NULL) {
+      delete messages[i];  // Not posted.
+    } else {
+      I->isolate()->CountMessageSent();
     }
+    results->set_element(i, PostResultObject(I, posts[i]));
+  }
+  free(messages);
+  free(posts);
+  RETURN(results);
+}
 
-    String result = H->AllocateString(length);  // SAFEPOINT
-    bytes = static_cast<Array>(I->Stack(0));
 
-    for (intptr_t i = 0; i < length; i++) {
-      SmallInteger byte = static_cast<SmallInteger>(bytes->element(i));
-      intptr_t raw_byte = byte->value();
-      result->set_element(i, raw_byte);
+// The message, as the receiver's Deserializer reads it, or nullptr if the
+// Newspeak Serializer should write it.
+static bool IncludesObject(Array array, Object object) {
+  intptr_t size = array->Size();
+  for (intptr_t i = 0; i < size; i++) {
+    if (array->element(i) == object) {
+      return true;
     }
-
-    RETURN(result);
   }
-  return kFailure;
+  return false;
 }
 
 
-DEFINE_PRIMITIVE(Object_isCanonical) {
-  ASSERT(num_args == 1);
-  Object object = I->Stack(0);
-  if (object->IsHeapObject()) {
-    RETURN_BOOL(static_cast<HeapObject>(object)->is_canonical());
-  } else {
-    RETURN_BOOL(true);
+static IsolateMessage* NewObjectMessage(Interpreter* I, Heap* H, Port port,
+                                        Object message, Object shared) {
+  if (!shared->IsArray()) {
+    return nullptr;
+  }
+  if (message->IsString() &&
+      !static_cast<String>(message)->is_canonical() &&
+      !IncludesObject(static_cast<Array>(shared), message)) {
+    // Received as a copy either way, and by embedders as just its bytes.
+    String string = static_cast<String>(message);
+    return IsolateMessage::NewText(port, string->element_addr(0),
+                                   string->Size());
   }
+  Isolate* isolate = I->isolate();
+  Serializer serializer(H, isolate->snapshot(), isolate->snapshot_length());
+  intptr_t length;
+  bool transferable;
+  uint8_t* data = serializer.SerializeMessage(I->object_store(), message,
+                                              static_cast<Array>(shared),
+                                              &length, &transferable);
+  if (data == nullptr) {
+    return nullptr;
+  }
+  return new IsolateMessage(port, data, length, transferable);
 }
 
 
-DEFINE_PRIMITIVE(Object_markCanonical) {
-  ASSERT(num_args == 1);
-  Object object = I->Stack(0);
-  if (object->IsHeapObject()) {
-    static_cast<HeapObject>(object)->set_is_canonical(true);
-  } else {
-    // Nop.
+DEFINE_PRIMITIVE(spawnObject) {
+  ASSERT(num_args == 2);
+  IsolateMessage* message =
+      NewObjectMessage(I, H, ILLEGAL_PORT, I->Stack(1), I->Stack(0));
+  if (message == nullptr) {
+    return kFailure;
   }
-  RETURN(object);
+  I->isolate()->Spawn(message, false);
+  RETURN_SELF();
 }
 
 
-DEFINE_PRIMITIVE(writeBytesToFile) {
+DEFINE_PRIMITIVE(spawnObjectNear) {
   ASSERT(num_args == 2);
-  ByteArray content = static_cast<ByteArray>(I->Stack(1));
-  String filename = static_cast<String>(I->Stack(0));
-  if (!content->IsByteArray() || !filename->IsString()) {
+  IsolateMessage* message =
+      NewObjectMessage(I, H, ILLEGAL_PORT, I->Stack(1), I->Stack(0));
+  if (message == nullptr) {
     return kFailure;
   }
+  I->isolate()->Spawn(message, true);
+  RETURN_SELF();
+}
 
-  char* raw_filename = reinterpret_cast<char*>(malloc(filename->Size() + 1));
-  memcpy(raw_filename, filename->element_addr(0), filename->Size());
-  raw_filename[filename->Size()] = 0;
-  FILE* f = fopen(raw_filename, "wb");
-  if (f == NULL) {
-    FATAL1("Cannot open %s\n", raw_filename);
-  }
 
-  size_t length = content->Size();
-  size_t start = 0;
-  while (start != length) {
-    size_t written = fwrite(content->element_addr(start), 1, length - start, f);
-    if (written == 0) {
-      FATAL1("Failed to write '%s'\n", raw_filename);
-    }
-    start += written;
+DEFINE_PRIMITIVE(sendObject) {
+  ASSERT(num_args == 3);
+  MINT_ARGUMENT(port, 2);
+  IsolateMessage* message =
+      NewObjectMessage(I, H, port, I->Stack(1), I->Stack(0));
+  if (message == nullptr) {
+    return kFailure;
   }
-  fflush(f);
-  fclose(f);
+  RETURN(PostResultObject(I, PostCounted(I, message)));
+}
 
-  free(raw_filename);
 
-  RETURN_SELF();
+// Fuchsia only, where a handle such as a VMO's moves to the receiver instead of
+// being copied. The sender no longer owns the handle, even if the message is
+// not posted.
+DEFINE_PRIMITIVE(sendHandle) {
+#if !defined(OS_FUCHSIA)
+  return kFailure;
+#else
+  ASSERT(num_args == 2);
+  MINT_ARGUMENT(port, 1);
+  SmallInteger handle = static_cast<SmallInteger>(I->Stack(0));
+  if (!handle->IsSmallInteger() || (handle->value() == ZX_HANDLE_INVALID)) {
+    return kFailure;
+  }
+  zx_handle_t raw_handle = static_cast<zx_handle_t>(handle->value());
+  IsolateMessage* message = IsolateMessage::NewHandle(port, raw_handle);
+  RETURN(PostResultObject(I, PostCounted(I, message)));
+#endif
 }
 
 
-DEFINE_PRIMITIVE(readFileAsBytes) {
+DEFINE_PRIMITIVE(messageSymbols) {
   ASSERT(num_args == 1);
-  String filename = static_cast<String>(I->Stack(0));
-  if (!filename->IsString()) {
+  ByteArray bytes = static_cast<ByteArray>(I->Stack(0));
+  if (!bytes->IsByteArray()) {
     return kFailure;
   }
-
-  char* raw_filename = reinterpret_cast<char*>(malloc(filename->Size() + 1));
-  memcpy(raw_filename, filename->element_addr(0), filename->Size());
-  raw_filename[filename->Size()] = 0;
-  FILE* f = fopen(raw_filename, "rb");
-  if (f == NULL) {
-    FATAL1("Failed to stat '%s'\n", raw_filename);
-  }
-  struct stat st;
-  if (fstat(fileno(f), &st) != 0) {
-    FATAL1("Failed to stat '%s'\n", raw_filename);
+  // Allocates without collecting, so the bytes stay put.
+  Array symbols = Deserializer::MessageSymbols(H, bytes->element_addr(0),
+                                               bytes->Size());
+  if (symbols == nullptr) {
+    return kFailure;
   }
-  size_t length = st.st_size;
+  RETURN(symbols);
+}
 
-  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
-  size_t start = 0;
-  size_t remaining = length;
-  while (remaining > 0) {
-    size_t bytes_read = fread(result->element_addr(start), 1, remaining, f);
-    if (bytes_read == 0) {
-      FATAL1("Failed to read '%s'\n", raw_filename);
+
+DEFINE_PRIMITIVE(decodeMessage) {
+  ASSERT(num_args == 3);
+  ByteArray bytes = static_cast<ByteArray>(I->Stack(2));
+  Array shared = static_cast<Array>(I->Stack(1));
+  Array symbols = static_cast<Array>(I->Stack(0));
+  if (!bytes->IsByteArray() || !shared->IsArray() || !symbols->IsArray()) {
+    return kFailure;
+  }
+  Object result;
+  {
+    Deserializer deserializer(H, bytes->element_addr(0), bytes->Size());
+    if (!deserializer.DeserializeMessage(shared, symbols, &result)) {
+      return kFailure;
     }
-    start += bytes_read;
-    remaining -= bytes_read;
   }
+  RETURN(result);
+}
 
-  fclose(f);
-  free(raw_filename);
 
+// The bytes sendObject would post, for keeping a graph outside the heap, as
+// in a file, and reading it back later with messageSymbols and decodeMessage.
+DEFINE_PRIMITIVE(encodeMessage) {
+  ASSERT(num_args == 2);
+  Object message = I->Stack(1);
+  Array shared = static_cast<Array>(I->Stack(0));
+  if (!shared->IsArray()) {
+    return kFailure;
+  }
+  Isolate* isolate = I->isolate();
+  intptr_t length;
+  bool transferable;
+  uint8_t* data;
+  {
+    Serializer serializer(H, isolate->snapshot(), isolate->snapshot_length());
+    data = serializer.SerializeMessage(I->object_store(), message, shared,
+                                       &length, &transferable);
+  }
+  if (data == nullptr) {
+    return kFailure;
+  }
+  ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), data, length);
+  if (transferable) {
+    Heap::FreeTransferable(data);
+  } else {
+    free(data);
+  }
   RETURN(result);
 }
 
 
-DEFINE_PRIMITIVE(Double_class_parse) {
+DEFINE_PRIMITIVE(mailboxCapacity) {
   ASSERT(num_args == 1);
-  String string = static_cast<String>(I->Stack(0));
-  if (!string->IsString()) {
+  SMI_ARGUMENT(capacity, 0);
+  if (capacity < 0) {
     return kFailure;
   }
-  double raw_result;
-  const char* cstr = reinterpret_cast<const char*>(string->element_addr(0));
-  intptr_t length = string->Size();
-  if (CStringToDouble(cstr, length, &raw_result)) {
-    RETURN_FLOAT(raw_result);
+  I->isolate()->loop()->set_mailbox_capacity(capacity);
+  RETURN_SELF();
+}
+
+
+DEFINE_PRIMITIVE(mailboxStatistic) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(index, 0);
+  if ((index < 0) || (index >= MessageLoop::kNumMailboxStatistics)) {
+    return kFailure;
   }
-  return kFailure;
+  int64_t value = I->isolate()->loop()->MailboxStatisticAt(
+      static_cast<MessageLoop::MailboxStatistic>(index));
+  RETURN_MINT(value);
 }
 
 
-DEFINE_PRIMITIVE(currentActivation) {
-  ASSERT(num_args == 0);
-  RETURN(I->CurrentActivation());  // SAFEPOINT
+DEFINE_PRIMITIVE(usageStatistic) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(index, 0);
+  if ((index < 0) || (index >= Isolate::kNumUsageStatistics)) {
+    return kFailure;
+  }
+  int64_t value = I->isolate()->UsageStatisticAt(
+      static_cast<Isolate::UsageStatistic>(index));
+  RETURN_MINT(value);
 }
 
 
-DEFINE_PRIMITIVE(Behavior_adoptInstance) {
+DEFINE_PRIMITIVE(timeLimits) {
   ASSERT(num_args == 2);
-  Behavior new_cls = static_cast<Behavior>(I->Stack(1));
-  HeapObject instance = static_cast<HeapObject>(I->Stack(0));
-  Behavior old_cls = instance->Klass(H);
+  SMI_ARGUMENT(slice, 1);
+  SMI_ARGUMENT(quota, 0);
+  if (!I->isolate()->SetTimeLimits(slice, quota)) {
+    return kFailure;
+  }
+  RETURN_SELF();
+}
 
-  ASSERT(old_cls->cid() >= kFirstRegularObjectCid);
-  ASSERT(old_cls->format() == new_cls->format());
 
-  SmallInteger id = new_cls->id();
-  if (id == nil) {
-    id = SmallInteger::New(H->AllocateClassId());  // SAFEPOINT
-    new_cls = static_cast<Behavior>(I->Stack(1));
-    instance = static_cast<HeapObject>(I->Stack(0));
-    new_cls->set_id(id);
-    H->RegisterClass(id->value(), new_cls);
+DEFINE_PRIMITIVE(threadPoolStatistic) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(index, 0);
+  if ((index < 0) || (index >= ThreadPool::kNumStatistics)) {
+    return kFailure;
   }
-  ASSERT(id->IsSmallInteger());
-  instance->set_cid(id->value());
-
-  RETURN_SELF();
+  int64_t value = H->thread_pool()->StatisticAt(
+      static_cast<ThreadPool::Statistic>(index));
+  RETURN_MINT(value);
 }
 
 
-DEFINE_PRIMITIVE(openPort) {
-  ASSERT(num_args == 0);
-  Port new_port = I->isolate()->loop()->OpenPort();
-  RETURN_MINT(new_port);
+// How a key is compared with the entries of a hashed collection, when its #=
+// is one the VM knows.
+enum KeyEquality {
+  kUnknownEquality,
+  kIdentityEquality,  // Object>>=.
+  kStringEquality,  // String>>=.
+  kSmallIntegerEquality,  // Number>>= on a SmallInteger.
+};
+
+
+static const intptr_t kCommonSelectorEquals = 6;  // Of bytecode 86.
+
+
+static KeyEquality EqualityOf(Object key, Heap* H, Interpreter* I) {
+  String selector = static_cast<String>(
+      I->object_store()->common_selectors()->element(
+          kCommonSelectorEquals * 2));
+  ASSERT((selector->Size() == 1) && (selector->element(0) == '='));
+  Method method = static_cast<Method>(nil);
+#if LOOKUP_CACHE
+  if (!I->lookup_cache()->LookupOrdinary(key->ClassId(), selector, &method)) {
+    method = static_cast<Method>(nil);
+  }
+#endif
+  if (method == nil) {
+    // As OrdinarySendMiss would find it, without activating it.
+    Behavior lookup_class = key->Klass(H);
+    while (lookup_class != nil) {
+      method = I->MethodAt(lookup_class, selector);
+      if (method != nil) {
+        break;
+      }
+      lookup_class = lookup_class->superclass();
+    }
+    if ((method == nil) || !method->IsPublic()) {
+      return kUnknownEquality;
+    }
+#if LOOKUP_CACHE
+    I->lookup_cache()->InsertOrdinary(key->ClassId(), selector, method);
+#endif
+  }
+  switch (method->Primitive()) {
+    case 86:
+      return kIdentityEquality;
+    case 114:
+      return key->IsString() ? kStringEquality : kUnknownEquality;
+    case 9:
+      return key->IsSmallInteger() ? kSmallIntegerEquality : kUnknownEquality;
+    default:
+      return kUnknownEquality;
+  }
+}
+
+
+// Open addressing as in CollectionsForPrimordialSoup's Map and Set: the
+// slots of a key are width elements apart from start, wrapping around, and
+// an empty one holds the table itself.
+static bool HashTableArguments(Interpreter* I,
+                               intptr_t table_index,
+                               Array* table,
+                               intptr_t* start,
+                               intptr_t* width) {
+  Object t = I->Stack(table_index);
+  Object s = I->Stack(table_index - 1);
+  Object w = I->Stack(table_index - 2);
+  if (!t->IsArray() || !s->IsSmallInteger() || !w->IsSmallInteger()) {
+    return false;
+  }
+  *table = static_cast<Array>(t);
+  *start = static_cast<SmallInteger>(s)->value() - 1;
+  *width = static_cast<SmallInteger>(w)->value();
+  intptr_t size = (*table)->Size();
+  return (*width > 0) && (size > 0) && ((size % *width) == 0) &&
+         (*start >= 0) && (*start < size) && ((*start % *width) == 0);
 }
 
 
-DEFINE_PRIMITIVE(closePort) {
-  ASSERT(num_args == 1);
-  MINT_ARGUMENT(port, 0);
-  I->isolate()->loop()->ClosePort(port);
-  RETURN_SELF();
+// Key's slot in the table, or the empty one that ends its probe. Fails for
+// keys whose #= the VM does not know, and for entries it cannot compare
+// with them, so the collection probes by sending #= instead.
+DEFINE_PRIMITIVE(HashTable_slotFor) {
+  ASSERT(num_args == 4);
+  Object key = I->Stack(3);
+  Array table;
+  intptr_t start, width;
+  if (!HashTableArguments(I, 2, &table, &start, &width)) {
+    return kFailure;
+  }
+  KeyEquality equality = EqualityOf(key, H, I);
+  if (equality == kUnknownEquality) {
+    return kFailure;
+  }
+  intptr_t size = table->Size();
+  intptr_t index = start;
+  do {
+    Object entry = table->element(index);
+    if ((entry == table) || (entry == key)) {
+      RETURN_SMI(index + 1);
+    }
+    switch (equality) {
+      case kIdentityEquality:
+        break;
+      case kStringEquality:
+        if (entry->IsString()) {
+          String a = static_cast<String>(key);
+          String b = static_cast<String>(entry);
+          if ((a->Size() == b->Size()) &&
+              (memcmp(a->element_addr(0), b->element_addr(0),
+                      a->Size()) == 0)) {
+            RETURN_SMI(index + 1);
+          }
+        }
+        break;
+      case kSmallIntegerEquality:
+        if (entry->IsMediumInteger() || entry->IsLargeInteger() ||
+            entry->IsFloat64()) {
+          return kFailure;  // May be equal to it.
+        }
+        break;
+      default:
+        UNREACHABLE();
+    }
+    index += width;
+    if (index == size) {
+      index = 0;
+    }
+  } while (index != start);
+  return kFailure;  // Full: let the collection report it.
 }
 
 
-DEFINE_PRIMITIVE(spawn) {
-  ASSERT(num_args == 1);
-  ByteArray message = static_cast<ByteArray>(I->Stack(0));
-  if (message->IsByteArray()) {
-    intptr_t length = message->Size();
-    uint8_t* data = reinterpret_cast<uint8_t*>(malloc(length));
-    memcpy(data, message->element_addr(0), length);
+// The empty slot that ends the probe from start, for adding a key known to
+// be absent, as when rehashing.
+DEFINE_PRIMITIVE(HashTable_emptySlot) {
+  ASSERT(num_args == 3);
+  Array table;
+  intptr_t start, width;
+  if (!HashTableArguments(I, 2, &table, &start, &width)) {
+    return kFailure;
+  }
+  intptr_t size = table->Size();
+  intptr_t index = start;
+  do {
+    if (table->element(index) == table) {
+      RETURN_SMI(index + 1);
+    }
+    index += width;
+    if (index == size) {
+      index = 0;
+    }
+  } while (index != start);
+  return kFailure;
+}
 
-    I->isolate()->Spawn(new IsolateMessage(ILLEGAL_PORT, data, length));
 
-    RETURN_SELF();
+DEFINE_PRIMITIVE(timerSchedule) {
+  ASSERT(num_args == 2);
+  SMI_ARGUMENT(id, 1);
+  MINT_ARGUMENT(deadline, 0);
+  if (!I->isolate()->loop()->timers()->Schedule(id, deadline)) {
+    return kFailure;
   }
+  RETURN_SELF();
+}
 
-  return kFailure;
+
+DEFINE_PRIMITIVE(timerCancel) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(id, 0);
+  I->isolate()->loop()->timers()->Cancel(id);
+  RETURN_SELF();
 }
 
 
-DEFINE_PRIMITIVE(send) {
+// Fills the array with the ids of the timers due by now, answering how many.
+DEFINE_PRIMITIVE(timerExpire) {
   ASSERT(num_args == 2);
-  MINT_ARGUMENT(port, 1);
-  ByteArray data = static_cast<ByteArray>(I->Stack(0));
-  if (!data->IsByteArray()) {
+  Array ids = static_cast<Array>(I->Stack(1));
+  MINT_ARGUMENT(now, 0);
+  if (!ids->IsArray()) {
     return kFailure;
   }
+  const intptr_t kBatch = 64;
+  intptr_t batch[kBatch];
+  intptr_t length = ids->Size();
+  if (length > kBatch) {
+    length = kBatch;
+  }
+  intptr_t count = I->isolate()->loop()->timers()->Expire(now, batch, length);
+  for (intptr_t i = 0; i < count; i++) {
+    ids->set_element(i, SmallInteger::New(batch[i]));
+  }
+  RETURN_SMI(count);
+}
 
-  intptr_t length = data->Size();
-  uint8_t* raw_data = reinterpret_cast<uint8_t*>(malloc(length));
-  memcpy(raw_data, data->element_addr(0), length);
-  IsolateMessage* message = new IsolateMessage(port, raw_data, length);
-  bool result = PortMap::PostMessage(message);
 
-  RETURN_BOOL(result);
+DEFINE_PRIMITIVE(timerNextWakeup) {
+  ASSERT(num_args == 0);
+  RETURN_MINT(I->isolate()->loop()->timers()->NextWakeup());
 }
 
 
@@ -2760,14 +4789,14 @@ DEFINE_PRIMITIVE(doPrimitiveWithArgs) {
 
   // TODO(rmacnak): We're repeating the accessor primitives in the interpreter
   // and here. We should invoke these uniformly.
-  if ((index & 256) != 0) {
+  if (Primitives::IsGetter(index)) {
     // Getter
     intptr_t offset = index & 255;
     ASSERT(callee_num_args == 0);
     ASSERT(receiver->IsRegularObject() || receiver->IsEphemeron());
     Object value = static_cast<RegularObject>(receiver)->slot(offset);
     RETURN(value);
-  } else if ((index & 512) != 0) {
+  } else if (Primitives::IsSetter(index)) {
     // Setter
     intptr_t offset = index & 255;
     ASSERT(callee_num_args == 1);
@@ -3019,82 +5048,749 @@ DEFINE_PRIMITIVE(ZXVmo_getSize) {
 #endif
 }
 
-DEFINE_PRIMITIVE(ZXVmo_setSize) {
-#if !defined(OS_FUCHSIA)
+DEFINE_PRIMITIVE(ZXVmo_setSize) {
+#if !defined(OS_FUCHSIA)
+  return kFailure;
+#else
+  ASSERT(num_args == 3);
+  SmallInteger vmo = static_cast<SmallInteger>(I->Stack(2));
+  if (!vmo->IsSmallInteger()) {
+    return kFailure;
+  }
+  SmallInteger size = static_cast<SmallInteger>(I->Stack(1));
+  if (!size->IsSmallInteger() || size->value() < 0) {
+    return kFailure;
+  }
+  Array multiple_return = static_cast<Array>(I->Stack(0));
+  if (!multiple_return->IsArray() || (multiple_return->Size() < 2)) {
+    return kFailure;
+  }
+  zx_status_t status = zx_vmo_set_size(AsHandle(vmo), size->value());
+  RETURN_SMI(status);
+#endif
+}
+
+DEFINE_PRIMITIVE(ZXVmo_read) {
+#if !defined(OS_FUCHSIA)
+  return kFailure;
+#else
+  ASSERT(num_args == 4);
+  SmallInteger vmo = static_cast<SmallInteger>(I->Stack(3));
+  if (!vmo->IsSmallInteger()) {
+    return kFailure;
+  }
+  SmallInteger size = static_cast<SmallInteger>(I->Stack(2));
+  if (!size->IsSmallInteger() || size->value() < 0) {
+    return kFailure;
+  }
+  SmallInteger offset = static_cast<SmallInteger>(I->Stack(1));
+  if (!offset->IsSmallInteger() || offset->value() < 0) {
+    return kFailure;
+  }
+  Array multiple_return = static_cast<Array>(I->Stack(0));
+  if (!multiple_return->IsArray() || (multiple_return->Size() < 1)) {
+    return kFailure;
+  }
+  HandleScope h1(H, reinterpret_cast<Object*>(&multiple_return));
+  ByteArray buffer = H->AllocateByteArray(size->value());  // SAFEPOINT
+  zx_status_t status = zx_vmo_read(AsHandle(vmo), buffer->element_addr(0),
+                                   offset->value(), size->value());
+  multiple_return->set_element(0, buffer);
+  RETURN_SMI(status);
+#endif
+}
+
+DEFINE_PRIMITIVE(ZXVmo_write) {
+#if !defined(OS_FUCHSIA)
+  return kFailure;
+#else
+  ASSERT(num_args == 4);
+  SmallInteger vmo = static_cast<SmallInteger>(I->Stack(3));
+  if (!vmo->IsSmallInteger()) {
+    return kFailure;
+  }
+  ByteArray buffer = static_cast<ByteArray>(I->Stack(2));
+  if (!buffer->IsByteArray()) {
+    return kFailure;
+  }
+  SmallInteger offset = static_cast<SmallInteger>(I->Stack(1));
+  if (!offset->IsSmallInteger() || offset->value() < 0) {
+    return kFailure;
+  }
+  Array multiple_return = static_cast<Array>(I->Stack(0));
+  if (!multiple_return->IsArray() || (multiple_return->Size() < 1)) {
+    return kFailure;
+  }
+  zx_status_t status = zx_vmo_write(AsHandle(vmo), buffer->element_addr(0),
+                                    offset->value(), buffer->Size());
+  RETURN_SMI(status);
+#endif
+}
+
+DEFINE_PRIMITIVE(ZXVmo_map) {
+#if !defined(OS_FUCHSIA)
+  return kFailure;
+#else
+  ASSERT(num_args == 5);
+  SmallInteger vmo = static_cast<SmallInteger>(I->Stack(4));
+  if (!vmo->IsSmallInteger()) {
+    return kFailure;
+  }
+  SmallInteger offset = static_cast<SmallInteger>(I->Stack(3));
+  if (!offset->IsSmallInteger() || offset->value() < 0) {
+    return kFailure;
+  }
+  SmallInteger size = static_cast<SmallInteger>(I->Stack(2));
+  if (!size->IsSmallInteger() || size->value() < 0) {
+    return kFailure;
+  }
+  Object shared = I->Stack(1);
+  if ((shared != I->true_obj()) && (shared != I->false_obj())) {
+    return kFailure;
+  }
+  Array multiple_return = static_cast<Array>(I->Stack(0));
+  if (!multiple_return->IsArray() || (multiple_return->Size() < 1)) {
+    return kFailure;
+  }
+  HandleScope h1(H, reinterpret_cast<Object*>(&multiple_return));
+  ByteArray bytes;
+  zx_status_t status = H->AllocateMappedByteArray(
+      AsHandle(vmo), offset->value(), size->value(),
+      shared == I->true_obj(), &bytes);  // SAFEPOINT
+  if (status == ZX_OK) {
+    multiple_return->set_element(0, bytes);
+  }
+  RETURN_SMI(status);
+#endif
+}
+
+#if defined(OS_WINDOWS)
+// Only IOCPMessageLoop runs isolates on Windows.
+static IOCPMessageLoop* OverlappedLoop(Interpreter* I) {
+  return static_cast<IOCPMessageLoop*>(I->isolate()->loop());
+}
+
+static HANDLE AsHandle(int64_t handle) {
+  return reinterpret_cast<HANDLE>(static_cast<intptr_t>(handle));
+}
+#endif
+
+// The overlapped operations answer their id, whose completion is signaled, or
+// the negated Windows error.
+DEFINE_PRIMITIVE(Overlapped_read) {
+#if !defined(OS_WINDOWS)
+  return kFailure;
+#else
+  ASSERT(num_args == 3);
+  MINT_ARGUMENT(handle, 2);
+  SmallInteger size = static_cast<SmallInteger>(I->Stack(1));
+  if (!size->IsSmallInteger() || (size->value() < 0) ||
+      (size->value() > kMaxInt32)) {
+    return kFailure;
+  }
+  MINT_ARGUMENT(position, 0);
+  if (position < 0) {
+    return kFailure;
+  }
+  DWORD error = 0;
+  intptr_t id = OverlappedLoop(I)->StartRead(AsHandle(handle), size->value(),
+                                             position, &error);
+  RETURN_SMI(id < 0 ? -static_cast<intptr_t>(error) : id);
+#endif
+}
+
+DEFINE_PRIMITIVE(Overlapped_write) {
+#if !defined(OS_WINDOWS)
+  return kFailure;
+#else
+  ASSERT(num_args == 3);
+  MINT_ARGUMENT(handle, 2);
+  ByteArray bytes = static_cast<ByteArray>(I->Stack(1));
+  if (!bytes->IsByteArray() || (bytes->Size() > kMaxInt32)) {
+    return kFailure;
+  }
+  MINT_ARGUMENT(position, 0);
+  if (position < 0) {
+    return kFailure;
+  }
+  DWORD error = 0;
+  intptr_t id = OverlappedLoop(I)->StartWrite(AsHandle(handle),
+                                              bytes->element_addr(0),
+                                              bytes->Size(), position, &error);
+  RETURN_SMI(id < 0 ? -static_cast<intptr_t>(error) : id);
+#endif
+}
+
+DEFINE_PRIMITIVE(Overlapped_accept) {
+#if !defined(OS_WINDOWS)
+  return kFailure;
+#else
+  ASSERT(num_args == 1);
+  MINT_ARGUMENT(listener, 0);
+  DWORD error = 0;
+  intptr_t id = OverlappedLoop(I)->StartAccept(static_cast<SOCKET>(listener),
+                                               &error);
+  RETURN_SMI(id < 0 ? -static_cast<intptr_t>(error) : id);
+#endif
+}
+
+// Of a completed operation, which is then freed: the bytes read, the count
+// written, the socket accepted or 0 once connected, or nil if it failed.
+DEFINE_PRIMITIVE(Overlapped_result) {
+#if !defined(OS_WINDOWS)
+  return kFailure;
+#else
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(id, 0);
+  IOCPMessageLoop* loop = OverlappedLoop(I);
+  OverlappedOperation* operation = loop->CompletedOperation(id);
+  if (operation == NULL) {
+    return kFailure;
+  }
+  if (operation->error() != 0) {
+    loop->FreeOperation(operation);
+    RETURN(I->nil_obj());
+  }
+  intptr_t transferred = operation->transferred();
+  switch (operation->kind()) {
+    case OverlappedOperation::kRead: {
+      ByteArray bytes = H->AllocateByteArray(transferred);  // SAFEPOINT
+      memcpy(bytes->element_addr(0), operation->buffer(), transferred);
+      loop->FreeOperation(operation);
+      RETURN(bytes);
+    }
+    case OverlappedOperation::kWrite:
+      loop->FreeOperation(operation);
+      RETURN_SMI(transferred);
+    case OverlappedOperation::kAccept: {
+      intptr_t accepted = static_cast<intptr_t>(operation->TakeAccepted());
+      loop->FreeOperation(operation);
+      RETURN_MINT(accepted);
+    }
+    case OverlappedOperation::kConnect:
+      loop->FreeOperation(operation);
+      RETURN_SMI(0);
+  }
+  UNREACHABLE();
+  return kFailure;
+#endif
+}
+
+#if !defined(OS_EMSCRIPTEN)
+// Sockets. On Windows their reads, writes, accepts and connects are
+// overlapped operations; elsewhere the socket is non-blocking and the
+// operations answer nil when they would block, to be tried again once the
+// socket's wait reports it ready.
+#if defined(OS_WINDOWS)
+typedef SOCKET NativeSocket;
+static intptr_t SocketError() { return WSAGetLastError(); }
+#else
+typedef int NativeSocket;
+static intptr_t SocketError() { return errno; }
+
+static bool WouldBlock(int error) {
+  return (error == EAGAIN) || (error == EWOULDBLOCK);
+}
+
+#if defined(MSG_NOSIGNAL)
+static const int kSendFlags = MSG_NOSIGNAL;
+#else
+static const int kSendFlags = 0;  // SO_NOSIGPIPE is set when opened.
+#endif
+#endif  // defined(OS_WINDOWS)
+
+// Only numeric IPv4 and IPv6 addresses: resolving a name would block.
+static bool ParseSocketAddress(Object address,
+                               intptr_t port,
+                               struct sockaddr_storage* storage,
+                               socklen_t* size) {
+  if (!address->IsString() || (port < 0) || (port > 65535)) {
+    return false;
+  }
+  String string = static_cast<String>(address);
+  char raw[INET6_ADDRSTRLEN];
+  if (string->Size() >= static_cast<intptr_t>(sizeof(raw))) {
+    return false;
+  }
+  memcpy(raw, string->element_addr(0), string->Size());
+  raw[string->Size()] = 0;
+
+  memset(storage, 0, sizeof(*storage));
+  struct sockaddr_in* in4 = reinterpret_cast<struct sockaddr_in*>(storage);
+  if (inet_pton(AF_INET, raw, &in4->sin_addr) == 1) {
+    in4->sin_family = AF_INET;
+    in4->sin_port = htons(static_cast<uint16_t>(port));
+    *size = sizeof(*in4);
+    return true;
+  }
+  struct sockaddr_in6* in6 = reinterpret_cast<struct sockaddr_in6*>(storage);
+  if (inet_pton(AF_INET6, raw, &in6->sin6_addr) == 1) {
+    in6->sin6_family = AF_INET6;
+    in6->sin6_port = htons(static_cast<uint16_t>(port));
+    *size = sizeof(*in6);
+    return true;
+  }
+  return false;
+}
+
+static intptr_t SocketAddressPort(const struct sockaddr_storage* storage) {
+  if (storage->ss_family == AF_INET6) {
+    return ntohs(
+        reinterpret_cast<const struct sockaddr_in6*>(storage)->sin6_port);
+  }
+  return ntohs(reinterpret_cast<const struct sockaddr_in*>(storage)->sin_port);
+}
+#endif  // !defined(OS_EMSCRIPTEN)
+
+// Family 4 or 6, and kind 0 for a stream or 1 for datagrams. Answers the
+// socket or the negated error.
+DEFINE_PRIMITIVE(Socket_open) {
+#if defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 2);
+  SMI_ARGUMENT(family, 1);
+  SMI_ARGUMENT(kind, 0);
+  int domain;
+  switch (family) {
+    case 4: domain = AF_INET; break;
+    case 6: domain = AF_INET6; break;
+    default: return kFailure;
+  }
+  int type;
+  switch (kind) {
+    case 0: type = SOCK_STREAM; break;
+    case 1: type = SOCK_DGRAM; break;
+    default: return kFailure;
+  }
+#if defined(OS_WINDOWS)
+  SOCKET result = WSASocketW(domain, type, 0, NULL, 0, WSA_FLAG_OVERLAPPED);
+  if (result == INVALID_SOCKET) {
+    RETURN_SMI(-SocketError());
+  }
+  RETURN_MINT(static_cast<int64_t>(result));
+#elif defined(SOCK_NONBLOCK)
+  int result = socket(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  RETURN_SMI(result == -1 ? -SocketError() : result);
+#else
+  int result = socket(domain, type, 0);
+  if (result == -1) {
+    RETURN_SMI(-SocketError());
+  }
+  int one = 1;
+  if ((fcntl(result, F_SETFL, O_NONBLOCK) == -1) ||
+      (fcntl(result, F_SETFD, FD_CLOEXEC) == -1) ||
+      (setsockopt(result, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one)) ==
+       -1)) {
+    intptr_t error = SocketError();
+    close(result);
+    RETURN_SMI(-error);
+  }
+  RETURN_SMI(result);
+#endif
+#endif
+}
+
+DEFINE_PRIMITIVE(Socket_bind) {
+#if defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 3);
+  MINT_ARGUMENT(fd, 2);
+  SMI_ARGUMENT(port, 0);
+  struct sockaddr_storage address;
+  socklen_t size;
+  if (!ParseSocketAddress(I->Stack(1), port, &address, &size)) {
+    return kFailure;
+  }
+  NativeSocket socket = static_cast<NativeSocket>(fd);
+  // So a listener can be restarted while its old connections linger.
+  int one = 1;
+  setsockopt(socket, SOL_SOCKET, SO_REUSEADDR,
+             reinterpret_cast<const char*>(&one), sizeof(one));
+  if (bind(socket, reinterpret_cast<struct sockaddr*>(&address), size) != 0) {
+    RETURN_SMI(-SocketError());
+  }
+  RETURN_SMI(0);
+#endif
+}
+
+DEFINE_PRIMITIVE(Socket_listen) {
+#if defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 2);
+  MINT_ARGUMENT(fd, 1);
+  SMI_ARGUMENT(backlog, 0);
+  if (listen(static_cast<NativeSocket>(fd), backlog) != 0) {
+    RETURN_SMI(-SocketError());
+  }
+  RETURN_SMI(0);
+#endif
+}
+
+// The accepted socket, non-blocking like the listener.
+DEFINE_PRIMITIVE(Socket_accept) {
+#if defined(OS_WINDOWS) || defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(fd, 0);
+  int result;
+  do {
+#if defined(SOCK_NONBLOCK)
+    result = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    result = accept(fd, NULL, NULL);
+#endif
+  } while ((result == -1) && (errno == EINTR));
+  if (result == -1) {
+    if (WouldBlock(errno) || (errno == ECONNABORTED)) {
+      RETURN(nil);
+    }
+    RETURN_SMI(-errno);
+  }
+#if !defined(SOCK_NONBLOCK)
+  int one = 1;
+  fcntl(result, F_SETFL, O_NONBLOCK);
+  fcntl(result, F_SETFD, FD_CLOEXEC);
+  setsockopt(result, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+  RETURN_SMI(result);
+#endif
+}
+
+// Answers 0 once connected, or nil while connecting, when it should be tried
+// again once the socket is writable.
+DEFINE_PRIMITIVE(Socket_connect) {
+#if defined(OS_WINDOWS) || defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 3);
+  SMI_ARGUMENT(fd, 2);
+  SMI_ARGUMENT(port, 0);
+  struct sockaddr_storage address;
+  socklen_t size;
+  if (!ParseSocketAddress(I->Stack(1), port, &address, &size)) {
+    return kFailure;
+  }
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&address), size) == 0) {
+    RETURN_SMI(0);
+  }
+  switch (errno) {
+    case EISCONN:
+      RETURN_SMI(0);
+    case EINPROGRESS:
+    case EALREADY:
+    case EINTR:  // The connection continues asynchronously.
+      RETURN(nil);
+    default:
+      RETURN_SMI(-errno);
+  }
+#endif
+}
+
+// The error left by an asynchronous connect, or 0.
+DEFINE_PRIMITIVE(Socket_error) {
+#if defined(OS_WINDOWS) || defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(fd, 0);
+  int error = 0;
+  socklen_t size = sizeof(error);
+  if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &size) != 0) {
+    RETURN_SMI(errno);
+  }
+  RETURN_SMI(error);
+#endif
+}
+
+// Answers the bytes read, 0 at the end, or nil if none are ready.
+DEFINE_PRIMITIVE(Socket_read) {
+#if defined(OS_WINDOWS) || defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 4);
+  SMI_ARGUMENT(fd, 3);
+  ByteArray buffer = static_cast<ByteArray>(I->Stack(2));
+  if (!buffer->IsByteArray()) {
+    return kFailure;
+  }
+  SMI_ARGUMENT(start, 1);
+  SMI_ARGUMENT(count, 0);
+  if (start <= 0 || count < 0 || start - 1 + count > buffer->Size()) {
+    return kFailure;
+  }
+  ssize_t result;
+  do {
+    result = recv(fd, buffer->element_addr(start - 1), count, 0);
+  } while (result == -1 && errno == EINTR);
+  if (result == -1) {
+    if (WouldBlock(errno)) {
+      RETURN(nil);
+    }
+    RETURN_SMI(-errno);
+  }
+  RETURN_SMI(result);
+#endif
+}
+
+// Answers the bytes written, or nil if there is no room for any.
+DEFINE_PRIMITIVE(Socket_write) {
+#if defined(OS_WINDOWS) || defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 4);
+  SMI_ARGUMENT(fd, 3);
+  Bytes bytes = static_cast<Bytes>(I->Stack(2));
+  if (!bytes->IsBytes()) {
+    return kFailure;
+  }
+  SMI_ARGUMENT(start, 1);
+  SMI_ARGUMENT(count, 0);
+  if (start <= 0 || count < 0 || start - 1 + count > bytes->Size()) {
+    return kFailure;
+  }
+  ssize_t result;
+  do {
+    result = send(fd, bytes->element_addr(start - 1), count, kSendFlags);
+  } while (result == -1 && errno == EINTR);
+  if (result == -1) {
+    if (WouldBlock(errno)) {
+      RETURN(nil);
+    }
+    RETURN_SMI(-errno);
+  }
+  RETURN_SMI(result);
+#endif
+}
+
+// Writes an Array of ByteArrays and Strings as one, after skipping the bytes
+// already written, in one system call. Answers as Socket_write.
+DEFINE_PRIMITIVE(Socket_writev) {
+#if defined(OS_WINDOWS) || defined(OS_EMSCRIPTEN)
   return kFailure;
 #else
   ASSERT(num_args == 3);
-  SmallInteger vmo = static_cast<SmallInteger>(I->Stack(2));
-  if (!vmo->IsSmallInteger()) {
+  SMI_ARGUMENT(fd, 2);
+  Array buffers = static_cast<Array>(I->Stack(1));
+  if (!buffers->IsArray()) {
     return kFailure;
   }
-  SmallInteger size = static_cast<SmallInteger>(I->Stack(1));
-  if (!size->IsSmallInteger() || size->value() < 0) {
+  SMI_ARGUMENT(skip, 0);
+  if (skip < 0) {
     return kFailure;
   }
-  Array multiple_return = static_cast<Array>(I->Stack(0));
-  if (!multiple_return->IsArray() || (multiple_return->Size() < 2)) {
+  // Any more are written by a later call.
+  static const intptr_t kMaxGather = 64;
+  struct iovec gather[kMaxGather];
+  intptr_t num_gathered = 0;
+  for (intptr_t i = 0; i < buffers->Size(); i++) {
+    Bytes bytes = static_cast<Bytes>(buffers->element(i));
+    if (!bytes->IsBytes()) {
+      return kFailure;
+    }
+    intptr_t size = bytes->Size();
+    if (skip >= size) {
+      skip -= size;
+      continue;
+    }
+    if (num_gathered < kMaxGather) {
+      gather[num_gathered].iov_base = bytes->element_addr(skip);
+      gather[num_gathered].iov_len = size - skip;
+      num_gathered++;
+    }
+    skip = 0;
+  }
+  if (skip != 0) {
     return kFailure;
   }
-  zx_status_t status = zx_vmo_set_size(AsHandle(vmo), size->value());
-  RETURN_SMI(status);
+  if (num_gathered == 0) {
+    RETURN_SMI(0);
+  }
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = gather;
+  message.msg_iovlen = num_gathered;
+  ssize_t result;
+  do {
+    result = sendmsg(fd, &message, kSendFlags);
+  } while (result == -1 && errno == EINTR);
+  if (result == -1) {
+    if (WouldBlock(errno)) {
+      RETURN(nil);
+    }
+    RETURN_SMI(-errno);
+  }
+  RETURN_SMI(result);
 #endif
 }
 
-DEFINE_PRIMITIVE(ZXVmo_read) {
-#if !defined(OS_FUCHSIA)
+// A datagram to the address and port. Answers as Socket_write.
+DEFINE_PRIMITIVE(Socket_sendTo) {
+#if defined(OS_WINDOWS) || defined(OS_EMSCRIPTEN)
   return kFailure;
 #else
-  ASSERT(num_args == 4);
-  SmallInteger vmo = static_cast<SmallInteger>(I->Stack(3));
-  if (!vmo->IsSmallInteger()) {
+  ASSERT(num_args == 6);
+  SMI_ARGUMENT(fd, 5);
+  Bytes bytes = static_cast<Bytes>(I->Stack(4));
+  if (!bytes->IsBytes()) {
     return kFailure;
   }
-  SmallInteger size = static_cast<SmallInteger>(I->Stack(2));
-  if (!size->IsSmallInteger() || size->value() < 0) {
+  SMI_ARGUMENT(start, 3);
+  SMI_ARGUMENT(count, 2);
+  if (start <= 0 || count < 0 || start - 1 + count > bytes->Size()) {
     return kFailure;
   }
-  SmallInteger offset = static_cast<SmallInteger>(I->Stack(1));
-  if (!offset->IsSmallInteger() || offset->value() < 0) {
+  SMI_ARGUMENT(port, 0);
+  struct sockaddr_storage address;
+  socklen_t size;
+  if (!ParseSocketAddress(I->Stack(1), port, &address, &size)) {
     return kFailure;
   }
-  Array multiple_return = static_cast<Array>(I->Stack(0));
-  if (!multiple_return->IsArray() || (multiple_return->Size() < 1)) {
-    return kFailure;
+  ssize_t result;
+  do {
+    result = sendto(fd, bytes->element_addr(start - 1), count, kSendFlags,
+                    reinterpret_cast<struct sockaddr*>(&address), size);
+  } while (result == -1 && errno == EINTR);
+  if (result == -1) {
+    if (WouldBlock(errno)) {
+      RETURN(nil);
+    }
+    RETURN_SMI(-errno);
   }
-  HandleScope h1(H, reinterpret_cast<Object*>(&multiple_return));
-  ByteArray buffer = H->AllocateByteArray(size->value());  // SAFEPOINT
-  zx_status_t status = zx_vmo_read(AsHandle(vmo), buffer->element_addr(0),
-                                   offset->value(), size->value());
-  multiple_return->set_element(0, buffer);
-  RETURN_SMI(status);
+  RETURN_SMI(result);
 #endif
 }
 
-DEFINE_PRIMITIVE(ZXVmo_write) {
-#if !defined(OS_FUCHSIA)
+// A datagram, whose sender's address and port are put in the multiple return.
+// Answers as Socket_read.
+DEFINE_PRIMITIVE(Socket_receiveFrom) {
+#if defined(OS_WINDOWS) || defined(OS_EMSCRIPTEN)
   return kFailure;
 #else
-  ASSERT(num_args == 4);
-  SmallInteger vmo = static_cast<SmallInteger>(I->Stack(3));
-  if (!vmo->IsSmallInteger()) {
-    return kFailure;
-  }
-  ByteArray buffer = static_cast<ByteArray>(I->Stack(2));
+  ASSERT(num_args == 5);
+  SMI_ARGUMENT(fd, 4);
+  ByteArray buffer = static_cast<ByteArray>(I->Stack(3));
   if (!buffer->IsByteArray()) {
     return kFailure;
   }
-  SmallInteger offset = static_cast<SmallInteger>(I->Stack(1));
-  if (!offset->IsSmallInteger() || offset->value() < 0) {
+  SMI_ARGUMENT(start, 2);
+  SMI_ARGUMENT(count, 1);
+  if (start <= 0 || count < 0 || start - 1 + count > buffer->Size()) {
     return kFailure;
   }
   Array multiple_return = static_cast<Array>(I->Stack(0));
-  if (!multiple_return->IsArray() || (multiple_return->Size() < 1)) {
+  if (!multiple_return->IsArray() || (multiple_return->Size() < 2)) {
     return kFailure;
   }
-  zx_status_t status = zx_vmo_write(AsHandle(vmo), buffer->element_addr(0),
-                                    offset->value(), buffer->Size());
-  RETURN_SMI(status);
+  struct sockaddr_storage address;
+  socklen_t size = sizeof(address);
+  ssize_t result;
+  do {
+    result = recvfrom(fd, buffer->element_addr(start - 1), count, 0,
+                      reinterpret_cast<struct sockaddr*>(&address), &size);
+  } while (result == -1 && errno == EINTR);
+  if (result == -1) {
+    if (WouldBlock(errno)) {
+      RETURN(nil);
+    }
+    RETURN_SMI(-errno);
+  }
+  char raw[INET6_ADDRSTRLEN];
+  const void* host;
+  if (address.ss_family == AF_INET6) {
+    host = &reinterpret_cast<struct sockaddr_in6*>(&address)->sin6_addr;
+  } else {
+    host = &reinterpret_cast<struct sockaddr_in*>(&address)->sin_addr;
+  }
+  if (inet_ntop(address.ss_family, host, raw, sizeof(raw)) == NULL) {
+    raw[0] = 0;
+  }
+  intptr_t length = strlen(raw);
+  HandleScope h1(H, reinterpret_cast<Object*>(&multiple_return));
+  String string = H->AllocateString(length);  // SAFEPOINT
+  memcpy(string->element_addr(0), raw, length);
+  multiple_return->set_element(0, string);
+  intptr_t port = SocketAddressPort(&address);
+  multiple_return->set_element(1, SmallInteger::New(port));
+  RETURN_SMI(result);
+#endif
+}
+
+// The port the socket is bound to, as chosen for port 0.
+DEFINE_PRIMITIVE(Socket_localPort) {
+#if defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 1);
+  MINT_ARGUMENT(fd, 0);
+  struct sockaddr_storage address;
+  socklen_t size = sizeof(address);
+  if (getsockname(static_cast<NativeSocket>(fd),
+                  reinterpret_cast<struct sockaddr*>(&address), &size) != 0) {
+    RETURN_SMI(-SocketError());
+  }
+  RETURN_SMI(SocketAddressPort(&address));
+#endif
+}
+
+DEFINE_PRIMITIVE(Socket_close) {
+#if defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 1);
+  MINT_ARGUMENT(fd, 0);
+#if defined(OS_WINDOWS)
+  intptr_t result = closesocket(static_cast<SOCKET>(fd)) != 0 ? -SocketError()
+                                                              : 0;
+#else
+  // Not retried on EINTR: the descriptor is released either way.
+  intptr_t result = close(fd) == -1 ? -errno : 0;
+#endif
+  RETURN_SMI(result);
+#endif
+}
+
+// As MessageLoop_awaitSignal, with the read and write signals the POSIX loops
+// take, for a socket on any of them.
+DEFINE_PRIMITIVE(Socket_await) {
+#if defined(OS_WINDOWS) || defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  ASSERT(num_args == 2);
+  SMI_ARGUMENT(fd, 1);
+  SMI_ARGUMENT(signals, 0);
+#if defined(OS_FUCHSIA)
+  FuchsiaMessageLoop* loop =
+      static_cast<FuchsiaMessageLoop*>(I->isolate()->loop());
+  intptr_t wait_id = loop->AwaitDescriptor(fd, signals);
+#else
+  intptr_t wait_id = I->isolate()->loop()->AwaitSignal(fd, signals);
+#endif
+  RETURN_SMI(wait_id);
+#endif
+}
+
+// Answers the id of the connect operation, as Overlapped_read does.
+DEFINE_PRIMITIVE(Overlapped_connect) {
+#if !defined(OS_WINDOWS)
+  return kFailure;
+#else
+  ASSERT(num_args == 3);
+  MINT_ARGUMENT(socket, 2);
+  SMI_ARGUMENT(port, 0);
+  struct sockaddr_storage address;
+  socklen_t size;
+  if (!ParseSocketAddress(I->Stack(1), port, &address, &size)) {
+    return kFailure;
+  }
+  DWORD error = 0;
+  intptr_t id = OverlappedLoop(I)->StartConnect(
+      static_cast<SOCKET>(socket),
+      reinterpret_cast<struct sockaddr*>(&address), size, &error);
+  RETURN_SMI(id < 0 ? -static_cast<intptr_t>(error) : id);
 #endif
 }
 
@@ -3279,6 +5975,240 @@ EM_JS(bool, _JS_performHas, (), {
     return false;
   }
 });
+
+// A batch is a sequence of operations run in one call into JavaScript. Each
+// pushes onto a stack of its own, or pops its inputs from it and records a
+// result.
+enum BatchOp {
+  kBatchPushValue = 0,  // The next operand.
+  kBatchPushAlien,  // Of the next operand's index.
+  kBatchPushResult,  // Of the next operand's index.
+  kBatchGet,  // receiver key
+  kBatchSet,  // receiver key value
+  kBatchDelete,  // receiver key
+  kBatchHas,  // receiver key
+  kBatchInstanceOf,  // receiver constructor
+  kBatchInvoke,  // receiver selector arguments..., count in the next byte
+  kBatchNew,  // constructor arguments..., count in the next byte
+};
+
+// How the operands and results cross, each a tag byte and then its payload,
+// unaligned and little-endian.
+enum BatchTag {
+  kBatchAlien = 0,  // int32 index, 0 for undefined
+  kBatchNull,
+  kBatchFalse,
+  kBatchTrue,
+  kBatchInt32,
+  kBatchFloat64,
+  kBatchString,  // int32 length, then UTF-8
+};
+
+// Answers the results, malloced, or 0 with the exception pushed.
+EM_JS(intptr_t, _JS_performBatch, (intptr_t code, intptr_t code_size,
+                                   intptr_t operands, intptr_t num_results), {
+  var aliens = Module.aliens;
+  var view = new DataView(HEAPU8.buffer);
+  var position = operands;
+  function operand() {
+    var tag = HEAPU8[position++];
+    var value;
+    if (0 === tag) {
+      value = aliens[view.getInt32(position, true)];
+      position += 4;
+    } else if (1 === tag) {
+      value = null;
+    } else if (2 === tag) {
+      value = false;
+    } else if (3 === tag) {
+      value = true;
+    } else if (4 === tag) {
+      value = view.getInt32(position, true);
+      position += 4;
+    } else if (5 === tag) {
+      value = view.getFloat64(position, true);
+      position += 8;
+    } else {
+      var length = view.getInt32(position, true);
+      value = UTF8ToString(position + 4, length);
+      position += 4 + length;
+    }
+    return value;
+  }
+  function popArguments(count) {
+    var args = new Array(count);
+    for (var i = count - 1; i >= 0; i--) {
+      args[i] = stack.pop();
+    }
+    return args;
+  }
+
+  var stack = new Array();
+  var results = new Array();
+  try {
+    for (var pc = code; pc < code + code_size; pc++) {
+      var op = HEAPU8[pc];
+      var receiver, key, value, args;
+      if (0 === op) {
+        stack.push(operand());
+      } else if (1 === op) {
+        stack.push(aliens[operand()]);
+      } else if (2 === op) {
+        stack.push(results[operand()]);
+      } else if (3 === op) {
+        key = stack.pop();
+        receiver = stack.pop();
+        results.push(Reflect.get(receiver, key));
+      } else if (4 === op) {
+        value = stack.pop();
+        key = stack.pop();
+        receiver = stack.pop();
+        Reflect.set(receiver, key, value);
+        results.push(value);
+      } else if (5 === op) {
+        key = stack.pop();
+        receiver = stack.pop();
+        results.push(Reflect.deleteProperty(receiver, key));
+      } else if (6 === op) {
+        key = stack.pop();
+        receiver = stack.pop();
+        results.push(Reflect.has(receiver, key));
+      } else if (7 === op) {
+        value = stack.pop();
+        receiver = stack.pop();
+        results.push(receiver instanceof value);
+      } else if (8 === op) {
+        args = popArguments(HEAPU8[++pc]);
+        key = stack.pop();
+        receiver = stack.pop();
+        if ((undefined === receiver) || (undefined === receiver[key])) {
+          throw "NoSuchMethod: " + key;
+        }
+        results.push(Reflect.apply(receiver[key], receiver, args));
+      } else if (9 === op) {
+        args = popArguments(HEAPU8[++pc]);
+        receiver = stack.pop();
+        results.push(Reflect.construct(receiver, args));
+      } else {
+        throw "Bad batch operation: " + op;
+      }
+    }
+    if (results.length !== num_results) {
+      throw "Batch has " + results.length + " results, not " + num_results;
+    }
+  } catch (exception) {
+    aliens.push(exception);
+    return 0;
+  }
+
+  var size = 1;  // For the NUL after the last string.
+  for (var i = 0; i < results.length; i++) {
+    var result = results[i];
+    if ((null === result) || (false === result) || (true === result)) {
+      size += 1;
+    } else if (typeof result === "number") {
+      size += (result === (0 | result)) ? 5 : 9;
+    } else if (typeof result === "string") {
+      size += 5 + lengthBytesUTF8(result);
+    } else {
+      size += 5;
+    }
+  }
+  var out = _malloc(size);
+  view = new DataView(HEAPU8.buffer);  // Which the malloc may have grown.
+  position = out;
+  for (var i = 0; i < results.length; i++) {
+    var result = results[i];
+    if (null === result) {
+      HEAPU8[position++] = 1;
+    } else if (false === result) {
+      HEAPU8[position++] = 2;
+    } else if (true === result) {
+      HEAPU8[position++] = 3;
+    } else if (typeof result === "number") {
+      if (result === (0 | result)) {
+        HEAPU8[position++] = 4;
+        view.setInt32(position, result, true);
+        position += 4;
+      } else {
+        HEAPU8[position++] = 5;
+        view.setFloat64(position, result, true);
+        position += 8;
+      }
+    } else if (typeof result === "string") {
+      var length = lengthBytesUTF8(result);
+      HEAPU8[position++] = 6;
+      view.setInt32(position, length, true);
+      stringToUTF8(result, position + 4, length + 1);
+      position += 4 + length;
+    } else {
+      var index = 0;
+      if (undefined !== result) {
+        index = aliens.length;
+        aliens.push(result);
+      }
+      HEAPU8[position++] = 0;
+      view.setInt32(position, index, true);
+      position += 4;
+    }
+  }
+  return out;
+});
+
+// Fails the batch as a JavaScript exception would, with a message for it.
+static void PushBatchError(const char* message) {
+  _JS_pushString(reinterpret_cast<intptr_t>(message), strlen(message));
+}
+
+static intptr_t BatchValueSize(Object value, Interpreter* I) {
+  if (value->IsSmallInteger() || value->IsMediumInteger()) {
+    return 9;  // Or 5, as an int32.
+  }
+  if (value->IsFloat64()) {
+    return 9;
+  }
+  if (value->IsString()) {
+    return 5 + static_cast<String>(value)->Size();
+  }
+  if ((value == I->nil_obj()) || (value == I->false_obj()) ||
+      (value == I->true_obj())) {
+    return 1;
+  }
+  return -1;
+}
+
+static uint8_t* WriteBatchValue(uint8_t* out, Object value, Interpreter* I) {
+  double number;
+  if (value->IsSmallInteger() || value->IsMediumInteger()) {
+    int64_t integer = value->IsSmallInteger()
+        ? static_cast<SmallInteger>(value)->value()
+        : static_cast<MediumInteger>(value)->value();
+    if ((integer >= kMinInt32) && (integer <= kMaxInt32)) {
+      int32_t int32 = static_cast<int32_t>(integer);
+      *out++ = kBatchInt32;
+      memcpy(out, &int32, sizeof(int32));
+      return out + sizeof(int32);
+    }
+    number = static_cast<double>(integer);
+  } else if (value->IsFloat64()) {
+    number = static_cast<Float64>(value)->value();
+  } else if (value->IsString()) {
+    String string = static_cast<String>(value);
+    int32_t length = static_cast<int32_t>(string->Size());
+    *out++ = kBatchString;
+    memcpy(out, &length, sizeof(length));
+    out += sizeof(length);
+    memcpy(out, string->element_addr(0), length);
+    return out + length;
+  } else {
+    *out++ = (value == I->nil_obj()) ? kBatchNull
+           : (value == I->false_obj()) ? kBatchFalse : kBatchTrue;
+    return out;
+  }
+  *out++ = kBatchFloat64;
+  memcpy(out, &number, sizeof(number));
+  return out + sizeof(number);
+}
 #endif  // defined(OS_EMSCRIPTEN)
 
 DEFINE_PRIMITIVE(JS_pushValue) {
@@ -3480,6 +6410,278 @@ DEFINE_PRIMITIVE(JS_performHas) {
 #endif
 }
 
+DEFINE_PRIMITIVE(JS_performBatch) {
+#if !defined(OS_EMSCRIPTEN)
+  return kFailure;
+#else
+  // code operands results kinds, filling results and marking in kinds those
+  // that are alien indices.
+  ASSERT(num_args == 4);
+  if (!I->Stack(3)->IsByteArray() || !I->Stack(2)->IsArray() ||
+      !I->Stack(1)->IsArray() || !I->Stack(0)->IsByteArray() ||
+      (static_cast<Array>(I->Stack(1))->Size() !=
+       static_cast<ByteArray>(I->Stack(0))->Size())) {
+    PushBatchError("Malformed batch");
+    return kFailure;
+  }
+  ByteArray code = static_cast<ByteArray>(I->Stack(3));
+  Array operands = static_cast<Array>(I->Stack(2));
+  intptr_t num_results = static_cast<Array>(I->Stack(1))->Size();
+
+  intptr_t size = 0;
+  for (intptr_t i = 0; i < operands->Size(); i++) {
+    intptr_t value_size = BatchValueSize(operands->element(i), I);
+    if (value_size < 0) {
+      PushBatchError("Batches pass only numbers, strings, booleans and nil");
+      return kFailure;
+    }
+    size += value_size;
+  }
+  uint8_t* encoded = reinterpret_cast<uint8_t*>(malloc(size + 1));
+  uint8_t* out = encoded;
+  for (intptr_t i = 0; i < operands->Size(); i++) {
+    out = WriteBatchValue(out, operands->element(i), I);
+  }
+  ASSERT(out <= encoded + size);
+  uint8_t* results = reinterpret_cast<uint8_t*>(_JS_performBatch(
+      reinterpret_cast<intptr_t>(code->element_addr(0)), code->Size(),
+      reinterpret_cast<intptr_t>(encoded), num_results));
+  free(encoded);
+  if (results == NULL) {
+    return kFailure;
+  }
+
+  // Re-read from the stack after each allocation, which may move them.
+  const uint8_t* in = results;
+  for (intptr_t i = 0; i < num_results; i++) {
+    uint8_t tag = *in++;
+    Object value;
+    bool alien = false;
+    if (tag == kBatchNull) {
+      value = I->nil_obj();
+    } else if (tag == kBatchFalse) {
+      value = I->false_obj();
+    } else if (tag == kBatchTrue) {
+      value = I->true_obj();
+    } else if (tag == kBatchFloat64) {
+      double number;
+      memcpy(&number, in, sizeof(number));
+      in += sizeof(number);
+      Float64 result = H->AllocateFloat64();  // SAFEPOINT
+      result->set_value(number);
+      value = result;
+    } else if (tag == kBatchString) {
+      int32_t length;
+      memcpy(&length, in, sizeof(length));
+      in += sizeof(length);
+      String result = H->AllocateString(length);  // SAFEPOINT
+      memcpy(result->element_addr(0), in, length);
+      in += length;
+      value = result;
+    } else {
+      ASSERT((tag == kBatchAlien) || (tag == kBatchInt32));
+      int32_t int32;
+      memcpy(&int32, in, sizeof(int32));
+      in += sizeof(int32);
+      if (SmallInteger::IsSmiValue(static_cast<intptr_t>(int32))) {
+        value = SmallInteger::New(int32);
+      } else {
+        MediumInteger result = H->AllocateMediumInteger();  // SAFEPOINT
+        result->set_value(int32);
+        value = result;
+      }
+      alien = (tag == kBatchAlien);
+    }
+    static_cast<Array>(I->Stack(1))->set_element(i, value);
+    static_cast<ByteArray>(I->Stack(0))->set_element(i, alien ? 1 : 0);
+  }
+  free(results);
+  RETURN_SELF();
+#endif
+}
+
+DEFINE_PRIMITIVE(lookupCacheStatistic) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(index, 0);
+  if ((index < 0) || (index >= LookupCache::kNumStatistics)) {
+    return kFailure;
+  }
+  int64_t value = I->lookup_cache()->StatisticAt(
+      static_cast<LookupCache::Statistic>(index));
+  RETURN_MINT(value);
+}
+
+DEFINE_PRIMITIVE(lookupCacheResize) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(size, 0);
+  if (size <= 0) {
+    return kFailure;
+  }
+  I->lookup_cache()->Resize(size);
+  RETURN_SELF();
+}
+
+DEFINE_PRIMITIVE(gcTraceCapacity) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(capacity, 0);
+  if ((capacity < 0) || (capacity > GCTrace::kMaxCapacity)) {
+    return kFailure;
+  }
+  H->trace()->SetCapacity(capacity);
+  RETURN_SELF();
+}
+
+DEFINE_PRIMITIVE(gcPauseStatistic) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(index, 0);
+  if (index == 0) {
+    RETURN_MINT(H->trace()->pauses());
+  } else if (index == 1) {
+    RETURN_MINT(H->trace()->pause_nanos());
+  }
+  return kFailure;
+}
+
+DEFINE_PRIMITIVE(gcTraceEvents) {
+  ASSERT(num_args == 0);
+  intptr_t length;
+  char* json = H->trace()->TakeJSON(&length);  // Before the GC below adds any.
+  String result = H->AllocateString(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), json, length);
+  free(json);
+  RETURN(result);
+}
+
+DEFINE_PRIMITIVE(messageTraceCapacity) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(capacity, 0);
+  if ((capacity < 0) || (capacity > MessageTrace::kMaxCapacity)) {
+    return kFailure;
+  }
+  I->isolate()->loop()->message_trace()->SetCapacity(capacity);
+  RETURN_SELF();
+}
+
+DEFINE_PRIMITIVE(messageTraceEvents) {
+  ASSERT(num_args == 0);
+  intptr_t length;
+  char* json = I->isolate()->loop()->message_trace()->TakeJSON(&length);
+  String result = H->AllocateString(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), json, length);
+  free(json);
+  RETURN(result);
+}
+
+// Answers the budget replaced, so that a caller can restore it.
+DEFINE_PRIMITIVE(messageBudget) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(budget, 0);
+  if (budget < 0) {
+    return kFailure;
+  }
+  MessageLoop* loop = I->isolate()->loop();
+  intptr_t previous = loop->message_budget();
+  loop->set_message_budget(budget);
+  RETURN_SMI(previous);
+}
+
+DEFINE_PRIMITIVE(profileInterval) {
+  ASSERT(num_args == 1);
+#if defined(OS_EMSCRIPTEN)
+  return kFailure;  // No thread to sample from.
+#else
+  SMI_ARGUMENT(interval, 0);
+  if ((interval < 0) ||
+      ((interval > 0) && (interval < Profiler::kMinInterval))) {
+    return kFailure;
+  }
+  I->profiler()->SetInterval(interval);
+  RETURN_SELF();
+#endif
+}
+
+DEFINE_PRIMITIVE(profileSamples) {
+  ASSERT(num_args == 0);
+  intptr_t length;
+  char* folded = I->profiler()->TakeFolded(&length);
+  String result = H->AllocateString(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), folded, length);
+  free(folded);
+  RETURN(result);
+}
+
+DEFINE_PRIMITIVE(allocationSampleInterval) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(interval, 0);
+  if ((interval < 0) ||
+      ((interval > 0) && (interval < AllocationProfiler::kMinInterval))) {
+    return kFailure;
+  }
+  H->SetAllocationSampleInterval(interval);
+  RETURN_SELF();
+}
+
+static String AllocationProfile(Heap* H, bool by_site) {
+  intptr_t length;
+  char* text = by_site ? H->allocation_profiler()->PrintSites(&length)
+                       : H->allocation_profiler()->PrintSummary(&length);
+  String result = H->AllocateString(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), text, length);
+  free(text);
+  return result;
+}
+
+DEFINE_PRIMITIVE(allocationSummary) {
+  ASSERT(num_args == 0);
+  RETURN(AllocationProfile(H, false));
+}
+
+DEFINE_PRIMITIVE(allocationSites) {
+  ASSERT(num_args == 0);
+  RETURN(AllocationProfile(H, true));
+}
+
+DEFINE_PRIMITIVE(writeHeapSnapshot) {
+  ASSERT(num_args == 1);
+  String path = static_cast<String>(I->Stack(0));
+  if (!path->IsString()) {
+    return kFailure;
+  }
+  char* raw_path = reinterpret_cast<char*>(malloc(path->Size() + 1));
+  memcpy(raw_path, path->element_addr(0), path->Size());
+  raw_path[path->Size()] = 0;
+  HeapSnapshot snapshot(H);
+  bool written = snapshot.WriteTo(raw_path);
+  free(raw_path);
+  if (!written) {
+    return kFailure;
+  }
+  RETURN_SELF();
+}
+
+DEFINE_PRIMITIVE(primitiveProfileEnabled) {
+  ASSERT(num_args == 1);
+  Object enabled = I->Stack(0);
+  if (enabled == I->true_obj()) {
+    I->primitive_profiler()->SetEnabled(true);
+  } else if (enabled == I->false_obj()) {
+    I->primitive_profiler()->SetEnabled(false);
+  } else {
+    return kFailure;
+  }
+  RETURN_SELF();
+}
+
+DEFINE_PRIMITIVE(primitiveProfile) {
+  ASSERT(num_args == 0);
+  intptr_t length;
+  char* text = I->primitive_profiler()->Print(&length);
+  String result = H->AllocateString(length);  // SAFEPOINT
+  memcpy(result->element_addr(0), text, length);
+  free(text);
+  RETURN(result);
+}
+
 DEFINE_PRIMITIVE(quickReturnSelf) {
   ASSERT(num_args == 0);
   return kSuccess;
@@ -3489,6 +6691,17 @@ DEFINE_PRIMITIVE(quickReturnSelf) {
 PrimitiveFunction** Primitives::primitive_table_ = NULL;
 
 
+const char* Primitives::Name(intptr_t prim) {
+  switch (prim) {
+#define PRIMITIVE_NAME(number, name)                                           \
+    case number: return #name;
+PRIMITIVE_LIST(PRIMITIVE_NAME);
+#undef PRIMITIVE_NAME
+    default: return NULL;
+  }
+}
+
+
 void Primitives::Startup() {
   primitive_table_ = new PrimitiveFunction*[kNumPrimitives];
   for (intptr_t i = 0; i < kNumPrimitives; i++) {
@@ -19,11 +19,22 @@ typedef bool (PrimitiveFunction)(intptr_t num_args,
 
 class Primitives {
  public:
+  // A method header's primitive field has 10 bits. It also holds the quick
+  // accessors, 256 + slot for a getter and 512 + slot for a setter, so the
+  // primitives proper are numbered below 256 and from 768.
+  static const intptr_t kNumPrimitives = 1024;
+
   static void Startup();
   static void Shutdown();
 
+  // The primitive's name as in the primitive list, or NULL if unused.
+  static const char* Name(intptr_t prim);
+
   static bool IsUnwindProtect(intptr_t prim) { return prim == 113; }
   static bool IsSimulationRoot(intptr_t prim) { return prim == 142; }
+  static bool IsExceptionHandler(intptr_t prim) { return prim == 116; }
+  static bool IsGetter(intptr_t prim) { return (prim & 768) == 256; }
+  static bool IsSetter(intptr_t prim) { return (prim & 768) == 512; }
 
   static bool Invoke(intptr_t prim,
                      intptr_t num_args,
@@ -36,8 +47,6 @@ class Primitives {
   }
 
  private:
-  static const intptr_t kNumPrimitives = 256;
-
   static PrimitiveFunction** primitive_table_;
 };
 
@@ -4,19 +4,32 @@
 
 #include "vm/primordial_soup.h"
 
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm/assert.h"
 #include "vm/flags.h"
 #include "vm/globals.h"
+#include "vm/heap.h"
+#include "vm/interpreter.h"
 #include "vm/isolate.h"
+#include "vm/log.h"
 #include "vm/message_loop.h"
 #include "vm/os.h"
+#include "vm/output.h"
 #include "vm/port.h"
 #include "vm/primitives.h"
+#include "vm/probes.h"
 #include "vm/snapshot.h"
 #include "vm/thread.h"
 
 PSOUP_EXTERN_C void PrimordialSoup_Startup() {
   psoup::OS::Startup();
+  psoup::Log::Startup();
+  psoup::OutputBuffer::Startup();
+  psoup::PerfMap::Startup();
   psoup::Primitives::Startup();
+  psoup::MessagePool::Startup();
   psoup::PortMap::Startup();
   psoup::Isolate::Startup();
 }
@@ -26,6 +39,9 @@ PSOUP_EXTERN_C void PrimordialSoup_Shutdown() {
   psoup::Isolate::Shutdown();
   psoup::PortMap::Shutdown();
   psoup::Primitives::Shutdown();
+  psoup::PerfMap::Shutdown();
+  psoup::OutputBuffer::Shutdown();
+  psoup::Log::Shutdown();
   psoup::OS::Shutdown();
 }
 
@@ -34,12 +50,69 @@ PSOUP_EXTERN_C intptr_t PrimordialSoup_RunIsolate(void* snapshot,
                                                   size_t snapshot_length,
                                                   int argc,
                                                   const char** argv) {
+  PrimordialSoup_IsolateOptions options;
+  PrimordialSoup_DefaultIsolateOptions(&options);
+  return PrimordialSoup_RunIsolateWithOptions(snapshot, snapshot_length,
+                                              &options, argc, argv);
+}
+
+
+PSOUP_EXTERN_C intptr_t PrimordialSoup_RunIsolateWithStack(
+    void* snapshot,
+    size_t snapshot_length,
+    size_t stack_size,
+    intptr_t max_stack_segments,
+    int argc,
+    const char** argv) {
+  PrimordialSoup_IsolateOptions options;
+  PrimordialSoup_DefaultIsolateOptions(&options);
+  options.stack_size = stack_size;
+  options.max_stack_segments = max_stack_segments;
+  return PrimordialSoup_RunIsolateWithOptions(snapshot, snapshot_length,
+                                              &options, argc, argv);
+}
+
+
+PSOUP_EXTERN_C void PrimordialSoup_DefaultIsolateOptions(
+    PrimordialSoup_IsolateOptions* options) {
+  options->stack_size = psoup::Interpreter::kDefaultStackSize;
+  options->max_stack_segments = 1;
+  options->scavenger_workers = 1;
+  options->initial_semispace_size = psoup::Heap::kInitialSemispaceCapacity;
+  options->max_semispace_size = psoup::Heap::kMaxSemispaceCapacity;
+  options->old_space_growth = psoup::Heap::kOldSpaceGrowth;
+  options->heap_limit = 0;
+  options->message_budget = psoup::MessageLoop::kDefaultMessageBudget;
+  options->mailbox_capacity = 0;
+  options->scheduler_workers = psoup::OS::NumberOfAvailableProcessors();
+  options->max_isolate_threads = 0;
+  options->warm_threads = 0;
+  options->cpu_affinity = NULL;
+  options->lookup_cache_size = 0;
+  options->time_slice = 0;
+  options->turn_quota = 0;
+  options->huge_pages = 0;
+}
+
+
+PSOUP_EXTERN_C intptr_t PrimordialSoup_RunIsolateWithOptions(
+    void* snapshot,
+    size_t snapshot_length,
+    const PrimordialSoup_IsolateOptions* options,
+    int argc,
+    const char** argv) {
+  bool confined = (options->cpu_affinity != NULL) &&
+                  psoup::OS::SetThreadAffinity(options->cpu_affinity, -1);
   uint64_t seed = psoup::OS::CurrentMonotonicNanos();
-  psoup::Isolate* isolate = new psoup::Isolate(snapshot, snapshot_length, seed);
+  psoup::Isolate* isolate = new psoup::Isolate(snapshot, snapshot_length, seed,
+                                               *options);
   isolate->loop()->PostMessage(new psoup::IsolateMessage(ILLEGAL_PORT,
                                                          argc, argv));
   intptr_t exit_code = isolate->loop()->Run();
   delete isolate;
+  if (confined) {
+    psoup::OS::SetThreadAffinity(NULL, -1);
+  }
   return exit_code;
 }
 
@@ -47,3 +120,125 @@ PSOUP_EXTERN_C intptr_t PrimordialSoup_RunIsolate(void* snapshot,
 PSOUP_EXTERN_C void PrimordialSoup_InterruptAll() {
   psoup::Isolate::InterruptAll();
 }
+
+
+struct PrimordialSoup_Snapshot {
+  void* data;
+  size_t length;
+};
+
+
+PSOUP_EXTERN_C PrimordialSoup_Snapshot* PrimordialSoup_LoadSnapshot(
+    const void* snapshot,
+    size_t snapshot_length) {
+  if (!psoup::Deserializer::IsSnapshot(snapshot, snapshot_length)) {
+    return NULL;
+  }
+  PrimordialSoup_Snapshot* result = new PrimordialSoup_Snapshot;
+  result->data = malloc(snapshot_length);
+  if (result->data == NULL) {
+    FATAL("Failed to allocate snapshot");
+  }
+  memcpy(result->data, snapshot, snapshot_length);
+  result->length = snapshot_length;
+  psoup::Isolate::PrepareSnapshot(result->data, result->length);
+  return result;
+}
+
+
+PSOUP_EXTERN_C void PrimordialSoup_ReleaseSnapshot(
+    PrimordialSoup_Snapshot* snapshot) {
+  psoup::Isolate::ForgetSnapshot(snapshot->data);
+  free(snapshot->data);
+  delete snapshot;
+}
+
+
+PSOUP_EXTERN_C intptr_t PrimordialSoup_RunIsolateFromSnapshot(
+    PrimordialSoup_Snapshot* snapshot,
+    const PrimordialSoup_IsolateOptions* options,
+    int argc,
+    const char** argv) {
+  return PrimordialSoup_RunIsolateWithOptions(snapshot->data, snapshot->length,
+                                              options, argc, argv);
+}
+
+
+PSOUP_EXTERN_C PrimordialSoup_Port PrimordialSoup_OpenPort(
+    PrimordialSoup_MessageHandler handler,
+    void* context) {
+  return psoup::PortMap::CreateHostPort(handler, context);
+}
+
+
+PSOUP_EXTERN_C bool PrimordialSoup_ClosePort(PrimordialSoup_Port port) {
+  return psoup::PortMap::CloseHostPort(port);
+}
+
+
+PSOUP_EXTERN_C void PrimordialSoup_StartIsolate(
+    PrimordialSoup_Snapshot* snapshot,
+    const PrimordialSoup_IsolateOptions* options,
+    PrimordialSoup_Port reply_port,
+    PrimordialSoup_ExitHandler on_exit,
+    void* context) {
+  psoup::Isolate::Start(snapshot->data, snapshot->length, *options,
+                        reply_port, on_exit, context);
+}
+
+
+PSOUP_EXTERN_C bool PrimordialSoup_IsolateUsageOf(
+    PrimordialSoup_Port port,
+    PrimordialSoup_IsolateUsage* usage) {
+  int64_t values[psoup::Isolate::kNumUsageStatistics];
+  if (!psoup::PortMap::ReadUsage(port, values)) {
+    return false;
+  }
+  psoup::Isolate::UsageFrom(values, usage);
+  return true;
+}
+
+
+PSOUP_EXTERN_C intptr_t PrimordialSoup_PostMessage(PrimordialSoup_Port port,
+                                                   const void* data,
+                                                   size_t length) {
+  psoup::IsolateMessage* message =
+      psoup::IsolateMessage::NewText(port, data, length);
+  return psoup::PortMap::PostMessage(message);
+}
+
+
+PSOUP_EXTERN_C intptr_t PrimordialSoup_PostBuffer(
+    PrimordialSoup_Port port,
+    const void* data,
+    size_t length,
+    PrimordialSoup_ReleaseHandler release,
+    void* context) {
+  psoup::IsolateMessage* message =
+      psoup::IsolateMessage::NewBorrowedText(port, data, length, release,
+                                             context);
+  return psoup::PortMap::PostMessage(message);
+}
+
+
+PSOUP_EXTERN_C size_t PrimordialSoup_PostMessages(
+    PrimordialSoup_Port port,
+    const PrimordialSoup_Message* messages,
+    size_t count) {
+  // Linked in reverse, so they are taken in order.
+  psoup::IsolateMessage* head = NULL;
+  for (size_t i = count; i > 0; i--) {
+    const PrimordialSoup_Message* m = &messages[i - 1];
+    psoup::IsolateMessage* message;
+    if (m->release == NULL) {
+      message = psoup::IsolateMessage::NewText(port, m->data, m->length);
+    } else {
+      message = psoup::IsolateMessage::NewBorrowedText(port, m->data,
+                                                       m->length, m->release,
+                                                       m->context);
+    }
+    message->set_next(head);
+    head = message;
+  }
+  return psoup::PortMap::PostMessages(head);
+}
@@ -7,6 +7,7 @@
 #ifndef VM_PRIMORDIAL_SOUP_H_
 #define VM_PRIMORDIAL_SOUP_H_
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -21,6 +22,248 @@ PSOUP_EXTERN_C void PrimordialSoup_Shutdown();
 PSOUP_EXTERN_C intptr_t PrimordialSoup_RunIsolate(void* snapshot,
                                                   size_t snapshot_length,
                                                   int argc, const char** argv);
+/*
+ * Like PrimordialSoup_RunIsolate, with an interpreter stack of stack_size
+ * bytes. With max_stack_segments above 1, a full stack grows by up to that
+ * many segments of stack_size bytes before its frames are moved to the heap.
+ * Isolates spawned by the isolate get the same stack.
+ */
+PSOUP_EXTERN_C intptr_t PrimordialSoup_RunIsolateWithStack(
+    void* snapshot,
+    size_t snapshot_length,
+    size_t stack_size,
+    intptr_t max_stack_segments,
+    int argc,
+    const char** argv);
+
+/*
+ * Per-isolate settings. Isolates spawned by an isolate get the same ones.
+ *
+ * stack_size and max_stack_segments are as for
+ * PrimordialSoup_RunIsolateWithStack.
+ *
+ * With scavenger_workers above 1, each scavenge of new space copies objects on
+ * up to that many threads, the isolate's own and helpers borrowed from the
+ * VM's thread pool.
+ *
+ * New space starts with two semispaces of initial_semispace_size bytes and
+ * doubles them, up to max_semispace_size, while much of it survives. After
+ * each full collection, old space may grow by old_space_growth percent of what
+ * survived before the next.
+ *
+ * With heap_limit above 0, full collections start early enough to keep the
+ * surviving old-space bytes and both semispaces within heap_limit bytes. When
+ * one cannot, or a single instantiation would not fit, the next instantiation
+ * fails and signals OutOfMemory in Newspeak, once per such collection.
+ *
+ * Each turn of an isolate's message loop hands up to message_budget of its
+ * pending messages to Newspeak at once, then checks for signals and timers
+ * before the rest. 0 means no limit.
+ *
+ * With mailbox_capacity above 0, a send to one of the isolate's ports while
+ * that many messages wait for it is dropped, and the sender told so.
+ *
+ * With scheduler_workers above 0, where supported, the isolates the first one
+ * spawns, and theirs, share that many threads instead of each holding one: a
+ * spawned isolate takes a thread only for a turn of its loop. 0 gives each
+ * isolate its own thread.
+ *
+ * With scheduler_workers 0 and max_isolate_threads above 0, at most that many
+ * spawned isolates hold threads at once. The isolates spawned beyond that wait
+ * for one to exit, and start in the order they were spawned. 0 means no limit.
+ * Up to warm_threads threads that have run isolates are kept idle for the next
+ * spawns, instead of exiting after a few seconds. These settings are shared
+ * by the VM and last set by the most recent spawn.
+ *
+ * With cpu_affinity, a list of CPUs and ranges such as "0-3,8", where
+ * supported, the isolate's thread, those of the isolates it spawns and the
+ * scheduler's workers run only on those CPUs. A heap whose threads are kept
+ * to one NUMA node takes its memory from that node. NULL leaves threads
+ * where the system puts them. The list must outlive the isolates.
+ *
+ * With lookup_cache_size above 0, the isolate's method lookup caches start
+ * with that many entries, rounded to a power of two within the caches'
+ * bounds, instead of growing to it from their default.
+ *
+ * With time_slice above 0, a turn of a spawned isolate on the scheduler that
+ * runs longer than that many microseconds yields its worker at the next
+ * backward jump or activation, and goes on after the other isolates waiting.
+ * With turn_quota above 0, a turn of any isolate that runs longer than that
+ * many microseconds, over all its slices, signals TimeQuotaExceeded in
+ * Newspeak there, and again for each further turn_quota it runs. Either is
+ * ignored below 100.
+ *
+ * With huge_pages nonzero, where supported, the isolate's heap takes its
+ * memory in chunks aligned to and backed by huge pages, for fewer TLB misses
+ * in large heaps at the cost of memory held in whole chunks.
+ */
+typedef struct {
+  size_t stack_size;
+  intptr_t max_stack_segments;
+  intptr_t scavenger_workers;
+  size_t initial_semispace_size;
+  size_t max_semispace_size;
+  intptr_t old_space_growth;
+  size_t heap_limit;
+  intptr_t message_budget;
+  intptr_t mailbox_capacity;
+  intptr_t scheduler_workers;
+  intptr_t max_isolate_threads;
+  intptr_t warm_threads;
+  const char* cpu_affinity;
+  intptr_t lookup_cache_size;
+  int64_t time_slice;
+  int64_t turn_quota;
+  intptr_t huge_pages;
+} PrimordialSoup_IsolateOptions;
+
+/* Fills in the settings PrimordialSoup_RunIsolate uses. */
+PSOUP_EXTERN_C void PrimordialSoup_DefaultIsolateOptions(
+    PrimordialSoup_IsolateOptions* options);
+PSOUP_EXTERN_C intptr_t PrimordialSoup_RunIsolateWithOptions(
+    void* snapshot,
+    size_t snapshot_length,
+    const PrimordialSoup_IsolateOptions* options,
+    int argc,
+    const char** argv);
 PSOUP_EXTERN_C void PrimordialSoup_InterruptAll();
 
+/*
+ * For embedders running isolates beside their own threads, between
+ * PrimordialSoup_Startup and PrimordialSoup_Shutdown.
+ *
+ * A loaded snapshot holds a copy of a snapshot's bytes, read once into an
+ * image of the heap they describe, for starting any number of isolates at
+ * once from any thread. Each copies the image instead of reading the
+ * snapshot again. NULL if the bytes are not a snapshot of this VM. It must
+ * not be released until the isolates started from it, and those they spawn,
+ * have exited.
+ */
+typedef struct PrimordialSoup_Snapshot PrimordialSoup_Snapshot;
+
+PSOUP_EXTERN_C PrimordialSoup_Snapshot* PrimordialSoup_LoadSnapshot(
+    const void* snapshot,
+    size_t snapshot_length);
+PSOUP_EXTERN_C void PrimordialSoup_ReleaseSnapshot(
+    PrimordialSoup_Snapshot* snapshot);
+/* Like PrimordialSoup_RunIsolateWithOptions, from a loaded snapshot. */
+PSOUP_EXTERN_C intptr_t PrimordialSoup_RunIsolateFromSnapshot(
+    PrimordialSoup_Snapshot* snapshot,
+    const PrimordialSoup_IsolateOptions* options,
+    int argc,
+    const char** argv);
+
+/*
+ * A port the embedder receives messages on. The handler runs on the thread
+ * of each sender, and may run for a message sent just before the port was
+ * closed. Its data is only valid during the call. A String or ByteArray sent
+ * to the port arrives as its bytes, any other object in the VM's message
+ * format.
+ */
+typedef int64_t PrimordialSoup_Port;
+typedef void (*PrimordialSoup_MessageHandler)(PrimordialSoup_Port port,
+                                              const uint8_t* data,
+                                              size_t length,
+                                              void* context);
+
+PSOUP_EXTERN_C PrimordialSoup_Port PrimordialSoup_OpenPort(
+    PrimordialSoup_MessageHandler handler,
+    void* context);
+PSOUP_EXTERN_C bool PrimordialSoup_ClosePort(PrimordialSoup_Port port);
+
+/*
+ * What an isolate has used, to account for it: the nanoseconds it spent
+ * running Newspeak, including its GCs, by the monotonic clock rather than
+ * the thread's CPU time, which is slower to read; the bytes it allocated;
+ * its scavenges and mark-sweeps, with the nanoseconds of their pauses, those
+ * of the mark-sweeps including their incremental steps; the messages it
+ * posted to ports and those dispatched to it from its own; and the most
+ * bytes its heap has held.
+ */
+typedef struct {
+  int64_t busy_nanos;
+  int64_t allocated_bytes;
+  int64_t scavenges;
+  int64_t scavenge_nanos;
+  int64_t mark_sweeps;
+  int64_t mark_sweep_nanos;
+  int64_t messages_sent;
+  int64_t messages_received;
+  int64_t peak_heap_size;
+} PrimordialSoup_IsolateUsage;
+
+/*
+ * Starts an isolate on a thread of the VM and returns at once. Instead of
+ * arguments, its main:args: gets an Array of reply_port, which it may answer
+ * on, e.g., with the id of a port of its own. Once it has exited, on_exit
+ * runs on its thread with its exit code and what it used, if not NULL.
+ * Unlike an isolate spawned by another, a failing isolate does not end the
+ * process.
+ */
+typedef void (*PrimordialSoup_ExitHandler)(
+    intptr_t exit_code,
+    const PrimordialSoup_IsolateUsage* usage,
+    void* context);
+
+PSOUP_EXTERN_C void PrimordialSoup_StartIsolate(
+    PrimordialSoup_Snapshot* snapshot,
+    const PrimordialSoup_IsolateOptions* options,
+    PrimordialSoup_Port reply_port,
+    PrimordialSoup_ExitHandler on_exit,
+    void* context);
+
+/*
+ * What the isolate a port belongs to has used, as of the end of its last
+ * turn. False if there is no such port, or it is the embedder's own. Cheap
+ * enough to call often, from any thread.
+ */
+PSOUP_EXTERN_C bool PrimordialSoup_IsolateUsageOf(
+    PrimordialSoup_Port port,
+    PrimordialSoup_IsolateUsage* usage);
+
+/*
+ * Sends a copy of data to a port of an isolate, whose handler gets it as a
+ * String. Answers 0 if it was sent, 1 if there is no such port and 2 if the
+ * isolate's mailbox is full.
+ */
+PSOUP_EXTERN_C intptr_t PrimordialSoup_PostMessage(PrimordialSoup_Port port,
+                                                   const void* data,
+                                                   size_t length);
+
+/*
+ * Like PrimordialSoup_PostMessage, but lends the isolate data instead of
+ * copying it. When the VM is done with the bytes, release runs with them and
+ * context, once, on any thread: after the isolate has read them, or before
+ * this returns if they were not sent.
+ */
+typedef void (*PrimordialSoup_ReleaseHandler)(const void* data,
+                                              size_t length,
+                                              void* context);
+
+PSOUP_EXTERN_C intptr_t PrimordialSoup_PostBuffer(
+    PrimordialSoup_Port port,
+    const void* data,
+    size_t length,
+    PrimordialSoup_ReleaseHandler release,
+    void* context);
+
+/*
+ * Sends count messages to one port, in order, taking its locks once rather
+ * than for each. Each is lent, as by PrimordialSoup_PostBuffer, or copied if
+ * its release is NULL. Answers how many were sent. Those after the first the
+ * isolate's mailbox has no room for, or all if there is no such port, are
+ * not sent.
+ */
+typedef struct {
+  const void* data;
+  size_t length;
+  PrimordialSoup_ReleaseHandler release;
+  void* context;
+} PrimordialSoup_Message;
+
+PSOUP_EXTERN_C size_t PrimordialSoup_PostMessages(
+    PrimordialSoup_Port port,
+    const PrimordialSoup_Message* messages,
+    size_t count);
+
 #endif /* VM_PRIMORDIAL_SOUP_H_ */
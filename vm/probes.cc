@@ -0,0 +1,64 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/probes.h"
+
+#include <stdio.h>
+#if defined(OS_LINUX)
+#include <unistd.h>
+#endif
+
+#include "vm/lockers.h"
+#include "vm/os.h"
+#include "vm/profiler.h"
+#include "vm/thread.h"
+
+namespace psoup {
+
+Mutex* PerfMap::mutex_ = NULL;
+FILE* PerfMap::file_ = NULL;
+
+
+void PerfMap::Startup() {
+  if (!FLAG_perf_map) {
+    return;
+  }
+#if defined(OS_LINUX)
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/perf-%d.map", static_cast<int>(getpid()));
+  file_ = fopen(path, "w");
+  if (file_ == NULL) {
+    OS::PrintErr("Failed to open %s\n", path);
+    return;
+  }
+  mutex_ = new Mutex();
+#else
+  OS::PrintErr("--perf_map is only supported on Linux\n");
+#endif
+}
+
+
+void PerfMap::Shutdown() {
+  if (file_ != NULL) {
+    fclose(file_);
+    file_ = NULL;
+  }
+  delete mutex_;
+  mutex_ = NULL;
+}
+
+
+void PerfMap::AddCode(uword start, intptr_t size, Method method) {
+  if (file_ == NULL) {
+    return;
+  }
+  char name[NameTable::kMaxName];
+  NameTable::PrintMethod(name, sizeof(name), method, false);
+  // Isolates compile on their own threads.
+  MutexLocker locker(mutex_);
+  fprintf(file_, "%" Px " %" Px " %s\n", start, static_cast<uword>(size), name);
+  fflush(file_);
+}
+
+}  // namespace psoup
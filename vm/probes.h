@@ -0,0 +1,109 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_PROBES_H_
+#define VM_PROBES_H_
+
+#include <stdio.h>
+
+#include "vm/flags.h"
+#include "vm/globals.h"
+#include "vm/object.h"
+
+#if USDT_PROBES && defined(OS_LINUX)
+#include <sys/sdt.h>
+#define USE_USDT_PROBES 1
+#endif
+
+namespace psoup {
+
+class Mutex;
+
+// Statically defined tracepoints for system-wide tracers such as bpftrace,
+// built with `scons usdt=true`, under the provider psoup:
+//
+//   method__entry    selector, selector length, mixin name, mixin name length,
+//                    whether of the class side
+//   method__return   the same
+//   gc__begin        kind, reason
+//   gc__phase        phase, as it ends
+//   gc__end
+//
+// Names are the bytes of the Strings, not terminated, so read them with
+// str(arg0, arg1). Entry is probed as a method's frame is created, and return
+// as it returns, locally or as the home of a non-local return. Frames unwound
+// by a non-local return, and blocks, probe neither. Without the build option,
+// each probe compiles to nothing.
+class Probes {
+ public:
+  static void MethodEntry(Method method) {
+#if defined(USE_USDT_PROBES)
+    Object name = method->mixin()->name();
+    bool is_meta = !name->IsString();
+    if (is_meta) {
+      name = static_cast<AbstractMixin>(name)->name();
+    }
+    String mixin = static_cast<String>(name);
+    String selector = method->selector();
+    DTRACE_PROBE5(psoup, method__entry,
+                  selector->element_addr(0), selector->Size(),
+                  mixin->element_addr(0), mixin->Size(), is_meta);
+#endif
+  }
+
+  static void MethodReturn(Method method) {
+#if defined(USE_USDT_PROBES)
+    Object name = method->mixin()->name();
+    bool is_meta = !name->IsString();
+    if (is_meta) {
+      name = static_cast<AbstractMixin>(name)->name();
+    }
+    String mixin = static_cast<String>(name);
+    String selector = method->selector();
+    DTRACE_PROBE5(psoup, method__return,
+                  selector->element_addr(0), selector->Size(),
+                  mixin->element_addr(0), mixin->Size(), is_meta);
+#endif
+  }
+
+  static void GCBegin(const char* kind, const char* reason) {
+#if defined(USE_USDT_PROBES)
+    DTRACE_PROBE2(psoup, gc__begin, kind, reason);
+#endif
+  }
+
+  static void GCPhase(const char* phase) {
+#if defined(USE_USDT_PROBES)
+    DTRACE_PROBE1(psoup, gc__phase, phase);
+#endif
+  }
+
+  static void GCEnd() {
+#if defined(USE_USDT_PROBES)
+    DTRACE_PROBE(psoup, gc__end);
+#endif
+  }
+};
+
+// With --perf_map, names the native code of each method the baseline JIT
+// compiles in /tmp/perf-<pid>.map, where perf looks for the symbols of code
+// not in any file. Interpreted methods run in Interpreter::Interpret, so
+// perf attributes them there; the USDT probes are for attributing those.
+// Code freed is not removed, as perf has no way to forget a range. Linux
+// only.
+class PerfMap {
+ public:
+  static void Startup();
+  static void Shutdown();
+
+  static void AddCode(uword start, intptr_t size, Method method);
+
+ private:
+  static Mutex* mutex_;
+  static FILE* file_;  // Or NULL while disabled.
+};
+
+}  // namespace psoup
+
+#endif  // VM_PROBES_H_
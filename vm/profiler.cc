@@ -0,0 +1,976 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm/assert.h"
+#include "vm/heap.h"
+#include "vm/interpreter.h"
+#include "vm/lockers.h"
+#include "vm/log.h"
+#include "vm/os.h"
+#include "vm/primitives.h"
+#include "vm/thread.h"
+#include "vm/thread_pool.h"
+#include "vm/utils.h"
+
+namespace psoup {
+
+Monitor* Profiler::monitor_ = NULL;
+ThreadPool* Profiler::pool_ = NULL;
+Profiler* Profiler::enabled_ = NULL;
+bool Profiler::sampling_ = false;
+
+
+NameTable::NameTable()
+    : names_(NULL), size_(0), capacity_(0), table_(NULL), table_capacity_(0) {}
+
+
+NameTable::~NameTable() {
+  Clear();
+  free(names_);
+  free(table_);
+}
+
+
+void NameTable::Clear() {
+  for (intptr_t i = 0; i < size_; i++) {
+    free(names_[i]);
+  }
+  size_ = 0;
+  for (intptr_t i = 0; i < table_capacity_; i++) {
+    table_[i] = -1;
+  }
+}
+
+
+static uword HashName(const char* name, intptr_t length) {
+  uword hash = 2166136261u;  // FNV-1a.
+  for (intptr_t i = 0; i < length; i++) {
+    hash = (hash ^ static_cast<uint8_t>(name[i])) * 16777619u;
+  }
+  return hash;
+}
+
+
+intptr_t NameTable::Intern(const char* name, intptr_t length) {
+  if (2 * (size_ + 1) > table_capacity_) {
+    free(table_);
+    table_capacity_ = table_capacity_ == 0 ? 256 : table_capacity_ * 2;
+    table_ = reinterpret_cast<intptr_t*>(
+        malloc(table_capacity_ * sizeof(table_[0])));
+    if (table_ == NULL) {
+      FATAL("Failed to grow profile names");
+    }
+    intptr_t mask = table_capacity_ - 1;
+    for (intptr_t i = 0; i < table_capacity_; i++) {
+      table_[i] = -1;
+    }
+    for (intptr_t i = 0; i < size_; i++) {
+      intptr_t slot = HashName(names_[i], strlen(names_[i])) & mask;
+      while (table_[slot] != -1) {
+        slot = (slot + 1) & mask;
+      }
+      table_[slot] = i;
+    }
+  }
+
+  intptr_t mask = table_capacity_ - 1;
+  intptr_t slot = HashName(name, length) & mask;
+  while (table_[slot] != -1) {
+    const char* other = names_[table_[slot]];
+    if ((strncmp(other, name, length) == 0) && (other[length] == 0)) {
+      return table_[slot];
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  if (size_ == capacity_) {
+    capacity_ = capacity_ == 0 ? 256 : capacity_ * 2;
+    names_ = reinterpret_cast<char**>(
+        realloc(names_, capacity_ * sizeof(names_[0])));
+    if (names_ == NULL) {
+      FATAL("Failed to grow profile names");
+    }
+  }
+  char* copy = reinterpret_cast<char*>(malloc(length + 1));
+  if (copy == NULL) {
+    FATAL("Failed to copy profile name");
+  }
+  memcpy(copy, name, length);
+  copy[length] = 0;
+  table_[slot] = size_;
+  names_[size_] = copy;
+  return size_++;
+}
+
+
+static intptr_t PrintMixin(char* buffer, intptr_t size, intptr_t length,
+                           AbstractMixin mixin) {
+  Object name = mixin->name();
+  const char* suffix = "";
+  if (!name->IsString()) {
+    name = static_cast<AbstractMixin>(name)->name();  // Of the instance side.
+    suffix = " class";
+  }
+  String string = static_cast<String>(name);
+  ASSERT(string->IsString());
+  return length + snprintf(buffer + length, size - length, "%.*s%s",
+                           static_cast<int>(string->Size()),
+                           reinterpret_cast<const char*>(
+                               string->element_addr(0)),
+                           suffix);
+}
+
+
+static intptr_t Truncated(intptr_t length, intptr_t size) {
+  return (length >= size) ? size - 1 : length;
+}
+
+
+intptr_t NameTable::PrintMethod(char* buffer, intptr_t size,
+                                Method method, bool is_closure) {
+  // Like the stacks printed on interrupt, but by the mixin that defines the
+  // method rather than the receiver's.
+  intptr_t length = 0;
+  if (is_closure) {
+    length = snprintf(buffer, size, "[] in ");
+  }
+  length = PrintMixin(buffer, size, length, method->mixin());
+  if (length < size) {
+    String selector = method->selector();
+    length += snprintf(buffer + length, size - length, " %.*s",
+                       static_cast<int>(selector->Size()),
+                       reinterpret_cast<const char*>(
+                           selector->element_addr(0)));
+  }
+  return Truncated(length, size);
+}
+
+
+intptr_t NameTable::PrintClass(char* buffer, intptr_t size, Behavior cls) {
+  return Truncated(PrintMixin(buffer, size, 0, cls->mixin()), size);
+}
+
+
+class Profiler::SamplerTask : public ThreadPool::Task {
+ public:
+  SamplerTask() {}
+  void Run() { Profiler::SamplerLoop(); }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(SamplerTask);
+};
+
+
+void Profiler::Startup(ThreadPool* pool) {
+  monitor_ = new Monitor();
+  pool_ = pool;
+}
+
+
+void Profiler::Shutdown() {
+  ASSERT(enabled_ == NULL);
+  ASSERT(!sampling_);
+  delete monitor_;
+  monitor_ = NULL;
+  pool_ = NULL;
+}
+
+
+void Profiler::SamplerLoop() {
+  MonitorLocker ml(monitor_);
+  while (enabled_ != NULL) {
+    int64_t now = OS::CurrentMonotonicNanos();
+    int64_t next = kMaxInt64;
+    for (Profiler* profiler = enabled_;
+         profiler != NULL;
+         profiler = profiler->next_) {
+      if (profiler->deadline_ <= now) {
+        profiler->interpreter_->RequestSample();
+        // An interval missed is skipped rather than sampled late.
+        profiler->deadline_ += profiler->interval_;
+        if (profiler->deadline_ <= now) {
+          profiler->deadline_ = now + profiler->interval_;
+        }
+      }
+      if (profiler->deadline_ < next) {
+        next = profiler->deadline_;
+      }
+    }
+    ml.WaitUntilNanos(next);
+  }
+  sampling_ = false;
+}
+
+
+Profiler::Profiler(Interpreter* interpreter)
+    : interpreter_(interpreter),
+      nodes_(NULL),
+      nodes_size_(0),
+      nodes_capacity_(0),
+      depth_(0),
+      truncated_(false),
+      interval_(0),
+      deadline_(0),
+      next_(NULL) {
+  FlushCache();
+}
+
+
+Profiler::~Profiler() {
+  SetInterval(0);
+  free(nodes_);
+}
+
+
+void Profiler::SetInterval(int64_t interval) {
+  ASSERT(interval >= 0);
+  if (interval > 0) {
+    Reset();
+  }
+
+  MonitorLocker ml(monitor_);
+  if ((interval_ == 0) && (interval > 0)) {
+    next_ = enabled_;
+    enabled_ = this;
+  } else if ((interval_ > 0) && (interval == 0)) {
+    Profiler** link = &enabled_;
+    while (*link != this) {
+      link = &(*link)->next_;
+    }
+    *link = next_;
+    next_ = NULL;
+  }
+  interval_ = interval * kNanosecondsPerMicrosecond;
+  deadline_ = OS::CurrentMonotonicNanos() + interval_;
+  if ((enabled_ != NULL) && !sampling_) {
+    sampling_ = true;
+    pool_->Run(new SamplerTask());
+  }
+  ml.Notify();  // The next deadline may be sooner, or there may be none.
+}
+
+
+void Profiler::FlushCache() {
+  for (intptr_t i = 0; i < kCacheSize; i++) {
+    cache_[i].method = 0;
+    cache_[i].is_closure = false;
+    cache_[i].name = -1;
+  }
+}
+
+
+void Profiler::Reset() {
+  names_.Clear();
+  nodes_size_ = 0;
+  FlushCache();
+}
+
+
+bool Profiler::AddFrame(Method method, bool is_closure) {
+  if (depth_ == kMaxDepth) {
+    truncated_ = true;
+    return false;
+  }
+  frames_[depth_++] = NameOf(method, is_closure);
+  return true;
+}
+
+
+void Profiler::EndSample() {
+  if (depth_ == 0) {
+    return;  // Between turns.
+  }
+  if (nodes_size_ == 0) {
+    ChildOf(-1, -1);  // The root.
+  }
+  intptr_t node = 0;
+  if (truncated_) {
+    node = ChildOf(node, names_.Intern("...", 3));
+  }
+  for (intptr_t i = depth_ - 1; i >= 0; i--) {
+    node = ChildOf(node, frames_[i]);
+  }
+  nodes_[node].count++;
+}
+
+
+intptr_t Profiler::NameOf(Method method, bool is_closure) {
+  uword address = static_cast<uword>(method);
+  CacheEntry* entry = &cache_[(address >> 4) & (kCacheSize - 1)];
+  if ((entry->method == address) && (entry->is_closure == is_closure)) {
+    return entry->name;
+  }
+  char buffer[NameTable::kMaxName];
+  intptr_t length =
+      NameTable::PrintMethod(buffer, sizeof(buffer), method, is_closure);
+  entry->method = address;
+  entry->is_closure = is_closure;
+  entry->name = names_.Intern(buffer, length);
+  return entry->name;
+}
+
+
+intptr_t Profiler::ChildOf(intptr_t parent, intptr_t name) {
+  intptr_t* link = NULL;
+  if (parent != -1) {
+    link = &nodes_[parent].child;
+    while (*link != 0) {
+      if (nodes_[*link].name == name) {
+        return *link;
+      }
+      link = &nodes_[*link].sibling;
+    }
+  }
+
+  if (nodes_size_ == nodes_capacity_) {
+    intptr_t offset = (link == NULL) ? 0 :
+        reinterpret_cast<intptr_t>(link) - reinterpret_cast<intptr_t>(nodes_);
+    nodes_capacity_ = nodes_capacity_ == 0 ? 1024 : nodes_capacity_ * 2;
+    nodes_ = reinterpret_cast<Node*>(
+        realloc(nodes_, nodes_capacity_ * sizeof(nodes_[0])));
+    if (nodes_ == NULL) {
+      FATAL("Failed to grow profiler nodes");
+    }
+    if (link != NULL) {
+      link = reinterpret_cast<intptr_t*>(
+          reinterpret_cast<intptr_t>(nodes_) + offset);
+    }
+  }
+  intptr_t node = nodes_size_++;
+  nodes_[node].name = name;
+  nodes_[node].count = 0;
+  nodes_[node].child = 0;
+  nodes_[node].sibling = 0;
+  if (link != NULL) {
+    *link = node;
+  }
+  return node;
+}
+
+
+intptr_t Profiler::PrintPaths(char* buffer, intptr_t size) {
+  // Depth first, keeping the path to the node at hand. Without a buffer, only
+  // measures.
+  intptr_t length = 0;
+  if (nodes_size_ == 0) {
+    return length;
+  }
+  intptr_t path[kMaxDepth + 3];  // For "...", and a child past the last.
+  intptr_t depth = 0;
+  path[0] = nodes_[0].child;
+  while (depth >= 0) {
+    intptr_t node = path[depth];
+    if (node == 0) {
+      depth--;
+      if (depth >= 0) {
+        path[depth] = nodes_[path[depth]].sibling;
+      }
+      continue;
+    }
+    if (nodes_[node].count > 0) {
+      for (intptr_t i = 0; i <= depth; i++) {
+        length += snprintf((buffer == NULL) ? NULL : buffer + length,
+                           (buffer == NULL) ? 0 : size - length,
+                           (i == 0) ? "%s" : ";%s",
+                           names_.At(nodes_[path[i]].name));
+      }
+      length += snprintf((buffer == NULL) ? NULL : buffer + length,
+                         (buffer == NULL) ? 0 : size - length,
+                         " %" Pd "\n", nodes_[node].count);
+    }
+    path[++depth] = nodes_[node].child;
+  }
+  return length;
+}
+
+
+char* Profiler::TakeFolded(intptr_t* length) {
+  intptr_t size = PrintPaths(NULL, 0);
+  char* buffer = reinterpret_cast<char*>(malloc(size + 1));
+  if (buffer == NULL) {
+    FATAL("Failed to allocate profile");
+  }
+  intptr_t printed = PrintPaths(buffer, size + 1);
+  ASSERT(printed == size);
+  Reset();
+  *length = printed;
+  return buffer;
+}
+
+
+AllocationProfiler::AllocationProfiler()
+    : rows_(NULL),
+      rows_size_(0),
+      rows_capacity_(0),
+      table_(NULL),
+      table_capacity_(0),
+      interval_(0),
+      random_(OS::CurrentMonotonicNanos() | 1) {}
+
+
+AllocationProfiler::~AllocationProfiler() {
+  free(rows_);
+  free(table_);
+}
+
+
+intptr_t AllocationProfiler::SetInterval(intptr_t interval) {
+  ASSERT(interval >= 0);
+  if (interval > 0) {
+    Reset();
+  }
+  interval_ = interval;
+  return NextCountdown();
+}
+
+
+void AllocationProfiler::Reset() {
+  names_.Clear();
+  rows_size_ = 0;
+  for (intptr_t i = 0; i < table_capacity_; i++) {
+    table_[i] = -1;
+  }
+}
+
+
+intptr_t AllocationProfiler::NextCountdown() {
+  if (interval_ == 0) {
+    return kNever;
+  }
+  random_ ^= random_ << 13;  // Xorshift.
+  random_ ^= random_ >> 7;
+  random_ ^= random_ << 17;
+  // Uniform in [interval / 2, interval * 3 / 2), so the mean is the interval.
+  return interval_ / 2 + static_cast<intptr_t>(random_ % interval_);
+}
+
+
+intptr_t AllocationProfiler::Record(Behavior cls, intptr_t size,
+                                    intptr_t allocated, Method method,
+                                    bool is_closure, intptr_t bci) {
+  if (interval_ == 0) {
+    return kNever;
+  }
+  char buffer[NameTable::kMaxName];
+  intptr_t length;
+  if (cls->IsHeapObject() && !cls->IsForwardingCorpse()) {
+    length = NameTable::PrintClass(buffer, sizeof(buffer), cls);
+  } else {
+    length = snprintf(buffer, sizeof(buffer), "?");
+  }
+  intptr_t class_name = names_.Intern(buffer, length);
+  intptr_t site_name = -1;
+  if (method != nullptr) {
+    length = NameTable::PrintMethod(buffer, sizeof(buffer), method, is_closure);
+    site_name = names_.Intern(buffer, length);
+  }
+
+  // The sample stands for all allocated since the last, as if each were of
+  // its size.
+  Row* row = RowFor(class_name, site_name, bci);
+  row->bytes += allocated;
+  row->objects += static_cast<double>(allocated) / size;
+  return NextCountdown();
+}
+
+
+static uword HashRow(intptr_t cls, intptr_t site, intptr_t bci) {
+  uword hash = static_cast<uword>(cls) * 31 + static_cast<uword>(site);
+  return hash * 31 + static_cast<uword>(bci);
+}
+
+
+AllocationProfiler::Row* AllocationProfiler::RowFor(intptr_t cls,
+                                                    intptr_t site,
+                                                    intptr_t bci) {
+  if (2 * (rows_size_ + 1) > table_capacity_) {
+    free(table_);
+    table_capacity_ = table_capacity_ == 0 ? 256 : table_capacity_ * 2;
+    table_ = reinterpret_cast<intptr_t*>(
+        malloc(table_capacity_ * sizeof(table_[0])));
+    if (table_ == NULL) {
+      FATAL("Failed to grow allocation profile");
+    }
+    intptr_t mask = table_capacity_ - 1;
+    for (intptr_t i = 0; i < table_capacity_; i++) {
+      table_[i] = -1;
+    }
+    for (intptr_t i = 0; i < rows_size_; i++) {
+      Row* row = &rows_[i];
+      intptr_t slot = HashRow(row->cls, row->site, row->bci) & mask;
+      while (table_[slot] != -1) {
+        slot = (slot + 1) & mask;
+      }
+      table_[slot] = i;
+    }
+  }
+
+  intptr_t mask = table_capacity_ - 1;
+  intptr_t slot = HashRow(cls, site, bci) & mask;
+  while (table_[slot] != -1) {
+    Row* row = &rows_[table_[slot]];
+    if ((row->cls == cls) && (row->site == site) && (row->bci == bci)) {
+      return row;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  if (rows_size_ == rows_capacity_) {
+    rows_capacity_ = rows_capacity_ == 0 ? 64 : rows_capacity_ * 2;
+    rows_ = reinterpret_cast<Row*>(
+        realloc(rows_, rows_capacity_ * sizeof(rows_[0])));
+    if (rows_ == NULL) {
+      FATAL("Failed to grow allocation profile");
+    }
+  }
+  table_[slot] = rows_size_;
+  Row* row = &rows_[rows_size_++];
+  row->cls = cls;
+  row->site = site;
+  row->bci = bci;
+  row->bytes = 0;
+  row->objects = 0.0;
+  return row;
+}
+
+
+int AllocationProfiler::CompareRows(const void* a, const void* b) {
+  const Row* left = reinterpret_cast<const Row*>(a);
+  const Row* right = reinterpret_cast<const Row*>(b);
+  // Largest first, then as first sampled for a stable order.
+  if (left->bytes != right->bytes) {
+    return (left->bytes < right->bytes) ? 1 : -1;
+  }
+  return (left < right) ? -1 : 1;
+}
+
+
+char* AllocationProfiler::PrintSummary(intptr_t* length) {
+  return Print(false, length);
+}
+
+
+char* AllocationProfiler::PrintSites(intptr_t* length) {
+  return Print(true, length);
+}
+
+
+char* AllocationProfiler::Print(bool by_site, intptr_t* length) {
+  // A copy to sort, merged by class for the summary.
+  Row* rows = reinterpret_cast<Row*>(
+      malloc((rows_size_ + 1) * sizeof(rows[0])));
+  intptr_t* by_class = reinterpret_cast<intptr_t*>(
+      malloc((names_.size() + 1) * sizeof(by_class[0])));
+  if ((rows == NULL) || (by_class == NULL)) {
+    FATAL("Failed to allocate allocation profile");
+  }
+  for (intptr_t i = 0; i < names_.size(); i++) {
+    by_class[i] = -1;
+  }
+  intptr_t size = 0;
+  for (intptr_t i = 0; i < rows_size_; i++) {
+    Row* row = &rows_[i];
+    if (!by_site) {
+      intptr_t merged = by_class[row->cls];
+      if (merged != -1) {
+        rows[merged].bytes += row->bytes;
+        rows[merged].objects += row->objects;
+        continue;
+      }
+      by_class[row->cls] = size;
+    }
+    rows[size++] = *row;
+  }
+  free(by_class);
+  qsort(rows, size, sizeof(rows[0]), CompareRows);
+
+  intptr_t printed = PrintRows(rows, size, by_site, NULL, 0);
+  char* buffer = reinterpret_cast<char*>(malloc(printed + 1));
+  if (buffer == NULL) {
+    FATAL("Failed to allocate allocation profile");
+  }
+  intptr_t check = PrintRows(rows, size, by_site, buffer, printed + 1);
+  ASSERT(check == printed);
+  free(rows);
+  *length = printed;
+  return buffer;
+}
+
+
+intptr_t AllocationProfiler::PrintRows(Row* rows, intptr_t size, bool by_site,
+                                       char* buffer, intptr_t capacity) {
+  // Without a buffer, only measures.
+  intptr_t length = 0;
+  for (intptr_t i = 0; i < size; i++) {
+    Row* row = &rows[i];
+    length += snprintf((buffer == NULL) ? NULL : buffer + length,
+                       (buffer == NULL) ? 0 : capacity - length,
+                       "%" Pd64 "\t%" Pd64 "\t%s",
+                       row->bytes,
+                       static_cast<int64_t>(row->objects + 0.5),
+                       names_.At(row->cls));
+    if (by_site) {
+      length += snprintf((buffer == NULL) ? NULL : buffer + length,
+                         (buffer == NULL) ? 0 : capacity - length,
+                         "\t%s\t%" Pd,
+                         (row->site == -1) ? "" : names_.At(row->site),
+                         row->bci);
+    }
+    length += snprintf((buffer == NULL) ? NULL : buffer + length,
+                       (buffer == NULL) ? 0 : capacity - length, "\n");
+  }
+  return length;
+}
+
+
+PrimitiveProfiler::PrimitiveProfiler() : rows_(NULL), enabled_(false) {}
+
+
+PrimitiveProfiler::~PrimitiveProfiler() {
+  free(rows_);
+}
+
+
+void PrimitiveProfiler::SetEnabled(bool enabled) {
+  if (enabled) {
+    if (rows_ == NULL) {
+      rows_ = reinterpret_cast<Row*>(
+          malloc(Primitives::kNumPrimitives * sizeof(rows_[0])));
+      if (rows_ == NULL) {
+        FATAL("Failed to allocate primitive profile");
+      }
+    }
+    memset(rows_, 0, Primitives::kNumPrimitives * sizeof(rows_[0]));
+    for (intptr_t i = 0; i < Primitives::kNumPrimitives; i++) {
+      rows_[i].prim = i;
+    }
+  }
+  enabled_ = enabled;
+}
+
+
+void PrimitiveProfiler::Record(intptr_t prim, bool success, int64_t nanos) {
+  // Also after the primitive disabling the profiler.
+  ASSERT((prim > 0) && (prim < Primitives::kNumPrimitives));
+  Row* row = &rows_[prim];
+  row->calls++;
+  if (!success) {
+    row->failures++;
+  }
+  row->nanos += nanos;
+  intptr_t bucket = (nanos <= 0) ? 0 : Utils::HighestBit(nanos);
+  if (bucket >= kNumBuckets) {
+    bucket = kNumBuckets - 1;
+  }
+  row->buckets[bucket]++;
+}
+
+
+int PrimitiveProfiler::CompareRows(const void* a, const void* b) {
+  const Row* left = reinterpret_cast<const Row*>(a);
+  const Row* right = reinterpret_cast<const Row*>(b);
+  if (left->nanos != right->nanos) {
+    return (left->nanos < right->nanos) ? 1 : -1;
+  }
+  return (left->prim < right->prim) ? -1 : 1;
+}
+
+
+intptr_t PrimitiveProfiler::SortedRows(Row** rows) {
+  // A copy of those called, to sort.
+  *rows = reinterpret_cast<Row*>(
+      malloc(Primitives::kNumPrimitives * sizeof(rows_[0])));
+  if (*rows == NULL) {
+    FATAL("Failed to allocate primitive profile");
+  }
+  intptr_t size = 0;
+  if (rows_ != NULL) {
+    for (intptr_t i = 0; i < Primitives::kNumPrimitives; i++) {
+      if (rows_[i].calls != 0) {
+        (*rows)[size++] = rows_[i];
+      }
+    }
+  }
+  qsort(*rows, size, sizeof(rows_[0]), CompareRows);
+  return size;
+}
+
+
+intptr_t PrimitiveProfiler::PrintRow(const Row* row,
+                                     char* buffer, intptr_t capacity) {
+  // Without a buffer, only measures.
+  const char* name = Primitives::Name(row->prim);
+  intptr_t length = snprintf(buffer, capacity,
+                             "%" Pd "\t%s\t%" Pd64 "\t%" Pd64 "\t%" Pd64 "\t",
+                             row->prim, (name == NULL) ? "?" : name,
+                             row->calls, row->failures, row->nanos);
+  intptr_t last = kNumBuckets - 1;
+  while ((last > 0) && (row->buckets[last] == 0)) {
+    last--;
+  }
+  for (intptr_t i = 0; i <= last; i++) {
+    length += snprintf((buffer == NULL) ? NULL : buffer + length,
+                       (buffer == NULL) ? 0 : capacity - length,
+                       (i == 0) ? "%" Pd64 : ",%" Pd64, row->buckets[i]);
+  }
+  return length;
+}
+
+
+char* PrimitiveProfiler::Print(intptr_t* length) {
+  Row* rows;
+  intptr_t size = SortedRows(&rows);
+  intptr_t printed = 0;
+  for (intptr_t i = 0; i < size; i++) {
+    printed += PrintRow(&rows[i], NULL, 0) + 1;
+  }
+  char* buffer = reinterpret_cast<char*>(malloc(printed + 1));
+  if (buffer == NULL) {
+    FATAL("Failed to allocate primitive profile");
+  }
+  intptr_t check = 0;
+  for (intptr_t i = 0; i < size; i++) {
+    check += PrintRow(&rows[i], buffer + check, printed + 1 - check);
+    buffer[check++] = '\n';
+  }
+  buffer[check] = 0;
+  ASSERT(check == printed);
+  free(rows);
+  *length = printed;
+  return buffer;
+}
+
+
+void PrimitiveProfiler::Report() {
+  Row* rows;
+  intptr_t size = SortedRows(&rows);
+  for (intptr_t i = 0; i < size; i++) {
+    char line[1024];
+    PrintRow(&rows[i], line, sizeof(line));
+    Log::Print("report_primitives", "%s", line);
+  }
+  free(rows);
+}
+
+
+ExecutionCounter::ExecutionCounter()
+    : rows_(NULL),
+      rows_size_(0),
+      rows_capacity_(0),
+      table_(NULL),
+      table_capacity_(0) {
+  for (intptr_t i = 0; i < 256; i++) {
+    bytecodes_[i] = 0;
+  }
+  FlushCache();
+}
+
+
+ExecutionCounter::~ExecutionCounter() {
+  free(rows_);
+  free(table_);
+}
+
+
+void ExecutionCounter::FlushCache() {
+  for (intptr_t i = 0; i < kCacheSize; i++) {
+    cache_[i].method = 0;
+    cache_[i].name = -1;
+  }
+}
+
+
+intptr_t ExecutionCounter::NameOf(Method method) {
+  uword address = static_cast<uword>(method);
+  CacheEntry* entry = &cache_[(address >> 4) & (kCacheSize - 1)];
+  if (entry->method == address) {
+    return entry->name;
+  }
+  char buffer[NameTable::kMaxName];
+  intptr_t length =
+      NameTable::PrintMethod(buffer, sizeof(buffer), method, false);
+  entry->method = address;
+  entry->name = names_.Intern(buffer, length);
+  return entry->name;
+}
+
+
+void ExecutionCounter::CountSend(Method method, intptr_t bci, intptr_t cid,
+                                 Behavior cls) {
+  RowFor(NameOf(method), bci, cid, cls)->count++;
+}
+
+
+ExecutionCounter::Row* ExecutionCounter::RowFor(intptr_t site, intptr_t bci,
+                                                intptr_t cid, Behavior cls) {
+  if (2 * (rows_size_ + 1) > table_capacity_) {
+    free(table_);
+    table_capacity_ = table_capacity_ == 0 ? 1024 : table_capacity_ * 2;
+    table_ = reinterpret_cast<intptr_t*>(
+        malloc(table_capacity_ * sizeof(table_[0])));
+    if (table_ == NULL) {
+      FATAL("Failed to grow execution counts");
+    }
+    intptr_t mask = table_capacity_ - 1;
+    for (intptr_t i = 0; i < table_capacity_; i++) {
+      table_[i] = -1;
+    }
+    for (intptr_t i = 0; i < rows_size_; i++) {
+      Row* row = &rows_[i];
+      intptr_t slot = HashRow(row->site, row->bci, row->cid) & mask;
+      while (table_[slot] != -1) {
+        slot = (slot + 1) & mask;
+      }
+      table_[slot] = i;
+    }
+  }
+
+  intptr_t mask = table_capacity_ - 1;
+  intptr_t slot = HashRow(site, bci, cid) & mask;
+  while (table_[slot] != -1) {
+    Row* row = &rows_[table_[slot]];
+    if ((row->site == site) && (row->bci == bci) && (row->cid == cid)) {
+      return row;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  if (rows_size_ == rows_capacity_) {
+    rows_capacity_ = rows_capacity_ == 0 ? 1024 : rows_capacity_ * 2;
+    rows_ = reinterpret_cast<Row*>(
+        realloc(rows_, rows_capacity_ * sizeof(rows_[0])));
+    if (rows_ == NULL) {
+      FATAL("Failed to grow execution counts");
+    }
+  }
+  // Named now: the heap is gone by the time of the report.
+  char buffer[NameTable::kMaxName];
+  intptr_t length = NameTable::PrintClass(buffer, sizeof(buffer), cls);
+  table_[slot] = rows_size_;
+  Row* row = &rows_[rows_size_++];
+  row->site = site;
+  row->bci = bci;
+  row->cid = cid;
+  row->cls = names_.Intern(buffer, length);
+  row->count = 0;
+  return row;
+}
+
+
+int ExecutionCounter::CompareRows(const void* a, const void* b) {
+  const Row* left = reinterpret_cast<const Row*>(a);
+  const Row* right = reinterpret_cast<const Row*>(b);
+  // By site, then most frequent class first.
+  if (left->site != right->site) {
+    return (left->site < right->site) ? -1 : 1;
+  }
+  if (left->bci != right->bci) {
+    return (left->bci < right->bci) ? -1 : 1;
+  }
+  if (left->count != right->count) {
+    return (left->count < right->count) ? 1 : -1;
+  }
+  return (left->cid < right->cid) ? -1 : 1;
+}
+
+
+int ExecutionCounter::CompareSites(const void* a, const void* b) {
+  const Site* left = reinterpret_cast<const Site*>(a);
+  const Site* right = reinterpret_cast<const Site*>(b);
+  if (left->count != right->count) {
+    return (left->count < right->count) ? 1 : -1;
+  }
+  return (left->first < right->first) ? -1 : 1;
+}
+
+
+void ExecutionCounter::Report() {
+  ReportBytecodes();
+  ReportSends();
+}
+
+
+void ExecutionCounter::ReportBytecodes() {
+  int64_t total = 0;
+  for (intptr_t i = 0; i < 256; i++) {
+    total += bytecodes_[i];
+  }
+  if (total == 0) {
+    return;
+  }
+  OS::PrintErr("Executed %" Pd64 " bytecodes\n", total);
+  bool reported[256] = {false};
+  for (;;) {
+    intptr_t max = -1;
+    for (intptr_t i = 0; i < 256; i++) {
+      if (!reported[i] && (bytecodes_[i] != 0) &&
+          ((max == -1) || (bytecodes_[i] > bytecodes_[max]))) {
+        max = i;
+      }
+    }
+    if (max == -1) {
+      break;
+    }
+    reported[max] = true;
+    OS::PrintErr("  %12" Pd64 " %5.1f%% bytecode %" Pd "\n",
+                 bytecodes_[max], 100.0 * bytecodes_[max] / total, max);
+  }
+}
+
+
+void ExecutionCounter::ReportSends() {
+  if (rows_size_ == 0) {
+    return;
+  }
+  qsort(rows_, rows_size_, sizeof(rows_[0]), CompareRows);
+  Site* sites = reinterpret_cast<Site*>(
+      malloc(rows_size_ * sizeof(sites[0])));
+  if (sites == NULL) {
+    FATAL("Failed to allocate execution counts");
+  }
+  intptr_t num_sites = 0;
+  int64_t total = 0;
+  for (intptr_t i = 0; i < rows_size_; i++) {
+    Row* row = &rows_[i];
+    if ((i == 0) || (row->site != rows_[i - 1].site) ||
+        (row->bci != rows_[i - 1].bci)) {
+      sites[num_sites].first = i;
+      sites[num_sites].size = 0;
+      sites[num_sites].count = 0;
+      num_sites++;
+    }
+    sites[num_sites - 1].size++;
+    sites[num_sites - 1].count += row->count;
+    total += row->count;
+  }
+  qsort(sites, num_sites, sizeof(sites[0]), CompareSites);
+
+  OS::PrintErr("Sent %" Pd64 " messages from %" Pd " sites\n",
+               total, num_sites);
+  for (intptr_t i = 0; (i < num_sites) && (i < kTopSites); i++) {
+    Site* site = &sites[i];
+    Row* first = &rows_[site->first];
+    OS::PrintErr("  %12" Pd64 " %5.1f%% %s @%" Pd ", %" Pd " classes\n",
+                 site->count, 100.0 * site->count / total,
+                 names_.At(first->site), first->bci, site->size);
+    for (intptr_t j = 0; j < site->size; j++) {
+      Row* row = &first[j];
+      OS::PrintErr("    %12" Pd64 " %s\n", row->count, names_.At(row->cls));
+    }
+  }
+  free(sites);
+  // The table's indices are stale once sorted.
+  rows_size_ = 0;
+  for (intptr_t i = 0; i < table_capacity_; i++) {
+    table_[i] = -1;
+  }
+}
+
+}  // namespace psoup
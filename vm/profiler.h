@@ -0,0 +1,319 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_PROFILER_H_
+#define VM_PROFILER_H_
+
+#include "vm/globals.h"
+#include "vm/object.h"
+
+namespace psoup {
+
+class Heap;
+class Interpreter;
+class Monitor;
+class ThreadPool;
+
+// Strings interned by content: the names of the methods and classes in
+// profiles.
+class NameTable {
+ public:
+  static const intptr_t kMaxName = 256;  // Bytes with the terminator.
+
+  NameTable();
+  ~NameTable();
+
+  intptr_t Intern(const char* name, intptr_t length);
+  const char* At(intptr_t index) const { return names_[index]; }
+  intptr_t size() const { return size_; }
+  void Clear();
+
+  // The name a profile gives a method, or a block in it, and a class,
+  // truncated to fit size, answering its length.
+  static intptr_t PrintMethod(char* buffer, intptr_t size,
+                              Method method, bool is_closure);
+  static intptr_t PrintClass(char* buffer, intptr_t size, Behavior cls);
+
+ private:
+  char** names_;
+  intptr_t size_;
+  intptr_t capacity_;
+  intptr_t* table_;  // Indices in names_ by hash, or -1.
+  intptr_t table_capacity_;
+
+  DISALLOW_COPY_AND_ASSIGN(NameTable);
+};
+
+// A sampling profiler for one interpreter. While it is enabled, a thread
+// shared by all profilers asks the interpreter for a sample at each interval,
+// and the interpreter records its stack of methods at its next poll. Samples
+// are counted in a tree of call paths and read as folded stacks: a line for
+// each path, its methods outermost first separated by ';', then a space and
+// its count, as flame graph tools take them. Methods are kept by name, so
+// samples outlive the methods' moves. Disabled, the profiler costs nothing.
+class Profiler {
+ public:
+  static const intptr_t kMaxDepth = 256;  // Frames kept of a sample, innermost.
+  static const int64_t kMinInterval = 100;  // Microseconds.
+
+  explicit Profiler(Interpreter* interpreter);
+  ~Profiler();
+
+  static void Startup(ThreadPool* pool);
+  static void Shutdown();
+
+  // Samples every interval microseconds, discarding the samples taken so far.
+  // Zero stops sampling, keeping them.
+  void SetInterval(int64_t interval);
+
+  // For the interpreter: the frames of a sample, innermost first. AddFrame
+  // answers false once the sample has all the frames it can keep.
+  void BeginSample() { depth_ = 0; truncated_ = false; }
+  bool AddFrame(Method method, bool is_closure);
+  void EndSample();
+
+  // Methods are cached by address, which a GC may change.
+  void FlushCache();
+
+  // The samples as folded stacks, in a buffer for the caller to free. The
+  // samples are then forgotten.
+  char* TakeFolded(intptr_t* length);
+
+ private:
+  struct Node {
+    intptr_t name;  // Index in names_, or -1 for the root.
+    intptr_t count;  // Samples that ended here.
+    intptr_t child;  // First, or 0.
+    intptr_t sibling;  // Next, or 0.
+  };
+
+  struct CacheEntry {
+    uword method;
+    bool is_closure;
+    intptr_t name;
+  };
+
+  static const intptr_t kCacheSize = 1024;
+
+  class SamplerTask;
+  static void SamplerLoop();
+
+  intptr_t NameOf(Method method, bool is_closure);
+  intptr_t ChildOf(intptr_t parent, intptr_t name);
+  void Reset();
+  intptr_t PrintPaths(char* buffer, intptr_t size);
+
+  Interpreter* const interpreter_;
+
+  NameTable names_;
+  Node* nodes_;  // The root is the first.
+  intptr_t nodes_size_;
+  intptr_t nodes_capacity_;
+
+  CacheEntry cache_[kCacheSize];
+
+  intptr_t frames_[kMaxDepth];
+  intptr_t depth_;
+  bool truncated_;
+
+  // With monitor_ held.
+  int64_t interval_;  // Nanoseconds, or 0 while disabled.
+  int64_t deadline_;
+  Profiler* next_;
+
+  static Monitor* monitor_;
+  static ThreadPool* pool_;
+  static Profiler* enabled_;
+  static bool sampling_;  // Whether the sampler is running.
+
+  DISALLOW_COPY_AND_ASSIGN(Profiler);
+};
+
+// Samples one heap's allocations about every interval bytes, each standing
+// for the bytes allocated since the last, and counts them by class and by the
+// method allocating them and where in it. The sample points are jittered so
+// that allocations of a regular pattern are not always or never sampled.
+// Classes and methods are kept by name, as for Profiler. While disabled the
+// heap only decrements a countdown that never runs out.
+class AllocationProfiler {
+ public:
+  static const intptr_t kMinInterval = 256;  // Bytes.
+  static const intptr_t kNever =
+      static_cast<intptr_t>(~static_cast<uword>(0) >> 1);
+
+  AllocationProfiler();
+  ~AllocationProfiler();
+
+  // Samples about every interval bytes, discarding the samples taken so far.
+  // Zero stops sampling, keeping them. Answers the bytes to allocate before
+  // the first sample, or kNever.
+  intptr_t SetInterval(intptr_t interval);
+  intptr_t interval() const { return interval_; }
+
+  // For the heap: a sample of size bytes of class, allocated by method, or a
+  // block in it, at bci, or by none if method is null, that fell after
+  // allocated bytes. Answers the bytes to allocate before the next sample.
+  intptr_t Record(Behavior cls, intptr_t size, intptr_t allocated,
+                  Method method, bool is_closure, intptr_t bci);
+
+  // The samples, by class and then by where they were allocated, largest
+  // first, as lines of tab-separated fields:
+  //
+  //   bytes  objects  class
+  //   bytes  objects  class  method  bci
+  //
+  // In a buffer for the caller to free.
+  char* PrintSummary(intptr_t* length);
+  char* PrintSites(intptr_t* length);
+
+ private:
+  struct Row {
+    intptr_t cls;  // Index in names_.
+    intptr_t site;  // Index in names_, or -1 for none.
+    intptr_t bci;
+    int64_t bytes;
+    double objects;
+  };
+
+  static int CompareRows(const void* a, const void* b);
+
+  intptr_t NextCountdown();
+  Row* RowFor(intptr_t cls, intptr_t site, intptr_t bci);
+  void Reset();
+  char* Print(bool by_site, intptr_t* length);
+  intptr_t PrintRows(Row* rows, intptr_t size, bool by_site,
+                     char* buffer, intptr_t capacity);
+
+  NameTable names_;
+  Row* rows_;
+  intptr_t rows_size_;
+  intptr_t rows_capacity_;
+  intptr_t* table_;  // Indices in rows_ by hash, or -1.
+  intptr_t table_capacity_;
+
+  intptr_t interval_;  // Or 0 while disabled.
+  uint64_t random_;
+
+  DISALLOW_COPY_AND_ASSIGN(AllocationProfiler);
+};
+
+// Counts the calls of each primitive by one interpreter, how many failed to
+// the method's Newspeak fallback, and their times, in total and in a
+// histogram of power-of-two buckets of nanoseconds. A primitive that fails
+// more than it succeeds is a slow path taken by every call. Disabled, the
+// interpreter only tests whether it is enabled.
+class PrimitiveProfiler {
+ public:
+  static const intptr_t kNumBuckets = 32;  // The last also counts the longer.
+
+  PrimitiveProfiler();
+  ~PrimitiveProfiler();
+
+  // Starts counting, discarding the counts so far, or stops, keeping them.
+  void SetEnabled(bool enabled);
+  bool enabled() const { return enabled_; }
+
+  // For the interpreter.
+  void Record(intptr_t prim, bool success, int64_t nanos);
+
+  // The counts of the primitives called, longest total time first, as lines
+  // of tab-separated fields:
+  //
+  //   number  name  calls  failures  nanoseconds  histogram
+  //
+  // where the histogram is the counts of calls taking under 2, 4, 8, ...
+  // nanoseconds, separated by commas and without the trailing zeros. In a
+  // buffer for the caller to free.
+  char* Print(intptr_t* length);
+  // The same, a line at a time, to the Log.
+  void Report();
+
+ private:
+  struct Row {
+    intptr_t prim;
+    int64_t calls;
+    int64_t failures;
+    int64_t nanos;
+    int64_t buckets[kNumBuckets];
+  };
+
+  static int CompareRows(const void* a, const void* b);
+
+  intptr_t SortedRows(Row** rows);
+  static intptr_t PrintRow(const Row* row, char* buffer, intptr_t capacity);
+
+  Row* rows_;  // By primitive number, allocated when first enabled.
+  bool enabled_;
+
+  DISALLOW_COPY_AND_ASSIGN(PrimitiveProfiler);
+};
+
+// Counts the bytecodes an interpreter executes, by opcode, and the sends it
+// makes, by method, bytecode index and the class looked up in, to show which
+// paths are hot and how polymorphic each send site is. Only built with
+// REPORT_BYTECODES, which adds a count to every dispatch, and reported to
+// standard error as the interpreter exits. Methods and classes are kept by
+// name, as for Profiler.
+class ExecutionCounter {
+ public:
+  static const intptr_t kTopSites = 50;
+
+  ExecutionCounter();
+  ~ExecutionCounter();
+
+  void CountBytecode(uint8_t bytecode) { bytecodes_[bytecode]++; }
+  void CountSend(Method method, intptr_t bci, intptr_t cid, Behavior cls);
+
+  // Methods are cached by address, which a GC may change.
+  void FlushCache();
+
+  void Report();
+
+ private:
+  struct Row {
+    intptr_t site;  // Index in names_.
+    intptr_t bci;
+    intptr_t cid;
+    intptr_t cls;  // Index in names_.
+    int64_t count;
+  };
+
+  struct Site {
+    intptr_t first;  // Index of its first row, once sorted.
+    intptr_t size;
+    int64_t count;
+  };
+
+  struct CacheEntry {
+    uword method;
+    intptr_t name;
+  };
+
+  static const intptr_t kCacheSize = 1024;
+
+  static int CompareRows(const void* a, const void* b);
+  static int CompareSites(const void* a, const void* b);
+
+  intptr_t NameOf(Method method);
+  Row* RowFor(intptr_t site, intptr_t bci, intptr_t cid, Behavior cls);
+  void ReportBytecodes();
+  void ReportSends();
+
+  int64_t bytecodes_[256];
+
+  NameTable names_;
+  Row* rows_;
+  intptr_t rows_size_;
+  intptr_t rows_capacity_;
+  intptr_t* table_;  // Indices in rows_ by hash, or -1.
+  intptr_t table_capacity_;
+
+  CacheEntry cache_[kCacheSize];
+
+  DISALLOW_COPY_AND_ASSIGN(ExecutionCounter);
+};
+
+}  // namespace psoup
+
+#endif  // VM_PROFILER_H_
@@ -5,30 +5,78 @@
 #ifndef VM_RANDOM_H_
 #define VM_RANDOM_H_
 
+#include "vm/globals.h"
+
 namespace psoup {
 
-// xorshift128+
-// Sebastiano Vigna. "Further scramblings of Marsaglia’s xorshift generators."
+// xoshiro256**
+// David Blackman and Sebastiano Vigna. "Scrambled linear pseudorandom number
+// generators." The state is expanded from the seed with SplitMix64, as its
+// authors suggest, so that nearby seeds give unrelated streams.
 class Random {
  public:
   explicit Random(uint64_t seed) {
-    state0_ = seed;
-    state1_ = 0;
+    for (intptr_t i = 0; i < 4; i++) {
+      seed += 0x9E3779B97F4A7C15ULL;
+      uint64_t z = seed;
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+      state_[i] = z ^ (z >> 31);
+    }
   }
 
   uint64_t NextUInt64() {
-    uint64_t s1 = state0_;
-    const uint64_t s0 = state1_;
-    const uint64_t result = s0 + s1;
-    state0_ = s0;
-    s1 ^= s1 << 23;
-    state1_ = s1 ^ s0 ^ (s1 >> 18) ^ (s0 >> 5);
+    const uint64_t result = Rotate(state_[1] * 5, 7) * 9;
+    const uint64_t t = state_[1] << 17;
+    state_[2] ^= state_[0];
+    state_[3] ^= state_[1];
+    state_[1] ^= state_[2];
+    state_[0] ^= state_[3];
+    state_[2] ^= t;
+    state_[3] = Rotate(state_[3], 45);
     return result;
   }
 
+  // Uniform in [0, 1), from the top 53 bits.
+  double NextDouble() {
+    return static_cast<double>(NextUInt64() >> 11) * (1.0 / (1ULL << 53));
+  }
+
+  // Uniform in [0, bound), without the bias of a bare remainder. A bound of 0
+  // stands for 2^64.
+  uint64_t NextBelow(uint64_t bound) {
+    if (bound == 0) {
+      return NextUInt64();
+    }
+    // The draws below 2^64 mod bound are those of an incomplete last cycle.
+    const uint64_t threshold = (0 - bound) % bound;
+    for (;;) {
+      uint64_t r = NextUInt64();
+      if (r >= threshold) {
+        return r % bound;
+      }
+    }
+  }
+
+  void Fill(uint8_t* bytes, intptr_t length) {
+    while (length >= 8) {
+      uint64_t r = NextUInt64();
+      memcpy(bytes, &r, 8);
+      bytes += 8;
+      length -= 8;
+    }
+    if (length > 0) {
+      uint64_t r = NextUInt64();
+      memcpy(bytes, &r, length);
+    }
+  }
+
  private:
-  uint64_t state0_;
-  uint64_t state1_;
+  static uint64_t Rotate(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  uint64_t state_[4];
 };
 
 }  // namespace psoup
@@ -0,0 +1,728 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/globals.h"  // NOLINT
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+
+#include "vm/scheduler.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "vm/isolate.h"
+#include "vm/lockers.h"
+#include "vm/os.h"
+#include "vm/thread_pool.h"
+
+namespace psoup {
+
+static const intptr_t kPollEvents = 64;
+
+thread_local Scheduler::Worker* Scheduler::current_worker_ = NULL;
+
+class Scheduler::WorkerTask : public ThreadPool::Task {
+ public:
+  explicit WorkerTask(Worker* worker) : worker_(worker) {}
+
+  virtual void Run() {
+    worker_->scheduler->WorkerLoop(worker_);
+  }
+
+ private:
+  Worker* worker_;
+
+  DISALLOW_COPY_AND_ASSIGN(WorkerTask);
+};
+
+class Scheduler::PollerTask : public ThreadPool::Task {
+ public:
+  explicit PollerTask(Scheduler* scheduler) : scheduler_(scheduler) {}
+
+  virtual void Run() {
+    scheduler_->PollerLoop();
+  }
+
+ private:
+  Scheduler* scheduler_;
+
+  DISALLOW_COPY_AND_ASSIGN(PollerTask);
+};
+
+Scheduler::Scheduler(ThreadPool* pool, intptr_t workers, const char* cpus)
+    : workers_(new Worker[workers]),
+      num_workers_(workers),
+      cpus_((cpus == NULL) ? NULL : strdup(cpus)),
+      next_worker_(0),
+      idle_(0),
+      idle_monitor_(),
+      shutting_down_(false),
+      exit_monitor_(),
+      live_(0),
+      threads_(workers + 1),
+      mutex_(),
+      epoll_fd_(-1),
+      timer_fd_(-1),
+      stop_fd_(-1),
+      armed_(0),
+      timers_(NULL),
+      timers_size_(0),
+      timers_capacity_(0),
+      retired_(NULL) {
+  ASSERT(workers > 0);
+  for (intptr_t i = 0; i < workers; i++) {
+    workers_[i].scheduler = this;
+    workers_[i].head = NULL;
+    workers_[i].tail = NULL;
+    workers_[i].length = 0;
+    workers_[i].running = NULL;
+    workers_[i].numa_node.store(-1, std::memory_order_relaxed);
+  }
+
+  // Non-blocking: a loop may have re-armed it since it fired.
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (timer_fd_ == -1) {
+    FATAL("Failed to create timer_fd");
+  }
+  stop_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (stop_fd_ == -1) {
+    FATAL("Failed to create eventfd");
+  }
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ == -1) {
+    FATAL("Failed to create epoll");
+  }
+
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = &timer_fd_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &event) == -1) {
+    FATAL("Failed to add timer_fd to epoll");
+  }
+  event.events = EPOLLIN;
+  event.data.ptr = &stop_fd_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, stop_fd_, &event) == -1) {
+    FATAL("Failed to add eventfd to epoll");
+  }
+
+  pool->Run(new PollerTask(this));
+  for (intptr_t i = 0; i < workers; i++) {
+    pool->Run(new WorkerTask(&workers_[i]));
+  }
+}
+
+Scheduler::~Scheduler() {
+  {
+    MonitorLocker ml(&exit_monitor_);
+    while (live_ > 0) {
+      ml.Wait();
+    }
+  }
+  {
+    MonitorLocker ml(&idle_monitor_);
+    shutting_down_ = true;
+    ml.NotifyAll();
+  }
+  uint64_t value = 1;
+  if (write(stop_fd_, &value, sizeof(value)) != sizeof(value)) {
+    FATAL("Failed to stop the poller");
+  }
+  {
+    MonitorLocker ml(&exit_monitor_);
+    while (threads_ > 0) {
+      ml.Wait();
+    }
+  }
+
+  while (retired_ != NULL) {
+    Wait* next = retired_->next_retired;
+    delete retired_;
+    retired_ = next;
+  }
+  ASSERT(timers_size_ == 0);
+  free(timers_);
+  close(epoll_fd_);
+  close(timer_fd_);
+  close(stop_fd_);
+  delete[] workers_;
+  free(cpus_);
+}
+
+void Scheduler::Start(Task* task, intptr_t numa_node) {
+  {
+    MonitorLocker ml(&exit_monitor_);
+    live_++;
+  }
+  Worker* worker = current_worker_;
+  if ((worker == NULL) || (worker->scheduler != this)) {
+    worker = NULL;
+  }
+  if ((numa_node >= 0) &&
+      ((worker == NULL) ||
+       (worker->numa_node.load(std::memory_order_relaxed) != numa_node))) {
+    worker = NULL;
+    uintptr_t first = next_worker_.fetch_add(1, std::memory_order_relaxed);
+    for (intptr_t i = 0; i < num_workers_; i++) {
+      Worker* candidate = &workers_[(first + i) % num_workers_];
+      if (candidate->numa_node.load(std::memory_order_relaxed) == numa_node) {
+        worker = candidate;
+        break;
+      }
+    }
+  }
+  if (worker == NULL) {
+    Schedule(task);
+  } else {
+    Push(worker, task);
+  }
+}
+
+void Scheduler::Exited(intptr_t exit_code) {
+  if (exit_code != 0) {
+    OS::Exit(exit_code);
+  }
+  MonitorLocker ml(&exit_monitor_);
+  live_--;
+  if (live_ == 0) {
+    ml.NotifyAll();
+  }
+}
+
+void Scheduler::ThreadExited() {
+  MonitorLocker ml(&exit_monitor_);
+  threads_--;
+  if (threads_ == 0) {
+    ml.NotifyAll();
+  }
+}
+
+void Scheduler::Schedule(Task* task) {
+  // Tasks queued by a worker usually follow from its turn, so they stay with
+  // it, where what they share is still in cache.
+  Worker* worker = current_worker_;
+  if ((worker == NULL) || (worker->scheduler != this)) {
+    worker = &workers_[next_worker_.fetch_add(1, std::memory_order_relaxed) %
+                       num_workers_];
+  }
+  Push(worker, task);
+}
+
+void Scheduler::Push(Worker* worker, Task* task) {
+  intptr_t length;
+  {
+    MutexLocker ml(&worker->mutex);
+    task->next_ = NULL;
+    if (worker->tail == NULL) {
+      worker->head = task;
+    } else {
+      worker->tail->next_ = task;
+    }
+    worker->tail = task;
+    length = ++worker->length;
+  }
+
+  // A turn queued again by itself is next for its worker, which is about to
+  // take it. Anything else may wait behind a long turn, so an idle worker
+  // should steal it.
+  if ((worker == current_worker_) && (task == worker->running) &&
+      (length == 1)) {
+    return;
+  }
+  // Pairs with the fence of a worker going idle: either it sees this task or
+  // this sees it idle.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (idle_.load(std::memory_order_relaxed) > 0) {
+    MonitorLocker ml(&idle_monitor_);
+    ml.Notify();
+  }
+}
+
+Scheduler::Task* Scheduler::TakeFrom(Worker* worker) {
+  MutexLocker ml(&worker->mutex);
+  Task* task = worker->head;
+  if (task != NULL) {
+    worker->head = task->next_;
+    if (worker->head == NULL) {
+      worker->tail = NULL;
+    }
+    worker->length--;
+    task->next_ = NULL;
+  }
+  return task;
+}
+
+Scheduler::Task* Scheduler::Take(Worker* worker) {
+  Task* task = TakeFrom(worker);
+  if (task != NULL) {
+    return task;
+  }
+  // Isolates stolen across nodes leave their heaps behind, so those are
+  // stolen last.
+  intptr_t index = worker - workers_;
+  intptr_t node = worker->numa_node.load(std::memory_order_relaxed);
+  for (intptr_t pass = 0; pass < 2; pass++) {
+    for (intptr_t i = 1; i < num_workers_; i++) {
+      Worker* victim = &workers_[(index + i) % num_workers_];
+      bool local = victim->numa_node.load(std::memory_order_relaxed) == node;
+      if (local != (pass == 0)) {
+        continue;
+      }
+      task = TakeFrom(victim);
+      if (task != NULL) {
+        return task;
+      }
+    }
+  }
+  return NULL;
+}
+
+void Scheduler::WorkerLoop(Worker* worker) {
+  intptr_t nodes = OS::NumberOfNumaNodes();
+  bool confined = false;
+  if ((cpus_ != NULL) || (nodes > 1)) {
+    intptr_t node = (nodes > 1) ? (worker - workers_) % nodes : -1;
+    confined = OS::SetThreadAffinity(cpus_, node);
+  }
+  worker->numa_node.store(OS::ThreadNumaNode(), std::memory_order_relaxed);
+  current_worker_ = worker;
+  for (;;) {
+    Task* task = Take(worker);
+    if (task == NULL) {
+      MonitorLocker ml(&idle_monitor_);
+      idle_.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      while (!shutting_down_ && ((task = Take(worker)) == NULL)) {
+        ml.Wait();
+      }
+      idle_.fetch_sub(1, std::memory_order_relaxed);
+      if (task == NULL) {
+        break;
+      }
+    }
+    worker->running = task;
+    task->RunTurn();  // May delete the task.
+    worker->running = NULL;
+  }
+  current_worker_ = NULL;
+  if (confined) {
+    OS::SetThreadAffinity(NULL, -1);  // The pool's thread may run other tasks.
+  }
+  ThreadExited();
+}
+
+static intptr_t SignalsOf(uint32_t events) {
+  intptr_t signals = 0;
+  if (events & EPOLLERR) {
+    signals |= 1 << kErrorEvent;
+  }
+  if (events & EPOLLIN) {
+    signals |= 1 << kReadEvent;
+  }
+  if (events & EPOLLOUT) {
+    signals |= 1 << kWriteEvent;
+  }
+  if (events & (EPOLLHUP | EPOLLRDHUP)) {
+    signals |= 1 << kCloseEvent;
+  }
+  return signals;
+}
+
+void Scheduler::PollerLoop() {
+  struct epoll_event events[kPollEvents];
+  bool stopped = false;
+  while (!stopped) {
+    int count = epoll_wait(epoll_fd_, events, kPollEvents, -1);
+    if (count < 0) {
+      if (errno != EINTR) {
+        FATAL("epoll_wait failed");
+      }
+      continue;
+    }
+
+    MutexLocker ml(&mutex_);
+    for (int i = 0; i < count; i++) {
+      void* data = events[i].data.ptr;
+      if (data == &stop_fd_) {
+        stopped = true;
+      } else if (data == &timer_fd_) {
+        uint64_t value;
+        if (read(timer_fd_, &value, sizeof(value)) == sizeof(value)) {
+          armed_ = 0;  // Disarmed by expiring.
+        }
+        ExpireTimersLocked(OS::CurrentMonotonicNanos());
+      } else {
+        Wait* wait = reinterpret_cast<Wait*>(data);
+        if (wait->loop != NULL) {
+          wait->pending.fetch_or(SignalsOf(events[i].events),
+                                 std::memory_order_relaxed);
+          wait->loop->Nudge();
+        }
+      }
+    }
+    // Cancelled waits may have been in this batch, but not in the next.
+    while (retired_ != NULL) {
+      Wait* next = retired_->next_retired;
+      delete retired_;
+      retired_ = next;
+    }
+  }
+  ThreadExited();
+}
+
+void Scheduler::AwaitSignal(ScheduledMessageLoop* loop,
+                            Wait* wait,
+                            intptr_t signals) {
+  struct epoll_event event;
+  event.events = EPOLLRDHUP;
+  if ((signals & (1 << kLevelTriggered)) == 0) {
+    event.events |= EPOLLET;
+  }
+  if (signals & (1 << kOneShot)) {
+    event.events |= EPOLLONESHOT;
+  }
+  if (signals & (1 << kReadEvent)) {
+    event.events |= EPOLLIN;
+  }
+  if (signals & (1 << kWriteEvent)) {
+    event.events |= EPOLLOUT;
+  }
+  event.data.ptr = wait;
+
+  // Awaited again, as after a one-shot wait, if the loop already had it.
+  MutexLocker ml(&mutex_);
+  int op = (wait->loop == NULL) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+  wait->loop = loop;
+  if (epoll_ctl(epoll_fd_, op, wait->fd, &event) == -1) {
+    FATAL("Failed to add to epoll");
+  }
+}
+
+void Scheduler::CancelWait(Wait* wait) {
+  MutexLocker ml(&mutex_);
+  CancelWaitLocked(wait);
+}
+
+void Scheduler::CancelWaitLocked(Wait* wait) {
+  if (wait->loop != NULL) {
+    // The fd may already be closed, which also removes it.
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, wait->fd, NULL);
+    wait->loop = NULL;
+  }
+  wait->next_retired = retired_;
+  retired_ = wait;
+}
+
+void Scheduler::SetWakeup(ScheduledMessageLoop* loop, int64_t wakeup) {
+  MutexLocker ml(&mutex_);
+  if (loop->timer_index_ >= 0) {
+    RemoveTimerLocked(loop);
+  }
+  if (wakeup != 0) {
+    if (timers_size_ == timers_capacity_) {
+      timers_capacity_ = (timers_capacity_ == 0) ? 64 : timers_capacity_ * 2;
+      timers_ = reinterpret_cast<ScheduledMessageLoop**>(
+          realloc(timers_, timers_capacity_ * sizeof(timers_[0])));
+      if (timers_ == NULL) {
+        FATAL("Failed to grow timers");
+      }
+    }
+    loop->timer_deadline_ = wakeup;
+    loop->timer_index_ = timers_size_;
+    timers_[timers_size_++] = loop;
+    SiftUp(loop->timer_index_);
+  }
+  ArmTimerLocked();
+}
+
+void Scheduler::Retire(ScheduledMessageLoop* loop) {
+  MutexLocker ml(&mutex_);
+  if (loop->timer_index_ >= 0) {
+    RemoveTimerLocked(loop);
+    ArmTimerLocked();
+  }
+  for (intptr_t i = 0; i < loop->waits_size_; i++) {
+    if (loop->waits_[i] != NULL) {
+      CancelWaitLocked(loop->waits_[i]);
+      loop->waits_[i] = NULL;
+    }
+  }
+}
+
+void Scheduler::RemoveTimerLocked(ScheduledMessageLoop* loop) {
+  intptr_t index = loop->timer_index_;
+  ASSERT(timers_[index] == loop);
+  loop->timer_index_ = -1;
+  ScheduledMessageLoop* last = timers_[--timers_size_];
+  if (index != timers_size_) {
+    timers_[index] = last;
+    last->timer_index_ = index;
+    SiftUp(index);
+    SiftDown(last->timer_index_);
+  }
+}
+
+void Scheduler::ExpireTimersLocked(int64_t now) {
+  while ((timers_size_ > 0) && (timers_[0]->timer_deadline_ <= now)) {
+    ScheduledMessageLoop* loop = timers_[0];
+    RemoveTimerLocked(loop);
+    loop->Nudge();
+  }
+  ArmTimerLocked();
+}
+
+void Scheduler::ArmTimerLocked() {
+  int64_t deadline = (timers_size_ == 0) ? 0 : timers_[0]->timer_deadline_;
+  if (deadline == armed_) {
+    return;
+  }
+  armed_ = deadline;
+  struct itimerspec it;
+  memset(&it, 0, sizeof(it));
+  if (deadline != 0) {
+    it.it_value.tv_sec = deadline / kNanosecondsPerSecond;
+    it.it_value.tv_nsec = deadline % kNanosecondsPerSecond;
+  }
+  timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &it, NULL);
+}
+
+void Scheduler::SiftUp(intptr_t index) {
+  ScheduledMessageLoop* loop = timers_[index];
+  while (index > 0) {
+    intptr_t parent = (index - 1) / 2;
+    if (timers_[parent]->timer_deadline_ <= loop->timer_deadline_) {
+      break;
+    }
+    timers_[index] = timers_[parent];
+    timers_[index]->timer_index_ = index;
+    index = parent;
+  }
+  timers_[index] = loop;
+  loop->timer_index_ = index;
+}
+
+void Scheduler::SiftDown(intptr_t index) {
+  ScheduledMessageLoop* loop = timers_[index];
+  for (;;) {
+    intptr_t child = 2 * index + 1;
+    if (child >= timers_size_) {
+      break;
+    }
+    if ((child + 1 < timers_size_) &&
+        (timers_[child + 1]->timer_deadline_ <
+         timers_[child]->timer_deadline_)) {
+      child++;
+    }
+    if (loop->timer_deadline_ <= timers_[child]->timer_deadline_) {
+      break;
+    }
+    timers_[index] = timers_[child];
+    timers_[index]->timer_index_ = index;
+    index = child;
+  }
+  timers_[index] = loop;
+  loop->timer_index_ = index;
+}
+
+ScheduledMessageLoop::ScheduledMessageLoop(Isolate* isolate,
+                                           Scheduler* scheduler)
+    : MessageLoop(isolate),
+      owner_(isolate),
+      scheduler_(scheduler),
+      queue_(),
+      nudge_(ILLEGAL_PORT, static_cast<uint8_t*>(NULL), 0),
+      nudged_(false),
+      pending_(false),
+      wakeup_(0),
+      waits_(NULL),
+      waits_size_(0),
+      waits_capacity_(0),
+      timer_index_(-1),
+      timer_deadline_(0) {}
+
+ScheduledMessageLoop::~ScheduledMessageLoop() {
+  // An interrupt may have nudged the loop after it finished.
+  DiscardMessages(TakeMessages());
+  free(waits_);
+}
+
+intptr_t ScheduledMessageLoop::AwaitSignal(intptr_t fd, intptr_t signals) {
+  Scheduler::Wait* wait = NULL;
+  intptr_t free_index = -1;
+  for (intptr_t i = 0; i < waits_size_; i++) {
+    if (waits_[i] == NULL) {
+      free_index = i;
+    } else if (waits_[i]->fd == fd) {
+      wait = waits_[i];
+      break;
+    }
+  }
+  if (wait == NULL) {
+    wait = new Scheduler::Wait;
+    wait->loop = NULL;
+    wait->fd = fd;
+    wait->pending.store(0, std::memory_order_relaxed);
+    wait->next_retired = NULL;
+    if (free_index < 0) {
+      if (waits_size_ == waits_capacity_) {
+        waits_capacity_ = (waits_capacity_ == 0) ? 8 : waits_capacity_ * 2;
+        waits_ = reinterpret_cast<Scheduler::Wait**>(
+            realloc(waits_, waits_capacity_ * sizeof(waits_[0])));
+        if (waits_ == NULL) {
+          FATAL("Failed to grow waits");
+        }
+      }
+      free_index = waits_size_++;
+    }
+    waits_[free_index] = wait;
+    open_waits_++;
+  }
+  scheduler_->AwaitSignal(this, wait, signals);
+  return fd;
+}
+
+void ScheduledMessageLoop::CancelSignalWait(intptr_t wait_id) {
+  for (intptr_t i = 0; i < waits_size_; i++) {
+    if ((waits_[i] != NULL) && (waits_[i]->fd == wait_id)) {
+      scheduler_->CancelWait(waits_[i]);
+      waits_[i] = NULL;
+      open_waits_--;
+      return;
+    }
+  }
+}
+
+void ScheduledMessageLoop::MessageEpilogue(int64_t new_wakeup) {
+  if (new_wakeup != wakeup_) {
+    wakeup_ = new_wakeup;
+    scheduler_->SetWakeup(this, new_wakeup);
+  }
+
+  if ((open_ports_ == 0) && (open_waits_ == 0) && (wakeup_ == 0)) {
+    Exit(0);
+  }
+}
+
+void ScheduledMessageLoop::Exit(intptr_t exit_code) {
+  exit_code_ = exit_code;
+  isolate_ = NULL;
+}
+
+void ScheduledMessageLoop::PostMessage(IsolateMessage* message) {
+  if (queue_.Post(message)) {
+    scheduler_->Schedule(this);
+  }
+}
+
+void ScheduledMessageLoop::Nudge() {
+  if (!nudged_.exchange(true, std::memory_order_acq_rel)) {
+    if (queue_.Post(&nudge_)) {
+      scheduler_->Schedule(this);
+    }
+  }
+}
+
+IsolateMessage* ScheduledMessageLoop::TakeMessages() {
+  IsolateMessage* messages = queue_.TakeAll();
+  if (nudged_.load(std::memory_order_acquire)) {
+    IsolateMessage** link = &messages;
+    while (*link != NULL) {
+      if (*link == &nudge_) {
+        *link = nudge_.next_;
+        nudge_.next_ = NULL;
+        nudged_.store(false, std::memory_order_release);
+        break;
+      }
+      link = &(*link)->next_;
+    }
+  }
+  return messages;
+}
+
+intptr_t ScheduledMessageLoop::Run() {
+  UNREACHABLE();
+  return 0;
+}
+
+void ScheduledMessageLoop::RunTurn() {
+  owner_->MakeCurrent();
+  if (Yielded()) {
+    isolate_->Resume();
+  }
+  // What a yield leaves undispatched waits for the turn that resumes it:
+  // signals stay pending, the wakeup due and the messages queued.
+  if ((isolate_ != NULL) && !Yielded()) {
+    for (intptr_t i = 0; (i < waits_size_) && !Yielded(); i++) {
+      Scheduler::Wait* wait = waits_[i];
+      if (wait == NULL) {
+        continue;
+      }
+      intptr_t signals = wait->pending.exchange(0, std::memory_order_relaxed);
+      if (signals != 0) {
+        DispatchSignal(wait->fd, 0, signals, 0);
+      }
+    }
+    if (!Yielded() && (wakeup_ != 0) &&
+        (OS::CurrentMonotonicNanos() >= wakeup_)) {
+      wakeup_ = 0;  // Taken off the scheduler's timers by expiring.
+      DispatchWakeup();
+    }
+    if (!Yielded()) {
+      pending_ = DispatchMessages(TakeMessages());
+    }
+  }
+  if (isolate_ == NULL) {
+    Finish();
+    return;
+  }
+  Isolate::ClearCurrent();
+
+  // A signal seen after the turn went past its wait, while the nudge the turn
+  // then took was queued, posted no nudge of its own.
+  //
+  // Once the queue is marked as waiting, the next post may queue this loop on
+  // another worker, so nothing of it may be touched after.
+  if (pending_ || Yielded() || HasPendingSignals() ||
+      !queue_.PrepareToWait()) {
+    scheduler_->Schedule(this);
+  }
+}
+
+bool ScheduledMessageLoop::HasPendingSignals() const {
+  for (intptr_t i = 0; i < waits_size_; i++) {
+    Scheduler::Wait* wait = waits_[i];
+    if ((wait != NULL) &&
+        (wait->pending.load(std::memory_order_relaxed) != 0)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ScheduledMessageLoop::Finish() {
+  if (open_ports_ > 0) {
+    PortMap::CloseAllPorts(this);
+  }
+  // After this only an interrupt may still nudge the loop.
+  scheduler_->Retire(this);
+  DiscardMessages(TakeMessages());
+
+  Scheduler* scheduler = scheduler_;
+  intptr_t exit_code = exit_code_;
+  delete owner_;  // And with it this loop.
+  scheduler->Exited(exit_code);
+}
+
+void ScheduledMessageLoop::Interrupt() {
+  Exit(SIGINT);
+  Nudge();
+}
+
+}  // namespace psoup
+
+#endif  // defined(OS_ANDROID) || defined(OS_LINUX)
@@ -0,0 +1,196 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_SCHEDULER_H_
+#define VM_SCHEDULER_H_
+
+#include "vm/globals.h"
+
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+
+#include <atomic>
+
+#include "vm/message_loop.h"
+#include "vm/thread.h"
+
+namespace psoup {
+
+class ScheduledMessageLoop;
+class ThreadPool;
+
+// Runs the turns of many isolates on a few worker threads. Each worker takes
+// turns from its own queue and, when that is empty, steals from the others'.
+// An isolate with nothing to do holds no thread: it is queued again when a
+// message is posted to it, or when the scheduler's poller thread sees one of
+// its fds become ready or its timer expire.
+class Scheduler {
+ public:
+  // A unit of work for a worker, such as one turn of an isolate.
+  class Task {
+   public:
+    virtual ~Task() {}
+    virtual void RunTurn() = 0;
+
+   protected:
+    Task() : next_(NULL) {}
+
+   private:
+    friend class Scheduler;
+    Task* next_;
+
+    DISALLOW_COPY_AND_ASSIGN(Task);
+  };
+
+  // Borrows workers + 1 threads from the pool until deleted. With cpus, as
+  // for OS::SetThreadAffinity, the workers run only there. On hosts with
+  // several NUMA nodes, each worker keeps to one, and they are spread over
+  // the nodes.
+  Scheduler(ThreadPool* pool, intptr_t workers, const char* cpus);
+  // Waits for every isolate started to exit.
+  ~Scheduler();
+
+  // Queues the task that creates an isolate, which is then counted until its
+  // loop calls Exited. With a node of 0 or more, on a worker on that node.
+  void Start(Task* task, intptr_t numa_node);
+  void Exited(intptr_t exit_code);
+
+  // Queues a task not already queued. A running task may queue itself once
+  // nothing more of it is touched in its turn.
+  void Schedule(Task* task);
+
+ private:
+  friend class ScheduledMessageLoop;
+
+  // An fd awaited by a loop. Freed by the poller, which may still be holding
+  // it when the wait is cancelled.
+  struct Wait {
+    ScheduledMessageLoop* loop;  // NULL once cancelled.
+    intptr_t fd;
+    std::atomic<intptr_t> pending;  // Signals seen since the loop's last turn.
+    Wait* next_retired;
+  };
+
+  // A queue of turns, oldest first, which the other workers steal from when
+  // their own are empty, first those on the same NUMA node.
+  struct Worker {
+    Scheduler* scheduler;
+    Mutex mutex;
+    Task* head;
+    Task* tail;
+    intptr_t length;
+    Task* running;
+    std::atomic<intptr_t> numa_node;  // -1 until the worker has started.
+  };
+
+  class WorkerTask;
+  class PollerTask;
+
+  void Push(Worker* worker, Task* task);
+  void WorkerLoop(Worker* worker);
+  static Task* TakeFrom(Worker* worker);
+  Task* Take(Worker* worker);
+  void PollerLoop();
+  void ThreadExited();
+
+  // Adds a wait, or changes the signals of one the loop already has.
+  void AwaitSignal(ScheduledMessageLoop* loop, Wait* wait, intptr_t signals);
+  void CancelWait(Wait* wait);
+  // A wakeup of 0 removes the loop's timer.
+  void SetWakeup(ScheduledMessageLoop* loop, int64_t wakeup);
+  // Cancels the timer and waits of a loop that has exited.
+  void Retire(ScheduledMessageLoop* loop);
+
+  void CancelWaitLocked(Wait* wait);
+  void RemoveTimerLocked(ScheduledMessageLoop* loop);
+  void ExpireTimersLocked(int64_t now);
+  void ArmTimerLocked();
+  void SiftUp(intptr_t index);
+  void SiftDown(intptr_t index);
+
+  Worker* workers_;
+  intptr_t num_workers_;
+  char* cpus_;
+  std::atomic<uintptr_t> next_worker_;  // For tasks queued by other threads.
+  std::atomic<intptr_t> idle_;  // Changed with idle_monitor_ held.
+  Monitor idle_monitor_;
+  bool shutting_down_;  // With idle_monitor_ held.
+
+  Monitor exit_monitor_;
+  intptr_t live_;  // Isolates started and not yet exited.
+  intptr_t threads_;  // Workers and the poller still running.
+
+  // The poller's, and with mutex_ held, the loops' timers and waits.
+  Mutex mutex_;
+  int epoll_fd_;
+  int timer_fd_;
+  int stop_fd_;
+  int64_t armed_;
+  ScheduledMessageLoop** timers_;  // A binary heap by deadline.
+  intptr_t timers_size_;
+  intptr_t timers_capacity_;
+  Wait* retired_;
+
+  static thread_local Worker* current_worker_;
+
+  DISALLOW_COPY_AND_ASSIGN(Scheduler);
+};
+
+// The loop of an isolate run by a Scheduler. Its turns are those of the other
+// loops, less the wait: when its queue is empty it marks it as waiting and
+// returns the worker, and whoever next posts to it queues it again.
+class ScheduledMessageLoop : public MessageLoop, public Scheduler::Task {
+ public:
+  ScheduledMessageLoop(Isolate* isolate, Scheduler* scheduler);
+  ~ScheduledMessageLoop();
+
+  void PostMessage(IsolateMessage* message);
+  intptr_t AwaitSignal(intptr_t handle, intptr_t signals);
+  void CancelSignalWait(intptr_t wait_id);
+  void MessageEpilogue(int64_t new_wakeup);
+  void Exit(intptr_t exit_code);
+
+  // Turns are run by the scheduler instead.
+  intptr_t Run();
+  void Interrupt();
+  // A turn that yields is queued again behind the loops waiting for its
+  // worker, and resumed before the loop's next messages.
+  bool CanYield() const { return true; }
+
+  void RunTurn();
+
+ private:
+  friend class Scheduler;
+
+  // Has a turn run soon, for something outside the queue.
+  void Nudge();
+  IsolateMessage* TakeMessages();
+  // Whether some wait has signals its turn has not dispatched.
+  bool HasPendingSignals() const;
+  void Finish();
+
+  Isolate* owner_;  // isolate_ is cleared by Exit.
+  Scheduler* scheduler_;
+  MessageQueue queue_;
+  IsolateMessage nudge_;  // Posted at most once until taken.
+  std::atomic<bool> nudged_;
+  bool pending_;  // Messages left for the next turn.
+  int64_t wakeup_;
+  // By index, so a signal's handler may add or cancel waits while the turn
+  // goes through them. Cancelled ones leave a NULL.
+  Scheduler::Wait** waits_;
+  intptr_t waits_size_;
+  intptr_t waits_capacity_;
+
+  // The scheduler's, with its mutex_ held.
+  intptr_t timer_index_;  // In the heap, or -1.
+  int64_t timer_deadline_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScheduledMessageLoop);
+};
+
+}  // namespace psoup
+
+#endif  // defined(OS_ANDROID) || defined(OS_LINUX)
+
+#endif  // VM_SCHEDULER_H_
@@ -4,10 +4,16 @@
 
 #include "vm/snapshot.h"
 
+#include <string.h>
+
 #include "vm/heap.h"
 #include "vm/interpreter.h"
+#include "vm/lockers.h"
+#include "vm/log.h"
 #include "vm/object.h"
 #include "vm/os.h"
+#include "vm/thread.h"
+#include "vm/thread_pool.h"
 
 namespace psoup {
 
@@ -18,33 +24,47 @@ class Cluster {
   virtual ~Cluster() {}
 
   virtual void ReadNodes(Deserializer* d, Heap* h) = 0;
+  // May run in parallel with other clusters' edges.
   virtual void ReadEdges(Deserializer* d, Heap* h) = 0;
+  // Runs in order once all the edges are read.
+  virtual void FinishEdges(Deserializer* d, Heap* h) {}
 
  protected:
+  // Messages are read into a running heap.
+  static Heap::Allocator AllocatorOf(Deserializer* d) {
+    return d->is_message() ? Heap::kMessage : Heap::kSnapshot;
+  }
+
   intptr_t ref_start_;
   intptr_t ref_stop_;
 };
 
 class RegularObjectCluster : public Cluster {
  public:
-  explicit RegularObjectCluster(intptr_t format) : format_(format), cid_(0) {}
+  explicit RegularObjectCluster(intptr_t format)
+      : format_(format), cid_(0), cls_(nullptr) {}
   ~RegularObjectCluster() {}
 
   void ReadNodes(Deserializer* d, Heap* h) {
     intptr_t num_objects = d->ReadUnsigned();
-    cid_ = h->AllocateClassId();
+    if (d->is_message()) {
+      // The instances take the id of their class once it is known, which
+      // nothing sees before.
+      cid_ = kFirstRegularObjectCid;
+    } else {
+      cid_ = h->AllocateClassId();
+    }
     ref_start_ = d->next_ref();
     ref_stop_ = ref_start_ + num_objects;
     for (intptr_t i = 0; i < num_objects; i++) {
-      Object object = h->AllocateRegularObject(cid_, format_, Heap::kSnapshot);
+      Object object = h->AllocateRegularObject(cid_, format_, AllocatorOf(d));
       d->RegisterRef(object);
     }
     ASSERT(d->next_ref() == ref_stop_);
   }
 
   void ReadEdges(Deserializer* d, Heap* h) {
-    Object cls = d->ReadRef();
-    h->RegisterClass(cid_, static_cast<Behavior>(cls));
+    cls_ = static_cast<Behavior>(d->ReadRef());
 
     for (intptr_t i = ref_start_; i < ref_stop_; i++) {
       RegularObject object = static_cast<RegularObject>(d->Ref(i));
@@ -54,9 +74,25 @@ class RegularObjectCluster : public Cluster {
     }
   }
 
+  void FinishEdges(Deserializer* d, Heap* h) {
+    if (!d->is_message()) {
+      h->RegisterClass(cid_, cls_);
+      return;
+    }
+    SmallInteger id = cls_->id();
+    if (!id->IsSmallInteger()) {
+      id = SmallInteger::New(h->AllocateClassId());
+      h->RegisterClass(id->value(), cls_);
+    }
+    for (intptr_t i = ref_start_; i < ref_stop_; i++) {
+      static_cast<HeapObject>(d->Ref(i))->set_cid(id->value());
+    }
+  }
+
  private:
   intptr_t format_;
   intptr_t cid_;
+  Behavior cls_;
 };
 
 class ByteArrayCluster : public Cluster {
@@ -70,10 +106,8 @@ class ByteArrayCluster : public Cluster {
     ref_stop_ = ref_start_ + num_objects;
     for (intptr_t i = 0; i < num_objects; i++) {
       intptr_t size = d->ReadUnsigned();
-      ByteArray object = h->AllocateByteArray(size, Heap::kSnapshot);
-      for (intptr_t j = 0; j < size; j++) {
-        object->set_element(j, d->ReadUint8());
-      }
+      ByteArray object = h->AllocateByteArray(size, AllocatorOf(d));
+      d->ReadBytes(object->element_addr(0), size);
       d->RegisterRef(object);
       ASSERT(object->IsByteArray());
     }
@@ -99,12 +133,15 @@ class StringCluster : public Cluster {
     ref_stop_ = ref_start_ + num_objects;
     for (intptr_t i = 0; i < num_objects; i++) {
       intptr_t size = d->ReadUnsigned();
-      String object = h->AllocateString(size, Heap::kSnapshot);
+      if (is_canonical && d->is_message()) {
+        d->Skip(size);
+        d->RegisterRef(d->NextSymbol());
+        continue;
+      }
+      String object = h->AllocateString(size, AllocatorOf(d));
       ASSERT(!object->is_canonical());
       object->set_is_canonical(is_canonical);
-      for (intptr_t j = 0; j < size; j++) {
-        object->set_element(j, d->ReadUint8());
-      }
+      d->ReadBytes(object->element_addr(0), size);
       d->RegisterRef(object);
     }
     ASSERT(d->next_ref() == ref_stop_);
@@ -113,6 +150,36 @@ class StringCluster : public Cluster {
   void ReadEdges(Deserializer* d, Heap* h) {}
 };
 
+// Strings that are rarely read, such as method sources. Each is a SmallInteger
+// locating it in the snapshot until Method>>source first asks for it, unless
+// the snapshot is a temporary copy or a message.
+class DeferredStringCluster : public Cluster {
+ public:
+  DeferredStringCluster() {}
+  ~DeferredStringCluster() {}
+
+  void ReadNodes(Deserializer* d, Heap* h) {
+    intptr_t num_objects = d->ReadUnsigned();
+    ref_start_ = d->next_ref();
+    ref_stop_ = ref_start_ + num_objects;
+    for (intptr_t i = 0; i < num_objects; i++) {
+      intptr_t offset = d->position();
+      intptr_t size = d->ReadUint32();
+      if (d->is_inflated() || d->is_message()) {
+        String object = h->AllocateString(size, AllocatorOf(d));
+        d->ReadBytes(object->element_addr(0), size);
+        d->RegisterRef(object);
+      } else {
+        d->Skip(size);
+        d->RegisterRef(SmallInteger::New(offset));
+      }
+    }
+    ASSERT(d->next_ref() == ref_stop_);
+  }
+
+  void ReadEdges(Deserializer* d, Heap* h) {}
+};
+
 class ArrayCluster : public Cluster {
  public:
   ArrayCluster() {}
@@ -124,7 +191,7 @@ class ArrayCluster : public Cluster {
     ref_stop_ = ref_start_ + num_objects;
     for (intptr_t i = 0; i < num_objects; i++) {
       intptr_t size = d->ReadUnsigned();
-      Array object = h->AllocateArray(size, Heap::kSnapshot);
+      Array object = h->AllocateArray(size, AllocatorOf(d));
       d->RegisterRef(object);
     }
     ASSERT(d->next_ref() == ref_stop_);
@@ -152,7 +219,7 @@ class WeakArrayCluster : public Cluster {
     ref_stop_ = ref_start_ + num_objects;
     for (intptr_t i = 0; i < num_objects; i++) {
       intptr_t size = d->ReadUnsigned();
-      WeakArray object = h->AllocateWeakArray(size, Heap::kSnapshot);
+      WeakArray object = h->AllocateWeakArray(size, AllocatorOf(d));
       d->RegisterRef(object);
     }
     ASSERT(d->next_ref() == ref_stop_);
@@ -180,7 +247,7 @@ class ClosureCluster : public Cluster {
     ref_stop_ = ref_start_ + num_objects;
     for (intptr_t i = 0; i < num_objects; i++) {
       intptr_t size = d->ReadUint16();
-      Closure object = h->AllocateClosure(size, Heap::kSnapshot);
+      Closure object = h->AllocateClosure(size, AllocatorOf(d));
       d->RegisterRef(object);
     }
     ASSERT(d->next_ref() == ref_stop_);
@@ -192,6 +259,9 @@ class ClosureCluster : public Cluster {
 
       object->set_defining_activation(Activation::Cast(d->ReadRef()),
                                       kNoBarrier);
+      // Snapshots hold closures with their defining activation, for which the
+      // receiver is unused, and nil is not known yet.
+      object->set_receiver(SmallInteger::New(0), kNoBarrier);
       object->set_initial_bci(static_cast<SmallInteger>(d->ReadRef()));
       object->set_num_args(static_cast<SmallInteger>(d->ReadRef()));
 
@@ -214,7 +284,7 @@ class ActivationCluster : public Cluster {
     ref_start_ = d->next_ref();
     ref_stop_ = ref_start_ + num_objects;
     for (intptr_t i = 0; i < num_objects; i++) {
-      Activation object = h->AllocateActivation(Heap::kSnapshot);
+      Activation object = h->AllocateActivation(AllocatorOf(d));
       d->RegisterRef(object);
     }
     ASSERT(d->next_ref() == ref_stop_);
@@ -260,7 +330,7 @@ class SmallIntegerCluster : public Cluster {
         ASSERT(object->IsSmallInteger());
         d->RegisterRef(object);
       } else {
-        MediumInteger object = h->AllocateMediumInteger(Heap::kSnapshot);
+        MediumInteger object = h->AllocateMediumInteger(AllocatorOf(d));
         object->set_value(value);
         d->RegisterRef(object);
       }
@@ -274,7 +344,7 @@ class SmallIntegerCluster : public Cluster {
       intptr_t digits = (bytes + (sizeof(digit_t) - 1)) / sizeof(digit_t);
       intptr_t full_digits = bytes / sizeof(digit_t);
 
-      LargeInteger object = h->AllocateLargeInteger(digits, Heap::kSnapshot);
+      LargeInteger object = h->AllocateLargeInteger(digits, AllocatorOf(d));
       object->set_negative(negative);
       object->set_size(digits);
 
@@ -307,24 +377,128 @@ class SmallIntegerCluster : public Cluster {
   void ReadEdges(Deserializer* d, Heap* h) {}
 };
 
+class Float64Cluster : public Cluster {
+ public:
+  Float64Cluster() {}
+  ~Float64Cluster() {}
+
+  void ReadNodes(Deserializer* d, Heap* h) {
+    intptr_t num_objects = d->ReadUnsigned();
+    ref_start_ = d->next_ref();
+    ref_stop_ = ref_start_ + num_objects;
+    for (intptr_t i = 0; i < num_objects; i++) {
+      int64_t bits = d->ReadInt64();
+      double value;
+      memcpy(&value, &bits, sizeof(value));
+      Float64 object = h->AllocateFloat64(AllocatorOf(d));
+      object->set_value(value);
+      d->RegisterRef(object);
+    }
+    ASSERT(d->next_ref() == ref_stop_);
+  }
+
+  void ReadEdges(Deserializer* d, Heap* h) {}
+};
+
+class EdgesTask : public ThreadPool::Task {
+ public:
+  EdgesTask(const Deserializer* parent, intptr_t first, intptr_t last,
+            Monitor* monitor, intptr_t* num_tasks)
+      : parent_(parent), first_(first), last_(last),
+        monitor_(monitor), num_tasks_(num_tasks) {}
+
+  virtual void Run();
+
+ private:
+  const Deserializer* parent_;
+  intptr_t first_;
+  intptr_t last_;
+  Monitor* monitor_;
+  intptr_t* num_tasks_;
+
+  DISALLOW_COPY_AND_ASSIGN(EdgesTask);
+};
+
 Deserializer::Deserializer(Heap* heap, void* snapshot, size_t snapshot_length) :
+  parent_(NULL),
   snapshot_(reinterpret_cast<const uint8_t*>(snapshot)),
   snapshot_length_(snapshot_length),
   cursor_(snapshot_),
+  inflated_(NULL),
   heap_(heap),
+  num_clusters_(0),
   clusters_(NULL),
+  edges_start_(NULL),
+  edges_end_(NULL),
   refs_(NULL),
-  next_ref_(0) {
+  next_ref_(0),
+  symbols_(nullptr),
+  next_symbol_(0) {
+}
+
+
+Deserializer::Deserializer(const Deserializer* parent) :
+  parent_(parent),
+  snapshot_(parent->snapshot_),
+  snapshot_length_(parent->snapshot_length_),
+  cursor_(NULL),
+  inflated_(NULL),
+  heap_(parent->heap_),
+  num_clusters_(parent->num_clusters_),
+  clusters_(parent->clusters_),
+  edges_start_(parent->edges_start_),
+  edges_end_(parent->edges_end_),
+  refs_(parent->refs_),
+  next_ref_(parent->next_ref_),
+  symbols_(parent->symbols_),
+  next_symbol_(0) {
 }
 
 
 Deserializer::~Deserializer() {
+  if (parent_ != NULL) {
+    return;
+  }
+
   for (intptr_t i = 0; i < num_clusters_; i++) {
     delete clusters_[i];
   }
 
   delete[] clusters_;
+  delete[] edges_start_;
+  delete[] edges_end_;
   delete[] refs_;
+  delete[] inflated_;
+}
+
+
+void EdgesTask::Run() {
+  Deserializer d(parent_);
+  d.ReadEdges(first_, last_);
+
+  MonitorLocker ml(monitor_);
+  (*num_tasks_)--;
+  ml.NotifyAll();
+}
+
+
+bool Deserializer::IsSnapshot(const void* snapshot, size_t snapshot_length) {
+  const uint8_t* cursor = reinterpret_cast<const uint8_t*>(snapshot);
+  const uint8_t* end = cursor + snapshot_length;
+  if ((end - cursor >= 2) &&
+      (cursor[0] == static_cast<uint8_t>('#')) &&
+      (cursor[1] == static_cast<uint8_t>('!'))) {
+    while ((cursor < end) && (*cursor++ != static_cast<uint8_t>('\n'))) {}
+  }
+  Deserializer header(NULL, const_cast<uint8_t*>(cursor), end - cursor);
+  if (end - cursor < 4) {
+    return false;
+  }
+  uint16_t magic = header.ReadUint16();
+  if (magic == kCompressedMagic) {
+    return true;  // The version is in the compressed bytes.
+  }
+  return (magic == 0x1984) && (header.ReadUint16() == kSnapshotVersion);
 }
 
 
@@ -339,16 +513,22 @@ void Deserializer::Deserialize() {
   }
 
   uint16_t magic = ReadUint16();
+  if (magic == kCompressedMagic) {
+    Inflate();
+    magic = ReadUint16();
+  }
   if (magic != 0x1984) {
     FATAL("Wrong magic value");
   }
   uint16_t version = ReadUint16();
-  if (version != 0) {
+  if (version != kSnapshotVersion) {
     FATAL1("Wrong version (%d)", version);
   }
 
   num_clusters_ = ReadUint16();
   clusters_ = new Cluster*[num_clusters_];
+  edges_start_ = new const uint8_t*[num_clusters_];
+  edges_end_ = new const uint8_t*[num_clusters_];
 
   intptr_t num_nodes = ReadUint32();
   refs_ = new Object[num_nodes + 1];  // Refs are 1-origin.
@@ -360,8 +540,30 @@ void Deserializer::Deserialize() {
     c->ReadNodes(this, heap_);
   }
   ASSERT((next_ref_ - 1) == num_nodes);
+
+  // Each cluster's edges follow their length, so they can be found without
+  // reading the edges before them.
+  const uint8_t* edges = cursor_;
   for (intptr_t i = 0; i < num_clusters_; i++) {
-    clusters_[i]->ReadEdges(this, heap_);
+    intptr_t length = ReadUint32();
+    edges_start_[i] = cursor_;
+    cursor_ += length;
+    edges_end_[i] = cursor_;
+    ASSERT(position() <= snapshot_length_);
+  }
+  intptr_t num_workers = (cursor_ - edges) / kMinParallelEdgesSize;
+  if (num_workers > heap_->scavenger_workers()) {
+    num_workers = heap_->scavenger_workers();
+  }
+  if (num_workers > 1) {
+    ReadEdgesInParallel(num_workers);
+  } else {
+    const uint8_t* root = cursor_;
+    ReadEdges(0, num_clusters_);
+    cursor_ = root;
+  }
+  for (intptr_t i = 0; i < num_clusters_; i++) {
+    clusters_[i]->FinishEdges(this, heap_);
   }
 
   ObjectStore os = static_cast<ObjectStore>(ReadRef());
@@ -383,15 +585,15 @@ void Deserializer::Deserialize() {
 
   int64_t stop = OS::CurrentMonotonicNanos();
   intptr_t time = stop - start;
-  if (TRACE_GROWTH) {
-    OS::PrintErr("Deserialized %" Pd "kB snapshot "
-                 "into %" Pd "kB heap "
-                 "with %" Pd " objects "
-                 "in %" Pd " us\n",
-                 snapshot_length_ / KB,
-                 heap_->Size() / KB,
-                 next_ref_ - 1,
-                 time / kNanosecondsPerMicrosecond);
+  if (FLAG_trace_growth) {
+    Log::Print("trace_growth", "Deserialized %" Pd "kB snapshot "
+               "into %" Pd "kB heap "
+               "with %" Pd " objects "
+               "in %" Pd " us",
+               snapshot_length_ / KB,
+               heap_->Size() / KB,
+               next_ref_ - 1,
+               time / kNanosecondsPerMicrosecond);
   }
 
 #if defined(DEBUG)
@@ -403,11 +605,318 @@ void Deserializer::Deserialize() {
 }
 
 
+bool Deserializer::DeserializeMessage(Array shared, Array symbols,
+                                      Object* result) {
+  // Checked before anything is allocated, since what is cannot be taken back.
+  {
+    Deserializer probe(heap_, const_cast<uint8_t*>(snapshot_),
+                       snapshot_length_);
+    if (!probe.SkipToMessageSymbols() ||
+        (probe.ReadUnsigned() != symbols->Size())) {
+      return false;
+    }
+  }
+  ReadUint16();  // Magic.
+  ReadUint16();  // Version.
+  num_clusters_ = ReadUint16();
+  intptr_t num_nodes = ReadUint32();
+  if (num_nodes < shared->Size()) {
+    return false;
+  }
+  clusters_ = new Cluster*[num_clusters_];
+  refs_ = new Object[num_nodes + 1];  // Refs are 1-origin.
+  next_ref_ = 1;
+  symbols_ = symbols;
+  next_symbol_ = 0;
+
+  for (intptr_t i = 0; i < shared->Size(); i++) {
+    RegisterRef(shared->element(i));
+  }
+  intptr_t first_new_ref = next_ref_;
+
+  // Nothing may move until the last class is registered: allocation is
+  // Heap::kMessage throughout, and allocating class ids does not collect.
+  heap_->ReserveClassIds(num_clusters_);
+
+  for (intptr_t i = 0; i < num_clusters_; i++) {
+    Cluster* c = ReadCluster();
+    clusters_[i] = c;
+    c->ReadNodes(this, heap_);
+  }
+  ASSERT((next_ref_ - 1) == num_nodes);
+  for (intptr_t i = 0; i < num_clusters_; i++) {
+    clusters_[i]->ReadEdges(this, heap_);
+  }
+  for (intptr_t i = 0; i < num_clusters_; i++) {
+    clusters_[i]->FinishEdges(this, heap_);
+  }
+  *result = ReadRef();
+  ASSERT(next_symbol_ == symbols->Size());
+
+  // The objects read are all old and were filled without barriers. Only the
+  // shared objects and symbols might be new.
+  bool refers_to_new = false;
+  for (intptr_t i = 0; i < shared->Size(); i++) {
+    refers_to_new = refers_to_new || shared->element(i)->IsNewObject();
+  }
+  for (intptr_t i = 0; i < symbols->Size(); i++) {
+    refers_to_new = refers_to_new || symbols->element(i)->IsNewObject();
+  }
+  if (refers_to_new) {
+    for (intptr_t i = first_new_ref; i < next_ref_; i++) {
+      Object object = refs_[i];
+      if (object->IsHeapObject() &&
+          !static_cast<HeapObject>(object)->is_remembered()) {
+        heap_->AddToRememberedSet(static_cast<HeapObject>(object));
+      }
+    }
+  }
+  return true;
+}
+
+
+Array Deserializer::MessageSymbols(Heap* heap, const void* message,
+                                   size_t length) {
+  Deserializer d(heap, const_cast<void*>(message), length);
+  if (!d.SkipToMessageSymbols()) {
+    return nullptr;
+  }
+  // Allocated without collecting, so the message stays put.
+  intptr_t num_symbols = d.ReadUnsigned();
+  Array symbols = heap->AllocateArray(num_symbols, Heap::kMessage);
+  for (intptr_t i = 0; i < num_symbols; i++) {
+    intptr_t size = d.ReadUnsigned();
+    String symbol = heap->AllocateString(size, Heap::kMessage);
+    d.ReadBytes(symbol->element_addr(0), size);
+    symbols->set_element(i, symbol, kNoBarrier);
+  }
+  return symbols;
+}
+
+
+// Messages written by Serializer::SerializeMessage start with their strings,
+// the noncanonical ones first.
+bool Deserializer::SkipToMessageSymbols() {
+  static const intptr_t kHeaderSize = 14;  // Through the first format.
+  if (snapshot_length_ < kHeaderSize) {
+    return false;
+  }
+  if ((ReadUint16() != 0x1984) || (ReadUint16() != kMessageVersion)) {
+    return false;
+  }
+  intptr_t num_clusters = ReadUint16();
+  ReadUint32();  // Nodes.
+  if ((num_clusters == 0) || (ReadInt32() != -kStringCid)) {
+    return false;
+  }
+  intptr_t num_strings = ReadUnsigned();
+  for (intptr_t i = 0; i < num_strings; i++) {
+    Skip(ReadUnsigned());
+  }
+  return true;
+}
+
+
+Object Deserializer::NextSymbol() {
+  if (next_symbol_ >= symbols_->Size()) {
+    FATAL("Message has more canonical strings than it starts with");
+  }
+  return symbols_->element(next_symbol_++);
+}
+
+
+void Deserializer::Inflate() {
+  intptr_t length = ReadUint32();
+  const uint8_t* in = cursor_;
+  const uint8_t* in_end = snapshot_ + snapshot_length_;
+  inflated_ = new uint8_t[length];
+  uint8_t* out = inflated_;
+  uint8_t* out_end = inflated_ + length;
+
+  // Each sequence is a token with the lengths of a run of literals and of a
+  // match, the literals, and the offset back to the match. The last has only
+  // literals. A length of 15 in the token continues in bytes after it.
+  for (;;) {
+    if (in >= in_end) {
+      FATAL("Truncated compressed snapshot");
+    }
+    uint8_t token = *in++;
+    intptr_t literals = token >> 4;
+    if (literals == 15) {
+      uint8_t b;
+      do {
+        if (in >= in_end) {
+          FATAL("Truncated compressed snapshot");
+        }
+        b = *in++;
+        literals += b;
+      } while (b == 255);
+    }
+    if ((literals > in_end - in) || (literals > out_end - out)) {
+      FATAL("Corrupt compressed snapshot");
+    }
+    memcpy(out, in, literals);
+    in += literals;
+    out += literals;
+    if (in == in_end) {
+      break;
+    }
+
+    if (in_end - in < 2) {
+      FATAL("Truncated compressed snapshot");
+    }
+    intptr_t offset = in[0] | (in[1] << 8);
+    in += 2;
+    intptr_t match = (token & 15) + 4;
+    if ((token & 15) == 15) {
+      uint8_t b;
+      do {
+        if (in >= in_end) {
+          FATAL("Truncated compressed snapshot");
+        }
+        b = *in++;
+        match += b;
+      } while (b == 255);
+    }
+    if ((offset == 0) || (offset > out - inflated_) ||
+        (match > out_end - out)) {
+      FATAL("Corrupt compressed snapshot");
+    }
+    const uint8_t* from = out - offset;
+    if (offset >= match) {
+      memcpy(out, from, match);
+      out += match;
+    } else {
+      // Overlapping: repeats the last offset bytes.
+      for (intptr_t i = 0; i < match; i++) {
+        *out++ = *from++;
+      }
+    }
+  }
+  if (out != out_end) {
+    FATAL("Corrupt compressed snapshot");
+  }
+
+  snapshot_ = inflated_;
+  snapshot_length_ = length;
+  cursor_ = inflated_;
+}
+
+
+void Deserializer::ReadEdges(intptr_t first, intptr_t last) {
+  for (intptr_t i = first; i < last; i++) {
+    cursor_ = edges_start_[i];
+    clusters_[i]->ReadEdges(this, heap_);
+    ASSERT(cursor_ == edges_end_[i]);
+  }
+}
+
+
+void Deserializer::ReadEdgesInParallel(intptr_t num_workers) {
+  // Give each worker a run of clusters with about the same size of edges.
+  // This thread reads the first.
+  intptr_t edges_size = edges_end_[num_clusters_ - 1] - edges_start_[0];
+  intptr_t bounds[Heap::kMaxScavengerWorkers + 1];
+  bounds[0] = 0;
+  intptr_t cluster = 0;
+  for (intptr_t i = 1; i < num_workers; i++) {
+    const uint8_t* limit = edges_start_[0] + edges_size / num_workers * i;
+    while ((cluster < num_clusters_) && (edges_end_[cluster] <= limit)) {
+      cluster++;
+    }
+    bounds[i] = cluster;
+  }
+  bounds[num_workers] = num_clusters_;
+
+  Monitor monitor;
+  intptr_t num_tasks = 0;
+  for (intptr_t i = 1; i < num_workers; i++) {
+    if (bounds[i] == bounds[i + 1]) {
+      continue;
+    }
+    EdgesTask* task = new EdgesTask(this, bounds[i], bounds[i + 1],
+                                    &monitor, &num_tasks);
+    {
+      MonitorLocker ml(&monitor);
+      num_tasks++;
+    }
+    if (!heap_->thread_pool()->Run(task)) {
+      // Shutting down: read them here.
+      delete task;
+      {
+        MonitorLocker ml(&monitor);
+        num_tasks--;
+      }
+      Deserializer d(this);
+      d.ReadEdges(bounds[i], bounds[i + 1]);
+    }
+  }
+
+  Deserializer d(this);
+  d.ReadEdges(bounds[0], bounds[1]);
+
+  MonitorLocker ml(&monitor);
+  while (num_tasks > 0) {
+    ml.Wait();
+  }
+}
+
+
 uint8_t Deserializer::ReadUint8() {
   return *cursor_++;
 }
 
 
+void Deserializer::ReadBytes(uint8_t* bytes, intptr_t length) {
+  ASSERT(position() + length <= snapshot_length_);
+  memcpy(bytes, cursor_, length);
+  cursor_ += length;
+}
+
+
+void Deserializer::Skip(intptr_t length) {
+  if (length > snapshot_length_ - position()) {
+    FATAL("Truncated snapshot");
+  }
+  cursor_ += length;
+}
+
+
+const uint8_t* Deserializer::FindDeferredString(const void* snapshot,
+                                                size_t snapshot_length,
+                                                intptr_t offset,
+                                                intptr_t* size) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(snapshot);
+  intptr_t length = snapshot_length;
+  if ((offset <= 0) || (offset > length - 4)) {
+    return nullptr;
+  }
+  intptr_t result = (static_cast<intptr_t>(bytes[offset]) << 24) |
+                    (static_cast<intptr_t>(bytes[offset + 1]) << 16) |
+                    (static_cast<intptr_t>(bytes[offset + 2]) << 8) |
+                    static_cast<intptr_t>(bytes[offset + 3]);
+  if (result > length - 4 - offset) {
+    return nullptr;
+  }
+  *size = result;
+  return &bytes[offset + 4];
+}
+
+
+String Deserializer::DeferredString(Heap* heap, const void* snapshot,
+                                    size_t snapshot_length, intptr_t offset) {
+  intptr_t size;
+  const uint8_t* bytes =
+      FindDeferredString(snapshot, snapshot_length, offset, &size);
+  if (bytes == nullptr) {
+    return nullptr;
+  }
+  String result = heap->AllocateString(size);  // SAFEPOINT
+  memcpy(result->element_addr(0), bytes, size);
+  return result;
+}
+
+
 uint16_t Deserializer::ReadUint16() {
   int16_t result = ReadUint8();
   result = (result << 8) | ReadUint8();
@@ -445,19 +954,11 @@ int64_t Deserializer::ReadInt64() {
   return static_cast<int64_t>(result);
 }
 
-static const int8_t kDataBitsPerByte = 7;
-static const int8_t kByteMask = (1 << kDataBitsPerByte) - 1;
-static const int8_t kMaxUnsignedDataPerByte = kByteMask;
-static const uint8_t kEndUnsignedByteMarker = (255 - kMaxUnsignedDataPerByte);
-
-intptr_t Deserializer::ReadUnsigned() {
+intptr_t Deserializer::ReadUnsignedSlow() {
   const uint8_t* c = cursor_;
   // ASSERT(c < end_);
   uint8_t b = *c++;
-  if (b > kMaxUnsignedDataPerByte) {
-    cursor_ = c;
-    return static_cast<uint32_t>(b) - kEndUnsignedByteMarker;
-  }
+  ASSERT(b <= kMaxUnsignedDataPerByte);
 
   int32_t r = 0;
   r |= static_cast<uint32_t>(b);
@@ -498,6 +999,8 @@ Cluster* Deserializer::ReadCluster() {
 
   if (format >= 0) {
     return new RegularObjectCluster(format);
+  } else if (format == kDeferredStringFormat) {
+    return new DeferredStringCluster();
   } else {
     switch (-format) {
       case kByteArrayCid: return new ByteArrayCluster();
@@ -507,10 +1010,1082 @@ Cluster* Deserializer::ReadCluster() {
       case kClosureCid: return new ClosureCluster();
       case kActivationCid: return new ActivationCluster();
       case kSmiCid: return new SmallIntegerCluster();
+      case kFloat64Cid: return new Float64Cluster();
     }
     FATAL1("Unknown cluster format %" Pd "\n", format);
     return NULL;
   }
 }
 
+
+// Objects in the order they were added.
+class ObjectList {
+ public:
+  ObjectList() : objects_(nullptr), size_(0), capacity_(0) {}
+  ~ObjectList() { delete[] objects_; }
+
+  intptr_t Size() const { return size_; }
+  Object At(intptr_t index) const {
+    ASSERT((index >= 0) && (index < size_));
+    return objects_[index];
+  }
+  void Add(Object object) {
+    if (size_ == capacity_) {
+      Grow();
+    }
+    objects_[size_++] = object;
+  }
+  Object RemoveLast() {
+    ASSERT(size_ > 0);
+    return objects_[--size_];
+  }
+  // Replaces the object at index with the last one.
+  void RemoveAt(intptr_t index) {
+    ASSERT((index >= 0) && (index < size_));
+    objects_[index] = objects_[--size_];
+  }
+
+ private:
+  void Grow() {
+    intptr_t capacity = (capacity_ == 0) ? 64 : capacity_ * 2;
+    Object* objects = new Object[capacity];
+    for (intptr_t i = 0; i < size_; i++) {
+      objects[i] = objects_[i];
+    }
+    delete[] objects_;
+    objects_ = objects;
+    capacity_ = capacity;
+  }
+
+  Object* objects_;
+  intptr_t size_;
+  intptr_t capacity_;
+
+  DISALLOW_COPY_AND_ASSIGN(ObjectList);
+};
+
+// The ref of each object seen, by identity. Zero is no ref.
+class RefMap {
+ public:
+  RefMap() : entries_(nullptr), capacity_(0), size_(0) {
+    Resize(1024);
+  }
+  ~RefMap() { delete[] entries_; }
+
+  intptr_t Lookup(Object key) const {
+    return entries_[IndexOf(key)].ref;
+  }
+  // Whether key was absent.
+  bool Insert(Object key, intptr_t ref) {
+    ASSERT(ref != 0);
+    Entry* entry = &entries_[IndexOf(key)];
+    if (entry->ref != 0) {
+      return false;
+    }
+    entry->key = key;
+    entry->ref = ref;
+    if (++size_ * 2 > capacity_) {
+      Resize(capacity_ * 2);
+    }
+    return true;
+  }
+  void Update(Object key, intptr_t ref) {
+    ASSERT(ref != 0);
+    Entry* entry = &entries_[IndexOf(key)];
+    ASSERT(entry->ref != 0);
+    entry->ref = ref;
+  }
+
+ private:
+  struct Entry {
+    Object key;
+    intptr_t ref;
+  };
+
+  intptr_t IndexOf(Object key) const {
+    uword mask = capacity_ - 1;
+    uword index = ((static_cast<uword>(key) >> 1) * 2654435761u) & mask;
+    while ((entries_[index].ref != 0) && (entries_[index].key != key)) {
+      index = (index + 1) & mask;
+    }
+    return index;
+  }
+
+  void Resize(intptr_t capacity) {
+    Entry* old_entries = entries_;
+    intptr_t old_capacity = capacity_;
+    entries_ = new Entry[capacity];
+    capacity_ = capacity;
+    for (intptr_t i = 0; i < capacity; i++) {
+      entries_[i].ref = 0;
+    }
+    for (intptr_t i = 0; i < old_capacity; i++) {
+      if (old_entries[i].ref != 0) {
+        entries_[IndexOf(old_entries[i].key)] = old_entries[i];
+      }
+    }
+    delete[] old_entries;
+  }
+
+  Entry* entries_;
+  intptr_t capacity_;
+  intptr_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(RefMap);
+};
+
+// The writing side of a Cluster: Trace finds an object and what it refers to,
+// then WriteNodes and WriteEdges write what the Cluster reads.
+class ClusterWriter {
+ public:
+  ClusterWriter() {}
+  virtual ~ClusterWriter() {}
+
+  virtual void Trace(Serializer* s, Object object) = 0;
+  virtual void WriteNodes(Serializer* s) = 0;
+  virtual void WriteEdges(Serializer* s) = 0;
+
+ protected:
+  ObjectList objects_;
+};
+
+class RegularObjectClusterWriter : public ClusterWriter {
+ public:
+  RegularObjectClusterWriter(Behavior cls, intptr_t format,
+                             bool is_behavior, bool is_method)
+      : cls_(cls), format_(format),
+        is_behavior_(is_behavior), is_method_(is_method) {}
+  ~RegularObjectClusterWriter() {}
+
+  void Trace(Serializer* s, Object object) {
+    objects_.Add(object);
+    RegularObject regular = static_cast<RegularObject>(object);
+    for (intptr_t i = 0; i < format_; i++) {
+      if (is_behavior_ && (i == kClassIdSlot)) {
+        continue;
+      }
+      if (is_method_ && (i == Serializer::kMethodSourceSlot) &&
+          s->DeferSource(object, regular->slot(i))) {
+        continue;
+      }
+      s->Enqueue(regular->slot(i));
+    }
+  }
+
+  void WriteNodes(Serializer* s) {
+    s->WriteInt32(format_);
+    s->WriteUnsigned(objects_.Size());
+    for (intptr_t i = 0; i < objects_.Size(); i++) {
+      s->RegisterRef(objects_.At(i));
+    }
+  }
+
+  void WriteEdges(Serializer* s) {
+    s->WriteRef(cls_);
+    for (intptr_t i = 0; i < objects_.Size(); i++) {
+      RegularObject object = static_cast<RegularObject>(objects_.At(i));
+      for (intptr_t j = 0; j < format_; j++) {
+        if (is_behavior_ && (j == kClassIdSlot)) {
+          // The deserializer gives classes new ids.
+          s->WriteRef(s->nil());
+        } else if (is_method_ && (j == Serializer::kMethodSourceSlot) &&
+                   s->IsDeferred(object)) {
+          s->WriteDeferredRef(object);
+        } else {
+          s->WriteRef(object->slot(j));
+        }
+      }
+    }
+  }
+
+ private:
+  static const intptr_t kClassIdSlot = 4;
+
+  Behavior cls_;
+  intptr_t format_;
+  bool is_behavior_;
+  bool is_method_;
+};
+
+class ByteArrayClusterWriter : public ClusterWriter {
+ public:
+  ByteArrayClusterWriter() {}
+  ~ByteArrayClusterWriter() {}
+
+  void Trace(Serializer* s, Object object) {
+    objects_.Add(object);
+  }
+
+  void WriteNodes(Serializer* s) {
+    s->WriteInt32(-kByteArrayCid);
+    s->WriteUnsigned(objects_.Size());
+    for (intptr_t i = 0; i < objects_.Size(); i++) {
+      ByteArray object = static_cast<ByteArray>(objects_.At(i));
+      s->RegisterRef(object);
+      s->WriteUnsigned(object->Size());
+      s->WriteBytes(object->element_addr(0), object->Size());
+    }
+  }
+
+  void WriteEdges(Serializer* s) {}
+};
+
+class StringClusterWriter : public ClusterWriter {
+ public:
+  StringClusterWriter() {}
+  ~StringClusterWriter() {}
+
+  void Trace(Serializer* s, Object object) {
+    if (static_cast<String>(object)->is_canonical()) {
+      canonical_.Add(object);
+    } else {
+      objects_.Add(object);
+    }
+  }
+
+  void WriteNodes(Serializer* s) {
+    s->WriteInt32(-kStringCid);
+    WriteNodes(s, &objects_);
+    WriteNodes(s, &canonical_);
+  }
+
+  void WriteNodes(Serializer* s, ObjectList* objects) {
+    s->WriteUnsigned(objects->Size());
+    for (intptr_t i = 0; i < objects->Size(); i++) {
+      String object = static_cast<String>(objects->At(i));
+      s->RegisterRef(object);
+      s->WriteUnsigned(object->Size());
+      s->WriteBytes(object->element_addr(0), object->Size());
+    }
+  }
+
+  void WriteEdges(Serializer* s) {}
+
+ private:
+  ObjectList canonical_;
+};
+
+class DeferredStringClusterWriter : public ClusterWriter {
+ public:
+  DeferredStringClusterWriter() {}
+  ~DeferredStringClusterWriter() {}
+
+  // Objects are the methods whose sources these are.
+  void Trace(Serializer* s, Object method) {
+    objects_.Add(method);
+  }
+
+  void WriteNodes(Serializer* s) {
+    // A message may go to an isolate with another snapshot, so its sources
+    // are ordinary strings.
+    if (s->is_message()) {
+      s->WriteInt32(-kStringCid);
+    } else {
+      s->WriteInt32(Serializer::kDeferredStringFormat);
+    }
+    s->WriteUnsigned(objects_.Size());
+    for (intptr_t i = 0; i < objects_.Size(); i++) {
+      Object method = objects_.At(i);
+      intptr_t size = 0;
+      const uint8_t* bytes = s->DeferredSource(method, &size);
+      s->RegisterDeferredRef(method);
+      if (s->is_message()) {
+        s->WriteUnsigned(size);
+      } else {
+        s->WriteUint32(size);
+      }
+      s->WriteBytes(bytes, size);
+    }
+    if (s->is_message()) {
+      s->WriteUnsigned(0);  // Canonical strings.
+    }
+  }
+
+  void WriteEdges(Serializer* s) {}
+};
+
+class ArrayClusterWriter : public ClusterWriter {
+ public:
+  ArrayClusterWriter() {}
+  ~ArrayClusterWriter() {}
+
+  void Trace(Serializer* s, Object object) {
+    objects_.Add(object);
+    Array array = static_cast<Array>(object);
+    for (intptr_t i = 0; i < array->Size(); i++) {
+      s->Enqueue(array->element(i));
+    }
+  }
+
+  void WriteNodes(Serializer* s) {
+    s->WriteInt32(-kArrayCid);
+    s->WriteUnsigned(objects_.Size());
+    for (intptr_t i = 0; i < objects_.Size(); i++) {
+      Array object = static_cast<Array>(objects_.At(i));
+      s->RegisterRef(object);
+      s->WriteUnsigned(object->Size());
+    }
+  }
+
+  void WriteEdges(Serializer* s) {
+    for (intptr_t i = 0; i < objects_.Size(); i++) {
+      Array object = static_cast<Array>(objects_.At(i));
+      for (intptr_t j = 0; j < object->Size(); j++) {
+        s->WriteRef(object->element(j));
+      }
+    }
+  }
+};
+
+class WeakArrayClusterWriter : public ClusterWriter {
+ public:
+  WeakArrayClusterWriter() {}
+  ~WeakArrayClusterWriter() {}
+
+  void Trace(Serializer* s, Object object) {
+    objects_.Add(object);
+    // Only immediates are held, as the collector does.
+    WeakArray array = static_cast<WeakArray>(object);
+    for (intptr_t i = 0; i < array->Size(); i++) {
+      if (array->element(i)->IsImmediateObject()) {
+        s->Enqueue(array->element(i));
+      }
+    }
+  }
+
+  void WriteNodes(Serializer* s) {
+    s->WriteInt32(-kWeakArrayCid);
+    s->WriteUnsigned(objects_.Size());
+    for (intptr_t i = 0; i < objects_.Size(); i++) {
+      WeakArray object = static_cast<WeakArray>(objects_.At(i));
+      s->RegisterRef(object);
+      s->WriteUnsigned(object->Size());
+    }
+  }
+
+  void WriteEdges(Serializer* s) {
+    for (intptr_t i = 0; i < objects_.Size(); i++) {
+      WeakArray object = static_cast<WeakArray>(objects_.At(i));
+      for (intptr_t j = 0; j < object->Size(); j++) {
+        s->WriteWeakRef(object->element(j));
+      }
+    }
+  }
+};
+
+// As the Snapshotter writes them: regular objects of three slots, whose
+// referents are kept only if the key is.
+class EphemeronClusterWriter : public ClusterWriter {
+ public:
+  explicit EphemeronClusterWriter(Behavior cls) : cls_(cls) {}
+  ~EphemeronClusterWriter() {}
+
+  void Trace(Serializer* s, Object object) {
+    objects_.Add(object);
+    s->AddEphemeron(object);
+  }
+
+  void WriteNodes(Serializer* s) {
+    s->WriteInt32(3);
+    s->WriteUnsigned(objects_.Size());
+    for (intptr_t i = 0; i < objects_.Size(); i++) {
+      s->RegisterRef(objects_.At(i));
+    }
+  }
+
+  void WriteEdges(Serializer* s) {
+    s->WriteRef(cls_);
+    for (intptr_t i = 0; i < objects_.Size(); i++) {
+      Ephemeron object = static_cast<Ephemeron>(objects_.At(i));
+      s->WriteWeakRef(object->key());
+      s->WriteWeakRef(object->value());
+      s->WriteWeakRef(object->finalizer());
+    }
+  }
+
+ private:
+  Behavior cls_;
+};
+
+class ActivationClusterWriter : public ClusterWriter {
+ public:
+  ActivationClusterWriter() {}
+  ~ActivationClusterWriter() {}
+
+  void Trace(Serializer* s, Object object) {
+    objects_.Add(object);
+    Activation activation = static_cast<Activation>(object);
+    if (IsOnStack(activation) && s->is_message()) {
+      s->Fail();  // Its receiver would see it returned from.
+    }
+    if (!IsOnStack(activation)) {
+      s->Enqueue(activation->sender());
+      s->Enqueue(activation->bci());
+    }
+    s->Enqueue(activation->method());
+    s->Enqueue(activation->closure());
+    s->Enqueue(activation->receiver());
+    intptr_t depth = IsOnStack(activation) ? 0 : activation->StackDepth();
+    for (intptr_t i = 0; i < depth; i++) {
+      s->Enqueue(activation->temp(i));
+    }
+  }
+
+  // A closure created without its defining activation gets one, as
+  // Closure_definingActivation would make it.
+  void TraceHome(Serializer* s, Closure closure) {
+    homes_.Add(closure);
+    s->Enqueue(closure->home_method());
+    s->Enqueue(closure->receiver());
+  }
+
+  void WriteNodes(Serializer* s) {
+    s->WriteInt32(-kActivationCid);
+    s->WriteUnsigned(objects_.Size() + homes_.Size());
+    for (intptr_t i = 0; i < objects_.Size(); i++) {
+      s->RegisterRef(objects_.At(i));
+    }
+    for (intptr_t i = 0; i < homes_.Size(); i++) {
+      s->RegisterHomeRef(homes_.At(i));
+    }
+  }
+
+  void WriteEdges(Serializer* s) {
+    for (intptr_t i = 0; i < objects_.Size(); i++) {
+      Activation object = static_cast<Activation>(objects_.At(i));
+      if (IsOnStack(object)) {
+        // The frame does not survive the snapshot: written as returned from.
+        s->WriteRef(s->nil());
+        s->WriteRef(s->nil());
+      } else {
+        s->WriteRef(object->sender());
+        s->WriteRef(object->bci());
+      }
+      s->WriteRef(object->method());
+      s->WriteRef(object->closure());
+      s->WriteRef(object->receiver());
+      intptr_t depth = IsOnStack(object) ? 0 : object->StackDepth();
+      s->WriteUint16(depth);
+      for (intptr_t j = 0; j < depth; j++) {
+        s->WriteRef(object->temp(j));
+      }
+    }
+    for (intptr_t i = 0; i < homes_.Size(); i++) {
+      Closure closure = static_cast<Closure>(homes_.At(i));
+      s->WriteRef(s->nil());
+      s->WriteRef(s->nil());
+      s->WriteRef(closure->home_method());
+      s->WriteRef(s->nil());
+      s->WriteRef(closure->receiver());
+      s->WriteUint16(0);
+    }
+  }
+
+ private:
+  // Whether the activation is, or was, married to a frame.
+  static bool IsOnStack(Activation activation) {
+    return activation->sender()->IsSmallInteger();
+  }
+
+  ObjectList homes_;
+};
+
+class ClosureClusterWriter : public ClusterWriter {
+ public:
+  explicit ClosureClusterWriter(ActivationClusterWriter* activations)
+      : activations_(activations) {}
+  ~ClosureClusterWriter() {}
+
+  void Trace(Serializer* s, Object object) {
+    objects_.Add(object);
+    Closure closure = static_cast<Closure>(object);
+    if (closure->HasDefiningActivation()) {
+      s->Enqueue(closure->defining_activation());
+    } else {
+      activations_->TraceHome(s, closure);
+    }
+    s->Enqueue(closure->initial_bci());
+    s->Enqueue(closure->num_args());
+    if (closure->NumCopied() > kMaxUint16) {
+      s->Fail();
+    }
+    for (intptr_t i = 0; i < closure->NumCopied(); i++) {
+      s->Enqueue(closure->copied(i));
+    }
+  }
+
+  void WriteNodes(Serializer* s) {
+    s->WriteInt32(-kClosureCid);
+    s->WriteUnsigned(objects_.Size());
+    for (intptr_t i = 0; i < objects_.Size(); i++) {
+      Closure object = static_cast<Closure>(objects_.At(i));
+      s->RegisterRef(object);
+      s->WriteUint16(object->NumCopied());
+    }
+  }
+
+  void WriteEdges(Serializer* s) {
+    for (intptr_t i = 0; i < objects_.Size(); i++) {
+      Closure object = static_cast<Closure>(objects_.At(i));
+      if (object->HasDefiningActivation()) {
+        s->WriteRef(object->defining_activation());
+      } else {
+        s->WriteHomeRef(object);
+      }
+      s->WriteRef(object->initial_bci());
+      s->WriteRef(object->num_args());
+      for (intptr_t j = 0; j < object->NumCopied(); j++) {
+        s->WriteRef(object->copied(j));
+      }
+    }
+  }
+
+ private:
+  ActivationClusterWriter* activations_;
+};
+
+class IntegerClusterWriter : public ClusterWriter {
+ public:
+  IntegerClusterWriter() {}
+  ~IntegerClusterWriter() {}
+
+  void Trace(Serializer* s, Object object) {
+    if (object->IsLargeInteger()) {
+      LargeInteger large = static_cast<LargeInteger>(object);
+      if (NumBytes(large) > kMaxUint16) {
+        s->Fail();
+      }
+      large_.Add(object);
+    } else {
+      objects_.Add(object);
+    }
+  }
+
+  void WriteNodes(Serializer* s) {
+    s->WriteInt32(-kSmiCid);
+    s->WriteUnsigned(objects_.Size());
+    for (intptr_t i = 0; i < objects_.Size(); i++) {
+      Object object = objects_.At(i);
+      s->RegisterRef(object);
+      if (object->IsSmallInteger()) {
+        s->WriteInt64(static_cast<SmallInteger>(object)->value());
+      } else {
+        s->WriteInt64(static_cast<MediumInteger>(object)->value());
+      }
+    }
+
+    s->WriteUnsigned(large_.Size());
+    for (intptr_t i = 0; i < large_.Size(); i++) {
+      LargeInteger object = static_cast<LargeInteger>(large_.At(i));
+      s->RegisterRef(object);
+      s->WriteUint8(object->negative() ? 1 : 0);
+      intptr_t bytes = NumBytes(object);
+      s->WriteUint16(bytes);
+      for (intptr_t j = 0; j < bytes; j++) {
+        digit_t digit = object->digit(j / sizeof(digit_t));
+        s->WriteUint8(digit >> ((j % sizeof(digit_t)) * kBitsPerByte));
+      }
+    }
+  }
+
+  void WriteEdges(Serializer* s) {}
+
+ private:
+  // Without leading zeros.
+  static intptr_t NumBytes(LargeInteger large) {
+    intptr_t bytes = large->size() * sizeof(digit_t);
+    while (bytes > 0) {
+      digit_t digit = large->digit((bytes - 1) / sizeof(digit_t));
+      intptr_t shift = ((bytes - 1) % sizeof(digit_t)) * kBitsPerByte;
+      if (((digit >> shift) & 0xFF) != 0) {
+        break;
+      }
+      bytes--;
+    }
+    return bytes;
+  }
+
+  ObjectList large_;
+};
+
+class Float64ClusterWriter : public ClusterWriter {
+ public:
+  Float64ClusterWriter() {}
+  ~Float64ClusterWriter() {}
+
+  void Trace(Serializer* s, Object object) {
+    objects_.Add(object);
+  }
+
+  void WriteNodes(Serializer* s) {
+    s->WriteInt32(-kFloat64Cid);
+    s->WriteUnsigned(objects_.Size());
+    for (intptr_t i = 0; i < objects_.Size(); i++) {
+      Float64 object = static_cast<Float64>(objects_.At(i));
+      s->RegisterRef(object);
+      double value = object->value();
+      int64_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      s->WriteInt64(bits);
+    }
+  }
+
+  void WriteEdges(Serializer* s) {}
+};
+
+Serializer::Serializer(Heap* heap, const void* snapshot,
+                       size_t snapshot_length) :
+  heap_(heap),
+  snapshot_(snapshot),
+  snapshot_length_(snapshot_length),
+  buffer_(nullptr),
+  size_(0),
+  capacity_(0),
+  failed_(false),
+  is_message_(false),
+  transferable_(false),
+  nil_(),
+  metaclass_(),
+  method_cid_(kIllegalCid),
+  refs_(new RefMap()),
+  home_refs_(new RefMap()),
+  deferred_refs_(new RefMap()),
+  cluster_indices_(new RefMap()),
+  stack_(new ObjectList()),
+  ephemerons_(new ObjectList()),
+  clusters_(nullptr),
+  num_clusters_(0),
+  clusters_capacity_(0),
+  integers_(nullptr),
+  floats_(nullptr),
+  byte_arrays_(nullptr),
+  strings_(nullptr),
+  deferred_strings_(nullptr),
+  arrays_(nullptr),
+  weak_arrays_(nullptr),
+  ephemeron_objects_(nullptr),
+  activations_(nullptr),
+  closures_(nullptr),
+  next_ref_(1) {
+}
+
+
+Serializer::~Serializer() {
+  for (intptr_t i = 0; i < num_clusters_; i++) {
+    delete clusters_[i];
+  }
+  free(clusters_);
+  FreeBuffer();
+  delete refs_;
+  delete home_refs_;
+  delete deferred_refs_;
+  delete cluster_indices_;
+  delete stack_;
+  delete ephemerons_;
+}
+
+
+uint8_t* Serializer::Serialize(ObjectStore root, intptr_t* length) {
+  int64_t start = OS::CurrentMonotonicNanos();
+
+  Initialize(root);
+  // As the Snapshotter does, give the most popular objects short refs.
+  Enqueue(root->nil_obj());
+  Trace(stack_->RemoveLast());
+  Enqueue(root->false_obj());
+  Trace(stack_->RemoveLast());
+  Enqueue(root->true_obj());
+  Trace(stack_->RemoveLast());
+
+  AddSpecialClusters(root);
+  uint8_t* result = Write(root, length);
+
+  int64_t stop = OS::CurrentMonotonicNanos();
+  intptr_t time = stop - start;
+  if (FLAG_trace_growth && (result != nullptr)) {
+    Log::Print("trace_growth", "Serialized %" Pd "kB heap "
+               "into %" Pd "kB snapshot "
+               "with %" Pd " objects "
+               "in %" Pd " us",
+               heap_->Size() / KB,
+               *length / KB,
+               next_ref_ - 1,
+               time / kNanosecondsPerMicrosecond);
+  }
+  return result;
+}
+
+
+uint8_t* Serializer::SerializeMessage(ObjectStore os, Object message,
+                                      Array shared, intptr_t* length,
+                                      bool* transferable) {
+  is_message_ = true;
+  for (intptr_t i = 0; i < shared->Size(); i++) {
+    if (!refs_->Insert(shared->element(i), next_ref_++)) {
+      return nullptr;
+    }
+  }
+  Initialize(os);
+  AddSpecialClusters(os);
+  uint8_t* result = Write(message, length);
+  *transferable = (result != nullptr) && transferable_;
+  if (*transferable) {
+    Heap::ShrinkTransferable(result, *length);
+    transferable_ = false;
+  }
+  return result;
+}
+
+
+void Serializer::Initialize(ObjectStore os) {
+  nil_ = os->nil_obj();
+  metaclass_ = os->Array()->Klass(heap_)->Klass(heap_);
+  if (os->Method()->id()->IsSmallInteger()) {
+    method_cid_ = os->Method()->id()->value();
+  }
+}
+
+
+void Serializer::AddSpecialClusters(ObjectStore os) {
+  // First, so the receiver of a message can intern its symbols before
+  // reading the rest.
+  strings_ = AddCluster(new StringClusterWriter());
+  integers_ = AddCluster(new IntegerClusterWriter());
+  floats_ = AddCluster(new Float64ClusterWriter());
+  byte_arrays_ = AddCluster(new ByteArrayClusterWriter());
+  arrays_ = AddCluster(new ArrayClusterWriter());
+  weak_arrays_ = AddCluster(new WeakArrayClusterWriter());
+  ephemeron_objects_ =
+      AddCluster(new EphemeronClusterWriter(os->Ephemeron()));
+  ActivationClusterWriter* activations = new ActivationClusterWriter();
+  activations_ = AddCluster(activations);
+  closures_ = AddCluster(new ClosureClusterWriter(activations));
+  deferred_strings_ = AddCluster(new DeferredStringClusterWriter());
+}
+
+
+uint8_t* Serializer::Write(Object root, intptr_t* length) {
+  Enqueue(root);
+  do {
+    while (stack_->Size() > 0) {
+      Trace(stack_->RemoveLast());
+    }
+  } while (TraceEphemerons());
+
+  if (num_clusters_ > kMaxUint16) {
+    failed_ = true;
+  }
+  if (failed_) {
+    return nullptr;
+  }
+
+  WriteUint16(0x1984);
+  WriteUint16(is_message_ ? Deserializer::kMessageVersion
+                          : Deserializer::kSnapshotVersion);
+  WriteUint16(num_clusters_);
+  intptr_t num_nodes_position = size_;
+  WriteUint32(0);
+  for (intptr_t i = 0; i < num_clusters_; i++) {
+    clusters_[i]->WriteNodes(this);
+  }
+  PatchUint32(num_nodes_position, next_ref_ - 1);
+  for (intptr_t i = 0; i < num_clusters_; i++) {
+    if (is_message_) {
+      clusters_[i]->WriteEdges(this);
+      continue;
+    }
+    intptr_t edges_position = size_;
+    WriteUint32(0);
+    clusters_[i]->WriteEdges(this);
+    PatchUint32(edges_position, size_ - edges_position - 4);
+  }
+  WriteRef(root);
+  if (failed_) {
+    return nullptr;
+  }
+
+  uint8_t* result = buffer_;
+  *length = size_;
+  buffer_ = nullptr;
+  size_ = capacity_ = 0;
+  return result;
+}
+
+
+ClusterWriter* Serializer::AddCluster(ClusterWriter* cluster) {
+  if (num_clusters_ == clusters_capacity_) {
+    clusters_capacity_ = (clusters_capacity_ == 0) ? 64 : clusters_capacity_ * 2;
+    clusters_ = reinterpret_cast<ClusterWriter**>(
+        realloc(clusters_, clusters_capacity_ * sizeof(ClusterWriter*)));
+  }
+  clusters_[num_clusters_++] = cluster;
+  return cluster;
+}
+
+
+ClusterWriter* Serializer::RegularClusterFor(intptr_t cid) {
+  SmallInteger key = SmallInteger::New(cid);
+  intptr_t index = cluster_indices_->Lookup(key);
+  if (index != 0) {
+    return clusters_[index - 1];
+  }
+
+  Behavior cls = heap_->ClassAt(cid);
+  Enqueue(cls);
+  intptr_t format = 0;
+  if (cls->format()->IsSmallInteger() && (cls->format()->value() >= 0)) {
+    format = cls->format()->value();
+  } else {
+    failed_ = true;
+  }
+  bool is_behavior = (cls == metaclass_) || (cls->Klass(heap_) == metaclass_);
+  bool is_method = cid == method_cid_;
+  ClusterWriter* cluster =
+      AddCluster(new RegularObjectClusterWriter(cls, format,
+                                                is_behavior, is_method));
+  cluster_indices_->Insert(key, num_clusters_);
+  return cluster;
+}
+
+
+void Serializer::Enqueue(Object object) {
+  if (refs_->Insert(object, kUnnumberedRef)) {
+    stack_->Add(object);
+  }
+}
+
+
+void Serializer::Trace(Object object) {
+  if (object->IsSmallInteger()) {
+    integers_->Trace(this, object);
+    return;
+  }
+  switch (object->ClassId()) {
+    case kMintCid:
+    case kBigintCid:
+      integers_->Trace(this, object);
+      return;
+    case kFloat64Cid: floats_->Trace(this, object); return;
+    case kByteArrayCid: byte_arrays_->Trace(this, object); return;
+    case kStringCid: strings_->Trace(this, object); return;
+    case kArrayCid: arrays_->Trace(this, object); return;
+    case kWeakArrayCid: weak_arrays_->Trace(this, object); return;
+    case kEphemeronCid: ephemeron_objects_->Trace(this, object); return;
+    case kActivationCid: activations_->Trace(this, object); return;
+    case kClosureCid: closures_->Trace(this, object); return;
+  }
+  ASSERT(object->IsRegularObject());
+  RegularClusterFor(object->ClassId())->Trace(this, object);
+}
+
+
+bool Serializer::TraceEphemerons() {
+  bool traced = false;
+  intptr_t i = 0;
+  while (i < ephemerons_->Size()) {
+    Ephemeron ephemeron = static_cast<Ephemeron>(ephemerons_->At(i));
+    Object key = ephemeron->key();
+    if (key->IsImmediateObject() || (refs_->Lookup(key) != 0)) {
+      Enqueue(key);
+      Enqueue(ephemeron->value());
+      Enqueue(ephemeron->finalizer());
+      ephemerons_->RemoveAt(i);
+      traced = true;
+    } else {
+      i++;
+    }
+  }
+  return traced;
+}
+
+
+void Serializer::AddEphemeron(Object ephemeron) {
+  ephemerons_->Add(ephemeron);
+}
+
+
+bool Serializer::DeferSource(Object method, Object source) {
+  if (is_message_ && !source->IsSmallInteger()) {
+    return false;
+  }
+  if (source->IsSmallInteger()) {
+    intptr_t size;
+    if (Deserializer::FindDeferredString(
+            snapshot_, snapshot_length_,
+            static_cast<SmallInteger>(source)->value(), &size) == nullptr) {
+      return false;
+    }
+  } else if (!source->IsString() ||
+             static_cast<String>(source)->is_canonical()) {
+    return false;
+  }
+  deferred_refs_->Insert(method, kUnnumberedRef);
+  deferred_strings_->Trace(this, method);
+  return true;
+}
+
+
+const uint8_t* Serializer::DeferredSource(Object method, intptr_t* size) {
+  Object source = static_cast<RegularObject>(method)->slot(kMethodSourceSlot);
+  if (source->IsSmallInteger()) {
+    return Deserializer::FindDeferredString(
+        snapshot_, snapshot_length_,
+        static_cast<SmallInteger>(source)->value(), size);
+  }
+  String string = static_cast<String>(source);
+  *size = string->Size();
+  return string->element_addr(0);
+}
+
+
+bool Serializer::IsDeferred(Object method) const {
+  return deferred_refs_->Lookup(method) != 0;
+}
+
+
+void Serializer::RegisterRef(Object object) {
+  refs_->Update(object, next_ref_++);
+}
+
+
+void Serializer::RegisterHomeRef(Object closure) {
+  home_refs_->Insert(closure, next_ref_++);
+}
+
+
+void Serializer::RegisterDeferredRef(Object method) {
+  deferred_refs_->Update(method, next_ref_++);
+}
+
+
+void Serializer::WriteRef(Object object) {
+  intptr_t ref = refs_->Lookup(object);
+  ASSERT(ref > 0);
+  WriteUnsigned(ref);
+}
+
+
+void Serializer::WriteWeakRef(Object object) {
+  intptr_t ref = refs_->Lookup(object);
+  if (ref <= 0) {
+    ref = refs_->Lookup(nil_);
+  }
+  WriteUnsigned(ref);
+}
+
+
+void Serializer::WriteHomeRef(Object closure) {
+  intptr_t ref = home_refs_->Lookup(closure);
+  ASSERT(ref > 0);
+  WriteUnsigned(ref);
+}
+
+
+void Serializer::WriteDeferredRef(Object method) {
+  intptr_t ref = deferred_refs_->Lookup(method);
+  ASSERT(ref > 0);
+  WriteUnsigned(ref);
+}
+
+
+void Serializer::WriteUint8(uint8_t value) {
+  if (size_ == capacity_) {
+    Grow(1);
+  }
+  buffer_[size_++] = value;
+}
+
+
+void Serializer::WriteUint16(uint16_t value) {
+  WriteUint8(value >> 8);
+  WriteUint8(value);
+}
+
+
+void Serializer::WriteUint32(uint32_t value) {
+  WriteUint8(value >> 24);
+  WriteUint8(value >> 16);
+  WriteUint8(value >> 8);
+  WriteUint8(value);
+}
+
+
+void Serializer::WriteInt32(int32_t value) {
+  WriteUint32(static_cast<uint32_t>(value));
+}
+
+
+void Serializer::WriteInt64(int64_t value) {
+  uint64_t bits = static_cast<uint64_t>(value);
+  WriteUint32(bits >> 32);
+  WriteUint32(bits);
+}
+
+
+void Serializer::WriteUnsigned(intptr_t value) {
+  ASSERT(value >= 0);
+  if (static_cast<uint64_t>(value) > kMaxUint32) {
+    failed_ = true;
+    return;
+  }
+  uintptr_t v = value;
+  while (v > static_cast<uintptr_t>(Deserializer::kMaxUnsignedDataPerByte)) {
+    WriteUint8(v & Deserializer::kByteMask);
+    v >>= Deserializer::kDataBitsPerByte;
+  }
+  WriteUint8(v + Deserializer::kEndUnsignedByteMarker);
+}
+
+
+void Serializer::WriteBytes(const uint8_t* bytes, intptr_t length) {
+  if (length > capacity_ - size_) {
+    Grow(length);
+  }
+  memcpy(&buffer_[size_], bytes, length);
+  size_ += length;
+}
+
+
+void Serializer::PatchUint32(intptr_t position, uint32_t value) {
+  ASSERT(position + 4 <= size_);
+  buffer_[position] = value >> 24;
+  buffer_[position + 1] = value >> 16;
+  buffer_[position + 2] = value >> 8;
+  buffer_[position + 3] = value;
+}
+
+
+void Serializer::Grow(intptr_t needed) {
+  intptr_t capacity = capacity_ * 2;
+  if (capacity_ == 0) {
+    capacity = is_message_ ? 256 : 64 * KB;
+  }
+  while (capacity - size_ < needed) {
+    capacity *= 2;
+  }
+  // A large message is written where the receiver's heap can take it.
+  if (is_message_ && (capacity >= Heap::kMinGrownTransferable)) {
+    uint8_t* buffer = Heap::AllocateTransferable(capacity);
+    memcpy(buffer, buffer_, size_);
+    FreeBuffer();
+    buffer_ = buffer;
+    transferable_ = true;
+    capacity_ = capacity;
+    return;
+  }
+  buffer_ = reinterpret_cast<uint8_t*>(realloc(buffer_, capacity));
+  if (buffer_ == nullptr) {
+    FATAL("Failed to allocate snapshot buffer");
+  }
+  capacity_ = capacity;
+}
+
+void Serializer::FreeBuffer() {
+  if (transferable_) {
+    Heap::FreeTransferable(buffer_);
+  } else {
+    free(buffer_);
+  }
+}
+
 }  // namespace psoup
@@ -12,8 +12,12 @@
 namespace psoup {
 
 class Cluster;
+class ClusterWriter;
+class EdgesTask;
 class Heap;
 class Object;
+class ObjectList;
+class RefMap;
 
 // Reads a variant of VictoryFuel.
 class Deserializer : public ValueObject {
@@ -27,13 +31,48 @@ class Deserializer : public ValueObject {
   uint32_t ReadUint32();
   int32_t ReadInt32();
   int64_t ReadInt64();
-  intptr_t ReadUnsigned();
+  void ReadBytes(uint8_t* bytes, intptr_t length);
+  void Skip(intptr_t length);
+  intptr_t ReadUnsigned() {
+    // Most counts and refs fit in the one-byte form.
+    uint8_t b = *cursor_;
+    if (b > kMaxUnsignedDataPerByte) {
+      cursor_++;
+      return static_cast<uint32_t>(b) - kEndUnsignedByteMarker;
+    }
+    return ReadUnsignedSlow();
+  }
 
   void Deserialize();
+  // Whether the bytes start as a snapshot of this version does, before
+  // reading the rest.
+  static bool IsSnapshot(const void* snapshot, size_t snapshot_length);
+  // Reads a message, as Serializer::SerializeMessage writes them, into the
+  // running heap. Its first refs are the objects of shared, and its canonical
+  // strings are those of symbols, which the kernel interned from
+  // MessageSymbols. False if the message is not one this reads.
+  bool DeserializeMessage(Array shared, Array symbols, Object* result);
+  // New strings for the canonical strings of a message, for the kernel to
+  // intern, or nullptr if the message does not start with them.
+  static Array MessageSymbols(Heap* heap, const void* message, size_t length);
 
   Cluster* ReadCluster();
+  void ReadEdges(intptr_t first, intptr_t last);
 
   intptr_t next_ref() const { return next_ref_; }
+  bool is_message() const { return symbols_ != nullptr; }
+  Object NextSymbol();
+  // Whether the snapshot read is a copy that goes away with the deserializer.
+  bool is_inflated() const { return inflated_ != NULL; }
+
+  // A string a DeferredStringCluster left at offset in snapshot, or nullptr if
+  // there cannot be one there.
+  static String DeferredString(Heap* heap, const void* snapshot,
+                               size_t snapshot_length, intptr_t offset);
+  // The bytes of that string, and their number in size, without copying them.
+  static const uint8_t* FindDeferredString(const void* snapshot,
+                                           size_t snapshot_length,
+                                           intptr_t offset, intptr_t* size);
 
   void RegisterRef(Object object) {
     refs_[next_ref_++] = object;
@@ -48,17 +87,169 @@ class Deserializer : public ValueObject {
   }
 
  private:
-  const uint8_t* const snapshot_;
-  const intptr_t snapshot_length_;
+  friend class EdgesTask;
+  friend class Serializer;
+
+  static const int8_t kDataBitsPerByte = 7;
+  static const int8_t kByteMask = (1 << kDataBitsPerByte) - 1;
+  static const int8_t kMaxUnsignedDataPerByte = kByteMask;
+  static const uint8_t kEndUnsignedByteMarker = (255 - kMaxUnsignedDataPerByte);
+
+  // Compressed snapshots start with this instead, then the length of the
+  // snapshot and the snapshot as an LZ4 block.
+  static const uint16_t kCompressedMagic = 0x4C5A;
+
+  // Messages leave out the lengths of the edges, as the Newspeak Serializer
+  // does.
+  static const uint16_t kSnapshotVersion = 1;
+  static const uint16_t kMessageVersion = 0;
+
+  // Not minus any class id.
+  static const intptr_t kDeferredStringFormat = -64;
+
+  // Below this much per worker, the edges are not worth spreading out.
+  static const intptr_t kMinParallelEdgesSize = 128 * KB;
+
+  // Shares the clusters and refs of parent, to read some of its edges.
+  explicit Deserializer(const Deserializer* parent);
+
+  intptr_t ReadUnsignedSlow();
+  void ReadEdgesInParallel(intptr_t num_workers);
+  void Inflate();
+  bool SkipToMessageSymbols();
+
+  const Deserializer* const parent_;
+
+  const uint8_t* snapshot_;
+  intptr_t snapshot_length_;
   const uint8_t* cursor_;
+  // The snapshot decompressed, if it was compressed.
+  uint8_t* inflated_;
 
   Heap* const heap_;
 
   intptr_t num_clusters_;
   Cluster** clusters_;
+  // Where each cluster's edges are.
+  const uint8_t** edges_start_;
+  const uint8_t** edges_end_;
 
   Object* refs_;
   intptr_t next_ref_;
+
+  // Of a message.
+  Array symbols_;
+  intptr_t next_symbol_;
+};
+
+// Writes what Deserializer reads from the live heap, so a running isolate can
+// be started again with the state it has reached. Activations on the stack are
+// written as returned from. Nothing is allocated meanwhile, so objects stay put.
+class Serializer : public ValueObject {
+ public:
+  // Method sources still left in snapshot are copied from there.
+  Serializer(Heap* heap, const void* snapshot, size_t snapshot_length);
+  ~Serializer();
+
+  // The snapshot, in a buffer for the caller to free, or nullptr if the heap
+  // holds something the format cannot.
+  uint8_t* Serialize(ObjectStore root, intptr_t* length);
+  // As a message to an isolate that already knows the objects of shared, or
+  // nullptr if it holds something messages cannot, such as an activation
+  // still running. A large message is written into a buffer from
+  // Heap::AllocateTransferable, which *transferable then says.
+  uint8_t* SerializeMessage(ObjectStore os, Object message, Array shared,
+                            intptr_t* length, bool* transferable);
+
+  // For the clusters.
+  static const intptr_t kMethodSourceSlot = 5;
+  static const intptr_t kDeferredStringFormat =
+      Deserializer::kDeferredStringFormat;
+
+  Object nil() const { return nil_; }
+  bool is_message() const { return is_message_; }
+  void Fail() { failed_ = true; }
+  void Enqueue(Object object);
+  void AddEphemeron(Object ephemeron);
+  // Whether the source of method goes to the DeferredStringCluster.
+  bool DeferSource(Object method, Object source);
+  const uint8_t* DeferredSource(Object method, intptr_t* size);
+  bool IsDeferred(Object method) const;
+
+  void RegisterRef(Object object);
+  void RegisterHomeRef(Object closure);
+  void RegisterDeferredRef(Object method);
+  void WriteRef(Object object);
+  void WriteWeakRef(Object object);
+  void WriteHomeRef(Object closure);
+  void WriteDeferredRef(Object method);
+
+  void WriteUint8(uint8_t value);
+  void WriteUint16(uint16_t value);
+  void WriteUint32(uint32_t value);
+  void WriteInt32(int32_t value);
+  void WriteInt64(int64_t value);
+  void WriteUnsigned(intptr_t value);
+  void WriteBytes(const uint8_t* bytes, intptr_t length);
+
+ private:
+  // Seen, but not yet written.
+  static const intptr_t kUnnumberedRef = -1;
+
+  void Initialize(ObjectStore os);
+  void AddSpecialClusters(ObjectStore os);
+  uint8_t* Write(Object root, intptr_t* length);
+  ClusterWriter* AddCluster(ClusterWriter* cluster);
+  ClusterWriter* RegularClusterFor(intptr_t cid);
+  void Trace(Object object);
+  bool TraceEphemerons();
+  void PatchUint32(intptr_t position, uint32_t value);
+  void Grow(intptr_t needed);
+  void FreeBuffer();
+
+  Heap* const heap_;
+  const void* const snapshot_;
+  const size_t snapshot_length_;
+
+  uint8_t* buffer_;
+  intptr_t size_;
+  intptr_t capacity_;
+  bool failed_;
+  bool is_message_;
+  bool transferable_;  // The buffer is from Heap::AllocateTransferable.
+
+  Object nil_;
+  Object metaclass_;
+  intptr_t method_cid_;
+
+  RefMap* refs_;
+  // Refs of the activations written for closures without them, and of the
+  // sources written for methods, by closure and method.
+  RefMap* home_refs_;
+  RefMap* deferred_refs_;
+  // One more than the index of each class id's cluster.
+  RefMap* cluster_indices_;
+  ObjectList* stack_;
+  // Those whose keys are not yet known to be written.
+  ObjectList* ephemerons_;
+
+  ClusterWriter** clusters_;
+  intptr_t num_clusters_;
+  intptr_t clusters_capacity_;
+  ClusterWriter* integers_;
+  ClusterWriter* floats_;
+  ClusterWriter* byte_arrays_;
+  ClusterWriter* strings_;
+  ClusterWriter* deferred_strings_;
+  ClusterWriter* arrays_;
+  ClusterWriter* weak_arrays_;
+  ClusterWriter* ephemeron_objects_;
+  ClusterWriter* activations_;
+  ClusterWriter* closures_;
+
+  intptr_t next_ref_;
+
+  DISALLOW_COPY_AND_ASSIGN(Serializer);
 };
 
 }  // namespace psoup
@@ -44,6 +44,9 @@ class Thread : public AllStatic {
   static ThreadId ThreadIdFromIntPtr(intptr_t id);
   static bool Compare(ThreadId a, ThreadId b);
 
+  // Lets another thread run on this processor, for spin-waiting.
+  static void YieldTimeslice();
+
   // This function can be called only once per Thread, and should only be
   // called when the returned id will eventually be passed to Thread::Join().
   static ThreadJoinId GetCurrentThreadJoinId();
@@ -10,10 +10,52 @@
 #endif
 
 #include "vm/assert.h"
+#include "vm/flags.h"
 #include "vm/globals.h"
 
+#if EMSCRIPTEN_THREADS
+#include <pthread.h>
+#endif
+
 namespace psoup {
 
+#if EMSCRIPTEN_THREADS
+typedef pthread_t ThreadId;
+typedef pthread_t ThreadJoinId;
+
+class MutexData {
+ private:
+  MutexData() {}
+  ~MutexData() {}
+
+  pthread_mutex_t* mutex() { return &mutex_; }
+
+  pthread_mutex_t mutex_;
+
+  friend class Mutex;
+
+  DISALLOW_ALLOCATION();
+  DISALLOW_COPY_AND_ASSIGN(MutexData);
+};
+
+
+class MonitorData {
+ private:
+  MonitorData() {}
+  ~MonitorData() {}
+
+  pthread_mutex_t* mutex() { return &mutex_; }
+  pthread_cond_t* cond() { return &cond_; }
+
+  pthread_mutex_t mutex_;
+  pthread_cond_t cond_;
+
+  friend class Monitor;
+
+  DISALLOW_ALLOCATION();
+  DISALLOW_COPY_AND_ASSIGN(MonitorData);
+};
+#else  // !EMSCRIPTEN_THREADS
 typedef intptr_t ThreadId;
 typedef intptr_t ThreadJoinId;
 
@@ -39,6 +81,7 @@ class MonitorData {
   DISALLOW_ALLOCATION();
   DISALLOW_COPY_AND_ASSIGN(MonitorData);
 };
+#endif  // EMSCRIPTEN_THREADS
 
 }  // namespace psoup
 
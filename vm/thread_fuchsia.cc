@@ -146,6 +146,11 @@ bool Thread::Compare(ThreadId a, ThreadId b) {
 }
 
 
+void Thread::YieldTimeslice() {
+  zx_nanosleep(0);
+}
+
+
 Mutex::Mutex() {
   pthread_mutexattr_t attr;
   int result = pthread_mutexattr_init(&attr);
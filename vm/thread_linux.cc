@@ -8,6 +8,7 @@
 #include "vm/thread.h"
 
 #include <errno.h>         // NOLINT
+#include <sched.h>         // NOLINT
 #include <sys/resource.h>  // NOLINT
 #include <sys/syscall.h>   // NOLINT
 #include <sys/time.h>      // NOLINT
@@ -153,6 +154,11 @@ bool Thread::Compare(ThreadId a, ThreadId b) {
 }
 
 
+void Thread::YieldTimeslice() {
+  sched_yield();
+}
+
+
 Mutex::Mutex() {
   pthread_mutexattr_t attr;
   int result = pthread_mutexattr_init(&attr);
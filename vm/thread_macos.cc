@@ -7,6 +7,7 @@
 
 #include "vm/thread.h"
 
+#include <sched.h>             // NOLINT
 #include <sys/errno.h>         // NOLINT
 #include <sys/types.h>         // NOLINT
 #include <sys/sysctl.h>        // NOLINT
@@ -160,6 +161,11 @@ bool Thread::Compare(ThreadId a, ThreadId b) {
 }
 
 
+void Thread::YieldTimeslice() {
+  sched_yield();
+}
+
+
 Mutex::Mutex() {
   pthread_mutexattr_t attr;
   int result = pthread_mutexattr_init(&attr);
@@ -18,6 +18,15 @@ ThreadPool::ThreadPool()
       count_stopped_(0),
       count_running_(0),
       count_idle_(0),
+      max_queued_(0),
+      min_idle_(0),
+      count_queued_running_(0),
+      queue_head_(NULL),
+      queue_tail_(NULL),
+      count_waiting_(0),
+      count_queued_(0),
+      queue_latency_(0),
+      max_queue_latency_(0),
       shutting_down_workers_(NULL),
       join_list_(NULL) {}
 
@@ -37,35 +46,171 @@ bool ThreadPool::Run(Task* task) {
     if (shutting_down_) {
       return false;
     }
-    if (idle_workers_ == NULL) {
-      worker = new Worker(this);
-      ASSERT(worker != NULL);
-      new_worker = true;
-      count_started_++;
-
-      // Add worker to the all_workers_ list.
-      worker->all_next_ = all_workers_;
-      all_workers_ = worker;
-      worker->owned_ = true;
-      count_running_++;
-    } else {
-      // Get the first worker from the idle worker list.
-      worker = idle_workers_;
-      idle_workers_ = worker->idle_next_;
-      worker->idle_next_ = NULL;
-      count_idle_--;
-      count_running_++;
-    }
+    worker = TakeWorkerLocked(&new_worker);
+    worker->queued_ = false;
   }
 
   // Release ThreadPool::mutex_ before calling Worker functions.
+  StartTask(worker, new_worker, task);
+  return true;
+}
+
+
+bool ThreadPool::Queue(Task* task) {
+  Worker* worker = NULL;
+  bool new_worker = false;
+  {
+    MutexLocker ml(&mutex_);
+    if (shutting_down_) {
+      return false;
+    }
+    if ((max_queued_ > 0) && (count_queued_running_ >= max_queued_)) {
+      QueuedTask* queued = new QueuedTask();
+      queued->task = task;
+      queued->queued_at = OS::CurrentMonotonicNanos();
+      queued->worker = NULL;
+      queued->new_worker = false;
+      queued->next = NULL;
+      if (queue_tail_ == NULL) {
+        queue_head_ = queued;
+      } else {
+        queue_tail_->next = queued;
+      }
+      queue_tail_ = queued;
+      count_waiting_++;
+      count_queued_++;
+      return true;
+    }
+    count_queued_running_++;
+    worker = TakeWorkerLocked(&new_worker);
+    worker->queued_ = true;
+  }
+
+  StartTask(worker, new_worker, task);
+  return true;
+}
+
+
+void ThreadPool::SetLimits(intptr_t max_queued, intptr_t min_idle) {
+  // Tasks the new limit lets run, each with the worker to run it on.
+  QueuedTask* admitted = NULL;
+  {
+    MutexLocker ml(&mutex_);
+    if (shutting_down_) {
+      return;
+    }
+    max_queued_ = max_queued;
+    min_idle_ = min_idle;
+    QueuedTask** tail = &admitted;
+    while ((queue_head_ != NULL) &&
+           ((max_queued_ == 0) || (count_queued_running_ < max_queued_))) {
+      QueuedTask* queued = DequeueLocked();
+      count_queued_running_++;
+      queued->worker = TakeWorkerLocked(&queued->new_worker);
+      queued->worker->queued_ = true;
+      *tail = queued;
+      tail = &queued->next;
+    }
+  }
+
+  while (admitted != NULL) {
+    QueuedTask* queued = admitted;
+    admitted = queued->next;
+    StartTask(queued->worker, queued->new_worker, queued->task);
+    delete queued;
+  }
+}
+
+
+int64_t ThreadPool::StatisticAt(Statistic statistic) {
+  MutexLocker ml(&mutex_);
+  switch (statistic) {
+    case kWorkersRunning: return count_running_;
+    case kWorkersIdle: return count_idle_;
+    case kWorkersStarted: return count_started_;
+    case kWorkersStopped: return count_stopped_;
+    case kTasksWaiting: return count_waiting_;
+    case kTasksQueued: return count_queued_;
+    case kQueueLatency: return queue_latency_;
+    case kMaxQueueLatency: return max_queue_latency_;
+    default:
+      UNREACHABLE();
+      return 0;
+  }
+}
+
+
+ThreadPool::Worker* ThreadPool::TakeWorkerLocked(bool* new_worker) {
+  DEBUG_ASSERT(mutex_.IsOwnedByCurrentThread());
+  Worker* worker;
+  if (idle_workers_ == NULL) {
+    worker = new Worker(this);
+    ASSERT(worker != NULL);
+    *new_worker = true;
+    count_started_++;
+
+    // Add worker to the all_workers_ list.
+    worker->all_next_ = all_workers_;
+    all_workers_ = worker;
+    worker->owned_ = true;
+    count_running_++;
+  } else {
+    // Get the first worker from the idle worker list.
+    worker = idle_workers_;
+    idle_workers_ = worker->idle_next_;
+    worker->idle_next_ = NULL;
+    *new_worker = false;
+    count_idle_--;
+    count_running_++;
+  }
+  return worker;
+}
+
+
+void ThreadPool::StartTask(Worker* worker, bool new_worker, Task* task) {
   ASSERT(worker != NULL);
   worker->SetTask(task);
   if (new_worker) {
     // Call StartThread after we've assigned the first task.
     worker->StartThread();
   }
-  return true;
+}
+
+
+ThreadPool::QueuedTask* ThreadPool::DequeueLocked() {
+  DEBUG_ASSERT(mutex_.IsOwnedByCurrentThread());
+  QueuedTask* queued = queue_head_;
+  queue_head_ = queued->next;
+  if (queue_head_ == NULL) {
+    queue_tail_ = NULL;
+  }
+  queued->next = NULL;
+  count_waiting_--;
+  int64_t latency = OS::CurrentMonotonicNanos() - queued->queued_at;
+  queue_latency_ += latency;
+  if (latency > max_queue_latency_) {
+    max_queue_latency_ = latency;
+  }
+  return queued;
+}
+
+
+ThreadPool::Task* ThreadPool::TaskFinished(Worker* worker) {
+  MutexLocker ml(&mutex_);
+  if (shutting_down_ || !worker->queued_) {
+    return NULL;
+  }
+  if ((queue_head_ != NULL) &&
+      ((max_queued_ == 0) || (count_queued_running_ <= max_queued_))) {
+    // The worker's slot passes to the oldest queued task.
+    QueuedTask* queued = DequeueLocked();
+    Task* task = queued->task;
+    delete queued;
+    return task;
+  }
+  worker->queued_ = false;
+  count_queued_running_--;
+  return NULL;
 }
 
 
@@ -90,6 +235,16 @@ void ThreadPool::Shutdown() {
     count_idle_ = 0;
     count_running_ = 0;
     ASSERT(count_started_ == count_stopped_);
+
+    // Tasks still queued never run.
+    while (queue_head_ != NULL) {
+      QueuedTask* queued = queue_head_;
+      queue_head_ = queued->next;
+      delete queued->task;
+      delete queued;
+    }
+    queue_tail_ = NULL;
+    count_waiting_ = 0;
   }
   // Release ThreadPool::mutex_ before calling Worker functions.
 
@@ -248,6 +403,9 @@ bool ThreadPool::ReleaseIdleWorker(Worker* worker) {
     return false;
   }
   // Remove from idle list.
+  if (count_idle_ <= static_cast<uint64_t>(min_idle_)) {
+    return false;  // Kept warm.
+  }
   if (!RemoveWorkerFromIdleList(worker)) {
     return false;
   }
@@ -325,6 +483,7 @@ ThreadPool::Worker::Worker(ThreadPool* pool)
       id_(Thread::kInvalidThreadId),
       done_(false),
       owned_(false),
+      queued_(false),
       all_next_(NULL),
       idle_next_(NULL),
       shutdown_next_(NULL) {}
@@ -380,6 +539,10 @@ bool ThreadPool::Worker::Loop() {
       return false;
     }
     ASSERT(!done_);
+    task_ = pool_->TaskFinished(this);
+    if (task_ != NULL) {
+      continue;
+    }
     pool_->SetIdleAndReapExited(this);
     idle_start = OS::CurrentMonotonicNanos();
     while (true) {
@@ -394,8 +557,11 @@ bool ThreadPool::Worker::Loop() {
       if (IsDone()) {
         return false;
       }
-      if ((result == Monitor::kTimedOut) && pool_->ReleaseIdleWorker(this)) {
-        return true;
+      if (result == Monitor::kTimedOut) {
+        if (pool_->ReleaseIdleWorker(this)) {
+          return true;
+        }
+        idle_start = OS::CurrentMonotonicNanos();
       }
     }
   }
@@ -33,9 +33,31 @@ class ThreadPool {
   // themselves when they are active again.
   ~ThreadPool();
 
-  // Runs a task on the thread pool.
+  // Runs a task on the thread pool, starting a thread if none is idle.
   bool Run(Task* task);
 
+  // Like Run, but while the limit's worth of tasks given to Queue are
+  // running, the task waits behind the others queued until one finishes.
+  // Only for tasks that nothing holding a thread of the pool waits on.
+  bool Queue(Task* task);
+
+  // A max_queued of 0 means no limit. Idle threads are kept, however long
+  // idle, while no more than min_idle are.
+  void SetLimits(intptr_t max_queued, intptr_t min_idle);
+
+  enum Statistic {
+    kWorkersRunning = 0,
+    kWorkersIdle,
+    kWorkersStarted,
+    kWorkersStopped,
+    kTasksWaiting,  // Given to Queue and not yet running.
+    kTasksQueued,  // Given to Queue over the limit.
+    kQueueLatency,  // Total nanoseconds queued tasks waited.
+    kMaxQueueLatency,
+    kNumStatistics,
+  };
+  int64_t StatisticAt(Statistic statistic);
+
   // Some simple stats.
   uint64_t workers_running() const { return count_running_; }
   uint64_t workers_idle() const { return count_idle_; }
@@ -82,6 +104,7 @@ class ThreadPool {
     // Fields owned by ThreadPool.  Workers should not look at these
     // directly.  It's like looking at the sun.
     bool owned_;         // Protected by ThreadPool::mutex_
+    bool queued_;        // Protected by ThreadPool::mutex_
     Worker* all_next_;   // Protected by ThreadPool::mutex_
     Worker* idle_next_;  // Protected by ThreadPool::mutex_
 
@@ -109,8 +132,24 @@ class ThreadPool {
     DISALLOW_COPY_AND_ASSIGN(JoinList);
   };
 
+  // A task given to Queue over the limit.
+  struct QueuedTask {
+    Task* task;
+    int64_t queued_at;
+    Worker* worker;  // Once admitted by SetLimits.
+    bool new_worker;
+    QueuedTask* next;
+  };
+
   void Shutdown();
 
+  // Takes an idle worker, or makes one whose thread is not yet started.
+  Worker* TakeWorkerLocked(bool* new_worker);
+  void StartTask(Worker* worker, bool new_worker, Task* task);
+  QueuedTask* DequeueLocked();
+  // The next queued task for a worker that has finished one of them.
+  Task* TaskFinished(Worker* worker);
+
   // Expensive.  Use only in assertions.
   bool IsIdle(Worker* worker);
 
@@ -136,6 +175,16 @@ class ThreadPool {
   uint64_t count_running_;
   uint64_t count_idle_;
 
+  intptr_t max_queued_;
+  intptr_t min_idle_;
+  intptr_t count_queued_running_;
+  QueuedTask* queue_head_;
+  QueuedTask* queue_tail_;
+  uint64_t count_waiting_;
+  uint64_t count_queued_;
+  int64_t queue_latency_;
+  int64_t max_queue_latency_;
+
   Monitor exit_monitor_;
   Worker* shutting_down_workers_;
   JoinList* join_list_;
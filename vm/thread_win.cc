@@ -120,6 +120,11 @@ bool Thread::Compare(ThreadId a, ThreadId b) {
 }
 
 
+void Thread::YieldTimeslice() {
+  SwitchToThread();
+}
+
+
 Mutex::Mutex() {
   InitializeSRWLock(&data_.lock_);
 #if defined(DEBUG)
@@ -0,0 +1,191 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/time_quota.h"
+
+#include "vm/assert.h"
+#include "vm/interpreter.h"
+#include "vm/lockers.h"
+#include "vm/os.h"
+#include "vm/thread.h"
+#include "vm/thread_pool.h"
+
+namespace psoup {
+
+Monitor* TimeQuota::monitor_ = NULL;
+ThreadPool* TimeQuota::pool_ = NULL;
+TimeQuota* TimeQuota::limited_ = NULL;
+int64_t TimeQuota::tick_ = kMaxInt64;
+bool TimeQuota::watching_ = false;
+
+
+class TimeQuota::WatchdogTask : public ThreadPool::Task {
+ public:
+  WatchdogTask() {}
+  void Run() { TimeQuota::WatchdogLoop(); }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(WatchdogTask);
+};
+
+
+void TimeQuota::Startup(ThreadPool* pool) {
+  monitor_ = new Monitor();
+  pool_ = pool;
+}
+
+
+void TimeQuota::Shutdown() {
+  ASSERT(limited_ == NULL);
+  ASSERT(!watching_);
+  delete monitor_;
+  monitor_ = NULL;
+  pool_ = NULL;
+}
+
+
+void TimeQuota::WatchdogLoop() {
+  MonitorLocker ml(monitor_);
+  while (limited_ != NULL) {
+    // A slice that starts while the watchdog waits is seen within a tick, a
+    // fraction of its limits, and then at its deadlines. Past one, the
+    // request is repeated each tick until the interpreter polls.
+    int64_t now = OS::CurrentMonotonicNanos();
+    int64_t next = now + tick_;
+    for (TimeQuota* limit = limited_; limit != NULL; limit = limit->next_) {
+      int64_t deadline =
+          limit->slice_deadline_.load(std::memory_order_relaxed);
+      if (deadline != 0) {
+        if (deadline <= now) {
+          limit->interpreter_->RequestYield();
+        } else if (deadline < next) {
+          next = deadline;
+        }
+      }
+      deadline = limit->quota_deadline_.load(std::memory_order_relaxed);
+      if (deadline != 0) {
+        if (deadline <= now) {
+          limit->interpreter_->RequestQuotaCheck();
+        } else if (deadline < next) {
+          next = deadline;
+        }
+      }
+    }
+    ml.WaitUntilNanos(next);
+  }
+  watching_ = false;
+}
+
+
+TimeQuota::TimeQuota(Interpreter* interpreter)
+    : interpreter_(interpreter),
+      slice_(0),
+      quota_(0),
+      running_(false),
+      start_(0),
+      used_(0),
+      slice_deadline_(0),
+      quota_deadline_(0),
+      next_(NULL) {}
+
+
+TimeQuota::~TimeQuota() {
+  SetLimits(0, 0);
+}
+
+
+void TimeQuota::SetLimits(int64_t slice, int64_t quota) {
+  ASSERT(slice >= 0);
+  ASSERT(quota >= 0);
+
+  MonitorLocker ml(monitor_);
+  bool was_limited = (slice_ != 0) || (quota_ != 0);
+  bool limited = (slice != 0) || (quota != 0);
+  if (!was_limited && limited) {
+    next_ = limited_;
+    limited_ = this;
+  } else if (was_limited && !limited) {
+    TimeQuota** link = &limited_;
+    while (*link != this) {
+      link = &(*link)->next_;
+    }
+    *link = next_;
+    next_ = NULL;
+  }
+  slice_ = slice * kNanosecondsPerMicrosecond;
+  quota_ = quota * kNanosecondsPerMicrosecond;
+
+  tick_ = kMaxInt64;
+  for (TimeQuota* limit = limited_; limit != NULL; limit = limit->next_) {
+    if ((limit->slice_ != 0) && (limit->slice_ / 4 < tick_)) {
+      tick_ = limit->slice_ / 4;
+    }
+    if ((limit->quota_ != 0) && (limit->quota_ / 4 < tick_)) {
+      tick_ = limit->quota_ / 4;
+    }
+  }
+
+  used_ = 0;
+  if (running_) {
+    start_ = OS::CurrentMonotonicNanos();
+    slice_deadline_.store(slice_ == 0 ? 0 : start_ + slice_,
+                          std::memory_order_relaxed);
+    quota_deadline_.store(quota_ == 0 ? 0 : start_ + quota_,
+                          std::memory_order_relaxed);
+  }
+
+  if ((limited_ != NULL) && !watching_) {
+    watching_ = true;
+    pool_->Run(new WatchdogTask());
+  }
+  ml.Notify();  // The next tick may be sooner, or there may be none.
+}
+
+
+void TimeQuota::BeginSlice() {
+  running_ = true;
+  if ((slice_ == 0) && (quota_ == 0)) {
+    return;
+  }
+  start_ = OS::CurrentMonotonicNanos();
+  slice_deadline_.store(slice_ == 0 ? 0 : start_ + slice_,
+                        std::memory_order_relaxed);
+  quota_deadline_.store(quota_ == 0 ? 0 : start_ + quota_ - used_,
+                        std::memory_order_relaxed);
+}
+
+
+void TimeQuota::EndSlice() {
+  running_ = false;
+  if ((slice_ == 0) && (quota_ == 0)) {
+    return;
+  }
+  used_ += OS::CurrentMonotonicNanos() - start_;
+  slice_deadline_.store(0, std::memory_order_relaxed);
+  quota_deadline_.store(0, std::memory_order_relaxed);
+}
+
+
+bool TimeQuota::SliceSpent() const {
+  int64_t deadline = slice_deadline_.load(std::memory_order_relaxed);
+  return (deadline != 0) && (OS::CurrentMonotonicNanos() >= deadline);
+}
+
+
+bool TimeQuota::QuotaSpent() {
+  int64_t deadline = quota_deadline_.load(std::memory_order_relaxed);
+  if (deadline == 0) {
+    return false;
+  }
+  int64_t now = OS::CurrentMonotonicNanos();
+  if (now < deadline) {
+    return false;
+  }
+  start_ = now;
+  used_ = 0;
+  quota_deadline_.store(now + quota_, std::memory_order_relaxed);
+  return true;
+}
+
+}  // namespace psoup
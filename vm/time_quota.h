@@ -0,0 +1,85 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_TIME_QUOTA_H_
+#define VM_TIME_QUOTA_H_
+
+#include <atomic>
+
+#include "vm/globals.h"
+
+namespace psoup {
+
+class Interpreter;
+class Monitor;
+class ThreadPool;
+
+// Limits how long one interpreter's turns run. A turn runs in slices when it
+// yields its thread partway and is resumed later. While a limit is set, a
+// thread shared by all quotas watches the slices running and asks the
+// interpreter to act at its next poll once one passes a deadline: past the
+// time slice, to yield, and past the quota, counted over the turn's slices,
+// to signal TimeQuotaExceeded. A turn that goes on after that gets a fresh
+// quota. Without limits, a slice costs two stores.
+class TimeQuota {
+ public:
+  static const int64_t kMinLimit = 100;  // Microseconds.
+
+  explicit TimeQuota(Interpreter* interpreter);
+  ~TimeQuota();
+
+  static void Startup(ThreadPool* pool);
+  static void Shutdown();
+
+  // In microseconds, or 0 for no limit. If a slice is running, it is counted
+  // as starting now, with the whole quota left.
+  void SetLimits(int64_t slice, int64_t quota);
+  int64_t slice() const { return slice_ / kNanosecondsPerMicrosecond; }
+  int64_t quota() const { return quota_ / kNanosecondsPerMicrosecond; }
+
+  // For the interpreter: brackets each slice of a turn, the first after
+  // BeginTurn.
+  void BeginTurn() { used_ = 0; }
+  void BeginSlice();
+  void EndSlice();
+
+  // For the interpreter, when asked to act: whether the slice running is past
+  // its deadline, or the turn past its quota, which then starts again. A
+  // request meant for an earlier slice finds neither.
+  bool SliceSpent() const;
+  bool QuotaSpent();
+
+ private:
+  class WatchdogTask;
+  static void WatchdogLoop();
+
+  Interpreter* const interpreter_;
+
+  // Nanoseconds, or 0 for no limit. Set with monitor_ held.
+  int64_t slice_;
+  int64_t quota_;
+
+  bool running_;  // Within a slice.
+  int64_t start_;  // Of the slice running, or of its quota's restart.
+  int64_t used_;  // Of the quota, by the turn's earlier slices.
+
+  // For the watchdog: those of the slice running, or 0.
+  std::atomic<int64_t> slice_deadline_;
+  std::atomic<int64_t> quota_deadline_;
+
+  // With monitor_ held.
+  TimeQuota* next_;
+
+  static Monitor* monitor_;
+  static ThreadPool* pool_;
+  static TimeQuota* limited_;
+  static int64_t tick_;  // Nanoseconds between looks for new slices.
+  static bool watching_;  // Whether the watchdog is running.
+
+  DISALLOW_COPY_AND_ASSIGN(TimeQuota);
+};
+
+}  // namespace psoup
+
+#endif  // VM_TIME_QUOTA_H_
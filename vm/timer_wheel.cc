@@ -0,0 +1,255 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/timer_wheel.h"
+
+#include <stdlib.h>
+
+#include "vm/assert.h"
+#include "vm/utils.h"
+
+namespace psoup {
+
+static const intptr_t kInitialTimers = 64;
+
+TimerWheel::TimerWheel()
+    : nodes_(reinterpret_cast<Node*>(
+          malloc((kNumLists + kInitialTimers) * sizeof(Node)))),
+      capacity_(kNumLists + kInitialTimers),
+      size_(0),
+      current_(0),
+      sequence_(0) {
+  for (intptr_t i = 0; i < kNumLists; i++) {
+    nodes_[i].next = i;
+    nodes_[i].prev = i;
+    nodes_[i].list = i;
+  }
+  for (intptr_t i = kNumLists; i < capacity_; i++) {
+    nodes_[i].list = -1;
+  }
+  for (intptr_t level = 0; level < kLevels; level++) {
+    occupied_[level] = 0;
+  }
+}
+
+TimerWheel::~TimerWheel() {
+  free(nodes_);
+}
+
+bool TimerWheel::Grow(intptr_t id) {
+  if ((id < 0) || (id >= kMaxTimers)) {
+    return false;
+  }
+  intptr_t needed = NodeIndex(id) + 1;
+  if (needed <= capacity_) {
+    return true;
+  }
+  intptr_t capacity = capacity_ * 2;
+  if (capacity < needed) {
+    capacity = needed;
+  }
+  nodes_ = reinterpret_cast<Node*>(realloc(nodes_, capacity * sizeof(Node)));
+  if (nodes_ == NULL) {
+    FATAL("Failed to grow timer wheel");
+  }
+  for (intptr_t i = capacity_; i < capacity; i++) {
+    nodes_[i].list = -1;
+  }
+  capacity_ = capacity;
+  return true;
+}
+
+bool TimerWheel::Schedule(intptr_t id, int64_t deadline) {
+  if (!Grow(id)) {
+    return false;
+  }
+  intptr_t index = NodeIndex(id);
+  if (nodes_[index].list >= 0) {
+    Unlink(index);
+  } else {
+    size_++;
+  }
+  nodes_[index].deadline = deadline;
+  nodes_[index].sequence = sequence_++;
+  Insert(index);
+  return true;
+}
+
+void TimerWheel::Cancel(intptr_t id) {
+  if ((id < 0) || (NodeIndex(id) >= capacity_)) {
+    return;
+  }
+  intptr_t index = NodeIndex(id);
+  if (nodes_[index].list >= 0) {
+    Unlink(index);
+    size_--;
+  }
+}
+
+void TimerWheel::Link(intptr_t index, intptr_t list) {
+  intptr_t last = nodes_[list].prev;
+  nodes_[index].next = list;
+  nodes_[index].prev = last;
+  nodes_[index].list = list;
+  nodes_[last].next = index;
+  nodes_[list].prev = index;
+  if (list < kOverflowList) {
+    occupied_[list >> kLevelBits] |= static_cast<uint64_t>(1)
+        << (list & (kSlots - 1));
+  }
+}
+
+void TimerWheel::Unlink(intptr_t index) {
+  intptr_t list = nodes_[index].list;
+  ASSERT(list >= 0);
+  nodes_[nodes_[index].prev].next = nodes_[index].next;
+  nodes_[nodes_[index].next].prev = nodes_[index].prev;
+  nodes_[index].list = -1;
+  if ((list < kOverflowList) && IsEmpty(list)) {
+    occupied_[list >> kLevelBits] &= ~(static_cast<uint64_t>(1)
+        << (list & (kSlots - 1)));
+  }
+}
+
+void TimerWheel::Insert(intptr_t index) {
+  // The wheel has already turned past a deadline before current_.
+  int64_t deadline = nodes_[index].deadline;
+  if (deadline < current_) {
+    LinkDue(index);
+    return;
+  }
+  // The level is that of the highest bits the deadline has apart from the
+  // current tick, so the slot is reached by counting up to the deadline.
+  uint64_t differing = static_cast<uint64_t>(deadline ^ current_);
+  intptr_t level =
+      (differing == 0) ? 0 : Utils::HighestBit(differing) / kLevelBits;
+  if (level >= kLevels) {
+    Link(index, kOverflowList);
+    return;
+  }
+  intptr_t slot = (deadline >> (level * kLevelBits)) & (kSlots - 1);
+  Link(index, level * kSlots + slot);
+}
+
+void TimerWheel::Cascade(intptr_t list) {
+  intptr_t index = nodes_[list].next;
+  nodes_[list].next = list;
+  nodes_[list].prev = list;
+  if (list < kOverflowList) {
+    occupied_[list >> kLevelBits] &= ~(static_cast<uint64_t>(1)
+        << (list & (kSlots - 1)));
+  }
+  // Overflowing nodes may be filed back in the list they come from.
+  while (index != list) {
+    intptr_t next = nodes_[index].next;
+    nodes_[index].list = -1;
+    Insert(index);
+    index = next;
+  }
+}
+
+void TimerWheel::LinkDue(intptr_t index) {
+  // Cascades can put a later-scheduled timer first, so search from the end
+  // for the place by deadline and then sequence; usually the end is it.
+  const Node& node = nodes_[index];
+  intptr_t before = nodes_[kDueList].prev;
+  while ((before != kDueList) &&
+         ((node.deadline < nodes_[before].deadline) ||
+          ((node.deadline == nodes_[before].deadline) &&
+           (node.sequence < nodes_[before].sequence)))) {
+    before = nodes_[before].prev;
+  }
+  intptr_t after = nodes_[before].next;
+  nodes_[index].prev = before;
+  nodes_[index].next = after;
+  nodes_[index].list = kDueList;
+  nodes_[before].next = index;
+  nodes_[after].prev = index;
+}
+
+void TimerWheel::MoveToDue(intptr_t list) {
+  while (!IsEmpty(list)) {
+    intptr_t index = nodes_[list].next;
+    Unlink(index);
+    LinkDue(index);
+  }
+}
+
+int64_t TimerWheel::NextEventTick() const {
+  // A slot's tick is passed only once it is handled, but when current_ was
+  // moved on to that tick, a timer scheduled since may be on a lower level.
+  // So the earliest slot of all levels, not of the lowest, comes first.
+  int64_t next = kMaxInt64;
+  for (intptr_t level = 0; level < kLevels; level++) {
+    intptr_t shift = level * kLevelBits;
+    intptr_t current_slot = (current_ >> shift) & (kSlots - 1);
+    uint64_t slots = occupied_[level] & (~static_cast<uint64_t>(0)
+                                         << current_slot);
+    if (slots != 0) {
+      int64_t turn = current_ & ~((static_cast<int64_t>(1)
+                                   << (shift + kLevelBits)) - 1);
+      int64_t tick = turn + (static_cast<int64_t>(Utils::LowestBit(slots))
+                             << shift);
+      ASSERT(tick >= current_);
+      if (tick < next) {
+        next = tick;
+      }
+    }
+  }
+  if (!IsEmpty(kOverflowList)) {
+    int64_t tick = Utils::RoundUp(current_, static_cast<intptr_t>(1)
+                                  << (kLevels * kLevelBits));
+    if (tick < next) {
+      next = tick;
+    }
+  }
+  return next;
+}
+
+intptr_t TimerWheel::Expire(int64_t now, intptr_t* ids, intptr_t length) {
+  intptr_t count = 0;
+  for (;;) {
+    while ((count < length) && !IsEmpty(kDueList)) {
+      intptr_t index = nodes_[kDueList].next;
+      Unlink(index);
+      size_--;
+      ids[count++] = index - kNumLists;
+    }
+    if ((count == length) || (current_ > now)) {
+      return count;
+    }
+    int64_t tick = (size_ == 0) ? kMaxInt64 : NextEventTick();
+    if (tick > now) {
+      // Nothing happens up to now, so the wheel can turn straight past it.
+      current_ = now + 1;
+      return count;
+    }
+
+    current_ = tick;
+    if ((tick & ((static_cast<int64_t>(1) << (kLevels * kLevelBits)) - 1)) ==
+        0) {
+      Cascade(kOverflowList);
+    }
+    for (intptr_t level = kLevels - 1; level > 0; level--) {
+      intptr_t shift = level * kLevelBits;
+      if ((tick & ((static_cast<int64_t>(1) << shift) - 1)) == 0) {
+        Cascade(level * kSlots + ((tick >> shift) & (kSlots - 1)));
+      }
+    }
+    MoveToDue(tick & (kSlots - 1));
+    current_ = tick + 1;
+  }
+}
+
+int64_t TimerWheel::NextWakeup() const {
+  if (!IsEmpty(kDueList)) {
+    return nodes_[nodes_[kDueList].next].deadline;
+  }
+  if (size_ == 0) {
+    return 0;
+  }
+  return NextEventTick();
+}
+
+}  // namespace psoup
@@ -0,0 +1,87 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_TIMER_WHEEL_H_
+#define VM_TIMER_WHEEL_H_
+
+#include "vm/globals.h"
+
+namespace psoup {
+
+// The timers of one isolate, by the millisecond, in a hierarchical wheel: four
+// levels of 64 slots, each slot of a level spanning a whole turn of the level
+// below, and beyond them a list for deadlines more than 2^24 ms ahead.
+// Scheduling and cancelling take constant time; a timer moves down a level at
+// most four times before it expires. Timers are named by small integers chosen
+// by the caller, which keeps the objects they stand for.
+class TimerWheel {
+ public:
+  static const intptr_t kMaxTimers = 16 * MB;
+
+  TimerWheel();
+  ~TimerWheel();
+
+  intptr_t size() const { return size_; }
+
+  // Answers false if the id is out of range. A timer already scheduled is
+  // moved to the new deadline.
+  bool Schedule(intptr_t id, int64_t deadline);
+  void Cancel(intptr_t id);
+
+  // Fills ids with the timers due by now, which are no longer scheduled, by
+  // deadline and then in the order they were scheduled. Answers how many,
+  // at most length; those that did not fit are answered by the next call.
+  intptr_t Expire(int64_t now, intptr_t* ids, intptr_t length);
+
+  // When Expire next has something to do, or 0 if there are no timers. This
+  // may be before the next deadline, when timers move down a level, but is
+  // never after it, so the wakeups of timers close together are coalesced.
+  int64_t NextWakeup() const;
+
+ private:
+  static const intptr_t kLevelBits = 6;
+  static const intptr_t kSlots = 1 << kLevelBits;
+  static const intptr_t kLevels = 4;
+  static const intptr_t kOverflowList = kLevels * kSlots;
+  static const intptr_t kDueList = kOverflowList + 1;
+  static const intptr_t kNumLists = kDueList + 1;  // Each has a sentinel.
+
+  struct Node {
+    int64_t deadline;
+    uint64_t sequence;
+    int32_t next;
+    int32_t prev;
+    int32_t list;  // Or -1, when not scheduled.
+  };
+
+  static intptr_t NodeIndex(intptr_t id) { return kNumLists + id; }
+  bool Grow(intptr_t id);
+
+  void Link(intptr_t index, intptr_t list);
+  void Unlink(intptr_t index);
+  bool IsEmpty(intptr_t list) const { return nodes_[list].next == list; }
+  // Files a node in the list for its deadline, relative to current_.
+  void Insert(intptr_t index);
+  // Moves the nodes of a slot down into the levels below.
+  void Cascade(intptr_t list);
+  // Adds a node to the due list, keeping it in order.
+  void LinkDue(intptr_t index);
+  // Moves the nodes of a level 0 slot to the due list.
+  void MoveToDue(intptr_t list);
+  // The first tick at or after current_ at which a slot cascades or expires.
+  int64_t NextEventTick() const;
+
+  Node* nodes_;
+  intptr_t capacity_;  // Nodes, including the sentinels.
+  intptr_t size_;
+  int64_t current_;  // The next tick to handle.
+  uint64_t sequence_;
+  uint64_t occupied_[kLevels];  // A bit per non-empty slot.
+
+  DISALLOW_COPY_AND_ASSIGN(TimerWheel);
+};
+
+}  // namespace psoup
+
+#endif  // VM_TIMER_WHEEL_H_
@@ -42,6 +42,23 @@ class Utils {
 #endif
   }
 
+  static inline int LowestBit(uint64_t x) {
+    ASSERT(x != 0);
+#if defined(__GNUC__)
+    ASSERT(sizeof(long long) == sizeof(uint64_t));  // NOLINT
+    return __builtin_ctzll(x);
+#else
+    int r = 0;
+    if ((x & 0xFFFFFFFF) == 0) { x >>= 32; r += 32; }
+    if ((x & 0xFFFF) == 0) { x >>= 16; r += 16; }
+    if ((x & 0xFF) == 0) { x >>= 8; r += 8; }
+    if ((x & 0xF) == 0) { x >>= 4; r += 4; }
+    if ((x & 0x3) == 0) { x >>= 2; r += 2; }
+    if ((x & 0x1) == 0) r += 1;
+    return r;
+#endif
+  }
+
   static int BitLength(int64_t value) {
     // Flip bits if negative (-1 becomes 0).
     value ^= value >> (8 * sizeof(value) - 1);
@@ -5,8 +5,13 @@
 #ifndef VM_VIRTUAL_MEMORY_H_
 #define VM_VIRTUAL_MEMORY_H_
 
+#include "vm/assert.h"
 #include "vm/globals.h"
 
+#if defined(OS_FUCHSIA)
+#include <zircon/types.h>
+#endif
+
 namespace psoup {
 
 class VirtualMemory {
@@ -15,14 +20,52 @@ class VirtualMemory {
     kNoAccess,
     kReadOnly,
     kReadWrite,
+    kReadExecute,
   };
 
+  static const size_t kHugePageSize = 2 * MB;
+
   static VirtualMemory MapReadOnly(const char* filename);
   static VirtualMemory Allocate(size_t size,
                                 Protection protection,
                                 const char* name);
+  // Read-write, aligned to kHugePageSize and backed by huge pages as the
+  // system has them for the whole huge pages it spans. Answers memory of size
+  // 0 where unsupported.
+  static VirtualMemory AllocateHuge(size_t size, const char* name);
+#if defined(OS_FUCHSIA)
+  // Read-write memory of prefix bytes, a multiple of the page size, followed
+  // by size bytes of vmo from offset, rounded up to whole pages. Shared, the
+  // writes land in vmo; otherwise in a copy-on-write child of it, so reads
+  // still share its pages. Free unmaps both. Answers memory of size 0 if vmo
+  // cannot be mapped so, with *status saying why.
+  static VirtualMemory MapVmo(zx_handle_t vmo,
+                              uint64_t offset,
+                              size_t size,
+                              size_t prefix,
+                              bool shared,
+                              const char* name,
+                              zx_status_t* status);
+  static size_t PageSize();
+#endif
+  // The first size bytes, a multiple of the page size, split off to be freed
+  // apart from the rest. Only for memory from AllocateHuge.
+  VirtualMemory Split(size_t size) {
+    ASSERT(size <= size_);
+    VirtualMemory front(address_, size);
+    address_ = reinterpret_cast<void*>(base() + size);
+    size_ -= size;
+    return front;
+  }
   void Free();
   bool Protect(Protection protection);
+  // Has the pages not yet touched come from that NUMA node, while it has
+  // memory free. Answers false where unsupported.
+  bool PreferNumaNode(intptr_t node);
+  // Lets the system reclaim the whole pages between address and address +
+  // size, which then hold unspecified contents until written again. Answers
+  // false if there are none or where unsupported.
+  bool Discard(uword address, size_t size);
 
   uword base() const { return reinterpret_cast<uword>(address_); }
   uword limit() const { return base() + size(); }
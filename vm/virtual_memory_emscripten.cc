@@ -29,6 +29,11 @@ VirtualMemory VirtualMemory::Allocate(size_t size,
 }
 
 
+VirtualMemory VirtualMemory::AllocateHuge(size_t size, const char* name) {
+  return VirtualMemory();
+}
+
+
 void VirtualMemory::Free() {
   free(address_);
 }
@@ -38,6 +43,16 @@ bool VirtualMemory::Protect(Protection protection) {
   return true;
 }
 
+
+bool VirtualMemory::PreferNumaNode(intptr_t node) {
+  return false;
+}
+
+bool VirtualMemory::Discard(uword address, size_t size) {
+  return false;
+}
+
+
 }  // namespace psoup
 
 #endif  // defined(OS_EMSCRIPTEN)
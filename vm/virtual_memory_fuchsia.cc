@@ -14,6 +14,7 @@
 #include <zircon/syscalls.h>
 
 #include "vm/assert.h"
+#include "vm/utils.h"
 
 namespace psoup {
 
@@ -87,6 +88,76 @@ VirtualMemory VirtualMemory::Allocate(size_t size,
 }
 
 
+VirtualMemory VirtualMemory::AllocateHuge(size_t size, const char* name) {
+  return VirtualMemory();
+}
+
+
+size_t VirtualMemory::PageSize() {
+  return zx_system_get_page_size();
+}
+
+
+VirtualMemory VirtualMemory::MapVmo(zx_handle_t vmo,
+                                    uint64_t offset,
+                                    size_t size,
+                                    size_t prefix,
+                                    bool shared,
+                                    const char* name,
+                                    zx_status_t* status) {
+  ASSERT(Utils::IsAligned(prefix, PageSize()));
+  size_t mapped = Utils::RoundUp(size, PageSize());
+  const uint32_t prot = ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_WRITE;
+
+  // A region of our own, so the prefix and the VMO can be placed together.
+  zx_handle_t vmar = ZX_HANDLE_INVALID;
+  uintptr_t addr;
+  *status = zx_vmar_allocate(zx_vmar_root_self(),
+                             ZX_VM_CAN_MAP_READ | ZX_VM_CAN_MAP_WRITE |
+                             ZX_VM_CAN_MAP_SPECIFIC,
+                             0, prefix + mapped, &vmar, &addr);
+  if (*status != ZX_OK) {
+    return VirtualMemory();
+  }
+
+  zx_handle_t header = ZX_HANDLE_INVALID;
+  *status = zx_vmo_create(prefix, 0u, &header);
+  if (*status == ZX_OK) {
+    ASSERT(name != NULL);
+    zx_object_set_property(header, ZX_PROP_NAME, name, strlen(name));
+    uintptr_t header_addr;
+    *status = zx_vmar_map(vmar, prot | ZX_VM_SPECIFIC, 0, header, 0, prefix,
+                          &header_addr);
+    zx_handle_close(header);
+  }
+
+  zx_handle_t target = vmo;
+  if ((*status == ZX_OK) && !shared) {
+    *status = zx_vmo_create_child(vmo,
+                                  ZX_VMO_CHILD_SNAPSHOT_AT_LEAST_ON_WRITE,
+                                  offset, mapped, &target);
+    offset = 0;
+  }
+  if (*status == ZX_OK) {
+    uintptr_t bytes_addr;
+    *status = zx_vmar_map(vmar, prot | ZX_VM_SPECIFIC, prefix, target, offset,
+                          mapped, &bytes_addr);
+    if (target != vmo) {
+      zx_handle_close(target);  // The mapping keeps the child.
+    }
+  }
+
+  if (*status != ZX_OK) {
+    zx_vmar_destroy(vmar);
+    zx_handle_close(vmar);
+    return VirtualMemory();
+  }
+  // Unmapping the whole range destroys the region.
+  zx_handle_close(vmar);
+  return VirtualMemory(reinterpret_cast<void*>(addr), prefix + mapped);
+}
+
+
 void VirtualMemory::Free() {
   zx_handle_t vmar = zx_vmar_root_self();
   zx_status_t status = zx_vmar_unmap(vmar,
@@ -110,6 +181,10 @@ bool VirtualMemory::Protect(Protection protection) {
     case kReadWrite:
       prot = ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_WRITE;
       break;
+    case kReadExecute:
+      // Needs a VMO replaced as executable, which needs a resource we do not
+      // hold.
+      return false;
     default:
       UNREACHABLE();
       prot = 0;
@@ -124,6 +199,16 @@ bool VirtualMemory::Protect(Protection protection) {
   return true;
 }
 
+
+bool VirtualMemory::PreferNumaNode(intptr_t node) {
+  return false;
+}
+
+bool VirtualMemory::Discard(uword address, size_t size) {
+  return false;
+}
+
+
 }  // namespace psoup
 
 #endif  // defined(OS_FUCHSIA)
@@ -9,9 +9,15 @@
 
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#if defined(OS_LINUX)
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#endif
 
 #include "vm/assert.h"
 #include "vm/os.h"
+#include "vm/utils.h"
 
 namespace psoup {
 
@@ -46,6 +52,7 @@ VirtualMemory VirtualMemory::Allocate(size_t size,
     case kNoAccess: prot = PROT_NONE; break;
     case kReadOnly: prot = PROT_READ; break;
     case kReadWrite: prot = PROT_READ | PROT_WRITE; break;
+    case kReadExecute: prot = PROT_READ | PROT_EXEC; break;
     default:
      UNREACHABLE();
      prot = 0;
@@ -62,6 +69,38 @@ VirtualMemory VirtualMemory::Allocate(size_t size,
 }
 
 
+
+VirtualMemory VirtualMemory::AllocateHuge(size_t size, const char* name) {
+#if defined(OS_LINUX) && defined(MADV_HUGEPAGE)
+  // Transparent huge pages, since MAP_HUGETLB fails unless the administrator
+  // has reserved them. Mapped a huge page larger to trim to the alignment.
+  size_t mapped_size = size + kHugePageSize;
+  void* mapped = mmap(0, mapped_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANON,
+                      0, 0);
+  if (mapped == MAP_FAILED) {
+    return VirtualMemory();
+  }
+  uword mapped_base = reinterpret_cast<uword>(mapped);
+  uword base = Utils::RoundUp(mapped_base, kHugePageSize);
+  if (base != mapped_base) {
+    munmap(mapped, base - mapped_base);
+  }
+  uword limit = base + size;
+  if (limit != mapped_base + mapped_size) {
+    munmap(reinterpret_cast<void*>(limit), mapped_base + mapped_size - limit);
+  }
+  void* address = reinterpret_cast<void*>(base);
+  if (madvise(address, size, MADV_HUGEPAGE) != 0) {
+    munmap(address, size);
+    return VirtualMemory();
+  }
+  return VirtualMemory(address, size);
+#else
+  return VirtualMemory();
+#endif
+}
+
 void VirtualMemory::Free() {
   int result = munmap(address_, size_);
   if (result != 0) {
@@ -72,14 +111,18 @@ void VirtualMemory::Free() {
 
 bool VirtualMemory::Protect(Protection protection) {
 #if defined(__aarch64__)
-  // mprotect crashes my DragonBoard, so skip on ARM64.
-  return true;
-#else
+  // mprotect crashes my DragonBoard, so skip on ARM64. Code must still be made
+  // executable.
+  if (protection != kReadExecute) {
+    return true;
+  }
+#endif
   int prot;
   switch (protection) {
     case kNoAccess: prot = PROT_NONE; break;
     case kReadOnly: prot = PROT_READ; break;
     case kReadWrite: prot = PROT_READ | PROT_WRITE; break;
+    case kReadExecute: prot = PROT_READ | PROT_EXEC; break;
     default:
      UNREACHABLE();
      prot = 0;
@@ -87,7 +130,42 @@ bool VirtualMemory::Protect(Protection protection) {
 
   int result = mprotect(address_, size_, prot);
   return result == 0;
+}
+
+
+bool VirtualMemory::PreferNumaNode(intptr_t node) {
+#if defined(OS_LINUX)
+  // Through the system call, since libnuma may not be installed.
+  unsigned long mask = 1;  // NOLINT
+  if ((node < 0) || (node >= static_cast<intptr_t>(8 * sizeof(mask)))) {
+    return false;
+  }
+  mask <<= node;
+  long result = syscall(SYS_mbind, address_, size_, MPOL_PREFERRED,  // NOLINT
+                        &mask, 8 * sizeof(mask) + 1, 0);
+  return result == 0;
+#else
+  return false;
+#endif
+}
+
+bool VirtualMemory::Discard(uword address, size_t size) {
+  ASSERT((address >= base()) && (address + size <= limit()));
+  uword page_size = static_cast<uword>(sysconf(_SC_PAGESIZE));
+  uword start = Utils::RoundUp(address, page_size);
+  uword end = Utils::RoundDown(address + size, page_size);
+  if (start >= end) {
+    return false;
+  }
+#if defined(OS_MACOS)
+  // MADV_DONTNEED only hints there.
+  int advice = MADV_FREE;
+#else
+  // Dropped at once, rather than under pressure as with MADV_FREE, so that
+  // the resident size shows them gone.
+  int advice = MADV_DONTNEED;
 #endif
+  return madvise(reinterpret_cast<void*>(start), end - start, advice) == 0;
 }
 
 }  // namespace psoup
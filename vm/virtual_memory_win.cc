@@ -9,6 +9,7 @@
 
 #include "vm/assert.h"
 #include "vm/os.h"
+#include "vm/utils.h"
 
 namespace psoup {
 
@@ -51,6 +52,7 @@ VirtualMemory VirtualMemory::Allocate(size_t size,
     case kNoAccess: prot = PAGE_NOACCESS; break;
     case kReadOnly: prot = PAGE_READONLY; break;
     case kReadWrite: prot = PAGE_READWRITE; break;
+    case kReadExecute: prot = PAGE_EXECUTE_READ; break;
     default:
      UNREACHABLE();
      prot = 0;
@@ -65,6 +67,11 @@ VirtualMemory VirtualMemory::Allocate(size_t size,
 }
 
 
+VirtualMemory VirtualMemory::AllocateHuge(size_t size, const char* name) {
+  return VirtualMemory();
+}
+
+
 void VirtualMemory::Free() {
   if (VirtualFree(address_, 0, MEM_RELEASE) == 0) {
     FATAL1("VirtualFree failed %d", GetLastError());
@@ -78,6 +85,7 @@ bool VirtualMemory::Protect(Protection protection) {
     case kNoAccess: prot = PAGE_NOACCESS; break;
     case kReadOnly: prot = PAGE_READONLY; break;
     case kReadWrite: prot = PAGE_READWRITE; break;
+    case kReadExecute: prot = PAGE_EXECUTE_READ; break;
     default:
      UNREACHABLE();
      prot = 0;
@@ -87,6 +95,24 @@ bool VirtualMemory::Protect(Protection protection) {
   return result;
 }
 
+
+bool VirtualMemory::PreferNumaNode(intptr_t node) {
+  return false;
+}
+
+bool VirtualMemory::Discard(uword address, size_t size) {
+  ASSERT((address >= base()) && (address + size <= limit()));
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  uword start = Utils::RoundUp(address, info.dwPageSize);
+  uword end = Utils::RoundDown(address + size, info.dwPageSize);
+  if (start >= end) {
+    return false;
+  }
+  return VirtualAlloc(reinterpret_cast<void*>(start), end - start, MEM_RESET,
+                      PAGE_READWRITE) != NULL;
+}
+
 }  // namespace psoup
 
 #endif  // defined(OS_WINDOWS)